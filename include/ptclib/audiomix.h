@@ -0,0 +1,202 @@
+/*
+ * audiomix.h
+ *
+ * N-way PCM-16 audio conference mixer.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef PTLIB_AUDIOMIX_H
+#define PTLIB_AUDIOMIX_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <ptlib/syncthrd.h>
+#include <ptclib/delaychan.h>
+
+#include <map>
+#include <vector>
+
+
+/** Conference mixer for PCM-16 mono audio streams.
+
+    Each stream is written, in any size pieces, with a timestamp in samples
+    such as an RTP timestamp, into its own jitter buffer. Every frame time
+    the mixer takes one frame from each jitter buffer and gives each stream
+    the mix of all the others through OnMixed().
+
+    The frames are added once into a 32 bit total, and the mix for each
+    stream is that total less its own frame, saturated to 16 bits. So the
+    cost grows linearly with the number of streams, and the result is the
+    same as adding up all the other streams for each one.
+
+    With a limit on the number of speakers, only the loudest streams are
+    mixed, and every stream not speaking receives the same mix.
+
+    The mixer can run on its own paced thread with Start(), or the
+    application can call MixFrame() from its own timing source.
+  */
+class PAudioMixer : public PObject
+{
+  PCLASSINFO(PAudioMixer, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a mixer with no streams.
+      */
+    PAudioMixer(
+      unsigned sampleRate = 8000,   ///< Sample rate of all streams in Hz
+      unsigned frameTime = 20,      ///< Time between mixes in milliseconds
+      unsigned jitterTime = 60,     ///< Delay before playing a new stream, in milliseconds
+      PINDEX maxSpeakers = 0        ///< Loudest streams to mix, zero for all
+    );
+
+    /// Stop the mixing thread and remove all streams.
+    ~PAudioMixer();
+  //@}
+
+  /**@name Streams */
+  //@{
+    /**Add a stream, which is silent until audio is written to it.
+
+       @return false if a stream with the key already exists.
+      */
+    bool AddStream(
+      const PString & key   ///< Key identifying the stream
+    );
+
+    /**Remove a stream. This must not be called from OnMixed().
+
+       @return false if there is no stream with the key.
+      */
+    bool RemoveStream(
+      const PString & key   ///< Key identifying the stream
+    );
+
+    /// Get the number of streams.
+    PINDEX GetStreamCount() const;
+
+    /**Write audio for a stream into its jitter buffer. The first write sets
+       the frame boundaries of the stream, and its playout point jitterTime
+       behind its timestamp. Audio for frames
+       already mixed is dropped, and audio too far ahead of the playout
+       point restarts the jitter buffer at the new position.
+
+       @return false if there is no stream with the key.
+      */
+    bool WriteStream(
+      const PString & key,    ///< Key identifying the stream
+      const short * samples,  ///< PCM-16 samples
+      PINDEX count,           ///< Number of samples
+      DWORD timestamp         ///< Timestamp in samples of the first sample, wrapping at 2^32
+    );
+  //@}
+
+  /**@name Mixing */
+  //@{
+    /**Start a thread calling MixFrame() every frame time.
+      */
+    bool Start();
+
+    /// Stop the thread started by Start().
+    void Stop();
+
+    /**Take a frame from each stream and call OnMixed() for each stream.
+      */
+    void MixFrame();
+
+    /**Set the number of loudest streams that are mixed, zero for all.
+      */
+    void SetMaxSpeakers(
+      PINDEX maxSpeakers    ///< Loudest streams to mix, zero for all
+    );
+
+    /// Get the number of loudest streams that are mixed, zero for all.
+    PINDEX GetMaxSpeakers() const { return m_maxSpeakers; }
+
+    /// Get the sample rate.
+    unsigned GetSampleRate() const { return m_sampleRate; }
+
+    /// Get the number of samples in a frame.
+    PINDEX GetFrameSamples() const { return m_frameSamples; }
+  //@}
+
+  protected:
+    /**Called from MixFrame() with the mix of the other streams for a
+       stream. The mix is only valid during the call. Streams must not be
+       added or removed from this function.
+      */
+    virtual void OnMixed(
+      const PString & key,  ///< Key identifying the stream
+      const short * mix,    ///< Mix of the other streams
+      PINDEX count          ///< Number of samples, GetFrameSamples()
+    );
+
+    struct Stream {
+      Stream(const PString & key, PINDEX frameSamples, PINDEX slots);
+
+      void Write(const short * samples, PINDEX count, DWORD timestamp, PINDEX jitterFrames);
+      bool Read();
+
+      PString     m_key;
+      PMutex      m_mutex;
+      PINDEX      m_frameSamples;
+      PINDEX      m_slots;
+      std::vector<short>  m_buffer;     // jitter buffer of m_slots frames
+      std::vector<PInt64> m_slotFrame;  // frame held by each slot, or -1
+      bool        m_started;
+      DWORD       m_firstTimestamp;
+      PInt64      m_lastTimestamp;      // since the first, extended to 64 bits
+      PInt64      m_nextFrame;          // next frame to mix
+      std::vector<short> m_frame;       // frame being mixed
+      bool        m_hasAudio;
+      unsigned    m_level;              // smoothed mean absolute amplitude
+      bool        m_speaking;
+    };
+    typedef std::map<PString, Stream *> StreamMap;
+
+    void ThreadMain();
+
+    unsigned           m_sampleRate;
+    unsigned           m_frameTime;
+    PINDEX             m_frameSamples;
+    PINDEX             m_jitterFrames;
+    PINDEX             m_maxSpeakers;
+
+    StreamMap          m_streams;
+    mutable PReadWriteMutex m_streamsMutex;
+    PMutex             m_mixMutex;
+
+    std::vector<Stream *> m_speakers;
+    std::vector<int>   m_total;
+    std::vector<short> m_mix;
+    std::vector<short> m_everyone;
+
+    PThread          * m_thread;
+    bool               m_running;
+    PAdaptiveDelay     m_pacing;
+};
+
+
+#endif // PTLIB_AUDIOMIX_H
+
+// End Of File ///////////////////////////////////////////////////////////////
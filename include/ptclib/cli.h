@@ -140,6 +140,15 @@ class PCLI : public PObject
         virtual bool ProcessInput(int ch);
         virtual bool ProcessInput(const PString & line);
 
+        /**Process a block of characters read from the channel.
+           Each character is passed to ProcessInput(int).
+           Returns false if have error and processing is to cease.
+          */
+        virtual bool ProcessInput(
+          const char * data,  ///< Characters read
+          PINDEX length       ///< Number of characters
+        );
+
         /**Call back for a command line was completed and ENTER pressed.
            The default behaviour processes the line into a PArgList and deals
            with the command history and help.
@@ -599,10 +608,27 @@ class PCLIStandard : public PCLI
 /**Command Line Interpreter over TCP sockets.
    This class allows for access and automatic creation of command line
    interpreter contexts from incoming TCP connections on a listening port.
+
+   By default each connection has its own thread. In the Reactor mode a
+   single thread waits on all connections with epoll and hands what they
+   send to a fixed pool of worker threads to execute. Lines that arrive
+   before the previous command has finished are queued, so a client may
+   send several commands without waiting, and they are executed in order.
+   Output is sent without blocking where possible, the rest is buffered and
+   sent as the socket becomes writable, so a slow command or client only
+   holds up its own connection. The Reactor mode is only available on
+   Linux, elsewhere a thread per connection is used.
   */
 class PCLISocket : public PCLI
 {
   public:
+    /// How connections are serviced.
+    enum ThreadingModes {
+      ThreadPerContext,   ///< A thread reads and executes commands for each connection
+      SingleThreadForAll, ///< One thread selects on all connections and executes commands inline
+      Reactor             ///< One thread polls all connections, commands run on a worker pool
+    };
+
   /**@name Construction */
   //@{
     PCLISocket(
@@ -610,6 +636,12 @@ class PCLISocket : public PCLI
       const char * prompt = NULL,
       bool singleThreadForAll = false
     );
+    PCLISocket(
+      WORD port,
+      const char * prompt,
+      ThreadingModes mode,
+      unsigned workers = 4        ///< Number of threads executing commands in Reactor mode
+    );
     ~PCLISocket();
   //@}
 
@@ -658,8 +690,26 @@ class PCLISocket : public PCLI
     /**Get the port we are listing on.
       */
     WORD GetPort() const { return m_listenSocket.GetPort(); }
+
+    /**Get the mode used to service connections.
+      */
+    ThreadingModes GetThreadingMode() const;
+
+    /**Set the time a client may stop reading output in the Reactor mode.
+       A command producing a lot of output waits for the client to read it.
+       If the client has not caught up within this time the connection is
+       closed.
+       Default is 30 seconds.
+      */
+    void SetOutputTimeout(const PTimeInterval & timeout) { m_outputTimeout = timeout; }
+
+    /**Get the time a client may stop reading output in the Reactor mode.
+      */
+    const PTimeInterval & GetOutputTimeout() const { return m_outputTimeout; }
   //@}
 
+    class ReactorEngine;
+
   protected:
     PDECLARE_NOTIFIER(PThread, PCLISocket, ThreadMain);
     bool HandleSingleThreadForAll();
@@ -673,6 +723,11 @@ class PCLISocket : public PCLI
 
     typedef std::map<PSocket *, Context *> ContextMap_t;
     ContextMap_t m_contextBySocket;
+
+    ReactorEngine * m_reactor;
+    PTimeInterval   m_outputTimeout;
+
+  friend class ReactorEngine;
 };
 
 
@@ -690,6 +745,12 @@ class PCLITelnet : public PCLISocket
       const char * prompt = NULL,
       bool singleThreadForAll = false
     );
+    PCLITelnet(
+      WORD port,
+      const char * prompt,
+      ThreadingModes mode,
+      unsigned workers = 4        ///< Number of threads executing commands in Reactor mode
+    );
   //@}
 
   protected:
@@ -66,6 +66,20 @@
 
     if smaller blocks that fit easily in memory are to be decoded the
     <code>Decode()</code> functions can be used to everything in one go.
+
+    To avoid building intermediate strings, the encoding may be written
+    directly to a PChannel, or into a caller buffer of at least
+    <code>GetMaxEncodedLength()</code> characters:
+<pre><code>
+      PBase64 base;
+      base.StartEncoding();
+      while (Read(dataChunk))
+        base.ProcessEncoding(dataChunk, dataChunk.GetSize(), channel);
+      base.CompleteEncoding(channel);
+</code></pre>
+
+    Where the processor supports it, blocks of data are encoded and decoded
+    with SSSE3 or AVX2 vector instructions.
  */
 class PBase64 : public PObject
 {
@@ -100,6 +114,40 @@ class PBase64 : public PObject
     );
     // Incorporate the specified data into the base 64 encoding.
 
+    /** Incorporate the specified data into the base 64 encoding, writing the
+       encoded characters to a caller buffer rather than the internal string.
+       The buffer must be at least <code>GetMaxEncodedLength(length)</code>
+       characters. No terminating null is written.
+
+       @return
+       Number of characters written to <code>encoded</code>.
+     */
+    PINDEX ProcessEncoding(
+      const void * dataBlock,  ///< Pointer to data to be encoded
+      PINDEX length,           ///< Length of the data block.
+      char * encoded           ///< Buffer to receive encoded characters
+    );
+
+    /** Incorporate the specified data into the base 64 encoding, writing the
+       encoded characters to the channel in large blocks.
+
+       @return
+       false if a write to the channel failed.
+     */
+    PBoolean ProcessEncoding(
+      const void * dataBlock,  ///< Pointer to data to be encoded
+      PINDEX length,           ///< Length of the data block.
+      PChannel & channel       ///< Channel to receive encoded characters
+    );
+
+    /** Get the maximum number of characters that <code>ProcessEncoding()</code>
+       followed by <code>CompleteEncoding()</code> will write for the
+       specified amount of data, given the data already processed.
+     */
+    PINDEX GetMaxEncodedLength(
+      PINDEX length            ///< Length of data to be encoded.
+    ) const;
+
     /** Get the partial Base64 string for the data encoded so far.
     
        @return
@@ -115,6 +163,26 @@ class PBase64 : public PObject
      */
     PString CompleteEncoding();
 
+    /** Complete the base 64 encoding, writing the final, padded, characters
+       to a caller buffer of at least four characters.
+
+       @return
+       Number of characters written to <code>encoded</code>.
+     */
+    PINDEX CompleteEncoding(
+      char * encoded           ///< Buffer to receive encoded characters
+    );
+
+    /** Complete the base 64 encoding, writing the final, padded, characters
+       to the channel.
+
+       @return
+       false if the write to the channel failed.
+     */
+    PBoolean CompleteEncoding(
+      PChannel & channel       ///< Channel to receive encoded characters
+    );
+
 
     static PString Encode(
       const PString & str,          ///< String to be encoded to Base64
@@ -150,6 +218,43 @@ class PBase64 : public PObject
     PBoolean ProcessDecoding(
       const char * cstr        // C String to be encoded
     );
+    PBoolean ProcessDecoding(
+      const char * data,       // Base64 characters to be decoded
+      PINDEX length            // Number of characters
+    );
+
+    /** Incorporate the specified data into the base 64 decoding, writing
+       the decoded data to a caller buffer rather than the internal array.
+       The buffer must be at least <code>GetMaxDecodedLength(length)</code>
+       bytes. A partial quad at the end of <code>data</code> is held until
+       more characters arrive, or <code>CompleteDecoding()</code> is called.
+
+       @return
+       true if block was last in the Base64 encoded string.
+     */
+    PBoolean ProcessDecoding(
+      const char * data,       ///< Base64 characters to be decoded
+      PINDEX length,           ///< Number of characters
+      void * decoded,          ///< Buffer to receive decoded data
+      PINDEX & decodedLength   ///< Number of bytes written to <code>decoded</code>
+    );
+
+    /** Complete decoding into a caller buffer, writing any bytes held from
+       an unpadded partial quad. The buffer must be at least two bytes.
+
+       @return
+       Number of bytes written to <code>decoded</code>.
+     */
+    PINDEX CompleteDecoding(
+      void * decoded           ///< Buffer to receive decoded data
+    );
+
+    /** Get the maximum number of bytes that <code>ProcessDecoding()</code>
+       will write for the specified number of characters.
+     */
+    static PINDEX GetMaxDecodedLength(
+      PINDEX length            ///< Number of Base64 characters.
+    ) { return length/4*3 + 3; }
 
     /** Get the data decoded so far from the Base64 strings processed.
     
@@ -199,17 +304,19 @@ class PBase64 : public PObject
 
 
   private:
-    void OutputBase64(const BYTE * data);
+    char * OutputBase64(const BYTE * data, PINDEX triples, char * out);
 
     PString encodedString;
     PINDEX  encodeLength;
     BYTE    saveTriple[3];
     PINDEX  saveCount;
     PINDEX  nextLine;
+    PINDEX  lineQuads;
     PString endOfLine;
 
     PBoolean       perfectDecode;
     PINDEX     quadPosition;
+    DWORD      quadValue;
     PBYTEArray decodedData;
     PINDEX     decodeSize;
 };
@@ -266,6 +373,14 @@ class PMessageDigest : public PObject
       Result & result   ///< The resultant 128 bit MD5 code
     );
 
+    /**Complete the message digest into a buffer, without allocating any
+       memory. The buffer must be large enough for the digest, e.g.
+       PMessageDigest5::DigestSize bytes.
+      */
+    void CompleteDigest(
+      BYTE * digest     ///< Buffer to receive the digest
+    ) { InternalCompleteDigest(digest); }
+
   protected:
     virtual void InternalProcess(
        const void * dataBlock,  ///< Pointer to data to be part of the MD5
@@ -275,6 +390,10 @@ class PMessageDigest : public PObject
     virtual void InternalCompleteDigest(
       Result & result   ///< The resultant 128 bit MD5 code
     ) = 0;
+
+    virtual void InternalCompleteDigest(
+      BYTE * digest     ///< Buffer to receive the digest
+    );
 };
 
 
@@ -288,6 +407,11 @@ class PMessageDigest5 : public PMessageDigest
   PCLASSINFO(PMessageDigest5, PMessageDigest)
 
   public:
+    enum {
+      BlockSize = 64,   ///< Size of block the algorithm works on
+      DigestSize = 16   ///< Size of the resulting digest
+    };
+
     /// Create a new message digestor
     PMessageDigest5();
 
@@ -374,6 +498,24 @@ class PMessageDigest5 : public PMessageDigest
     );
     virtual PString Complete();
 
+    /**Encode several independent messages at once.
+       Where the processor supports it the messages are hashed in parallel,
+       four at a time with SSE2 or eight at a time with AVX2, each message in
+       its own lane. This is best for many short messages of similar size,
+       e.g. authenticating a batch of packets.
+
+       If \p prefix is not NULL, each message is hashed as though it
+       followed the data already given to \p prefix, which must have been a
+       whole number of blocks. This is how PHMAC hashes the key pads once.
+      */
+    static void EncodeMultiple(
+      PINDEX count,                 ///< Number of messages
+      const void * const * data,    ///< Pointer to each message
+      const PINDEX * lengths,       ///< Length of each message
+      BYTE * digests,               ///< count*DigestSize bytes for the results
+      const PMessageDigest5 * prefix = NULL
+    );
+
   protected:
     virtual void InternalProcess(
        const void * dataBlock,  ///< Pointer to data to be part of the MD5
@@ -384,6 +526,10 @@ class PMessageDigest5 : public PMessageDigest
       Result & result   ///< The resultant 128 bit MD5 code
     );
 
+    virtual void InternalCompleteDigest(
+      BYTE * digest     ///< Buffer to receive the digest
+    );
+
   private:
     void Transform(const BYTE * block);
 
@@ -395,17 +541,20 @@ class PMessageDigest5 : public PMessageDigest
     PUInt64 count;
 };
 
-#if P_SSL
-
 /** SHA1 Digest.
  A class to produce a Message Digest for a block of text/data using the
- SHA-1 algorithm 
+ SHA-1 algorithm. OpenSSL is used if available.
  */
 class PMessageDigestSHA1 : public PMessageDigest
 {
   PCLASSINFO(PMessageDigestSHA1, PMessageDigest)
 
   public:
+    enum {
+      BlockSize = 64,   ///< Size of block the algorithm works on
+      DigestSize = 20   ///< Size of the resulting digest
+    };
+
     /// Create a new message digestor
     PMessageDigestSHA1();
     ~PMessageDigestSHA1();
@@ -456,6 +605,24 @@ class PMessageDigestSHA1 : public PMessageDigest
       Result & result            ///< The resultant 128 bit MD5 code
     );
 
+    /**Encode several independent messages at once.
+       Where the processor supports it the messages are hashed in parallel,
+       four at a time with SSE2 or eight at a time with AVX2, each message in
+       its own lane. This is best for many short messages of similar size,
+       e.g. authenticating a batch of packets.
+
+       If \p prefix is not NULL, each message is hashed as though it
+       followed the data already given to \p prefix, which must have been a
+       whole number of blocks. This is how PHMAC hashes the key pads once.
+      */
+    static void EncodeMultiple(
+      PINDEX count,                 ///< Number of messages
+      const void * const * data,    ///< Pointer to each message
+      const PINDEX * lengths,       ///< Length of each message
+      BYTE * digests,               ///< count*DigestSize bytes for the results
+      const PMessageDigestSHA1 * prefix = NULL
+    );
+
   protected:
     virtual void InternalProcess(
        const void * dataBlock,  ///< Pointer to data to be part of the MD5
@@ -466,11 +633,168 @@ class PMessageDigestSHA1 : public PMessageDigest
       Result & result   ///< The resultant 128 bit MD5 code
     );
 
+    virtual void InternalCompleteDigest(
+      BYTE * digest     ///< Buffer to receive the digest
+    );
+
   private:
-    void * shaContext;
-};
+    void GetState(DWORD * state, PUInt64 & length) const;
+
+#if P_SSL
+    PUInt64 shaContext[16]; // Space for a SHA_CTX, so no heap allocation
+#else
+    void Transform(const BYTE * block);
 
+    BYTE    buffer[64];
+    DWORD   state[5];
+    PUInt64 count;
 #endif
+};
+
+
+/**Keyed-hash message authentication code, as per RFC 2104.
+   The key pads are hashed once, when the key is set, and the digest state
+   copied for each message after that, so a message only costs its own data
+   and one extra block for the outer hash.
+
+   The \p Digest may be PMessageDigest5 or PMessageDigestSHA1.
+  */
+template <class Digest>
+class PHMAC : public PObject
+{
+  PCLASSINFO(PHMAC, PObject);
+  public:
+    enum {
+      BlockSize = Digest::BlockSize,
+      DigestSize = Digest::DigestSize
+    };
+
+  /**@name Construction */
+  //@{
+    PHMAC(
+      const void * key = NULL,  ///< Secret key
+      PINDEX length = 0         ///< Length of key
+    ) { SetKey(key, length); }
+
+    PHMAC(
+      const PBYTEArray & key    ///< Secret key
+    ) { SetKey(key, key.GetSize()); }
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Set the secret key, hashing the inner and outer pads.
+      */
+    void SetKey(
+      const void * key,         ///< Secret key
+      PINDEX length             ///< Length of key
+    ) {
+      BYTE pad[BlockSize];
+      memset(pad, 0, sizeof(pad));
+      if (length > BlockSize) {
+        Digest keyDigest;
+        keyDigest.Process(key, length);
+        keyDigest.CompleteDigest(pad);
+      }
+      else if (length > 0)
+        memcpy(pad, key, length);
+
+      PINDEX i;
+      for (i = 0; i < BlockSize; ++i)
+        pad[i] ^= 0x36;
+      m_inner.Start();
+      m_inner.Process(pad, BlockSize);
+
+      for (i = 0; i < BlockSize; ++i)
+        pad[i] ^= 0x36^0x5c;
+      m_outer.Start();
+      m_outer.Process(pad, BlockSize);
+
+      memset(pad, 0, sizeof(pad));
+      Start();
+    }
+
+    /// Begin a new message with the same key.
+    void Start() { m_digest = m_inner; }
+
+    /// Incorporate the specified data into the message.
+    void Process(
+      const void * data,        ///< Data to be part of the message
+      PINDEX length             ///< Length of data
+    ) { m_digest.Process(data, length); }
+
+    /**Complete the message, putting DigestSize bytes into \p mac.
+       The object is then ready for the next message.
+      */
+    void Complete(
+      BYTE * mac                ///< Buffer for the result
+    ) {
+      BYTE innerDigest[DigestSize];
+      m_digest.CompleteDigest(innerDigest);
+      m_digest = m_outer;
+      m_digest.Process(innerDigest, DigestSize);
+      m_digest.CompleteDigest(mac);
+      Start();
+    }
+
+    /**Calculate the MAC for a single message.
+      */
+    void Encode(
+      const void * data,        ///< Message
+      PINDEX length,            ///< Length of message
+      BYTE * mac                ///< Buffer for DigestSize bytes of result
+    ) {
+      Start();
+      Process(data, length);
+      Complete(mac);
+    }
+
+    PBYTEArray Encode(
+      const void * data,        ///< Message
+      PINDEX length             ///< Length of message
+    ) {
+      PBYTEArray mac(DigestSize);
+      Encode(data, length, mac.GetPointer());
+      return mac;
+    }
+
+    /**Calculate the MAC for several independent messages at once, using
+       Digest::EncodeMultiple() for the inner and outer hashes.
+      */
+    void EncodeMultiple(
+      PINDEX count,                 ///< Number of messages
+      const void * const * data,    ///< Pointer to each message
+      const PINDEX * lengths,       ///< Length of each message
+      BYTE * macs                   ///< count*DigestSize bytes for the results
+    ) const {
+      // The inner digests go where the results do, then are hashed again in place
+      Digest::EncodeMultiple(count, data, lengths, macs, &m_inner);
+
+      enum { Batch = 32 };
+      const void * inner[Batch];
+      PINDEX innerLengths[Batch];
+      BYTE innerDigests[Batch*DigestSize];
+      for (PINDEX done = 0; done < count; done += Batch) {
+        PINDEX batch = count - done < Batch ? count - done : Batch;
+        memcpy(innerDigests, macs + done*DigestSize, batch*DigestSize);
+        for (PINDEX i = 0; i < batch; ++i) {
+          inner[i] = innerDigests + i*DigestSize;
+          innerLengths[i] = DigestSize;
+        }
+        Digest::EncodeMultiple(batch, inner, innerLengths, macs + done*DigestSize, &m_outer);
+      }
+    }
+  //@}
+
+  protected:
+    Digest m_inner;
+    Digest m_outer;
+    Digest m_digest;
+};
+
+typedef PHMAC<PMessageDigest5>    PHMAC_MD5;
+typedef PHMAC<PMessageDigestSHA1> PHMAC_SHA1;
+
 
 /**This abstract class defines an encryption/decryption algortihm.
 A specific algorithm is implemented in a descendent class.
@@ -35,12 +35,96 @@
 #include <ptlib/timeint.h>
 #include <ptlib/ptime.h>
 #include <ptlib/indchan.h>
+#include <ptlib/syncpoint.h>
+#include <ptlib/notifier.h>
+
+#include <map>
 
 #ifdef P_USE_PRAGMA
 #pragma interface
 #endif
 
 
+/** Class for pacing many streams from a single thread.
+    Deadlines are given in nanoseconds in the time base of
+    <code>PTimer::HighResolutionTick()</code>, so are not affected by
+    adjustments to the wall clock. The service thread sleeps until the
+    earliest deadline and then wakes waiters, or calls notifiers, in
+    deadline order.
+  */
+class PPacingService : public PObject
+{
+  PCLASSINFO(PPacingService, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    /// Create a pacing service and start its thread.
+    PPacingService();
+
+    /// Stop the service thread, waking any remaining waiters.
+    ~PPacingService();
+
+    /// Get the pacing service shared by the process.
+    static PPacingService & GetInstance();
+  //@}
+
+  /**@name Functionality */
+  //@{
+    /**Block the calling thread until the deadline, which is woken by the
+       service thread. Returns immediately if the deadline has passed.
+      */
+    void SleepUntil(
+      PInt64 deadline   ///< Deadline in PTimer::HighResolutionTick() nanoseconds
+    );
+
+    /**Call the notifier from the service thread every period, the first
+       call being one period from now. The INT parameter of the notifier is
+       the identifier returned.
+
+       @return identifier to use with RemovePeriodic().
+      */
+    PINDEX AddPeriodic(
+      const PNotifier & notifier,   ///< Function to call
+      PInt64 periodMicroSeconds     ///< Period between calls
+    );
+
+    /**Stop calling the notifier added with AddPeriodic(). On return the
+       notifier is not executing and will not be called again.
+      */
+    bool RemovePeriodic(
+      PINDEX id   ///< Identifier returned by AddPeriodic()
+    );
+
+    /**Block the calling thread until the deadline, using an absolute sleep
+       on the monotonic clock where the platform supports it.
+      */
+    static void SleepUntilTick(
+      PInt64 deadline   ///< Deadline in PTimer::HighResolutionTick() nanoseconds
+    );
+  //@}
+
+  protected:
+    void ThreadMain();
+
+    struct Entry {
+      PSyncPoint * m_wakeup;
+      PNotifier    m_notifier;
+      PINDEX       m_id;
+      PInt64       m_period;
+    };
+    typedef std::multimap<PInt64, Entry> DeadlineMap;
+
+    DeadlineMap   m_deadlines;
+    PMutex        m_mutex;
+    PMutex        m_callbackMutex;
+    PSyncPoint    m_newDeadline;
+    PINDEX        m_nextId;
+    bool          m_running;
+    PThread     * m_thread;
+};
+
+
 /** Class for implementing an "adaptive" delay.
     This class will cause the the caller to, on average, delay
     the specified number of milliseconds between calls. This can
@@ -101,18 +185,30 @@ class PAdaptiveDelay : public PObject
       */
     PBoolean Delay(int time);
 
+    /**As for Delay() but with the time in microseconds, so that frame times
+       which are not a whole number of milliseconds do not drift.
+      */
+    PBoolean DelayMicroSeconds(PInt64 time);
+
     /**Invalidate the timer. The timing of this function call is not
        important, the timer will restart at the next call to Delay().
       */
     void Restart();
+
+    /**Sleep using the pacing service rather than in the calling thread.
+       If NULL, the calling thread sleeps until each deadline itself.
+      */
+    void SetPacingService(PPacingService * service)
+    { m_pacing = service; }
   //@}
  
   protected:
     PBoolean   firstTime;
-    PTime  targetTime;
+    PInt64     m_targetTick;   // Deadline in PTimer::HighResolutionTick() nanoseconds
 
     PTimeInterval  jitterLimit;
     PTimeInterval  minimumDelay;
+    PPacingService * m_pacing;
 };
 
 
@@ -210,8 +306,17 @@ class PDelayChannel : public PIndirectChannel
   //@}
 
 
+  /**@name New functions for class */
+  //@{
+    /**Sleep using the pacing service rather than in the calling thread.
+       If NULL, the calling thread sleeps until each deadline itself.
+      */
+    void SetPacingService(PPacingService * service)
+    { m_pacing = service; }
+  //@}
+
   protected:
-    virtual void Wait(PINDEX count, PTimeInterval & nextTick);
+    virtual void Wait(PINDEX count, PInt64 & nextTick);
 
     Mode          mode;
     unsigned      frameDelay;
@@ -219,8 +324,10 @@ class PDelayChannel : public PIndirectChannel
     PTimeInterval maximumSlip;
     PTimeInterval minimumDelay;
 
-    PTimeInterval nextReadTick;
-    PTimeInterval nextWriteTick;
+    // Deadlines in PTimer::HighResolutionTick() nanoseconds
+    PInt64        nextReadTick;
+    PInt64        nextWriteTick;
+    PPacingService * m_pacing;
 };
 
 
@@ -42,6 +42,9 @@
 #include <ptclib/url.h>
 #include <ptlib/ipsock.h>
 #include <ptlib/pfactory.h>
+#include <ptclib/threadpool.h>
+
+#include <list>
 
 
 #include <ptclib/html.h>
@@ -496,6 +499,38 @@ class PHTTPClient : public PHTTP
       PString & body
     );
 
+    /** Class to receive the body of a HTTP command as it arrives, rather
+        than accumulating it all into memory first.
+      */
+    class ContentProcessor
+    {
+      public:
+        virtual ~ContentProcessor() { }
+
+        /** Get the buffer into which the next part of the body is read.
+            The \p size parameter is set to the amount of body still expected,
+            or P_MAX_INDEX if unknown, and must be set to the size of the
+            buffer returned.
+          */
+        virtual void * GetBuffer(
+          PINDEX & size
+        ) = 0;
+
+        /** Process data read into the buffer returned by GetBuffer().
+            Return false to abort reading the body.
+          */
+        virtual bool Process(
+          const void * data,
+          PINDEX length
+        ) = 0;
+    };
+
+    /// Read the body of the HTTP command, passing it to the processor as it arrives.
+    bool ReadContentBody(
+      PMIMEInfo & replyMIME,
+      ContentProcessor & processor
+    );
+
 
     /** Get the document specified by the URL.
 
@@ -611,6 +646,14 @@ class PHTTPClient : public PHTTP
       PMIMEInfo & replyMIME,
       PAbstractArray * body
     );
+    bool InternalReadContentBody(
+      PMIMEInfo & replyMIME,
+      ContentProcessor & processor
+    );
+    bool InternalReadContentPart(
+      ContentProcessor & processor,
+      PINDEX length
+    );
 
     PString m_userAgentName;
     bool    m_persist;
@@ -620,6 +663,181 @@ class PHTTPClient : public PHTTP
 };
 
 
+//////////////////////////////////////////////////////////////////////////////
+// PHTTPClientPool
+
+/** A pool of persistent HTTP client connections.
+
+   Connections are kept open after use and are keyed by scheme, host and
+   port, so a subsequent request to the same server re-uses the connection
+   instead of paying for a new TCP (and possibly TLS) handshake.
+
+   The pool can also execute requests asynchronously, on a set of worker
+   threads, with the result being indicated via a <code>PNotifier</code>:
+      <PRE><CODE>
+      PHTTPClientPool::Request * request = new PHTTPClientPool::Request(url);
+      request->m_completed = PCREATE_NOTIFIER(OnCompleted);
+      pool.StartRequest(request);
+      ...
+      void MyClass::OnCompleted(PHTTPClientPool::Request & request, INT)
+      {
+        if (request.IsOK())
+          Process(request.m_replyBody);
+      }
+      </CODE></PRE>
+ */
+class PHTTPClientPool : public PObject
+{
+  PCLASSINFO(PHTTPClientPool, PObject)
+
+  public:
+    /// Create a new HTTP client connection pool.
+    PHTTPClientPool(
+      PINDEX maxIdlePerHost = 4,    ///< Maximum idle connections kept per host
+      const PTimeInterval & idleTimeout = PTimeInterval(0, 30), ///< Time idle connection is kept
+      unsigned maxWorkers = 10,     ///< Maximum threads for asynchronous requests
+      const PString & userAgentName = PString::Empty()
+    );
+
+    /// Destroy pool, closing all idle connections.
+    ~PHTTPClientPool();
+
+
+  // New functions for class.
+    /** Get a client for the URL. If an idle connection to the same scheme,
+        host and port is available it is returned, otherwise a new client is
+        created which will connect on first use.
+
+        The client must be returned to the pool with Release().
+      */
+    PHTTPClient * Acquire(
+      const PURL & url
+    );
+
+    /** Return a client previously obtained with Acquire(). If \p reuse is
+        true, the client is still open and the body of the last response has
+        been completely read, the connection is kept for further requests,
+        otherwise it is closed and deleted.
+      */
+    void Release(
+      PHTTPClient * client,
+      bool reuse = true
+    );
+
+    /// Close all idle connections.
+    void CloseIdle();
+
+    /// Execute a command using a pooled connection, reading body into \p replyBody.
+    int ExecuteCommand(
+      const PString & cmdName,
+      const PURL & url,
+      PMIMEInfo & outMIME,
+      const PString & dataBody,
+      PMIMEInfo & replyMIME,
+      PBYTEArray & replyBody
+    );
+
+    /// Get the document specified by the URL using a pooled connection.
+    bool GetTextDocument(
+      const PURL & url,         ///< Universal Resource Locator for document.
+      PString & document,       ///< Body read
+      const PString & contentType = PString::Empty() ///< Content-Type header to expect
+    );
+
+    /// Post the data specified to the URL using a pooled connection.
+    bool PostData(
+      const PURL & url,       ///< Universal Resource Locator for document.
+      PMIMEInfo & outMIME,    ///< MIME info in request
+      const PString & data,   ///< Information posted to the HTTP server.
+      PMIMEInfo & replyMIME,  ///< MIME info in response
+      PString & replyBody     ///< Body of response
+    );
+
+    /** An asynchronous request. The notifier is called from a worker thread
+        with the request as the object parameter, after which the request is
+        deleted. Requests still queued when the pool is destroyed are deleted
+        without the notifier being called.
+      */
+    class Request : public PObject
+    {
+      PCLASSINFO(Request, PObject);
+      public:
+        Request(
+          const PURL & url,
+          const PString & command = "GET"
+        );
+
+        bool IsOK() const { return (m_responseCode/100) == 2; }
+
+        PURL      m_url;
+        PString   m_command;
+        PMIMEInfo m_outMIME;
+        PString   m_dataBody;
+        PNotifier m_completed;
+
+        /** If not NULL the body is passed to this processor as it arrives,
+            otherwise it is accumulated in m_replyBody. The pool does not
+            take ownership of the processor.
+          */
+        PHTTPClient::ContentProcessor * m_processor;
+
+        int        m_responseCode;
+        PString    m_responseInfo;
+        PMIMEInfo  m_replyMIME;
+        PBYTEArray m_replyBody;
+
+        // Used by thread pool
+        void Work();
+
+      protected:
+        PHTTPClientPool * m_pool;
+      friend class PHTTPClientPool;
+    };
+
+    /** Queue the request for execution on a worker thread. The pool takes
+        ownership of the request object.
+      */
+    bool StartRequest(
+      Request * request
+    );
+
+    /// Get the number of connections that have been established.
+    unsigned GetConnectionsOpened() const { return m_connectionsOpened; }
+
+    /// Get the number of times an idle connection was re-used.
+    unsigned GetConnectionsReused() const { return m_connectionsReused; }
+
+    /// Get the number of currently idle connections.
+    PINDEX GetIdleCount() const;
+
+  protected:
+    static PString MakeKey(const PURL & url);
+    void ExecuteRequest(Request & request);
+
+    PINDEX        m_maxIdlePerHost;
+    PTimeInterval m_idleTimeout;
+    PString       m_userAgentName;
+
+    struct IdleConnection {
+      PHTTPClient * m_client;
+      PTimeInterval m_released;
+    };
+    typedef std::list<IdleConnection> IdleList;
+    typedef std::map<PString, IdleList> IdleMap;
+    IdleMap m_idle;
+
+    typedef std::map<PHTTPClient *, PString> ActiveMap;
+    ActiveMap m_active;
+
+    PMutex m_mutex;
+
+    PAtomicInteger m_connectionsOpened;
+    PAtomicInteger m_connectionsReused;
+
+    PQueuedThreadPool<Request> m_threadPool;
+};
+
+
 //////////////////////////////////////////////////////////////////////////////
 // PHTTPConnectionInfo
 
@@ -1570,6 +1788,77 @@ class PHTTPString : public PHTTPResource
 };
 
 
+#if P_PROFILING
+
+/** This object describes a HyperText Transport Protocol resource which
+   outputs the current results of all <code>PProfiling</code> probes as
+   plain text.
+ */
+class PHTTPProfilingResource : public PHTTPString
+{
+  PCLASSINFO(PHTTPProfilingResource, PHTTPString)
+
+  public:
+    PHTTPProfilingResource(
+      const PURL & url             // Name of the resource in URL space.
+    );
+    PHTTPProfilingResource(
+      const PURL & url,            // Name of the resource in URL space.
+      const PHTTPAuthority & auth  // Authorisation for the resource.
+    );
+
+  // Overrides from class PHTTPResource
+    virtual PBoolean LoadHeaders(
+      PHTTPRequest & request    // Information on this request.
+    );
+    virtual PString LoadText(
+      PHTTPRequest & request    // Information on this request.
+    );
+
+  protected:
+    PMutex m_mutex;
+};
+
+#endif // P_PROFILING
+
+
+#if P_HEAP_PROFILER
+
+/** This object describes a HyperText Transport Protocol resource which
+   outputs a snapshot of the <code>PHeapProfiler</code> samples as plain
+   text. The default pprof format may be fetched directly by pprof.
+ */
+class PHTTPHeapProfileResource : public PHTTPString
+{
+  PCLASSINFO(PHTTPHeapProfileResource, PHTTPString)
+
+  public:
+    PHTTPHeapProfileResource(
+      const PURL & url,            // Name of the resource in URL space.
+      PHeapProfiler::Formats format = PHeapProfiler::Pprof  // Format of output
+    );
+    PHTTPHeapProfileResource(
+      const PURL & url,            // Name of the resource in URL space.
+      const PHTTPAuthority & auth, // Authorisation for the resource.
+      PHeapProfiler::Formats format = PHeapProfiler::Pprof  // Format of output
+    );
+
+  // Overrides from class PHTTPResource
+    virtual PBoolean LoadHeaders(
+      PHTTPRequest & request    // Information on this request.
+    );
+    virtual PString LoadText(
+      PHTTPRequest & request    // Information on this request.
+    );
+
+  protected:
+    PHeapProfiler::Formats m_format;
+    PMutex                 m_mutex;
+};
+
+#endif // P_HEAP_PROFILER
+
+
 //////////////////////////////////////////////////////////////////////////////
 // PHTTPFile
 
@@ -1642,6 +1931,17 @@ class PHTTPFile : public PHTTPResource
       PHTTPRequest & request    // Information on this request.
     );
 
+    /** Send the data associated with a command.
+
+       Binary files are read in large blocks and written directly to the
+       connection, other content uses the <code>LoadData()</code> mechanism.
+       If the file is truncated while being sent, or a write fails, the
+       connection is closed rather than kept persistent.
+     */
+    virtual void SendData(
+      PHTTPRequest & request    // Information on this request.
+    );
+
     /** Get a block of data that the resource contains.
 
        @return
@@ -1765,6 +2065,13 @@ class PHTTPTailFile : public PHTTPFile
       PHTTPRequest & request,    // Information on this request.
       PCharArray & data          // Data used in reply.
     );
+
+    /** Send the data associated with a command.
+       The file grows while sending so this always uses <code>LoadData()</code>.
+     */
+    virtual void SendData(
+      PHTTPRequest & request    // Information on this request.
+    );
 };
 
 
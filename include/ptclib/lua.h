@@ -40,6 +40,8 @@
 
 #if P_LUA
 
+#include <vector>
+
 struct lua_State;
 
 
@@ -49,12 +51,22 @@ class PLua
 {
   public:
     PLua();
-    ~PLua();
+    virtual ~PLua();
 
     virtual bool LoadString(const char * text);
 
     virtual bool LoadFile(const char * filename);
 
+    /** Load a chunk of source or precompiled bytecode from memory, the name
+        is used in error messages.
+      */
+    virtual bool LoadBuffer(const void * data, PINDEX length, const char * name);
+
+    /** Compile a script file to bytecode, which LoadBuffer() loads into any
+        state without parsing the source again.
+      */
+    bool Compile(const char * filename, PBYTEArray & bytecode);
+
     virtual bool Run(const char * program = NULL);
 
     virtual void OnError(int code, const PString & str);
@@ -122,6 +134,122 @@ class PLua
   int fn_name(lua_State * L); \
 
 
+//////////////////////////////////////////////////////////////
+
+/** A pool of Lua states all running the same script, for use by many
+    threads at once. A thread takes a state with a PLuaPool::Lease, so no
+    two threads run in one state.
+
+    The script is compiled once to bytecode, shared by every pool in the
+    process and keyed by the path and modification time of the file. New
+    states load the bytecode, then have the functions and instances added
+    to the pool bound to them once, before the script is run.
+
+    The file is checked for changes at most once per check interval. When
+    it has changed, it is compiled again and states made before the change
+    are replaced by new ones as they are returned to the pool.
+  */
+class PLuaPool : public PObject
+{
+    PCLASSINFO(PLuaPool, PObject);
+  public:
+    /** Create a pool for the script. A maximum of zero allows as many
+        states as there are concurrent leases.
+      */
+    PLuaPool(const PFilePath & script, PINDEX maxStates = 0);
+    ~PLuaPool();
+
+    /** Register a C function in every state.
+      */
+    void AddFunction(const char * name, PLua::CFunction func);
+
+    /** Bind an instance in every state, with the functions of its
+        PLUA_BINDING_START() block.
+      */
+    template <class T> void AddInstance(T & obj, const char * instanceName)
+    {
+      AddBinder(new InstanceBinder<T>(obj, instanceName));
+    }
+
+    /** Set how often the script file is checked for changes. Default 1 second.
+      */
+    void SetCheckInterval(const PTimeInterval & interval) { m_checkInterval = interval; }
+
+    /** Get the number of states created.
+      */
+    PINDEX GetStateCount() const;
+
+    /** Discard the compiled bytecode of all scripts.
+      */
+    static void FlushCache();
+
+    class State;
+
+    /** Take a state from the pool for the life of the object.
+      */
+    class Lease
+    {
+      public:
+        Lease(PLuaPool & pool);
+        ~Lease();
+
+        /** Determine if the script could be loaded into a state.
+          */
+        bool IsValid() const { return m_state != NULL; }
+
+        PLua & operator*() const;
+        PLua * operator->() const { return &**this; }
+
+      protected:
+        PLuaPool & m_pool;
+        State    * m_state;
+
+      private:
+        Lease(const Lease &);
+        void operator=(const Lease &);
+    };
+
+  protected:
+    /** Called for each new state after the functions and instances are
+        bound, and before the script is run.
+      */
+    virtual bool OnNewState(PLua & lua);
+
+    struct Binder {
+      virtual ~Binder() { }
+      virtual void Bind(PLua & lua) = 0;
+    };
+
+    template <class T> struct InstanceBinder : public Binder {
+      InstanceBinder(T & obj, const char * name) : m_object(obj), m_name(name) { }
+      virtual void Bind(PLua & lua) { m_object.BindToInstance(lua, m_name); }
+      T     & m_object;
+      PString m_name;
+    };
+
+    void AddBinder(Binder * binder);
+    bool CheckScript();
+    State * Acquire();
+    void Release(State * state);
+
+    PFilePath                m_script;
+    PINDEX                   m_maxStates;
+    PTimeInterval            m_checkInterval;
+    PTimeInterval            m_lastCheck;
+    PTime                    m_modified;
+    PBYTEArray               m_bytecode;
+    unsigned                 m_generation;
+    std::vector<Binder *>    m_binders;
+    std::vector<std::pair<PString, PLua::CFunction> > m_functions;
+    std::vector<State *>     m_idle;
+    PINDEX                   m_stateCount;
+    PSemaphore             * m_available;
+    mutable PMutex           m_mutex;
+
+  friend class Lease;
+};
+
+
 //////////////////////////////////////////////////////////////
 
 #endif // P_LUA
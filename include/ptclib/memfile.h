@@ -208,6 +208,167 @@ class PMemoryFile : public PFile
 };
 
 
+/**This class maps a disk file into memory.
+   The file is accessed with the usual <code>PFile</code> functions, which
+   copy to or from the mapping without any system calls, or directly via
+   <code>GetPointer()</code> and <code>ReadPointer()</code> without any copy
+   at all.
+
+   A file opened ReadOnly is mapped read only and its length is fixed at the
+   time it is opened. A file opened WriteOnly or ReadWrite is a shared
+   writable mapping, writing past the end grows the file and the mapping.
+   Growth reserves extra space, the file is truncated to the written length
+   on <code>Close()</code>.
+
+   If the file cannot be mapped, e.g. it is a pipe or device, or it is an
+   empty ReadOnly file, then the file stays open and all operations fall
+   back to the normal <code>PFile</code> behaviour, see <code>IsMapped()</code>.
+ */
+class PMemoryMappedFile : public PFile
+{
+  PCLASSINFO(PMemoryMappedFile, PFile);
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a memory mapped file object but do not open it.
+      */
+    PMemoryMappedFile();
+
+    /**Create a memory mapped file object and open the specified file.
+      */
+    PMemoryMappedFile(
+      const PFilePath & name,    ///< Name of file to open.
+      OpenMode mode = ReadOnly,  ///< Mode in which to open the file.
+      int opts = ModeDefault     ///< <code>OpenOptions</code> enum# for open operation.
+    );
+
+    /**Unmap and close the file.
+      */
+    ~PMemoryMappedFile();
+  //@}
+
+
+  /**@name Overrides from class PChannel */
+  //@{
+    /**Open the current file and map it into memory. Note that a WriteOnly
+       file is opened for read and write as this is required for mapping.
+     */
+    virtual PBoolean Open(
+      OpenMode mode = ReadWrite,  // Mode in which to open the file.
+      int opts = ModeDefault      // Options for open operation.
+    );
+
+    /**Open the specified file and map it into memory.
+     */
+    virtual PBoolean Open(
+      const PFilePath & name,    // Name of file to open.
+      OpenMode mode = ReadWrite, // Mode in which to open the file.
+      int opts = ModeDefault     // <code>OpenOptions</code> enum# for open operation.
+    );
+
+    /**Unmap and close the file, truncating it to the written length.
+     */
+    virtual PBoolean Close();
+
+    /**Copy data from the mapping at the current position.
+     */
+    virtual PBoolean Read(
+      void * buf,   ///< Pointer to a block of memory to receive the read bytes.
+      PINDEX len    ///< Maximum number of bytes to read into the buffer.
+    );
+
+    /**Copy data to the mapping at the current position, growing the file if
+       required.
+     */
+    virtual PBoolean Write(
+      const void * buf, ///< Pointer to a block of memory to write.
+      PINDEX len        ///< Number of bytes to write.
+    );
+  //@}
+
+
+  /**@name Overrides from class PFile */
+  //@{
+    virtual off_t GetLength() const;
+    virtual PBoolean SetLength(
+      off_t len   ///< New length of file.
+    );
+    virtual PBoolean SetPosition(
+      off_t pos,                         ///< New position to set.
+      FilePositionOrigin origin = Start  ///< Origin for position change.
+    );
+    virtual off_t GetPosition() const;
+  //@}
+
+
+  /**@name Mapping functions */
+  //@{
+    /**Indicate the file is mapped into memory.
+      */
+    bool IsMapped() const { return m_address != NULL; }
+
+    /**Get pointer to the start of the mapped file. This is NULL if the file
+       is empty or could not be mapped. The pointer is invalidated if the
+       file grows or is closed.
+      */
+    const BYTE * GetPointer() const { return m_address; }
+
+    /**Get writable pointer to the start of the mapped file. This is NULL if
+       the file was opened ReadOnly.
+      */
+    BYTE * GetWritablePointer() const { return m_writable ? m_address : NULL; }
+
+    /**Read without copying. Returns a pointer to the data at the current
+       position and advances the position by up to <code>len</code> bytes,
+       <code>GetLastReadCount()</code> returns the number of bytes available
+       at the pointer. NULL is returned at end of file, or if not mapped.
+      */
+    const BYTE * ReadPointer(
+      PINDEX len    ///< Maximum bytes to read.
+    );
+
+    /// Expected access pattern for <code>Advise()</code>.
+    enum Advice {
+      AdviseNormal,
+      AdviseSequential,
+      AdviseRandom,
+      AdviseWillNeed,
+      AdviseDontNeed
+    };
+
+    /**Give the operating system a hint on how the mapping will be accessed.
+       A length of zero indicates to the end of the file.
+      */
+    PBoolean Advise(
+      Advice advice,      ///< Expected access pattern
+      off_t offset = 0,   ///< Start of region
+      off_t length = 0    ///< Length of region
+    );
+
+    /**Write modified pages of a shared mapping back to the file.
+      */
+    PBoolean Synchronise(
+      bool wait = true    ///< Wait for the write to complete
+    );
+  //@}
+
+
+  protected:
+    PBoolean MapFile(off_t size);
+    PBoolean UnmapFile();
+
+    BYTE * m_address;
+    off_t  m_mappedSize;
+    off_t  m_length;
+    off_t  m_position;
+    bool   m_writable;
+    bool   m_unmapped;
+#ifdef _WIN32
+    HANDLE m_mapping;
+#endif
+};
+
+
 #endif // PTLIB_PMEMFILE_H
 
 
@@ -41,6 +41,7 @@
 #include <ptlib/pluginmgr.h>
 #include <map>
 #include <list>
+#include <vector>
 
 struct ldap;
 struct ldapmsg;
@@ -432,6 +433,177 @@ class PLDAPSession : public PObject
 };
 
 
+/**This class keeps a number of bound LDAP sessions to a server, and runs
+   searches on them asynchronously.
+   Many searches may be outstanding on each connection at once, each
+   identified by its LDAP message ID. A thread per connection collects the
+   results and passes them to the PNotifier given with the search, so a
+   caller does not hold a thread and a connection for each lookup.
+
+   Results may optionally be cached, keyed by base DN, scope, filter and
+   attributes, for a limited time and number of searches.
+  */
+class PLDAPSessionPool : public PObject
+{
+  PCLASSINFO(PLDAPSessionPool, PObject);
+  public:
+    /**Create a pool of LDAP clients.
+      */
+    PLDAPSessionPool(
+      const PString & defaultBaseDN = PString::Empty(),
+      unsigned size = 4   ///< Number of connections to the server
+    );
+
+    /**Close the connections on destruction.
+      */
+    ~PLDAPSessionPool();
+
+    /**Open and bind the connections to the specified server.
+       The server is as for PLDAPSession::Open(). The credentials are kept,
+       so a connection that fails can be opened and bound again.
+      */
+    PBoolean Open(
+      const PString & server,
+      WORD port = 0,
+      const PString & who = PString::Empty(),
+      const PString & passwd = PString::Empty(),
+      PLDAPSession::AuthenticationMethod authMethod = PLDAPSession::AuthSimple
+    );
+
+    /**Close all connections. Outstanding searches are completed with the
+       LDAP_USER_CANCELLED error.
+      */
+    void Close();
+
+    /**Determine if any connection is open.
+      */
+    PBoolean IsOpen() const;
+
+    /**Result of a search, passed as the PObject argument of the notifier.
+      */
+    class SearchResult : public PObject
+    {
+        PCLASSINFO(SearchResult, PObject);
+      public:
+        SearchResult();
+
+        int                    m_errorNumber;  ///< OpenLDAP error, eg LDAP_NO_RESULTS_RETURNED
+        PList<PStringToString> m_entries;      ///< Entries, as from PLDAPSession::Search()
+        bool                   m_cached;       ///< Result came from the cache
+        PTimeInterval          m_latency;      ///< Time from starting the search
+    };
+
+    /**Start search for specified information.
+       The notifier is called with a SearchResult and the userData from the
+       thread of the connection, or if the result is in the cache, from this
+       function before it returns.
+
+       @return PFalse if the search could not be sent to the server, in
+               which case the notifier is not called.
+      */
+    PBoolean Search(
+      const PNotifier & notifier,
+      INT userData,
+      const PString & filter,
+      const PStringArray & attributes = PStringList(),
+      const PString & base = PString::Empty(),
+      PLDAPSession::SearchScope scope = PLDAPSession::ScopeSubTree
+    );
+
+    /**Search for specified information, waiting for all matches.
+      */
+    PList<PStringToString> Search(
+      const PString & filter,
+      const PStringArray & attributes = PStringList(),
+      const PString & base = PString::Empty(),
+      PLDAPSession::SearchScope scope = PLDAPSession::ScopeSubTree
+    );
+
+    /**Set the size and lifetime of cached search results. A size of zero,
+       the default, disables the cache.
+      */
+    void SetCache(
+      PINDEX maxSearches,
+      const PTimeInterval & timeToLive
+    );
+
+    /**Remove all cached search results.
+      */
+    void FlushCache();
+
+    /**Set the default base DN for use if not specified for searches.
+      */
+    void SetBaseDN(
+      const PString & dn
+    ) { defaultBaseDN = dn; }
+
+    /**Get the default base DN for use if not specified for searches.
+      */
+    const PString & GetBaseDN() const { return defaultBaseDN; }
+
+    /**Set the time a search may be outstanding before it fails with the
+       LDAP_TIMEOUT error.
+      */
+    void SetTimeout(
+      const PTimeInterval & t
+    ) { timeout = t; }
+
+    /**Get the time a search may be outstanding.
+      */
+    const PTimeInterval & GetTimeout() const { return timeout; }
+
+    /**Set a limit on the number of results to return.
+      */
+    void SetSearchLimit(
+      unsigned s
+    ) { searchLimit = s; }
+
+    /**Get the number of searches waiting for the server.
+      */
+    PINDEX GetOutstanding() const;
+
+    class Connection;
+
+  protected:
+    void OnSearchComplete(
+      const PString & cacheKey,
+      SearchResult & result,
+      const PNotifier & notifier,
+      INT userData
+    );
+
+    PString       defaultBaseDN;
+    unsigned      poolSize;
+    PTimeInterval timeout;
+    unsigned      searchLimit;
+
+    PString                             server;
+    WORD                                port;
+    PString                             who;
+    PString                             passwd;
+    PLDAPSession::AuthenticationMethod  authMethod;
+
+    std::vector<Connection *> connections;
+    PMutex                    connectionsMutex;
+
+    struct CachedSearch {
+      int                              m_errorNumber;
+      PList<PStringToString>           m_entries;
+      PTimeInterval                    m_expiry;
+      std::list<PString>::iterator     m_order;
+    };
+    typedef std::map<PString, CachedSearch> CacheMap;
+
+    CacheMap           cache;
+    std::list<PString> cacheOrder;    ///< Most recently used first
+    PINDEX             cacheSize;
+    PTimeInterval      cacheTimeToLive;
+    PMutex             cacheMutex;
+
+  friend class Connection;
+};
+
+
 
 class PLDAPStructBase;
 
@@ -101,6 +101,8 @@
 #include <sql.h> 
 #include <sqlext.h>
 
+#include <vector>
+
 #ifdef _MSC_VER
  #include <tchar.h>
  #pragma comment(lib,"odbc32.lib")
@@ -799,6 +801,274 @@ class PDSNConnection : public PODBC
 };
 
 
+/** PODBCPreparedStmt
+    A statement that is parsed once by the driver and executed many times
+    with different parameter values. Parameters are given by index, from 1,
+    in the order of the '?' markers in the SQL.
+
+    Parameters set and then added with AddBatch() are sent to the driver
+    as arrays, so a whole batch of rows is inserted by one ExecuteBatch().
+
+    Results are fetched in blocks of rows, set by SetRowArraySize(), into
+    buffers bound once per column, and read with GetValue() without any
+    allocation per field.
+*/
+class PODBCPreparedStmt : public PODBCStmt
+{
+    PCLASSINFO(PODBCPreparedStmt, PODBCStmt);
+
+  public:
+    /**@name Constructor/Deconstructor */
+    //@{
+    PODBCPreparedStmt(PODBC * odbc);
+    ~PODBCPreparedStmt();
+    //@}
+
+    /**@name Execution */
+    //@{
+    /** Prepare the SQL statement, with '?' for each parameter.
+    */
+    PBoolean Prepare(const PString & sql);
+
+    /** Get the SQL last prepared.
+    */
+    const PString & GetSQL() const { return m_sql; }
+
+    /** Set a parameter value. The first parameter is 1.
+    */
+    void SetParameter(PINDEX index, const PString & value);
+    void SetParameter(PINDEX index, const char * value);
+    void SetParameter(PINDEX index, int value);
+    void SetParameter(PINDEX index, PInt64 value);
+    void SetParameter(PINDEX index, double value);
+
+    /** Set a parameter to NULL.
+    */
+    void SetNull(PINDEX index);
+
+    /** Clear all parameter values and any batch.
+    */
+    void ClearParameters();
+
+    /** Execute the prepared statement with the current parameters.
+        Any open cursor from a previous execution is closed first.
+    */
+    PBoolean Execute();
+
+    /** Add the current parameter values as a row of the batch. Each
+        parameter must have the same type in every row.
+    */
+    PBoolean AddBatch();
+
+    /** Get the number of rows added to the batch.
+    */
+    PINDEX GetBatchSize() const { return m_batchRows; }
+
+    /** Execute the statement once for every row of the batch, as a single
+        parameter array, then clear the batch. Drivers without parameter
+        arrays execute each row in turn.
+    */
+    PBoolean ExecuteBatch();
+    //@}
+
+    /**@name Bulk Fetch */
+    //@{
+    /** Set the number of rows fetched at once. Default is 100.
+    */
+    void SetRowArraySize(PINDEX rows);
+
+    /** Fetch the next block of rows. Returns the number of rows fetched,
+        or zero when there are no more.
+    */
+    PINDEX FetchRows();
+
+    /** Get the number of columns in the result.
+    */
+    PINDEX GetColumnCount() const { return m_columns.size(); }
+
+    /** Get the name of a result column. The first column is 1.
+    */
+    PString GetColumnName(PINDEX column) const;
+
+    /** Determine if a value in the last fetched block is NULL.
+        The first row is 0, the first column is 1.
+    */
+    PBoolean IsNull(PINDEX row, PINDEX column) const;
+
+    /** Get a value in the last fetched block as a string. Values longer
+        than the column size, limited by PODBCRecord::MaxCharSize, are
+        truncated. The first row is 0, the first column is 1.
+    */
+    PString GetValue(PINDEX row, PINDEX column) const;
+
+    /** Get a value in the last fetched block as a pointer to the bound
+        buffer, valid until the next FetchRows().
+    */
+    const char * GetValuePtr(PINDEX row, PINDEX column) const;
+    //@}
+
+  protected:
+    PBoolean BindColumns();
+    PBoolean BindParameters();
+    void     CloseCursor();
+
+    struct Parameter;
+    Parameter & GetParameter(PINDEX index);
+
+    struct Parameter {
+      Parameter();
+      SQLSMALLINT m_cType;
+      SQLSMALLINT m_sqlType;
+      PInt64      m_integer;
+      double      m_real;
+      PString     m_string;
+      SQLLEN      m_indicator;
+    };
+
+    struct Column {
+      PString          m_name;
+      SQLLEN           m_width;
+      PBYTEArray       m_buffer;
+      std::vector<SQLLEN> m_indicators;
+    };
+
+    struct BatchColumn {
+      SQLSMALLINT      m_cType;
+      SQLSMALLINT      m_sqlType;
+      SQLLEN           m_width;
+      PBYTEArray       m_buffer;
+      std::vector<SQLLEN> m_indicators;
+    };
+
+    PString                   m_sql;
+    std::vector<Parameter>    m_parameters;
+    std::vector<Parameter>    m_batch;      // m_batchRows rows of parameters
+    PINDEX                    m_batchRows;
+    std::vector<Column>       m_columns;
+    PINDEX                    m_rowArraySize;
+    SQLULEN                   m_rowsFetched;
+    bool                      m_cursorOpen;
+    bool                      m_columnsBound;
+};
+
+
+/** PODBCPool
+    A thread safe pool of connections to one data source. A thread takes a
+    connection with a PODBCPool::Lease for as long as it needs it, and the
+    connection keeps the statements prepared on it for reuse by the next
+    thread.
+
+    A connection that failed to open, or that the driver reports as dead
+    via SQL_ATTR_CONNECTION_DEAD, is reconnected when it is next leased. A
+    driver that cannot report the connection state gets a reconnect on
+    every lease.
+
+    Note the pool is untested against a real ODBC driver, it has only been
+    run against a stub driver that simulates connect and state failures.
+
+<pre><code>
+  PODBCPool pool(8);
+  pool.Open("DRIVER=SQLite3;Database=/var/lib/cdr.db");
+  ...
+  PODBCPool::Lease lease(pool);
+  PODBCPreparedStmt * stmt = lease.Prepare("INSERT INTO cdr (id, duration) VALUES (?, ?)");
+  if (stmt != NULL) {
+    stmt->SetParameter(1, callId);
+    stmt->SetParameter(2, duration);
+    stmt->Execute();
+  }
+</code></pre>
+*/
+class PODBCPool : public PObject
+{
+    PCLASSINFO(PODBCPool, PObject);
+
+  public:
+    /**@name Constructor/Deconstructor */
+    //@{
+    PODBCPool(PINDEX size = 4);
+    ~PODBCPool();
+    //@}
+
+    /**@name Connection/Disconnect */
+    //@{
+    /** Open the connections with an ODBC connection string, as for
+        PODBC::Connect().
+    */
+    PBoolean Open(const PString & connectString);
+
+    /** Open the connections to a preconfigured DSN, as for
+        PDSNConnection::Connect().
+    */
+    PBoolean OpenDSN(const PString & source, const PString & username, const PString & password);
+
+    /** Close all connections, waiting for any leases to be released.
+    */
+    void Close();
+
+    /** Get the number of connections in the pool.
+    */
+    PINDEX GetSize() const { return m_size; }
+    //@}
+
+    class Connection;
+
+    /** Take a connection from the pool for the life of the object.
+    */
+    class Lease
+    {
+      public:
+        /** Wait for a connection, up to the timeout.
+        */
+        Lease(PODBCPool & pool, const PTimeInterval & timeout = PMaxTimeInterval);
+
+        /** Return the connection to the pool.
+        */
+        ~Lease();
+
+        /** Determine if a connected link was obtained.
+        */
+        PBoolean IsValid() const { return m_connection != NULL; }
+
+        /** Get the connection.
+        */
+        PODBC & operator*() const;
+        PODBC * operator->() const { return &**this; }
+
+        /** Get a prepared statement for the SQL, reusing the one already
+            prepared on this connection if there is one. The statement
+            belongs to the connection and must not be deleted.
+        */
+        PODBCPreparedStmt * Prepare(const PString & sql);
+
+      protected:
+        PODBCPool  & m_pool;
+        Connection * m_connection;
+
+      private:
+        Lease(const Lease &);
+        void operator=(const Lease &);
+    };
+
+  protected:
+    PBoolean OpenConnections();
+    Connection * Acquire(const PTimeInterval & timeout);
+    void Release(Connection * connection);
+
+    PINDEX                    m_size;
+    PString                   m_connectString;
+    PString                   m_source;
+    PString                   m_username;
+    PString                   m_password;
+    std::vector<Connection *> m_connections;
+    std::vector<Connection *> m_idle;
+    PMutex                    m_mutex;
+    PSemaphore                m_available;
+
+  friend class Lease;
+};
+
+
  //--
 /** PODBCRecord
     This Class is used to analyse the fetched data and handles
@@ -40,9 +40,11 @@
 #include <ptlib/sockets.h>
 #include <ptclib/snmp.h>
 #include <ptclib/pasn.h>
+#include <ptlib/safecoll.h>
 
 #include <list>
 #include <vector>
+#include <map>
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -248,6 +250,180 @@ class PSNMPClient : public PSNMP
 };
 
 
+//////////////////////////////////////////////////////////////////////////
+
+/** A tree of MIB variables registered against object identifiers.
+
+    Variables are kept in object identifier order, so that Get, GetNext and
+    GetBulk requests are each resolved in O(log n). The tree is thread safe
+    and variables may be registered and removed while an agent is running.
+ */
+class PSNMPMIBTree : public PObject
+{
+  PCLASSINFO(PSNMPMIBTree, PObject)
+  public:
+    /** A variable in the MIB. The value is obtained at the time of each
+        request, so may be bound to live data.
+     */
+    class Variable : public PObject
+    {
+      PCLASSINFO(Variable, PObject)
+      public:
+        /// Get the current value of the variable.
+        virtual void GetValue(
+          PRFC1155_ObjectSyntax & value
+        ) const = 0;
+
+        /// Set the value of the variable, default returns ReadOnly.
+        virtual PSNMP::ErrorType SetValue(
+          const PRFC1155_ObjectSyntax & value
+        );
+    };
+
+    /// A variable with a fixed value, e.g. sysDescr.
+    class Constant : public Variable
+    {
+      PCLASSINFO(Constant, Variable)
+      public:
+        Constant(const PRFC1155_ObjectSyntax & value) : m_value(value) { }
+        virtual void GetValue(PRFC1155_ObjectSyntax & value) const { value = m_value; }
+      protected:
+        PRFC1155_ObjectSyntax m_value;
+    };
+
+    /// A Counter variable bound to an atomic integer.
+    class Counter : public Variable
+    {
+      PCLASSINFO(Counter, Variable)
+      public:
+        Counter(const PAtomicInteger & counter) : m_counter(counter) { }
+        virtual void GetValue(PRFC1155_ObjectSyntax & value) const { SetCounter(value, m_counter); }
+      protected:
+        const PAtomicInteger & m_counter;
+    };
+
+    /// A Gauge variable bound to an atomic integer.
+    class Gauge : public Variable
+    {
+      PCLASSINFO(Gauge, Variable)
+      public:
+        Gauge(const PAtomicInteger & gauge) : m_gauge(gauge) { }
+        virtual void GetValue(PRFC1155_ObjectSyntax & value) const { SetGauge(value, m_gauge); }
+      protected:
+        const PAtomicInteger & m_gauge;
+    };
+
+    /// A Gauge variable bound to a const member function of an object, e.g. PSafeCollection::GetSize().
+    template <class T, typename R = PINDEX>
+    class MemberGauge : public Variable
+    {
+      PCLASSINFO(MemberGauge, Variable)
+      public:
+        typedef R (T::*Function)() const;
+        MemberGauge(const T & obj, Function func) : m_object(obj), m_function(func) { }
+        virtual void GetValue(PRFC1155_ObjectSyntax & value) const { SetGauge(value, (unsigned)(m_object.*m_function)()); }
+      protected:
+        const T & m_object;
+        Function  m_function;
+    };
+
+    /** A variable whose value is obtained from a notifier. The notifier is
+        called with the PRFC1155_ObjectSyntax to be filled in as the object
+        parameter.
+     */
+    class Notifier : public Variable
+    {
+      PCLASSINFO(Notifier, Variable)
+      public:
+        Notifier(const PNotifier & notifier) : m_notifier(notifier) { }
+        virtual void GetValue(PRFC1155_ObjectSyntax & value) const { m_notifier(value, 0); }
+      protected:
+        PNotifier m_notifier;
+    };
+
+    /// Create empty MIB tree.
+    PSNMPMIBTree();
+
+    /// Destroy MIB tree and all registered variables.
+    ~PSNMPMIBTree();
+
+    /** Register a variable against the object identifier. The tree takes
+        ownership of the variable, replacing any previous registration.
+      */
+    bool Register(
+      const PString & oid,
+      Variable * variable
+    );
+
+    /// Remove the variable registered against the object identifier.
+    bool Unregister(
+      const PString & oid
+    );
+
+    /// Remove all variables at or below the object identifier.
+    PINDEX UnregisterSubTree(
+      const PString & oid
+    );
+
+    /** Register a sub-tree of PTLib runtime statistics below \p baseOID:
+          - baseOID.1.0 number of active threads
+          - baseOID.2.0 number of active timers
+          - baseOID.3.0 process up time in TimeTicks
+      */
+    void RegisterProcessStatistics(
+      const PString & baseOID
+    );
+
+    /// Register a Gauge reporting the size of a PSafeCollection.
+    bool RegisterSafeCollection(
+      const PString & oid,
+      const PSafeCollection & collection
+    );
+
+    /// Get the value of the exact object identifier.
+    PSNMP::ErrorType Get(
+      const PASN_ObjectId & oid,
+      PRFC1155_ObjectSyntax & value
+    ) const;
+
+    /** Get the first variable after the object identifier, which is updated
+        to the identifier of the variable found. Returns NoSuchName at the end
+        of the MIB.
+      */
+    PSNMP::ErrorType GetNext(
+      PASN_ObjectId & oid,
+      PRFC1155_ObjectSyntax & value
+    ) const;
+
+    /// Set the value of the exact object identifier.
+    PSNMP::ErrorType Set(
+      const PASN_ObjectId & oid,
+      const PRFC1155_ObjectSyntax & value
+    );
+
+    /// Get the number of registered variables.
+    PINDEX GetSize() const;
+
+    // Helper functions to set values of various SNMP types
+    static void SetInteger(PRFC1155_ObjectSyntax & value, int number);
+    static void SetString(PRFC1155_ObjectSyntax & value, const PString & str);
+    static void SetObjectId(PRFC1155_ObjectSyntax & value, const PString & oid);
+    static void SetNull(PRFC1155_ObjectSyntax & value);
+    static void SetCounter(PRFC1155_ObjectSyntax & value, unsigned count);
+    static void SetGauge(PRFC1155_ObjectSyntax & value, unsigned gauge);
+    static void SetTimeTicks(PRFC1155_ObjectSyntax & value, unsigned ticks);
+
+  protected:
+    typedef std::vector<unsigned> Key;
+    static Key MakeKey(const PASN_ObjectId & oid);
+    static Key MakeKey(const PString & oid);
+
+    typedef std::map<Key, Variable *> VariableMap;
+    VariableMap   m_variables;
+    mutable PMutex m_mutex;
+};
+
+
 //////////////////////////////////////////////////////////////////////////
 
 /** Class which supplies SNMP data
@@ -268,6 +444,7 @@ class PSNMPServer : public PSNMP
 	void Main();
 
     void SetVersion(PASNInt newVersion);
+    void SetCommunity(const PString & str) { community = str; }
     PBoolean HandleChannel();
     PBoolean ProcessPDU(const PBYTEArray & readBuffer, PBYTEArray & writeBuffer);
 
@@ -280,11 +457,16 @@ class PSNMPServer : public PSNMP
     virtual PBoolean OnGetRequest     (PINDEX reqID, PSNMP::BindingList & vars, PSNMP::ErrorType & errCode);
     virtual PBoolean OnGetNextRequest (PINDEX reqID, PSNMP::BindingList & vars, PSNMP::ErrorType & errCode);
     virtual PBoolean OnSetRequest     (PINDEX reqID, PSNMP::BindingList & vars, PSNMP::ErrorType & errCode);
+    virtual PBoolean OnGetBulkRequest (PINDEX reqID, PINDEX nonRepeaters, PINDEX maxRepetitions,
+                                       PSNMP::BindingList & vars, PSNMP::ErrorType & errCode);
+
+    /// Get the MIB tree used by the default request handlers.
+    PSNMPMIBTree & GetMIB() { return m_mib; }
 
     PSNMP::ErrorType SendGetResponse  (PSNMPVarBindingList & vars);
   
   protected:
-    PThreadObj<PSNMPServer> m_thread;
+    PThreadObj<PSNMPServer> * m_thread;
     PString       community;
     PASN_Integer  version;
     PINDEX        lastErrorIndex;
@@ -294,6 +476,7 @@ class PSNMPServer : public PSNMP
     PINDEX        maxTxSize;
     PUDPSocket   *baseSocket;
     PDictionary<PRFC1155_ObjectName, PRFC1155_ObjectSyntax>  objList;
+    PSNMPMIBTree  m_mib;
 };
 
 #endif // P_SNMP
@@ -44,6 +44,7 @@
 #if P_VIDFILE
 
 #include <ptlib/videoio.h>
+#include <ptclib/memfile.h>
 
 
 /**
@@ -96,7 +97,7 @@ class PVideoFile : public PVideoFrameInfo
     bool   m_fixedFrameRate;
     PINDEX m_frameBytes;
     off_t  m_headerOffset;
-    PFile  m_file;
+    PMemoryMappedFile m_file;
 };
 
 /**
@@ -41,6 +41,7 @@
 
 
 #include <ptlib/pfactory.h>
+#include <ptclib/resample.h>
 
 class PWAVFile;
 
@@ -418,6 +419,26 @@ public:
    */
   void SetAutoconvert();
 
+  /**Enable autoconversion between PCM-16 at the given sample rate and
+     number of channels, and the format of a PCM file. Reads and writes,
+     positions and lengths are then in the converted format, while
+     GetSampleRate() and GetChannels() still return those of the file.
+     Other file formats are converted to PCM-16 as for SetAutoconvert(),
+     without changing the rate. When writing, the last few milliseconds
+     held back by the filter are not written.
+   */
+  void SetAutoconvert(
+    unsigned sampleRate,  ///< Sample rate to convert to and from
+    unsigned channels,    ///< Number of channels to convert to and from
+    PAudioResampler::Quality quality = PAudioResampler::MediumQuality ///< Filter preset
+  );
+
+  /**Determine if reads and writes are resampled to the sample rate and
+     channels given to SetAutoconvert(). This is only done for 8 and 16 bit
+     PCM files, other formats are at the rate of the file.
+   */
+  bool IsResampling() const;
+
   //@}
 
   PBoolean RawRead(void * buf, PINDEX len);
@@ -458,6 +479,9 @@ protected:
 
   PBoolean     autoConvert;
   PWAVFileConverter * autoConverter;
+  unsigned autoConvertSampleRate;
+  unsigned autoConvertChannels;
+  PAudioResampler::Quality autoConvertQuality;
 
   off_t lenHeader;
   off_t lenData;
@@ -227,6 +227,8 @@ class PXML : public PXMLBase
 
   protected:
     void Construct(int options, const char * noIndentElements);
+    bool InternalLoad(const char * data, off_t len);
+
     PXMLElement * rootElement;
     PMutex rootMutex;
 
@@ -36,6 +36,8 @@
 #pragma interface
 #endif
 
+#include <vector>
+
 
 /** Class for implementing a serial queue channel in memory.
     This implements a simple memory based First In First Out queue. Data
@@ -49,17 +51,38 @@
     bytes, so you must check the GetLastReadCount() to determine the actual
     number of bytes read and not rely on the count being passed into the read
     function.
+
+    By default the queue is protected by a mutex, and any number of threads
+    may read and write it. When there is only one reader thread, one of the
+    lock free modes may be used instead. Data is then passed without any
+    locking or signalling while the queue is neither empty nor full, and a
+    thread only sleeps, on a futex under Linux, when it has to wait. In the
+    lock free modes a Write() queues all of its data before returning, unless
+    it times out, and in MultiProducerMode the data from each Write() no
+    larger than the queue is kept together. As GetLastWriteCount() is shared
+    by all the writers, they should rely on the return value instead.
+
+    The queue may also be allowed to grow, doubling in size up to a maximum,
+    rather than block a writer when it is full.
   */
 class PQueueChannel : public PChannel
 {
     PCLASSINFO(PQueueChannel, PChannel);
   public:
+    /// How the queue is shared between threads.
+    enum Mode {
+      LockedMode,         ///< Any number of readers and writers, using a mutex
+      SingleProducerMode, ///< One reader and one writer thread, lock free
+      MultiProducerMode   ///< One reader and any number of writer threads, lock free
+    };
+
   /**@name Construction */
   //@{
     /** Create a new queue channel with the specified maximum size.
       */
     PQueueChannel(
-      PINDEX queueSize = 0   ///< Queue size
+      PINDEX queueSize = 0,     ///< Queue size
+      Mode mode = LockedMode    ///< Sharing between threads
     );
 
     /**Delete queue and release memory used.
@@ -115,19 +138,111 @@ class PQueueChannel : public PChannel
       PINDEX queueSize   ///< Queue size
     );
 
+    /**Open a queue, allocating the queueSize bytes, in the given mode. If
+       maxSize is larger than queueSize, the queue doubles in size when a
+       writer finds it full, up to maxSize bytes, instead of blocking.
+       Growth is not available in MultiProducerMode.
+
+       This must not be called while other threads are using the queue.
+      */
+    PBoolean Open(
+      PINDEX queueSize,   ///< Queue size
+      Mode mode,          ///< Sharing between threads
+      PINDEX maxSize = 0  ///< Size the queue may grow to
+    );
+
     /// Get the queue size.
     PINDEX GetSize() const { return queueSize; }
 
     /// Get the current queue length.
-    PINDEX GetLength() const { return queueLength; }
+    PINDEX GetLength() const;
+
+    /// Get the sharing mode.
+    Mode GetMode() const { return mode; }
+  //@}
+
+
+  /**@name Zero copy access, lock free modes only */
+  //@{
+    /**Get the queued data that is contiguous in memory, waiting up to
+       timeout for some to arrive. The data stays queued until ReadCommit()
+       and may be used in place until then. Only the reader thread may call
+       this.
+
+       @return number of bytes at \p data, zero on timeout, if the channel
+               is closed or is not in a lock free mode.
+      */
+    PINDEX ReadPeek(
+      const BYTE * & data,                        ///< Set to the queued data
+      const PTimeInterval & timeout = PMaxTimeInterval  ///< Time to wait for data
+    );
+
+    /**Remove bytes returned by ReadPeek() from the queue.
+      */
+    void ReadCommit(
+      PINDEX len    ///< Number of bytes used, no more than ReadPeek() returned
+    );
+
+    /**Get free queue space that is contiguous in memory, waiting up to
+       timeout for some to become free. Data put there is not queued until
+       WriteCommit(). Only available in SingleProducerMode, and only the
+       writer thread may call this.
+
+       @return number of bytes at \p data, zero on timeout, if the channel
+               is closed or is not in SingleProducerMode.
+      */
+    PINDEX WritePeek(
+      BYTE * & data,                              ///< Set to the free space
+      const PTimeInterval & timeout = PMaxTimeInterval  ///< Time to wait for space
+    );
+
+    /**Queue bytes put into the space returned by WritePeek().
+      */
+    void WriteCommit(
+      PINDEX len    ///< Number of bytes written, no more than WritePeek() returned
+    );
   //@}
 
   protected:
+    PBoolean LockedRead(void * buf, PINDEX count);
+    PBoolean LockedWrite(const void * buf, PINDEX count);
+    PBoolean RingRead(void * buf, PINDEX count);
+    PBoolean RingWrite(const void * buf, PINDEX count);
+    PINDEX RingReadable(const PTimeInterval & timeout);
+    PINDEX RingSpace(PINDEX count, size_t & position);
+    PINDEX RingReserve(PINDEX count, size_t & position, const PTimeInterval & timeout);
+    void RingCommit(size_t position, PINDEX len);
+    bool RingGrow();
+    void DeleteRings();
+
     PMutex     mutex;
     BYTE     * queueBuffer;
     PINDEX     queueSize, queueLength, enqueuePos, dequeuePos;
     PSyncPoint unempty;
     PSyncPoint unfull;
+
+    Mode       mode;
+    PINDEX     maxSize;
+
+    // Lock free ring, a power of two bytes of which queueSize are used.
+    // Positions count all bytes ever passed, and wrap with the mask.
+    struct Ring {
+      BYTE * data;
+      size_t mask;
+    };
+    Ring * volatile    ring;
+    std::vector<Ring *> oldRings;   // replaced by growth, freed at Open()
+    size_t volatile    ringHead;      // end of committed data, written by writers
+    size_t volatile    ringReserved;  // end of reserved space, MultiProducerMode
+    size_t             writerTail;    // writer copy of ringTail
+    BYTE               writerPadding[64];
+    size_t volatile    ringTail;      // end of data read, written by the reader
+    size_t             readerHead;    // reader copy of ringHead
+    BYTE               readerPadding[64];
+    unsigned volatile  readWaiting;   // reader is waiting for data
+    unsigned volatile  readSequence;  // changed when data arrives for a waiting reader
+    unsigned volatile  writeWaiting;  // writers are waiting for space
+    unsigned volatile  writeSequence; // changed when space frees for waiting writers
 };
 
 
@@ -51,14 +51,17 @@
         }
 
     This method is not thread safe, so it is the applications responsibility
-    to assure that its calls are single threaded.
+    to assure that its calls are single threaded. The static functions such
+    as PRandom::Number() use a separate generator for each thread, so need
+    no locking.
   */
 class PRandom
 {
   public:
     /**Construct the random number generator.
-       This version will seed the random number generator with a value based
-       on the system time as returned by time() and clock().
+       This version will seed the random number generator from the operating
+       system entropy source, eg getrandom(), or if that is not available
+       with a value based on the system time.
       */
     PRandom();
 
@@ -76,6 +79,12 @@ class PRandom
       DWORD seed    ///< New seed value, must not be zero
     );
 
+    /**Set the seed for the random number generator from the operating
+       system entropy source. If that is not available, the seed is based on
+       the system time.
+      */
+    void SetSeed();
+
     /**Get the next psuedo-random number in sequence.
        This generates one pseudorandom unsigned integer (32bit) which is
        uniformly distributed among 0 to 2^32-1 for each call.
@@ -101,10 +110,19 @@ class PRandom
       */
     inline operator unsigned() { return Generate(); }
 
+    /**Fill a buffer with psuedo-random bytes.
+       This copies whole blocks of generated values, so is much faster than
+       calling Generate() for each four bytes.
+      */
+    void GenerateBytes(
+      void * buffer,    ///< Buffer to fill
+      PINDEX length     ///< Number of bytes to fill
+    );
+
 
     /**Get the next psuedo-random number in sequence.
-       This utilises a single system wide thread safe PRandom variable. All
-       threads etc will share the same psuedo-random sequence.
+       This utilises a PRandom variable for each thread, seeded from the
+       operating system entropy source, so threads do not contend for a lock.
       */
     static unsigned Number();
 
@@ -116,7 +134,18 @@ class PRandom
     */
     static unsigned Number(unsigned minimum, unsigned maximum);
 
+    /** Fill a buffer with random bytes from the thread's PRandom variable.
+    */
+    static void Fill(
+      void * buffer,    ///< Buffer to fill
+      PINDEX length     ///< Number of bytes to fill
+    );
+
   protected:
+    void Initialise();
+    void Isaac();
+
+
     enum {
       RandBits = 8, ///< I recommend 8 for crypto, 4 for simulations
       RandSize = 1<<RandBits
@@ -0,0 +1,244 @@
+/*
+ * resample.h
+ *
+ * Sample rate and channel conversion of PCM-16 audio.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef PTLIB_RESAMPLE_H
+#define PTLIB_RESAMPLE_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include <ptlib/indchan.h>
+
+#include <vector>
+
+
+/** Streaming sample rate and channel count converter for interleaved PCM-16
+    audio.
+
+    The rate is converted with a polyphase windowed sinc filter, which is
+    vectorised where the compiler supports it. Output frame n is the input
+    signal at time n/outputRate, so there is no offset between the input and
+    output streams; the output lags the input by half the filter length,
+    which Flush() drains at the end of a stream.
+
+    Channels are mixed down before the rate conversion and copied up after
+    it. When reducing, output channel c is the average of the input channels
+    c, c+outputChannels, ..., so stereo becomes the mean of left and right.
+    When increasing, output channel c is a copy of input channel
+    c % inputChannels, so mono is duplicated into both stereo channels.
+
+    An instance converts one stream and is not thread safe.
+  */
+class PAudioResampler : public PObject
+{
+  PCLASSINFO(PAudioResampler, PObject);
+
+  public:
+    /// Filter presets, trading CPU for the width of the passband.
+    enum Quality {
+      FastQuality,    ///< 80% of the output bandwidth, about 50dB stopband, 16 taps
+      MediumQuality,  ///< 90% of the output bandwidth, about 75dB stopband, 48 taps
+      HighQuality,    ///< 95% of the output bandwidth, about 100dB stopband, 128 taps
+      NumQualities
+    };
+
+  /**@name Construction */
+  //@{
+    /**Create a converter. With the default arguments it passes 8kHz mono
+       audio through unchanged.
+      */
+    PAudioResampler(
+      unsigned inputRate = 8000,        ///< Input sample rate in Hz
+      unsigned inputChannels = 1,       ///< Input channels per frame
+      unsigned outputRate = 8000,       ///< Output sample rate in Hz
+      unsigned outputChannels = 1,      ///< Output channels per frame
+      Quality quality = MediumQuality   ///< Filter preset
+    );
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Set the conversion, building the filter, and Reset() the stream.
+
+       @return false if a rate or channel count is zero.
+      */
+    bool Open(
+      unsigned inputRate,               ///< Input sample rate in Hz
+      unsigned inputChannels,           ///< Input channels per frame
+      unsigned outputRate,              ///< Output sample rate in Hz
+      unsigned outputChannels,          ///< Output channels per frame
+      Quality quality = MediumQuality   ///< Filter preset
+    );
+
+    /// Discard any buffered input and start a new stream.
+    void Reset();
+
+    /**Get the largest number of frames a call to Process() or Flush() can
+       produce for the given number of input frames.
+      */
+    PINDEX GetMaxOutputFrames(
+      PINDEX inputFrames    ///< Number of frames to be passed to Process()
+    ) const;
+
+    /**Convert a block of the stream. All input is consumed; output is
+       produced for as much of it as the filter length allows, the rest is
+       kept for the next call.
+
+       @return number of frames written to \p output, which must have room
+               for GetMaxOutputFrames(inputFrames) frames.
+      */
+    PINDEX Process(
+      const short * input,  ///< Interleaved input frames
+      PINDEX inputFrames,   ///< Number of frames in \p input
+      short * output        ///< Buffer for interleaved output frames
+    );
+
+    /**Produce the output still held back at the end of the stream, as if
+       the input were followed by silence, and Reset() for a new stream.
+
+       @return number of frames written to \p output, which must have room
+               for GetMaxOutputFrames(0) frames.
+      */
+    PINDEX Flush(
+      short * output        ///< Buffer for interleaved output frames
+    );
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    unsigned GetInputRate() const { return m_inputRate; }
+    unsigned GetInputChannels() const { return m_inputChannels; }
+    unsigned GetOutputRate() const { return m_outputRate; }
+    unsigned GetOutputChannels() const { return m_outputChannels; }
+    Quality GetQuality() const { return m_quality; }
+
+    /// Get the number of filter taps applied for each output sample.
+    unsigned GetTaps() const { return m_taps; }
+
+    /// Indicate the rates are equal, so only channels are converted.
+    bool IsSameRate() const { return m_inputRate == m_outputRate; }
+  //@}
+
+  protected:
+    void BuildFilter();
+    void MixInput(const short * input, PINDEX frames);
+    PINDEX Filter(short * output, PINDEX maxFrames);
+
+    unsigned m_inputRate;
+    unsigned m_inputChannels;
+    unsigned m_outputRate;
+    unsigned m_outputChannels;
+    Quality  m_quality;
+
+    unsigned m_interpolation;   // output rate over the common divisor
+    unsigned m_decimation;      // input rate over the common divisor
+    unsigned m_phases;
+    unsigned m_taps;
+    std::vector<float> m_filter;
+
+    unsigned m_mixedChannels;
+    std::vector< std::vector<float> > m_history;
+    PINDEX   m_historyFrames;
+    PINDEX   m_position;        // first history frame under the filter for the next output
+    unsigned m_remainder;       // fraction of an input frame, in units of 1/m_interpolation
+    PInt64   m_totalInput;
+    PInt64   m_totalOutput;
+    std::vector<unsigned> m_offsets;
+};
+
+
+/** Channel converting the sample rate and channel count of PCM-16 audio
+    passing through it, for example between a PSoundChannel and the
+    application. Data read from the underlying channel is converted from
+    the channel format to the application format, and data written is
+    converted from the application format to the channel format.
+  */
+class PAudioResampleChannel : public PIndirectChannel
+{
+  PCLASSINFO(PAudioResampleChannel, PIndirectChannel);
+
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a converting channel. The underlying channel is attached with
+       Open(), as for any PIndirectChannel.
+      */
+    PAudioResampleChannel(
+      unsigned channelRate,             ///< Sample rate of the underlying channel
+      unsigned channelChannels,         ///< Channels of the underlying channel
+      unsigned applicationRate,         ///< Sample rate seen by the application
+      unsigned applicationChannels,     ///< Channels seen by the application
+      PAudioResampler::Quality quality = PAudioResampler::MediumQuality
+    );
+  //@}
+
+  /**@name Overrides from class PChannel */
+  //@{
+    /**Read from the underlying channel until \p len bytes of converted audio
+       are available, or the underlying channel fails or reaches its end.
+
+       @return
+       true indicates that at least one character was read from the channel.
+     */
+    virtual PBoolean Read(
+      void * buf,   ///< Pointer to a block of memory to receive the read bytes.
+      PINDEX len    ///< Maximum number of bytes to read into the buffer.
+    );
+
+    /**Convert the audio and write it to the underlying channel. The last
+       few milliseconds are held back by the filter until the next write.
+
+       @return
+       true indicates that at least one character was written to the channel.
+     */
+    virtual PBoolean Write(
+      const void * buf, ///< Pointer to a block of memory to write.
+      PINDEX len        ///< Number of bytes to write.
+    );
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /// Get the converter for data read from the underlying channel.
+    PAudioResampler & GetReadResampler() { return m_readResampler; }
+
+    /// Get the converter for data written to the underlying channel.
+    PAudioResampler & GetWriteResampler() { return m_writeResampler; }
+  //@}
+
+  protected:
+    PAudioResampler m_readResampler;
+    PAudioResampler m_writeResampler;
+    PShortArray     m_readInput;
+    PShortArray     m_readOutput;
+    PINDEX          m_readOutputPosition;
+    PINDEX          m_readOutputFrames;
+    PShortArray     m_writeOutput;
+};
+
+
+#endif // PTLIB_RESAMPLE_H
+
+// End Of File ///////////////////////////////////////////////////////////////
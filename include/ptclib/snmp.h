@@ -26,6 +26,7 @@ class PSNMP_GetNextRequest_PDU;
 class PSNMP_GetResponse_PDU;
 class PSNMP_SetRequest_PDU;
 class PSNMP_Trap_PDU;
+class PSNMP_GetBulkRequest_PDU;
 
 class PSNMP_PDUs : public PASN_Choice
 {
@@ -40,7 +41,8 @@ class PSNMP_PDUs : public PASN_Choice
       e_get_next_request,
       e_get_response,
       e_set_request,
-      e_trap
+      e_trap,
+      e_get_bulk_request
     };
 
 #if defined(__GNUC__) && __GNUC__ <= 2 && __GNUC_MINOR__ < 9
@@ -73,6 +75,12 @@ class PSNMP_PDUs : public PASN_Choice
     operator PSNMP_Trap_PDU &();
     operator const PSNMP_Trap_PDU &() const;
 #endif
+#if defined(__GNUC__) && __GNUC__ <= 2 && __GNUC_MINOR__ < 9
+    operator PSNMP_GetBulkRequest_PDU &() const;
+#else
+    operator PSNMP_GetBulkRequest_PDU &();
+    operator const PSNMP_GetBulkRequest_PDU &() const;
+#endif
 
     virtual PBoolean Decode(PASN_Stream & strm);
     virtual void Encode(PASN_Stream & strm) const;
@@ -250,6 +258,22 @@ class PSNMP_SetRequest_PDU : public PSNMP_PDU
 };
 
 
+//
+// GetBulkRequest-PDU
+//
+
+class PSNMP_GetBulkRequest_PDU : public PSNMP_PDU
+{
+#ifndef PASN_LEANANDMEAN
+    PCLASSINFO(PSNMP_GetBulkRequest_PDU, PSNMP_PDU);
+#endif
+  public:
+    PSNMP_GetBulkRequest_PDU(unsigned tag = 5, TagClass tagClass = ContextSpecificTagClass);
+
+    PObject * Clone() const;
+};
+
+
 //
 // Message
 //
@@ -178,6 +178,11 @@ class PThreadPoolBase : public PObject
 
     ~PThreadPoolBase();
 
+    /** Stop all worker threads, waiting for any work in progress to complete.
+        Work that has been queued but not started is deleted.
+      */
+    void Shutdown();
+
     virtual WorkerThreadBase * CreateWorkerThread() = 0;
     virtual WorkerThreadBase * AllocateWorker();
     virtual WorkerThreadBase * NewWorker();
@@ -223,6 +228,26 @@ class PThreadPool : public PThreadPoolBase
       : PThreadPoolBase(maxWorkers, maxWorkUnits) 
     { }
 
+    //
+    //  destructor, workers must be stopped while work maps still exist
+    //
+    ~PThreadPool()
+    {
+      Shutdown();
+    }
+
+    //
+    //  stop all workers, forgetting work that was never started
+    //
+    void Shutdown()
+    {
+      PThreadPoolBase::Shutdown();
+
+      PWaitAndSignal m(m_listMutex);
+      m_externalToInternalWorkMap.clear();
+      m_groupInfoMap.clear();
+    }
+
     //
     // define the ancestor of the worker thread
     //
@@ -399,6 +424,15 @@ class PQueuedThreadPool : public PThreadPool<Work_T>
         {
         }
 
+        ~QueuedWorkerThread()
+        {
+          // dispose of work that was still queued when the pool shut down
+          while (!m_queue.empty()) {
+            delete m_queue.front();
+            m_queue.pop();
+          }
+        }
+
         void AddWork(Work_T * work)
         {
           m_mutex.Wait();
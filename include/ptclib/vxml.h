@@ -46,6 +46,8 @@
 #include <ptclib/url.h>
 
 #include <queue>
+#include <list>
+#include <map>
 
 
 class PVXMLSession;
@@ -165,6 +167,101 @@ class PVXMLCache : public PMutex
 
 class PVXMLChannel;
 
+/**In memory cache of decoded prompt audio.
+   Prompt files played via PVXMLPlayableFile are decoded once, using
+   PVXMLChannel::CreateWAVFile() for the channels media format and sample
+   rate, and the resulting data kept in memory. All sessions playing the same
+   prompt then share the one reference counted buffer, no file access or
+   format conversion is done for a cache hit.
+
+   The cache is bounded by total bytes, least recently used prompts are
+   discarded first. An entry is reloaded if the file modification time or
+   size changes. A maximum size of zero, the default, disables the cache.
+  */
+class PVXMLPromptCache : public PObject
+{
+  PCLASSINFO(PVXMLPromptCache, PObject);
+  public:
+    PVXMLPromptCache(
+      PINDEX maxSize = 0    ///< Maximum total bytes of decoded audio
+    );
+
+    /**Get the decoded audio for the file in the channels media format.
+       The returned array shares the cached buffer and must not be modified.
+       If the file is not cachable, e.g. too large, then false is returned and
+       the caller should play the file directly.
+      */
+    bool GetPrompt(
+      PVXMLChannel & channel,   ///< Channel audio is for
+      const PFilePath & fn,     ///< Prompt file name
+      PBYTEArray & data         ///< Decoded audio
+    );
+
+    /// Set the maximum total bytes of decoded audio, zero disables cache.
+    void SetMaxSize(PINDEX maxSize);
+
+    /// Get the maximum total bytes of decoded audio.
+    PINDEX GetMaxSize() const { return m_maxSize; }
+
+    /// Set the largest single prompt that will be cached.
+    void SetMaxPromptSize(PINDEX maxSize) { m_maxPromptSize = maxSize; }
+
+    /// Get the largest single prompt that will be cached.
+    PINDEX GetMaxPromptSize() const { return m_maxPromptSize; }
+
+    /// Remove all entries from the cache.
+    void RemoveAll();
+
+    struct Statistics {
+      Statistics();
+
+      PUInt64 m_hits;
+      PUInt64 m_misses;
+      PUInt64 m_evictions;
+      PINDEX  m_entries;
+      PINDEX  m_bytes;
+    };
+
+    /// Get counters and current occupancy of cache.
+    void GetStatistics(Statistics & statistics) const;
+
+    /// Get the cache used by PVXMLPlayableFile.
+    static PVXMLPromptCache & GetInstance();
+
+  protected:
+    /**Decode the prompt file into memory.
+       Default behaviour uses PVXMLChannel::CreateWAVFile() for ".wav" files
+       and reads raw media for all others.
+      */
+    virtual bool LoadPrompt(
+      PVXMLChannel & channel,
+      const PFilePath & fn,
+      PBYTEArray & data
+    );
+
+    typedef std::list<PString> LRUList;
+    struct Entry {
+      PBYTEArray        m_data;
+      PTime             m_modified;
+      PUInt64           m_fileSize;
+      LRUList::iterator m_lru;
+    };
+    typedef std::map<PString, Entry> EntryMap;
+
+    void RemoveEntry(EntryMap::iterator it);
+    void Evict(PINDEX required);
+
+    mutable PMutex m_mutex;
+    EntryMap       m_entries;
+    LRUList        m_lru;
+    PINDEX         m_maxSize;
+    PINDEX         m_maxPromptSize;
+    PINDEX         m_totalSize;
+    Statistics     m_statistics;
+};
+
+//////////////////////////////////////////////////////////////////
+
 class PVXMLSession : public PIndirectChannel
 {
   PCLASSINFO(PVXMLSession, PIndirectChannel);
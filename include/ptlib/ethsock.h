@@ -381,6 +381,51 @@ class PEthSocket : public PSocket
       PINDEX & len,         ///< Length of payload
       BYTE * & payload      ///< Pointer into <code>buffer</code> of payload.
     );
+
+    /**Read a raw frame from the interface without copying it.
+
+       When a memory mapped ring is in use, the returned pointer is to the
+       frame in place in the kernel ring and remains valid until the next
+       call to ReadFrame(), Read() or Close(). Otherwise the frame is read
+       into an internal buffer with the same lifetime.
+
+       @return
+       true if a frame was read, false on timeout or error.
+     */
+    PBoolean ReadFrame(
+      const BYTE * & frame, ///< Pointer to the start of the MAC frame
+      PINDEX & length       ///< Length of the frame captured
+    );
+  //@}
+
+  /**@name Memory mapped ring functions */
+  //@{
+    enum {
+      /// Default size of a receive ring block
+      DefaultRingBlockSize = 1 << 20
+    };
+
+    /**Set the size of the memory mapped packet ring, this must be called
+       before Connect(). The kernel fills whole blocks of frames so a single
+       wake up can deliver many frames, which ReadFrame() then walks in place.
+       If \p txFrames is non-zero a transmit ring is also mapped and Write()
+       queues frames into it.
+
+       A \p blockCount of zero disables the ring and each frame is read
+       from the socket individually.
+
+       @return
+       false if memory mapped rings are not supported on this platform.
+     */
+    PBoolean SetRingSize(
+      PINDEX blockCount,                        ///< Number of blocks in receive ring
+      PINDEX blockSize = DefaultRingBlockSize,  ///< Size of each block, power of two
+      PINDEX txFrames = 0                       ///< Number of frames in transmit ring
+    );
+
+    /**Indicate the receive ring is mapped for the open interface.
+     */
+    bool IsRingMapped() const;
   //@}
 
   protected:
@@ -389,6 +434,7 @@ class PEthSocket : public PSocket
 
 
     WORD filterType;  // Remember the set filter frame type
+    PBYTEArray m_frameBuffer;  // ReadFrame() buffer when not using ring
 
 
 // Include platform dependent part of class
@@ -493,6 +493,45 @@ class PFile : public PChannel
        true if at end of file.
      */
     PBoolean IsEndOfFile() const;
+
+    /**Set the size of the read ahead / write behind buffer. A size of zero,
+       the default for <code>PFile</code>, disables buffering so every
+       <code>Read()</code> and <code>Write()</code> is a system call.
+
+       Buffering is transparent to <code>GetPosition()</code>,
+       <code>SetPosition()</code>, <code>GetLength()</code> and the iostream
+       interface. However written data is not seen by other processes until
+       the buffer fills, the stream is flushed, <code>FlushBuffer()</code> is
+       called or the file is closed.
+
+       If <code>lineBuffered</code> is true, any <code>Write()</code>
+       containing a new line also writes out the buffer, so other processes,
+       for example something following a log file, see every complete line
+       straight away. This is the default for <code>PTextFile</code>.
+     */
+    void SetBufferSize(
+      PINDEX size,              ///< Size of buffer in bytes, zero for no buffering
+      bool lineBuffered = false ///< Write out the buffer at every new line
+    );
+
+    /**Get the size of the read ahead / write behind buffer.
+     */
+    PINDEX GetBufferSize() const { return m_bufferSize; }
+
+    /**Indicate the write behind buffer is written out at every new line.
+     */
+    bool IsLineBuffered() const { return m_lineBuffered; }
+
+    /**Write any data pending in the write behind buffer to the file, and
+       discard any read ahead data.
+
+       @return
+       true if the buffered data was written.
+     */
+    PBoolean FlushBuffer();
+
+    /// Buffer size used by <code>PTextFile</code>, which is also line buffered
+    enum { DefaultTextBufferSize = 32768 };
       
     /**Get information (eg protection, timestamps) on the specified file.
 
@@ -540,6 +579,16 @@ class PFile : public PChannel
     PFilePath path;         ///< The fully qualified path name for the file.
     PBoolean removeOnClose; ///< File is to be removed when closed.
 
+    PBoolean BufferedRead(void * buf, PINDEX len);
+    PBoolean BufferedWrite(const void * buf, PINDEX len);
+
+    PBYTEArray m_buffer;      ///< Read ahead or write behind data
+    PINDEX     m_bufferSize;  ///< Size of buffer, zero is unbuffered
+    PINDEX     m_bufferPos;   ///< Next byte to read, or bytes pending write
+    PINDEX     m_bufferLen;   ///< Bytes of read ahead data in buffer
+    bool       m_bufferWrite; ///< Buffer holds write behind data
+    bool       m_lineBuffered; ///< Write out buffer at every new line
+
 
 // Include platform dependent part of class
 #ifdef _WIN32
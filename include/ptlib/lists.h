@@ -40,6 +40,7 @@
 
 #include <cstddef>
 #include <iterator>
+#include <deque>
 
 ///////////////////////////////////////////////////////////////////////////////
 // PList container class
@@ -56,23 +57,34 @@ struct PListElement
 
 struct PListInfo
 {
-    PListInfo() { head = tail = NULL; }
+    PListInfo() { head = tail = NULL; elements = NULL; }
+    ~PListInfo() { delete elements; }
     PListElement * head;
     PListElement * tail;
 
+    /* Index of the elements in list order, so ordinal access does not need
+       to walk the list. It is only built by the first access by ordinal
+       index away from the head and tail, so lists used only as queues,
+       stacks or via iterators do not pay for it, and after that is kept in
+       step with the links. A deque is used as it is chunked, so growing
+       never copies the whole index, and adding or removing at either end is
+       constant time. As a const read may build it, it is published with a
+       compare and swap, see PAbstractList::GetElementsIndex(). */
+    std::deque<PListElement *> * elements;
+
     PDECLARE_POOL_ALLOCATOR();
 };
 
 /**This class is a collection of objects which are descendents of the
-   <code>PObject</code> class. It is implemeted as a doubly linked list.
-
-   The implementation of a list allows very fast inserting and deleting of
-   objects in the collection, but has severe penalties for random access. All
-   object access should be done sequentially to avoid these speed penalties.
+   <code>PObject</code> class. It is implemeted as a doubly linked list,
+   with an index of the list elements so access via ordinal index is fast.
 
-   The class remembers the last accessed element. This state information is
-   used to optimise access by the "virtual array" model of collections. If
-   access via ordinal index is made sequentially there is little overhead.
+   Adding and removing objects at the head and tail of the list is fast, as
+   is access by ordinal index, which is a simple lookup in the index. The
+   index is built by the first such access that is not to the head or tail.
+   Inserting or removing in the middle of the list moves the index entries
+   after that point, which is a block move of pointers. Iterators are
+   unaffected by other elements being added or removed.
 
    The PAbstractList class would very rarely be descended from directly by
    the user. The <code>PDECLARE_LIST</code> and <code>PLIST</code> macros would normally
@@ -241,9 +253,8 @@ class PAbstractList : public PCollection
     /**Get the object at the specified ordinal position. If the index was
        greater than the size of the collection then NULL is returned.
 
-       The object accessed in this way is remembered by the class and further
-       access will be fast. Access to elements one either side of that saved
-       element, and the head and tail of the list, will always be fast.
+       Access by ordinal index is a lookup in the list index, so is as fast
+       as for an array.
 
        @return
        pointer to object at the specified index.
@@ -281,9 +292,8 @@ class PAbstractList : public PCollection
     /**Get the object at the specified ordinal position. If the index was
        greater than the size of the collection then this asserts.
 
-       The object accessed in this way is remembered by the class and further
-       access will be fast. Access to elements one either side of that saved
-       element, and the head and tail of the list, will always be fast.
+       Access by ordinal index is a lookup in the list index, so is as fast
+       as for an array.
 
        @return
        reference to object at the specified index.
@@ -292,11 +302,9 @@ class PAbstractList : public PCollection
       PINDEX index  ///< Ordinal index of the list element to set as current.
     ) const;
 
-    /**Move the internal "cursor" to the index position specified. This
-       function will optimise the sequential move taking into account the
-       previous current position and the position at the head and tail of the
-       list. Whichever of these three points is closes is used as the starting
-       point for a sequential move to the required index.
+    /**Get the list element at the index position specified. The head and
+       tail are taken from the links, anything else from the list index,
+       which is built if not already.
 
        @return
        true if the index could be set as the current element.
@@ -306,7 +314,12 @@ class PAbstractList : public PCollection
       PListElement * & lastElement ///< pointer to final element
     ) const;
 
-    PObject * RemoveElement(PListElement * element);
+    /**Get the index of the list elements, building it if not already. This
+       is safe for concurrent readers of the list.
+     */
+    std::deque<PListElement *> * GetElementsIndex() const;
+
+    PObject * RemoveElement(PListElement * element, PINDEX index);
 
     // The types below cannot be nested as DevStudio 2005 AUTOEXP.DAT doesn't like it
     typedef PListElement Element;
@@ -403,7 +416,7 @@ template <class T> class PList : public PAbstractList
     const_iterator begin()  const { return info->head; }
     const_iterator end()    const { return const_iterator(); }
     const_iterator rbegin() const { return info->tail; }
-    const_iterator rend()   const { return iterator(); }
+    const_iterator rend()   const { return const_iterator(); }
 
     T & front() const { return *(T *)PAssertNULL(info->head)->data; }
     T & back() const { return *(T *)PAssertNULL(info->tail)->data; }
@@ -692,51 +705,71 @@ template <class T> class PStack : public PAbstractList
 ///////////////////////////////////////////////////////////////////////////////
 // Sorted List of PObjects
 
+/* Node of the order statistic B-tree used by PAbstractSortedList. Leaf nodes
+   hold up to MaxKeys object pointers in order. Branch nodes also hold one
+   more child than objects, and the number of objects under each child, so
+   ordinal access does not need to visit the children it skips over.
+
+   While the whole tree is a single leaf its node is allocated with only
+   "capacity" object pointers, growing as objects are added, so a small list
+   does not carry a full node. All other nodes have a capacity of MaxKeys.
+ */
 struct PSortedListElement
 {
-  PSortedListElement * parent;
-  PSortedListElement * left;
-  PSortedListElement * right;
-  PObject            * data;
-  PINDEX               subTreeSize;
-  enum { Red, Black }  colour;
+  enum {
+    MinDegree = 16,
+    MaxKeys = 2*MinDegree-1,
+    MinCapacity = 4
+  };
+
+  PSortedListElement(bool isLeaf, PINDEX size = MaxKeys) : count(0), leaf(isLeaf), capacity((BYTE)size) { }
+
+  static PSortedListElement * CreateLeaf(PINDEX capacity);
+  static void Destroy(PSortedListElement * node);
+
+  PINDEX    count;
+  bool      leaf;
+  BYTE      capacity;
+  PObject * data[MaxKeys];
+
+  PDECLARE_POOL_ALLOCATOR();
+};
+
+struct PSortedListBranch : public PSortedListElement
+{
+  PSortedListBranch() : PSortedListElement(false) { }
+
+  PSortedListElement * child[MaxKeys+1];
+  PINDEX               subTreeSize[MaxKeys+1];
 
   PDECLARE_POOL_ALLOCATOR();
 };
 
 struct PSortedListInfo
 {
-  PSortedListInfo();
+  PSortedListInfo() { root = NULL; }
 
   PSortedListElement * root;
-  //PSortedListElement * lastElement;
-  //PINDEX               lastIndex;
-  PSortedListElement   nil;
 
-  PSortedListElement * Successor(const PSortedListElement * node) const;
-  PSortedListElement * Predecessor(const PSortedListElement * node) const;
-  PSortedListElement * OrderSelect(PSortedListElement * node, PINDEX index) const;
+  const PSortedListElement * OrderSelect(PINDEX index, PINDEX & position) const;
 
   typedef PSortedListElement Element;
+  typedef PSortedListBranch  Branch;
 
   PDECLARE_POOL_ALLOCATOR();
 };
 
 /**This class is a collection of objects which are descendents of the
-   <code>PObject</code> class. It is implemeted as a Red-Black binary tree to
-   maintain the objects in rank order. Note that this requires that the
-   <code>PObject::Compare()</code> function be fully implemented oin objects
+   <code>PObject</code> class. It is implemeted as an order statistic B-tree
+   to maintain the objects in rank order. Note that this requires that the
+   <code>PObject::Compare()</code> function be fully implemented on objects
    contained in the collection.
 
    The implementation of a sorted list allows fast inserting and deleting as
    well as random access of objects in the collection. As the objects are being
-   kept sorted, "fast" is a relative term. All operations take o(lg n) unless
-   a particular object is repeatedly accessed.
-
-   The class remembers the last accessed element. This state information is
-   used to optimise access by the "virtual array" model of collections. If
-   repeated access via ordinal index is made there is little overhead. All
-   other access incurs a minimum overhead, but not insignificant.
+   kept sorted, "fast" is a relative term. All operations take o(lg n). Each
+   node of the tree holds many objects, so the tree is shallow and a search
+   touches few cache lines.
 
    The PAbstractSortedList class would very rarely be descended from directly
    by the user. The <code>PDECLARE_LIST</code> and <code>PLIST</code> macros would normally
@@ -918,10 +951,6 @@ class PAbstractSortedList : public PCollection
     virtual PINDEX GetObjectsIndex(
       const PObject * obj
     ) const;
-    virtual PINDEX GetObjectsIndex(
-      const PObject * obj,
-      PSortedListElement * & lastElement
-    ) const;
 
     /**Search the collection for the specified value of the object. The object
        values are compared, not the pointers.  So the objects in the
@@ -938,29 +967,76 @@ class PAbstractSortedList : public PCollection
 
     // The type below cannot be nested as DevStudio 2005 AUTOEXP.DAT doesn't like it
     typedef PSortedListElement Element;
+    typedef PSortedListBranch  Branch;
 
   protected:
-    
+    /**Find the position of an object value within a node of the tree. A
+       binary search of the objects in the node is made using the virtual
+       <code>PObject::Compare()</code> function of the objects in the list.
+       This is overridden by <code>PSortedList</code> to use its compare
+       type, so the comparisons need not be virtual.
+
+       @return
+       index of the first object in the node that is greater than
+       <code>obj</code> if <code>upper</code> is true, or not less than
+       <code>obj</code> if false.
+     */
+    virtual PINDEX FindInNode(
+      const Element & node,   ///< Node of tree to search
+      const PObject & obj,    ///< Object value to search for
+      bool upper              ///< Find upper rather than lower bound
+    ) const;
+
     // New functions for class
-    void RemoveElement(Element * node);
-    void LeftRotate(Element * node);
-    void RightRotate(Element * node);
+    PObject * RemoveElement(PINDEX index);
+    void SplitChild(Branch * node, PINDEX index);
+    void MergeChildren(Branch * node, PINDEX index);
+    PINDEX LeftRotate(Branch * node, PINDEX index);
+    PINDEX RightRotate(Branch * node, PINDEX index);
     void DeleteSubTrees(Element * node, PBoolean deleteObject);
-    PINDEX ValueSelect(const Element * node, const PObject & obj, const Element ** lastElement) const;
+    Element * CloneSubTree(const Element * node);
+    PINDEX ValueSelect(const PObject & obj, bool upper) const;
 
     // The type below cannot be nested as DevStudio 2005 AUTOEXP.DAT doesn't like it
     PSortedListInfo * info;
 };
 
 
+/**Comparison used by <code>PSortedList</code> to order its objects. This
+   calls the virtual <code>PObject::Compare()</code> function, so the list may
+   contain any descendant of <b>T</b>.
+ */
+template <class T> struct PSortedListCompare
+{
+  static PObject::Comparison Compare(const T & key, const PObject & obj)
+    { return key.Compare(obj); }
+};
+
+
+/**Comparison for a <code>PSortedList</code> that only ever contains objects of
+   exactly type <b>T</b>. This calls <code>T::Compare()</code> directly rather
+   than through the virtual function table, so the compiler can inline it
+   into the search of the tree.
+ */
+template <class T> struct PSortedListTypedCompare
+{
+  static PObject::Comparison Compare(const T & key, const PObject & obj)
+    { return key.T::Compare(obj); }
+};
+
+
 /**This template class maps the PAbstractSortedList to a specific object type.
    The functions in this class primarily do all the appropriate casting of
    types.
 
+   The <b>C</b> type supplies the static <code>Compare()</code> function used
+   to search the tree, see <code>PSortedListCompare</code> and
+   <code>PSortedListTypedCompare</code>.
+
    Note that if templates are not used the <code>PDECLARE_SORTED_LIST</code> macro
    will simulate the template instantiation.
  */
-template <class T> class PSortedList : public PAbstractSortedList
+template <class T, class C = PSortedListCompare<T> > class PSortedList : public PAbstractSortedList
 {
   PCLASSINFO(PSortedList, PAbstractSortedList);
 
@@ -1005,6 +1081,21 @@ template <class T> class PSortedList : public PAbstractSortedList
   protected:
     PSortedList(int dummy, const PSortedList * c)
       : PAbstractSortedList(dummy, c) { }
+
+    virtual PINDEX FindInNode(const Element & node, const PObject & obj, bool upper) const
+    {
+      PINDEX low = 0;
+      PINDEX high = node.count;
+      while (low < high) {
+        PINDEX mid = (low + high)/2;
+        PObject::Comparison result = C::Compare(*(const T *)node.data[mid], obj);
+        if (result == PObject::LessThan || (upper && result == PObject::EqualTo))
+          low = mid + 1;
+        else
+          high = mid;
+      }
+      return low;
+    }
 };
 
 
@@ -555,11 +555,175 @@ trace level is sufficient.
 #endif // PTRACING
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+
+#ifndef P_PROFILING
+#define P_PROFILING 0
+#endif
+
+#if P_PROFILING
+
+/**Class to encapsulate light weight profiling functions.
+   This class does not require any instances and is only being used as a
+   method of grouping functions together in a name space.
+
+   Named probes, usually declared with the <code>PPROFILE_BLOCK()</code>
+   macro, record the duration of each execution of a block into a histogram
+   rather than outputting trace text. Histograms are accumulated per thread,
+   under a lock only ever contended by output, and are merged when output by
+   <code>Dump()</code> or <code>Trace()</code>, which give the mean and
+   percentiles of each probe.
+
+   Profiling is only built when asked for, with the configure option
+   --enable-profiling, otherwise <code>PPROFILE_BLOCK()</code> compiles to
+   nothing.
+
+   Durations are measured with <code>PTimer::HighResolutionTick()</code>, or
+   if PTLib is compiled with <code>P_PROFILING_TSC</code> on an x86 processor,
+   the CPU time stamp counter. The latter is faster but is only accurate on
+   processors with an invariant TSC.
+  */
+class PProfiling
+{
+  public:
+    typedef PUInt64 Timestamp;
+
+    /** A named profiling probe. This is normally a static variable created by
+        the <code>PPROFILE_BLOCK()</code> macro, so must outlive all threads.
+      */
+    class Probe
+    {
+      public:
+        Probe(
+          const char * name,            ///< Name of probe, output in results
+          const char * fileName = NULL, ///< Source file of probe
+          int lineNum = 0               ///< Source line of probe
+        );
+
+        const char * GetName() const { return m_name; }
+        const char * GetFileName() const { return m_fileName; }
+        int GetLineNumber() const { return m_lineNum; }
+        unsigned GetIndex() const { return m_index; }
+
+      private:
+        Probe(const Probe &) { }
+        Probe & operator=(const Probe &) { return *this; }
+
+        const char * m_name;
+        const char * m_fileName;
+        int          m_lineNum;
+        unsigned     m_index;
+    };
+
+    /** Record the duration of the scope the instance is declared in. This is
+        normally only used from the <code>PPROFILE_BLOCK()</code> macro.
+      */
+    class Block
+    {
+      public:
+        Block(const Probe & probe)
+          : m_probe(probe)
+          , m_start(s_enabled ? GetTimestamp() : 0)
+        { }
+
+        ~Block()
+        {
+          if (m_start != 0)
+            Record(m_probe, GetTimestamp() - m_start);
+        }
+
+      private:
+        Block(const Block & other) : m_probe(other.m_probe) { }
+        Block & operator=(const Block &) { return *this; }
+
+        const Probe & m_probe;
+        Timestamp     m_start;
+    };
+
+#if P_PROFILING_TSC && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    /// Get a time stamp in arbitrary units, see <code>ToNanoSeconds()</code>.
+    static Timestamp GetTimestamp()
+    {
+      unsigned lo, hi;
+      __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+      return ((Timestamp)hi << 32) | lo;
+    }
+#else
+    /// Get a time stamp in arbitrary units, see <code>ToNanoSeconds()</code>.
+    static Timestamp GetTimestamp();
+#endif
+
+    /// Convert a difference between time stamps to nanoseconds.
+    static PUInt64 ToNanoSeconds(Timestamp duration);
+
+    /// Record a duration, as a difference between time stamps, against the probe.
+    static void Record(
+      const Probe & probe,
+      Timestamp duration
+    );
+
+    /** Enable or disable recording by <code>PProfiling::Block</code>. When
+        disabled the cost of a probe is a single test of a flag.
+      */
+    static void SetEnabled(bool enabled) { s_enabled = enabled; }
+
+    /// Indicate recording by <code>PProfiling::Block</code> is enabled.
+    static bool IsEnabled() { return s_enabled; }
+
+    /** Output the results of all probes that have recorded a duration, one
+        line per probe giving count, mean, minimum, 50th, 90th and 99th
+        percentiles and maximum in microseconds.
+      */
+    static void Dump(
+      ostream & strm
+    );
+
+    /// Output the results of all probes to the trace log.
+    static void Trace(
+      unsigned level
+    );
+
+    /// Clear the results of all probes.
+    static void Reset();
+
+    /** Release the per-thread storage of the calling thread, keeping its
+        results. This is done automatically for a <code>PThread</code>, and
+        for any thread where pthreads are used. A thread not created by PTLib
+        on other platforms should call this before it ends.
+      */
+    static void Cleanup();
+
+  protected:
+    static bool s_enabled;
+};
+
+#define PPROFILE_CONCAT_INTERNAL(a, b) a##b
+#define PPROFILE_CONCAT(a, b) PPROFILE_CONCAT_INTERNAL(a, b)
+
+/** Profile an execution block.
+This macro creates a static named probe and records the duration of each
+execution of the scope it is declared in, see <code>PProfiling</code>.
+*/
+#define PPROFILE_BLOCK(name) \
+    static PProfiling::Probe PPROFILE_CONCAT(PProfileProbe_, __LINE__)(name, __FILE__, __LINE__); \
+    PProfiling::Block PPROFILE_CONCAT(PProfileBlock_, __LINE__)(PPROFILE_CONCAT(PProfileProbe_, __LINE__))
+
+#else // P_PROFILING
+
+#define PPROFILE_BLOCK(name)
+
+#endif // P_PROFILING
+
+
 
 #if PMEMORY_CHECK || (defined(_MSC_VER) && defined(_DEBUG) && !defined(_WIN32_WCE)) 
 
 #define PMEMORY_HEAP 1
 
+#undef  P_HEAP_PROFILER
+#define P_HEAP_PROFILER 0   // Superseded by PMemoryHeap
+
 /** Memory heap checking class.
 This class implements the memory heap checking and validation functions. It
 maintains lists of allocated block so that memory leaks can be detected. It
@@ -667,6 +831,11 @@ class PMemoryHeap {
      */
     static void DumpStatistics(ostream & strm /** Stream to output to */);
 
+    /** Get pool allocator statistics.
+        Dump the PMemoryPool counters for every pool to the specified stream.
+     */
+    static void DumpPoolStatistics(ostream & strm /** Stream to output to */);
+
 #if PMEMORY_CHECK
     struct State {
       DWORD allocationNumber;
@@ -967,10 +1136,165 @@ public:
 
 #define PMEMORY_HEAP 0
 
-#define PNEW new
+/** Memory heap statistics.
+Without the memory checking subsystem only the pool allocator statistics are
+available.
+*/
+class PMemoryHeap {
+  public:
+    /** Get pool allocator statistics.
+        Dump the PMemoryPool counters for every pool to the specified stream.
+     */
+    static void DumpPoolStatistics(ostream & strm /** Stream to output to */);
+};
+
+#ifndef P_HEAP_PROFILER
+#define P_HEAP_PROFILER 0
+#endif
+
+#if P_HEAP_PROFILER && !(defined(P_LINUX) && defined(__GNUC__))
+#error The heap profiler is only available for GNU/Linux builds
+#endif
+
+#if P_HEAP_PROFILER
+
+#include <new>
+
+/** Sampling heap profiler.
+This class finds memory leaks and heap growth in release builds, where the
+<code>PMemoryHeap</code> checking is far too slow. When started, about one
+allocation in every <code>sampleBytes</code> bytes allocated is recorded,
+with a stack backtrace and, for <code>PObject</code> descendants, the class
+name. The chance of an allocation being recorded is proportional to its size
+so estimates are unbiased. Recording takes no locks, and an allocation that
+is not sampled costs a counter decrement, and a free a single table look up.
+
+A snapshot of the sampled allocations still in use is output by
+<code>Dump()</code>, by sending the process a SIGPROF, which writes a file,
+or by a <code>PHTTPHeapProfileResource</code> page. The default format is
+the pprof "heap_v2" text format, which pprof turns into call graphs and
+symbolises using the MAPPED_LIBRARIES section.
+
+The profiler replaces the global <code>operator new</code>, so it is only
+built when asked for, with the configure option --enable-heapprofiler, which
+is available on GNU/Linux only.
+*/
+class PHeapProfiler {
+  public:
+    enum Formats {
+      Pprof,    ///< pprof heap_v2 format with raw stack addresses
+      Summary   ///< Estimated totals per stack, with symbols and class name
+    };
+
+    /** Start recording allocations. May be called again to change the
+        sampling interval.
+      */
+    static void Start(
+      size_t sampleBytes = 512*1024 ///< Mean number of bytes between samples
+    );
+
+    /** Stop recording allocations. The sampled allocations recorded so far
+        are still output by <code>Dump()</code> and tracked as freed.
+      */
+    static void Stop();
+
+    /// Indicate allocations are being recorded.
+    static bool IsRunning() { return s_running; }
+
+    /// Get the mean number of bytes allocated between samples.
+    static size_t GetSampleBytes() { return s_sampleBytes; }
+
+    /// Output a snapshot of the sampled allocations that are in use.
+    static void Dump(
+      ostream & strm,             ///< Stream to output to
+      Formats format = Pprof      ///< Format of output
+    );
+
+    /** Output a snapshot to a file. If <code>filename</code> is NULL then
+        the file is "<process>.<pid>.<n>.heap" in the current directory.
+        @return false if the file could not be written.
+      */
+    static bool DumpToFile(
+      const char * filename = NULL, ///< Name of file to write
+      Formats format = Pprof        ///< Format of output
+    );
+
+    struct Totals {
+      PUInt64 m_samples;        ///< Allocations sampled since first started
+      PUInt64 m_liveSamples;    ///< Sampled allocations still in use
+      PUInt64 m_liveBytes;      ///< Estimated bytes in use, from the samples
+      PUInt64 m_liveObjects;    ///< Estimated allocations in use, from the samples
+      PUInt64 m_dropped;        ///< Samples not recorded as the tables were full
+    };
+
+    /// Get overall totals of the sampled allocations.
+    static void GetTotals(
+      Totals & totals
+    );
+
+    /** Allocate memory, possibly recording it. This is used by the global
+        <code>operator new</code> and the class specific one declared by
+        <code>PCLASSINFO()</code>, which supplies the class name.
+      */
+    static void * Allocate(
+      size_t nSize,           ///< Number of bytes to allocate
+      const char * className  ///< Class name for allocation, may be NULL
+    );
+
+    /** Allocate memory, possibly recording it, returning NULL rather than
+        throwing <code>std::bad_alloc</code> on failure. This is used by the
+        <code>std::nothrow</code> forms of <code>operator new</code>.
+      */
+    static void * Allocate(
+      size_t nSize,           ///< Number of bytes to allocate
+      const char * className, ///< Class name for allocation, may be NULL
+      const std::nothrow_t &  ///< Tag for the non-throwing form
+    );
+
+    /// Free memory from <code>Allocate()</code>.
+    static void Deallocate(
+      void * ptr              ///< Pointer to memory block to deallocate
+    );
+
+  protected:
+    static bool   s_running;
+    static size_t s_sampleBytes;
+};
+
+#define PNEW_AND_DELETE_FUNCTIONS \
+    void * operator new(size_t nSize) \
+      { return PHeapProfiler::Allocate(nSize, Class()); } \
+    void operator delete(void * ptr) \
+      { PHeapProfiler::Deallocate(ptr); } \
+    void * operator new(size_t, void * placement) \
+      { return placement; } \
+    void operator delete(void *, void *) \
+      { } \
+    void * operator new[](size_t nSize) \
+      { return PHeapProfiler::Allocate(nSize, Class()); } \
+    void operator delete[](void * ptr) \
+      { PHeapProfiler::Deallocate(ptr); } \
+    void * operator new[](size_t, void * placement) \
+      { return placement; } \
+    void operator delete[](void *, void *) \
+      { } \
+    void * operator new(size_t nSize, const std::nothrow_t & nothrow) \
+      { return PHeapProfiler::Allocate(nSize, Class(), nothrow); } \
+    void operator delete(void * ptr, const std::nothrow_t &) \
+      { PHeapProfiler::Deallocate(ptr); } \
+    void * operator new[](size_t nSize, const std::nothrow_t & nothrow) \
+      { return PHeapProfiler::Allocate(nSize, Class(), nothrow); } \
+    void operator delete[](void * ptr, const std::nothrow_t &) \
+      { PHeapProfiler::Deallocate(ptr); }
+
+#else // P_HEAP_PROFILER
 
 #define PNEW_AND_DELETE_FUNCTIONS
 
+#endif // P_HEAP_PROFILER
+
+#define PNEW new
+
 #define runtime_malloc(s) malloc(s)
 #define runtime_free(p) free(p)
 
@@ -1010,15 +1334,128 @@ struct PAllocatorTemplate
                    + __GNUC_MINOR__ * 100 \
                    + __GNUC_PATCHLEVEL__)
 
+/** Slab allocator for objects of a single fixed size.
+   Memory is obtained from the operating system in aligned slabs, so the slab
+   holding an object is found from its address alone. Each thread keeps a
+   magazine of free objects for every pool, so most allocations and
+   deallocations take no lock at all. Full magazines are handed whole to the
+   pool's depot, where a thread that allocates picks them up again, so objects
+   freed by a different thread from the one that allocated them also cost one
+   lock per magazine. Empty slabs beyond a small reserve are returned to the
+   operating system, and the process housekeeping periodically drains the
+   depots so idle pools shrink.
+
+   Pools are created on first use and never destroyed, so pooled objects may
+   still be deleted during static destruction.
+
+   The per-thread magazines need pthreads. Without them every allocation
+   takes the pool's lock, so on such platforms, for example Windows,
+   <code>PDEFINE_POOL_ALLOCATOR</code> keeps using <code>std::allocator</code>
+   and a pool is only used when asked for directly.
+ */
+class PMemoryPool
+{
+  public:
+    /// Create a pool, normally done by PFixedPoolAllocator.
+    PMemoryPool(
+      const char * name,    ///< Name for statistics, usually the class name
+      size_t objectSize     ///< Size in bytes of every object
+    );
+
+    /// Allocate an object, returns NULL if out of memory.
+    void * Allocate();
+
+    /**Allocate an object for an <code>operator new</code>. This throws
+       <code>std::bad_alloc</code> if out of memory, or if C++ exceptions
+       are disabled, asserts and aborts, so never returns NULL.
+     */
+    void * New();
+
+    /// Free an object allocated by this pool, by any thread.
+    void Deallocate(
+      void * ptr    ///< Object to free
+    );
+
+    /// Usage counters for a pool.
+    struct Statistics {
+      const char * m_name;          ///< Name of pool
+      size_t       m_objectSize;    ///< Size of each object, after alignment
+      size_t       m_liveObjects;   ///< Objects allocated and not yet freed
+      size_t       m_peakObjects;   ///< High water mark of live objects
+      size_t       m_cachedObjects; ///< Free objects held in magazines
+      size_t       m_slabs;         ///< Slabs obtained from the operating system
+      size_t       m_slabBytes;     ///< Bytes obtained from the operating system
+      PUInt64      m_allocations;   ///< Total number of allocations
+    };
+
+    /**Get the usage counters for this pool.
+       Counters held by other threads are read without locking, so they are
+       approximate while those threads are allocating.
+     */
+    void GetStatistics(
+      Statistics & stats    ///< Counters for pool
+    ) const;
+
+    /// Get the usage counters for all pools.
+    static void GetAllStatistics(
+      std::vector<Statistics> & stats   ///< Counters for each pool
+    );
+
+    /// Output the usage counters for all pools.
+    static void PrintStatistics(
+      ostream & strm    ///< Stream to output to
+    );
+
+    /**Return free memory to the operating system.
+       Magazines in the depot are emptied back into their slabs, along with
+       those of the calling thread, and all empty slabs are released.
+     */
+    void ReleaseMemory();
+
+    /// Return free memory of all pools to the operating system.
+    static void ReleaseAllMemory();
+
+    struct Internal;
+
+  protected:
+    Internal     * m_internal;
+    unsigned       m_index;
+    PMemoryPool  * m_next;
+
+  private:
+    PMemoryPool(const PMemoryPool &) { }
+    void operator=(const PMemoryPool &) { }
+};
+
+
 // Memory pooling allocators
+template <class Type> struct PFixedPoolAllocator
+{
+  Type * allocate(size_t v)
+  {
+    return v == 1 ? (Type *)GetPool().New() : (Type *)::operator new(v*sizeof(Type));
+  }
+
+  void deallocate(Type * p, size_t v)
+  {
+    if (v == 1)
+      GetPool().Deallocate(p);
+    else
+      ::operator delete(p);
+  }
+
+  static PMemoryPool & GetPool(const char * name = NULL)
+  {
+    // Never destroyed, objects may be freed after static destruction starts
+    static PMemoryPool * pool = new PMemoryPool(name, sizeof(Type));
+    return *pool;
+  }
+};
+
 #if defined(__GNUC__) && (GCC_VERSION > 40000) && !defined(P_MINGW) && !defined(P_MACOSX) && !defined(__clang__)
 #include <ext/mt_allocator.h>
-template <class Type> struct PFixedPoolAllocator    : public PAllocatorTemplate<__gnu_cxx::__mt_alloc<Type>, Type> { };
 template <class Type> struct PVariablePoolAllocator : public PAllocatorTemplate<__gnu_cxx::__mt_alloc<Type>, Type> { };
-
 #else
-
-template <class Type> struct PFixedPoolAllocator    : public PAllocatorTemplate<std::allocator<Type>, Type> { };
 template <class Type> struct PVariablePoolAllocator : public PAllocatorTemplate<std::allocator<Type>, Type> { };
 #endif
 
@@ -1028,13 +1465,26 @@ template <class Type> struct PVariablePoolAllocator : public PAllocatorTemplate<
     void operator delete(void * ptr); \
     void operator delete(void * ptr, const char *, int)
 
+#if P_PTHREADS
+
 #define PDEFINE_POOL_ALLOCATOR(cls) \
-  static PFixedPoolAllocator<cls> cls##_allocator; \
+  void * cls::operator new(size_t)                           { return PFixedPoolAllocator<cls>::GetPool(#cls).New(); } \
+  void * cls::operator new(size_t, const char *, int)        { return PFixedPoolAllocator<cls>::GetPool(#cls).New(); } \
+  void   cls::operator delete(void * ptr)                    {        PFixedPoolAllocator<cls>::GetPool(#cls).Deallocate(ptr); } \
+  void   cls::operator delete(void * ptr, const char *, int) {        PFixedPoolAllocator<cls>::GetPool(#cls).Deallocate(ptr); }
+
+#else
+
+// No per-thread magazines, so a pool would lock on every allocation
+#define PDEFINE_POOL_ALLOCATOR(cls) \
+  static PAllocatorTemplate<std::allocator<cls>, cls> cls##_allocator; \
   void * cls::operator new(size_t)                           { return cls##_allocator.allocate(1);               } \
   void * cls::operator new(size_t, const char *, int)        { return cls##_allocator.allocate(1);               } \
   void   cls::operator delete(void * ptr)                    {        cls##_allocator.deallocate((cls *)ptr, 1); } \
   void   cls::operator delete(void * ptr, const char *, int) {        cls##_allocator.deallocate((cls *)ptr, 1); }
 
+#endif
+
 
 /** Declare all the standard PTLib class information.
 This macro is used to provide the basic run-time typing capability needed
@@ -337,13 +337,16 @@ PINLINE PFilePath & PFilePath::operator+=(const char * cstr)
 ///////////////////////////////////////////////////////////////////////////////
 
 PINLINE PFile::PFile()
-  { os_handle = -1; removeOnClose = PFalse; }
+  : removeOnClose(PFalse), m_bufferSize(0), m_bufferPos(0), m_bufferLen(0), m_bufferWrite(false), m_lineBuffered(false)
+  { os_handle = -1; }
 
 PINLINE PFile::PFile(OpenMode mode, int opts)
-  { os_handle = -1; removeOnClose = PFalse; Open(mode, opts); }
+  : removeOnClose(PFalse), m_bufferSize(0), m_bufferPos(0), m_bufferLen(0), m_bufferWrite(false), m_lineBuffered(false)
+  { os_handle = -1; Open(mode, opts); }
 
 PINLINE PFile::PFile(const PFilePath & name, OpenMode mode, int opts)
-  { os_handle = -1; removeOnClose = PFalse; Open(name, mode, opts); }
+  : removeOnClose(PFalse), m_bufferSize(0), m_bufferPos(0), m_bufferLen(0), m_bufferWrite(false), m_lineBuffered(false)
+  { os_handle = -1; Open(name, mode, opts); }
 
 
 PINLINE PBoolean PFile::Exists() const
@@ -372,20 +375,18 @@ PINLINE const PFilePath & PFile::GetFilePath() const
 PINLINE PString PFile::GetName() const
   { return path; }
 
-PINLINE off_t PFile::GetPosition() const
-  { return _lseek(GetHandle(), 0, SEEK_CUR); }
 
 
 ///////////////////////////////////////////////////////////////////////////////
 
 PINLINE PTextFile::PTextFile()
-  { }
+  { m_bufferSize = DefaultTextBufferSize; m_lineBuffered = true; }
 
 PINLINE PTextFile::PTextFile(OpenMode mode, int opts)
-  { Open(mode, opts); }
+  { m_bufferSize = DefaultTextBufferSize; m_lineBuffered = true; Open(mode, opts); }
 
 PINLINE PTextFile::PTextFile(const PFilePath & name, OpenMode mode, int opts)
-  { Open(name, mode, opts); }
+  { m_bufferSize = DefaultTextBufferSize; m_lineBuffered = true; Open(name, mode, opts); }
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -39,6 +39,8 @@
 #endif
 
 #include <ptlib/channel.h>
+#include <vector>
+#include <list>
 
 
 /**A channel that uses a operating system pipe between the current process and
@@ -410,6 +412,115 @@ class PPipeChannel : public PChannel
 };
 
 
+/**A pool of long lived helper processes.
+   Each helper is started once by Open() and then serves any number of
+   requests, avoiding process creation for every invocation of a script.
+   The protocol is line based: a request is written as a single line to
+   the helpers standard input and exactly one line is expected back on its
+   standard output. Anything the helper writes to standard error is traced.
+
+   Execute() may be called from many threads at once, each request is given
+   to an idle helper, waiting for one if all are busy. A helper that fails
+   or times out is killed and restarted.
+ */
+class PPipeChannelPool : public PObject
+{
+  PCLASSINFO(PPipeChannelPool, PObject);
+  public:
+  /**@name Construction */
+  //@{
+    /**Create an empty pool, Open() must be called before use.
+     */
+    PPipeChannelPool();
+
+    /// Close the pool, killing all helper processes.
+    ~PPipeChannelPool();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Start the helper processes. The \p subProgram may contain arguments
+       separated by spaces, as for PPipeChannel::Open().
+
+       @return
+       true if all helpers were started.
+     */
+    bool Open(
+      const PString & subProgram,  ///< Sub program name or command line.
+      PINDEX size = 4,             ///< Number of helper processes.
+      PBoolean searchPath = true   ///< Flag for system PATH to be searched.
+    );
+
+    /**Start the helper processes.
+
+       @return
+       true if all helpers were started.
+     */
+    bool Open(
+      const PString & subProgram,         ///< Sub program name.
+      const PStringArray & argumentList,  ///< Array of arguments to sub-program.
+      PINDEX size = 4,                    ///< Number of helper processes.
+      PBoolean searchPath = true          ///< Flag for system PATH to be searched.
+    );
+
+    /**Stop all the helper processes, waiting for requests in progress to
+       complete. Each helper gets end of file on its standard input, then
+       SIGTERM if it has not exited within a second, then SIGKILL a second
+       after that.
+     */
+    void Close();
+
+    /**Indicate the pool has been opened.
+     */
+    bool IsOpen() const { return !m_helpers.empty(); }
+
+    /**Send a request line to an idle helper and wait for its reply line.
+       The request must not contain a line feed, and the trailing line end
+       is removed from the reply.
+
+       @return
+       false if no helper became available, or the helper did not reply,
+       within the timeout. The timeout covers both waits together.
+     */
+    bool Execute(
+      const PString & request,   ///< Request line to send
+      PString & reply,           ///< Reply line received
+      const PTimeInterval & timeout = PMaxTimeInterval  ///< Time to wait for helper and reply
+    );
+
+    /**Get the number of helper processes in the pool.
+     */
+    PINDEX GetSize() const { return m_helpers.size(); }
+
+    /**Get the number of times helper processes have been started, including
+       restarts after a failure.
+     */
+    unsigned GetStartCount() const { return m_startCount; }
+  //@}
+
+  protected:
+    struct Helper {
+      PPipeChannel m_channel;
+      PString      m_pending;
+    };
+
+    bool Start(Helper & helper);
+    bool Transact(Helper & helper, const PString & request, PString & reply, const PTimeInterval & deadline);
+    bool WaitForHelpers(const PTimeInterval & timeout);
+
+    enum { HelperExitGrace = 1000 }; ///< Milliseconds for helpers to exit at each stage of Close()
+
+    PString             m_subProgram;
+    PStringArray        m_arguments;
+    PBoolean            m_searchPath;
+    std::vector<Helper *> m_helpers;
+    std::list<Helper *> m_idle;
+    PSemaphore          m_available;
+    PMutex              m_mutex;
+    unsigned            m_startCount;
+};
+
+
 #endif // PTLIB_PIPECHANNEL_H
 
 
@@ -134,6 +134,9 @@ class PTimerList : public PObject
 
     PTimer::IDType GetNewTimerId() const { return ++timerId; }
 
+    // Get the number of running timers
+    PINDEX GetActiveTimerCount() const;
+
     class RequestType {
       public:
         enum Action {
@@ -182,6 +185,9 @@ class PTimerList : public PObject
     };
     typedef std::map<PTimer::IDType, ActiveTimerInfo> ActiveTimerInfoMap;
     ActiveTimerInfoMap m_activeTimers;
+    // Only the timer thread changes m_activeTimers, this is held while it
+    // does, so other threads may read the size.
+    PMutex m_activeTimersMutex;
 
     // set used to store timer expiry times, in order
     struct TimerExpiryInfo {
@@ -640,6 +646,13 @@ class PProcess : public PThread
      */
     PTimerList * GetTimerList();
 
+    /**Get the number of threads currently running in the process.
+
+       @return
+       number of active threads.
+     */
+    PINDEX GetActiveThreadCount();
+
     /**Internal initialisation function called directly from
        <code>InternalMain()</code>. The user should never call this function.
      */
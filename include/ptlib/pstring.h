@@ -47,6 +47,7 @@
 
 class PStringArray;
 class PRegularExpression;
+class PRegexProgram;
 class PString;
 
 /**The same as the standard C snprintf(fmt, 1000, ...), but returns a
@@ -2387,8 +2388,7 @@ PDECLARE_SORTED_LIST(PSortedStringList, PString);
     PINDEX InternalStringSelect(
       const char * str,
       PINDEX len,
-      Element * thisElement,
-      Element * & lastElement
+      const Element * thisElement
     ) const;
 };
 
@@ -2977,6 +2977,12 @@ class PStringOptions : public PStringToString
    patterns in strings. The regular expression string is "compiled" into a
    form that is more efficient during the matching. This compiled form
    exists for the lifetime of the PRegularExpression instance.
+
+   Patterns without back references are also compiled into a DFA that is
+   built lazily as strings are matched, with a literal prefix and required
+   substring check to reject most strings before the DFA is run at all. The
+   system regexec() is then only used to locate parenthesised
+   subexpressions, and for patterns the DFA cannot represent.
  */
 class PRegularExpression : public PObject
 {
@@ -3248,10 +3254,80 @@ class PRegularExpression : public PObject
     int flagsSaved;
 
     void * expression;
+    PRegexProgram * program;
     mutable ErrorCodes lastError;
 };
 
 
+/**A set of regular expressions matched against a string in a single pass.
+   This is much faster than executing many PRegularExpression instances in
+   turn, for example when routing a dialled number through a large dial
+   plan, as the time taken depends on the length of the string and not on
+   the number of patterns.
+
+   Patterns that the combined DFA cannot represent, for example those with
+   back references, are executed individually after the single pass.
+ */
+class PRegexSet : public PObject
+{
+  PCLASSINFO(PRegexSet, PObject);
+
+  public:
+    /// Create an empty set of regular expressions.
+    PRegexSet();
+
+    /// Release storage for the compiled regular expressions.
+    ~PRegexSet();
+
+    /**Add a pattern to the set.
+
+       @return
+       Index of the pattern in the set, or P_MAX_INDEX if it did not compile.
+     */
+    PINDEX Add(
+      const PString & pattern,    ///< Pattern to compile
+      int flags = PRegularExpression::IgnoreCase  ///< Pattern match options
+    );
+
+    /// Remove all patterns from the set.
+    void RemoveAll();
+
+    /// Get the number of patterns in the set.
+    PINDEX GetSize() const { return m_patterns.GetSize(); }
+
+    /// Get a pattern in the set.
+    const PRegularExpression & operator[](PINDEX index) const { return m_patterns[index]; }
+
+    /** Execute regular expressions */
+    PBoolean Execute(
+      const PString & str,    ///< Source string to search
+      PIntArray & matches,    ///< Indexes of matching patterns
+      int flags = 0           ///< Pattern match options
+    ) const;
+    /**Execute regular expressions.
+       Each pattern is searched for anywhere in the string, as for
+       PRegularExpression::Execute(). The \p matches array is set to the
+       indexes, in ascending order, of all the patterns that matched.
+
+       @return true if at least one pattern matched.
+     */
+    PBoolean Execute(
+      const char * cstr,      ///< Source string to search
+      PIntArray & matches,    ///< Indexes of matching patterns
+      int flags = 0           ///< Pattern match options
+    ) const;
+
+  protected:
+    PArray<PRegularExpression> m_patterns;
+    PRegexProgram            * m_program;
+    std::vector<PINDEX>        m_individual;
+
+  private:
+    PRegexSet(const PRegexSet &) { }
+    void operator=(const PRegexSet &) { }
+};
+
+
 #endif // PTLIB_STRING_H
 
 
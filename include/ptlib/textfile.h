@@ -45,6 +45,11 @@
 /** A class representing a a structured file that is portable accross CPU
    architectures. Essentially this will normalise the end of line character
    which differs fromplatform to platform.
+
+   A text file has a <code>PFile::DefaultTextBufferSize</code> read ahead /
+   write behind buffer which is written out at the end of every line, so
+   readers such as log followers see complete lines as soon as they are
+   written. Use <code>PFile::SetBufferSize()</code> to change this.
  */
 class PTextFile : public PFile
 {
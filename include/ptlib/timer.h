@@ -357,6 +357,15 @@ class PTimer : public PTimeInterval
      */
     static PTimeInterval Tick();
 
+    /** Get the number of nanoseconds since some arbtrary point in time. This
+       is a monotonic counter with the highest resolution the platform
+       provides, for measuring intervals shorter than a millisecond.
+
+       @return
+       nanosecond counter.
+     */
+    static PInt64 HighResolutionTick();
+
     /** Get the smallest number of milliseconds that the timer can be set to.
        All actual timing events will be rounded up to the next value. This is
        typically the platforms internal timing units used in the <code>Tick()</code>
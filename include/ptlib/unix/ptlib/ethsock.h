@@ -41,4 +41,27 @@
     PBoolean        fakeMacHeader;
     PBoolean        ipppInterface;
 
+#if defined(P_LINUX)
+    bool    OpenRing();
+    void    CloseRing();
+    bool    AttachFilter();
+    void    ReleaseRingBlock();
+
+    int     m_interfaceIndex;
+    PINDEX  m_ringBlockCount;
+    PINDEX  m_ringBlockSize;
+    PINDEX  m_ringTxFrames;
+    BYTE  * m_ring;
+    size_t  m_ringSize;
+    PINDEX  m_rxBlock;
+    PINDEX  m_rxFramesLeft;
+    BYTE  * m_rxFrame;
+    bool    m_rxBlockHeld;
+    BYTE  * m_txRing;
+    PINDEX  m_txFrameSize;
+    PINDEX  m_txBlockSize;
+    PINDEX  m_txFrameCount;
+    PINDEX  m_txFrame;
+#endif
+
 // End Of File ////////////////////////////////////////////////////////////////
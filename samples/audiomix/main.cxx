@@ -0,0 +1,440 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the N-way audio conference mixer and to measure
+ * how many mixes per second it manages for large conferences.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/audiomix.h>
+
+#include <map>
+#include <vector>
+
+
+class AudioMix : public PProcess
+{
+  PCLASSINFO(AudioMix, PProcess)
+  public:
+    AudioMix();
+    void Main();
+
+  protected:
+    bool TestMix();
+    bool TestSpeakers();
+    bool TestJitterBuffer();
+    bool TestThread();
+    bool TestRemove();
+    void Benchmark(unsigned frames);
+};
+
+PCREATE_PROCESS(AudioMix);
+
+
+typedef std::vector<short> Samples;
+
+
+/* Mixer keeping the last mix given to each stream, and counting them. */
+class TestMixer : public PAudioMixer
+{
+  public:
+    TestMixer(unsigned sampleRate, unsigned jitterTime, PINDEX maxSpeakers = 0)
+      : PAudioMixer(sampleRate, 20, jitterTime, maxSpeakers)
+      , m_count(0)
+    {
+    }
+
+    Samples GetMix(const PString & key)
+    {
+      PWaitAndSignal lock(m_mutex);
+      return m_mixes[key];
+    }
+
+    unsigned GetCount()
+    {
+      PWaitAndSignal lock(m_mutex);
+      return m_count;
+    }
+
+  protected:
+    virtual void OnMixed(const PString & key, const short * mix, PINDEX count)
+    {
+      PWaitAndSignal lock(m_mutex);
+      m_mixes[key].assign(mix, mix + count);
+      ++m_count;
+    }
+
+    PMutex m_mutex;
+    std::map<PString, Samples> m_mixes;
+    unsigned m_count;
+};
+
+
+static unsigned Random(unsigned & seed)
+{
+  seed = seed*1103515245 + 12345;
+  return seed >> 16;
+}
+
+
+static short Saturate(int sample)
+{
+  return (short)(sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample);
+}
+
+
+/* The mix for each listener by adding up every other stream. */
+static void NaiveMix(const std::vector<Samples> & frames, std::vector<Samples> & mixes)
+{
+  PINDEX count = frames[0].size();
+  for (size_t listener = 0; listener < frames.size(); ++listener) {
+    for (PINDEX i = 0; i < count; ++i) {
+      int sum = 0;
+      for (size_t other = 0; other < frames.size(); ++other) {
+        if (other != listener)
+          sum += frames[other][i];
+      }
+      mixes[listener][i] = Saturate(sum);
+    }
+  }
+}
+
+
+static PString StreamKey(PINDEX index)
+{
+  return psprintf("stream%03u", (unsigned)index);
+}
+
+
+AudioMix::AudioMix()
+  : PProcess("PTLib", "audiomix", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void AudioMix::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-frames:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestMix();
+  ok = TestSpeakers() && ok;
+  ok = TestJitterBuffer() && ok;
+  ok = TestThread() && ok;
+  ok = TestRemove() && ok;
+
+  if (!args.HasOption('T'))
+    Benchmark(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 500);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+bool AudioMix::TestMix()
+{
+  static const PINDEX Streams = 7;
+
+  // 8kHz frames are 160 samples, 44.1kHz ones 882, which leaves a SIMD tail
+  static const unsigned Rates[] = { 8000, 44100 };
+
+  unsigned seed = 1;
+  for (PINDEX r = 0; r < PARRAYSIZE(Rates); ++r) {
+    TestMixer mixer(Rates[r], 0);
+    PINDEX frameSamples = mixer.GetFrameSamples();
+    for (PINDEX s = 0; s < Streams; ++s)
+      mixer.AddStream(StreamKey(s));
+
+    std::vector<Samples> frames(Streams, Samples(frameSamples));
+    std::vector<Samples> expected(Streams, Samples(frameSamples));
+
+    for (PINDEX frame = 0; frame < 10; ++frame) {
+      // Loud enough in later frames for the mixes to saturate
+      int amplitude = frame < 5 ? 4000 : 32768;
+      for (PINDEX s = 0; s < Streams; ++s) {
+        for (PINDEX i = 0; i < frameSamples; ++i)
+          frames[s][i] = (short)((int)(Random(seed) % (2*amplitude)) - amplitude);
+        mixer.WriteStream(StreamKey(s), &frames[s][0], frameSamples, (DWORD)(frame*frameSamples));
+      }
+
+      mixer.MixFrame();
+      NaiveMix(frames, expected);
+
+      for (PINDEX s = 0; s < Streams; ++s) {
+        if (mixer.GetMix(StreamKey(s)) != expected[s]) {
+          cout << "Mix at " << Rates[r] << "Hz for stream " << s << " in frame " << frame
+               << " differs from adding the other streams: failed" << endl;
+          return false;
+        }
+      }
+    }
+  }
+
+  cout << "Mixes without each stream: passed" << endl;
+  return true;
+}
+
+
+bool AudioMix::TestSpeakers()
+{
+  static const PINDEX Streams = 6;
+  TestMixer mixer(8000, 0, 2);
+  PINDEX frameSamples = mixer.GetFrameSamples();
+  for (PINDEX s = 0; s < Streams; ++s)
+    mixer.AddStream(StreamKey(s));
+
+  // Square waves, stream s at amplitude levels[s]
+  int levels[Streams] = { 1000, 2000, 3000, 4000, 5000, 6000 };
+  Samples frame(frameSamples);
+  PINDEX written = 0;
+
+  struct Step {
+    int     m_level3;   // new level of stream 3
+    PINDEX  m_first;    // expected speakers
+    PINDEX  m_second;
+  } Steps[] = {
+    { 4000, 5, 4 },     // two loudest
+    { 5400, 5, 4 },     // a little louder than a speaker is not enough
+    { 7000, 5, 3 },     // a lot louder replaces the quieter speaker
+  };
+
+  for (PINDEX step = 0; step < PARRAYSIZE(Steps); ++step) {
+    levels[3] = Steps[step].m_level3;
+
+    for (PINDEX f = 0; f < 30; ++f, ++written) {
+      for (PINDEX s = 0; s < Streams; ++s) {
+        for (PINDEX i = 0; i < frameSamples; ++i)
+          frame[i] = (short)((i & 1) != 0 ? levels[s] : -levels[s]);
+        mixer.WriteStream(StreamKey(s), &frame[0], frameSamples, (DWORD)(written*frameSamples));
+      }
+      mixer.MixFrame();
+    }
+
+    // A speaker hears the other speaker, everyone else hears both
+    PINDEX first = Steps[step].m_first;
+    PINDEX second = Steps[step].m_second;
+    for (PINDEX s = 0; s < Streams; ++s) {
+      int expected = (s != first ? levels[first] : 0) + (s != second ? levels[second] : 0);
+      Samples mix = mixer.GetMix(StreamKey(s));
+      if (mix[1] != expected || mix[0] != -expected) {
+        cout << "Speakers " << first << " and " << second << ": stream " << s << " hears "
+             << mix[1] << " not " << expected << ": failed" << endl;
+        return false;
+      }
+    }
+  }
+
+  cout << "Active speaker selection: passed" << endl;
+  return true;
+}
+
+
+bool AudioMix::TestJitterBuffer()
+{
+  // 60ms of jitter is three 20ms frames; the timestamps wrap past 2^32
+  TestMixer mixer(8000, 60);
+  PINDEX frameSamples = mixer.GetFrameSamples();
+  DWORD base = 0xffffffff - (DWORD)(2*frameSamples) + 1;
+  mixer.AddStream("talker");
+  mixer.AddStream("listener");
+
+  struct Action {
+    int m_write;      // frame to write, or -1 to mix
+    int m_expected;   // frame the listener hears after mixing, or -1 for silence
+  } Actions[] = {
+    {  0,  0 }, {  2,  0 }, {  1,  0 },         // out of order
+    { -1, -1 }, { -1, -1 }, { -1, -1 },         // jitter delay
+    { -1,  0 }, { -1,  1 },
+    {  4,  0 }, { -1,  2 },
+    { -1, -1 },                                 // frame 3 missing
+    {  3,  0 },                                 // ... and late
+    { -1,  4 }, { -1, -1 },
+    { 1000, 0 },                                // a jump restarts the buffer
+    { -1, -1 }, { -1, -1 }, { -1, -1 }, { -1, 1000 }
+  };
+
+  Samples frame(frameSamples);
+  for (PINDEX a = 0; a < PARRAYSIZE(Actions); ++a) {
+    int index = Actions[a].m_write;
+    if (index >= 0) {
+      std::fill(frame.begin(), frame.end(), (short)(index + 1));
+      // Written in two halves, the second half first after the first write
+      PINDEX half = frameSamples/2;
+      DWORD timestamp = base + (DWORD)(index*frameSamples);
+      if (a == 0)
+        mixer.WriteStream("talker", &frame[0], half, timestamp);
+      mixer.WriteStream("talker", &frame[half], frameSamples - half, timestamp + (DWORD)half);
+      if (a != 0)
+        mixer.WriteStream("talker", &frame[0], half, timestamp);
+      continue;
+    }
+
+    mixer.MixFrame();
+    short expected = (short)(Actions[a].m_expected + 1);
+    Samples heard = mixer.GetMix("listener");
+    if (heard != Samples(frameSamples, expected)) {
+      cout << "Jitter buffer action " << a << " gave " << heard[0] << " not " << expected << ": failed" << endl;
+      return false;
+    }
+    if (mixer.GetMix("talker") != Samples(frameSamples, 0)) {
+      cout << "Talker hears itself: failed" << endl;
+      return false;
+    }
+  }
+
+  cout << "Jitter buffer: passed" << endl;
+  return true;
+}
+
+
+bool AudioMix::TestThread()
+{
+  TestMixer mixer(16000, 0);
+  mixer.AddStream("one");
+  mixer.AddStream("two");
+
+  mixer.Start();
+  PThread::Sleep(1000);
+  mixer.Stop();
+
+  // Two streams, fifty 20ms frames a second
+  unsigned count = mixer.GetCount();
+  if (count < 90 || count > 110) {
+    cout << "Paced thread mixed " << count/2 << " frames in a second: failed" << endl;
+    return false;
+  }
+
+  cout << "Paced mixing thread: passed" << endl;
+  return true;
+}
+
+
+bool AudioMix::TestRemove()
+{
+  TestMixer mixer(8000, 0);
+  Samples frame(mixer.GetFrameSamples(), 100);
+
+  if (!mixer.AddStream("a") || !mixer.AddStream("b") || !mixer.AddStream("c") || mixer.AddStream("b")) {
+    cout << "Adding streams: failed" << endl;
+    return false;
+  }
+
+  mixer.WriteStream("b", &frame[0], frame.size(), 0);
+  mixer.WriteStream("c", &frame[0], frame.size(), 0);
+  if (!mixer.RemoveStream("b") || mixer.RemoveStream("b") ||
+       mixer.GetStreamCount() != 2 || mixer.WriteStream("b", &frame[0], frame.size(), 0)) {
+    cout << "Removing streams: failed" << endl;
+    return false;
+  }
+
+  mixer.MixFrame();
+  if (mixer.GetMix("a") != frame || mixer.GetMix("c") != Samples(frame.size(), 0)) {
+    cout << "Mixing after removal: failed" << endl;
+    return false;
+  }
+
+  cout << "Removing streams: passed" << endl;
+  return true;
+}
+
+
+/* Mixer doing no more with each mix than a real one would, reading it. */
+class BenchmarkMixer : public PAudioMixer
+{
+  public:
+    BenchmarkMixer(unsigned sampleRate, PINDEX maxSpeakers)
+      : PAudioMixer(sampleRate, 20, 0, maxSpeakers)
+      , m_check(0)
+    {
+    }
+
+    int m_check;
+
+  protected:
+    virtual void OnMixed(const PString &, const short * mix, PINDEX count)
+    {
+      m_check += mix[0] + mix[count-1];
+    }
+};
+
+
+void AudioMix::Benchmark(unsigned frames)
+{
+  static const unsigned Rates[] = { 8000, 16000, 48000 };
+  static const PINDEX Participants[] = { 100, 250 };
+  static const PINDEX Speakers[] = { 0, 3 };
+
+  cout << "20ms frames mixed per second, including writing the jitter buffers:" << endl;
+  for (PINDEX p = 0; p < PARRAYSIZE(Participants); ++p) {
+    PINDEX participants = Participants[p];
+    for (PINDEX r = 0; r < PARRAYSIZE(Rates); ++r) {
+      cout << "  " << setw(3) << participants << " streams at " << setw(5) << Rates[r] << "Hz";
+
+      unsigned seed = 1;
+      std::vector<Samples> audio(participants, Samples(Rates[r]/50));
+      for (PINDEX s = 0; s < participants; ++s) {
+        for (size_t i = 0; i < audio[s].size(); ++i)
+          audio[s][i] = (short)((int)(Random(seed) % 2000) - 1000);
+      }
+      PINDEX frameSamples = audio[0].size();
+
+      for (PINDEX sp = 0; sp < PARRAYSIZE(Speakers); ++sp) {
+        BenchmarkMixer mixer(Rates[r], Speakers[sp]);
+        for (PINDEX s = 0; s < participants; ++s)
+          mixer.AddStream(StreamKey(s));
+
+        PInt64 start = PTimer::HighResolutionTick();
+        for (unsigned f = 0; f < frames; ++f) {
+          for (PINDEX s = 0; s < participants; ++s)
+            mixer.WriteStream(StreamKey(s), &audio[s][0], frameSamples, (DWORD)(f*frameSamples));
+          mixer.MixFrame();
+        }
+        PInt64 duration = PTimer::HighResolutionTick() - start;
+
+        if (Speakers[sp] == 0)
+          cout << "  all mixed";
+        else
+          cout << "  " << Speakers[sp] << " speakers";
+        cout << setw(8) << (unsigned)(frames*1e9/duration) << "/s";
+      }
+
+      // Adding up every other stream for each listener, for comparison
+      std::vector<Samples> mixes(participants, Samples(frameSamples));
+      unsigned naiveFrames = std::max(1U, frames/50);
+      PInt64 start = PTimer::HighResolutionTick();
+      for (unsigned f = 0; f < naiveFrames; ++f)
+        NaiveMix(audio, mixes);
+      PInt64 duration = PTimer::HighResolutionTick() - start;
+      cout << "  naive" << setw(7) << (unsigned)(naiveFrames*1e9/duration) << "/s" << endl;
+    }
+  }
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,497 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test PBase64 against the original byte at a time
+ * implementation, and to measure its throughput.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/cypher.h>
+#include <ptclib/memfile.h>
+#include <ptclib/random.h>
+
+
+class Base64Test : public PProcess
+{
+  PCLASSINFO(Base64Test, PProcess)
+  public:
+    Base64Test();
+    void Main();
+
+  protected:
+    bool TestEncode(unsigned iterations);
+    bool TestDecode(unsigned iterations);
+    bool TestStreaming(unsigned iterations);
+    void Benchmark(PINDEX size, unsigned count);
+
+    // PRandom::Generate(min, max) does not terminate for a range of one
+    unsigned Random(unsigned minimum, unsigned maximum) { return minimum + m_random.Generate()%(maximum - minimum + 1); }
+
+    PRandom m_random;
+};
+
+PCREATE_PROCESS(Base64Test);
+
+
+Base64Test::Base64Test()
+  : PProcess("PTLib", "base64", 1, 0, AlphaCode, 1)
+  , m_random(5678)
+{
+}
+
+
+void Base64Test::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("i-iterations:"
+             "n-count:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  unsigned iterations = args.HasOption('i') ? args.GetOptionString('i').AsUnsigned() : 20000;
+  bool ok = TestEncode(iterations);
+  ok = TestDecode(iterations) && ok;
+  ok = TestStreaming(iterations/10) && ok;
+
+  if (!args.HasOption('T')) {
+    unsigned count = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 50000;
+    static const PINDEX sizes[] = { 24, 256, 4096, 65536 };
+    for (PINDEX i = 0; i < PARRAYSIZE(sizes); ++i)
+      Benchmark(sizes[i], (unsigned)(count*256/(sizes[i]+256)));
+  }
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+/* The implementation of PBase64 before it used blocks, encoding and decoding
+   a byte at a time, used as the reference. */
+class OriginalBase64
+{
+  public:
+    OriginalBase64(const char * eol)
+      : encodeLength(0), saveCount(0), nextLine(0), endOfLine(eol)
+      , perfectDecode(true), quadPosition(0), decodeSize(0)
+    {
+    }
+
+    void OutputBase64(const BYTE * data)
+    {
+      static const char Binary2Base64[65] =
+                  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+      // The original overran this for end of lines over four characters
+      char * out = encodedString.GetPointer(((encodeLength+endOfLine.GetLength()+7)&~255) + 256);
+
+      out[encodeLength++] = Binary2Base64[data[0] >> 2];
+      out[encodeLength++] = Binary2Base64[((data[0]&3)<<4) | (data[1]>>4)];
+      out[encodeLength++] = Binary2Base64[((data[1]&15)<<2) | (data[2]>>6)];
+      out[encodeLength++] = Binary2Base64[data[2]&0x3f];
+
+      PINDEX len = endOfLine.GetLength();
+      if (++nextLine > (76-len)/4) {
+        for (PINDEX i = 0; i < len; ++i)
+          out[encodeLength++] = endOfLine[i];
+        nextLine = 0;
+      }
+    }
+
+    void ProcessEncoding(const void * dataPtr, PINDEX length)
+    {
+      if (length == 0)
+        return;
+
+      const BYTE * data = (const BYTE *)dataPtr;
+      while (saveCount < 3) {
+        saveTriple[saveCount++] = *data++;
+        if (--length == 0) {
+          if (saveCount == 3) {
+            OutputBase64(saveTriple);
+            saveCount = 0;
+          }
+          return;
+        }
+      }
+
+      OutputBase64(saveTriple);
+
+      PINDEX i;
+      for (i = 0; i+2 < length; i += 3)
+        OutputBase64(data+i);
+
+      saveCount = length - i;
+      switch (saveCount) {
+        case 2 :
+          saveTriple[0] = data[i++];
+          saveTriple[1] = data[i];
+          break;
+        case 1 :
+          saveTriple[0] = data[i];
+      }
+    }
+
+    PString CompleteEncoding()
+    {
+      static const char Binary2Base64[65] =
+                  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+      char * out = encodedString.GetPointer(encodeLength + 5)+encodeLength;
+
+      switch (saveCount) {
+        case 1 :
+          *out++ = Binary2Base64[saveTriple[0] >> 2];
+          *out++ = Binary2Base64[(saveTriple[0]&3)<<4];
+          *out++ = '=';
+          *out   = '=';
+          break;
+
+        case 2 :
+          *out++ = Binary2Base64[saveTriple[0] >> 2];
+          *out++ = Binary2Base64[((saveTriple[0]&3)<<4) | (saveTriple[1]>>4)];
+          *out++ = Binary2Base64[((saveTriple[1]&15)<<2)];
+          *out   = '=';
+      }
+
+      return encodedString;
+    }
+
+    bool ProcessDecoding(const char * cstr)
+    {
+      static const BYTE Base642Binary[256] = {
+        96, 99, 99, 99, 99, 99, 99, 99, 99, 99, 98, 99, 99, 98, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 62, 99, 99, 99, 63,
+        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 99, 99, 99, 97, 99, 99,
+        99,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 99, 99, 99, 99, 99,
+        99, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+      };
+
+      for (;;) {
+        BYTE value = Base642Binary[(BYTE)*cstr++];
+        switch (value) {
+          case 96 : // end of string
+            return false;
+
+          case 97 : // '=' sign
+            if (quadPosition == 3 || (quadPosition == 2 && *cstr == '=')) {
+              quadPosition = 0;
+              return true;
+            }
+            perfectDecode = false;
+            break;
+
+          case 98 : // CRLFs
+            break;
+
+          case 99 :  // Illegal characters
+            perfectDecode = false;
+            break;
+
+          default : // legal value from 0 to 63
+            BYTE * out = decodedData.GetPointer(((decodeSize+1)&~255) + 256);
+            switch (quadPosition) {
+              case 0 :
+                out[decodeSize] = (BYTE)(value << 2);
+                break;
+              case 1 :
+                out[decodeSize++] |= (BYTE)(value >> 4);
+                out[decodeSize] = (BYTE)((value&15) << 4);
+                break;
+              case 2 :
+                out[decodeSize++] |= (BYTE)(value >> 2);
+                out[decodeSize] = (BYTE)((value&3) << 6);
+                break;
+              case 3 :
+                out[decodeSize++] |= (BYTE)value;
+                break;
+            }
+            quadPosition = (quadPosition+1)&3;
+        }
+      }
+    }
+
+    PBYTEArray GetDecodedData()
+    {
+      perfectDecode = quadPosition == 0;
+      decodedData.SetSize(decodeSize);
+      return decodedData;
+    }
+
+    PString    encodedString;
+    PINDEX     encodeLength;
+    BYTE       saveTriple[3];
+    PINDEX     saveCount;
+    PINDEX     nextLine;
+    PString    endOfLine;
+    bool       perfectDecode;
+    PINDEX     quadPosition;
+    PBYTEArray decodedData;
+    PINDEX     decodeSize;
+};
+
+
+static const char * const EndOfLines[] = { "\n", "\r\n", "", "<br>\r\n", "--------------------------------------------------------------------------------\n" };
+
+
+bool Base64Test::TestEncode(unsigned iterations)
+{
+  bool ok = true;
+  for (unsigned i = 0; i < iterations && ok; ++i) {
+    PBYTEArray data(Random(0, i < iterations/2 ? 200 : 5000));
+    for (PINDEX j = 0; j < data.GetSize(); ++j)
+      data[j] = (BYTE)m_random.Generate();
+
+    const char * eol = EndOfLines[i % PARRAYSIZE(EndOfLines)];
+    OriginalBase64 original(eol);
+    PBase64 base64;
+    base64.StartEncoding(eol);
+
+    // Feed in random sized pieces, taking partial strings as we go
+    PString partial;
+    PINDEX done = 0;
+    while (done < data.GetSize()) {
+      PINDEX piece = Random(1, 300);
+      if (piece > data.GetSize() - done)
+        piece = data.GetSize() - done;
+      original.ProcessEncoding((const BYTE *)data + done, piece);
+      base64.ProcessEncoding((const BYTE *)data + done, piece);
+      done += piece;
+      if (Random(0, 3) == 0)
+        partial += base64.GetEncodedString();
+    }
+
+    PString expected = original.CompleteEncoding();
+    if (partial + base64.CompleteEncoding() != expected ||
+        PBase64::Encode(data, eol) != expected)
+      ok = false;
+  }
+
+  cout << "Encoding matches original: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool Base64Test::TestDecode(unsigned iterations)
+{
+  static const char Noise[] = "\r\n\r\n =-*\x80\xff!";
+
+  bool ok = true;
+  for (unsigned i = 0; i < iterations && ok; ++i) {
+    PBYTEArray data(Random(0, i < iterations/2 ? 200 : 5000));
+    for (PINDEX j = 0; j < data.GetSize(); ++j)
+      data[j] = (BYTE)m_random.Generate();
+    PString encoded = PBase64::Encode(data, EndOfLines[i % 2]);
+
+    // Sprinkle in noise and truncate some, so the rare paths are compared too
+    switch (i % 4) {
+      case 1 :
+        for (unsigned n = Random(1, 10); n > 0; --n)
+          encoded.Splice(PString(Noise[Random(0, sizeof(Noise)-2)]), Random(0, encoded.GetLength()), 0);
+        break;
+      case 2 :
+        encoded.Delete(Random(0, encoded.GetLength()), P_MAX_INDEX);
+        break;
+      case 3 :
+        encoded.Replace("=", "");
+        break;
+    }
+
+    OriginalBase64 original("\n");
+    PBase64 base64;
+
+    // Split where the original would not mind, that is away from '=' signs
+    PINDEX split = Random(0, encoded.GetLength());
+    while (split > 0 && (encoded[split] == '=' || encoded[split-1] == '='))
+      --split;
+
+    bool originalLast = original.ProcessDecoding(encoded.Left(split));
+    bool last = base64.ProcessDecoding(encoded.Left(split));
+    if (!originalLast) {
+      originalLast = original.ProcessDecoding(encoded.Mid(split));
+      last = base64.ProcessDecoding(encoded.Mid(split));
+    }
+
+    PBYTEArray expected = original.GetDecodedData();
+    PBYTEArray decoded = base64.GetDecodedData();
+
+    PBYTEArray single;
+    bool singleOK = PBase64::Decode(encoded, single);
+
+    if (last != originalLast ||
+        decoded != expected ||
+        single != expected ||
+        base64.IsDecodeOK() != original.perfectDecode ||
+        singleOK != original.perfectDecode ||
+        (i % 4 == 0 && expected != data)) {
+      cout << "Mismatch decoding \"" << encoded << '"' << endl;
+      ok = false;
+    }
+  }
+
+  cout << "Decoding matches original: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool Base64Test::TestStreaming(unsigned iterations)
+{
+  bool ok = true;
+  for (unsigned i = 0; i < iterations && ok; ++i) {
+    PBYTEArray data(Random(0, 100000));
+    for (PINDEX j = 0; j < data.GetSize(); ++j)
+      data[j] = (BYTE)m_random.Generate();
+
+    const char * eol = EndOfLines[i % PARRAYSIZE(EndOfLines)];
+    PString expected = PBase64::Encode(data, eol);
+
+    // Into a caller buffer, and through a channel
+    PBase64 toBuffer, toChannel;
+    toBuffer.StartEncoding(eol);
+    toChannel.StartEncoding(eol);
+
+    PCharArray buffer(toBuffer.GetMaxEncodedLength(data.GetSize()) + 1);
+    PMemoryFile file;
+    PINDEX length = 0;
+    PINDEX done = 0;
+    while (done < data.GetSize()) {
+      PINDEX piece = Random(1, 20000);
+      if (piece > data.GetSize() - done)
+        piece = data.GetSize() - done;
+      length += toBuffer.ProcessEncoding((const BYTE *)data + done, piece, buffer.GetPointer() + length);
+      if (!toChannel.ProcessEncoding((const BYTE *)data + done, piece, file))
+        ok = false;
+      done += piece;
+    }
+    length += toBuffer.CompleteEncoding(buffer.GetPointer() + length);
+    if (!toChannel.CompleteEncoding(file))
+      ok = false;
+
+    if (PString(buffer, length) != expected ||
+        PString((const char *)(const BYTE *)file.GetData(), (PINDEX)file.GetLength()) != expected)
+      ok = false;
+
+    // And decoding back into a caller buffer, in pieces
+    PBase64 decoder;
+    PBYTEArray decoded(PBase64::GetMaxDecodedLength(expected.GetLength()));
+    PINDEX decodedLength = 0;
+    done = 0;
+    bool last = false;
+    while (done < expected.GetLength() && !last) {
+      PINDEX piece = Random(1, 20000);
+      if (piece > expected.GetLength() - done)
+        piece = expected.GetLength() - done;
+      PINDEX count;
+      last = decoder.ProcessDecoding((const char *)expected + done, piece, decoded.GetPointer() + decodedLength, count);
+      decodedLength += count;
+      done += piece;
+    }
+    decodedLength += decoder.CompleteDecoding(decoded.GetPointer() + decodedLength);
+    decoded.SetSize(decodedLength);
+    // The letters of "<br>" are decoded as data, so will not match
+    if (decoded != data && strcmp(eol, "<br>\r\n") != 0)
+      ok = false;
+  }
+
+  cout << "Streaming to buffer and channel: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+void Base64Test::Benchmark(PINDEX size, unsigned count)
+{
+  PBYTEArray data(size);
+  for (PINDEX j = 0; j < size; ++j)
+    data[j] = (BYTE)m_random.Generate();
+  PString encoded = PBase64::Encode(data, "\r\n");
+  PCharArray buffer(PBase64().GetMaxEncodedLength(size));
+  PBYTEArray decoded(PBase64::GetMaxDecodedLength(encoded.GetLength()));
+
+  // Alternate, taking the best of each, as other load skews single runs
+  PInt64 best[5] = { 0 };
+  for (int round = 0; round < 5; round++) {
+    PInt64 times[5];
+    PInt64 start = PTimer::HighResolutionTick();
+    for (unsigned i = 0; i < count; ++i) {
+      OriginalBase64 original("\r\n");
+      original.ProcessEncoding(data, size);
+      original.CompleteEncoding();
+    }
+    times[0] = PTimer::HighResolutionTick() - start;
+
+    start = PTimer::HighResolutionTick();
+    for (unsigned i = 0; i < count; ++i)
+      PBase64::Encode(data, "\r\n");
+    times[1] = PTimer::HighResolutionTick() - start;
+
+    start = PTimer::HighResolutionTick();
+    for (unsigned i = 0; i < count; ++i) {
+      PBase64 base64;
+      base64.CompleteEncoding(buffer.GetPointer() + base64.ProcessEncoding(data, size, buffer.GetPointer()));
+    }
+    times[2] = PTimer::HighResolutionTick() - start;
+
+    start = PTimer::HighResolutionTick();
+    for (unsigned i = 0; i < count; ++i) {
+      OriginalBase64 original("\r\n");
+      original.ProcessDecoding(encoded);
+      original.GetDecodedData();
+    }
+    times[3] = PTimer::HighResolutionTick() - start;
+
+    start = PTimer::HighResolutionTick();
+    for (unsigned i = 0; i < count; ++i) {
+      PBase64 base64;
+      PINDEX length;
+      base64.ProcessDecoding(encoded, encoded.GetLength(), decoded.GetPointer(), length);
+    }
+    times[4] = PTimer::HighResolutionTick() - start;
+
+    for (int t = 0; t < 5; ++t) {
+      if (round == 0 || times[t] < best[t])
+        best[t] = times[t];
+    }
+  }
+
+  static const char * const Names[5] = {
+    "original encode", "Encode()", "encode to buffer", "original decode", "decode to buffer"
+  };
+  cout << size << " byte blocks:" << endl;
+  for (int t = 0; t < 5; ++t)
+    cout << "  " << setw(20) << left << Names[t] << right << setw(8)
+         << (PUInt64)size*count*1000/best[t] << " MB/s" << endl;
+}
@@ -0,0 +1,535 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the PCLISocket threading modes, and to compare
+ * them with many concurrent clients.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptlib/sockets.h>
+#include <ptclib/cli.h>
+#include <ptclib/telnet.h>
+
+
+class CLITest : public PProcess
+{
+  PCLASSINFO(CLITest, PProcess)
+  public:
+    CLITest();
+    void Main();
+
+  protected:
+    void SetCommands(PCLI & cli);
+    bool TestPipelining(PCLISocket::ThreadingModes mode);
+    bool TestSlowCommand(PCLISocket::ThreadingModes mode);
+    bool TestLargeOutput(PCLISocket::ThreadingModes mode);
+    bool TestExit(PCLISocket::ThreadingModes mode);
+    bool TestTelnet(PCLISocket::ThreadingModes mode);
+    bool TestInputOverride(PCLISocket::ThreadingModes mode);
+    bool TestStalledClient();
+    void Benchmark(PCLISocket::ThreadingModes mode, unsigned clients, unsigned rounds, unsigned batch);
+
+    PDECLARE_NOTIFIER(PCLI::Arguments, CLITest, CmdStatus);
+    PDECLARE_NOTIFIER(PCLI::Arguments, CLITest, CmdSleep);
+    PDECLARE_NOTIFIER(PCLI::Arguments, CLITest, CmdDump);
+
+    unsigned m_workers;
+};
+
+PCREATE_PROCESS(CLITest);
+
+
+static const char * const ModeNames[] = { "ThreadPerContext", "SingleThreadForAll", "Reactor" };
+static const unsigned DumpLines = 16384;
+
+
+// Context that reads '%' as a space, to check all input goes via ProcessInput(int)
+class PercentContext : public PCLI::Context
+{
+  public:
+    PercentContext(PCLI & cli)
+      : PCLI::Context(cli)
+    {
+    }
+
+    virtual bool ProcessInput(int ch)
+    {
+      return PCLI::Context::ProcessInput(ch == '%' ? ' ' : ch);
+    }
+};
+
+
+class TestCLI : public PCLISocket
+{
+  PCLASSINFO(TestCLI, PCLISocket);
+  public:
+    TestCLI(ThreadingModes mode, unsigned workers, bool percent = false)
+      : PCLISocket(0, "> ", mode, workers)
+      , m_percent(percent)
+    {
+    }
+
+    virtual Context * CreateContext()
+    {
+      return m_percent ? new PercentContext(*this) : PCLISocket::CreateContext();
+    }
+
+    bool m_percent;
+
+    size_t GetContextCount()
+    {
+      PWaitAndSignal mutex(m_contextMutex);
+      return m_contextList.size();
+    }
+};
+
+
+CLITest::CLITest()
+  : PProcess("PTLib", "clitest", 1, 0, AlphaCode, 1)
+  , m_workers(4)
+{
+}
+
+
+void CLITest::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("c-clients:"
+             "r-rounds:"
+             "b-batch:"
+             "w-workers:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  if (args.HasOption('w'))
+    m_workers = args.GetOptionString('w').AsUnsigned();
+
+  bool ok = true;
+  static const PCLISocket::ThreadingModes modes[] = { PCLISocket::ThreadPerContext, PCLISocket::Reactor };
+  for (PINDEX i = 0; i < PARRAYSIZE(modes); ++i) {
+    cout << ModeNames[modes[i]] << ':' << endl;
+    ok = TestPipelining(modes[i]) && ok;
+    ok = TestSlowCommand(modes[i]) && ok;
+    ok = TestLargeOutput(modes[i]) && ok;
+    ok = TestExit(modes[i]) && ok;
+    ok = TestTelnet(modes[i]) && ok;
+  }
+
+  cout << "All modes:" << endl;
+  for (PINDEX i = 0; i < PARRAYSIZE(ModeNames); ++i)
+    ok = TestInputOverride((PCLISocket::ThreadingModes)i) && ok;
+  ok = TestStalledClient() && ok;
+
+  if (!args.HasOption('T')) {
+    unsigned clients = args.HasOption('c') ? args.GetOptionString('c').AsUnsigned() : 1000;
+    unsigned rounds = args.HasOption('r') ? args.GetOptionString('r').AsUnsigned() : 20;
+    unsigned batch = args.HasOption('b') ? args.GetOptionString('b').AsUnsigned() : 5;
+    Benchmark(PCLISocket::ThreadPerContext, clients, rounds, batch);
+    Benchmark(PCLISocket::SingleThreadForAll, clients, rounds, batch);
+    Benchmark(PCLISocket::Reactor, clients, rounds, batch);
+  }
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+void CLITest::SetCommands(PCLI & cli)
+{
+  cli.SetCommand("status", PCREATE_NOTIFIER(CmdStatus), "Report status", "[ <tag> ]");
+  cli.SetCommand("sleep", PCREATE_NOTIFIER(CmdSleep), "Take half a second to complete");
+  cli.SetCommand("dump", PCREATE_NOTIFIER(CmdDump), "Output 2Mb of text", "[ <lines> ]");
+}
+
+
+void CLITest::CmdStatus(PCLI::Arguments & args, INT)
+{
+  args.GetContext() << "OK " << (args.GetCount() > 0 ? args[0] : PString::Empty()) << endl;
+}
+
+
+void CLITest::CmdSleep(PCLI::Arguments & args, INT)
+{
+  PThread::Sleep(500);
+  args.GetContext() << "slept" << endl;
+}
+
+
+void CLITest::CmdDump(PCLI::Arguments & args, INT)
+{
+  PString line(std::string(126, 'x').c_str());
+  unsigned count = args.GetCount() > 0 ? args[0].AsUnsigned() : DumpLines;
+  for (unsigned i = 0; i < count; ++i)
+    args.GetContext() << line << '\n';
+  args.GetContext().flush();
+}
+
+
+// Read until have the number of lines, returning them without prompts
+static bool ReadLines(PTCPSocket & socket, unsigned count, PStringArray & lines)
+{
+  PString line;
+  while (count > 0) {
+    char buffer[4096];
+    if (!socket.Read(buffer, sizeof(buffer)))
+      return false;
+
+    for (PINDEX i = 0; i < socket.GetLastReadCount(); ++i) {
+      switch (buffer[i]) {
+        case '\n' :
+          if (line.Find("> ") == 0)
+            line.Delete(0, 2);
+          lines.AppendString(line);
+          line.MakeEmpty();
+          --count;
+          break;
+        case '\r' :
+          break;
+        default :
+          line += buffer[i];
+      }
+    }
+  }
+  return true;
+}
+
+
+static bool Connect(PTCPSocket & socket, PCLISocket & cli)
+{
+  socket.SetReadTimeout(10000);
+  socket.SetPort(cli.GetPort());
+  return socket.Connect("127.0.0.1");
+}
+
+
+bool CLITest::TestPipelining(PCLISocket::ThreadingModes mode)
+{
+  TestCLI cli(mode, m_workers);
+  SetCommands(cli);
+  cli.Start(true);
+
+  PTCPSocket socket;
+  PStringArray lines;
+  bool ok = Connect(socket, cli) &&
+            socket.WriteString("status 1\nstatus 2\nstatus 3\nstatus 4\n") &&
+            ReadLines(socket, 4, lines) &&
+            lines[0] == "OK 1" && lines[1] == "OK 2" && lines[2] == "OK 3" && lines[3] == "OK 4";
+
+  cout << "  Pipelined commands in order: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool CLITest::TestSlowCommand(PCLISocket::ThreadingModes mode)
+{
+  TestCLI cli(mode, m_workers);
+  SetCommands(cli);
+  cli.Start(true);
+
+  PTCPSocket slow, fast;
+  if (!Connect(slow, cli) || !Connect(fast, cli) || !slow.WriteString("sleep\nstatus 5\n")) {
+    cout << "  Slow command: FAILED to connect" << endl;
+    return false;
+  }
+
+  PThread::Sleep(50);
+
+  PTimeInterval start = PTimer::Tick();
+  PStringArray fastLines;
+  bool ok = fast.WriteString("status 6\n") && ReadLines(fast, 1, fastLines) && fastLines[0] == "OK 6";
+  PTimeInterval fastTime = PTimer::Tick() - start;
+
+  PStringArray slowLines;
+  ok = ok && ReadLines(slow, 2, slowLines) && slowLines[0] == "slept" && slowLines[1] == "OK 5";
+  ok = ok && fastTime < 200;
+
+  cout << "  Slow command does not hold up others, " << fastTime.GetMilliSeconds()
+       << "ms: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool CLITest::TestLargeOutput(PCLISocket::ThreadingModes mode)
+{
+  TestCLI cli(mode, m_workers);
+  SetCommands(cli);
+  cli.Start(true);
+
+  PTCPSocket big, other;
+  bool ok = Connect(big, cli) && Connect(other, cli) && big.WriteString("dump\nstatus 7\n");
+
+  // Do not read the big output for a while, the other client should still get through
+  PThread::Sleep(300);
+  PStringArray otherLines;
+  ok = ok && other.WriteString("status 8\n") && ReadLines(other, 1, otherLines) && otherLines[0] == "OK 8";
+
+  PStringArray bigLines;
+  ok = ok && ReadLines(big, DumpLines+1, bigLines) &&
+       bigLines[0].GetLength() == 126 && bigLines[DumpLines-1].GetLength() == 126 && bigLines[DumpLines] == "OK 7";
+
+  cout << "  Large output to slow reader: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool CLITest::TestExit(PCLISocket::ThreadingModes mode)
+{
+  TestCLI cli(mode, m_workers);
+  SetCommands(cli);
+  cli.Start(true);
+
+  bool ok = true;
+  {
+    PTCPSocket socket1, socket2;
+    PStringArray lines;
+    ok = Connect(socket1, cli) && Connect(socket2, cli) &&
+         socket1.WriteString("status\nexit\n") && ReadLines(socket1, 1, lines);
+
+    // Should now get end of file
+    char buffer[100];
+    while (ok && socket1.Read(buffer, sizeof(buffer)))
+      ;
+    ok = ok && socket1.GetErrorCode(PChannel::LastReadError) == PChannel::NoError;
+  }
+
+  /* Both contexts should go, the second by the client closing. A thread per
+     context leaves the context open until stopped after the client closes. */
+  if (mode == PCLISocket::Reactor) {
+    for (int i = 0; i < 50 && cli.GetContextCount() > 0; ++i)
+      PThread::Sleep(20);
+    ok = ok && cli.GetContextCount() == 0;
+  }
+
+  cout << "  Exit and disconnect remove context: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool CLITest::TestTelnet(PCLISocket::ThreadingModes mode)
+{
+  PCLITelnet cli(0, "> ", mode, m_workers);
+  SetCommands(cli);
+  cli.Start(true);
+
+  PTelnetSocket socket;
+  socket.SetReadTimeout(10000);
+  socket.SetPort(cli.GetPort());
+  bool ok = socket.Connect("127.0.0.1") && socket.WriteString("status 9\n");
+
+  PString received;
+  int ch;
+  while (ok && received.Find("OK 9\r\n") == P_MAX_INDEX && (ch = socket.ReadChar()) >= 0)
+    received += (char)ch;
+  ok = ok && received.Find("OK 9\r\n") != P_MAX_INDEX;
+
+  cout << "  Telnet: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool CLITest::TestInputOverride(PCLISocket::ThreadingModes mode)
+{
+  TestCLI cli(mode, m_workers, true);
+  SetCommands(cli);
+  cli.Start(true);
+
+  PTCPSocket socket;
+  PStringArray lines;
+  bool ok = Connect(socket, cli) &&
+            socket.WriteString("status%10\nstatus%11\n") &&
+            ReadLines(socket, 2, lines) &&
+            lines[0] == "OK 10" && lines[1] == "OK 11";
+
+  cout << "  " << ModeNames[mode] << " context ProcessInput(int) override: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool CLITest::TestStalledClient()
+{
+  TestCLI cli(PCLISocket::Reactor, m_workers);
+  if (cli.GetThreadingMode() != PCLISocket::Reactor)
+    return true;
+
+  SetCommands(cli);
+  cli.SetOutputTimeout(500);
+  cli.Start(true);
+
+  // Far more output than the socket buffers hold, and the client never reads it
+  PTCPSocket stalled, other;
+  bool ok = Connect(stalled, cli) && Connect(other, cli) && stalled.WriteString("dump 500000\n");
+
+  for (int i = 0; i < 50 && cli.GetContextCount() < 2; ++i)
+    PThread::Sleep(20);
+
+  PTimeInterval start = PTimer::Tick();
+  while (ok && cli.GetContextCount() > 1 && PTimer::Tick() - start < 10000)
+    PThread::Sleep(20);
+  PTimeInterval elapsed = PTimer::Tick() - start;
+
+  PStringArray lines;
+  ok = ok && cli.GetContextCount() == 1 &&
+       other.WriteString("status 12\n") && ReadLines(other, 1, lines) && lines[0] == "OK 12";
+
+  cout << "  Reactor closes stalled client after " << elapsed.GetMilliSeconds()
+       << "ms: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+class BenchmarkClient : public PThread
+{
+  PCLASSINFO(BenchmarkClient, PThread);
+  public:
+    BenchmarkClient(WORD port, unsigned sockets, unsigned rounds, unsigned batch, PSemaphore & go)
+      : PThread(65536, NoAutoDeleteThread)
+      , m_port(port)
+      , m_socketCount(sockets)
+      , m_rounds(rounds)
+      , m_batch(batch)
+      , m_go(go)
+      , m_failed(0)
+    {
+      for (unsigned i = 0; i < m_batch; ++i)
+        m_commands += "status\n";
+      Resume();
+    }
+
+    ~BenchmarkClient()
+    {
+      for (size_t i = 0; i < m_sockets.size(); ++i)
+        delete m_sockets[i];
+    }
+
+    void Main()
+    {
+      for (unsigned i = 0; i < m_socketCount; ++i) {
+        PTCPSocket * socket = new PTCPSocket;
+        socket->SetReadTimeout(30000);
+        socket->SetPort(m_port);
+        if (socket->Connect("127.0.0.1"))
+          m_sockets.push_back(socket);
+        else {
+          delete socket;
+          ++m_failed;
+        }
+      }
+
+      m_connected.Signal();
+      m_go.Wait();
+
+      // Each round sends a batch of commands to every socket then reads all the replies
+      for (unsigned round = 0; round < m_rounds; ++round) {
+        for (size_t i = 0; i < m_sockets.size(); ++i)
+          m_sockets[i]->WriteString(m_commands);
+        for (size_t i = 0; i < m_sockets.size(); ++i) {
+          PStringArray lines;
+          if (!ReadLines(*m_sockets[i], m_batch, lines))
+            ++m_failed;
+        }
+      }
+
+      for (size_t i = 0; i < m_sockets.size(); ++i)
+        m_sockets[i]->Close();
+    }
+
+    WORD         m_port;
+    unsigned     m_socketCount;
+    unsigned     m_rounds;
+    unsigned     m_batch;
+    PSemaphore & m_go;
+    PSyncPoint   m_connected;
+    PString      m_commands;
+    unsigned     m_failed;
+    std::vector<PTCPSocket *> m_sockets;
+};
+
+
+void CLITest::Benchmark(PCLISocket::ThreadingModes mode, unsigned clients, unsigned rounds, unsigned batch)
+{
+  TestCLI cli(mode, m_workers);
+  SetCommands(cli);
+  if (!cli.Start(true)) {
+    cout << ModeNames[mode] << ": could not start" << endl;
+    return;
+  }
+
+  static const unsigned SocketsPerThread = 50;
+  PSemaphore go(0, INT_MAX);
+  std::vector<BenchmarkClient *> threads;
+  for (unsigned count = 0; count < clients; count += SocketsPerThread)
+    threads.push_back(new BenchmarkClient(cli.GetPort(), std::min(SocketsPerThread, clients - count), rounds, batch, go));
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i]->m_connected.Wait();
+
+  // A separate client measures the time for a single command while the others load the server
+  PTCPSocket probe;
+  Connect(probe, cli);
+
+  PInt64 start = PTimer::HighResolutionTick();
+  for (size_t i = 0; i < threads.size(); ++i)
+    go.Signal();
+
+  PInt64 worst = 0, total = 0;
+  unsigned probes = 0;
+  bool busy = true;
+  while (busy) {
+    PInt64 sent = PTimer::HighResolutionTick();
+    PStringArray lines;
+    if (!probe.WriteString("status\n") || !ReadLines(probe, 1, lines))
+      break;
+    PInt64 latency = PTimer::HighResolutionTick() - sent;
+    total += latency;
+    if (worst < latency)
+      worst = latency;
+    ++probes;
+
+    busy = false;
+    for (size_t i = 0; i < threads.size(); ++i) {
+      if (!threads[i]->IsTerminated())
+        busy = true;
+    }
+  }
+
+  unsigned failed = 0;
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->WaitForTermination();
+    failed += threads[i]->m_failed;
+  }
+  PInt64 elapsed = PTimer::HighResolutionTick() - start;
+
+  for (size_t i = 0; i < threads.size(); ++i)
+    delete threads[i];
+
+  cout << ModeNames[mode] << ", " << clients << " clients, " << rounds << " rounds of " << batch << " commands:\n"
+       << "  " << (PUInt64)clients*rounds*batch*1000000000/elapsed << " commands/s, "
+       << elapsed/1000000 << "ms, probe latency mean "
+       << (probes > 0 ? total/probes/1000 : 0) << "us max " << worst/1000 << "us";
+  if (failed > 0)
+    cout << ", " << failed << " failures";
+  cout << endl;
+}
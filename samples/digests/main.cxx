@@ -0,0 +1,377 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the message digests, HMAC and multi-buffer
+ * digests, and to measure their throughput.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/cypher.h>
+#include <ptclib/random.h>
+
+
+class Digests : public PProcess
+{
+  PCLASSINFO(Digests, PProcess)
+  public:
+    Digests();
+    void Main();
+
+  protected:
+    bool TestVectors();
+    bool TestHMAC();
+    template <class Digest> bool TestMultiple(const char * name);
+    void Benchmark(PINDEX size, unsigned count);
+};
+
+PCREATE_PROCESS(Digests);
+
+
+Digests::Digests()
+  : PProcess("PTLib", "digests", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void Digests::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-count:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestVectors();
+  ok = TestHMAC() && ok;
+  ok = TestMultiple<PMessageDigest5>("MD5") && ok;
+  ok = TestMultiple<PMessageDigestSHA1>("SHA-1") && ok;
+
+  if (!args.HasOption('T')) {
+    unsigned count = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 200000;
+    static const PINDEX sizes[] = { 64, 256, 512, 1500 };
+    for (PINDEX i = 0; i < PARRAYSIZE(sizes); ++i)
+      Benchmark(sizes[i], count*64/(sizes[i]+64));
+  }
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+static PString AsHex(const BYTE * data, PINDEX length)
+{
+  PStringStream str;
+  for (PINDEX i = 0; i < length; ++i)
+    str << setfill('0') << setw(2) << hex << (unsigned)data[i];
+  return str;
+}
+
+
+static PBYTEArray FromHex(const char * hex)
+{
+  PBYTEArray data(strlen(hex)/2);
+  for (PINDEX i = 0; i < data.GetSize(); ++i)
+    data[i] = (BYTE)PString(hex+i*2, 2).AsUnsigned(16);
+  return data;
+}
+
+
+bool Digests::TestVectors()
+{
+  static const struct {
+    const char * m_input;
+    const char * m_md5;
+    const char * m_sha1;
+  } vectors[] = {
+    { "",
+      "d41d8cd98f00b204e9800998ecf8427e", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+    { "abc",
+      "900150983cd24fb0d6963f7d28e17f72", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "8215ef0796a20bcaaae116d3876c664a", "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+    { "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+      "57edf4a22be3c955ac49da2e2107b67a", "50abf5706a150990a08b2c5ea40fa0e585554732" }
+  };
+
+  bool ok = true;
+  for (PINDEX i = 0; i < PARRAYSIZE(vectors); ++i) {
+    BYTE md5[PMessageDigest5::DigestSize];
+    PMessageDigest5 md5Digest;
+    md5Digest.Process(vectors[i].m_input);
+    md5Digest.CompleteDigest(md5);
+
+    PMessageDigest::Result md5Result;
+    PMessageDigest5::Encode(vectors[i].m_input, md5Result);
+
+    BYTE sha1[PMessageDigestSHA1::DigestSize];
+    PMessageDigestSHA1 sha1Digest;
+    sha1Digest.Process(vectors[i].m_input);
+    sha1Digest.CompleteDigest(sha1);
+
+    // Object is ready for reuse after completion
+    sha1Digest.Process(vectors[i].m_input);
+    PMessageDigest::Result sha1Result;
+    sha1Digest.CompleteDigest(sha1Result);
+
+    if (AsHex(md5, sizeof(md5)) != vectors[i].m_md5 ||
+        AsHex(md5Result.GetPointer(), md5Result.GetSize()) != vectors[i].m_md5 ||
+        AsHex(sha1, sizeof(sha1)) != vectors[i].m_sha1 ||
+        AsHex(sha1Result.GetPointer(), sha1Result.GetSize()) != vectors[i].m_sha1)
+      ok = false;
+  }
+
+  cout << "Known digests: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool Digests::TestHMAC()
+{
+  // From RFC 2202
+  static const struct {
+    const char * m_key;   // Hex
+    const char * m_data;  // Hex
+    const char * m_md5;
+    const char * m_sha1;
+  } vectors[] = {
+    { "0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b", "4869205468657265",
+      "5ccec34ea9656392457fa1ac27f08fbc", "b617318655057264e28bc0b6fb378c8ef146be00" },
+    { "4a656665", "7768617420646f2079612077616e7420666f72206e6f7468696e673f",
+      "750c783e6ab0b503eaa86e310a5db738", "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+    { "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+      "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+      "54657374205573696e67204c6172676572205468616e20426c6f636b2d53697a65204b6579"
+      "202d2048617368204b6579204669727374",
+      "6b1ab7fe4bd7bf8f0b62e6ce61b9d0cd", "aa4ae5e15272d00e95705637ce8a3b55ed402112" }
+  };
+
+  bool ok = true;
+  for (PINDEX i = 0; i < PARRAYSIZE(vectors); ++i) {
+    PBYTEArray key = FromHex(vectors[i].m_key);
+    PBYTEArray data = FromHex(vectors[i].m_data);
+
+    PHMAC_MD5 md5(key);
+    PHMAC_SHA1 sha1(key);
+
+    // Twice, to check the cached key state is reused correctly
+    for (int pass = 0; pass < 2; ++pass) {
+      PBYTEArray md5Mac = md5.Encode(data, data.GetSize());
+      PBYTEArray sha1Mac = sha1.Encode(data, data.GetSize());
+      if (AsHex(md5Mac, md5Mac.GetSize()) != vectors[i].m_md5 ||
+          AsHex(sha1Mac, sha1Mac.GetSize()) != vectors[i].m_sha1)
+        ok = false;
+    }
+  }
+
+  cout << "HMAC RFC 2202 vectors: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+template <class Digest>
+bool Digests::TestMultiple(const char * name)
+{
+  PRandom random(1234);
+  PBYTEArray buffer(4096);
+  for (PINDEX i = 0; i < buffer.GetSize(); ++i)
+    buffer[i] = (BYTE)random.Generate();
+
+  PHMAC<Digest> hmac("secret", 6);
+
+  bool ok = true;
+  for (PINDEX count = 1; count < 40 && ok; ++count) {
+    std::vector<const void *> data(count);
+    std::vector<PINDEX> lengths(count);
+    for (PINDEX i = 0; i < count; ++i) {
+      // Every length around the padding boundaries, plus some long ones
+      lengths[i] = (count*7 + i*13) % 140;
+      if (i % 5 == 4)
+        lengths[i] += 1400;
+      data[i] = (const BYTE *)buffer + random.Generate(0, 1000);
+    }
+
+    std::vector<BYTE> digests(count*Digest::DigestSize);
+    Digest::EncodeMultiple(count, &data[0], &lengths[0], &digests[0]);
+
+    std::vector<BYTE> macs(count*Digest::DigestSize);
+    hmac.EncodeMultiple(count, &data[0], &lengths[0], &macs[0]);
+
+    for (PINDEX i = 0; i < count; ++i) {
+      BYTE single[Digest::DigestSize];
+      Digest digest;
+      digest.Process(data[i], lengths[i]);
+      digest.CompleteDigest(single);
+      if (memcmp(single, &digests[i*Digest::DigestSize], Digest::DigestSize) != 0)
+        ok = false;
+
+      hmac.Encode(data[i], lengths[i], single);
+      if (memcmp(single, &macs[i*Digest::DigestSize], Digest::DigestSize) != 0)
+        ok = false;
+    }
+  }
+
+  cout << "Multi-buffer " << name << " and HMAC-" << name << " match single: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+static const unsigned Batch = 64;
+
+template <class Digest>
+static unsigned SingleDigests(const std::vector<const void *> & data, PINDEX size, BYTE * digests)
+{
+  for (unsigned i = 0; i < Batch; ++i) {
+    Digest digest;
+    digest.Process(data[i], size);
+    digest.CompleteDigest(digests + i*Digest::DigestSize);
+  }
+  return Batch;
+}
+
+
+static unsigned OldMD5(const std::vector<const void *> & data, PINDEX size, BYTE * digests)
+{
+  for (unsigned i = 0; i < Batch; ++i) {
+    PMessageDigest::Result result;
+    PMessageDigest5::Encode(data[i], size, result);
+    memcpy(digests + i*16, result.GetPointer(), 16);
+  }
+  return Batch;
+}
+
+
+static unsigned OldSHA1(const std::vector<const void *> & data, PINDEX size, BYTE * digests)
+{
+  for (unsigned i = 0; i < Batch; ++i) {
+    PMessageDigest::Result result;
+    PMessageDigestSHA1::Encode(data[i], size, result);
+    memcpy(digests + i*20, result.GetPointer(), 20);
+  }
+  return Batch;
+}
+
+
+template <class Digest>
+static unsigned MultipleDigests(const std::vector<const void *> & data, PINDEX size, BYTE * digests)
+{
+  std::vector<PINDEX> lengths(Batch, size);
+  Digest::EncodeMultiple(Batch, &data[0], &lengths[0], digests);
+  return Batch;
+}
+
+
+// HMAC as done without PHMAC, hashing the key pads for every message
+template <class Digest>
+static unsigned NaiveHMAC(const std::vector<const void *> & data, PINDEX size, BYTE * macs)
+{
+  static const char key[] = "0123456789abcdef";
+  BYTE ipad[64], opad[64];
+  memset(ipad, 0, sizeof(ipad));
+  memcpy(ipad, key, sizeof(key)-1);
+  memcpy(opad, ipad, sizeof(opad));
+  for (int j = 0; j < 64; ++j) {
+    ipad[j] ^= 0x36;
+    opad[j] ^= 0x5c;
+  }
+
+  for (unsigned i = 0; i < Batch; ++i) {
+    PMessageDigest::Result inner, outer;
+    Digest innerDigest;
+    innerDigest.Process(ipad, sizeof(ipad));
+    innerDigest.Process(data[i], size);
+    innerDigest.CompleteDigest(inner);
+    Digest outerDigest;
+    outerDigest.Process(opad, sizeof(opad));
+    outerDigest.Process(inner.GetPointer(), inner.GetSize());
+    outerDigest.CompleteDigest(outer);
+    memcpy(macs + i*Digest::DigestSize, outer.GetPointer(), Digest::DigestSize);
+  }
+  return Batch;
+}
+
+
+template <class Digest>
+static unsigned CachedHMAC(const std::vector<const void *> & data, PINDEX size, BYTE * macs)
+{
+  static PHMAC<Digest> hmac("0123456789abcdef", 16);
+  for (unsigned i = 0; i < Batch; ++i)
+    hmac.Encode(data[i], size, macs + i*Digest::DigestSize);
+  return Batch;
+}
+
+
+template <class Digest>
+static unsigned MultipleHMAC(const std::vector<const void *> & data, PINDEX size, BYTE * macs)
+{
+  static PHMAC<Digest> hmac("0123456789abcdef", 16);
+  std::vector<PINDEX> lengths(Batch, size);
+  hmac.EncodeMultiple(Batch, &data[0], &lengths[0], macs);
+  return Batch;
+}
+
+
+typedef unsigned (*DigestFunction)(const std::vector<const void *> & data, PINDEX size, BYTE * digests);
+
+static void Measure(const char * name, DigestFunction function, PINDEX size, unsigned count)
+{
+  PBYTEArray buffer(Batch*size);
+  std::vector<const void *> data(Batch);
+  for (unsigned i = 0; i < Batch; ++i)
+    data[i] = buffer + i*size;
+  BYTE digests[Batch*20];
+
+  // Best of three, other load skews single runs
+  PInt64 best = 0;
+  for (int run = 0; run < 3; ++run) {
+    PInt64 start = PTimer::HighResolutionTick();
+    for (unsigned done = 0; done < count; )
+      done += function(data, size, digests);
+    PInt64 duration = PTimer::HighResolutionTick() - start;
+    if (run == 0 || duration < best)
+      best = duration;
+  }
+
+  cout << "  " << setw(28) << left << name << right << setw(10)
+       << (PUInt64)count*1000000000/best << " msg/s" << endl;
+}
+
+
+void Digests::Benchmark(PINDEX size, unsigned count)
+{
+  cout << size << " byte messages:" << endl;
+  Measure("MD5 Encode() to Result", OldMD5, size, count);
+  Measure("MD5 to BYTE[]", SingleDigests<PMessageDigest5>, size, count);
+  Measure("MD5 EncodeMultiple()", MultipleDigests<PMessageDigest5>, size, count);
+  Measure("SHA-1 Encode() to Result", OldSHA1, size, count);
+  Measure("SHA-1 to BYTE[]", SingleDigests<PMessageDigestSHA1>, size, count);
+  Measure("SHA-1 EncodeMultiple()", MultipleDigests<PMessageDigestSHA1>, size, count);
+  Measure("HMAC-MD5 pads every message", NaiveHMAC<PMessageDigest5>, size, count);
+  Measure("PHMAC_MD5", CachedHMAC<PMessageDigest5>, size, count);
+  Measure("PHMAC_MD5 EncodeMultiple()", MultipleHMAC<PMessageDigest5>, size, count);
+  Measure("HMAC-SHA1 pads every message", NaiveHMAC<PMessageDigestSHA1>, size, count);
+  Measure("PHMAC_SHA1", CachedHMAC<PMessageDigestSHA1>, size, count);
+  Measure("PHMAC_SHA1 EncodeMultiple()", MultipleHMAC<PMessageDigestSHA1>, size, count);
+}
@@ -0,0 +1,273 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test PEthSocket capture, including the memory mapped
+ * packet ring. Needs raw socket privileges, uses the loopback by default.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptlib/sockets.h>
+
+
+// IEEE 802 local experimental ethertypes, nothing else should be using them
+static const WORD TestType  = 0x88B5;
+static const WORD OtherType = 0x88B6;
+
+
+class EthTest : public PProcess
+{
+  PCLASSINFO(EthTest, PProcess)
+  public:
+    EthTest();
+    void Main();
+
+  protected:
+    bool Open(PEthSocket & socket, PINDEX blocks, PINDEX txFrames);
+    bool Send(PEthSocket & socket, WORD type, bool broadcast, unsigned count);
+    unsigned Drain(PEthSocket & socket, WORD type);
+    bool TestCapture(PINDEX blocks, PINDEX txFrames);
+    void Benchmark(PINDEX blocks, unsigned count);
+
+    PString  m_interface;
+    unsigned m_sequence;
+    unsigned m_expected;
+    unsigned m_errors;
+};
+
+PCREATE_PROCESS(EthTest);
+
+
+class CaptureThread : public PThread
+{
+  PCLASSINFO(CaptureThread, PThread);
+  public:
+    CaptureThread(PEthSocket & socket)
+      : PThread(10000, NoAutoDeleteThread, HighestPriority)
+      , m_socket(socket)
+      , m_count(0)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      const BYTE * frame;
+      PINDEX length;
+      while (m_socket.ReadFrame(frame, length))
+        m_count++;
+    }
+
+    PEthSocket & m_socket;
+    unsigned     m_count;
+};
+
+
+EthTest::EthTest()
+  : PProcess("PTLib", "ethtest", 1, 0, AlphaCode, 1)
+  , m_sequence(0)
+  , m_expected(0)
+  , m_errors(0)
+{
+}
+
+
+void EthTest::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("i-interface:"
+             "n-count:"
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  m_interface = args.HasOption('i') ? args.GetOptionString('i') : PString("lo");
+  unsigned count = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 100000;
+
+  cout << "Socket reads:" << endl;
+  bool ok = TestCapture(0, 0);
+
+  PEthSocket probe;
+  if (!probe.SetRingSize(8)) {
+    cout << "Memory mapped ring not supported on this platform." << endl;
+    Benchmark(0, count);
+  }
+  else {
+    cout << "Memory mapped receive ring:" << endl;
+    ok = TestCapture(8, 0) && ok;
+    cout << "Memory mapped receive and transmit rings:" << endl;
+    ok = TestCapture(8, 64) && ok;
+
+    Benchmark(0, count);
+    Benchmark(8, count);
+  }
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+bool EthTest::Open(PEthSocket & socket, PINDEX blocks, PINDEX txFrames)
+{
+  socket.SetRingSize(blocks, PEthSocket::DefaultRingBlockSize, txFrames);
+  if (!socket.Connect(m_interface)) {
+    cout << "Could not open " << m_interface << ": " << socket.GetErrorText() << endl;
+    return false;
+  }
+
+  if (!socket.SetFilter(PEthSocket::FilterDirected, TestType)) {
+    cout << "Could not set filter: " << socket.GetErrorText() << endl;
+    return false;
+  }
+
+  socket.SetReadTimeout(200);
+  return true;
+}
+
+
+bool EthTest::Send(PEthSocket & socket, WORD type, bool broadcast, unsigned count)
+{
+  PEthSocket::Frame frame;
+  memset((void *)&frame, 0, sizeof(frame));
+  if (broadcast)
+    frame.dst_addr = PEthSocket::Address();
+  frame.ether.type = htons(type);
+
+  while (count-- > 0) {
+    *(PUInt32b *)frame.ether.payload = m_sequence++;
+    if (!socket.Write(&frame, 64)) {
+      cout << "Write failed: " << socket.GetErrorText(PChannel::LastWriteError) << endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+unsigned EthTest::Drain(PEthSocket & socket, WORD type)
+{
+  unsigned count = 0;
+  const BYTE * data;
+  PINDEX length;
+  while (socket.ReadFrame(data, length)) {
+    const PEthSocket::Frame * frame = (const PEthSocket::Frame *)data;
+    unsigned sequence = *(const PUInt32b *)frame->ether.payload;
+    if (length < 64 || ntohs(frame->ether.type) != type || sequence != m_expected) {
+      cout << "Unexpected frame: length=" << length << " type=0x" << hex << ntohs(frame->ether.type)
+           << dec << " sequence=" << sequence << " expected=" << m_expected << endl;
+      m_errors++;
+    }
+    m_expected = sequence+1;
+    count++;
+  }
+  return count;
+}
+
+
+bool EthTest::TestCapture(PINDEX blocks, PINDEX txFrames)
+{
+  PEthSocket capture, sender;
+  if (!Open(capture, blocks, 0) || !Open(sender, txFrames > 0 ? 1 : 0, txFrames))
+    return false;
+
+  cout << "  capture ring " << (capture.IsRingMapped() ? "mapped" : "not mapped")
+       << ", sender ring " << (sender.IsRingMapped() ? "mapped" : "not mapped") << endl;
+
+  m_errors = 0;
+
+  // Small batches so the socket buffer cannot overflow without a ring
+  unsigned received = 0;
+  m_expected = m_sequence;
+  for (PINDEX batch = 0; batch < 20; batch++) {
+    if (!Send(sender, TestType, false, 50))
+      return false;
+    received += Drain(capture, TestType);
+  }
+  cout << "  directed frames: " << received << "/1000" << endl;
+  bool ok = received == 1000;
+
+  // Broadcast and other type frames must be dropped by the kernel filter
+  Send(sender, TestType, true, 50);
+  Send(sender, OtherType, false, 50);
+  m_expected = m_sequence;
+  Send(sender, TestType, false, 10);
+  received = Drain(capture, TestType);
+  cout << "  filtered frames: " << received << "/10" << endl;
+  ok = received == 10 && ok;
+
+  capture.SetFilter(PEthSocket::FilterDirected|PEthSocket::FilterBroadcast, TestType);
+  m_expected = m_sequence;
+  Send(sender, TestType, true, 10);
+  received = Drain(capture, TestType);
+  cout << "  broadcast frames: " << received << "/10" << endl;
+  ok = received == 10 && ok;
+
+  capture.SetFilter(PEthSocket::FilterDirected, OtherType);
+  m_expected = m_sequence;
+  Send(sender, OtherType, false, 10);
+  received = Drain(capture, OtherType);
+  cout << "  changed type frames: " << received << "/10" << endl;
+  ok = received == 10 && ok;
+
+  if (capture.IsRingMapped()) {
+    // Whole burst held in the ring without anyone reading
+    capture.SetFilter(PEthSocket::FilterDirected, TestType);
+    m_expected = m_sequence;
+    Send(sender, TestType, false, 5000);
+    received = Drain(capture, TestType);
+    cout << "  burst frames: " << received << "/5000" << endl;
+    ok = received == 5000 && ok;
+  }
+
+  ok = m_errors == 0 && ok;
+  cout << "  " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+void EthTest::Benchmark(PINDEX blocks, unsigned count)
+{
+  PEthSocket capture, sender;
+  if (!Open(capture, blocks, 0) || !Open(sender, 0, 0))
+    return;
+
+  CaptureThread thread(capture);
+
+  PEthSocket::Frame frame;
+  memset((void *)&frame, 0, sizeof(frame));
+  frame.ether.type = htons(TestType);
+
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < count; i++)
+    sender.Write(&frame, 64);
+  // WaitForTermination() would abort the read, let it time out by itself
+  while (!thread.IsTerminated())
+    PThread::Sleep(10);
+  PTimeInterval elapsed = PTimer::Tick() - start - capture.GetReadTimeout();
+
+  cout << (capture.IsRingMapped() ? "Ring capture:   " : "Socket capture: ")
+       << thread.m_count << '/' << count << " frames received, "
+       << (count - thread.m_count) << " dropped, " << elapsed << 's' << endl;
+}
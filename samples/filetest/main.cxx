@@ -0,0 +1,415 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test PFile buffering and PMemoryMappedFile.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/random.h>
+#include <ptclib/memfile.h>
+
+
+class FileTest : public PProcess
+{
+  PCLASSINFO(FileTest, PProcess)
+  public:
+    FileTest();
+    void Main();
+
+  protected:
+    bool CompareOperations(PFile & test, unsigned iterations);
+    bool CompareStreams();
+    bool TestLineBuffering();
+    bool TestMapping();
+    void LineBenchmark(unsigned megabytes, PINDEX bufferSize, bool lineBuffered);
+    void ReadBenchmark(unsigned megabytes);
+};
+
+PCREATE_PROCESS(FileTest);
+
+
+FileTest::FileTest()
+  : PProcess("PTLib", "filetest", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void FileTest::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("s-size:"
+             "i-iterations:"
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  unsigned iterations = args.HasOption('i') ? args.GetOptionString('i').AsUnsigned() : 20000;
+  unsigned megabytes = args.HasOption('s') ? args.GetOptionString('s').AsUnsigned() : 20;
+
+  PFile buffered("filetest_buffered.dat", PFile::ReadWrite, PFile::Create|PFile::Truncate);
+  buffered.SetBufferSize(97); // Odd size to get plenty of boundary cases
+  cout << "Buffered file ";
+  bool ok = CompareOperations(buffered, iterations);
+
+  PMemoryMappedFile mapped("filetest_mapped.dat", PFile::ReadWrite, PFile::Create|PFile::Truncate);
+  cout << "Memory mapped file ";
+  ok = CompareOperations(mapped, iterations) && ok;
+
+  ok = CompareStreams() && ok;
+  ok = TestLineBuffering() && ok;
+  ok = TestMapping() && ok;
+
+  LineBenchmark(megabytes, 0, false);
+  LineBenchmark(megabytes, PFile::DefaultTextBufferSize, true);
+  LineBenchmark(megabytes, PFile::DefaultTextBufferSize, false);
+
+  ReadBenchmark(megabytes*5);
+
+  cout << (ok ? "All tests passed" : "TESTS FAILED") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+/* Apply the same random mix of reads, writes and seeks to a plain file and
+   the file under test, every result and the final contents must be identical.
+ */
+bool FileTest::CompareOperations(PFile & buffered, unsigned iterations)
+{
+  PFile plain(PFile::ReadWrite, PFile::Create|PFile::Temporary);
+
+  PRandom random(1234);
+  BYTE data[300], plainData[300], bufferedData[300];
+
+  for (unsigned i = 0; i < iterations; ++i) {
+    PINDEX len = random.Generate(1, sizeof(data));
+    int operation = random.Generate(0, 5);
+
+    switch (operation) {
+      case 0 :
+      case 1 :
+        for (PINDEX j = 0; j < len; ++j)
+          data[j] = (BYTE)random.Generate();
+        if (plain.Write(data, len) != buffered.Write(data, len) ||
+            plain.GetLastWriteCount() != buffered.GetLastWriteCount()) {
+          cout << "Write mismatch at iteration " << i << endl;
+          return false;
+        }
+        break;
+
+      case 2 :
+      case 3 :
+        if (plain.Read(plainData, len) != buffered.Read(bufferedData, len) ||
+            plain.GetLastReadCount() != buffered.GetLastReadCount() ||
+            memcmp(plainData, bufferedData, plain.GetLastReadCount()) != 0) {
+          cout << "Read mismatch at iteration " << i << endl;
+          return false;
+        }
+        break;
+
+      case 4 :
+      {
+        off_t length = plain.GetLength();
+        off_t pos = random.Generate(0, (unsigned)length);
+        plain.SetPosition(pos);
+        buffered.SetPosition(pos);
+        break;
+      }
+
+      default :
+      {
+        off_t delta = (off_t)random.Generate(0, 200) - 100;
+        if (plain.GetPosition() + delta < 0)
+          delta = -plain.GetPosition();
+        plain.SetPosition(delta, PFile::Current);
+        buffered.SetPosition(delta, PFile::Current);
+      }
+    }
+
+    if (plain.GetPosition() != buffered.GetPosition() || plain.GetLength() != buffered.GetLength()) {
+      cout << "Position mismatch at iteration " << i << ": "
+           << plain.GetPosition() << '/' << plain.GetLength() << " != "
+           << buffered.GetPosition() << '/' << buffered.GetLength() << endl;
+      return false;
+    }
+  }
+
+  PFilePath path = buffered.GetFilePath();
+  buffered.SetPosition(0);
+  buffered.Close();
+
+  PFile check(path, PFile::ReadOnly);
+  if (check.GetLength() != plain.GetLength()) {
+    cout << "Length mismatch after close " << check.GetLength() << " != " << plain.GetLength() << endl;
+    return false;
+  }
+
+  plain.SetPosition(0);
+  PINDEX total = 0;
+  while (plain.Read(plainData, sizeof(plainData))) {
+    if (!check.ReadBlock(bufferedData, plain.GetLastReadCount()) ||
+        memcmp(plainData, bufferedData, plain.GetLastReadCount()) != 0) {
+      cout << "Content mismatch at offset " << total << endl;
+      return false;
+    }
+    total += plain.GetLastReadCount();
+  }
+
+  check.Close();
+  PFile::Remove(path);
+
+  cout << "random operations: " << iterations << " passed, " << total << " bytes identical" << endl;
+  return true;
+}
+
+
+bool FileTest::CompareStreams()
+{
+  PTextFile file(PFile::ReadWrite, PFile::Create|PFile::Temporary);
+  for (int i = 0; i < 1000; ++i) {
+    file << "line " << i << '\n';
+    file.WriteLine(PString(PString::Unsigned, i));
+  }
+  file.flush();
+
+  file.SetPosition(0);
+  PString line;
+  for (int i = 0; i < 1000; ++i) {
+    if (!file.ReadLine(line) || line != "line " + PString(PString::Signed, i)) {
+      cout << "Stream line mismatch at " << i << ": \"" << line << '"' << endl;
+      return false;
+    }
+    int value;
+    file >> value;
+    file.ignore(1);
+    if (value != i) {
+      cout << "Stream value mismatch at " << i << ": " << value << endl;
+      return false;
+    }
+  }
+
+  if (file.ReadLine(line)) {
+    cout << "Stream has extra data: \"" << line << '"' << endl;
+    return false;
+  }
+
+  cout << "Stream and line I/O: passed" << endl;
+  return true;
+}
+
+
+/* A default PTextFile must show every complete line to another reader, such
+   as a log follower, without a flush or close, partial lines may be held back.
+ */
+bool FileTest::TestLineBuffering()
+{
+  PFilePath path("filetest_lines.txt");
+  PTextFile file(path, PFile::WriteOnly);
+  PFile tail(path, PFile::ReadOnly);
+
+  char data[100];
+  bool ok = file.IsLineBuffered() && file.GetBufferSize() == PFile::DefaultTextBufferSize;
+
+  file.WriteString("partial");
+  ok = !tail.Read(data, sizeof(data)) && ok;
+
+  file.WriteLine(" line");
+  ok = tail.Read(data, sizeof(data)) && PString(data, tail.GetLastReadCount()) == "partial line\n" && ok;
+
+  file << "stream line" << endl;
+  ok = tail.Read(data, sizeof(data)) && PString(data, tail.GetLastReadCount()) == "stream line\n" && ok;
+
+  file.SetBufferSize(PFile::DefaultTextBufferSize, false);
+  file.WriteLine("held");
+  ok = !file.IsLineBuffered() && !tail.Read(data, sizeof(data)) && ok;
+
+  file.Close();
+  ok = tail.Read(data, sizeof(data)) && PString(data, tail.GetLastReadCount()) == "held\n" && ok;
+
+  tail.Close();
+  PFile::Remove(path);
+
+  cout << "Line buffered text file: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool FileTest::TestMapping()
+{
+  PFilePath path("filetest_map.dat");
+  {
+    PMemoryMappedFile file(path, PFile::WriteOnly);
+    for (int i = 0; i < 100000; ++i)
+      file.Write(&i, sizeof(i));
+  }
+
+  PMemoryMappedFile file(path, PFile::ReadOnly);
+  if (!file.IsMapped() || file.GetLength() != 100000*sizeof(int)) {
+    cout << "Mapping failed, length " << file.GetLength() << endl;
+    return false;
+  }
+
+  file.Advise(PMemoryMappedFile::AdviseSequential);
+
+  int expected = 0;
+  const BYTE * ptr;
+  while ((ptr = file.ReadPointer(1000*sizeof(int))) != NULL) {
+    const int * values = (const int *)ptr;
+    for (PINDEX i = 0; i < file.GetLastReadCount()/(PINDEX)sizeof(int); ++i) {
+      if (values[i] != expected++) {
+        cout << "Mapped value mismatch at " << expected << endl;
+        return false;
+      }
+    }
+  }
+
+  bool ok = expected == 100000 && file.Write(&expected, sizeof(expected)) == PFalse &&
+            file.GetErrorCode(PChannel::LastWriteError) == PChannel::AccessDenied;
+  file.Close();
+  PFile::Remove(path);
+
+  PMemoryMappedFile proc("/proc/self/stat", PFile::ReadOnly);
+  PString stat;
+  if (proc.IsOpen())
+    ok = !proc.IsMapped() && proc.Read(stat.GetPointer(1000), 999) && ok;
+
+  cout << "Mapped read only and unmappable files: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+static void GetSystemCalls(PInt64 & reads, PInt64 & writes)
+{
+  reads = writes = 0;
+  PTextFile io("/proc/self/io", PFile::ReadOnly);
+  PString line;
+  while (io.ReadLine(line)) {
+    if (line.NumCompare("syscr:") == PObject::EqualTo)
+      reads = line.Mid(6).AsInt64();
+    else if (line.NumCompare("syscw:") == PObject::EqualTo)
+      writes = line.Mid(6).AsInt64();
+  }
+}
+
+
+void FileTest::LineBenchmark(unsigned megabytes, PINDEX bufferSize, bool lineBuffered)
+{
+  static const char CDR[] = "2026-10-19 12:34:56,sip:alice@example.com,sip:bob@example.com,180,NormalCallClearing";
+  PINDEX lines = megabytes*1000000/sizeof(CDR);
+
+  PTextFile file(PFile::ReadWrite, PFile::Create|PFile::Temporary);
+  file.SetBufferSize(bufferSize, lineBuffered);
+
+  PInt64 reads, writes, reads2, writes2;
+  GetSystemCalls(reads, writes);
+  PTimeInterval start = PTimer::Tick();
+
+  for (PINDEX i = 0; i < lines; ++i)
+    file.WriteLine(CDR);
+  file.FlushBuffer();
+
+  PTimeInterval writeTime = PTimer::Tick() - start;
+  GetSystemCalls(reads2, writes2);
+  const char * mode = lineBuffered ? " line" : "     ";
+  cout << "Buffer " << setw(5) << bufferSize << mode << ": WriteLine " << lines << " lines in " << writeTime
+       << "s, " << (writes2 - writes) << " write calls" << endl;
+
+  file.SetPosition(0);
+  GetSystemCalls(reads, writes);
+  start = PTimer::Tick();
+
+  PString line;
+  PINDEX count = 0;
+  while (file.ReadLine(line))
+    ++count;
+
+  PTimeInterval readTime = PTimer::Tick() - start;
+  GetSystemCalls(reads2, writes2);
+  cout << "Buffer " << setw(5) << bufferSize << mode << ": ReadLine  " << count << " lines in " << readTime
+       << "s, " << (reads2 - reads) << " read calls" << endl;
+}
+
+
+void FileTest::ReadBenchmark(unsigned megabytes)
+{
+  PFilePath path("filetest_read.dat");
+  {
+    PFile file(path, PFile::WriteOnly);
+    PBYTEArray block(1000000);
+    for (PINDEX i = 0; i < block.GetSize(); ++i)
+      block[i] = (BYTE)i;
+    for (unsigned i = 0; i < megabytes; ++i)
+      file.Write(block, block.GetSize());
+  }
+
+  static const PINDEX RecordSize = 512;
+  BYTE record[RecordSize];
+
+  for (int pass = 0; pass < 4; ++pass) {
+    static const char * const Names[] = { "PFile unbuffered", "PFile buffered", "Mapped Read()", "Mapped ReadPointer()" };
+
+    PFile * file;
+    if (pass < 2) {
+      file = new PFile(path, PFile::ReadOnly);
+      file->SetBufferSize(pass == 0 ? 0 : 65536);
+    }
+    else
+      file = new PMemoryMappedFile(path, PFile::ReadOnly);
+
+    PInt64 reads, writes, reads2, writes2;
+    GetSystemCalls(reads, writes);
+    PTimeInterval start = PTimer::Tick();
+
+    unsigned sum = 0;
+    PUInt64 total = 0;
+    if (pass == 3) {
+      PMemoryMappedFile * mapped = (PMemoryMappedFile *)file;
+      mapped->Advise(PMemoryMappedFile::AdviseSequential);
+      const BYTE * ptr;
+      while ((ptr = mapped->ReadPointer(RecordSize)) != NULL) {
+        sum += ptr[0];
+        total += mapped->GetLastReadCount();
+      }
+    }
+    else {
+      while (file->Read(record, RecordSize)) {
+        sum += record[0];
+        total += file->GetLastReadCount();
+      }
+    }
+
+    PTimeInterval elapsed = PTimer::Tick() - start;
+    GetSystemCalls(reads2, writes2);
+    delete file;
+
+    cout << setw(20) << Names[pass] << ": " << total << " bytes in " << elapsed << "s, "
+         << (elapsed > 0 ? total/1000/elapsed.GetMilliSeconds() : 0) << "MB/s, "
+         << (reads2 - reads) << " read calls, sum " << sum << endl;
+  }
+
+  PFile::Remove(path);
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
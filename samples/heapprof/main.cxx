@@ -0,0 +1,333 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the PHeapProfiler sampling heap profiler, and to
+ * measure its overhead.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <map>
+#include <algorithm>
+#include <signal.h>
+
+
+class HeapProf : public PProcess
+{
+  PCLASSINFO(HeapProf, PProcess)
+  public:
+    HeapProf();
+    void Main();
+
+#if P_HEAP_PROFILER
+  protected:
+    bool TestEstimate();
+    bool TestFormats();
+    bool TestThreads();
+    bool TestSignal();
+    void Benchmark(unsigned count, unsigned rounds);
+#endif
+};
+
+PCREATE_PROCESS(HeapProf);
+
+
+HeapProf::HeapProf()
+  : PProcess("PTLib", "heapprof", 1, 0, AlphaCode, 1)
+{
+}
+
+
+#if P_HEAP_PROFILER
+
+class LeakyObject : public PObject
+{
+  PCLASSINFO(LeakyObject, PObject);
+  public:
+    char m_data[256];
+};
+
+
+void HeapProf::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-count:"
+             "r-rounds:"
+             "s-summary."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  Benchmark(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 200000,
+            args.HasOption('r') ? args.GetOptionString('r').AsUnsigned() : 21);
+
+  bool ok = TestEstimate();
+  ok = TestFormats() && ok;
+  ok = TestThreads() && ok;
+  ok = TestSignal() && ok;
+
+  if (args.HasOption('s'))
+    PHeapProfiler::Dump(cout, PHeapProfiler::Summary);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+static bool Near(PUInt64 estimate, PUInt64 actual, double tolerance)
+{
+  return estimate > actual*(1-tolerance) && estimate < actual*(1+tolerance);
+}
+
+
+bool HeapProf::TestEstimate()
+{
+  PHeapProfiler::Start(16*1024);
+
+  std::vector<LeakyObject *> objects;
+  std::vector<char *> buffers;
+  objects.reserve(20000);
+  buffers.reserve(1000);
+
+  PHeapProfiler::Totals before;
+  PHeapProfiler::GetTotals(before);
+
+  // Half use the nothrow forms, which must be sampled the same way
+  for (int i = 0; i < 20000; i++)
+    objects.push_back(i%2 == 0 ? new LeakyObject : new (std::nothrow) LeakyObject);
+  for (int i = 0; i < 1000; i++)
+    buffers.push_back(i%2 == 0 ? new char[4096] : new (std::nothrow) char[4096]);
+
+  PHeapProfiler::Totals during;
+  PHeapProfiler::GetTotals(during);
+
+  PUInt64 actual = 20000*sizeof(LeakyObject) + 1000*4096;
+  PUInt64 estimate = during.m_liveBytes - before.m_liveBytes;
+  bool ok = Near(estimate, actual, 0.25) && during.m_dropped == 0;
+  cout << "Estimate in use: " << estimate << " bytes, actually " << actual << ": " << (ok ? "passed" : "FAILED") << endl;
+
+  PStringStream summary;
+  PHeapProfiler::Dump(summary, PHeapProfiler::Summary);
+  bool named = summary.Find(" allocations of LeakyObject\n") != P_MAX_INDEX;
+  cout << "Class name recorded: " << (named ? "passed" : "FAILED") << endl;
+
+  for (size_t i = 0; i < objects.size(); i++)
+    delete objects[i];
+  for (size_t i = 0; i < buffers.size(); i++)
+    delete [] buffers[i];
+
+  PHeapProfiler::Totals after;
+  PHeapProfiler::GetTotals(after);
+  bool freed = after.m_liveSamples <= before.m_liveSamples + 2 && after.m_samples > during.m_liveSamples;
+  cout << "Freed allocations removed: " << (freed ? "passed" : "FAILED") << endl;
+
+  return ok && named && freed;
+}
+
+
+bool HeapProf::TestFormats()
+{
+  std::vector<PString *> strings;
+  for (int i = 0; i < 10000; i++)
+    strings.push_back(new PString(PString::Unsigned, i));
+
+  PStringStream pprof;
+  PHeapProfiler::Dump(pprof);
+
+  for (size_t i = 0; i < strings.size(); i++)
+    delete strings[i];
+
+  PStringArray lines = pprof.Lines();
+  bool ok = lines.GetSize() > 2 &&
+            lines[0].Find("heap profile: ") == 0 &&
+            lines[0].Find("@ heap_v2/16384") != P_MAX_INDEX &&
+            lines[1].FindRegEx(PRegularExpression("^ *[0-9]+: +[0-9]+ \\[ *[0-9]+: +[0-9]+\\] @( 0x[0-9a-f]+)+$",
+                                                  PRegularExpression::Extended)) == 0 &&
+            pprof.Find("\nMAPPED_LIBRARIES:\n") != P_MAX_INDEX;
+
+  cout << "pprof format: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+class ChurnThread : public PThread
+{
+  PCLASSINFO(ChurnThread, PThread);
+  public:
+    ChurnThread(unsigned count)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_count(count)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      std::map<unsigned, PString> map;
+      for (unsigned i = 0; i < m_count; i++) {
+        map[i % 1000] = PString(PString::Unsigned, i);
+        if (i % 3000 == 0)
+          map.clear();
+      }
+    }
+
+    unsigned m_count;
+};
+
+
+bool HeapProf::TestThreads()
+{
+  PHeapProfiler::Totals before;
+  PHeapProfiler::GetTotals(before);
+
+  std::vector<ChurnThread *> threads;
+  for (int t = 0; t < 4; t++)
+    threads.push_back(new ChurnThread(200000));
+  for (int t = 0; t < 4; t++) {
+    threads[t]->WaitForTermination();
+    delete threads[t];
+  }
+
+  PHeapProfiler::Totals after;
+  PHeapProfiler::GetTotals(after);
+
+  // Only the thread objects and trace buffers might remain
+  bool ok = after.m_samples > before.m_samples + 100 && after.m_liveSamples <= before.m_liveSamples + 4;
+  cout << "Threads: " << (after.m_samples - before.m_samples) << " samples: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool HeapProf::TestSignal()
+{
+  PFilePath filename = psprintf("heapprof.%u.1.heap", (unsigned)GetCurrentProcessID());
+
+  raise(SIGPROF);
+  for (int i = 0; i < 50 && !PFile::Exists(filename); i++)
+    Sleep(100);
+  Sleep(100);
+
+  PTextFile file;
+  PString header;
+  bool ok = file.Open(filename, PFile::ReadOnly) && file.ReadLine(header) && header.Find("heap profile: ") == 0;
+  file.Close();
+  PFile::Remove(filename);
+
+  cout << "Dump on SIGPROF: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+static unsigned Workload(unsigned count)
+{
+  unsigned total = 0;
+  PStringList list;
+  std::map<PString, int> map;
+  for (unsigned i = 0; i < count; i++) {
+    PString str = psprintf("sip:%u@example.com", i);
+    list.AppendString(str);
+    map[str] = i;
+    total += str.Mid(4, 3).AsUnsigned();
+    if (list.GetSize() > 1000) {
+      list.RemoveAll();
+      map.clear();
+    }
+  }
+  return total;
+}
+
+
+static PInt64 TimeWorkload(unsigned count, bool profiling)
+{
+  if (profiling)
+    PHeapProfiler::Start();
+  else
+    PHeapProfiler::Stop();
+
+  PInt64 start = PTimer::HighResolutionTick();
+  Workload(count);
+  PInt64 duration = PTimer::HighResolutionTick() - start;
+
+  PHeapProfiler::Stop();
+  return duration;
+}
+
+
+static PInt64 Median(std::vector<PInt64> & durations)
+{
+  std::sort(durations.begin(), durations.end());
+  return durations[durations.size()/2];
+}
+
+
+void HeapProf::Benchmark(unsigned count, unsigned rounds)
+{
+  if (rounds == 0)
+    rounds = 1;
+
+  cout << "Workload of " << count << " iterations, median of " << rounds << " rounds:" << endl;
+
+  Workload(count/10);
+
+  /* Alternate, swapping which goes first each round, and take the median of
+     each, as other load and frequency scaling skew single runs. The spread
+     of the per-round differences shows how far the result can be trusted. */
+  std::vector<PInt64> stopped, running, difference;
+  for (unsigned round = 0; round < rounds; round++) {
+    PInt64 off, on;
+    if (round%2 == 0) {
+      off = TimeWorkload(count, false);
+      on = TimeWorkload(count, true);
+    }
+    else {
+      on = TimeWorkload(count, true);
+      off = TimeWorkload(count, false);
+    }
+    stopped.push_back(off);
+    running.push_back(on);
+    difference.push_back((on - off)*10000/off);
+  }
+
+  PInt64 stoppedMedian = Median(stopped);
+  PInt64 runningMedian = Median(running);
+  PInt64 differenceMedian = Median(difference);
+
+  cout << "  " << setw(24) << left << "profiler stopped" << right << setw(8) << stoppedMedian/1000000 << "ms\n"
+       << "  " << setw(24) << left << "sampling every 512KB" << right << setw(8) << runningMedian/1000000 << "ms\n"
+       << setprecision(2) << fixed
+       << "  overhead " << differenceMedian/100.0 << "%, per round from "
+       << difference.front()/100.0 << "% to " << difference.back()/100.0 << '%' << endl;
+}
+
+
+#else // P_HEAP_PROFILER
+
+void HeapProf::Main()
+{
+  cout << "Heap profiler not built, configure with --enable-heapprofiler." << endl;
+  SetTerminationValue(1);
+}
+
+#endif // P_HEAP_PROFILER
@@ -9,6 +9,7 @@
 #include <ptlib/sockets.h>
 #include <ptclib/http.h>
 #include <ptclib/threadpool.h>
+#include <ptclib/random.h>
 
 
 class HTTPConnection
@@ -30,9 +31,24 @@ class HTTPTest : public PProcess
 {
     PCLASSINFO(HTTPTest, PProcess)
   public:
+    HTTPTest()
+      : m_requestsDone(0, INT_MAX)
+    {
+    }
+
     void Main();
+    void ListenLoop();
+    void ClientTest(unsigned count);
+    bool FileTest();
+    bool PoolShutdownTest();
+
+    PDECLARE_NOTIFIER(PHTTPClientPool::Request, HTTPTest, OnRequestComplete);
 
     PQueuedThreadPool<HTTPConnection> m_pool;
+    PTCPSocket                        m_listener;
+    PHTTPSpace                        m_httpNameSpace;
+    PSemaphore                        m_requestsDone;
+    PAtomicInteger                    m_requestsFailed;
 };
 
 PCREATE_PROCESS(HTTPTest)
@@ -45,6 +61,7 @@ void HTTPTest::Main()
              "p-port:"
              "T-theads:"
              "Q-queue:"
+             "c-client-test:"
 #if PTRACING
              "o-output:"
              "t-trace."
@@ -65,6 +82,7 @@ void HTTPTest::Main()
               "   -p --port n           : port number to listen on (default 80).\n"
               "   -T --threads n        : max number of threads in pool (default 10)\n"
               "   -Q --queue n          : max queue size for listening sockets (default 100).\n"
+              "   -c --client-test n    : run n client requests against this server and exit.\n"
 #if PTRACING
               "   -o or --output file   : file name for output of log messages\n"       
               "   -t or --trace         : degree of verbosity in log (more times for more detail)\n"     
@@ -75,29 +93,218 @@ void HTTPTest::Main()
 
   m_pool.SetMaxWorkers(args.GetOptionString('T', "10").AsUnsigned());
 
-  PTCPSocket listener((WORD)args.GetOptionString('p', "80").AsUnsigned());
-  if (!listener.Listen(args.GetOptionString('Q', "100").AsUnsigned())) {
-    cerr << "Could not listen on port " << listener.GetPort() << endl;
+  m_listener.SetPort((WORD)args.GetOptionString('p', args.HasOption('c') ? "0" : "80").AsUnsigned());
+  if (!m_listener.Listen(args.GetOptionString('Q', "100").AsUnsigned())) {
+    cerr << "Could not listen on port " << m_listener.GetPort() << endl;
     return;
   }
 
-  PHTTPSpace httpNameSpace;
-  httpNameSpace.AddResource(new PHTTPString("index.html", "Hello", "text/plain"));
+  m_httpNameSpace.AddResource(new PHTTPString("index.html", "Hello", "text/plain"));
+
+  cout << "Listening for HTTP on port " << m_listener.GetPort() << endl;
+
+  if (args.HasOption('c')) {
+    PThread * thread = new PThreadObj<HTTPTest>(*this, &HTTPTest::ListenLoop, false, "Listener");
+    if (FileTest()) {
+      ClientTest(args.GetOptionString('c').AsUnsigned());
+      if (!PoolShutdownTest())
+        SetTerminationValue(1);
+    }
+    else
+      SetTerminationValue(1);
+    m_listener.Close();
+    thread->WaitForTermination();
+    delete thread;
+  }
+  else
+    ListenLoop();
+
+  cout << "Exiting HTTP test" << endl;
+}
 
-  cout << "Listening for HTTP on port " << listener.GetPort() << endl;
 
+void HTTPTest::ListenLoop()
+{
   for (;;) {
-    HTTPConnection * connection = new HTTPConnection(httpNameSpace);
-    if (connection->m_socket.Accept(listener))
+    HTTPConnection * connection = new HTTPConnection(m_httpNameSpace);
+    if (connection->m_socket.Accept(m_listener))
       m_pool.AddWork(connection);
     else {
       delete connection;
-      cerr << "Error in accept: " << listener.GetErrorText() << endl;
+      if (m_listener.IsOpen())
+        cerr << "Error in accept: " << m_listener.GetErrorText() << endl;
       break;
     }
   }
+}
 
-  cout << "Exiting HTTP test" << endl;
+
+bool HTTPTest::FileTest()
+{
+  PFilePath path("httptest_file.bin");
+  PBYTEArray contents(32*1024*1024);
+  PRandom random(1234);
+  random.GenerateBytes(contents.GetPointer(), contents.GetSize());
+  {
+    PFile file(path, PFile::WriteOnly, PFile::Create|PFile::Truncate);
+    if (!file.Write(contents, contents.GetSize())) {
+      cerr << "Could not write " << path << endl;
+      return false;
+    }
+  }
+
+  m_httpNameSpace.AddResource(new PHTTPFile("file.bin", path, "application/octet-stream"));
+
+  PURL url;
+  url.SetHostName("127.0.0.1");
+  url.SetPort(m_listener.GetPort());
+  url.SetPathStr("file.bin");
+
+  bool ok = true;
+
+  PHTTPClient client;
+  PMIMEInfo outMIME, replyMIME;
+  PBYTEArray body;
+  if (client.GetDocument(url, outMIME, replyMIME) && client.ReadContentBody(replyMIME, body) && body == contents)
+    cout << "File: " << body.GetSize() << " bytes passed" << endl;
+  else {
+    cerr << "File request failed: " << client.GetLastResponseInfo() << ", " << body.GetSize() << " bytes" << endl;
+    ok = false;
+  }
+
+  /* Shrink the file while the server is blocked sending it, the reply must
+     end early with the connection closed, and the server must survive. */
+  PHTTPClient truncated;
+  outMIME.RemoveAll();
+  replyMIME.RemoveAll();
+  body.SetSize(0);
+  if (!truncated.GetDocument(url, outMIME, replyMIME) || replyMIME.GetInteger(PHTTP::ContentLengthTag()) != contents.GetSize()) {
+    cerr << "Truncated file request failed: " << truncated.GetLastResponseInfo() << endl;
+    ok = false;
+  }
+  else {
+    PFile file(path, PFile::ReadWrite);
+    file.SetLength(contents.GetSize()/2);
+    file.Close();
+    if (truncated.ReadContentBody(replyMIME, body) ||
+        body.GetSize() >= contents.GetSize() ||
+        memcmp(body, contents, body.GetSize()) != 0) {
+      cerr << "Truncated file was not ended early, got " << body.GetSize() << " bytes" << endl;
+      ok = false;
+    }
+    else
+      cout << "Truncated file: ended after " << body.GetSize() << " bytes, passed" << endl;
+  }
+
+  PFile::Remove(path);
+  return ok;
+}
+
+
+void HTTPTest::ClientTest(unsigned count)
+{
+  if (count == 0)
+    count = 1000;
+
+  PURL url;
+  url.SetHostName("127.0.0.1");
+  url.SetPort(m_listener.GetPort());
+  url.SetPathStr("index.html");
+
+  PTime start;
+  unsigned i;
+  for (i = 0; i < count; ++i) {
+    PHTTPClient client;
+    client.SetPersistent(false);
+    PString document;
+    if (!client.GetTextDocument(url, document) || document != "Hello") {
+      cerr << "Non-pooled request " << i << " failed: " << client.GetLastResponseInfo() << endl;
+      return;
+    }
+  }
+  PTimeInterval duration = PTime() - start;
+  cout << "Non-pooled: " << count << " requests in " << duration
+       << "s, " << (count*1000.0/duration.GetMilliSeconds()) << " requests/s" << endl;
+
+  PHTTPClientPool pool;
+  start.SetCurrentTime();
+  for (i = 0; i < count; ++i) {
+    PString document;
+    if (!pool.GetTextDocument(url, document) || document != "Hello") {
+      cerr << "Pooled request " << i << " failed" << endl;
+      return;
+    }
+  }
+  duration = PTime() - start;
+  cout << "Pooled:     " << count << " requests in " << duration
+       << "s, " << (count*1000.0/duration.GetMilliSeconds()) << " requests/s, "
+       << pool.GetConnectionsOpened() << " connections, "
+       << pool.GetConnectionsReused() << " re-used" << endl;
+
+  PHTTPClientPool asyncPool(10);
+  m_requestsFailed = 0;
+  start.SetCurrentTime();
+  for (i = 0; i < count; ++i) {
+    PHTTPClientPool::Request * request = new PHTTPClientPool::Request(url);
+    request->m_completed = PCREATE_NOTIFIER(OnRequestComplete);
+    asyncPool.StartRequest(request);
+  }
+  for (i = 0; i < count; ++i)
+    m_requestsDone.Wait();
+  duration = PTime() - start;
+  cout << "Async:      " << count << " requests in " << duration
+       << "s, " << (count*1000.0/duration.GetMilliSeconds()) << " requests/s, "
+       << asyncPool.GetConnectionsOpened() << " connections, "
+       << asyncPool.GetConnectionsReused() << " re-used, "
+       << m_requestsFailed << " failed" << endl;
+}
+
+
+class CountedRequest : public PHTTPClientPool::Request
+{
+  public:
+    CountedRequest(const PURL & url, PAtomicInteger & live)
+      : PHTTPClientPool::Request(url)
+      , m_live(live)
+    {
+      ++m_live;
+    }
+
+    ~CountedRequest()
+    {
+      --m_live;
+    }
+
+    PAtomicInteger & m_live;
+};
+
+
+bool HTTPTest::PoolShutdownTest()
+{
+  PURL url;
+  url.SetHostName("127.0.0.1");
+  url.SetPort(m_listener.GetPort());
+  url.SetPathStr("index.html");
+
+  // Destroy the pool with requests in progress and still queued, none may leak
+  PAtomicInteger live;
+  {
+    PHTTPClientPool pool(10, PMaxTimeInterval, 2);
+    for (unsigned i = 0; i < 200; ++i)
+      pool.StartRequest(new CountedRequest(url, live));
+  }
+
+  bool ok = live == 0;
+  cout << "Pool shutdown: " << (ok ? "passed" : "FAILED") << ", " << live << " requests leaked" << endl;
+  return ok;
+}
+
+
+void HTTPTest::OnRequestComplete(PHTTPClientPool::Request & request, INT)
+{
+  if (!request.IsOK() || PString((const char *)(const BYTE *)request.m_replyBody, request.m_replyBody.GetSize()) != "Hello")
+    ++m_requestsFailed;
+  m_requestsDone.Signal();
 }
 
 
@@ -35,6 +35,9 @@
 #include <ptclib/pldap.h>
 #include <ptclib/pils.h>
 
+#include <algorithm>
+#include <vector>
+
 #if !P_LDAP
 #error Must have LDAP enabled for this application.
 #endif
@@ -52,6 +55,8 @@ search -h ils.seconix.com -x -b "objectClass=RTPerson" "cn=*" cn surname givenNa
 add    -h ils.seconix.com -x -I robertj@equival.com.au surname=Jongbloed givenName=Robert c=AU rfc822Mailbox=robertj@equival.com.au
 delete -h ils.seconix.com -x -I robertj@equival.com.au
 search -h ils.seconix.com -x -I "*" -P
+
+bench  -h localhost -b "dc=example,dc=com" -c 4 -w 64 -n 100000 -r 1000 "(uid=user%u)" cn mail
 */
 
 
@@ -68,13 +73,18 @@ LDAPTest::LDAPTest()
 void LDAPTest::Main()
 {
   PArgList & args = GetArguments();
-  args.Parse("h:p:xb:s:PI", PFalse);
+  args.Parse("h:p:xb:s:PIc:n:w:r:C:", PFalse);
 
   if (args.GetCount() == 0) {
     Usage();
     return;
   }
 
+  if (args[0] *= "bench") {
+    Benchmark(args);
+    return;
+  }
+
   if (args.HasOption('I')) {
     PILSSession ils;
     if (!ils.Open(args.GetOptionString('h'), (WORD)args.GetOptionString('p').AsUnsigned())) {
@@ -147,6 +157,15 @@ void LDAPTest::Usage()
           "      -b basedn  base dn for search\n"
           "      -P         Pause between entries\n"
           "      Note if -I is used then filter is implicitly cn=filter.\n"
+          "\n"
+          "   bench arguments:\n"
+          "      filter [ attribute ... ]\n"
+          "      -b basedn  base dn for search\n"
+          "      -c n       number of pooled connections (default 4)\n"
+          "      -w n       searches outstanding at once (default 64)\n"
+          "      -n n       total number of searches (default 10000)\n"
+          "      -r n       %u in the filter is replaced with 0 to n-1 (default 1000)\n"
+          "      -C secs    cache results for this long\n"
           "\n";
 }
 
@@ -217,6 +236,101 @@ void LDAPTest::Search(PArgList & args, PLDAPSession & ldap)
 }
 
 
+class LDAPBenchmark : public PObject
+{
+    PCLASSINFO(LDAPBenchmark, PObject);
+  public:
+    LDAPBenchmark(unsigned window)
+      : m_window(window, window)
+      , m_failed(0)
+      , m_cached(0)
+    {
+    }
+
+    PDECLARE_NOTIFIER(PObject, LDAPBenchmark, OnResult);
+
+    PSemaphore           m_window;
+    PMutex               m_mutex;
+    std::vector<PInt64>  m_latencies;
+    unsigned             m_failed;
+    unsigned             m_cached;
+};
+
+
+void LDAPBenchmark::OnResult(PObject & obj, INT)
+{
+  PLDAPSessionPool::SearchResult & result = (PLDAPSessionPool::SearchResult &)obj;
+
+  m_mutex.Wait();
+  m_latencies.push_back(result.m_latency.GetMilliSeconds());
+  if (result.m_entries.IsEmpty())
+    m_failed++;
+  if (result.m_cached)
+    m_cached++;
+  m_mutex.Signal();
+
+  m_window.Signal();
+}
+
+
+void LDAPTest::Benchmark(PArgList & args)
+{
+  if (args.GetCount() < 2) {
+    Usage();
+    return;
+  }
+
+  unsigned connections = args.HasOption('c') ? args.GetOptionString('c').AsUnsigned() : 4;
+  unsigned window = args.HasOption('w') ? args.GetOptionString('w').AsUnsigned() : 64;
+  unsigned count = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 10000;
+  unsigned range = args.HasOption('r') ? args.GetOptionString('r').AsUnsigned() : 1000;
+  if (window == 0)
+    window = 1;
+  if (range == 0)
+    range = 1;
+
+  PLDAPSessionPool pool(args.GetOptionString('b'), connections);
+  if (!pool.Open(args.GetOptionString('h'), (WORD)args.GetOptionString('p').AsUnsigned())) {
+    cerr << "Could not open LDAP server at " << args.GetOptionString('h') << endl;
+    return;
+  }
+
+  if (args.HasOption('C'))
+    pool.SetCache(range, PTimeInterval(0, args.GetOptionString('C').AsUnsigned()));
+
+  LDAPBenchmark bench(window);
+  PNotifier notifier = PCREATE_NOTIFIER_EXT(&bench, LDAPBenchmark, OnResult);
+  PStringArray attributes = args.GetParameters(2);
+
+  PTime start;
+  unsigned refused = 0;
+  for (unsigned i = 0; i < count; i++) {
+    bench.m_window.Wait();
+    PString filter = args[1];
+    filter.Replace("%u", PString(PString::Unsigned, i % range), PTrue);
+    if (!pool.Search(notifier, i, filter, attributes)) {
+      refused++;
+      bench.m_window.Signal();
+    }
+  }
+
+  for (unsigned i = 0; i < window; i++)
+    bench.m_window.Wait();
+  PTimeInterval elapsed = PTime() - start;
+
+  std::sort(bench.m_latencies.begin(), bench.m_latencies.end());
+  size_t completed = bench.m_latencies.size();
+
+  cout << completed << " searches on " << connections << " connections in " << elapsed << "s\n"
+       << "  lookups per second " << (elapsed > 0 ? completed*1000/elapsed.GetMilliSeconds() : 0) << '\n'
+       << "  not found or failed " << bench.m_failed << ", not sent " << refused << ", cached " << bench.m_cached << '\n';
+  if (completed > 0)
+    cout << "  latency p50 " << bench.m_latencies[completed/2] << "ms"
+            ", p99 " << bench.m_latencies[completed*99/100] << "ms"
+            ", max " << bench.m_latencies.back() << "ms" << endl;
+}
+
+
 void LDAPTest::AddILS(PArgList & args, PILSSession & ils)
 {
   if (args.GetCount() < 2) {
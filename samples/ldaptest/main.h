@@ -46,6 +46,7 @@ class LDAPTest : public PProcess
     void Add(PArgList & args, PLDAPSession & ldap);
     void Delete(PArgList & args, PLDAPSession & ldap);
     void Search(PArgList & args, PLDAPSession & ldap);
+    void Benchmark(PArgList & args);
 
     void AddILS(PArgList & args, PILSSession & ils);
     void DeleteILS(PArgList & args, PILSSession & ils);
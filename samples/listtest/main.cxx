@@ -0,0 +1,389 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test PList, PQueue and PStack, checking them against a
+ * simple model and timing positional access.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/random.h>
+
+#include <vector>
+
+
+class ListTest : public PProcess
+{
+  PCLASSINFO(ListTest, PProcess)
+  public:
+    ListTest();
+    void Main();
+
+  protected:
+    bool TestRandomOperations(unsigned count);
+    bool TestIterators();
+    bool TestQueueAndStack();
+    bool TestConcurrentReads();
+    void Benchmark(PINDEX size);
+};
+
+PCREATE_PROCESS(ListTest);
+
+
+class IntObj : public PObject
+{
+  PCLASSINFO(IntObj, PObject);
+  public:
+    IntObj(int value) : m_value(value) { }
+    virtual PObject * Clone() const { return new IntObj(m_value); }
+    virtual Comparison Compare(const PObject & obj) const
+      { int other = ((const IntObj &)obj).m_value; return m_value < other ? LessThan : m_value > other ? GreaterThan : EqualTo; }
+    int m_value;
+};
+
+PLIST(IntObjList, IntObj);
+PQUEUE(IntObjQueue, IntObj);
+PSTACK(IntObjStack, IntObj);
+
+
+ListTest::ListTest()
+  : PProcess("PTLib", "listtest", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void ListTest::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-count:"
+             "s-size:"
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestRandomOperations(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 100000);
+  ok = TestIterators() && ok;
+  ok = TestQueueAndStack() && ok;
+  ok = TestConcurrentReads() && ok;
+
+  Benchmark(args.HasOption('s') ? args.GetOptionString('s').AsUnsigned() : 20000);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+static bool Same(const IntObjList & list, const std::vector<int> & model)
+{
+  if (list.GetSize() != (PINDEX)model.size())
+    return false;
+
+  PINDEX i = 0;
+  for (IntObjList::const_iterator it = list.begin(); it != list.end(); ++it, ++i) {
+    if (it->m_value != model[i] || list[i].m_value != model[i])
+      return false;
+  }
+
+  // Walk backwards as well to check the links in the other direction
+  i = list.GetSize();
+  for (IntObjList::const_iterator it = list.rbegin(); it != list.rend(); --it) {
+    if (it->m_value != model[--i])
+      return false;
+  }
+
+  return i == 0;
+}
+
+
+bool ListTest::TestRandomOperations(unsigned count)
+{
+  IntObjList list;
+  std::vector<int> model;
+  PRandom random(1);
+  int nextValue = 0;
+
+  for (unsigned n = 0; n < count; n++) {
+    PINDEX size = model.size();
+    unsigned op = random.Generate() % 10;
+
+    switch (size == 0 ? 0 : op) {
+      case 0 :
+      case 1 :
+        list.Append(new IntObj(nextValue));
+        model.push_back(nextValue++);
+        break;
+
+      case 2 : {
+        PINDEX index = random.Generate() % (size+1);
+        list.InsertAt(index, new IntObj(nextValue));
+        model.insert(model.begin()+index, nextValue++);
+        break;
+      }
+
+      case 3 : {
+        PINDEX index = random.Generate() % size;
+        list.RemoveAt(index);
+        model.erase(model.begin()+index);
+        break;
+      }
+
+      case 4 : {
+        PINDEX index = random.Generate() % size;
+        list.Remove(&list[index]);
+        model.erase(model.begin()+index);
+        break;
+      }
+
+      case 5 : {
+        PINDEX index = random.Generate() % size;
+        list.ReplaceAt(index, new IntObj(nextValue));
+        model[index] = nextValue++;
+        break;
+      }
+
+      case 6 : {
+        PINDEX index = random.Generate() % size;
+        if (list.GetObjectsIndex(&list[index]) != index ||
+            list.GetValuesIndex(IntObj(model[index])) != index) {
+          cout << "Index search failed at operation " << n << endl;
+          return false;
+        }
+        break;
+      }
+
+      case 7 : {
+        // Insert before a value, the value must be present
+        PINDEX index = random.Generate() % size;
+        list.Insert(list[index], new IntObj(nextValue));
+        model.insert(model.begin()+index, nextValue++);
+        break;
+      }
+
+      default :
+        if (list.GetAt(size) != NULL) {
+          cout << "GetAt beyond end not NULL at operation " << n << endl;
+          return false;
+        }
+    }
+
+    if ((n % 5000) == 0 && !Same(list, model)) {
+      cout << "Mismatch at operation " << n << endl;
+      return false;
+    }
+  }
+
+  bool ok = Same(list, model);
+
+  IntObjList * clone = (IntObjList *)list.Clone();
+  ok = ok && Same(*clone, model) && *clone == list && &(*clone)[0] != &list[0];
+  delete clone;
+
+  // A new list has no index until accessed away from its ends, and must be
+  // consistent when it is then built part way through
+  if (model.size() > 2) {
+    clone = (IntObjList *)list.Clone();
+    std::vector<int> cloneModel = model;
+    clone->Append(new IntObj(-1));
+    cloneModel.push_back(-1);
+    clone->RemoveAt(0);
+    cloneModel.erase(cloneModel.begin());
+    clone->Remove(&clone->back());
+    cloneModel.pop_back();
+    clone->InsertAt(0, new IntObj(-2));
+    cloneModel.insert(cloneModel.begin(), -2);
+    ok = ok && Same(*clone, cloneModel);
+    clone->RemoveAt(1);
+    cloneModel.erase(cloneModel.begin()+1);
+    clone->Append(new IntObj(-3));
+    cloneModel.push_back(-3);
+    ok = ok && Same(*clone, cloneModel);
+    delete clone;
+  }
+
+  IntObjList shared = list;
+  shared.Append(new IntObj(-1));
+  model.push_back(-1);
+  ok = ok && Same(list, model);
+
+  cout << "Random operations: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool ListTest::TestIterators()
+{
+  IntObjList list;
+  for (int i = 0; i < 100; i++)
+    list.Append(new IntObj(i));
+
+  // Erase while iterating, the idiom many callers rely on
+  IntObjList::iterator it = list.begin();
+  while (it != list.end()) {
+    if (it->m_value % 3 == 0)
+      list.erase(it++);
+    else
+      ++it;
+  }
+
+  std::vector<int> model;
+  for (int i = 0; i < 100; i++) {
+    if (i % 3 != 0)
+      model.push_back(i);
+  }
+  bool ok = Same(list, model);
+
+  // Element addresses must not move as others are added and removed
+  IntObj * fifth = &list[5];
+  list.InsertAt(0, new IntObj(-1));
+  list.RemoveAt(list.GetSize()-1);
+  ok = ok && &list[6] == fifth && &list.front() == &list[0] && &list.back() == &list[list.GetSize()-1];
+
+  cout << "Iterators: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool ListTest::TestQueueAndStack()
+{
+  IntObjQueue queue;
+  IntObjStack stack;
+
+  bool ok = queue.Dequeue() == NULL;
+  for (int i = 0; i < 1000; i++) {
+    queue.Enqueue(new IntObj(i));
+    stack.Push(new IntObj(i));
+  }
+
+  for (int i = 0; i < 1000 && ok; i++) {
+    ok = stack.Top().m_value == 999-i;
+    IntObj * q = queue.Dequeue();
+    IntObj * s = stack.Pop();
+    ok = ok && q->m_value == i && s->m_value == 999-i;
+    delete q;
+    delete s;
+  }
+  ok = ok && queue.GetSize() == 0 && stack.GetSize() == 0;
+
+  cout << "Queue and stack: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+/* Threads reading one list, and reference copies of it, by ordinal index all
+   race to build the shared index, every one must see the right elements.
+ */
+class ListReader : public PThread
+{
+    PCLASSINFO(ListReader, PThread);
+  public:
+    ListReader(const IntObjList & list, int seed)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_list(list)
+      , m_seed(seed)
+      , m_ok(false)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      PRandom random(m_seed);
+      PINDEX size = m_list.GetSize();
+      m_ok = true;
+      for (PINDEX i = 0; i < size; i++) {
+        PINDEX index = random.Generate() % size;
+        if (m_list[index].m_value != (int)index)
+          m_ok = false;
+      }
+    }
+
+    const IntObjList & m_list;
+    int                m_seed;
+    bool               m_ok;
+};
+
+
+bool ListTest::TestConcurrentReads()
+{
+  static const int Threads = 4;
+  bool ok = true;
+
+  for (int round = 0; round < 200 && ok; round++) {
+    IntObjList list;
+    for (int i = 0; i < 1000; i++)
+      list.Append(new IntObj(i));
+    IntObjList copies[Threads/2];
+
+    ListReader * readers[Threads];
+    for (int i = 0; i < Threads; i++) {
+      if (i < Threads/2) {
+        copies[i] = list;
+        readers[i] = new ListReader(copies[i], round*Threads+i);
+      }
+      else
+        readers[i] = new ListReader(list, round*Threads+i);
+    }
+
+    for (int i = 0; i < Threads; i++) {
+      readers[i]->WaitForTermination();
+      ok = ok && readers[i]->m_ok;
+      delete readers[i];
+    }
+  }
+
+  cout << "Concurrent reads: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+#define TIME(name, statement) \
+  { \
+    PTimeInterval start = PTimer::Tick(); \
+    statement; \
+    cout << "  " << setw(28) << left << name << right << setw(8) << (PTimer::Tick() - start).GetMilliSeconds() << "ms" << endl; \
+  }
+
+void ListTest::Benchmark(PINDEX size)
+{
+  cout << "Timings for " << size << " elements:" << endl;
+
+  PStringList list;
+  TIME("Append", for (PINDEX i = 0; i < size; i++) list.AppendString(PString(PString::Unsigned, i)));
+
+  PINDEX total = 0;
+  TIME("Indexed loop", for (PINDEX i = 0; i < list.GetSize(); i++) total += list[i].GetLength());
+  TIME("Iterator loop", for (PStringList::iterator it = list.begin(); it != list.end(); ++it) total += it->GetLength());
+
+  PRandom random(1);
+  TIME("Random GetAt", for (PINDEX i = 0; i < size; i++) total += list[random.Generate() % size].GetLength());
+  TIME("InsertAt middle", for (PINDEX i = 0; i < size/10; i++) list.InsertAt(list.GetSize()/2, new PString("x")));
+  TIME("RemoveAt middle", for (PINDEX i = 0; i < size/10; i++) list.RemoveAt(list.GetSize()/2));
+  TIME("RemoveAt head", while (list.GetSize() > 0) list.RemoveAt(0));
+
+  PQueue<PString> queue;
+  TIME("Enqueue/Dequeue", for (PINDEX i = 0; i < size*10; i++) { queue.Enqueue(new PString("x")); if (queue.GetSize() > 100) delete queue.Dequeue(); });
+
+  if (total == 0)
+    cout << "Nothing read!" << endl;
+}
@@ -7,6 +7,9 @@
 #include <ptlib.h>
 #include <ptlib/pprocess.h>
 #include <ptclib/lua.h>
+#include <lua.hpp>
+
+#include <vector>
 
 #if P_LUA
 #else
@@ -18,6 +21,7 @@ class LuaProcess : public PProcess
   PCLASSINFO(LuaProcess, PProcess)
   public:
     void Main();
+    void Benchmark(unsigned threads, unsigned calls);
 };
 
 
@@ -39,6 +43,136 @@ class MyClass {
     }
 };
 
+
+class Router {
+  public:
+    PLUA_BINDING_START(Router)
+      PLUA_BINDING(weight)
+    PLUA_BINDING_END()
+
+    PLUA_FUNCTION(weight)
+    {
+      lua_pushinteger(L, lua_tointeger(L, 1) % 7 + 1);
+      return 1;
+    }
+};
+
+
+static const char RouteScript[] =
+  "routes = {}\n"
+  "for i = 1, 64 do routes[i] = 'gw' .. i end\n"
+  "function route(number)\n"
+  "  local best, score = 1, -1\n"
+  "  for i = 1, #routes do\n"
+  "    local s = (number * i) % 97 * router.weight(i)\n"
+  "    if s > score then best, score = i, s end\n"
+  "  end\n"
+  "  return best\n"
+  "end\n";
+
+
+class CallThread : public PThread
+{
+  PCLASSINFO(CallThread, PThread);
+  public:
+    CallThread(PLuaPool & pool, unsigned calls)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_pool(pool)
+      , m_calls(calls)
+      , m_errors(0)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      for (unsigned i = 0; i < m_calls; ++i) {
+        PLuaPool::Lease lua(m_pool);
+        int gateway = 0;
+        if (!lua.IsValid() || !lua->CallLuaFunction("route", "i>i", (int)i, &gateway) || gateway < 1)
+          ++m_errors;
+      }
+    }
+
+    PLuaPool & m_pool;
+    unsigned   m_calls;
+    unsigned   m_errors;
+};
+
+
+/* Every call reloading the script into one shared state, as before the pool. */
+class SerialThread : public PThread
+{
+  PCLASSINFO(SerialThread, PThread);
+  public:
+    SerialThread(PLua & lua, PMutex & mutex, unsigned calls)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_lua(lua)
+      , m_mutex(mutex)
+      , m_calls(calls)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      for (unsigned i = 0; i < m_calls; ++i) {
+        PWaitAndSignal lock(m_mutex);
+        int gateway = 0;
+        if (m_lua.LoadFile("route.lua") && m_lua.Run())
+          m_lua.CallLuaFunction("route", "i>i", (int)i, &gateway);
+        lua_settop(m_lua, 0);
+      }
+    }
+
+    PLua   & m_lua;
+    PMutex & m_mutex;
+    unsigned m_calls;
+};
+
+
+void LuaProcess::Benchmark(unsigned threads, unsigned calls)
+{
+  {
+    PLua lua;
+    Router router;
+    router.BindToInstance(lua, "router");
+    PMutex mutex;
+    PTimeInterval start = PTimer::Tick();
+    std::vector<SerialThread *> workers;
+    for (unsigned i = 0; i < threads; ++i)
+      workers.push_back(new SerialThread(lua, mutex, calls/threads));
+    for (unsigned i = 0; i < threads; ++i) {
+      workers[i]->WaitForTermination();
+      delete workers[i];
+    }
+    PInt64 ms = (PTimer::Tick() - start).GetMilliSeconds();
+    cout << setw(2) << threads << " threads, shared state, load per call: "
+         << (ms > 0 ? calls*(PInt64)1000/ms : 0) << " calls/s" << endl;
+  }
+
+  Router router;
+  PLuaPool pool("route.lua");
+  pool.AddInstance(router, "router");
+
+  PTimeInterval start = PTimer::Tick();
+  std::vector<CallThread *> workers;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.push_back(new CallThread(pool, calls/threads));
+  unsigned errors = 0;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers[i]->WaitForTermination();
+    errors += workers[i]->m_errors;
+    delete workers[i];
+  }
+  PInt64 ms = (PTimer::Tick() - start).GetMilliSeconds();
+  cout << setw(2) << threads << " threads, PLuaPool (" << pool.GetStateCount() << " states):       "
+       << (ms > 0 ? calls*(PInt64)1000/ms : 0) << " calls/s";
+  if (errors > 0)
+    cout << ", " << errors << " calls failed";
+  cout << endl;
+}
+
 PCREATE_PROCESS(LuaProcess)
 
 void LuaProcess::Main()
@@ -58,6 +192,17 @@ void LuaProcess::Main()
     cout << lua.GetLastErrorText() << endl;
 
   cout << "New value for a=" << lua.GetValue("a") << endl;
+
+  PFile script("route.lua", PFile::WriteOnly);
+  script.Write(RouteScript, sizeof(RouteScript)-1);
+  script.Close();
+
+  unsigned calls = GetArguments().GetCount() > 0 ? GetArguments()[0].AsUnsigned() : 20000;
+  static const unsigned threads[] = { 1, 4, 16 };
+  for (PINDEX i = 0; i < PARRAYSIZE(threads); ++i)
+    Benchmark(threads[i], calls);
+
+  PFile::Remove(PFilePath("route.lua"));
 }
 
 // End of hello.cxx
@@ -0,0 +1,743 @@
+/*
+ * main.cxx
+ *
+ * Sample program to check and measure the MJPEG/JPEG colour converters,
+ * on generated frames like those of a webcam, or on JPEG files.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptlib/vconvert.h>
+
+#include <math.h>
+#include <vector>
+
+
+class MJPEGBench : public PProcess
+{
+  PCLASSINFO(MJPEGBench, PProcess)
+  public:
+    MJPEGBench();
+    void Main();
+};
+
+PCREATE_PROCESS(MJPEGBench);
+
+
+MJPEGBench::MJPEGBench()
+  : PProcess("PTLib", "mjpegbench", 1, 0, AlphaCode, 1)
+{
+}
+
+
+#if P_VIDEO
+
+/* Order of the coefficients in the stream, as indexes in the 8x8 block */
+static const int NaturalOrder[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/* Tables from annex K of the JPEG standard */
+static const BYTE LuminanceQuant[64] = {
+  16, 11, 10, 16,  24,  40,  51,  61,  12, 12, 14, 19,  26,  58,  60,  55,
+  14, 13, 16, 24,  40,  57,  69,  56,  14, 17, 22, 29,  51,  87,  80,  62,
+  18, 22, 37, 56,  68, 109, 103,  77,  24, 35, 55, 64,  81, 104, 113,  92,
+  49, 64, 78, 87, 103, 121, 120, 101,  72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const BYTE ChrominanceQuant[64] = {
+  17, 18, 24, 47, 99, 99, 99, 99,  18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99,  47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99
+};
+
+static const BYTE DCLuminanceBits[17] = { 0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const BYTE DCChrominanceBits[17] = { 0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const BYTE DCValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const BYTE ACLuminanceBits[17] = { 0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const BYTE ACLuminanceValues[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa
+};
+
+static const BYTE ACChrominanceBits[17] = { 0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const BYTE ACChrominanceValues[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+  0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+  0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+  0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+  0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+  0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+  0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa
+};
+
+
+/* Just enough of a baseline JPEG encoder to make test frames, as a camera would. */
+class JPEGEncoder
+{
+  public:
+    JPEGEncoder(unsigned quality);
+
+    void Encode(const BYTE * ycc, unsigned width, unsigned height,
+                unsigned hFactor, unsigned vFactor, unsigned restartInterval,
+                PBYTEArray & jpeg);
+
+  protected:
+    struct HuffmanCodes {
+      unsigned m_code[256];
+      unsigned m_size[256];
+      void Build(const BYTE * bits, const BYTE * values);
+    };
+
+    void Marker(BYTE marker);
+    void Word(unsigned value);
+    void Byte(BYTE value);
+    void PutBits(unsigned code, unsigned size);
+    void FlushBits();
+    void EncodeBlock(const float * samples, const BYTE * quant, int & previousDC,
+                     const HuffmanCodes & dc, const HuffmanCodes & ac);
+
+    BYTE         m_quant[2][64];
+    float        m_cosines[8][8];
+    HuffmanCodes m_dc[2], m_ac[2];
+
+    PBYTEArray * m_output;
+    PINDEX       m_length;
+    unsigned     m_bits;
+    unsigned     m_bitCount;
+};
+
+
+JPEGEncoder::JPEGEncoder(unsigned quality)
+{
+  // Scaling as libjpeg does it
+  int scale = quality < 50 ? 5000/quality : 200 - quality*2;
+  for (int i = 0; i < 64; ++i) {
+    m_quant[0][i] = (BYTE)PMAX(1, PMIN(255, (LuminanceQuant[i]*scale + 50)/100));
+    m_quant[1][i] = (BYTE)PMAX(1, PMIN(255, (ChrominanceQuant[i]*scale + 50)/100));
+  }
+
+  for (int u = 0; u < 8; ++u) {
+    for (int x = 0; x < 8; ++x)
+      m_cosines[u][x] = (float)((u == 0 ? sqrt(0.125) : 0.5) * cos((2*x + 1)*u*M_PI/16));
+  }
+
+  m_dc[0].Build(DCLuminanceBits, DCValues);
+  m_dc[1].Build(DCChrominanceBits, DCValues);
+  m_ac[0].Build(ACLuminanceBits, ACLuminanceValues);
+  m_ac[1].Build(ACChrominanceBits, ACChrominanceValues);
+}
+
+
+void JPEGEncoder::HuffmanCodes::Build(const BYTE * bits, const BYTE * values)
+{
+  unsigned code = 0;
+  for (unsigned size = 1; size <= 16; ++size) {
+    for (unsigned i = 0; i < bits[size]; ++i) {
+      m_code[*values] = code++;
+      m_size[*values++] = size;
+    }
+    code <<= 1;
+  }
+}
+
+
+void JPEGEncoder::Byte(BYTE value)
+{
+  if (m_length >= m_output->GetSize())
+    m_output->SetSize(m_length*2 + 1024);
+  (*m_output)[m_length++] = value;
+}
+
+
+void JPEGEncoder::Word(unsigned value)
+{
+  Byte((BYTE)(value >> 8));
+  Byte((BYTE)value);
+}
+
+
+void JPEGEncoder::Marker(BYTE marker)
+{
+  Byte(0xff);
+  Byte(marker);
+}
+
+
+void JPEGEncoder::PutBits(unsigned code, unsigned size)
+{
+  m_bits = (m_bits << size) | (code & ((1 << size) - 1));
+  m_bitCount += size;
+  while (m_bitCount >= 8) {
+    BYTE value = (BYTE)(m_bits >> (m_bitCount - 8));
+    Byte(value);
+    if (value == 0xff)
+      Byte(0);
+    m_bitCount -= 8;
+  }
+}
+
+
+void JPEGEncoder::FlushBits()
+{
+  if (m_bitCount > 0)
+    PutBits(0x7f, 8 - m_bitCount);
+  m_bits = 0;
+}
+
+
+void JPEGEncoder::EncodeBlock(const float * samples, const BYTE * quant, int & previousDC,
+                              const HuffmanCodes & dc, const HuffmanCodes & ac)
+{
+  float rows[64];
+  for (int y = 0; y < 8; ++y) {
+    for (int u = 0; u < 8; ++u) {
+      float sum = 0;
+      for (int x = 0; x < 8; ++x)
+        sum += m_cosines[u][x] * samples[y*8 + x];
+      rows[y*8 + u] = sum;
+    }
+  }
+
+  int coefficients[64];
+  for (int v = 0; v < 8; ++v) {
+    for (int u = 0; u < 8; ++u) {
+      float sum = 0;
+      for (int y = 0; y < 8; ++y)
+        sum += m_cosines[v][y] * rows[y*8 + u];
+      coefficients[v*8 + u] = (int)floor(sum/quant[v*8 + u] + 0.5f);
+    }
+  }
+
+  int run = 0;
+  for (int k = 0; k < 64; ++k) {
+    int value = coefficients[NaturalOrder[k]];
+    if (k == 0) {
+      int diff = value - previousDC;
+      previousDC = value;
+      value = diff;
+    }
+    else if (value == 0) {
+      ++run;
+      continue;
+    }
+    else {
+      while (run > 15) {
+        PutBits(ac.m_code[0xf0], ac.m_size[0xf0]);
+        run -= 16;
+      }
+    }
+
+    unsigned magnitude = value < 0 ? -value : value;
+    unsigned size = 0;
+    while (magnitude >> size)
+      ++size;
+    if (value < 0)
+      value -= 1;
+
+    if (k == 0)
+      PutBits(dc.m_code[size], dc.m_size[size]);
+    else
+      PutBits(ac.m_code[run*16 + size], ac.m_size[run*16 + size]);
+    PutBits(value, size);
+    run = 0;
+  }
+
+  if (run > 0)
+    PutBits(ac.m_code[0], ac.m_size[0]);
+}
+
+
+/* Input is 3 bytes (Y, Cb, Cr) per pixel, a multiple of the MCU in size */
+void JPEGEncoder::Encode(const BYTE * ycc, unsigned width, unsigned height,
+                         unsigned hFactor, unsigned vFactor, unsigned restartInterval,
+                         PBYTEArray & jpeg)
+{
+  m_output = &jpeg;
+  m_length = 0;
+  m_bits = 0;
+  m_bitCount = 0;
+
+  Marker(0xd8);
+
+  Marker(0xdb);
+  Word(2 + 2*65);
+  for (int t = 0; t < 2; ++t) {
+    Byte((BYTE)t);
+    for (int k = 0; k < 64; ++k)
+      Byte(m_quant[t][NaturalOrder[k]]);
+  }
+
+  Marker(0xc0);
+  Word(8 + 3*3);
+  Byte(8);
+  Word(height);
+  Word(width);
+  Byte(3);
+  static const BYTE Ids[3] = { 1, 2, 3 };
+  for (int c = 0; c < 3; ++c) {
+    Byte(Ids[c]);
+    Byte((BYTE)(c == 0 ? (hFactor << 4) | vFactor : 0x11));
+    Byte((BYTE)(c == 0 ? 0 : 1));
+  }
+
+  Marker(0xc4);
+  static const struct {
+    BYTE         m_class;
+    const BYTE * m_bits;
+    const BYTE * m_values;
+  } Tables[4] = {
+    { 0x00, DCLuminanceBits,   DCValues },
+    { 0x10, ACLuminanceBits,   ACLuminanceValues },
+    { 0x01, DCChrominanceBits, DCValues },
+    { 0x11, ACChrominanceBits, ACChrominanceValues }
+  };
+  unsigned length = 2;
+  for (int t = 0; t < 4; ++t) {
+    length += 17;
+    for (int i = 1; i <= 16; ++i)
+      length += Tables[t].m_bits[i];
+  }
+  Word(length);
+  for (int t = 0; t < 4; ++t) {
+    Byte(Tables[t].m_class);
+    unsigned count = 0;
+    for (int i = 1; i <= 16; ++i) {
+      Byte(Tables[t].m_bits[i]);
+      count += Tables[t].m_bits[i];
+    }
+    for (unsigned i = 0; i < count; ++i)
+      Byte(Tables[t].m_values[i]);
+  }
+
+  if (restartInterval > 0) {
+    Marker(0xdd);
+    Word(4);
+    Word(restartInterval);
+  }
+
+  Marker(0xda);
+  Word(6 + 2*3);
+  Byte(3);
+  for (int c = 0; c < 3; ++c) {
+    Byte(Ids[c]);
+    Byte((BYTE)(c == 0 ? 0x00 : 0x11));
+  }
+  Byte(0);
+  Byte(63);
+  Byte(0);
+
+  unsigned mcuWidth = 8*hFactor, mcuHeight = 8*vFactor;
+  unsigned mcus = (width/mcuWidth)*(height/mcuHeight);
+  int previousDC[3] = { 0, 0, 0 };
+  unsigned mcu = 0;
+  float block[64];
+
+  for (unsigned my = 0; my < height; my += mcuHeight) {
+    for (unsigned mx = 0; mx < width; mx += mcuWidth) {
+      for (unsigned by = 0; by < vFactor; ++by) {
+        for (unsigned bx = 0; bx < hFactor; ++bx) {
+          for (int y = 0; y < 8; ++y) {
+            for (int x = 0; x < 8; ++x)
+              block[y*8 + x] = ycc[((my + by*8 + y)*width + mx + bx*8 + x)*3] - 128.0f;
+          }
+          EncodeBlock(block, m_quant[0], previousDC[0], m_dc[0], m_ac[0]);
+        }
+      }
+
+      // Chroma are averaged over the MCU down to one block
+      for (int c = 1; c < 3; ++c) {
+        for (int y = 0; y < 8; ++y) {
+          for (int x = 0; x < 8; ++x) {
+            float sum = 0;
+            for (unsigned sy = 0; sy < vFactor; ++sy) {
+              for (unsigned sx = 0; sx < hFactor; ++sx)
+                sum += ycc[((my + y*vFactor + sy)*width + mx + x*hFactor + sx)*3 + c];
+            }
+            block[y*8 + x] = sum/(hFactor*vFactor) - 128.0f;
+          }
+        }
+        EncodeBlock(block, m_quant[1], previousDC[c], m_dc[1], m_ac[1]);
+      }
+
+      if (restartInterval > 0 && ++mcu % restartInterval == 0 && mcu < mcus) {
+        FlushBits();
+        Marker((BYTE)(0xd0 + (mcu/restartInterval - 1)%8));
+        previousDC[0] = previousDC[1] = previousDC[2] = 0;
+      }
+    }
+  }
+
+  FlushBits();
+  Marker(0xd9);
+  jpeg.SetSize(m_length);
+}
+
+
+/* A frame with gradients, edges, detail and noise, moving with the frame number */
+static void MakeFrame(PBYTEArray & ycc, unsigned width, unsigned height, unsigned frame)
+{
+  BYTE * pixel = ycc.GetPointer(width*height*3);
+  unsigned seed = 12345 + frame;
+  for (unsigned y = 0; y < height; ++y) {
+    for (unsigned x = 0; x < width; ++x) {
+      seed = seed*1103515245 + 12345;
+      int noise = (int)((seed >> 16) & 15) - 8;
+      int luma = (x*255/width + y*64/height) & 0xff;
+      if (((x + frame*4)/64 + y/48) % 3 == 0)
+        luma = 255 - luma;
+      if ((x/4 + y/4) % 2 == 0 && y > height/2)
+        luma = luma/2 + 64;
+      *pixel++ = (BYTE)PMAX(0, PMIN(255, luma + noise));
+      *pixel++ = (BYTE)(128 + 100*sin((x + frame*8)/97.0) * cos(y/71.0));
+      *pixel++ = (BYTE)(128 + 90*cos((x + y)/113.0));
+    }
+  }
+}
+
+
+/* The same sums as the converters, so a perfect decode has infinite PSNR */
+static void ToRGB(const BYTE * ycc, unsigned pixels, PBYTEArray & rgb)
+{
+  BYTE * out = rgb.GetPointer(pixels*3);
+  for (unsigned i = 0; i < pixels; ++i, ycc += 3) {
+    int y = ycc[0] << 10, cb = ycc[1] - 128, cr = ycc[2] - 128;
+    int r = (y + 1436*cr + 512) >> 10;
+    int g = (y - 352*cb - 731*cr + 512) >> 10;
+    int b = (y + 1815*cb + 512) >> 10;
+    *out++ = (BYTE)PMAX(0, PMIN(255, r));
+    *out++ = (BYTE)PMAX(0, PMIN(255, g));
+    *out++ = (BYTE)PMAX(0, PMIN(255, b));
+  }
+}
+
+
+static double PSNR(const BYTE * a, PINDEX aStep, const BYTE * b, PINDEX bStep, PINDEX count)
+{
+  double error = 0;
+  for (PINDEX i = 0; i < count; ++i) {
+    int diff = a[i*aStep] - b[i*bStep];
+    error += diff*diff;
+  }
+  return error > 0 ? 10*log10(255.0*255.0*count/error) : 99;
+}
+
+
+/* Create(src, dst, width, height) would leave the output at the default size */
+static PColourConverter * CreateConverter(const char * format, unsigned width, unsigned height)
+{
+  return PColourConverter::Create(PVideoFrameInfo(width, height, "MJPEG"),
+                                  PVideoFrameInfo(width, height, format));
+}
+
+
+static bool Decode(PColourConverter & converter, const PBYTEArray & jpeg, PBYTEArray & output)
+{
+  PINDEX returned = 0;
+  output.MakeUnique(); // Copies of an earlier output share its buffer
+  return converter.Convert(jpeg, output.GetPointer(converter.GetMaxDstFrameBytes()), jpeg.GetSize(), &returned) &&
+         returned == converter.GetMaxDstFrameBytes();
+}
+
+
+static bool CheckDecode(unsigned width, unsigned height, unsigned hFactor, unsigned vFactor)
+{
+  PString name = psprintf("%ux%u %ux%u", width, height, hFactor, vFactor);
+
+  PBYTEArray ycc, rgb, plain, restarts, decoded;
+  MakeFrame(ycc, width, height, 0);
+  ToRGB(ycc, width*height, rgb);
+
+  JPEGEncoder encoder(85);
+  encoder.Encode(ycc, width, height, hFactor, vFactor, 0, plain);
+  encoder.Encode(ycc, width, height, hFactor, vFactor, 7, restarts);
+
+  PColourConverter * toYUV = CreateConverter("YUV420P", width, height);
+  PColourConverter * toRGB = CreateConverter("RGB24", width, height);
+  PColourConverter * toBGR = CreateConverter("BGR24", width, height);
+  bool ok = false;
+
+  do {
+    if (!Decode(*toYUV, plain, decoded)) {
+      cout << name << ": YUV420P decode: failed" << endl;
+      break;
+    }
+    double psnr = PSNR(decoded, 1, ycc, 3, width*height);
+    if (psnr < 30) {
+      cout << name << ": YUV420P luma PSNR " << psnr << " dB: failed" << endl;
+      break;
+    }
+    PBYTEArray yuv = decoded;
+    if (!Decode(*toYUV, restarts, decoded) || decoded != yuv) {
+      cout << name << ": YUV420P with restart markers differs: failed" << endl;
+      break;
+    }
+
+    if (!Decode(*toRGB, plain, decoded)) {
+      cout << name << ": RGB24 decode: failed" << endl;
+      break;
+    }
+    psnr = PSNR(decoded, 1, rgb, 1, width*height*3);
+    if (psnr < 25) {
+      cout << name << ": RGB24 PSNR " << psnr << " dB: failed" << endl;
+      break;
+    }
+    PBYTEArray rgbDecoded = decoded;
+    if (!Decode(*toRGB, restarts, decoded) || decoded != rgbDecoded) {
+      cout << name << ": RGB24 with restart markers differs: failed" << endl;
+      break;
+    }
+
+    if (!Decode(*toBGR, restarts, decoded)) {
+      cout << name << ": BGR24 decode: failed" << endl;
+      break;
+    }
+    unsigned i;
+    for (i = 0; i < width*height; ++i) {
+      if (decoded[i*3] != rgbDecoded[i*3+2] || decoded[i*3+1] != rgbDecoded[i*3+1] || decoded[i*3+2] != rgbDecoded[i*3])
+        break;
+    }
+    if (i < width*height) {
+      cout << name << ": BGR24 is not RGB24 reversed: failed" << endl;
+      break;
+    }
+
+    cout << name << ": passed" << endl;
+    ok = true;
+  } while (false);
+
+  delete toYUV;
+  delete toRGB;
+  delete toBGR;
+  return ok;
+}
+
+
+/* Truncated, damaged and wrongly sized frames must fail cleanly, not crash */
+static bool CheckDamaged(unsigned width, unsigned height)
+{
+  PString name = psprintf("%ux%u damaged", width, height);
+
+  PBYTEArray ycc, jpeg, larger, decoded;
+  MakeFrame(ycc, width, height, 1);
+  JPEGEncoder encoder(85);
+  encoder.Encode(ycc, width, height, 2, 1, 5, jpeg);
+  MakeFrame(ycc, width*2, height, 1);
+  encoder.Encode(ycc, width*2, height, 2, 1, 0, larger);
+
+  PColourConverter * toYUV = CreateConverter("YUV420P", width, height);
+  PColourConverter * toRGB = CreateConverter("RGB24", width, height);
+  bool ok = false;
+
+  do {
+    if (Decode(*toYUV, larger, decoded) || Decode(*toRGB, larger, decoded)) {
+      cout << name << ": frame larger than the converter accepted: failed" << endl;
+      break;
+    }
+
+    PINDEX length;
+    for (length = 0; length < jpeg.GetSize() - 2; length += 7) {
+      PBYTEArray truncated(jpeg, length);
+      if (Decode(*toYUV, truncated, decoded) || Decode(*toRGB, truncated, decoded))
+        break;
+    }
+    if (length < jpeg.GetSize() - 2) {
+      cout << name << ": frame truncated to " << length << " bytes accepted: failed" << endl;
+      break;
+    }
+
+    // Any byte of the headers or data may be damaged, decoding may succeed or not
+    unsigned seed = 4321;
+    for (int i = 0; i < 2000; ++i) {
+      PBYTEArray damaged = jpeg;
+      for (int n = 0; n < 4; ++n) {
+        seed = seed*1103515245 + 12345;
+        PINDEX offset = (seed >> 8) % (i < 1000 ? PMIN(jpeg.GetSize(), 700) : jpeg.GetSize());
+        damaged[offset] = (BYTE)(seed >> 24);
+      }
+      Decode(*toYUV, damaged, decoded);
+      Decode(*toRGB, damaged, decoded);
+    }
+
+    cout << name << ": passed" << endl;
+    ok = true;
+  } while (false);
+
+  delete toYUV;
+  delete toRGB;
+  return ok;
+}
+
+
+static void Measure(const char * name, const std::vector<PBYTEArray> & frames, unsigned width, unsigned height,
+                    const char * format, unsigned count)
+{
+  PColourConverter * converter = CreateConverter(format, width, height);
+  PBYTEArray output;
+
+  // Best of three, other load skews single runs
+  PInt64 best = 0;
+  for (int run = 0; run < 3; ++run) {
+    PInt64 start = PTimer::HighResolutionTick();
+    for (unsigned i = 0; i < count; ++i)
+      Decode(*converter, frames[i % frames.size()], output);
+    PInt64 duration = PTimer::HighResolutionTick() - start;
+    if (run == 0 || duration < best)
+      best = duration;
+  }
+
+  delete converter;
+
+  cout << "  " << setw(28) << left << name << right << setw(8)
+       << setprecision(1) << fixed << best/1000000.0/count << " ms  "
+       << setw(7) << count*1000000000.0/best << " fps" << endl;
+}
+
+
+static void Benchmark(unsigned width, unsigned height, unsigned hFactor, unsigned vFactor, unsigned count)
+{
+  cout << width << 'x' << height << ' ' << hFactor << 'x' << vFactor << " sampling:" << endl;
+
+  JPEGEncoder encoder(85);
+  std::vector<PBYTEArray> plain(4), restarts(4);
+  for (unsigned i = 0; i < plain.size(); ++i) {
+    PBYTEArray ycc;
+    MakeFrame(ycc, width, height, i);
+    encoder.Encode(ycc, width, height, hFactor, vFactor, 0, plain[i]);
+    encoder.Encode(ycc, width, height, hFactor, vFactor, width/(8*hFactor), restarts[i]);
+  }
+
+  Measure("MJPEG to YUV420P", plain, width, height, "YUV420P", count);
+  Measure("MJPEG to RGB24", plain, width, height, "RGB24", count);
+  Measure("MJPEG+DRI to YUV420P", restarts, width, height, "YUV420P", count);
+  Measure("MJPEG+DRI to RGB24", restarts, width, height, "RGB24", count);
+}
+
+
+/* Frame size from the SOF marker of a baseline JPEG */
+static bool GetJPEGSize(const PBYTEArray & jpeg, unsigned & width, unsigned & height)
+{
+  for (PINDEX i = 2; i + 9 < jpeg.GetSize(); ) {
+    if (jpeg[i] != 0xff)
+      return false;
+    if (jpeg[i+1] == 0xc0) {
+      height = (jpeg[i+5] << 8) | jpeg[i+6];
+      width = (jpeg[i+7] << 8) | jpeg[i+8];
+      return true;
+    }
+    i += 2 + ((jpeg[i+2] << 8) | jpeg[i+3]);
+  }
+  return false;
+}
+
+
+static bool BenchmarkFile(const PFilePath & filename, unsigned count)
+{
+  PFile file;
+  PBYTEArray jpeg;
+  unsigned width, height;
+  if (!file.Open(filename, PFile::ReadOnly) ||
+      !file.Read(jpeg.GetPointer(file.GetLength()), file.GetLength()) ||
+      !GetJPEGSize(jpeg, width, height)) {
+    cout << filename << ": not a baseline JPEG: failed" << endl;
+    return false;
+  }
+
+  cout << filename << ' ' << width << 'x' << height << ':' << endl;
+  std::vector<PBYTEArray> frames(1, jpeg);
+  Measure("MJPEG to YUV420P", frames, width, height, "YUV420P", count);
+  Measure("MJPEG to RGB24", frames, width, height, "RGB24", count);
+  return true;
+}
+
+
+void MJPEGBench::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-count:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  PColourConverter * converter = CreateConverter("YUV420P", 320, 240);
+  if (converter == NULL) {
+    cout << "MJPEG decoder is not compiled in, configure with --enable-tinyjpeg: failed" << endl;
+    SetTerminationValue(1);
+    return;
+  }
+  delete converter;
+
+  unsigned count = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 50;
+  bool ok = true;
+
+  if (args.GetCount() > 0) {
+    for (PINDEX i = 0; i < args.GetCount(); ++i)
+      ok = BenchmarkFile(args[i], count) && ok;
+  }
+  else {
+    ok = CheckDecode(64, 48, 1, 1) && ok;
+    ok = CheckDecode(176, 144, 2, 1) && ok;
+    ok = CheckDecode(352, 288, 2, 2) && ok;
+    ok = CheckDamaged(176, 144) && ok;
+
+    if (!args.HasOption('T')) {
+      Benchmark(1280, 720, 2, 1, count);
+      Benchmark(1920, 1088, 2, 1, count);
+      Benchmark(1920, 1088, 2, 2, count);
+    }
+  }
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+#else
+
+void MJPEGBench::Main()
+{
+  cout << "Video support is not compiled in: failed" << endl;
+  SetTerminationValue(1);
+}
+
+#endif // P_VIDEO
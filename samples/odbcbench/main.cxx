@@ -0,0 +1,288 @@
+/*
+ * main.cxx
+ *
+ * Sample program to check and measure the ODBC connection pool, prepared
+ * statements, batched inserts and block fetches against a data source.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/podbc.h>
+
+#include <vector>
+
+
+class ODBCBench : public PProcess
+{
+  PCLASSINFO(ODBCBench, PProcess)
+  public:
+    ODBCBench();
+    void Main();
+};
+
+PCREATE_PROCESS(ODBCBench);
+
+
+ODBCBench::ODBCBench()
+  : PProcess("PTLib", "odbcbench", 1, 0, AlphaCode, 1)
+{
+}
+
+
+#if defined(P_ODBC) && !defined(_WIN32_WCE)
+
+static void Report(const char * name, PINDEX rows, const PTimeInterval & start)
+{
+  PInt64 ms = (PTimer::Tick() - start).GetMilliSeconds();
+  cout << "  " << setw(32) << left << name << right << setw(10)
+       << (ms > 0 ? rows*(PInt64)1000/ms : (PInt64)rows*1000) << " rows/s" << endl;
+}
+
+
+static PString RowName(PINDEX id)
+{
+  return psprintf("name%06u", (unsigned)id);
+}
+
+
+static bool CheckTable(PODBC & link, PINDEX rows, const char * method)
+{
+  PODBCStmt stmt(&link);
+  if (!stmt.Query("SELECT COUNT(*), SUM(id) FROM bench") || !stmt.Fetch()) {
+    cout << method << ": cannot count rows: failed" << endl;
+    return false;
+  }
+
+  PString count, sum;
+  SQLLEN length;
+  SQLGetData(stmt, 1, SQL_C_CHAR, count.GetPointer(32), 32, &length);
+  SQLGetData(stmt, 2, SQL_C_CHAR, sum.GetPointer(32), 32, &length);
+  if (count.AsInteger() != rows || sum.AsInt64() != (PInt64)rows*(rows-1)/2) {
+    cout << method << ": table has " << count << " rows, sum " << sum << ": failed" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+class LookupThread : public PThread
+{
+  PCLASSINFO(LookupThread, PThread);
+  public:
+    LookupThread(PODBCPool & pool, PINDEX rows, unsigned count)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_pool(pool)
+      , m_rows(rows)
+      , m_count(count)
+      , m_errors(0)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      for (unsigned i = 0; i < m_count; ++i) {
+        PINDEX id = (i*7919) % m_rows;
+        PODBCPool::Lease lease(m_pool);
+        PODBCPreparedStmt * stmt = lease.Prepare("SELECT name FROM bench WHERE id = ?");
+        if (stmt == NULL) {
+          ++m_errors;
+          continue;
+        }
+        stmt->SetParameter(1, (int)id);
+        if (!stmt->Execute() || stmt->FetchRows() != 1 || stmt->GetValue(0, 1) != RowName(id))
+          ++m_errors;
+      }
+    }
+
+    PODBCPool & m_pool;
+    PINDEX      m_rows;
+    unsigned    m_count;
+    unsigned    m_errors;
+};
+
+
+void ODBCBench::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-rows:"
+             "c-connections:"
+             "l-lookups:"
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  PString connectString = args.GetCount() > 0 ? args[0] : PString("DRIVER=SQLite3;Database=odbcbench.db");
+  PINDEX rows = args.HasOption('n') ? args.GetOptionString('n').AsInteger() : 10000;
+  PINDEX connections = args.HasOption('c') ? args.GetOptionString('c').AsInteger() : 4;
+  unsigned lookups = args.HasOption('l') ? args.GetOptionString('l').AsUnsigned() : 20000;
+
+  PODBC link;
+  if (!link.Connect(connectString)) {
+    cout << "Cannot connect to \"" << connectString << '"' << endl;
+    SetTerminationValue(1);
+    return;
+  }
+
+  bool ok = true;
+  {
+    PODBCStmt stmt(&link);
+    stmt.Query("DROP TABLE bench");
+    if (!stmt.Query("CREATE TABLE bench (id INTEGER, name VARCHAR(40), value DOUBLE)")) {
+      cout << "Cannot create table" << endl;
+      SetTerminationValue(1);
+      return;
+    }
+  }
+
+  cout << "Insert " << rows << " rows:" << endl;
+  {
+    PTimeInterval start = PTimer::Tick();
+    PODBCStmt stmt(&link);
+    for (PINDEX i = 0; i < rows; ++i)
+      stmt.Query(psprintf("INSERT INTO bench (id, name, value) VALUES (%u, '%s', %u.5)",
+                          (unsigned)i, (const char *)RowName(i), (unsigned)i));
+    Report("SQL text per row", rows, start);
+    ok = CheckTable(link, rows, "SQL text per row") && ok;
+    stmt.Query("DELETE FROM bench");
+  }
+
+  {
+    PTimeInterval start = PTimer::Tick();
+    PODBCPreparedStmt stmt(&link);
+    stmt.Prepare("INSERT INTO bench (id, name, value) VALUES (?, ?, ?)");
+    for (PINDEX i = 0; i < rows; ++i) {
+      stmt.SetParameter(1, (int)i);
+      stmt.SetParameter(2, RowName(i));
+      stmt.SetParameter(3, i + 0.5);
+      stmt.Execute();
+    }
+    Report("Prepared per row", rows, start);
+    ok = CheckTable(link, rows, "Prepared per row") && ok;
+    PODBCStmt(&link).Query("DELETE FROM bench");
+  }
+
+  {
+    PTimeInterval start = PTimer::Tick();
+    PODBCPreparedStmt stmt(&link);
+    stmt.Prepare("INSERT INTO bench (id, name, value) VALUES (?, ?, ?)");
+    for (PINDEX i = 0; i < rows; ++i) {
+      stmt.SetParameter(1, (int)i);
+      stmt.SetParameter(2, RowName(i));
+      if (i % 10 == 0)
+        stmt.SetNull(3);
+      else
+        stmt.SetParameter(3, i + 0.5);
+      stmt.AddBatch();
+      if (stmt.GetBatchSize() == 500)
+        ok = stmt.ExecuteBatch() && ok;
+    }
+    ok = stmt.ExecuteBatch() && ok;
+    Report("Prepared batches of 500", rows, start);
+    ok = CheckTable(link, rows, "Prepared batches") && ok;
+  }
+
+  cout << "Read " << rows << " rows:" << endl;
+  {
+    PTimeInterval start = PTimer::Tick();
+    PODBC::Table table(&link, "SELECT id, name, value FROM bench");
+    PInt64 sum = 0;
+    PINDEX count = table.Rows();
+    for (PINDEX i = 0; i < count; ++i)
+      sum += table(i+1, 1).AsString().AsInt64();
+    Report("PODBC::Table", count, start);
+    if (count != rows || sum != (PInt64)rows*(rows-1)/2) {
+      cout << "PODBC::Table read " << count << " rows: failed" << endl;
+      ok = false;
+    }
+  }
+
+  {
+    PTimeInterval start = PTimer::Tick();
+    PODBCPreparedStmt stmt(&link);
+    stmt.Prepare("SELECT id, name, value FROM bench");
+    stmt.SetRowArraySize(256);
+    stmt.Execute();
+    PInt64 sum = 0;
+    PINDEX count = 0, nulls = 0, fetched;
+    while ((fetched = stmt.FetchRows()) > 0) {
+      for (PINDEX r = 0; r < fetched; ++r) {
+        PINDEX id = atoi(stmt.GetValuePtr(r, 1));
+        sum += id;
+        if (stmt.IsNull(r, 3))
+          ++nulls;
+        else if (strcmp(stmt.GetValuePtr(r, 2), RowName(id)) != 0)
+          ok = false;
+      }
+      count += fetched;
+    }
+    Report("FetchRows() blocks of 256", count, start);
+    if (count != rows || sum != (PInt64)rows*(rows-1)/2 || nulls != (rows+9)/10 || !ok) {
+      cout << "FetchRows() read " << count << " rows, " << nulls << " NULL: failed" << endl;
+      ok = false;
+    }
+  }
+  link.Disconnect();
+
+  cout << "Lookups through a pool of " << connections << " connections:" << endl;
+  PODBCPool pool(connections);
+  if (!pool.Open(connectString)) {
+    cout << "Cannot open pool: failed" << endl;
+    ok = false;
+  }
+  else {
+    static const unsigned threads[] = { 1, 4, 16 };
+    for (PINDEX t = 0; t < PARRAYSIZE(threads); ++t) {
+      PTimeInterval start = PTimer::Tick();
+      std::vector<LookupThread *> workers;
+      for (unsigned i = 0; i < threads[t]; ++i)
+        workers.push_back(new LookupThread(pool, rows, lookups/threads[t]));
+      unsigned errors = 0;
+      for (unsigned i = 0; i < threads[t]; ++i) {
+        workers[i]->WaitForTermination();
+        errors += workers[i]->m_errors;
+        delete workers[i];
+      }
+      Report(psprintf("%u threads", threads[t]), lookups, start);
+      if (errors > 0) {
+        cout << errors << " lookups failed: failed" << endl;
+        ok = false;
+      }
+    }
+    pool.Close();
+  }
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+#else
+
+void ODBCBench::Main()
+{
+  cout << "ODBC support is not compiled in." << endl;
+}
+
+#endif // P_ODBC
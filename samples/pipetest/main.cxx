@@ -0,0 +1,272 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test PPipeChannel and PPipeChannelPool, and to measure
+ * the latency of starting sub-processes.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptlib/pipechan.h>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+
+class PipeTest : public PProcess
+{
+  PCLASSINFO(PipeTest, PProcess)
+  public:
+    PipeTest();
+    void Main();
+
+  protected:
+    bool TestChannel();
+    bool TestPool();
+    void Benchmark(unsigned count);
+
+    PPipeChannelPool m_pool;
+    PAtomicInteger   m_failures;
+};
+
+PCREATE_PROCESS(PipeTest);
+
+
+class PoolThread : public PThread
+{
+  PCLASSINFO(PoolThread, PThread);
+  public:
+    PoolThread(PPipeChannelPool & pool, unsigned id, unsigned count, PAtomicInteger & failures)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_pool(pool)
+      , m_id(id)
+      , m_count(count)
+      , m_failures(failures)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      for (unsigned i = 0; i < m_count; i++) {
+        PString request = psprintf("thread %u request %u", m_id, i);
+        PString reply;
+        if (!m_pool.Execute(request, reply) || reply != request)
+          ++m_failures;
+      }
+    }
+
+    PPipeChannelPool & m_pool;
+    unsigned           m_id;
+    unsigned           m_count;
+    PAtomicInteger   & m_failures;
+};
+
+
+PipeTest::PipeTest()
+  : PProcess("PTLib", "pipetest", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void PipeTest::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("m-memory:"
+             "n-count:"
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestChannel();
+  ok = TestPool() && ok;
+
+  // Touch some memory so the process looks more like a real server
+  PINDEX megabytes = args.HasOption('m') ? args.GetOptionString('m').AsUnsigned() : 256;
+  PBYTEArray ballast(megabytes*1024*1024);
+  for (PINDEX i = 0; i < ballast.GetSize(); i += 4096)
+    ballast[i] = 1;
+  cout << "Resident ballast: " << megabytes << "MB" << endl;
+
+  Benchmark(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 200);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+static bool Check(bool condition, const char * test)
+{
+  cout << "  " << test << ": " << (condition ? "passed" : "FAILED") << endl;
+  return condition;
+}
+
+
+bool PipeTest::TestChannel()
+{
+  cout << "PPipeChannel:" << endl;
+  bool ok = true;
+
+  PPipeChannel echo("echo hello world", PPipeChannel::ReadOnly);
+  PString output = echo.ReadString(P_MAX_INDEX);
+  ok = Check(echo.WaitForTermination() == 0 && output == "hello world\n", "read output") && ok;
+
+  PStringArray catArgs;
+  PPipeChannel cat("cat", catArgs, PPipeChannel::ReadWrite);
+  cat << "round trip" << flush;
+  cat.Execute();
+  output = cat.ReadString(P_MAX_INDEX);
+  ok = Check(output == "round trip", "write and read") && ok;
+
+  PStringToString environment;
+  environment.SetAt("PIPETEST", "from environment");
+  PStringArray shellArgs;
+  shellArgs.AppendString("-c");
+  shellArgs.AppendString("echo $PIPETEST; echo to stderr >&2; exit 3");
+  PPipeChannel shell("/bin/sh", shellArgs, environment, PPipeChannel::ReadOnly, false, true);
+  output = shell.ReadString(P_MAX_INDEX);
+  PString errors;
+  shell.ReadStandardError(errors, true);
+  ok = Check(output == "from environment\n", "environment") && ok;
+  ok = Check(errors == "to stderr\n", "separate stderr") && ok;
+  ok = Check(shell.WaitForTermination() == 3, "exit code") && ok;
+
+  PPipeChannel missing;
+  ok = Check(!missing.Open("/nonexistent/program", PPipeChannel::ReadOnly, false), "missing program") && ok;
+
+#ifdef P_LINUX
+  // Child starts with no blocked signals and SIGPIPE at its default action,
+  // whatever the calling thread has
+  sigset_t blocked, previous;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+  void (*oldPipe)(int) = signal(SIGPIPE, SIG_IGN);
+  PPipeChannel status("grep -E \"^Sig(Blk|Ign)\" /proc/self/status", PPipeChannel::ReadOnly);
+  output = status.ReadString(P_MAX_INDEX);
+  signal(SIGPIPE, oldPipe);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  PINDEX blk = output.Find("SigBlk:"), ign = output.Find("SigIgn:");
+  ok = Check(blk != P_MAX_INDEX && output.Mid(blk+7, 17).Trim().AsUnsigned64(16) == 0 &&
+             ign != P_MAX_INDEX && (output.Mid(ign+7, 17).Trim().AsUnsigned64(16) & (1 << (SIGPIPE-1))) == 0,
+             "child signals") && ok;
+#endif
+
+  PPipeChannel slow("sleep 5", PPipeChannel::ReadOnly);
+  slow.SetReadTimeout(200);
+  PTimeInterval start = PTimer::Tick();
+  char ch;
+  bool timedOut = !slow.Read(&ch, 1) && slow.GetErrorCode(PChannel::LastReadError) == PChannel::Timeout;
+  ok = Check(timedOut && PTimer::Tick() - start < 2000, "read timeout") && ok;
+
+  return ok;
+}
+
+
+bool PipeTest::TestPool()
+{
+  cout << "PPipeChannelPool:" << endl;
+  bool ok = true;
+
+  ok = Check(m_pool.Open("cat", 4) && m_pool.GetSize() == 4, "open") && ok;
+
+  PString reply;
+  ok = Check(m_pool.Execute("hello", reply) && reply == "hello", "single request") && ok;
+  ok = Check(!m_pool.Execute("two\nlines", reply), "reject line feed") && ok;
+
+  m_failures = 0;
+  PoolThread * threads[8];
+  PINDEX i;
+  for (i = 0; i < PARRAYSIZE(threads); i++)
+    threads[i] = new PoolThread(m_pool, i, 500, m_failures);
+  for (i = 0; i < PARRAYSIZE(threads); i++) {
+    threads[i]->WaitForTermination();
+    delete threads[i];
+  }
+  ok = Check(m_failures == 0 && m_pool.GetStartCount() == 4, "concurrent requests") && ok;
+
+  // Helper exits after one reply, the pool must restart it
+  PPipeChannelPool once;
+  once.Open("head -n 1", 1);
+  bool first = once.Execute("first", reply) && reply == "first";
+  bool second = once.Execute("second", reply);
+  bool third = once.Execute("third", reply) && reply == "third";
+  ok = Check(first && !second && third && once.GetStartCount() == 2, "restart helper") && ok;
+
+  PPipeChannelPool slow;
+  slow.Open("sh -c \"read line; sleep 5\"", 1);
+  PTimeInterval start = PTimer::Tick();
+  ok = Check(!slow.Execute("request", reply, 200) && PTimer::Tick() - start < 2000, "reply timeout") && ok;
+
+  // A reply that trickles in must not restart the timeout with each read
+  PPipeChannelPool trickle;
+  trickle.Open("sh -c \"read line; while true; do printf x; sleep 0.1; done\"", 1);
+  start = PTimer::Tick();
+  ok = Check(!trickle.Execute("request", reply, 500) && PTimer::Tick() - start < 2000, "trickled reply timeout") && ok;
+
+  // Helper ignores end of file, Close() must SIGTERM it after the grace period
+  PPipeChannelPool stubborn;
+  stubborn.Open("sleep 30", 1);
+  start = PTimer::Tick();
+  stubborn.Close();
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  ok = Check(elapsed >= 900 && elapsed < 3000 && !stubborn.IsOpen(), "close stubborn helper") && ok;
+
+  return ok;
+}
+
+
+void PipeTest::Benchmark(unsigned count)
+{
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < count; i++) {
+    PPipeChannel channel("true", PPipeChannel::ReadOnly);
+    channel.WaitForTermination();
+  }
+  PTimeInterval elapsed = PTimer::Tick() - start;
+  cout << "PPipeChannel start: " << (elapsed.GetMilliSeconds()*1000/count) << "us per process" << endl;
+
+#ifndef _WIN32
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < count; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      execlp("true", "true", (char *)NULL);
+      _exit(2);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+  }
+  elapsed = PTimer::Tick() - start;
+  cout << "fork/exec start:    " << (elapsed.GetMilliSeconds()*1000/count) << "us per process" << endl;
+#endif
+
+  PString reply;
+  start = PTimer::Tick();
+  for (unsigned i = 0; i < count*10; i++)
+    m_pool.Execute("request", reply);
+  elapsed = PTimer::Tick() - start;
+  cout << "Pool request:       " << (elapsed.GetMilliSeconds()*100/count) << "us per request" << endl;
+}
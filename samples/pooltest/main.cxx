@@ -0,0 +1,462 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the PMemoryPool slab allocator behind
+ * PDEFINE_POOL_ALLOCATOR, and to measure allocation throughput.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#include <set>
+#include <list>
+
+#ifdef P_LINUX
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef __GNUC__
+#include <ext/mt_allocator.h>
+#endif
+
+
+class PoolTest : public PProcess
+{
+  PCLASSINFO(PoolTest, PProcess)
+  public:
+    PoolTest();
+    void Main();
+
+  protected:
+    bool TestAllocate();
+    bool TestCrossThread();
+    bool TestRelease();
+    bool TestLarge();
+    bool TestOutOfMemory();
+    void Benchmark(unsigned count, unsigned threads);
+};
+
+PCREATE_PROCESS(PoolTest);
+
+
+struct Node48 { char m_data[48]; };
+struct Node16k { char m_data[16384]; };
+
+typedef PFixedPoolAllocator<Node48> Node48Allocator;
+
+struct PooledNode
+{
+  char m_data[200];
+  PDECLARE_POOL_ALLOCATOR();
+};
+
+PDEFINE_POOL_ALLOCATOR(PooledNode)
+
+
+/* The three allocators being compared, all for 48 byte objects. */
+struct Allocator {
+  const char * m_name;
+  void * (*m_allocate)();
+  void (*m_deallocate)(void *);
+};
+
+static void * HeapAllocate() { return ::operator new(sizeof(Node48)); }
+static void HeapDeallocate(void * ptr) { ::operator delete(ptr); }
+
+static void * PoolAllocate() { return Node48Allocator::GetPool("Node48").Allocate(); }
+static void PoolDeallocate(void * ptr) { Node48Allocator::GetPool("Node48").Deallocate(ptr); }
+
+#ifdef __GNUC__
+static __gnu_cxx::__mt_alloc<Node48> MtAlloc;
+static void * MtAllocate() { return MtAlloc.allocate(1); }
+static void MtDeallocate(void * ptr) { MtAlloc.deallocate((Node48 *)ptr, 1); }
+#endif
+
+static const Allocator Allocators[] = {
+  { "operator new",  HeapAllocate, HeapDeallocate },
+#ifdef __GNUC__
+  { "__mt_alloc",    MtAllocate,   MtDeallocate   },
+#endif
+  { "PMemoryPool",   PoolAllocate, PoolDeallocate }
+};
+
+
+/* Allocates and frees in batches, as a container being filled and emptied. */
+class BatchThread : public PThread
+{
+  PCLASSINFO(BatchThread, PThread);
+  public:
+    BatchThread(const Allocator & allocator, unsigned count)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_allocator(allocator)
+      , m_count(count)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      void * batch[256];
+      for (unsigned n = 0; n < m_count; n += PARRAYSIZE(batch)) {
+        for (PINDEX i = 0; i < PARRAYSIZE(batch); i++)
+          batch[i] = m_allocator.m_allocate();
+        for (PINDEX i = 0; i < PARRAYSIZE(batch); i++)
+          m_allocator.m_deallocate(batch[(i*7)%PARRAYSIZE(batch)]);
+      }
+    }
+
+    const Allocator & m_allocator;
+    unsigned          m_count;
+};
+
+
+/* Hands batches of objects from one thread to another, which frees them. */
+class HandOff
+{
+  public:
+    HandOff() : m_ready(0, INT_MAX) { }
+
+    void Put(std::vector<void *> * batch)
+    {
+      m_mutex.Wait();
+      m_batches.push_back(batch);
+      m_mutex.Signal();
+      m_ready.Signal();
+    }
+
+    std::vector<void *> * Get()
+    {
+      m_ready.Wait();
+      PWaitAndSignal lock(m_mutex);
+      std::vector<void *> * batch = m_batches.front();
+      m_batches.pop_front();
+      return batch;
+    }
+
+  protected:
+    PMutex                            m_mutex;
+    PSemaphore                        m_ready;
+    std::list<std::vector<void *> *>  m_batches;
+};
+
+
+class ProducerThread : public PThread
+{
+  PCLASSINFO(ProducerThread, PThread);
+  public:
+    ProducerThread(const Allocator & allocator, unsigned count, HandOff & handOff)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_allocator(allocator)
+      , m_count(count)
+      , m_handOff(handOff)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      for (unsigned n = 0; n < m_count; n += 1000) {
+        std::vector<void *> * batch = new std::vector<void *>(1000);
+        for (size_t i = 0; i < batch->size(); i++)
+          (*batch)[i] = m_allocator.m_allocate();
+        m_handOff.Put(batch);
+      }
+      m_handOff.Put(NULL);
+    }
+
+    const Allocator & m_allocator;
+    unsigned          m_count;
+    HandOff         & m_handOff;
+};
+
+
+class ConsumerThread : public PThread
+{
+  PCLASSINFO(ConsumerThread, PThread);
+  public:
+    ConsumerThread(const Allocator & allocator, HandOff & handOff)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_allocator(allocator)
+      , m_handOff(handOff)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      std::vector<void *> * batch;
+      while ((batch = m_handOff.Get()) != NULL) {
+        for (size_t i = 0; i < batch->size(); i++)
+          m_allocator.m_deallocate((*batch)[i]);
+        delete batch;
+      }
+    }
+
+    const Allocator & m_allocator;
+    HandOff         & m_handOff;
+};
+
+
+PoolTest::PoolTest()
+  : PProcess("PTLib", "pooltest", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void PoolTest::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-count:"
+             "T-threads:"
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestAllocate();
+  ok = TestCrossThread() && ok;
+  ok = TestRelease() && ok;
+  ok = TestLarge() && ok;
+  ok = TestOutOfMemory() && ok;
+
+  Benchmark(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 10000000,
+            args.HasOption('T') ? args.GetOptionString('T').AsUnsigned() : 4);
+
+  cout << "\nPool statistics:\n";
+  PMemoryHeap::DumpPoolStatistics(cout);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+static PMemoryPool::Statistics GetStatistics(PMemoryPool & pool)
+{
+  PMemoryPool::Statistics stats;
+  pool.GetStatistics(stats);
+  return stats;
+}
+
+
+bool PoolTest::TestAllocate()
+{
+  PMemoryPool & pool = Node48Allocator::GetPool("Node48");
+  PMemoryPool::Statistics before = GetStatistics(pool);
+
+  std::vector<void *> objects;
+  std::set<void *> unique;
+  bool ok = true;
+  for (unsigned i = 0; i < 100000; i++) {
+    void * ptr = pool.Allocate();
+    ok = ok && ptr != NULL && ((size_t)ptr % 16) == 0 && unique.insert(ptr).second;
+    memset(ptr, (int)i, sizeof(Node48));
+    objects.push_back(ptr);
+  }
+
+  PMemoryPool::Statistics during = GetStatistics(pool);
+  ok = ok && during.m_liveObjects == before.m_liveObjects + 100000
+          && during.m_peakObjects >= during.m_liveObjects
+          && during.m_allocations == before.m_allocations + 100000
+          && during.m_slabBytes >= 100000*sizeof(Node48);
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    ok = ok && *(BYTE *)objects[i] == (BYTE)i;
+    pool.Deallocate(objects[i]);
+  }
+
+  PMemoryPool::Statistics after = GetStatistics(pool);
+  ok = ok && after.m_liveObjects == before.m_liveObjects && after.m_peakObjects >= during.m_peakObjects;
+
+  // Pooled containers still work
+  PStringList list;
+  for (int i = 0; i < 1000; i++)
+    list.AppendString(PString(PString::Signed, i));
+  ok = ok && list.GetSize() == 1000 && list[999] == "999";
+
+  cout << "Allocate and free: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool PoolTest::TestCrossThread()
+{
+  PMemoryPool & pool = Node48Allocator::GetPool("Node48");
+  PMemoryPool::Statistics before = GetStatistics(pool);
+
+  HandOff handOff;
+  const Allocator & allocator = Allocators[PARRAYSIZE(Allocators)-1];
+  ProducerThread producer(allocator, 200000, handOff);
+  ConsumerThread consumer(allocator, handOff);
+  producer.WaitForTermination();
+  consumer.WaitForTermination();
+
+  // Thread caches are returned to the pool as each thread exits
+  PMemoryPool::Statistics after = GetStatistics(pool);
+  bool ok = after.m_liveObjects == before.m_liveObjects &&
+            after.m_allocations == before.m_allocations + 200000;
+
+  cout << "Cross thread free: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool PoolTest::TestRelease()
+{
+  PMemoryPool & pool = Node48Allocator::GetPool("Node48");
+
+  std::vector<void *> objects;
+  for (unsigned i = 0; i < 200000; i++)
+    objects.push_back(pool.Allocate());
+  size_t peakSlabs = GetStatistics(pool).m_slabs;
+  for (size_t i = 0; i < objects.size(); i++)
+    pool.Deallocate(objects[i]);
+
+  // Emptied slabs are released as they go, apart from a small reserve and
+  // those still holding objects cached in magazines
+  size_t freedSlabs = GetStatistics(pool).m_slabs;
+  pool.ReleaseMemory();
+  size_t releasedSlabs = GetStatistics(pool).m_slabs;
+
+  bool ok = peakSlabs > 100 && freedSlabs < peakSlabs/10 && releasedSlabs == 0;
+  cout << "Return to system: " << peakSlabs << " slabs at peak, " << freedSlabs
+       << " after free, " << releasedSlabs << " after release: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool PoolTest::TestLarge()
+{
+  PFixedPoolAllocator<Node16k> allocator;
+  PFixedPoolAllocator<Node16k>::GetPool("Node16k");
+  std::vector<Node16k *> objects;
+  for (int i = 0; i < 100; i++) {
+    objects.push_back(allocator.allocate(1));
+    memset(objects.back(), i, sizeof(Node16k));
+  }
+
+  bool ok = GetStatistics(PFixedPoolAllocator<Node16k>::GetPool()).m_liveObjects == 100;
+  for (int i = 0; i < 100; i++) {
+    ok = ok && objects[i]->m_data[sizeof(Node16k)-1] == (char)i;
+    allocator.deallocate(objects[i], 1);
+  }
+
+  ok = ok && GetStatistics(PFixedPoolAllocator<Node16k>::GetPool()).m_liveObjects == 0;
+  cout << "Large objects: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+/* With the address space limited the pool runs out of slabs, and new must
+   then throw, or if exceptions are disabled abort, rather than return NULL
+   for the constructor to run on. This is done in a child process so the
+   abort can be checked.
+ */
+bool PoolTest::TestOutOfMemory()
+{
+#ifdef P_LINUX
+  pid_t pid = fork();
+  if (pid == 0) {
+    std::vector<PooledNode *> objects;
+    objects.reserve(10000000);
+
+    long pages = 0;
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+      if (fscanf(statm, "%ld", &pages) != 1)
+        pages = 0;
+      fclose(statm);
+    }
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_AS, &limit);
+    limit.rlim_cur = pages*sysconf(_SC_PAGESIZE) + 64*1024*1024;
+    setrlimit(RLIMIT_AS, &limit);
+
+#ifdef __EXCEPTIONS
+    try {
+#endif
+      while (objects.size() < objects.capacity()) {
+        PooledNode * node = new PooledNode;
+        if (node == NULL)
+          _exit(2);
+        objects.push_back(node);
+      }
+#ifdef __EXCEPTIONS
+    }
+    catch (const std::bad_alloc &) {
+      _exit(0);
+    }
+#endif
+    _exit(3);
+  }
+
+  int status = 0;
+  bool ok = pid > 0 && waitpid(pid, &status, 0) == pid &&
+            ((WIFEXITED(status) && WEXITSTATUS(status) == 0) || (WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT));
+
+  cout << "Out of memory: ";
+  if (WIFSIGNALED(status))
+    cout << "aborted with signal " << WTERMSIG(status);
+  else
+    cout << "exited with " << WEXITSTATUS(status);
+  cout << ": " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+#else
+  return true;
+#endif
+}
+
+
+void PoolTest::Benchmark(unsigned count, unsigned threadCount)
+{
+  cout << "Timings for " << count << " allocations:" << endl;
+
+  for (PINDEX a = 0; a < PARRAYSIZE(Allocators); a++) {
+    const Allocator & allocator = Allocators[a];
+    cout << "  " << allocator.m_name << ':' << endl;
+
+    PTimeInterval start = PTimer::Tick();
+    BatchThread single(allocator, count);
+    single.WaitForTermination();
+    cout << "    " << setw(24) << left << "one thread" << right << setw(8) << (PTimer::Tick() - start).GetMilliSeconds() << "ms" << endl;
+
+    start = PTimer::Tick();
+    std::vector<BatchThread *> threads;
+    for (unsigned t = 0; t < threadCount; t++)
+      threads.push_back(new BatchThread(allocator, count/threadCount));
+    for (unsigned t = 0; t < threadCount; t++) {
+      threads[t]->WaitForTermination();
+      delete threads[t];
+    }
+    cout << "    " << setw(24) << left << psprintf("%u threads", threadCount) << right << setw(8) << (PTimer::Tick() - start).GetMilliSeconds() << "ms" << endl;
+
+    start = PTimer::Tick();
+    HandOff handOff;
+    ProducerThread producer(allocator, count/4, handOff);
+    ConsumerThread consumer(allocator, handOff);
+    producer.WaitForTermination();
+    consumer.WaitForTermination();
+    cout << "    " << setw(24) << left << "producer/consumer" << right << setw(8) << (PTimer::Tick() - start).GetMilliSeconds() << "ms" << endl;
+  }
+}
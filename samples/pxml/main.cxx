@@ -70,7 +70,7 @@ void PxmlTest::Main()
 
   PString ch = LEThdr + SetNumHdr + "23" + SetNumTrl + LETtrl;
 
-  PXML xml(PXMLParser::Indent | PXMLParser::NewLineAfterElement+PXMLParser::NoIgnoreWhiteSpace, ch);
+  PXML xml(ch, PXMLParser::Indent | PXMLParser::NewLineAfterElement | PXMLParser::NoIgnoreWhiteSpace);
   PStringStream s;
   s << xml;
 
@@ -118,7 +118,7 @@ void PxmlTest::Main()
   // is XML and you don't need that parsed yet :-)
   //===
   PStringStream ss;
-  xml.GetElement(0)->Output(ss, -1, 0);
+  xml.GetElement(0)->Output(ss, PXMLBase(), 0);
 
   PString EXCERPT("<s:Body>" + SetNumHdr + "23" + SetNumTrl + "</s:Body>");
   PAssert((EXCERPT == ss),"XML subset data not as expected");
@@ -149,6 +149,24 @@ void PxmlTest::Main()
   cout << "done" << endl;
 #endif
 
+  //===
+  // Parser options must be honoured loading from a literal and from a file
+  //===
+  static const char NSDoc[] = "<a xmlns=\"urn:test\"><b/></a>";
+  PXML withNS;
+  PAssert(withNS.Load(NSDoc, PXMLParser::WithNS), "Load of literal failed");
+  PAssert((PString("urn:test|a") == withNS.GetRootElement()->GetName()), "Load of literal lost options");
+
+  PFilePath nsPath("pxmltest_ns.xml");
+  {
+    PTextFile nsFile(nsPath, PFile::WriteOnly);
+    nsFile << NSDoc;
+  }
+  PXML nsFromFile;
+  PAssert(nsFromFile.LoadFile(nsPath, PXMLParser::WithNS), "LoadFile failed");
+  PAssert((PString("urn:test|a") == nsFromFile.GetRootElement()->GetName()), "LoadFile lost options");
+  PFile::Remove(nsPath);
+
   //  Constructor with PConfig and String
   PFilePath fp("cfg.txt");
   PConfig cfg(fp, "Options");
@@ -0,0 +1,466 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the locked and lock free modes of PQueueChannel,
+ * and to compare their throughput.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/qchannel.h>
+
+#include <vector>
+
+
+class QChanBench : public PProcess
+{
+  PCLASSINFO(QChanBench, PProcess)
+  public:
+    QChanBench();
+    void Main();
+
+  protected:
+    bool TestStream();
+    bool TestMessages();
+    bool TestZeroCopy();
+    bool TestGrowth();
+    bool TestTimeouts();
+    void Benchmark(unsigned megabytes);
+};
+
+PCREATE_PROCESS(QChanBench);
+
+
+static const char * const ModeNames[] = { "locked", "single producer", "multi producer" };
+
+
+static BYTE Pattern(PINDEX position)
+{
+  return (BYTE)(position % 251);
+}
+
+
+static PINDEX ChunkSize(unsigned & seed, PINDEX maximum)
+{
+  seed = seed*1103515245 + 12345;
+  return 1 + (PINDEX)((seed >> 16) % maximum);
+}
+
+
+/* Writes a stream of Pattern() bytes in chunks of random size, or of a
+   fixed size if chunkSize is not zero. With no check the bytes are left
+   as they are, to time only the queue. */
+class StreamWriter : public PThread
+{
+  PCLASSINFO(StreamWriter, PThread);
+  public:
+    StreamWriter(PQueueChannel & queue, PINDEX total, PINDEX chunkSize, bool zeroCopy, bool check = true)
+      : PThread(10000, NoAutoDeleteThread, NormalPriority, "Writer")
+      , m_queue(queue)
+      , m_total(total)
+      , m_chunkSize(chunkSize)
+      , m_zeroCopy(zeroCopy)
+      , m_check(check)
+      , m_ok(true)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      std::vector<BYTE> buffer(m_chunkSize > 0 ? m_chunkSize : 1000);
+      unsigned seed = 7;
+      PINDEX position = 0;
+      while (position < m_total) {
+        PINDEX len = m_chunkSize > 0 ? m_chunkSize : ChunkSize(seed, buffer.size());
+        if (len > m_total - position)
+          len = m_total - position;
+
+        if (m_zeroCopy) {
+          BYTE * data;
+          PINDEX space = m_queue.WritePeek(data);
+          if (space == 0) {
+            m_ok = false;
+            return;
+          }
+          if (len > space)
+            len = space;
+          for (PINDEX i = 0; i < len; ++i)
+            data[i] = Pattern(position+i);
+          m_queue.WriteCommit(len);
+        }
+        else {
+          for (PINDEX i = 0; m_check && i < len; ++i)
+            buffer[i] = Pattern(position+i);
+          // The locked mode may take only part of a write
+          for (PINDEX done = 0; done < len; done += m_queue.GetLastWriteCount()) {
+            if (!m_queue.Write(&buffer[done], len - done)) {
+              m_ok = false;
+              return;
+            }
+          }
+        }
+        position += len;
+      }
+    }
+
+    PQueueChannel & m_queue;
+    PINDEX m_total;
+    PINDEX m_chunkSize;
+    bool   m_zeroCopy;
+    bool   m_check;
+    bool   m_ok;
+};
+
+
+/* Read a stream of Pattern() bytes, checking every byte. */
+static bool ReadStream(PQueueChannel & queue, PINDEX total, bool zeroCopy)
+{
+  std::vector<BYTE> buffer(1000);
+  unsigned seed = 11;
+  PINDEX position = 0;
+  while (position < total) {
+    const BYTE * data;
+    PINDEX len;
+    if (zeroCopy) {
+      len = queue.ReadPeek(data);
+      if (len == 0)
+        return false;
+      // Use only part of it sometimes, the rest comes back next time
+      PINDEX used = ChunkSize(seed, len);
+      len = used;
+    }
+    else {
+      if (!queue.Read(&buffer[0], ChunkSize(seed, buffer.size())))
+        return false;
+      len = queue.GetLastReadCount();
+      data = &buffer[0];
+    }
+
+    for (PINDEX i = 0; i < len; ++i) {
+      if (data[i] != Pattern(position+i)) {
+        cout << "Byte " << position+i << " is " << (unsigned)data[i]
+             << " not " << (unsigned)Pattern(position+i) << endl;
+        return false;
+      }
+    }
+
+    if (zeroCopy)
+      queue.ReadCommit(len);
+    position += len;
+  }
+  return true;
+}
+
+
+/* Writes messages of the form id, sequence, then bytes counting up from
+   the sequence number. */
+class MessageWriter : public PThread
+{
+  PCLASSINFO(MessageWriter, PThread);
+  public:
+    enum { MessageSize = 24 };
+
+    MessageWriter(PQueueChannel & queue, BYTE id, unsigned messages)
+      : PThread(10000, NoAutoDeleteThread, NormalPriority, "Writer")
+      , m_queue(queue)
+      , m_id(id)
+      , m_messages(messages)
+      , m_ok(true)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      BYTE message[MessageSize];
+      for (unsigned m = 0; m < m_messages; ++m) {
+        message[0] = m_id;
+        for (PINDEX i = 1; i < MessageSize; ++i)
+          message[i] = (BYTE)(m + i);
+        if (!m_queue.Write(message, MessageSize)) {
+          m_ok = false;
+          return;
+        }
+      }
+    }
+
+    PQueueChannel & m_queue;
+    BYTE     m_id;
+    unsigned m_messages;
+    bool     m_ok;
+};
+
+
+/* Closes a queue after a short delay. */
+class Closer : public PThread
+{
+  PCLASSINFO(Closer, PThread);
+  public:
+    Closer(PQueueChannel & queue)
+      : PThread(10000, NoAutoDeleteThread, NormalPriority, "Closer")
+      , m_queue(queue)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      PThread::Sleep(50);
+      m_queue.Close();
+    }
+
+    PQueueChannel & m_queue;
+};
+
+
+QChanBench::QChanBench()
+  : PProcess("PTLib", "qchanbench", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void QChanBench::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-megabytes:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestStream();
+  ok = TestMessages() && ok;
+  ok = TestZeroCopy() && ok;
+  ok = TestGrowth() && ok;
+  ok = TestTimeouts() && ok;
+
+  if (!args.HasOption('T'))
+    Benchmark(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 256);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+bool QChanBench::TestStream()
+{
+  static const PINDEX Total = 4000000;
+
+  for (int mode = PQueueChannel::LockedMode; mode <= PQueueChannel::MultiProducerMode; ++mode) {
+    // Not a power of two, so the ring is larger than the queue
+    PQueueChannel queue(1000, (PQueueChannel::Mode)mode);
+    StreamWriter writer(queue, Total, 0, false);
+    bool ok = ReadStream(queue, Total, false);
+    writer.WaitForTermination();
+
+    if (!ok || !writer.m_ok || queue.GetLength() != 0) {
+      cout << "Stream through " << ModeNames[mode] << " queue: failed" << endl;
+      return false;
+    }
+  }
+
+  cout << "Streams in all modes: passed" << endl;
+  return true;
+}
+
+
+bool QChanBench::TestMessages()
+{
+  static const unsigned Writers = 4;
+  static const unsigned Messages = 20000;
+
+  // Messages are only kept whole in the multi producer mode
+  PQueueChannel queue(1000, PQueueChannel::MultiProducerMode);
+  std::vector<MessageWriter *> writers;
+  for (unsigned w = 0; w < Writers; ++w)
+    writers.push_back(new MessageWriter(queue, (BYTE)w, Messages));
+
+  std::vector<unsigned> next(Writers, 0);
+  BYTE message[MessageWriter::MessageSize];
+  bool ok = true;
+  for (unsigned m = 0; ok && m < Writers*Messages; ++m) {
+    // Read in odd sized pieces, which the queue does not care about
+    PINDEX done = 0;
+    while (ok && done < MessageWriter::MessageSize) {
+      PINDEX len = MessageWriter::MessageSize - done;
+      ok = queue.Read(message+done, len < 7 ? len : 7);
+      done += queue.GetLastReadCount();
+    }
+
+    unsigned id = message[0];
+    if (!ok || id >= Writers)
+      ok = false;
+    else {
+      for (PINDEX i = 1; i < MessageWriter::MessageSize; ++i) {
+        if (message[i] != (BYTE)(next[id] + i))
+          ok = false;
+      }
+      ++next[id];
+    }
+  }
+
+  for (unsigned w = 0; w < Writers; ++w) {
+    writers[w]->WaitForTermination();
+    ok = ok && writers[w]->m_ok;
+    delete writers[w];
+  }
+
+  if (!ok) {
+    cout << "Messages from " << Writers << " writers: failed" << endl;
+    return false;
+  }
+
+  cout << "Messages from several writers: passed" << endl;
+  return true;
+}
+
+
+bool QChanBench::TestZeroCopy()
+{
+  static const PINDEX Total = 4000000;
+
+  PQueueChannel queue(4096, PQueueChannel::SingleProducerMode);
+  StreamWriter writer(queue, Total, 0, true);
+  bool ok = ReadStream(queue, Total, true);
+  writer.WaitForTermination();
+
+  // Peeking is not available in the locked mode
+  PQueueChannel locked(4096);
+  const BYTE * data;
+  if (!ok || !writer.m_ok || locked.ReadPeek(data, 0) != 0) {
+    cout << "Zero copy peek and commit: failed" << endl;
+    return false;
+  }
+
+  cout << "Zero copy peek and commit: passed" << endl;
+  return true;
+}
+
+
+bool QChanBench::TestGrowth()
+{
+  static const PQueueChannel::Mode Modes[] = { PQueueChannel::LockedMode, PQueueChannel::SingleProducerMode };
+
+  for (PINDEX m = 0; m < PARRAYSIZE(Modes); ++m) {
+    // With nothing reading, writes grow the queue instead of blocking
+    PQueueChannel queue;
+    queue.Open(100, Modes[m], 3000);
+    queue.SetWriteTimeout(0);
+
+    BYTE buffer[3000];
+    for (PINDEX i = 0; i < 3000; ++i)
+      buffer[i] = Pattern(i);
+
+    PINDEX written = 0;
+    while (written < 3000 && queue.Write(buffer+written, 3000-written))
+      written += queue.GetLastWriteCount();
+
+    bool ok = written == 3000 && queue.GetSize() == 3000 && queue.GetLength() == 3000 &&
+              !queue.Write(buffer, 1) && queue.GetErrorCode(PChannel::LastWriteError) == PChannel::Timeout;
+    ok = ok && ReadStream(queue, 3000, false);
+
+    // Growing while the reader is busy
+    queue.Open(16, Modes[m], 1 << 20);
+    queue.SetWriteTimeout(PMaxTimeInterval);
+    StreamWriter writer(queue, 4000000, 0, false);
+    ok = ReadStream(queue, 4000000, false) && ok;
+    writer.WaitForTermination();
+
+    if (!ok || !writer.m_ok) {
+      cout << "Growing " << ModeNames[Modes[m]] << " queue: failed" << endl;
+      return false;
+    }
+  }
+
+  cout << "Growing queues: passed" << endl;
+  return true;
+}
+
+
+bool QChanBench::TestTimeouts()
+{
+  for (int mode = PQueueChannel::LockedMode; mode <= PQueueChannel::MultiProducerMode; ++mode) {
+    PQueueChannel queue(100, (PQueueChannel::Mode)mode);
+    queue.SetReadTimeout(50);
+    queue.SetWriteTimeout(50);
+
+    BYTE buffer[100];
+    PTimeInterval start = PTimer::Tick();
+    bool ok = !queue.Read(buffer, 1) && queue.GetErrorCode(PChannel::LastReadError) == PChannel::Timeout;
+    PTimeInterval elapsed = PTimer::Tick() - start;
+    ok = ok && elapsed >= 40 && elapsed < 1000;
+
+    ok = ok && queue.Write(buffer, 100);
+    start = PTimer::Tick();
+    ok = ok && !queue.Write(buffer, 1) && queue.GetErrorCode(PChannel::LastWriteError) == PChannel::Timeout;
+    elapsed = PTimer::Tick() - start;
+    ok = ok && elapsed >= 40 && elapsed < 1000;
+
+    // Closing wakes a blocked reader
+    ok = ok && queue.Read(buffer, 100) && queue.GetLastReadCount() == 100;
+    queue.SetReadTimeout(PMaxTimeInterval);
+    Closer closer(queue);
+    ok = ok && !queue.Read(buffer, 1) && queue.GetErrorCode(PChannel::LastReadError) == PChannel::Interrupted;
+    closer.WaitForTermination();
+
+    if (!ok) {
+      cout << "Timeouts on " << ModeNames[mode] << " queue: failed" << endl;
+      return false;
+    }
+  }
+
+  cout << "Timeouts and closing: passed" << endl;
+  return true;
+}
+
+
+void QChanBench::Benchmark(unsigned megabytes)
+{
+  static const PINDEX Chunks[] = { 20, 160, 1500, 8192 };
+  PINDEX total = megabytes*1000000;
+
+  cout << "Megabytes per second through a 64kB queue, one writer thread:" << endl;
+  for (PINDEX c = 0; c < PARRAYSIZE(Chunks); ++c) {
+    cout << "  " << setw(5) << Chunks[c] << " byte writes";
+    for (int mode = PQueueChannel::LockedMode; mode <= PQueueChannel::MultiProducerMode; ++mode) {
+      PQueueChannel queue(65536, (PQueueChannel::Mode)mode);
+      std::vector<BYTE> buffer(Chunks[c]);
+
+      PInt64 start = PTimer::HighResolutionTick();
+      StreamWriter writer(queue, total, Chunks[c], false, false);
+      PINDEX done = 0;
+      while (done < total && queue.Read(&buffer[0], buffer.size()))
+        done += queue.GetLastReadCount();
+      writer.WaitForTermination();
+      PInt64 duration = PTimer::HighResolutionTick() - start;
+
+      cout << "  " << ModeNames[mode] << setw(7) << (unsigned)(total*1000.0/duration);
+    }
+    cout << endl;
+  }
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,368 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the per thread random number generators and
+ * the GUID generator, and to measure them with many threads.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/random.h>
+#include <ptclib/guid.h>
+
+#include <algorithm>
+#include <vector>
+
+
+class RandGUID : public PProcess
+{
+  PCLASSINFO(RandGUID, PProcess)
+  public:
+    RandGUID();
+    void Main();
+
+  protected:
+    bool TestSequence();
+    bool TestFill();
+    bool TestRange();
+    bool TestUniqueness(unsigned threads, unsigned count);
+    void Benchmark(unsigned threads, unsigned count);
+};
+
+PCREATE_PROCESS(RandGUID);
+
+
+RandGUID::RandGUID()
+  : PProcess("PTLib", "randguid", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void RandGUID::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-count:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestSequence();
+  ok = TestFill() && ok;
+  ok = TestRange() && ok;
+  ok = TestUniqueness(8, 50000) && ok;
+
+  if (!args.HasOption('T')) {
+    unsigned count = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 1000000;
+    static const unsigned threads[] = { 1, 2, 4, 8 };
+    for (PINDEX i = 0; i < PARRAYSIZE(threads); ++i)
+      Benchmark(threads[i], count/threads[i]);
+  }
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+bool RandGUID::TestSequence()
+{
+  // Values from the generator before it was split into Isaac() and Generate()
+  static const struct {
+    unsigned m_index;
+    unsigned m_value;
+  } expected[] = {
+    { 0, 0xa761930a }, { 1, 0x3cf32c99 }, { 2, 0xa1a51704 }, { 3, 0xb9b46bbc }, { 599, 0x031ae279 }
+  };
+
+  PRandom rand(1234);
+  PINDEX next = 0;
+  for (unsigned i = 0; i < 600; ++i) {
+    unsigned value = rand.Generate();
+    if (i == expected[next].m_index) {
+      if (value != expected[next].m_value) {
+        cout << "Seeded sequence: value " << i << " is 0x" << hex << value
+             << " not 0x" << expected[next].m_value << dec << endl;
+        return false;
+      }
+      ++next;
+    }
+  }
+
+  cout << "Seeded sequence unchanged: passed" << endl;
+  return true;
+}
+
+
+bool RandGUID::TestFill()
+{
+  static const PINDEX lengths[] = { 0, 1, 3, 4, 7, 1020, 1023, 1024, 1025, 5000 };
+
+  for (PINDEX i = 0; i < PARRAYSIZE(lengths); ++i) {
+    PINDEX length = lengths[i];
+    for (unsigned skip = 0; skip < 300; skip += 97) {
+      PRandom filled(99), single(99);
+      for (unsigned s = 0; s < skip; ++s) {
+        filled.Generate();
+        single.Generate();
+      }
+
+      PBYTEArray buffer(length+1), expected(length+1);
+      filled.GenerateBytes(buffer.GetPointer(), length);
+      for (PINDEX pos = 0; pos < length; pos += 4) {
+        DWORD value = single.Generate();
+        memcpy(expected.GetPointer() + pos, &value, std::min((PINDEX)4, length - pos));
+      }
+
+      if (buffer != expected || filled.Generate() != single.Generate()) {
+        cout << "Fill of " << length << " bytes after " << skip << " values: failed" << endl;
+        return false;
+      }
+    }
+  }
+
+  BYTE buffer[100];
+  memset(buffer, 0, sizeof(buffer));
+  PRandom::Fill(buffer, sizeof(buffer));
+  PINDEX zeros = std::count(buffer, buffer+sizeof(buffer), (BYTE)0);
+  if (zeros > 10) {
+    cout << "PRandom::Fill() left " << zeros << " zero bytes: failed" << endl;
+    return false;
+  }
+
+  cout << "Fill matches Generate(): passed" << endl;
+  return true;
+}
+
+
+bool RandGUID::TestRange()
+{
+  static const struct {
+    unsigned m_minimum;
+    unsigned m_maximum;
+  } ranges[] = { { 0, 1 }, { 5, 6 }, { 10, 10 }, { 0, 2 }, { 100, 1000 }, { 0, UINT_MAX } };
+
+  for (PINDEX i = 0; i < PARRAYSIZE(ranges); ++i) {
+    bool seenMinimum = false, seenMaximum = false;
+    for (int n = 0; n < 10000; ++n) {
+      unsigned value = PRandom::Number(ranges[i].m_minimum, ranges[i].m_maximum);
+      if (value < ranges[i].m_minimum || value > ranges[i].m_maximum) {
+        cout << "Number(" << ranges[i].m_minimum << ',' << ranges[i].m_maximum
+             << ") returned " << value << ": failed" << endl;
+        return false;
+      }
+      seenMinimum = seenMinimum || value == ranges[i].m_minimum;
+      seenMaximum = seenMaximum || value == ranges[i].m_maximum;
+    }
+    if (ranges[i].m_maximum - ranges[i].m_minimum <= 2 && !(seenMinimum && seenMaximum)) {
+      cout << "Number(" << ranges[i].m_minimum << ',' << ranges[i].m_maximum
+           << ") does not cover the range: failed" << endl;
+      return false;
+    }
+  }
+
+  cout << "Number() ranges: passed" << endl;
+  return true;
+}
+
+
+class GUIDThread : public PThread
+{
+  PCLASSINFO(GUIDThread, PThread);
+  public:
+    GUIDThread(unsigned count)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_ids(count)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      for (size_t i = 0; i < m_ids.size(); ++i) {
+        PGloballyUniqueID id;
+        memcpy(m_ids[i].m_bytes, (const BYTE *)id, sizeof(m_ids[i].m_bytes));
+      }
+    }
+
+    struct ID {
+      BYTE m_bytes[16];
+      bool operator<(const ID & other) const { return memcmp(m_bytes, other.m_bytes, 16) < 0; }
+      bool operator==(const ID & other) const { return memcmp(m_bytes, other.m_bytes, 16) == 0; }
+    };
+    std::vector<ID> m_ids;
+};
+
+
+bool RandGUID::TestUniqueness(unsigned threads, unsigned count)
+{
+  std::vector<GUIDThread *> workers;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.push_back(new GUIDThread(count));
+
+  std::vector<GUIDThread::ID> all;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers[i]->WaitForTermination();
+    all.insert(all.end(), workers[i]->m_ids.begin(), workers[i]->m_ids.end());
+    delete workers[i];
+  }
+
+  for (size_t i = 0; i < all.size(); ++i) {
+    if ((all[i].m_bytes[7] & 0xf0) != 0x10 || (all[i].m_bytes[8] & 0xc0) != 0x80) {
+      cout << "GUID has wrong version or variant: failed" << endl;
+      return false;
+    }
+  }
+
+  std::sort(all.begin(), all.end());
+  size_t duplicates = all.end() - std::unique(all.begin(), all.end());
+  if (duplicates > 0) {
+    cout << duplicates << " duplicate GUIDs from " << threads << " threads: failed" << endl;
+    return false;
+  }
+
+  cout << "GUIDs unique over " << threads << " threads: passed" << endl;
+  return true;
+}
+
+
+/* The generators as they were, every call taking the same global lock. */
+static unsigned LockedNumber()
+{
+  static PMutex mutex;
+  PWaitAndSignal wait(mutex);
+
+  static PRandom rand;
+  return rand;
+}
+
+
+static void LockedGUID(BYTE * id)
+{
+  static PMutex mutex;
+  PWaitAndSignal wait(mutex);
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  PInt64 timestamp = (tv.tv_sec*(PInt64)1000000 + tv.tv_usec)*10;
+  for (int i = 0; i < 8; ++i)
+    id[i] = (BYTE)(timestamp >> (i*8));
+
+  static WORD clockSequence = (WORD)LockedNumber();
+  static PInt64 lastTimestamp = 0;
+  if (lastTimestamp < timestamp)
+    lastTimestamp = timestamp;
+  else
+    clockSequence++;
+  id[8] = (BYTE)(clockSequence >> 8);
+  id[9] = (BYTE)clockSequence;
+}
+
+
+enum Operation { OpLockedNumber, OpNumber, OpFill, OpLockedGUID, OpGUID };
+
+class BenchmarkThread : public PThread
+{
+  PCLASSINFO(BenchmarkThread, PThread);
+  public:
+    BenchmarkThread(Operation operation, unsigned count)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_operation(operation)
+      , m_count(count)
+      , m_sum(0)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      DWORD buffer[64];
+      switch (m_operation) {
+        case OpLockedNumber :
+          for (unsigned i = 0; i < m_count; ++i)
+            m_sum += LockedNumber();
+          break;
+        case OpNumber :
+          for (unsigned i = 0; i < m_count; ++i)
+            m_sum += PRandom::Number();
+          break;
+        case OpFill :
+          for (unsigned i = 0; i < m_count; i += PARRAYSIZE(buffer)) {
+            PRandom::Fill(buffer, sizeof(buffer));
+            m_sum += buffer[0];
+          }
+          break;
+        case OpLockedGUID :
+          for (unsigned i = 0; i < m_count; ++i) {
+            PBYTEArray id(16);
+            LockedGUID(id.GetPointer());
+            m_sum += id[0];
+          }
+          break;
+        case OpGUID :
+          for (unsigned i = 0; i < m_count; ++i) {
+            PGloballyUniqueID guid;
+            m_sum += guid[0];
+          }
+          break;
+      }
+    }
+
+    Operation m_operation;
+    unsigned  m_count;
+    unsigned  m_sum;
+};
+
+
+static void Measure(const char * name, Operation operation, unsigned threads, unsigned count)
+{
+  // Best of three, other load skews single runs
+  PInt64 best = 0;
+  for (int run = 0; run < 3; ++run) {
+    PInt64 start = PTimer::HighResolutionTick();
+    std::vector<BenchmarkThread *> workers;
+    for (unsigned i = 0; i < threads; ++i)
+      workers.push_back(new BenchmarkThread(operation, count));
+    for (unsigned i = 0; i < threads; ++i) {
+      workers[i]->WaitForTermination();
+      delete workers[i];
+    }
+    PInt64 duration = PTimer::HighResolutionTick() - start;
+    if (run == 0 || duration < best)
+      best = duration;
+  }
+
+  cout << "  " << setw(28) << left << name << right << setw(10)
+       << (PUInt64)count*threads*1000000000/best << " /s" << endl;
+}
+
+
+void RandGUID::Benchmark(unsigned threads, unsigned count)
+{
+  cout << threads << " thread" << (threads > 1 ? "s:" : ":") << endl;
+  Measure("Number() with global lock", OpLockedNumber, threads, count);
+  Measure("PRandom::Number()", OpNumber, threads, count);
+  Measure("PRandom::Fill() words", OpFill, threads, count);
+  Measure("GUID with global lock", OpLockedGUID, threads, count/4);
+  Measure("PGloballyUniqueID()", OpGUID, threads, count/4);
+}
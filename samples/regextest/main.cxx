@@ -0,0 +1,399 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test PRegularExpression and PRegexSet against the
+ * system regexec(), and to time matching against a large dial plan.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/random.h>
+
+#include <regex.h>
+
+
+class RegexTest : public PProcess
+{
+  PCLASSINFO(RegexTest, PProcess)
+  public:
+    RegexTest();
+    void Main();
+
+  protected:
+    bool TestCases();
+    bool TestRandomPatterns(unsigned count);
+    bool TestSet();
+    void Benchmark(PINDEX rules, PINDEX numbers);
+};
+
+PCREATE_PROCESS(RegexTest);
+
+
+/* Reference result straight from the system library. */
+class Reference
+{
+  public:
+    Reference(const char * pattern, int flags)
+      { m_ok = regcomp(&m_regex, pattern, flags) == 0; }
+    ~Reference()
+      { if (m_ok) regfree(&m_regex); }
+
+    bool Execute(const char * str, PINDEX & start, PINDEX & len, int flags) const
+    {
+      regmatch_t match;
+      if (regexec(&m_regex, str, 1, &match, flags) != 0)
+        return false;
+      start = match.rm_so;
+      len = match.rm_eo - match.rm_so;
+      return true;
+    }
+
+    bool    m_ok;
+    regex_t m_regex;
+};
+
+
+RegexTest::RegexTest()
+  : PProcess("PTLib", "regextest", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void RegexTest::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-count:"
+             "r-rules:"
+             "d-dialled:"
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestCases();
+  ok = TestRandomPatterns(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 3000) && ok;
+  ok = TestSet() && ok;
+
+  Benchmark(args.HasOption('r') ? args.GetOptionString('r').AsUnsigned() : 10000,
+            args.HasOption('d') ? args.GetOptionString('d').AsUnsigned() : 1000);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+static bool Agrees(const char * pattern, int flags, const char * str, int execFlags)
+{
+  Reference reference(pattern, flags);
+  PRegularExpression regex;
+  if (regex.Compile(pattern, flags) != reference.m_ok) {
+    cout << "Compile differs for \"" << pattern << "\" flags " << flags << endl;
+    return false;
+  }
+  if (!reference.m_ok)
+    return true;
+
+  PINDEX refStart = 0, refLen = 0, start = 0, len = 0;
+  bool refMatched = reference.Execute(str, refStart, refLen, execFlags);
+  bool matched = regex.Execute(str, start, len, execFlags) != PFalse;
+  if (matched == refMatched && (!matched || (start == refStart && len == refLen)))
+    return true;
+
+  cout << "Mismatch: pattern \"" << pattern << "\" flags " << flags
+       << " string \"" << str << "\" exec flags " << execFlags << ": expected ";
+  if (refMatched)
+    cout << refStart << ',' << refLen;
+  else
+    cout << "no match";
+  cout << ", got ";
+  if (matched)
+    cout << start << ',' << len;
+  else
+    cout << "no match";
+  cout << endl;
+  return false;
+}
+
+
+bool RegexTest::TestCases()
+{
+  static const char * const Patterns[] = {
+    "a|ab", "(a|ab)(c|bcd)", "x*", "^$", "^a", "b$", "^ab|cd$", "a+b?c*",
+    "[[:alpha:]]+", "[[:digit:]]{2,3}", "[^]a]+", "[]a-]", "[a-]", "a.c",
+    "a{0}b", "(ab){2}", "(a*)*b", "(a|b)*abb", "\\.", "a\\|b", "a\\+",
+    "\\(ab\\)*c", "a\\{2,3\\}", "*a", "^*a", "a\\(b\\)\\1", "(a)\\1",
+    "\\<a", "\\bab", "[[.a.]]", "[[=a=]]", "a$b", "a^b", "()", "a||b",
+    "x{,2}", "[[:foo:]]", "\\w+", "caf\xc3\xa9", "0044[0-9]+", "[A-C]+"
+  };
+  static const char * const Strings[] = {
+    "", "a", "ab", "abc", "abcd", "abbc", "xaxa", "aab", "abab", "ABab",
+    "a.c", "a-c", "abb", "aabb", "12345", "]]a-", "a^b", "a$b", "a|b",
+    "a+", "aaa", "cd", "xcd", "b", "0044123", "caf\xc3\xa9"
+  };
+
+  bool ok = true;
+  for (PINDEX p = 0; p < PARRAYSIZE(Patterns); p++) {
+    for (int flags = 0; flags < 4; flags++) {
+      for (PINDEX s = 0; s < PARRAYSIZE(Strings); s++) {
+        for (int execFlags = 0; execFlags < 4; execFlags++)
+          ok = Agrees(Patterns[p], flags, Strings[s], execFlags) && ok;
+      }
+    }
+  }
+
+  PRegularExpression dial("^0044([0-9]+)$", PRegularExpression::Extended);
+  PStringArray substrings(2);
+  ok = ok && dial.Execute("00442071234567", substrings) && substrings[1] == "2071234567";
+  ok = ok && PString("Hello World").FindRegEx(PRegularExpression("o w", PRegularExpression::IgnoreCase)) == 4;
+  ok = ok && PString("12345").MatchesRegEx(PRegularExpression("[0-9]*", 0));
+
+  cout << "Test cases: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+static PString RandomPattern(PRandom & random, bool extended, int depth);
+
+static PString RandomPiece(PRandom & random, bool extended, int depth)
+{
+  static const char * const Brackets[] = { "[ab]", "[^a]", "[a-c]", "[[:digit:]]", "[]a]", "[A-Z]", "[^b-]" };
+  static const char Literals[] = "abcAB0-";
+
+  PString atom;
+  switch (random.Generate() % 8) {
+    case 0 :
+      atom = ".";
+      break;
+    case 1 :
+      atom = Brackets[random.Generate() % PARRAYSIZE(Brackets)];
+      break;
+    case 2 :
+      if (depth < 2) {
+        PString inner = RandomPattern(random, extended, depth+1);
+        atom = extended ? ('(' + inner + ')') : ("\\(" + inner + "\\)");
+        break;
+      }
+    default :
+      atom = Literals[random.Generate() % (sizeof(Literals)-1)];
+  }
+
+  switch (random.Generate() % 10) {
+    case 0 :
+    case 1 :
+      return atom + '*';
+    case 2 :
+      return atom + (extended ? "+" : "\\{1,\\}");
+    case 3 :
+      return atom + (extended ? "?" : "\\{0,1\\}");
+    case 4 :
+      return atom + (extended ? "{1,2}" : "\\{1,2\\}");
+    default :
+      return atom;
+  }
+}
+
+
+static PString RandomPattern(PRandom & random, bool extended, int depth)
+{
+  PString pattern;
+  int alternatives = extended ? random.Generate() % 3 : 0;
+  for (int a = 0; a <= alternatives; a++) {
+    if (a > 0)
+      pattern += '|';
+    int pieces = 1 + random.Generate() % 4;
+    for (int p = 0; p < pieces; p++)
+      pattern += RandomPiece(random, extended, depth);
+  }
+  return pattern;
+}
+
+
+bool RegexTest::TestRandomPatterns(unsigned count)
+{
+  static const char Chars[] = "abcAB0-.\n";
+  PRandom random(1);
+  bool ok = true;
+  unsigned failures = 0;
+
+  for (unsigned n = 0; n < count && failures < 10; n++) {
+    int flags = random.Generate() % 4;
+    PString pattern = RandomPattern(random, (flags & PRegularExpression::Extended) != 0, 0);
+    if (random.Generate() % 4 == 0)
+      pattern = '^' + pattern;
+    if (random.Generate() % 4 == 0)
+      pattern += '$';
+
+    for (int s = 0; s < 20; s++) {
+      PString str;
+      int length = random.Generate() % 12;
+      for (int i = 0; i < length; i++)
+        str += Chars[random.Generate() % (sizeof(Chars)-1)];
+      if (!Agrees(pattern, flags, str, random.Generate() % 4)) {
+        ok = false;
+        failures++;
+      }
+    }
+  }
+
+  cout << "Random patterns: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool RegexTest::TestSet()
+{
+  PRandom random(2);
+  PRegexSet set;
+  std::vector<Reference *> references;
+
+  for (int n = 0; n < 300; n++) {
+    int flags = random.Generate() % 4;
+    PString pattern = n % 50 == 0 ? PString("\\(a\\)\\1") : RandomPattern(random, (flags & PRegularExpression::Extended) != 0, 0);
+    Reference * reference = new Reference(pattern, flags);
+    PINDEX index = set.Add(pattern, flags);
+    if (reference->m_ok != (index != P_MAX_INDEX)) {
+      cout << "Set add differs for \"" << pattern << '"' << endl;
+      return false;
+    }
+    if (reference->m_ok)
+      references.push_back(reference);
+    else
+      delete reference;
+  }
+
+  bool ok = set.GetSize() == (PINDEX)references.size();
+  static const char Chars[] = "abcAB0-";
+  for (int s = 0; s < 500 && ok; s++) {
+    PString str;
+    int length = random.Generate() % 10;
+    for (int i = 0; i < length; i++)
+      str += Chars[random.Generate() % (sizeof(Chars)-1)];
+
+    PIntArray expected;
+    for (size_t i = 0; i < references.size(); i++) {
+      PINDEX start, len;
+      if (references[i]->Execute(str, start, len, 0)) {
+        expected.SetSize(expected.GetSize()+1);
+        expected[expected.GetSize()-1] = i;
+      }
+    }
+
+    PIntArray matches;
+    if (set.Execute(str, matches) != (expected.GetSize() > 0) || matches != expected) {
+      cout << "Set mismatch for \"" << str << "\": expected " << expected << " got " << matches << endl;
+      ok = false;
+    }
+  }
+
+  for (size_t i = 0; i < references.size(); i++)
+    delete references[i];
+
+  cout << "Regular expression set: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+#define TIME(name, statement) \
+  { \
+    PTimeInterval start = PTimer::Tick(); \
+    statement; \
+    cout << "  " << setw(28) << left << name << right << setw(8) << (PTimer::Tick() - start).GetMilliSeconds() << "ms" << endl; \
+  }
+
+void RegexTest::Benchmark(PINDEX ruleCount, PINDEX numberCount)
+{
+  static const char * const Tails[] = {
+    "[0-9][0-9]{%u}$", "[0-9]{%u,12}$", "[0-9]*$", "(1|2|3)[0-9]{%u}$", "[2-9][0-9]{%u}$"
+  };
+
+  // A dial plan of routes by number prefix, like a carrier routing table
+  PRandom random(3);
+  PStringArray rules, prefixes;
+  for (PINDEX i = 0; i < ruleCount; i++) {
+    PString prefix;
+    int length = 3 + random.Generate() % 5;
+    for (int d = 0; d < length; d++)
+      prefix += (char)('0' + random.Generate() % 10);
+    unsigned digits = 3 + random.Generate() % 6;
+    rules.AppendString("^\\+?" + prefix + psprintf(Tails[random.Generate() % PARRAYSIZE(Tails)], digits));
+    for (unsigned d = 0; d <= digits; d++)
+      prefix += '2';
+    prefixes.AppendString(prefix);
+  }
+
+  // Half are numbers for a random route, the rest mostly have no route
+  PStringArray numbers;
+  while (numbers.GetSize() < numberCount) {
+    if (random.Generate() % 2 == 0)
+      numbers.AppendString(prefixes[random.Generate() % ruleCount]);
+    else {
+      PString number;
+      int length = 4 + random.Generate() % 10;
+      for (int d = 0; d < length; d++)
+        number += (char)('0' + random.Generate() % 10);
+      numbers.AppendString(number);
+    }
+  }
+
+  cout << "Timings for " << ruleCount << " rules and " << numberCount << " numbers:" << endl;
+
+  std::vector<Reference *> references;
+  std::vector<PRegularExpression *> expressions;
+  PRegexSet set;
+  TIME("Compile regcomp", for (PINDEX i = 0; i < ruleCount; i++) references.push_back(new Reference(rules[i], REG_EXTENDED)));
+  TIME("Compile PRegularExpression", for (PINDEX i = 0; i < ruleCount; i++) expressions.push_back(new PRegularExpression(rules[i], PRegularExpression::Extended)));
+  TIME("Compile PRegexSet", for (PINDEX i = 0; i < ruleCount; i++) set.Add(rules[i], PRegularExpression::Extended));
+
+  // First matching rule routes the call
+  std::vector<PINDEX> refRoutes(numberCount, P_MAX_INDEX), routes(numberCount, P_MAX_INDEX), setRoutes(numberCount, P_MAX_INDEX);
+  PINDEX where, len;
+  TIME("regexec each rule",
+       for (PINDEX n = 0; n < numberCount; n++)
+         for (PINDEX i = 0; i < ruleCount; i++)
+           if (references[i]->Execute(numbers[n], where, len, 0)) { refRoutes[n] = i; break; });
+  TIME("PRegularExpression each rule",
+       for (PINDEX n = 0; n < numberCount; n++)
+         for (PINDEX i = 0; i < ruleCount; i++)
+           if (expressions[i]->Execute(numbers[n], where, len, 0)) { routes[n] = i; break; });
+  PIntArray matches;
+  TIME("PRegexSet single pass",
+       for (PINDEX n = 0; n < numberCount; n++)
+         if (set.Execute(numbers[n], matches)) setRoutes[n] = matches[0]);
+  TIME("PRegexSet again, DFA built",
+       for (PINDEX n = 0; n < numberCount; n++)
+         if (set.Execute(numbers[n], matches)) setRoutes[n] = matches[0]);
+
+  PINDEX routed = 0;
+  for (PINDEX n = 0; n < numberCount; n++) {
+    if (refRoutes[n] != P_MAX_INDEX)
+      routed++;
+    if (routes[n] != refRoutes[n] || setRoutes[n] != refRoutes[n])
+      cout << "  Route differs for " << numbers[n] << endl;
+  }
+  cout << "  " << routed << " of " << numberCount << " numbers routed" << endl;
+
+  for (PINDEX i = 0; i < ruleCount; i++) {
+    delete references[i];
+    delete expressions[i];
+  }
+}
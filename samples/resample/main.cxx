@@ -0,0 +1,525 @@
+/*
+ * main.cxx
+ *
+ * Sample program to test the audio sample rate and channel converter,
+ * PAudioResampleChannel and PWAVFile autoconversion, and to measure their
+ * throughput.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+#include <ptclib/resample.h>
+#include <ptclib/pwavfile.h>
+#include <ptclib/pwavfiledev.h>
+#include <ptclib/memfile.h>
+
+#include <math.h>
+#include <vector>
+
+
+class Resample : public PProcess
+{
+  PCLASSINFO(Resample, PProcess)
+  public:
+    Resample();
+    void Main();
+
+  protected:
+    bool TestSNR();
+    bool TestStopband();
+    bool TestStreaming();
+    bool TestChannels();
+    bool TestWAVFile();
+    bool TestWAVFileDevice();
+    bool TestChannel();
+    void Benchmark(unsigned seconds);
+};
+
+PCREATE_PROCESS(Resample);
+
+
+static const char * const QualityNames[PAudioResampler::NumQualities] = { "fast", "medium", "high" };
+
+typedef std::vector<short> Samples;
+
+
+Resample::Resample()
+  : PProcess("PTLib", "resample", 1, 0, AlphaCode, 1)
+{
+}
+
+
+void Resample::Main()
+{
+  PArgList & args = GetArguments();
+  args.Parse("n-seconds:"
+             "T-tests-only."
+             "t-trace."
+             "o-output:");
+
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
+
+  bool ok = TestSNR();
+  ok = TestStopband() && ok;
+  ok = TestStreaming() && ok;
+  ok = TestChannels() && ok;
+  ok = TestWAVFile() && ok;
+  ok = TestWAVFileDevice() && ok;
+  ok = TestChannel() && ok;
+
+  if (!args.HasOption('T'))
+    Benchmark(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 10);
+
+  cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+/* A tone in each channel, channel c at frequency[c % count]. */
+static Samples MakeTone(unsigned rate, unsigned channels, PINDEX frames,
+                        const double * frequency, unsigned count, double amplitude)
+{
+  Samples samples(frames*channels);
+  for (PINDEX i = 0; i < frames; ++i) {
+    for (unsigned c = 0; c < channels; ++c)
+      samples[i*channels+c] = (short)floor(amplitude*sin(2*M_PI*frequency[c % count]*i/rate) + 0.5);
+  }
+  return samples;
+}
+
+
+/* Convert a whole stream, in blocks of the given number of frames, or in
+   one go if zero, and flush the end. */
+static Samples Convert(PAudioResampler & resampler, const Samples & input, PINDEX blockFrames = 0)
+{
+  unsigned inputChannels = resampler.GetInputChannels();
+  unsigned outputChannels = resampler.GetOutputChannels();
+  PINDEX inputFrames = input.size()/inputChannels;
+  if (blockFrames == 0)
+    blockFrames = inputFrames;
+
+  Samples output;
+  std::vector<short> buffer;
+  for (PINDEX done = 0; done < inputFrames; done += blockFrames) {
+    PINDEX frames = std::min(blockFrames, inputFrames - done);
+    buffer.resize((resampler.GetMaxOutputFrames(frames)+1)*outputChannels);
+    PINDEX count = resampler.Process(&input[done*inputChannels], frames, &buffer[0]);
+    output.insert(output.end(), buffer.begin(), buffer.begin() + count*outputChannels);
+  }
+
+  buffer.resize((resampler.GetMaxOutputFrames(0)+1)*outputChannels);
+  PINDEX count = resampler.Flush(&buffer[0]);
+  output.insert(output.end(), buffer.begin(), buffer.begin() + count*outputChannels);
+  return output;
+}
+
+
+/* Signal to noise ratio of one channel against the ideal tone, leaving out
+   the start and end where the filter runs into the surrounding silence. */
+static double ToneSNR(const Samples & output, unsigned rate, unsigned channels, unsigned channel,
+                      double frequency, double amplitude)
+{
+  PINDEX frames = output.size()/channels;
+  PINDEX skip = rate/50;
+  double signal = 0, noise = 0;
+  for (PINDEX i = skip; i < frames - skip; ++i) {
+    double ideal = amplitude*sin(2*M_PI*frequency*i/rate);
+    double error = output[i*channels+channel] - ideal;
+    signal += ideal*ideal;
+    noise += error*error;
+  }
+  return noise > 0 ? 10*log10(signal/noise) : 200;
+}
+
+
+static const struct {
+  unsigned m_inputRate;
+  unsigned m_outputRate;
+} Conversions[] = {
+  {  8000, 16000 }, { 16000,  8000 }, { 44100,  8000 }, {  8000, 44100 },
+  { 48000, 44100 }, { 11025,  8000 }, { 16000, 48000 }, { 22050, 16000 },
+  { 48000, 16000 }
+};
+
+
+bool Resample::TestSNR()
+{
+  // Tones well inside and near the edge of the passband of every preset
+  static const double Fractions[] = { 0.1, 0.37, 0.7 };
+  static const double MinimumSNR[PAudioResampler::NumQualities] = { 48, 72, 85 };
+  static const double Amplitude = 16000;
+
+  for (PINDEX q = 0; q < PAudioResampler::NumQualities; ++q) {
+    double worst = 1000;
+    for (PINDEX i = 0; i < PARRAYSIZE(Conversions); ++i) {
+      unsigned inputRate = Conversions[i].m_inputRate;
+      unsigned outputRate = Conversions[i].m_outputRate;
+      for (PINDEX f = 0; f < PARRAYSIZE(Fractions); ++f) {
+        double frequency = Fractions[f]*std::min(inputRate, outputRate)/2;
+        PAudioResampler resampler(inputRate, 1, outputRate, 1, (PAudioResampler::Quality)q);
+        Samples output = Convert(resampler, MakeTone(inputRate, 1, inputRate/4, &frequency, 1, Amplitude));
+        double snr = ToneSNR(output, outputRate, 1, 0, frequency, Amplitude);
+        if (snr < MinimumSNR[q]) {
+          cout << "SNR " << QualityNames[q] << ' ' << inputRate << "->" << outputRate
+               << " at " << frequency << "Hz is " << snr << "dB: failed" << endl;
+          return false;
+        }
+        worst = std::min(worst, snr);
+      }
+    }
+    cout << "SNR " << QualityNames[q] << " at least " << setprecision(3) << worst << "dB: passed" << endl;
+  }
+  return true;
+}
+
+
+bool Resample::TestStopband()
+{
+  // A tone beyond the output Nyquist frequency must not alias into the output
+  static const double MinimumAttenuation[PAudioResampler::NumQualities] = { 50, 75, 90 };
+  static const double Amplitude = 16000;
+
+  for (PINDEX q = 0; q < PAudioResampler::NumQualities; ++q) {
+    double worst = 1000;
+    for (PINDEX i = 0; i < PARRAYSIZE(Conversions); ++i) {
+      unsigned inputRate = Conversions[i].m_inputRate;
+      unsigned outputRate = Conversions[i].m_outputRate;
+      if (outputRate > inputRate || outputRate*1.25/2 > inputRate*0.45)
+        continue;
+
+      double frequency = outputRate*1.25/2;
+      PAudioResampler resampler(inputRate, 1, outputRate, 1, (PAudioResampler::Quality)q);
+      Samples output = Convert(resampler, MakeTone(inputRate, 1, inputRate/4, &frequency, 1, Amplitude));
+
+      PINDEX skip = outputRate/50;
+      double power = 0;
+      for (PINDEX n = skip; n < (PINDEX)output.size() - skip; ++n)
+        power += (double)output[n]*output[n];
+      power /= output.size() - 2*skip;
+      double attenuation = power > 0 ? 10*log10(Amplitude*Amplitude/2/power) : 200;
+      if (attenuation < MinimumAttenuation[q]) {
+        cout << "Stopband " << QualityNames[q] << ' ' << inputRate << "->" << outputRate
+             << " at " << frequency << "Hz is " << attenuation << "dB: failed" << endl;
+        return false;
+      }
+      worst = std::min(worst, attenuation);
+    }
+    cout << "Stopband " << QualityNames[q] << " at least " << setprecision(3) << worst << "dB: passed" << endl;
+  }
+  return true;
+}
+
+
+bool Resample::TestStreaming()
+{
+  static const double Frequencies[] = { 440, 1000 };
+  static const PINDEX Blocks[] = { 1, 7, 160, 441, 1000 };
+
+  for (PINDEX i = 0; i < PARRAYSIZE(Conversions); ++i) {
+    unsigned inputRate = Conversions[i].m_inputRate;
+    unsigned outputRate = Conversions[i].m_outputRate;
+    Samples input = MakeTone(inputRate, 2, inputRate/10, Frequencies, 2, 12000);
+
+    PAudioResampler resampler(inputRate, 2, outputRate, 2, PAudioResampler::HighQuality);
+    Samples whole = Convert(resampler, input);
+
+    PINDEX expected = ((PInt64)input.size()/2*outputRate + inputRate - 1)/inputRate;
+    if ((PINDEX)whole.size() != expected*2) {
+      cout << "Length " << inputRate << "->" << outputRate << " is " << whole.size()/2
+           << " frames, not " << expected << ": failed" << endl;
+      return false;
+    }
+
+    for (PINDEX b = 0; b < PARRAYSIZE(Blocks); ++b) {
+      if (Convert(resampler, input, Blocks[b]) != whole) {
+        cout << "Streaming " << inputRate << "->" << outputRate << " in blocks of "
+             << Blocks[b] << " differs: failed" << endl;
+        return false;
+      }
+    }
+  }
+
+  cout << "Block sizes and lengths: passed" << endl;
+  return true;
+}
+
+
+bool Resample::TestChannels()
+{
+  // Right is left plus an even number, so the mean of the two is exact
+  static const double Frequencies[] = { 300, 1700 };
+  static const unsigned Rates[][2] = { { 8000, 8000 }, { 44100, 8000 }, { 8000, 16000 } };
+
+  for (PINDEX r = 0; r < PARRAYSIZE(Rates); ++r) {
+    unsigned inputRate = Rates[r][0], outputRate = Rates[r][1];
+    Samples tones = MakeTone(inputRate, 2, inputRate/10, Frequencies, 2, 8000);
+    PINDEX frames = tones.size()/2;
+    Samples stereo(frames*2), mono(frames);
+    for (PINDEX i = 0; i < frames; ++i) {
+      stereo[i*2] = tones[i*2];
+      stereo[i*2+1] = (short)(tones[i*2] + 2*(tones[i*2+1]/2));
+      mono[i] = (short)(tones[i*2] + tones[i*2+1]/2);
+    }
+
+    PAudioResampler monoToMono(inputRate, 1, outputRate, 1);
+    Samples expected = Convert(monoToMono, mono);
+
+    PAudioResampler stereoToMono(inputRate, 2, outputRate, 1);
+    if (Convert(stereoToMono, stereo) != expected) {
+      cout << "Stereo to mono at " << inputRate << "->" << outputRate << " is not the mean: failed" << endl;
+      return false;
+    }
+
+    PAudioResampler monoToStereo(inputRate, 1, outputRate, 2);
+    Samples output = Convert(monoToStereo, mono);
+    for (PINDEX i = 0; i < (PINDEX)expected.size(); ++i) {
+      if (output[i*2] != expected[i] || output[i*2+1] != expected[i]) {
+        cout << "Mono to stereo at " << inputRate << "->" << outputRate << " is not a copy: failed" << endl;
+        return false;
+      }
+    }
+  }
+
+  cout << "Channel mixing: passed" << endl;
+  return true;
+}
+
+
+static bool WriteWAV(const PFilePath & path, unsigned rate, unsigned channels, unsigned bits, const Samples & samples)
+{
+  PWAVFile file(path, PFile::WriteOnly);
+  if (!file.IsOpen())
+    return false;
+  file.SetChannels(channels);
+  file.SetSampleRate(rate);
+  file.SetSampleSize(bits);
+
+  if (bits == 16)
+    return file.Write(&samples[0], samples.size()*sizeof(short));
+
+  PBYTEArray pcm8(samples.size());
+  for (PINDEX i = 0; i < (PINDEX)samples.size(); ++i)
+    pcm8[i] = (BYTE)((samples[i] >> 8) + 0x80);
+  return file.Write(pcm8, pcm8.GetSize());
+}
+
+
+static Samples ReadWAV(PWAVFile & file, PINDEX blockBytes)
+{
+  Samples samples;
+  std::vector<short> buffer(blockBytes/sizeof(short));
+  while (file.Read(&buffer[0], blockBytes)) {
+    PINDEX count = file.GetLastReadCount()/sizeof(short);
+    samples.insert(samples.end(), buffer.begin(), buffer.begin() + count);
+  }
+  return samples;
+}
+
+
+bool Resample::TestWAVFile()
+{
+  static const double Frequencies[] = { 1000, 2500 };
+  Samples tones = MakeTone(44100, 2, 44100/2, Frequencies, 2, 10000);
+
+  for (unsigned bits = 8; bits <= 16; bits += 8) {
+    PFilePath path("resample", NULL);
+    Samples input = tones;
+    if (bits == 8) {
+      for (PINDEX i = 0; i < (PINDEX)input.size(); ++i)
+        input[i] = (short)(((input[i] >> 8) << 8));
+    }
+
+    if (!WriteWAV(path, 44100, 2, bits, input)) {
+      cout << "Could not write " << path << ": failed" << endl;
+      return false;
+    }
+
+    PAudioResampler resampler(44100, 2, 8000, 1);
+    Samples expected = Convert(resampler, input);
+
+    PWAVFile file;
+    file.SetAutoconvert(8000, 1);
+    if (!file.Open(path, PFile::ReadOnly)) {
+      cout << "Could not read " << path << ": failed" << endl;
+      return false;
+    }
+
+    off_t length = file.GetDataLength();
+    Samples output = ReadWAV(file, 320);
+    if (output != expected) {
+      cout << bits << " bit WAV file read differs from the resampler: failed" << endl;
+      return false;
+    }
+    if (length/2 + 1 < (off_t)output.size() || (off_t)output.size() < length/2) {
+      cout << bits << " bit WAV file length " << length << " does not match "
+           << output.size() << " samples read: failed" << endl;
+      return false;
+    }
+
+    file.SetPosition(0);
+    if (file.GetPosition() != 0 || ReadWAV(file, 1000) != expected) {
+      cout << bits << " bit WAV file read after rewinding differs: failed" << endl;
+      return false;
+    }
+
+    file.Close();
+    PFile::Remove(path);
+  }
+
+  cout << "WAV file autoconversion: passed" << endl;
+  return true;
+}
+
+
+/* The WAV file sound device resamples 8 and 16 bit PCM files to the rate
+   asked for, but must refuse anything else at a different rate, here 32 bit
+   PCM, rather than play it at the wrong speed.
+ */
+bool Resample::TestWAVFileDevice()
+{
+  static const double Frequency = 1000;
+  PFilePath pcm16Path("resample", NULL);
+  if (!WriteWAV(pcm16Path, 16000, 1, 16, MakeTone(16000, 1, 1600, &Frequency, 1, 10000))) {
+    cout << "Could not write " << pcm16Path << ": failed" << endl;
+    return false;
+  }
+
+  PFilePath pcm32Path("resample", NULL);
+  {
+    PWAVFile file(pcm32Path, PFile::WriteOnly);
+    file.SetSampleRate(16000);
+    file.SetSampleSize(32);
+    PBYTEArray silence(6400);
+    if (!file.Write(silence, silence.GetSize())) {
+      cout << "Could not write " << pcm32Path << ": failed" << endl;
+      return false;
+    }
+  }
+
+  PSoundChannel_WAVFile device;
+  bool ok = device.Open(pcm16Path, PSoundChannel::Recorder, 1, 8000, 16);
+  device.Close();
+
+  ok = device.Open(pcm32Path, PSoundChannel::Recorder, 1, 16000, 32) && ok;
+  device.Close();
+
+  ok = !device.Open(pcm32Path, PSoundChannel::Recorder, 1, 8000, 32) && ok;
+  device.Close();
+
+  PFile::Remove(pcm16Path);
+  PFile::Remove(pcm32Path);
+
+  cout << "WAV file device rates: " << (ok ? "passed" : "FAILED") << endl;
+  return ok;
+}
+
+
+bool Resample::TestChannel()
+{
+  // Write 8kHz mono as 44.1kHz stereo and read it back
+  static const double Frequency = 700;
+  static const PINDEX BlockFrames = 160;
+  Samples input = MakeTone(8000, 1, 8000, &Frequency, 1, 10000);
+
+  PMemoryFile memory;
+  PAudioResampleChannel writer(44100, 2, 8000, 1);
+  writer.Open(memory);
+  for (PINDEX i = 0; i < (PINDEX)input.size(); i += BlockFrames) {
+    if (!writer.Write(&input[i], BlockFrames*sizeof(short)) || writer.GetLastWriteCount() != BlockFrames*sizeof(short)) {
+      cout << "Resample channel write: failed" << endl;
+      return false;
+    }
+  }
+
+  PAudioResampler resampler(8000, 1, 44100, 2);
+  Samples expected = Convert(resampler, input);
+  const short * written = (const short *)(const BYTE *)memory.GetData();
+  PINDEX writtenSamples = memory.GetData().GetSize()/sizeof(short);
+  if (writtenSamples > (PINDEX)expected.size() || !std::equal(written, written + writtenSamples, expected.begin())) {
+    cout << "Resample channel writes differ from the resampler: failed" << endl;
+    return false;
+  }
+
+  memory.SetPosition(0);
+  PAudioResampleChannel reader(44100, 2, 8000, 1);
+  reader.Open(memory);
+  Samples output;
+  short buffer[BlockFrames];
+  while (reader.Read(buffer, sizeof(buffer)))
+    output.insert(output.end(), buffer, buffer + reader.GetLastReadCount()/sizeof(short));
+
+  double snr = ToneSNR(output, 8000, 1, 0, Frequency, 10000);
+  if (output.size() + BlockFrames < input.size() || snr < 60) {
+    cout << "Resample channel round trip of " << output.size() << " samples has SNR "
+         << snr << "dB: failed" << endl;
+    return false;
+  }
+
+  cout << "Resample channel round trip " << setprecision(3) << snr << "dB: passed" << endl;
+  return true;
+}
+
+
+void Resample::Benchmark(unsigned seconds)
+{
+  static const struct {
+    unsigned m_inputRate;
+    unsigned m_inputChannels;
+    unsigned m_outputRate;
+    unsigned m_outputChannels;
+  } Cases[] = {
+    {  8000, 1, 16000, 1 }, { 16000, 1,  8000, 1 }, { 44100, 2,  8000, 1 },
+    {  8000, 1, 48000, 2 }, { 48000, 2, 44100, 2 }, { 44100, 2, 48000, 2 }
+  };
+  static const double Frequencies[] = { 440, 1000 };
+
+  cout << "Seconds of audio converted per second, in 20ms blocks:" << endl;
+  for (PINDEX i = 0; i < PARRAYSIZE(Cases); ++i) {
+    Samples input = MakeTone(Cases[i].m_inputRate, Cases[i].m_inputChannels,
+                             Cases[i].m_inputRate*seconds, Frequencies, 2, 10000);
+    PINDEX blockFrames = Cases[i].m_inputRate/50;
+
+    cout << "  " << setw(6) << Cases[i].m_inputRate << "Hz x" << Cases[i].m_inputChannels
+         << " -> " << setw(6) << Cases[i].m_outputRate << "Hz x" << Cases[i].m_outputChannels;
+    for (PINDEX q = 0; q < PAudioResampler::NumQualities; ++q) {
+      PAudioResampler resampler(Cases[i].m_inputRate, Cases[i].m_inputChannels,
+                                Cases[i].m_outputRate, Cases[i].m_outputChannels,
+                                (PAudioResampler::Quality)q);
+
+      // Best of three, other load skews single runs
+      PInt64 best = 0;
+      for (int run = 0; run < 3; ++run) {
+        PInt64 start = PTimer::HighResolutionTick();
+        Convert(resampler, input, blockFrames);
+        PInt64 duration = PTimer::HighResolutionTick() - start;
+        if (run == 0 || duration < best)
+          best = duration;
+      }
+      cout << "  " << QualityNames[q] << setw(8) << (unsigned)(seconds*1e9/best) << 'x';
+    }
+    cout << endl;
+  }
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
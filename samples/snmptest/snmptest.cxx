@@ -33,38 +33,43 @@ usage on linux with snmpget:
 snmpget -v1 -c public 127.0.0.1:34500 1.3.6.1.2.1.1.1.0
 
 will print PTLIB_VERSION 
+
+PTLib runtime statistics are published below 1.3.6.1.4.1.34500.1, try:
+
+snmpwalk -v1 -c public 127.0.0.1:34500 1.3.6.1.4.1.34500
+snmpbulkwalk -v2c -c public 127.0.0.1:34500 1.3.6.1.4.1.34500
+
+Running "snmptest -b n" instead performs an in-process benchmark walking
+a MIB of n variables with GetNext and GetBulk requests.
 */
 
 
 
 #include "snmptest.h"
 
+#define BASE_OID "1.3.6.1.4.1.34500"
+
 /** Start SNMPServer on 127.0.0.1 port 34500
 */
 MySNMPServer::MySNMPServer()
-  :PSNMPServer(PIPSocket::Address::Address(), 34500)
-  ,sys_description(PRFC1155_SimpleSyntax::e_string)
+  :PSNMPServer(PIPSocket::Address(), 34500)
 {
-  // Create a PRFC1155_ObjectName and set value
-  // to '1.3.6.1.2.1.1.1.0' # system Description
-  PRFC1155_ObjectName obj_name;
-  obj_name.SetValue("1.3.6.1.2.1.1.1.0");
-
-  // Get sys_description object as ASN_OctetString and 
-  // Set it to 'PTLIB Version: PTLIB_VERSION'
-  PASN_OctetString *str = (PASN_OctetString *) &(sys_description.GetObject());
-  str->SetValue(PString("PTLIB Version : ") + PTLIB_VERSION);
-
-  // objList is the dictionary where PSNMPServer stores the 
-  // object_name--object mappings.
-  // On every request, PSNMPServer::MIB_LocalMatch function matches
-  // the oid to object in objList. if found, matched object is added to the result,
-  // else, SNMPServer responds with error (noSuchName).
-  // since PSNMPServer::MIB_LocalMatch is virtual, you can change this behaviour
-
-  objList.SetAt(obj_name, (PRFC1155_ObjectSyntax *) &sys_description);
+  // Accept SNMPv2c requests, so GetBulk may be used
+  SetVersion(1);
+
+  // Register '1.3.6.1.2.1.1.1.0' # system Description
+  // with the value 'PTLIB Version: PTLIB_VERSION'
+  PRFC1155_ObjectSyntax sys_description;
+  PSNMPMIBTree::SetString(sys_description, PString("PTLIB Version : ") + PTLIB_VERSION);
+
+  // The MIB tree answers Get, GetNext, GetBulk and Set requests in
+  // the default PSNMPServer handlers. Variables may be constants, or
+  // be bound to live data, read at the time of each request.
+  PSNMPMIBTree & mib = GetMIB();
+  mib.Register("1.3.6.1.2.1.1.1.0", new PSNMPMIBTree::Constant(sys_description));
+  mib.RegisterProcessStatistics(BASE_OID ".1");
+  mib.Register(BASE_OID ".2.1.0", new PSNMPMIBTree::Counter(requestCount));
 
-  PTrace::SetLevel(1);
   PTRACE(1, "SNMPServer\tWaiting for requests");
 }
 
@@ -74,25 +79,19 @@ MySNMPServer::MySNMPServer()
 */
 PBoolean MySNMPServer::Authorise(const PIPSocket::Address & received)
 {
-  PTRACE(1, "SNMPServer\tReceived request from " << received);
+  PTRACE(3, "SNMPServer\tReceived request from " << received);
+  ++requestCount;
   return PTrue;
 }
 
 
-/** Confirm Community String. We print community string and accept it
+/** Confirm Community String. We print community string and
+    check it against the configured one, "public" by default.
 */
 PBoolean MySNMPServer::ConfirmCommunity(PASN_OctetString & community)
 {
-  PTRACE(1, "SNMPServer\tReceived community : " << community);
-  return PTrue;
-}
-
-/** This is called on every get request
-    We are just going to return true for now 
-*/
-PBoolean MySNMPServer::OnGetRequest(PINDEX reqID, PSNMP::BindingList & vars, PSNMP::ErrorType & errCode)
-{
-  return PTrue;
+  PTRACE(3, "SNMPServer\tReceived community : " << community);
+  return PSNMPServer::ConfirmCommunity(community);
 }
 
 /* We can confirm the version of the snmp request here
@@ -100,8 +99,8 @@ PBoolean MySNMPServer::OnGetRequest(PINDEX reqID, PSNMP::BindingList & vars, PSN
 */
 PBoolean MySNMPServer::ConfirmVersion(PASN_Integer vers)
 {
-  PTRACE(1,"SNMPServer\tReceived Request version " << vers);
-  return PTrue;
+  PTRACE(3,"SNMPServer\tReceived Request version " << vers);
+  return PSNMPServer::ConfirmVersion(vers);
 }
 
 MySNMPServer::~MySNMPServer()
@@ -112,8 +111,25 @@ PCREATE_PROCESS(SNMPSrv)
 
 void SNMPSrv::Main()
 {
+  PArgList & args = GetArguments();
+  args.Parse("b-benchmark:"
+             "w-walks:"
+             "h-help.");
+
+  if (args.HasOption('h')) {
+    cout << "usage: snmptest [ -b variables [ -w walks ] ]\n";
+    return;
+  }
+
   // You can set level to 4 for more debug info
   PTrace::SetLevel(1);
+
+  if (args.HasOption('b')) {
+    Benchmark(args.GetOptionString('b').AsUnsigned(),
+              args.HasOption('w') ? args.GetOptionString('w').AsUnsigned() : 100);
+    return;
+  }
+
   PThread::Suspend();
 }
 
@@ -121,3 +137,116 @@ SNMPSrv::SNMPSrv()
 {
 	
 }
+
+
+/** Walk the MIB below root, using GetNext requests if maxRepetitions is
+    zero and GetBulk requests otherwise. Returns the number of variables
+    found, requests are passed directly to PSNMPServer::ProcessPDU(). The
+    message version is SNMPv1 for GetNext and SNMPv2c for GetBulk, unless
+    version is given.
+*/
+unsigned SNMPSrv::Walk(const PString & root, PINDEX maxRepetitions, int version)
+{
+  PString prefix = root + '.';
+  PString oid = root;
+  unsigned found = 0;
+
+  for (PINDEX requestId = 1; ; ++requestId) {
+    PSNMP_Message request;
+    request.m_version = version >= 0 ? version : (maxRepetitions > 0 ? 1 : 0);
+    request.m_community = "public";
+    request.m_pdu.SetTag(maxRepetitions > 0 ? PSNMP_PDUs::e_get_bulk_request : PSNMP_PDUs::e_get_next_request);
+
+    PSNMP_PDU & pdu = (PSNMP_PDU &)request.m_pdu.GetObject();
+    pdu.m_request_id = requestId;
+    pdu.m_error_index = maxRepetitions;
+    pdu.m_variable_bindings.SetSize(1);
+    pdu.m_variable_bindings[0].m_name.SetValue(oid);
+    PSNMPMIBTree::SetNull(pdu.m_variable_bindings[0].m_value);
+
+    PBYTEArray requestBuffer(1500);
+    request.Encode((PASN_Stream &)requestBuffer);
+
+    PBYTEArray responseBuffer;
+    if (!srv.ProcessPDU(requestBuffer, responseBuffer)) {
+      cout << "No response to request " << requestId << endl;
+      return found;
+    }
+
+    PSNMP_Message response;
+    PBER_Stream responseStream(responseBuffer);
+    if (!response.Decode(responseStream) || response.m_pdu.GetTag() != PSNMP_PDUs::e_get_response) {
+      cout << "Invalid response to request " << requestId << endl;
+      return found;
+    }
+
+    const PSNMP_GetResponse_PDU & reply = response.m_pdu;
+    if (reply.m_error_status != PSNMP::NoError)
+      return found;
+
+    const PSNMP_VarBindList & vars = reply.m_variable_bindings;
+    for (PINDEX i = 0; i < vars.GetSize(); ++i) {
+      oid = vars[i].m_name.AsString();
+      if (oid.Find(prefix) != 0)
+        return found;
+      ++found;
+    }
+  }
+}
+
+
+void SNMPSrv::Benchmark(unsigned variables, unsigned walks)
+{
+  // Check the value helpers survive encoding
+  PRFC1155_ObjectSyntax value;
+  PSNMPMIBTree::SetTimeTicks(value, 12345);
+  PBER_Stream valueStream;
+  value.Encode(valueStream);
+  valueStream.CompleteEncoding();
+  PRFC1155_ObjectSyntax decoded;
+  PBER_Stream decodeStream((const PBYTEArray &)valueStream);
+  if (!decoded.Decode(decodeStream) || decoded != value) {
+    cout << "Value encoding failed: " << value << " != " << decoded << endl;
+    return;
+  }
+
+  PSNMPMIBTree & mib = srv.GetMIB();
+  for (unsigned i = 1; i <= variables; ++i)
+    mib.Register(psprintf(BASE_OID ".3.%u.0", i), new PSNMPMIBTree::Gauge(srv.requestCount));
+
+  // GetBulk is not an SNMPv1 PDU, so must be ignored in a version 1 message
+  cout << "GetBulk in an SNMPv1 message, expecting no response:" << endl;
+  if (Walk(BASE_OID ".3", 10, 0) != 0)
+    cout << "GetBulk in an SNMPv1 message was answered!" << endl;
+
+  static const PINDEX Repetitions[] = { 0, 10, 50 };
+  for (PINDEX r = 0; r < PARRAYSIZE(Repetitions); ++r) {
+    unsigned found = 0;
+    PTime start;
+    for (unsigned w = 0; w < walks; ++w)
+      found = Walk(BASE_OID ".3", Repetitions[r]);
+    PTimeInterval duration = PTime() - start;
+
+    if (Repetitions[r] == 0)
+      cout << "GetNext";
+    else
+      cout << "GetBulk(" << Repetitions[r] << ')';
+    cout << " walk of " << found << " variables: "
+         << walks*1000.0/std::max<PInt64>(duration.GetMilliSeconds(), 1) << " walks/s" << endl;
+
+    if (found != variables)
+      cout << "Expected " << variables << " variables!" << endl;
+  }
+
+  PRFC1155_ObjectName threads;
+  threads.SetValue(BASE_OID ".1.1.0");
+  if (mib.Get(threads, value) == PSNMP::NoError)
+    cout << "Active threads: " << value << endl;
+
+  PTimer timer(0, 60);
+  PThread::Sleep(200);
+  PRFC1155_ObjectName timers;
+  timers.SetValue(BASE_OID ".1.2.0");
+  if (mib.Get(timers, value) == PSNMP::NoError)
+    cout << "Active timers: " << value << endl;
+}
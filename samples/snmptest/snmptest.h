@@ -35,12 +35,9 @@ class MySNMPServer : public PSNMPServer
 
     virtual PBoolean Authorise(const PIPSocket::Address & received);
 	virtual PBoolean ConfirmCommunity(PASN_OctetString & community);
-	virtual PBoolean OnGetRequest(PINDEX reqID, PSNMP::BindingList & vars, PSNMP::ErrorType & errCode);
     virtual PBoolean ConfirmVersion(PASN_Integer vers);
 
-  protected:
-    PRFC1155_SimpleSyntax sys_description;
-
+    PAtomicInteger requestCount;
 };
 
 class SNMPSrv : public PProcess
@@ -51,6 +48,9 @@ class SNMPSrv : public PProcess
     void Main();
 
   protected:
+    void Benchmark(unsigned variables, unsigned walks);
+    unsigned Walk(const PString & root, PINDEX maxRepetitions, int version = -1);
+
     MySNMPServer srv;
 };
 
@@ -3,6 +3,9 @@
 #include "SortedListTest.h"
 #include <ptclib/random.h>
 
+#include <vector>
+#include <algorithm>
+
 
 PCREATE_PROCESS(SortedListTest);
 
@@ -16,6 +19,18 @@ SortedListTest::SortedListTest()
 
 void SortedListTest::Main()
 {
+  PArgList & args = GetArguments();
+  args.Parse("b-benchmark."
+             "n-count:"
+             "s-size:");
+
+  if (args.HasOption('b')) {
+    bool ok = Verify(args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 100000);
+    Benchmark(args.HasOption('s') ? args.GetOptionString('s').AsUnsigned() : 200000);
+    cout << (ok ? "All tests passed." : "TESTS FAILED!") << endl;
+    SetTerminationValue(ok ? 0 : 1);
+    return;
+  }
 
   PINDEX i;
   for (i = 0; i < 10; i++) {
@@ -161,3 +176,186 @@ void DoSomeThing2::Main()
 }
 
 
+
+
+class IntKey : public PObject
+{
+  PCLASSINFO(IntKey, PObject);
+public:
+  IntKey(unsigned value) : m_value(value) { }
+  virtual PObject * Clone() const { return new IntKey(m_value); }
+  virtual Comparison Compare(const PObject & obj) const
+  {
+    unsigned other = ((const IntKey &)obj).m_value;
+    return m_value < other ? LessThan : m_value > other ? GreaterThan : EqualTo;
+  }
+  unsigned m_value;
+};
+
+typedef PSortedList<IntKey> IntKeyList;
+typedef PSortedList<IntKey, PSortedListTypedCompare<IntKey> > TypedIntKeyList;
+
+
+template <class L> static bool Same(const L & list, const std::vector<unsigned> & model)
+{
+  if (list.GetSize() != (PINDEX)model.size())
+    return false;
+  for (PINDEX i = 0; i < list.GetSize(); i++) {
+    if (list[i].m_value != model[i])
+      return false;
+  }
+  return true;
+}
+
+
+template <class L> static bool VerifyList(unsigned count)
+{
+  L list;
+  std::vector<unsigned> model;
+  PRandom rand(1);
+
+  for (unsigned n = 0; n < count; n++) {
+    unsigned value = rand.Generate() % 5000;  // Plenty of duplicates
+    switch (model.empty() ? 0 : rand.Generate() % 6) {
+      case 0 :
+      case 1 : {
+        PINDEX index = list.Append(new IntKey(value));
+        std::vector<unsigned>::iterator it = std::upper_bound(model.begin(), model.end(), value);
+        if (index != (PINDEX)(it - model.begin())) {
+          cout << "Append returned " << index << " expected " << (it - model.begin()) << endl;
+          return false;
+        }
+        model.insert(it, value);
+        break;
+      }
+
+      case 2 : {
+        PINDEX index = rand.Generate() % model.size();
+        list.RemoveAt(index);
+        model.erase(model.begin()+index);
+        break;
+      }
+
+      case 3 : {
+        PINDEX index = rand.Generate() % model.size();
+        if (list.GetObjectsIndex(&list[index]) != index || !list.Remove(&list[index])) {
+          cout << "Remove by pointer failed at " << index << endl;
+          return false;
+        }
+        model.erase(model.begin()+index);
+        break;
+      }
+
+      default : {
+        std::vector<unsigned>::iterator it = std::lower_bound(model.begin(), model.end(), value);
+        PINDEX expected = it != model.end() && *it == value ? (PINDEX)(it - model.begin()) : P_MAX_INDEX;
+        if (list.GetValuesIndex(IntKey(value)) != expected) {
+          cout << "GetValuesIndex(" << value << ") returned " << list.GetValuesIndex(IntKey(value)) << " expected " << expected << endl;
+          return false;
+        }
+      }
+    }
+
+    if ((n % 5000) == 0 && !Same(list, model)) {
+      cout << "Mismatch at operation " << n << endl;
+      return false;
+    }
+  }
+
+  if (!Same(list, model) || list.GetAt(list.GetSize()) != NULL || list.RemoveAt(list.GetSize()) != NULL)
+    return false;
+
+  L * clone = (L *)list.Clone();
+  bool ok = Same(*clone, model) && *clone == list && (list.GetSize() == 0 || &(*clone)[0] != &list[0]);
+  delete clone;
+
+  // Drain from both ends, exercising node merges all the way back to empty
+  while (ok && !model.empty()) {
+    if (model.size() & 1) {
+      list.RemoveAt(0);
+      model.erase(model.begin());
+    }
+    else {
+      list.RemoveAt(list.GetSize()-1);
+      model.pop_back();
+    }
+    ok = list.GetSize() == (PINDEX)model.size() && (model.empty() || (list[0].m_value == model.front() && list[list.GetSize()-1].m_value == model.back()));
+  }
+
+  // A small list grows its only node, so check every size up to past the first split
+  for (PINDEX size = 1; ok && size <= 2*PSortedListElement::MaxKeys; size++) {
+    L small;
+    std::vector<unsigned> smallModel;
+    for (PINDEX i = 0; i < size; i++) {
+      unsigned value = rand.Generate() % 20;
+      small.Append(new IntKey(value));
+      smallModel.insert(std::upper_bound(smallModel.begin(), smallModel.end(), value), value);
+    }
+    L * smallClone = (L *)small.Clone();
+    ok = Same(small, smallModel) && Same(*smallClone, smallModel);
+    delete smallClone;
+  }
+
+  return ok;
+}
+
+
+bool SortedListTest::Verify(unsigned count)
+{
+  bool ok = VerifyList<IntKeyList>(count);
+  cout << "Sorted list operations: " << (ok ? "passed" : "FAILED") << endl;
+
+  bool typedOk = VerifyList<TypedIntKeyList>(count);
+  cout << "Typed sorted list operations: " << (typedOk ? "passed" : "FAILED") << endl;
+  ok = ok && typedOk;
+
+  PSortedStringList strings;
+  static const char * const words[] = { "delta", "alpha", "charlie", "bravo", "alphabet", "echo", "alpha" };
+  for (PINDEX i = 0; i < PARRAYSIZE(words); i++)
+    strings.AppendString(words[i]);
+  bool stringsOk = strings.GetSize() == 7 &&
+                   strings[0] == "alpha" && strings[1] == "alpha" && strings[2] == "alphabet" && strings[6] == "echo" &&
+                   strings.GetStringsIndex("alpha") == 0 && strings.GetStringsIndex("charlie") == 4 &&
+                   strings.GetStringsIndex("foxtrot") == P_MAX_INDEX &&
+                   strings.GetNextStringsIndex("alphab") == 2 && strings.GetNextStringsIndex("b") == 3 &&
+                   strings.GetNextStringsIndex("a") == 0 && strings.GetNextStringsIndex("z") == 7;
+
+  PSortedStringList caseless(PARRAYSIZE(words), words, true);
+  stringsOk = stringsOk && caseless.GetStringsIndex("CHARLIE") == 4;
+  cout << "Sorted string list: " << (stringsOk ? "passed" : "FAILED") << endl;
+
+  return ok && stringsOk;
+}
+
+
+#define TIME(name, statement) \
+  { \
+    PTimeInterval start = PTimer::Tick(); \
+    statement; \
+    cout << "  " << setw(28) << left << name << right << setw(8) << (PTimer::Tick() - start).GetMilliSeconds() << "ms" << endl; \
+  }
+
+template <class L> static void BenchmarkList(PINDEX size)
+{
+  L list;
+  PRandom rand(1);
+  PINDEX i, total = 0;
+
+  TIME("Append", for (i = 0; i < size; i++) list.Append(new IntKey(rand.Generate())));
+  TIME("GetAt", for (i = 0; i < size; i++) total += list[rand.Generate() % size].m_value);
+  TIME("GetValuesIndex", for (i = 0; i < size; i++) total += list.GetValuesIndex(list[rand.Generate() % size]));
+  TIME("Remove", for (i = 0; i < size/2; i++) list.Remove(&list[rand.Generate() % list.GetSize()]));
+  TIME("RemoveAt", while (list.GetSize() > 0) list.RemoveAt(rand.Generate() % list.GetSize()));
+
+  if (total == 0)
+    cout << "Nothing read!" << endl;
+}
+
+
+void SortedListTest::Benchmark(PINDEX size)
+{
+  cout << "Timings for " << size << " elements:" << endl;
+  BenchmarkList<IntKeyList>(size);
+  cout << "Timings for " << size << " elements with typed compare:" << endl;
+  BenchmarkList<TypedIntKeyList>(size);
+}
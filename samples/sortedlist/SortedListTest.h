@@ -8,6 +8,9 @@ class SortedListTest:public PProcess {
 public:
   SortedListTest();
   void Main();
+protected:
+  bool Verify(unsigned count);
+  void Benchmark(PINDEX size);
 };
 
 
@@ -29,6 +29,9 @@
 #include <ptlib.h>
 #include <ptlib/pprocess.h>
 #include <ptclib/delaychan.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
 
 /*
  * The main program class
@@ -38,10 +41,118 @@ class TimingTest : public PProcess
   PCLASSINFO(TimingTest, PProcess)
   public:
     void Main();
+
+  protected:
+    PDECLARE_NOTIFIER(PPacingService, TimingTest, OnPeriodic);
+    PAtomicInteger m_periodicCount;
 };
 
 PCREATE_PROCESS(TimingTest);
 
+
+#if P_PROFILING
+
+class ProfileWorker : public PThread
+{
+    PCLASSINFO(ProfileWorker, PThread)
+  public:
+    ProfileWorker(unsigned iterations)
+      : PThread(10000, NoAutoDeleteThread, NormalPriority, "Profile")
+      , m_iterations(iterations)
+      , m_result(0)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      for (unsigned i = 0; i < m_iterations; ++i) {
+        PPROFILE_BLOCK("Square root loop");
+        for (unsigned j = 0; j < 100; ++j)
+          m_result += sqrt((double)(i+j));
+      }
+    }
+
+  protected:
+    unsigned m_iterations;
+    double   m_result;
+};
+
+
+// Get the count of a probe from the output of PProfiling::Dump()
+static PUInt64 GetProfileCount(const PString & name)
+{
+  PStringStream strm;
+  PProfiling::Dump(strm);
+  PINDEX pos = strm.Find(name);
+  if (pos == P_MAX_INDEX)
+    return 0;
+  pos = strm.Find("count=", pos);
+  return pos != P_MAX_INDEX ? strm.Mid(pos+6).AsUnsigned64() : 0;
+}
+
+#endif // P_PROFILING
+
+
+class JitterStream : public PThread
+{
+    PCLASSINFO(JitterStream, PThread)
+  public:
+    JitterStream(PPacingService * pacing, unsigned frames, PInt64 frameTime)
+      : PThread(10000, NoAutoDeleteThread, HighestPriority, "Jitter")
+      , m_pacing(pacing)
+      , m_frames(frames)
+      , m_frameTime(frameTime)
+    {
+      Resume();
+    }
+
+    void Main()
+    {
+      PAdaptiveDelay delay;
+      delay.SetPacingService(m_pacing);
+      delay.DelayMicroSeconds(m_frameTime);
+
+      // Lateness of each wake up against the ideal deadline, in microseconds
+      PInt64 start = PTimer::HighResolutionTick();
+      for (unsigned frame = 1; frame <= m_frames; ++frame) {
+        delay.DelayMicroSeconds(m_frameTime);
+        m_lateness.push_back((PTimer::HighResolutionTick() - start)/1000 - frame*m_frameTime);
+      }
+    }
+
+    PPacingService   * m_pacing;
+    unsigned           m_frames;
+    PInt64             m_frameTime;
+    std::vector<PInt64> m_lateness;
+};
+
+
+static void MeasureJitter(const char * title, PPacingService * pacing)
+{
+  static const unsigned Streams = 16;
+  static const unsigned Frames = 100;
+
+  JitterStream * streams[Streams];
+  unsigned i;
+  for (i = 0; i < Streams; i++) // Odd frame times, e.g. 128 samples at 44.1kHz, should not drift
+    streams[i] = new JitterStream(pacing, Frames, (i&1) != 0 ? 20000 : 2902);
+
+  std::vector<PInt64> lateness;
+  for (i = 0; i < Streams; i++) {
+    streams[i]->WaitForTermination();
+    lateness.insert(lateness.end(), streams[i]->m_lateness.begin(), streams[i]->m_lateness.end());
+    delete streams[i];
+  }
+
+  std::sort(lateness.begin(), lateness.end());
+  size_t count = lateness.size();
+  cout << title << ": " << Streams << " streams, lateness"
+          " p50=" << lateness[count/2] << "us"
+          " p99=" << lateness[count*99/100] << "us"
+          " max=" << lateness[count-1] << "us" << endl;
+}
+
 #define TEST_TIME(t) cout << t << " => " << PTime(t) << '\n'
 
 // The main program
@@ -118,6 +229,71 @@ void TimingTest::Main()
 
   cout << "Actual resolution is " << 1000000/count << "us" << endl;
 
+  cout << "\nTesting high resolution tick" << endl;
+  PInt64 hrStart = PTimer::HighResolutionTick();
+  PInt64 hrPrevious = hrStart;
+  PInt64 hrStep = 1000000000;
+  for (count = 0; count < 100000; count++) {
+    PInt64 hrTick = PTimer::HighResolutionTick();
+    if (hrTick > hrPrevious && hrTick - hrPrevious < hrStep)
+      hrStep = hrTick - hrPrevious;
+    hrPrevious = hrTick;
+  }
+  cout << "Smallest step is " << hrStep << "ns, "
+       << (hrPrevious - hrStart)/count << "ns per call" << endl;
+
+  cout << "\nTesting profiling" << endl;
+#if P_PROFILING
+  static const unsigned ProbeIterations = 1000000;
+  PInt64 hrProbe = PTimer::HighResolutionTick();
+  for (count = 0; count < ProbeIterations; count++) {
+    PPROFILE_BLOCK("Empty block");
+  }
+  cout << "Enabled probe costs " << (PTimer::HighResolutionTick() - hrProbe)/ProbeIterations << "ns" << endl;
+  PProfiling::SetEnabled(false);
+  hrProbe = PTimer::HighResolutionTick();
+  for (count = 0; count < ProbeIterations; count++) {
+    PPROFILE_BLOCK("Disabled block");
+  }
+  cout << "Disabled probe costs " << (PTimer::HighResolutionTick() - hrProbe)/ProbeIterations << "ns" << endl;
+  PProfiling::SetEnabled(true);
+
+  for (count = 0; count < 20; count++) {
+    PPROFILE_BLOCK("Sleep 2ms");
+    Sleep(2);
+  }
+
+  {
+    ProfileWorker * workers[4];
+    for (count = 0; count < PARRAYSIZE(workers); count++)
+      workers[count] = new ProfileWorker(100000);
+
+    // Take snapshots while the workers record, the count must never go back
+    PUInt64 lastCount = 0;
+    unsigned snapshots = 0;
+    bool ok = true;
+    while (!workers[0]->IsTerminated()) {
+      PUInt64 probeCount = GetProfileCount("Square root loop");
+      if (probeCount < lastCount)
+        ok = false;
+      lastCount = probeCount;
+      snapshots++;
+    }
+
+    for (count = 0; count < PARRAYSIZE(workers); count++) {
+      workers[count]->WaitForTermination();
+      delete workers[count];
+    }
+
+    ok = ok && GetProfileCount("Square root loop") == PARRAYSIZE(workers)*100000;
+    cout << "Snapshots while recording: " << snapshots << ' ' << (ok ? "passed" : "FAILED") << endl;
+  }
+
+  PProfiling::Dump(cout);
+#else
+  cout << "Profiling not built, configure with --enable-profiling." << endl;
+#endif // P_PROFILING
+
   oldTick = 123456;
   cout << "TimeInterval output: \"" << setw(15) << newTick << '"' << endl;
   cout << "TimeInterval output: \"" << setw(15) << oldTick << '"' << endl;
@@ -131,6 +307,15 @@ void TimingTest::Main()
     cout << "TimeInterval output: " << p << " \""
            << setw(p) << setprecision(2) << oldTick << '"' << endl;
 
+  cout << "\nTesting pacing jitter" << endl;
+  MeasureJitter("Sleeping in each stream", NULL);
+  MeasureJitter("Shared pacing service", &PPacingService::GetInstance());
+
+  PINDEX periodicId = PPacingService::GetInstance().AddPeriodic(PCREATE_NOTIFIER(OnPeriodic), 5000);
+  Sleep(1000);
+  PPacingService::GetInstance().RemovePeriodic(periodicId);
+  cout << "Periodic 5ms notifier called " << m_periodicCount << " times in one second" << endl;
+
   cout << "\nTesting sleep function" << endl;
   PTime start_time1;
   PINDEX loop;
@@ -162,3 +347,8 @@ void TimingTest::Main()
   cout << "The second loop took "<< end_time2-start_time2 << " milliseconds." << endl;
 }
 
+
+void TimingTest::OnPeriodic(PPacingService &, INT)
+{
+  ++m_periodicCount;
+}
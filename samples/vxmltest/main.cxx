@@ -15,6 +15,7 @@
 #include <ptlib.h>
 #include <ptlib/sound.h>
 #include <ptclib/vxml.h>
+#include <ptclib/memfile.h>
 
 #if !P_EXPAT
 #error Must have Expat XML support for this application
@@ -71,6 +72,131 @@ void ChannelCopyThread::Main()
   }
 }
 
+#define FRAME_SIZE 320
+
+class PromptBenchChannel : public PVXMLChannel
+{
+  PCLASSINFO(PromptBenchChannel, PVXMLChannel);
+  public:
+    PromptBenchChannel()
+      : PVXMLChannel(20, FRAME_SIZE)
+    { mediaFormat = VXML_PCM16; }
+
+    virtual PBoolean WriteFrame(const void *, PINDEX) { return true; }
+    virtual PBoolean IsSilenceFrame(const void *, PINDEX) const { return true; }
+    virtual PBoolean ReadFrame(void *, PINDEX) { return false; }
+    virtual PINDEX CreateSilenceFrame(void *, PINDEX amount) { return amount; }
+};
+
+
+class PromptBenchThread : public PThread
+{
+  PCLASSINFO(PromptBenchThread, PThread);
+  public:
+    PromptBenchThread(PromptBenchChannel & channel, PVXMLPromptCache * cache, const PFilePath & fn, unsigned plays)
+      : PThread(10000, NoAutoDeleteThread)
+      , m_channel(channel)
+      , m_cache(cache)
+      , m_filePath(fn)
+      , m_plays(plays)
+      , m_bytes(0)
+    { Resume(); }
+
+    void Main()
+    {
+      BYTE frame[FRAME_SIZE];
+
+      for (unsigned i = 0; i < m_plays; ++i) {
+        PFile * file;
+        PBYTEArray prompt;
+        if (m_cache != NULL && m_cache->GetPrompt(m_channel, m_filePath, prompt))
+          file = new PMemoryFile(prompt);
+        else
+          file = m_channel.CreateWAVFile(m_filePath);
+
+        if (file == NULL)
+          return;
+
+        while (file->Read(frame, sizeof(frame)) && file->GetLastReadCount() > 0)
+          m_bytes += file->GetLastReadCount();
+
+        delete file;
+      }
+    }
+
+    PromptBenchChannel & m_channel;
+    PVXMLPromptCache   * m_cache;
+    PFilePath            m_filePath;
+    unsigned             m_plays;
+    PUInt64              m_bytes;
+};
+
+
+static void PromptBenchmark(const PFilePath & fn, unsigned sessions, unsigned plays, PVXMLPromptCache * cache)
+{
+  PromptBenchChannel channel;
+  PList<PromptBenchThread> threads;
+
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < sessions; ++i)
+    threads.Append(new PromptBenchThread(channel, cache, fn, plays));
+
+  PUInt64 bytes = 0;
+  for (PINDEX i = 0; i < threads.GetSize(); ++i) {
+    threads[i].WaitForTermination();
+    bytes += threads[i].m_bytes;
+  }
+  PTimeInterval elapsed = PTimer::Tick() - start;
+
+  unsigned total = sessions*plays;
+  cout << (cache != NULL ? "Cached:   " : "Uncached: ")
+       << total << " plays in " << elapsed << "s, "
+       << (elapsed.GetMilliSeconds()*1000.0/total) << "us/play, "
+       << bytes/total << " bytes/play";
+
+  if (cache != NULL) {
+    PVXMLPromptCache::Statistics stats;
+    cache->GetStatistics(stats);
+    cout << ", hits=" << stats.m_hits << " misses=" << stats.m_misses
+         << " evictions=" << stats.m_evictions << " entries=" << stats.m_entries
+         << " bytes=" << stats.m_bytes;
+  }
+  cout << endl;
+}
+
+
+static void PromptBenchmark(PArgList & args)
+{
+  unsigned sessions = args.HasOption('s') ? args.GetOptionString('s').AsUnsigned() : 50;
+  unsigned plays = args.HasOption('n') ? args.GetOptionString('n').AsUnsigned() : 20;
+
+  PFilePath fn;
+  bool created = false;
+  if (args.GetCount() > 0)
+    fn = args[0];
+  else {
+    // Create a five second 8kHz prompt to play
+    fn = "vxmltest_prompt.wav";
+    PWAVFile wav(fn, PFile::WriteOnly);
+    PShortArray samples(8000*5);
+    for (PINDEX i = 0; i < samples.GetSize(); ++i)
+      samples[i] = (short)(i*37 % 16000 - 8000);
+    wav.Write(samples.GetPointer(), samples.GetSize()*sizeof(short));
+    created = true;
+  }
+
+  cout << "Prompt benchmark: " << sessions << " sessions each playing \"" << fn << "\" " << plays << " times" << endl;
+
+  PromptBenchmark(fn, sessions, plays, NULL);
+
+  PVXMLPromptCache cache(16*1024*1024);
+  PromptBenchmark(fn, sessions, plays, &cache);
+
+  if (created)
+    PFile::Remove(fn);
+}
+
+
 Vxmltest::Vxmltest()
   : PProcess("Equivalence", "vxmltest", 1, 0, AlphaCode, 1)
 {
@@ -81,9 +207,12 @@ void Vxmltest::Main()
 {
   PArgList & args = GetArguments();
   args.Parse(
-             "t.-trace."
-             "o:output:"
+             "t-trace."
+             "o-output:"
              "-tts:"
+             "-prompt-bench."
+             "s-sessions:"
+             "n-plays:"
              );
 
 #if PTRACING
@@ -92,8 +221,14 @@ void Vxmltest::Main()
          PTrace::Blocks | PTrace::Timestamp | PTrace::Thread | PTrace::FileAndLine);
 #endif
 
+  if (args.HasOption("prompt-bench")) {
+    PromptBenchmark(args);
+    return;
+  }
+
   if (args.GetCount() < 1) {
-    PError << "usage: vxmltest [opts] doc\n";
+    PError << "usage: vxmltest [opts] doc\n"
+              "       vxmltest --prompt-bench [-s sessions] [-n plays] [file.wav]\n";
     return;
   }
 
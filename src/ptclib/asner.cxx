@@ -668,10 +668,22 @@ PASN_ObjectId & PASN_ObjectId::operator=(const PUnsignedArray & numbers)
 
 void PASN_ObjectId::SetValue(const PString & dotstr)
 {
-  PStringArray parts = dotstr.Tokenise('.');
-  value.SetSize(parts.GetSize());
-  for (PINDEX i = 0; i < parts.GetSize(); i++)
-    value[i] = parts[i].AsUnsigned();
+  // Parse in place rather than tokenising, as this is on the SNMP agent fast path
+  value.SetSize(dotstr.GetLength()/2+1);
+  PINDEX count = 0;
+  const char * ptr = dotstr;
+  while (*ptr != '\0') {
+    if (*ptr == '.') {
+      ++ptr;
+      continue;
+    }
+    char * end;
+    value[count++] = strtoul(ptr, &end, 10);
+    ptr = end;
+    while (*ptr != '\0' && *ptr != '.')
+      ++ptr;
+  }
+  value.SetSize(count);
 }
 
 
@@ -716,9 +728,15 @@ void PASN_ObjectId::PrintOn(ostream & strm) const
 
 PString PASN_ObjectId::AsString() const
 {
-  PStringStream s;
-  PrintOn(s);
-  return s;
+  PString str;
+  char * ptr = str.GetPointer(value.GetSize()*11+1);
+  for (PINDEX i = 0; i < value.GetSize(); i++) {
+    if (i > 0)
+      *ptr++ = '.';
+    ptr += sprintf(ptr, "%u", (unsigned)value[i]);
+  }
+  str.MakeMinimumSize();
+  return str;
 }
 
 
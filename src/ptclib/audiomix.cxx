@@ -0,0 +1,394 @@
+/*
+ * audiomix.cxx
+ *
+ * N-way PCM-16 audio conference mixer.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifdef __GNUC__
+#pragma implementation "audiomix.h"
+#endif
+
+#include <ptlib.h>
+#include <ptclib/audiomix.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+  #include <emmintrin.h>
+  #define P_AUDIOMIX_SSE2 1
+#else
+  #define P_AUDIOMIX_SSE2 0
+#endif
+
+#define new PNEW
+
+
+/* Frames are added into 32 bit totals, eight samples at a time with SSE2,
+   and only saturated back to 16 bits, with a saturating pack, when a mix
+   is taken out. */
+
+static void AddFrame(int * total, const short * frame, PINDEX count)
+{
+  PINDEX i = 0;
+#if P_AUDIOMIX_SSE2
+  for (; i+8 <= count; i += 8) {
+    __m128i samples = _mm_loadu_si128((const __m128i *)(frame+i));
+    __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+    __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+    _mm_storeu_si128((__m128i *)(total+i), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(total+i)), low));
+    _mm_storeu_si128((__m128i *)(total+i+4), _mm_add_epi32(_mm_loadu_si128((const __m128i *)(total+i+4)), high));
+  }
+#endif
+  for (; i < count; ++i)
+    total[i] += frame[i];
+}
+
+
+// Saturate the total less the frame, or the whole total if frame is NULL
+static void SubtractFrame(const int * total, const short * frame, short * mix, PINDEX count)
+{
+  PINDEX i = 0;
+#if P_AUDIOMIX_SSE2
+  for (; i+8 <= count; i += 8) {
+    __m128i low = _mm_loadu_si128((const __m128i *)(total+i));
+    __m128i high = _mm_loadu_si128((const __m128i *)(total+i+4));
+    if (frame != NULL) {
+      __m128i samples = _mm_loadu_si128((const __m128i *)(frame+i));
+      low = _mm_sub_epi32(low, _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16));
+      high = _mm_sub_epi32(high, _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16));
+    }
+    _mm_storeu_si128((__m128i *)(mix+i), _mm_packs_epi32(low, high));
+  }
+#endif
+  for (; i < count; ++i) {
+    int sample = total[i] - (frame != NULL ? frame[i] : 0);
+    mix[i] = (short)(sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample);
+  }
+}
+
+
+// Mean absolute amplitude of a frame
+static unsigned FrameLevel(const short * frame, PINDEX count)
+{
+  unsigned sum = 0;
+  PINDEX i = 0;
+#if P_AUDIOMIX_SSE2
+  __m128i zero = _mm_setzero_si128();
+  __m128i ones = _mm_set1_epi16(1);
+  __m128i sums = zero;
+  for (; i+8 <= count; i += 8) {
+    __m128i samples = _mm_loadu_si128((const __m128i *)(frame+i));
+    __m128i magnitude = _mm_max_epi16(samples, _mm_subs_epi16(zero, samples));
+    sums = _mm_add_epi32(sums, _mm_madd_epi16(magnitude, ones));
+  }
+  int lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, sums);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; i < count; ++i)
+    sum += frame[i] < 0 ? -frame[i] : frame[i];
+  return count > 0 ? sum/count : 0;
+}
+
+
+static PInt64 FloorDivide(PInt64 value, PINDEX divisor)
+{
+  return value >= 0 ? value/divisor : -((-value + divisor - 1)/divisor);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PAudioMixer::Stream
+
+PAudioMixer::Stream::Stream(const PString & key, PINDEX frameSamples, PINDEX slots)
+  : m_key(key)
+  , m_frameSamples(frameSamples)
+  , m_slots(slots)
+  , m_buffer(frameSamples*slots)
+  , m_slotFrame(slots, -1)
+  , m_started(false)
+  , m_firstTimestamp(0)
+  , m_lastTimestamp(0)
+  , m_nextFrame(0)
+  , m_frame(frameSamples)
+  , m_hasAudio(false)
+  , m_level(0)
+  , m_speaking(false)
+{
+}
+
+
+void PAudioMixer::Stream::Write(const short * samples, PINDEX count, DWORD timestamp, PINDEX jitterFrames)
+{
+  // Positions count from the first timestamp, so frames start on it
+  if (!m_started) {
+    m_firstTimestamp = timestamp;
+    m_lastTimestamp = 0;
+    m_nextFrame = -(PInt64)jitterFrames;
+    m_started = true;
+  }
+
+  DWORD relative = timestamp - m_firstTimestamp;
+  PInt64 position = m_lastTimestamp + (int)(relative - (DWORD)m_lastTimestamp);
+  m_lastTimestamp = position;
+
+  while (count > 0) {
+    PInt64 frame = FloorDivide(position, m_frameSamples);
+    PINDEX offset = (PINDEX)(position - frame*m_frameSamples);
+    PINDEX chunk = std::min(count, m_frameSamples - offset);
+
+    // Too far from the playout point to be jitter, so the source has
+    // jumped; start again from here.
+    if (frame >= m_nextFrame + m_slots || frame < m_nextFrame - m_slots) {
+      PTRACE(4, "AudioMix\tRestarting jitter buffer of " << m_key << " at frame " << frame);
+      m_nextFrame = frame - jitterFrames;
+      std::fill(m_slotFrame.begin(), m_slotFrame.end(), -1);
+    }
+
+    // Audio for frames already mixed is dropped
+    if (frame >= m_nextFrame) {
+      PINDEX slot = (PINDEX)(frame - FloorDivide(frame, m_slots)*m_slots);
+      short * buffer = &m_buffer[slot*m_frameSamples];
+      if (m_slotFrame[slot] != frame) {
+        memset(buffer, 0, m_frameSamples*sizeof(short));
+        m_slotFrame[slot] = frame;
+      }
+      memcpy(buffer + offset, samples, chunk*sizeof(short));
+    }
+
+    samples += chunk;
+    count -= chunk;
+    position += chunk;
+  }
+}
+
+
+bool PAudioMixer::Stream::Read()
+{
+  if (!m_started)
+    return false;
+
+  PINDEX slot = (PINDEX)(m_nextFrame - FloorDivide(m_nextFrame, m_slots)*m_slots);
+  bool present = m_slotFrame[slot] == m_nextFrame;
+  if (present) {
+    memcpy(&m_frame[0], &m_buffer[slot*m_frameSamples], m_frameSamples*sizeof(short));
+    m_slotFrame[slot] = -1;
+  }
+
+  ++m_nextFrame;
+  return present;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PAudioMixer
+
+PAudioMixer::PAudioMixer(unsigned sampleRate, unsigned frameTime, unsigned jitterTime, PINDEX maxSpeakers)
+  : m_sampleRate(sampleRate > 0 ? sampleRate : 8000)
+  , m_frameTime(frameTime > 0 ? frameTime : 20)
+  , m_frameSamples(std::max(1U, m_sampleRate*m_frameTime/1000))
+  , m_jitterFrames((jitterTime + m_frameTime - 1)/m_frameTime)
+  , m_maxSpeakers(maxSpeakers)
+  , m_total(m_frameSamples)
+  , m_mix(m_frameSamples)
+  , m_everyone(m_frameSamples)
+  , m_thread(NULL)
+  , m_running(false)
+  , m_pacing(250)
+{
+  PTRACE(4, "AudioMix\tCreated mixer at " << m_sampleRate << "Hz, " << m_frameSamples
+         << " samples per frame, " << m_jitterFrames << " frames jitter buffer");
+}
+
+
+PAudioMixer::~PAudioMixer()
+{
+  Stop();
+
+  for (StreamMap::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+    delete it->second;
+}
+
+
+bool PAudioMixer::AddStream(const PString & key)
+{
+  PWriteWaitAndSignal lock(m_streamsMutex);
+
+  if (m_streams.find(key) != m_streams.end())
+    return false;
+
+  // Room for the jitter delay, as much again of early audio, and some slack
+  m_streams[key] = new Stream(key, m_frameSamples, m_jitterFrames*2 + 2);
+  PTRACE(4, "AudioMix\tAdded stream " << key);
+  return true;
+}
+
+
+bool PAudioMixer::RemoveStream(const PString & key)
+{
+  PWriteWaitAndSignal lock(m_streamsMutex);
+
+  StreamMap::iterator it = m_streams.find(key);
+  if (it == m_streams.end())
+    return false;
+
+  delete it->second;
+  m_streams.erase(it);
+  PTRACE(4, "AudioMix\tRemoved stream " << key);
+  return true;
+}
+
+
+PINDEX PAudioMixer::GetStreamCount() const
+{
+  PReadWaitAndSignal lock(m_streamsMutex);
+  return m_streams.size();
+}
+
+
+bool PAudioMixer::WriteStream(const PString & key, const short * samples, PINDEX count, DWORD timestamp)
+{
+  PReadWaitAndSignal lock(m_streamsMutex);
+
+  StreamMap::iterator it = m_streams.find(key);
+  if (it == m_streams.end())
+    return false;
+
+  Stream & stream = *it->second;
+  PWaitAndSignal wait(stream.m_mutex);
+  stream.Write(samples, count, timestamp, m_jitterFrames);
+  return true;
+}
+
+
+bool PAudioMixer::Start()
+{
+  if (m_thread != NULL)
+    return false;
+
+  m_running = true;
+  m_pacing.Restart();
+  m_thread = new PThreadObj<PAudioMixer>(*this, &PAudioMixer::ThreadMain, false, "AudioMixer", PThread::HighestPriority);
+  return true;
+}
+
+
+void PAudioMixer::Stop()
+{
+  if (m_thread == NULL)
+    return;
+
+  m_running = false;
+  m_thread->WaitForTermination();
+  delete m_thread;
+  m_thread = NULL;
+}
+
+
+void PAudioMixer::ThreadMain()
+{
+  PTRACE(4, "AudioMix\tMixing thread started");
+
+  while (m_running) {
+    MixFrame();
+    m_pacing.Delay(m_frameTime);
+  }
+
+  PTRACE(4, "AudioMix\tMixing thread ended");
+}
+
+
+void PAudioMixer::SetMaxSpeakers(PINDEX maxSpeakers)
+{
+  PWaitAndSignal mix(m_mixMutex);
+  m_maxSpeakers = maxSpeakers;
+}
+
+
+// Current speakers count a quarter louder, so the choice does not flap
+// between streams of about the same level.
+struct PAudioMixerLouder
+{
+  template <class S> static unsigned Level(const S * stream)
+  {
+    return stream->m_level + (stream->m_speaking ? stream->m_level/4 : 0);
+  }
+
+  template <class S> bool operator()(const S * left, const S * right) const
+  {
+    return Level(left) > Level(right);
+  }
+};
+
+
+void PAudioMixer::MixFrame()
+{
+  PWaitAndSignal mix(m_mixMutex);
+  PReadWaitAndSignal lock(m_streamsMutex);
+
+  m_speakers.clear();
+  for (StreamMap::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+    Stream & stream = *it->second;
+    stream.m_mutex.Wait();
+    stream.m_hasAudio = stream.Read();
+    stream.m_mutex.Signal();
+
+    unsigned level = stream.m_hasAudio ? FrameLevel(&stream.m_frame[0], m_frameSamples) : 0;
+    stream.m_level = (stream.m_level*3 + level)/4;
+    if (stream.m_hasAudio)
+      m_speakers.push_back(&stream);
+  }
+
+  if (m_maxSpeakers > 0 && (PINDEX)m_speakers.size() > m_maxSpeakers) {
+    std::nth_element(m_speakers.begin(), m_speakers.begin() + m_maxSpeakers, m_speakers.end(), PAudioMixerLouder());
+    m_speakers.resize(m_maxSpeakers);
+  }
+
+  for (StreamMap::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+    it->second->m_speaking = false;
+
+  std::fill(m_total.begin(), m_total.end(), 0);
+  for (size_t i = 0; i < m_speakers.size(); ++i) {
+    m_speakers[i]->m_speaking = true;
+    AddFrame(&m_total[0], &m_speakers[i]->m_frame[0], m_frameSamples);
+  }
+
+  // Everyone not speaking hears the same thing
+  SubtractFrame(&m_total[0], NULL, &m_everyone[0], m_frameSamples);
+
+  for (StreamMap::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+    Stream & stream = *it->second;
+    if (stream.m_speaking) {
+      SubtractFrame(&m_total[0], &stream.m_frame[0], &m_mix[0], m_frameSamples);
+      OnMixed(stream.m_key, &m_mix[0], m_frameSamples);
+    }
+    else
+      OnMixed(stream.m_key, &m_everyone[0], m_frameSamples);
+  }
+}
+
+
+void PAudioMixer::OnMixed(const PString & /*key*/, const short * /*mix*/, PINDEX /*count*/)
+{
+}
+
+
+// End Of File ///////////////////////////////////////////////////////////////
@@ -37,6 +37,16 @@
 #include <ptclib/cli.h>
 #include <ptclib/telnet.h>
 
+#if defined(P_LINUX)
+#include <sys/epoll.h>
+#define P_CLI_REACTOR 1
+#else
+#define P_CLI_REACTOR 0
+#endif
+
+#include <queue>
+#include <set>
+
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -61,35 +71,26 @@ PBoolean PCLI::Context::Write(const void * buf, PINDEX len)
   if (m_cli.GetNewLine().IsEmpty())
     return PIndirectChannel::Write(buf, len);
 
-  const char * newLinePtr = m_cli.GetNewLine();
-  PINDEX newLineLen = m_cli.GetNewLine().GetLength();
-
-  PINDEX written = 0;
-
   const char * str = (const char *)buf;
-  const char * nextline;
-  while (len > 0 && (nextline = strchr(str, '\n')) != NULL) {
-    PINDEX lineLen = nextline - str;
-
-    if (!PIndirectChannel::Write(str, lineLen))
-      return false;
-
-    written += GetLastWriteCount();
-
-    if (!PIndirectChannel::Write(newLinePtr, newLineLen))
-      return false;
+  const char * end = str + len;
+  const char * nextline = (const char *)memchr(str, '\n', len);
+  if (nextline == NULL)
+    return PIndirectChannel::Write(buf, len);
 
-    written += GetLastWriteCount();
+  const char * newLinePtr = m_cli.GetNewLine();
+  PINDEX newLineLen = m_cli.GetNewLine().GetLength();
 
-    len -= lineLen+1;
+  // Translate into one buffer so the channel gets a single write
+  std::string translated;
+  translated.reserve(len + 8*newLineLen);
+  do {
+    translated.append(str, nextline - str);
+    translated.append(newLinePtr, newLineLen);
     str = nextline+1;
-  }
+  } while ((nextline = (const char *)memchr(str, '\n', end - str)) != NULL);
+  translated.append(str, end - str);
 
-  if (!PIndirectChannel::Write(str, len))
-    return false;
-
-  lastWriteCount = written + GetLastWriteCount();
-  return true;
+  return PIndirectChannel::Write(translated.data(), translated.size());
 }
 
 
@@ -181,6 +182,18 @@ bool PCLI::Context::ProcessInput(const PString & str)
   return true;
 }
 
+bool PCLI::Context::ProcessInput(const char * data, PINDEX length)
+{
+  // Each character goes via the virtual, so descendants overriding it see all input
+  for (PINDEX pos = 0; pos < length; ++pos) {
+    if (!ProcessInput((BYTE)data[pos]))
+      return false;
+  }
+
+  return true;
+}
+
+
 bool PCLI::Context::ProcessInput(int ch)
 {
   if (ch != '\n' && ch != '\r') {
@@ -682,6 +695,626 @@ PCLI::Context * PCLIStandard::StartForeground()
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+#if P_CLI_REACTOR
+
+/* In the Reactor mode each connection has one of these. The context reads
+   nothing itself, its channel is a PCLIReactorChannel which passes output
+   to the reactor, while the reactor thread reads the socket and queues the
+   input for a worker to feed to the context.
+ */
+class PCLIReactorChannel;
+
+struct PCLIReactorConnection
+{
+  PCLIReactorConnection(PTCPSocket * socket)
+    : m_socket(socket)
+    , m_telnet(dynamic_cast<PTelnetSocket *>(socket))
+    , m_channel(NULL)
+    , m_context(NULL)
+    , m_outputPos(0)
+    , m_events(EPOLLIN)
+    , m_scheduled(false)
+    , m_corked(false)
+    , m_closing(false)
+    , m_waitingForDrain(false)
+  {
+  }
+
+  PTCPSocket         * m_socket;
+  PTelnetSocket      * m_telnet;
+  PCLIReactorChannel * m_channel;
+  PCLI::Context      * m_context;
+
+  PMutex        m_mutex;
+  std::string   m_input;
+  std::string   m_output;
+  size_t        m_outputPos;
+  uint32_t      m_events;
+  bool          m_scheduled;
+  bool          m_corked;
+  bool          m_closing;
+  bool          m_waitingForDrain;
+  PSyncPoint    m_drained;
+};
+
+
+class PCLISocket::ReactorEngine : public PObject
+{
+    PCLASSINFO(PCLISocket::ReactorEngine, PObject);
+  public:
+    enum {
+      MaxInputSize = 65536,     // Client sending more than this without a line being processed is dropped
+      MaxOutputSize = 262144    // Command producing more than this waits for the client to catch up
+    };
+
+    ReactorEngine(PCLISocket & cli, unsigned workers);
+    ~ReactorEngine();
+
+    bool IsOK() const { return m_epoll >= 0; }
+    void Main();
+    void Shutdown();
+
+    bool Send(PCLIReactorConnection & connection, const void * data, PINDEX length);
+    void Close(PCLIReactorConnection & connection);
+
+  protected:
+    void HandleAccept();
+    void HandleRead(PCLIReactorConnection & connection);
+    void HandleWrite(PCLIReactorConnection & connection);
+    bool WriteOutput(PCLIReactorConnection & connection);
+    void SetEvents(PCLIReactorConnection & connection, uint32_t events);
+    bool Reap(PCLIReactorConnection * connection, bool force);
+    void Wake();
+
+    PDECLARE_NOTIFIER(PThread, ReactorEngine, WorkerMain);
+
+    PCLISocket & m_cli;
+    unsigned     m_workerCount;
+    int          m_epoll;
+    int          m_wakePipe[2];
+    bool         m_shutdown;
+    bool         m_running;
+    PSyncPoint   m_finished;
+    PThread    * m_reactorThread;
+
+    std::set<PCLIReactorConnection *> m_connections;
+
+    PMutex                              m_closedMutex;
+    std::set<PCLIReactorConnection *>   m_closed;
+
+    std::vector<PThread *>              m_workers;
+    PMutex                              m_queueMutex;
+    PSemaphore                          m_queueCount;
+    std::queue<PCLIReactorConnection *> m_queue;
+};
+
+
+class PCLIReactorChannel : public PChannel
+{
+    PCLASSINFO(PCLIReactorChannel, PChannel);
+  public:
+    PCLIReactorChannel(PCLISocket::ReactorEngine & reactor, PCLIReactorConnection & connection)
+      : m_reactor(reactor)
+      , m_connection(connection)
+      , m_open(true)
+    {
+    }
+
+    virtual PBoolean IsOpen() const
+    {
+      return m_open;
+    }
+
+    virtual PBoolean Read(void *, PINDEX)
+    {
+      lastReadCount = 0;
+      return SetErrorValues(Miscellaneous, EINVAL, LastReadError);
+    }
+
+    virtual PBoolean Write(const void * buf, PINDEX len)
+    {
+      lastWriteCount = 0;
+      if (!m_open)
+        return SetErrorValues(NotOpen, EBADF, LastWriteError);
+      if (!m_reactor.Send(m_connection, buf, len))
+        return SetErrorValues(Interrupted, EPIPE, LastWriteError);
+      lastWriteCount = len;
+      return true;
+    }
+
+    virtual PBoolean Close()
+    {
+      if (!m_open)
+        return false;
+      m_open = false;
+      m_reactor.Close(m_connection);
+      return true;
+    }
+
+  protected:
+    PCLISocket::ReactorEngine & m_reactor;
+    PCLIReactorConnection     & m_connection;
+    bool                        m_open;
+};
+
+
+PCLISocket::ReactorEngine::ReactorEngine(PCLISocket & cli, unsigned workers)
+  : m_cli(cli)
+  , m_workerCount(workers > 0 ? workers : 1)
+  , m_epoll(epoll_create(256))
+  , m_shutdown(false)
+  , m_running(false)
+  , m_reactorThread(NULL)
+  , m_queueCount(0, INT_MAX)
+{
+  m_wakePipe[0] = m_wakePipe[1] = -1;
+  if (m_epoll < 0 || pipe(m_wakePipe) < 0) {
+    PTRACE(2, "PCLI\tCould not create epoll reactor, errno=" << errno);
+    if (m_epoll >= 0)
+      ::close(m_epoll);
+    m_epoll = -1;
+    return;
+  }
+
+  fcntl(m_wakePipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(m_wakePipe[1], F_SETFL, O_NONBLOCK);
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = m_wakePipe;
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakePipe[0], &event);
+}
+
+
+PCLISocket::ReactorEngine::~ReactorEngine()
+{
+  Shutdown();
+
+  if (m_epoll >= 0) {
+    ::close(m_epoll);
+    ::close(m_wakePipe[0]);
+    ::close(m_wakePipe[1]);
+  }
+}
+
+
+void PCLISocket::ReactorEngine::Main()
+{
+  if (m_epoll < 0 || m_shutdown)
+    return;
+
+  m_running = true;
+  m_reactorThread = PThread::Current();
+
+  PTRACE(4, "PCLI\tReactor started with " << m_workerCount << " workers");
+
+  /* A fixed set of workers sharing one queue, rather than PQueuedThreadPool,
+     as that creates and destroys threads as the load varies. */
+  for (unsigned i = 0; i < m_workerCount; ++i)
+    m_workers.push_back(PThread::Create(PCREATE_NOTIFIER(WorkerMain), 0,
+                                        PThread::NoAutoDeleteThread, PThread::NormalPriority, "CLI Worker"));
+
+  struct epoll_event listenEvent;
+  listenEvent.events = EPOLLIN;
+  listenEvent.data.ptr = NULL;
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_cli.m_listenSocket.GetHandle(), &listenEvent);
+
+  struct epoll_event events[64];
+  while (!m_shutdown && m_cli.m_listenSocket.IsOpen()) {
+    int count = epoll_wait(m_epoll, events, PARRAYSIZE(events), -1);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      PTRACE(1, "PCLI\tReactor wait failed, errno=" << errno);
+      break;
+    }
+
+    if (m_shutdown)
+      break;
+
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.ptr == NULL)
+        HandleAccept();
+      else if (events[i].data.ptr == m_wakePipe) {
+        char buffer[64];
+        while (::read(m_wakePipe[0], buffer, sizeof(buffer)) > 0)
+          ;
+      }
+      else {
+        PCLIReactorConnection & connection = *(PCLIReactorConnection *)events[i].data.ptr;
+        if ((events[i].events & EPOLLOUT) != 0)
+          HandleWrite(connection);
+        if ((events[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)) != 0)
+          HandleRead(connection);
+      }
+    }
+
+    // Connections closed above, or by the workers, go now they are idle
+    m_closedMutex.Wait();
+    std::set<PCLIReactorConnection *>::iterator iter = m_closed.begin();
+    while (iter != m_closed.end()) {
+      if (Reap(*iter, false))
+        m_closed.erase(iter++);
+      else
+        ++iter;
+    }
+    m_closedMutex.Signal();
+  }
+
+  std::set<PCLIReactorConnection *>::iterator iter;
+  for (iter = m_connections.begin(); iter != m_connections.end(); ++iter)
+    Close(**iter);
+
+  m_queueMutex.Wait();
+  for (size_t i = 0; i < m_workers.size(); ++i)
+    m_queue.push(NULL);
+  m_queueMutex.Signal();
+  for (size_t i = 0; i < m_workers.size(); ++i)
+    m_queueCount.Signal();
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    m_workers[i]->WaitForTermination();
+    delete m_workers[i];
+  }
+  m_workers.clear();
+
+  while (!m_connections.empty())
+    Reap(*m_connections.begin(), true);
+  m_closed.clear();
+
+  PTRACE(4, "PCLI\tReactor ended");
+  m_running = false;
+  m_finished.Signal();
+}
+
+
+void PCLISocket::ReactorEngine::Shutdown()
+{
+  if (m_shutdown)
+    return;
+
+  m_shutdown = true;
+  Wake();
+
+  if (m_running && PThread::Current() != m_reactorThread)
+    m_finished.Wait();
+}
+
+
+void PCLISocket::ReactorEngine::HandleAccept()
+{
+  PTCPSocket * socket = m_cli.CreateSocket();
+  if (!socket->Accept(m_cli.m_listenSocket)) {
+    PTRACE(2, "PCLI\tError accepting connection: " << m_cli.m_listenSocket.GetErrorText());
+    delete socket;
+    return;
+  }
+
+  PTRACE(3, "PCLI\tIncoming connection from " << socket->GetPeerAddress());
+
+  Context * context = m_cli.CreateContext();
+  if (context == NULL) {
+    delete socket;
+    return;
+  }
+
+  socket->SetReadTimeout(0);
+
+  PCLIReactorConnection * connection = new PCLIReactorConnection(socket);
+  connection->m_channel = new PCLIReactorChannel(*this, *connection);
+  connection->m_context = context;
+  context->Open(connection->m_channel, false);
+
+  struct epoll_event event;
+  event.events = connection->m_events;
+  event.data.ptr = connection;
+  if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, socket->GetHandle(), &event) < 0) {
+    PTRACE(2, "PCLI\tCould not add connection to reactor, errno=" << errno);
+    delete context;
+    delete connection->m_channel;
+    delete connection;
+    delete socket;
+    return;
+  }
+
+  m_connections.insert(connection);
+  m_cli.AddContext(context);
+  context->OnStart();
+}
+
+
+void PCLISocket::ReactorEngine::HandleRead(PCLIReactorConnection & connection)
+{
+  char buffer[4096];
+  ssize_t count;
+
+  if (connection.m_telnet == NULL)
+    count = ::recv(connection.m_socket->GetHandle(), buffer, sizeof(buffer), MSG_DONTWAIT);
+  else if (connection.m_telnet->Read(buffer, sizeof(buffer)))
+    count = connection.m_telnet->GetLastReadCount();
+  else if (connection.m_telnet->GetErrorCode(PChannel::LastReadError) == PChannel::Timeout)
+    return; // Was all telnet protocol
+  else
+    count = 0;
+
+  if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return;
+
+  if (count <= 0) {
+    PTRACE(4, "PCLI\tConnection closed by remote");
+    Close(connection);
+    return;
+  }
+
+  connection.m_mutex.Wait();
+
+  if (connection.m_closing) {
+    connection.m_mutex.Signal();
+    return;
+  }
+
+  if (connection.m_input.size() + count > MaxInputSize) {
+    connection.m_mutex.Signal();
+    PTRACE(2, "PCLI\tConnection sent too much input, closing");
+    Close(connection);
+    return;
+  }
+
+  connection.m_input.append(buffer, count);
+
+  bool schedule = !connection.m_scheduled;
+  connection.m_scheduled = true;
+
+  connection.m_mutex.Signal();
+
+  if (schedule) {
+    m_queueMutex.Wait();
+    m_queue.push(&connection);
+    m_queueMutex.Signal();
+    m_queueCount.Signal();
+  }
+}
+
+
+void PCLISocket::ReactorEngine::HandleWrite(PCLIReactorConnection & connection)
+{
+  connection.m_mutex.Wait();
+
+  bool ok = WriteOutput(connection);
+
+  if (connection.m_waitingForDrain &&
+      (!ok || connection.m_output.size() - connection.m_outputPos < MaxOutputSize/2)) {
+    connection.m_waitingForDrain = false;
+    connection.m_drained.Signal();
+  }
+
+  connection.m_mutex.Signal();
+
+  if (!ok)
+    Close(connection);
+}
+
+
+// Send what we can without blocking, waiting for the socket to be writable for the rest
+bool PCLISocket::ReactorEngine::WriteOutput(PCLIReactorConnection & connection)
+{
+  while (connection.m_outputPos < connection.m_output.size()) {
+    ssize_t sent = ::send(connection.m_socket->GetHandle(),
+                          connection.m_output.data() + connection.m_outputPos,
+                          connection.m_output.size() - connection.m_outputPos,
+                          MSG_DONTWAIT|MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        break;
+      PTRACE(3, "PCLI\tWrite failed, errno=" << errno);
+      connection.m_output.clear();
+      connection.m_outputPos = 0;
+      return false;
+    }
+    connection.m_outputPos += sent;
+  }
+
+  if (connection.m_outputPos < connection.m_output.size()) {
+    if (connection.m_outputPos > connection.m_output.size()/2) {
+      connection.m_output.erase(0, connection.m_outputPos);
+      connection.m_outputPos = 0;
+    }
+    SetEvents(connection, EPOLLIN|EPOLLOUT);
+  }
+  else {
+    connection.m_output.clear();
+    connection.m_outputPos = 0;
+    SetEvents(connection, EPOLLIN);
+  }
+
+  return true;
+}
+
+
+void PCLISocket::ReactorEngine::SetEvents(PCLIReactorConnection & connection, uint32_t events)
+{
+  if (connection.m_events == events)
+    return;
+
+  connection.m_events = events;
+
+  struct epoll_event event;
+  event.events = events;
+  event.data.ptr = &connection;
+  epoll_ctl(m_epoll, EPOLL_CTL_MOD, connection.m_socket->GetHandle(), &event);
+}
+
+
+bool PCLISocket::ReactorEngine::Send(PCLIReactorConnection & connection, const void * data, PINDEX length)
+{
+  const char * ptr = (const char *)data;
+
+  // Same escaping as PTelnetSocket::Write(), but without a write per escape
+  std::string escaped;
+  if (connection.m_telnet != NULL) {
+    bool binary = connection.m_telnet->IsOurOption(PTelnetSocket::TransmitBinary);
+    escaped.reserve(length+8);
+    for (PINDEX i = 0; i < length; ++i) {
+      escaped += ptr[i];
+      if ((BYTE)ptr[i] == PTelnetSocket::IAC)
+        escaped += ptr[i];
+      else if (ptr[i] == '\r' && !binary && !(i+1 < length && ptr[i+1] == '\n'))
+        escaped += '\0';
+    }
+    ptr = escaped.data();
+    length = escaped.size();
+  }
+
+  connection.m_mutex.Wait();
+
+  if (connection.m_closing) {
+    connection.m_mutex.Signal();
+    return false;
+  }
+
+  connection.m_output.append(ptr, length);
+
+  /* While a worker is processing input the output is collected, so that a
+     command's output and the prompt after it go in one packet. */
+  if ((connection.m_events & EPOLLOUT) == 0 &&
+      (!connection.m_corked || connection.m_output.size() > MaxOutputSize)) {
+    if (!WriteOutput(connection)) {
+      connection.m_mutex.Signal();
+      Close(connection);
+      return false;
+    }
+  }
+
+  /* Flow control, a command with a lot of output waits for the client to
+     read it, but the reactor thread never waits on itself. */
+  while (connection.m_output.size() - connection.m_outputPos > MaxOutputSize &&
+         !connection.m_closing &&
+         PThread::Current() != m_reactorThread) {
+    connection.m_waitingForDrain = true;
+    connection.m_mutex.Signal();
+    bool drained = connection.m_drained.Wait(m_cli.GetOutputTimeout());
+    connection.m_mutex.Wait();
+
+    // A client that stops reading must not hold the worker thread forever
+    if (!drained && connection.m_waitingForDrain) {
+      connection.m_waitingForDrain = false;
+      connection.m_mutex.Signal();
+      PTRACE(2, "PCLI\tClient has not read output for " << m_cli.GetOutputTimeout() << "s, closing");
+      Close(connection);
+      return false;
+    }
+  }
+
+  bool ok = !connection.m_closing;
+  connection.m_mutex.Signal();
+  return ok;
+}
+
+
+void PCLISocket::ReactorEngine::Close(PCLIReactorConnection & connection)
+{
+  connection.m_mutex.Wait();
+  bool alreadyClosing = connection.m_closing;
+  connection.m_closing = true;
+  if (connection.m_waitingForDrain) {
+    connection.m_waitingForDrain = false;
+    connection.m_drained.Signal();
+  }
+  connection.m_mutex.Signal();
+
+  if (alreadyClosing)
+    return;
+
+  m_closedMutex.Wait();
+  m_closed.insert(&connection);
+  m_closedMutex.Signal();
+
+  if (PThread::Current() != m_reactorThread)
+    Wake();
+}
+
+
+bool PCLISocket::ReactorEngine::Reap(PCLIReactorConnection * connection, bool force)
+{
+  connection->m_mutex.Wait();
+  bool busy = connection->m_scheduled;
+  connection->m_mutex.Signal();
+
+  if (busy && !force)
+    return false;
+
+  epoll_ctl(m_epoll, EPOLL_CTL_DEL, connection->m_socket->GetHandle(), NULL);
+  m_connections.erase(connection);
+
+  connection->m_context->OnStop();
+  m_cli.RemoveContext(connection->m_context);
+
+  delete connection->m_channel;
+  delete connection->m_socket;
+  delete connection;
+  return true;
+}
+
+
+void PCLISocket::ReactorEngine::Wake()
+{
+  if (m_wakePipe[1] >= 0) {
+    static const char wake = 0;
+    if (::write(m_wakePipe[1], &wake, 1) < 0 && errno != EAGAIN) {
+      PTRACE(1, "PCLI\tCould not wake reactor, errno=" << errno);
+    }
+  }
+}
+
+
+void PCLISocket::ReactorEngine::WorkerMain(PThread &, INT)
+{
+  for (;;) {
+    m_queueCount.Wait();
+
+    m_queueMutex.Wait();
+    PCLIReactorConnection * connection = m_queue.front();
+    m_queue.pop();
+    m_queueMutex.Signal();
+
+    if (connection == NULL)
+      break;
+
+    // Commands pipelined by the client are executed in order, as only one worker has the connection
+    for (;;) {
+      connection->m_mutex.Wait();
+      if (connection->m_closing || connection->m_input.empty()) {
+        connection->m_scheduled = false;
+        bool closing = connection->m_closing;
+        connection->m_mutex.Signal();
+        if (closing)
+          Wake();
+        break;
+      }
+
+      std::string input;
+      input.swap(connection->m_input);
+      connection->m_corked = true;
+      connection->m_mutex.Signal();
+
+      bool ok = connection->m_context->ProcessInput(input.data(), input.size());
+
+      connection->m_mutex.Wait();
+      connection->m_corked = false;
+      if ((connection->m_events & EPOLLOUT) == 0 && !WriteOutput(*connection))
+        ok = false;
+      connection->m_mutex.Signal();
+
+      if (!ok)
+        Close(*connection);
+    }
+  }
+}
+
+#endif // P_CLI_REACTOR
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 PCLISocket::PCLISocket(WORD port, const char * prompt, bool singleThreadForAll)
@@ -689,14 +1322,50 @@ PCLISocket::PCLISocket(WORD port, const char * prompt, bool singleThreadForAll)
   , m_singleThreadForAll(singleThreadForAll)
   , m_listenSocket(port)
   , m_thread(NULL)
+  , m_reactor(NULL)
+  , m_outputTimeout(0, 30)
 {
 }
 
 
+PCLISocket::PCLISocket(WORD port, const char * prompt, ThreadingModes mode, unsigned workers)
+  : PCLI(prompt)
+  , m_singleThreadForAll(mode == SingleThreadForAll)
+  , m_listenSocket(port)
+  , m_thread(NULL)
+  , m_reactor(NULL)
+  , m_outputTimeout(0, 30)
+{
+  if (mode != Reactor)
+    return;
+
+#if P_CLI_REACTOR
+  m_reactor = new ReactorEngine(*this, workers);
+  if (m_reactor->IsOK())
+    return;
+  delete m_reactor;
+  m_reactor = NULL;
+#endif
+
+  PTRACE(2, "PCLI\tReactor not available, using thread per connection.");
+}
+
+
 PCLISocket::~PCLISocket()
 {
   Stop();
   delete m_thread;
+#if P_CLI_REACTOR
+  delete m_reactor;
+#endif
+}
+
+
+PCLISocket::ThreadingModes PCLISocket::GetThreadingMode() const
+{
+  if (m_reactor != NULL)
+    return Reactor;
+  return m_singleThreadForAll ? SingleThreadForAll : ThreadPerContext;
 }
 
 
@@ -712,6 +1381,13 @@ bool PCLISocket::Start(bool runInBackground)
     return m_thread != NULL;
   }
 
+#if P_CLI_REACTOR
+  if (m_reactor != NULL) {
+    m_reactor->Main();
+    return true;
+  }
+#endif
+
   while (m_singleThreadForAll ? HandleSingleThreadForAll() : HandleIncoming())
     GarbageCollection();
   return true;
@@ -720,6 +1396,11 @@ bool PCLISocket::Start(bool runInBackground)
 
 void PCLISocket::Stop()
 {
+#if P_CLI_REACTOR
+  if (m_reactor != NULL)
+    m_reactor->Shutdown();
+#endif
+
   m_listenSocket.Close();
 
   if (m_thread != NULL && PThread::Current() != m_thread) {
@@ -769,7 +1450,8 @@ void PCLISocket::RemoveContext(Context * context)
 
 bool PCLISocket::Listen(WORD port)
 {
-  if (!m_listenSocket.Listen(5, port, PSocket::CanReuseAddress)) {
+  // Allow for many clients connecting at once
+  if (!m_listenSocket.Listen(128, port, PSocket::CanReuseAddress)) {
     PTRACE(2, "PCLI\tCannot open PCLI socket on port " << port
            << ", error: " << m_listenSocket.GetErrorText());
     return false;
@@ -784,6 +1466,11 @@ void PCLISocket::ThreadMain(PThread &, INT)
 {
   PTRACE(4, "PCLI\tServer thread started on port " << GetPort());
 
+#if P_CLI_REACTOR
+  if (m_reactor != NULL)
+    m_reactor->Main();
+  else
+#endif
   while (m_singleThreadForAll ? HandleSingleThreadForAll() : HandleIncoming())
     GarbageCollection();
 
@@ -813,11 +1500,8 @@ bool PCLISocket::HandleSingleThreadForAll()
         if (iterContext != m_contextBySocket.end()) {
           char buffer[1024];
           if (socket->Read(buffer, sizeof(buffer)-1)) {
-            PINDEX count = socket->GetLastReadCount();
-            for (PINDEX i = 0; i < count; ++i) {
-              if (!iterContext->second->ProcessInput(buffer[i]))
-                socket->Close();
-            }
+            if (!iterContext->second->ProcessInput(buffer, socket->GetLastReadCount()))
+              socket->Close();
           }
           else
             socket->Close();
@@ -866,6 +1550,12 @@ PCLITelnet::PCLITelnet(WORD port, const char * prompt, bool singleThreadForAll)
 }
 
 
+PCLITelnet::PCLITelnet(WORD port, const char * prompt, ThreadingModes mode, unsigned workers)
+  : PCLISocket(port, prompt, mode, workers)
+{
+}
+
+
 PTCPSocket * PCLITelnet::CreateSocket()
 {
   return new PTelnetSocket();
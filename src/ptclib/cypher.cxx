@@ -44,6 +44,24 @@
 ///////////////////////////////////////////////////////////////////////////////
 // PBase64
 
+/* Blocks of 12 or 24 bytes are encoded, and 16 or 32 characters decoded, as
+   GCC vectors. These are compiled for SSSE3 and AVX2 and selected at run
+   time, as without a byte shuffle instruction they are no faster than the
+   scalar code. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ >= 5 || defined(__clang__))
+  #define P_BASE64_SIMD 1
+  #define P_BASE64_INLINE inline __attribute__((always_inline))
+  typedef BYTE    PBase64Bytes16 __attribute__((vector_size(16)));
+  typedef DWORD   PBase64Words4  __attribute__((vector_size(16)));
+  typedef PUInt64 PBase64Longs2  __attribute__((vector_size(16)));
+  typedef BYTE    PBase64Bytes32 __attribute__((vector_size(32)));
+  typedef DWORD   PBase64Words8  __attribute__((vector_size(32)));
+  typedef PUInt64 PBase64Longs4  __attribute__((vector_size(32)));
+#else
+  #define P_BASE64_SIMD 0
+#endif
+
+
 PBase64::PBase64()
 {
   StartEncoding();
@@ -53,9 +71,7 @@ PBase64::PBase64()
 
 void PBase64::StartEncoding(bool useCRLF)
 {
-  encodedString = "";
-  encodeLength = nextLine = saveCount = 0;
-  endOfLine = useCRLF ? "\r\n" : "\n";
+  StartEncoding(useCRLF ? "\r\n" : "\n");
 }
 
 
@@ -64,6 +80,11 @@ void PBase64::StartEncoding(const char * eol)
   encodedString = "";
   encodeLength = nextLine = saveCount = 0;
   endOfLine = eol;
+
+  // Lines are up to 76 characters including the end of line
+  lineQuads = (76 - endOfLine.GetLength())/4 + 1;
+  if (lineQuads < 1)
+    lineQuads = 1;
 }
 
 
@@ -88,56 +109,315 @@ void PBase64::ProcessEncoding(const PBYTEArray & data)
 static const char Binary2Base64[65] =
             "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-void PBase64::OutputBase64(const BYTE * data)
+static char * EncodeBase64Scalar(const BYTE * data, PINDEX triples, char * out)
+{
+  while (triples-- > 0) {
+    out[0] = Binary2Base64[data[0] >> 2];
+    out[1] = Binary2Base64[((data[0]&3)<<4) | (data[1]>>4)];
+    out[2] = Binary2Base64[((data[1]&15)<<2) | (data[2]>>6)];
+    out[3] = Binary2Base64[data[2]&0x3f];
+    data += 3;
+    out += 4;
+  }
+  return out;
+}
+
+
+#if P_BASE64_SIMD
+
+/* Each 32 bit word holds the bytes of a triple in reverse order, as placed
+   by the load shuffle, and is replaced by its four characters. */
+template <typename Bytes, typename Words>
+static P_BASE64_INLINE void EncodeBase64Vector(Bytes & block)
+{
+  Words w = (Words)block;
+  Bytes i = (Bytes)(((w >> 18) & 0x3f) | (((w >> 12) & 0x3f) << 8) | (((w >> 6) & 0x3f) << 16) | ((w & 0x3f) << 24));
+
+  // 'A'-'Z' is i+65, 'a'-'z' is i+71, '0'-'9' is i-4, '+' is i-19 and '/' is i-16
+  block = i + (65 + ((Bytes)(i > 25) & 6) + ((Bytes)(i > 51) & (BYTE)-75) + ((Bytes)(i > 61) & (BYTE)-15) + ((Bytes)(i > 62) & 3));
+}
+
+
+/* Each 32 bit word holds four values of 0 to 63, packed into three bytes
+   and returned in the low twelve bytes of each 16 byte lane. Returns false
+   if any character is not in the Base64 alphabet. */
+template <typename Bytes, typename Words, typename Longs>
+static P_BASE64_INLINE bool DecodeBase64Vector(const Bytes & chars, Bytes & packed)
+{
+  Bytes upper = (Bytes)((chars >= 'A') & (chars <= 'Z'));
+  Bytes lower = (Bytes)((chars >= 'a') & (chars <= 'z'));
+  Bytes digit = (Bytes)((chars >= '0') & (chars <= '9'));
+  Bytes plus  = (Bytes)(chars == '+');
+  Bytes slash = (Bytes)(chars == '/');
+
+  Longs valid = (Longs)(upper | lower | digit | plus | slash);
+  PUInt64 all = valid[0];
+  for (unsigned i = 1; i < sizeof(Longs)/sizeof(PUInt64); ++i)
+    all &= valid[i];
+  if (all != ~(PUInt64)0)
+    return false;
+
+  Words w = (Words)(chars + ((upper & (BYTE)-65) | (lower & (BYTE)-71) | (digit & 4) | (plus & 19) | (slash & 16)));
+  w = ((w & 0x3f) << 18) | (((w >> 8) & 0x3f) << 12) | (((w >> 16) & 0x3f) << 6) | ((w >> 24) & 0x3f);
+  packed = (Bytes)w;
+  return true;
+}
+
+
+/* The 16 byte loops are inlined into both kernels, so the AVX2 kernels do
+   not call legacy SSE code with the upper halves of the registers dirty. */
+static P_BASE64_INLINE char * EncodeBase64Blocks16(const BYTE * data, PINDEX triples, char * out)
+{
+  static const PBase64Bytes16 load = { 2,1,0,0, 5,4,3,3, 8,7,6,6, 11,10,9,9 };
+
+  // The 16 byte load uses only 12, so stop short of the end
+  while (triples >= 6) {
+    PBase64Bytes16 block;
+    memcpy(&block, data, 16);
+    block = __builtin_shuffle(block, load);
+    EncodeBase64Vector<PBase64Bytes16, PBase64Words4>(block);
+    memcpy(out, &block, 16);
+    data += 12;
+    out += 16;
+    triples -= 4;
+  }
+  return EncodeBase64Scalar(data, triples, out);
+}
+
+
+static P_BASE64_INLINE PINDEX DecodeBase64Blocks16(const char * in, PINDEX quads, BYTE * out)
+{
+  static const PBase64Bytes16 store = { 2,1,0, 6,5,4, 10,9,8, 14,13,12, 3,7,11,15 };
+
+  PINDEX done = 0;
+  while (done+4 <= quads) {
+    PBase64Bytes16 block;
+    memcpy(&block, in, 16);
+    if (!DecodeBase64Vector<PBase64Bytes16, PBase64Words4, PBase64Longs2>(block, block))
+      break;
+    block = __builtin_shuffle(block, store);
+    memcpy(out, &block, 12);
+    in += 16;
+    out += 12;
+    done += 4;
+  }
+  return done;
+}
+
+
+__attribute__((target("ssse3")))
+static char * EncodeBase64SSSE3(const BYTE * data, PINDEX triples, char * out)
 {
-  char * out = encodedString.GetPointer(((encodeLength+7)&~255) + 256);
+  return EncodeBase64Blocks16(data, triples, out);
+}
+
 
-  out[encodeLength++] = Binary2Base64[data[0] >> 2];
-  out[encodeLength++] = Binary2Base64[((data[0]&3)<<4) | (data[1]>>4)];
-  out[encodeLength++] = Binary2Base64[((data[1]&15)<<2) | (data[2]>>6)];
-  out[encodeLength++] = Binary2Base64[data[2]&0x3f];
+__attribute__((target("avx2")))
+static char * EncodeBase64AVX2(const BYTE * data, PINDEX triples, char * out)
+{
+  static const PBase64Bytes32 load = { 2,1,0,0, 5,4,3,3, 8,7,6,6, 11,10,9,9,
+                                       18,17,16,16, 21,20,19,19, 24,23,22,22, 27,26,25,25 };
 
+  while (triples >= 10) {
+    PBase64Bytes32 block;
+    memcpy(&block, data, 16);
+    memcpy((BYTE *)&block + 16, data + 12, 16);
+    block = __builtin_shuffle(block, load);
+    EncodeBase64Vector<PBase64Bytes32, PBase64Words8>(block);
+    memcpy(out, &block, 32);
+    data += 24;
+    out += 32;
+    triples -= 8;
+  }
+  return EncodeBase64Blocks16(data, triples, out);
+}
+
+
+__attribute__((target("ssse3")))
+static PINDEX DecodeBase64SSSE3(const char * in, PINDEX quads, BYTE * out)
+{
+  return DecodeBase64Blocks16(in, quads, out);
+}
+
+
+__attribute__((target("avx2")))
+static PINDEX DecodeBase64AVX2(const char * in, PINDEX quads, BYTE * out)
+{
+  static const PBase64Bytes32 store = { 2,1,0, 6,5,4, 10,9,8, 14,13,12, 3,7,11,15,
+                                        18,17,16, 22,21,20, 26,25,24, 30,29,28, 19,23,27,31 };
+
+  PINDEX done = 0;
+  while (done+8 <= quads) {
+    PBase64Bytes32 block;
+    memcpy(&block, in, 32);
+    if (!DecodeBase64Vector<PBase64Bytes32, PBase64Words8, PBase64Longs4>(block, block))
+      break;
+    block = __builtin_shuffle(block, store);
+    memcpy(out, &block, 12);
+    memcpy(out+12, (BYTE *)&block + 16, 12);
+    in += 32;
+    out += 24;
+    done += 8;
+  }
+  return done + DecodeBase64Blocks16(in, quads - done, out);
+}
+
+
+enum Base64Kernels { Base64Scalar, Base64SSSE3, Base64AVX2 };
+
+static Base64Kernels GetBase64Kernels()
+{
+  static Base64Kernels kernels = __builtin_cpu_supports("avx2")  ? Base64AVX2
+                               : __builtin_cpu_supports("ssse3") ? Base64SSSE3
+                                                                 : Base64Scalar;
+  return kernels;
+}
+
+#endif // P_BASE64_SIMD
+
+
+static char * EncodeBase64(const BYTE * data, PINDEX triples, char * out)
+{
+#if P_BASE64_SIMD
+  switch (GetBase64Kernels()) {
+    case Base64AVX2 :
+      return EncodeBase64AVX2(data, triples, out);
+    case Base64SSSE3 :
+      return EncodeBase64SSSE3(data, triples, out);
+    default :
+      break;
+  }
+#endif
+  return EncodeBase64Scalar(data, triples, out);
+}
+
+
+/* Decode whole quads of Base64 alphabet characters, stopping at the first
+   block with anything else in it. Returns number of quads decoded. */
+static PINDEX DecodeBase64(const char * in, PINDEX quads, BYTE * out)
+{
+#if P_BASE64_SIMD
+  switch (GetBase64Kernels()) {
+    case Base64AVX2 :
+      return DecodeBase64AVX2(in, quads, out);
+    case Base64SSSE3 :
+      return DecodeBase64SSSE3(in, quads, out);
+    default :
+      break;
+  }
+#else
+  (void)in;
+  (void)quads;
+  (void)out;
+#endif
+  return 0;
+}
+
+
+char * PBase64::OutputBase64(const BYTE * data, PINDEX triples, char * out)
+{
   PINDEX len = endOfLine.GetLength();
-  if (++nextLine > (76-len)/4) {
-    for (PINDEX i = 0; i < len; ++i)
-      out[encodeLength++] = endOfLine[i];
-    nextLine = 0;
+
+  while (triples > 0) {
+    PINDEX count = lineQuads - nextLine;
+    if (count > triples)
+      count = triples;
+    out = EncodeBase64(data, count, out);
+    data += count*3;
+    triples -= count;
+
+    nextLine += count;
+    if (nextLine >= lineQuads) {
+      memcpy(out, (const char *)endOfLine, len);
+      out += len;
+      nextLine = 0;
+    }
   }
+
+  return out;
 }
 
 
-void PBase64::ProcessEncoding(const void * dataPtr, PINDEX length)
+PINDEX PBase64::GetMaxEncodedLength(PINDEX length) const
 {
-  if (length == 0)
-    return;
+  PINDEX quads = (saveCount + length)/3;
+  return quads*4 + (quads/lineQuads + 1)*endOfLine.GetLength() + 4;
+}
+
+
+PINDEX PBase64::ProcessEncoding(const void * dataPtr, PINDEX length, char * encoded)
+{
+  if (length <= 0)
+    return 0;
 
   const BYTE * data = (const BYTE *)dataPtr;
-  while (saveCount < 3) {
-    saveTriple[saveCount++] = *data++;
-    if (--length == 0) {
-      if (saveCount == 3) {
-        OutputBase64(saveTriple);
-        saveCount = 0;
+  char * out = encoded;
+
+  if (saveCount > 0) {
+    while (saveCount < 3) {
+      saveTriple[saveCount++] = *data++;
+      if (--length == 0) {
+        if (saveCount == 3) {
+          out = OutputBase64(saveTriple, 1, out);
+          saveCount = 0;
+        }
+        return out - encoded;
       }
-      return;
     }
+    out = OutputBase64(saveTriple, 1, out);
   }
 
-  OutputBase64(saveTriple);
+  PINDEX triples = length/3;
+  out = OutputBase64(data, triples, out);
 
-  PINDEX i;
-  for (i = 0; i+2 < length; i += 3)
-    OutputBase64(data+i);
+  data += triples*3;
+  saveCount = length - triples*3;
+  for (PINDEX i = 0; i < saveCount; ++i)
+    saveTriple[i] = data[i];
 
-  saveCount = length - i;
-  switch (saveCount) {
-    case 2 :
-      saveTriple[0] = data[i++];
-      saveTriple[1] = data[i];
-      break;
-    case 1 :
-      saveTriple[0] = data[i];
+  return out - encoded;
+}
+
+
+void PBase64::ProcessEncoding(const void * dataPtr, PINDEX length)
+{
+  if (length <= 0)
+    return;
+
+  // Grow geometrically, as encoding is often done in small pieces
+  PINDEX needed = encodeLength + GetMaxEncodedLength(length) + 1;
+  if (needed > encodedString.GetSize())
+    encodedString.SetMinSize(PMAX(needed, encodedString.GetSize()*2));
+
+  char * out = encodedString.GetPointer();
+  encodeLength += ProcessEncoding(dataPtr, length, out + encodeLength);
+  out[encodeLength] = '\0';
+}
+
+
+PBoolean PBase64::ProcessEncoding(const void * dataPtr, PINDEX length, PChannel & channel)
+{
+  const BYTE * data = (const BYTE *)dataPtr;
+
+  // Encode a chunk at a time into a buffer on the stack
+  char stackBuffer[8192];
+  PINDEX chunk = 3*PMAX((PINDEX)(sizeof(stackBuffer)/(4 + endOfLine.GetLength())) - 4, 1);
+
+  PCharArray heapBuffer;
+  char * buffer = stackBuffer;
+  if (GetMaxEncodedLength(chunk) > (PINDEX)sizeof(stackBuffer))
+    buffer = heapBuffer.GetPointer(GetMaxEncodedLength(chunk));
+
+  while (length > 0) {
+    PINDEX count = PMIN(length, chunk);
+    PINDEX encoded = ProcessEncoding(data, count, buffer);
+    if (encoded > 0 && !channel.Write(buffer, encoded))
+      return false;
+    data += count;
+    length -= count;
   }
+
+  return true;
 }
 
 
@@ -150,29 +430,49 @@ PString PBase64::GetEncodedString()
 }
 
 
-PString PBase64::CompleteEncoding()
+PINDEX PBase64::CompleteEncoding(char * out)
 {
-  char * out = encodedString.GetPointer(encodeLength + 5)+encodeLength;
-
   switch (saveCount) {
     case 1 :
-      *out++ = Binary2Base64[saveTriple[0] >> 2];
-      *out++ = Binary2Base64[(saveTriple[0]&3)<<4];
-      *out++ = '=';
-      *out   = '=';
+      out[0] = Binary2Base64[saveTriple[0] >> 2];
+      out[1] = Binary2Base64[(saveTriple[0]&3)<<4];
+      out[2] = '=';
+      out[3] = '=';
       break;
 
     case 2 :
-      *out++ = Binary2Base64[saveTriple[0] >> 2];
-      *out++ = Binary2Base64[((saveTriple[0]&3)<<4) | (saveTriple[1]>>4)];
-      *out++ = Binary2Base64[((saveTriple[1]&15)<<2)];
-      *out   = '=';
+      out[0] = Binary2Base64[saveTriple[0] >> 2];
+      out[1] = Binary2Base64[((saveTriple[0]&3)<<4) | (saveTriple[1]>>4)];
+      out[2] = Binary2Base64[((saveTriple[1]&15)<<2)];
+      out[3] = '=';
+      break;
+
+    default :
+      return 0;
   }
 
+  saveCount = 0;
+  return 4;
+}
+
+
+PString PBase64::CompleteEncoding()
+{
+  char * out = encodedString.GetPointer(encodeLength + 5);
+  encodeLength += CompleteEncoding(out + encodeLength);
+  out[encodeLength] = '\0';
   return encodedString;
 }
 
 
+PBoolean PBase64::CompleteEncoding(PChannel & channel)
+{
+  char buffer[4];
+  PINDEX encoded = CompleteEncoding(buffer);
+  return encoded == 0 || channel.Write(buffer, encoded);
+}
+
+
 PString PBase64::Encode(const PString & str, const char * endOfLine)
 {
   return Encode((const char *)str, str.GetLength(), endOfLine);
@@ -195,8 +495,14 @@ PString PBase64::Encode(const void * data, PINDEX length, const char * endOfLine
 {
   PBase64 encoder;
   encoder.StartEncoding(endOfLine);
-  encoder.ProcessEncoding(data, length);
-  return encoder.CompleteEncoding();
+
+  // Exact size, so no growing and a single allocation
+  PString str;
+  char * out = str.GetPointer(encoder.GetMaxEncodedLength(length) + 1);
+  PINDEX len = encoder.ProcessEncoding(data, length, out);
+  len += encoder.CompleteEncoding(out + len);
+  out[len] = '\0';
+  return str;
 }
 
 
@@ -204,6 +510,7 @@ void PBase64::StartDecoding()
 {
   perfectDecode = PTrue;
   quadPosition = 0;
+  quadValue = 0;
   decodedData.SetSize(0);
   decodeSize = 0;
 }
@@ -211,11 +518,30 @@ void PBase64::StartDecoding()
 
 PBoolean PBase64::ProcessDecoding(const PString & str)
 {
-  return ProcessDecoding((const char *)str);
+  return ProcessDecoding((const char *)str, str.GetLength());
 }
 
 
 PBoolean PBase64::ProcessDecoding(const char * cstr)
+{
+  return ProcessDecoding(cstr, (PINDEX)strlen(cstr));
+}
+
+
+PBoolean PBase64::ProcessDecoding(const char * data, PINDEX length)
+{
+  PINDEX needed = decodeSize + GetMaxDecodedLength(length);
+  if (needed > decodedData.GetSize())
+    decodedData.SetSize(PMAX(needed, decodedData.GetSize()*2));
+
+  PINDEX decoded;
+  PBoolean last = ProcessDecoding(data, length, decodedData.GetPointer() + decodeSize, decoded);
+  decodeSize += decoded;
+  return last;
+}
+
+
+PBoolean PBase64::ProcessDecoding(const char * data, PINDEX length, void * decoded, PINDEX & decodedLength)
 {
   static const BYTE Base642Binary[256] = {
     96, 99, 99, 99, 99, 99, 99, 99, 99, 99, 98, 99, 99, 98, 99, 99,
@@ -236,15 +562,37 @@ PBoolean PBase64::ProcessDecoding(const char * cstr)
     99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
   };
 
-  for (;;) {
-    BYTE value = Base642Binary[(BYTE)*cstr++];
+  BYTE * out = (BYTE *)decoded;
+  const char * end = data + length;
+
+  while (data < end) {
+    // On a quad boundary try whole blocks, which is most of a line
+    if (quadPosition == 0 && end - data >= 16) {
+      PINDEX quads = DecodeBase64(data, (end - data)/4, out);
+      data += quads*4;
+      out += quads*3;
+      if (data >= end)
+        break;
+    }
+
+    BYTE value = Base642Binary[(BYTE)*data++];
     switch (value) {
       case 96 : // end of string
+        decodedLength = out - (BYTE *)decoded;
         return PFalse;
 
       case 97 : // '=' sign
-        if (quadPosition == 3 || (quadPosition == 2 && *cstr == '=')) {
+        if (quadPosition == 3 || (quadPosition == 2 && data < end && *data == '=')) {
+          // Output the complete bytes of the partial quad
+          if (quadPosition == 3) {
+            *out++ = (BYTE)(quadValue >> 10);
+            *out++ = (BYTE)(quadValue >> 2);
+          }
+          else
+            *out++ = (BYTE)(quadValue >> 4);
           quadPosition = 0;  // Reset this to zero, as have a perfect decode
+          quadValue = 0;
+          decodedLength = out - (BYTE *)decoded;
           return PTrue; // Stop decoding now as must be at end of data
         }
         perfectDecode = PFalse;  // Ignore '=' sign but flag decode as suspect
@@ -258,32 +606,47 @@ PBoolean PBase64::ProcessDecoding(const char * cstr)
         break;
 
       default : // legal value from 0 to 63
-        BYTE * out = decodedData.GetPointer(((decodeSize+1)&~255) + 256);
-        switch (quadPosition) {
-          case 0 :
-            out[decodeSize] = (BYTE)(value << 2);
-            break;
-          case 1 :
-            out[decodeSize++] |= (BYTE)(value >> 4);
-            out[decodeSize] = (BYTE)((value&15) << 4);
-            break;
-          case 2 :
-            out[decodeSize++] |= (BYTE)(value >> 2);
-            out[decodeSize] = (BYTE)((value&3) << 6);
-            break;
-          case 3 :
-            out[decodeSize++] |= (BYTE)value;
-            break;
+        quadValue = (quadValue << 6) | value;
+        if (++quadPosition == 4) {
+          *out++ = (BYTE)(quadValue >> 16);
+          *out++ = (BYTE)(quadValue >> 8);
+          *out++ = (BYTE)quadValue;
+          quadPosition = 0;
+          quadValue = 0;
         }
-        quadPosition = (quadPosition+1)&3;
     }
   }
+
+  decodedLength = out - (BYTE *)decoded;
+  return PFalse;
 }
 
 
-PBYTEArray PBase64::GetDecodedData()
+PINDEX PBase64::CompleteDecoding(void * decoded)
 {
   perfectDecode = quadPosition == 0;
+
+  BYTE * out = (BYTE *)decoded;
+  PINDEX count = 0;
+  switch (quadPosition) {
+    case 3 :
+      out[count++] = (BYTE)(quadValue >> 10);
+      // Then next case
+
+    case 2 :
+      out[count++] = (BYTE)(quadValue >> (quadPosition == 3 ? 2 : 4));
+  }
+
+  quadPosition = 0;
+  quadValue = 0;
+  return count;
+}
+
+
+PBYTEArray PBase64::GetDecodedData()
+{
+  decodedData.SetMinSize(decodeSize + 2);
+  decodeSize += CompleteDecoding(decodedData.GetPointer() + decodeSize);
   decodedData.SetSize(decodeSize);
   PBYTEArray retval = decodedData;
   retval.MakeUnique();
@@ -295,7 +658,8 @@ PBYTEArray PBase64::GetDecodedData()
 
 PBoolean PBase64::GetDecodedData(void * dataBlock, PINDEX length)
 {
-  perfectDecode = quadPosition == 0;
+  decodedData.SetMinSize(decodeSize + 2);
+  decodeSize += CompleteDecoding(decodedData.GetPointer() + decodeSize);
   PBoolean bigEnough = length >= decodeSize;
   memcpy(dataBlock, decodedData, bigEnough ? decodeSize : length);
   decodedData.SetSize(0);
@@ -371,6 +735,14 @@ void PMessageDigest::CompleteDigest(Result & result)
 }
 
 
+void PMessageDigest::InternalCompleteDigest(BYTE * digest)
+{
+  Result result;
+  InternalCompleteDigest(result);
+  memcpy(digest, result.GetPointer(), result.GetSize());
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // PMessageDigest5
 
@@ -398,6 +770,26 @@ PMessageDigest5::PMessageDigest5()
 #define S43 15
 #define S44 21
 
+/* The rounds of MD5 and SHA-1 below are templates, so they work on plain
+   DWORDs, or on GCC vectors of DWORDs holding the state of several messages
+   at once, see EncodeMultiple(). */
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+  #define P_DIGEST_LANES 1
+  #define P_DIGEST_INLINE inline __attribute__((always_inline))
+  typedef DWORD PDigestWords4 __attribute__((vector_size(16)));
+  typedef DWORD PDigestWords8 __attribute__((vector_size(32)));
+#else
+  #define P_DIGEST_LANES 0
+  #define P_DIGEST_INLINE inline
+#endif
+
+#if defined(__GNUC__) && (__GNUC__ >= 8) && !defined(__clang__)
+  #define P_DIGEST_UNROLL _Pragma("GCC unroll 20")
+#else
+  #define P_DIGEST_UNROLL
+#endif
+
+
 // F, G, H and I are basic MD5 functions.
 #define F(x, y, z) (((x) & (y)) | ((~x) & (z)))
 #define G(x, y, z) (((x) & (z)) | ((y) & (~z)))
@@ -430,16 +822,13 @@ PMessageDigest5::PMessageDigest5()
  (a) += (b); \
 
 
-void PMessageDigest5::Transform(const BYTE * block)
+template <typename Word>
+static P_DIGEST_INLINE void MD5Rounds(Word * state, const Word * x)
 {
-  DWORD a = state[0];
-  DWORD b = state[1];
-  DWORD c = state[2];
-  DWORD d = state[3];
-
-  DWORD x[16];
-  for (PINDEX i = 0; i < 16; i++)
-    x[i] = ((PUInt32l*)block)[i];
+  Word a = state[0];
+  Word b = state[1];
+  Word c = state[2];
+  Word d = state[3];
 
   /* Round 1 */
   FF(a, b, c, d, x[ 0], S11, 0xd76aa478); /* 1 */
@@ -517,6 +906,16 @@ void PMessageDigest5::Transform(const BYTE * block)
   state[1] += b;
   state[2] += c;
   state[3] += d;
+}
+
+
+void PMessageDigest5::Transform(const BYTE * block)
+{
+  DWORD x[16];
+  for (PINDEX i = 0; i < 16; i++)
+    x[i] = ((PUInt32l*)block)[i];
+
+  MD5Rounds(state, x);
 
   // Zeroize sensitive information.
   memset(x, 0, sizeof(x));
@@ -564,6 +963,12 @@ void PMessageDigest5::InternalProcess(const void * dataPtr, PINDEX length)
 
 
 void PMessageDigest5::InternalCompleteDigest(Result & result)
+{
+  InternalCompleteDigest(result.value.GetPointer(DigestSize));
+}
+
+
+void PMessageDigest5::InternalCompleteDigest(BYTE * digest)
 {
   // Put the count into bytes platform independently
   PUInt64l countBytes = count;
@@ -582,7 +987,7 @@ void PMessageDigest5::InternalCompleteDigest(Result & result)
   Process(&countBytes, sizeof(countBytes));
 
   // Store state in digest
-  PUInt32l * valuep = (PUInt32l *)result.value.GetPointer(4 * sizeof(PUInt32l));
+  PUInt32l * valuep = (PUInt32l *)digest;
   for (PINDEX i = 0; i < PARRAYSIZE(state); i++)
     valuep[i] = state[i];
 
@@ -688,6 +1093,57 @@ void PMessageDigest5::Complete(Code & codeResult)
 ///////////////////////////////////////////////////////////////////////////////
 // PMessageDigestSHA1
 
+static const DWORD SHA1InitialState[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+template <typename Word>
+static P_DIGEST_INLINE void SHA1Rounds(Word * state, Word * w)
+{
+  Word a = state[0];
+  Word b = state[1];
+  Word c = state[2];
+  Word d = state[3];
+  Word e = state[4];
+  Word t;
+
+  // The message schedule is kept in a circular buffer of the last 16 words
+#define SHA1_STEP(f, k) \
+  if (i >= 16) \
+    w[i&15] = ROTATE_LEFT(w[(i+13)&15] ^ w[(i+8)&15] ^ w[(i+2)&15] ^ w[i&15], 1); \
+  t = ROTATE_LEFT(a, 5) + (f) + e + (DWORD)(k) + w[i&15]; \
+  e = d; \
+  d = c; \
+  c = ROTATE_LEFT(b, 30); \
+  b = a; \
+  a = t
+
+  int i;
+  P_DIGEST_UNROLL
+  for (i = 0; i < 20; ++i) {
+    SHA1_STEP(d ^ (b & (c ^ d)), 0x5a827999);
+  }
+  P_DIGEST_UNROLL
+  for (; i < 40; ++i) {
+    SHA1_STEP(b ^ c ^ d, 0x6ed9eba1);
+  }
+  P_DIGEST_UNROLL
+  for (; i < 60; ++i) {
+    SHA1_STEP((b & c) | (d & (b | c)), 0x8f1bbcdc);
+  }
+  P_DIGEST_UNROLL
+  for (; i < 80; ++i) {
+    SHA1_STEP(b ^ c ^ d, 0xca62c1d6);
+  }
+
+#undef SHA1_STEP
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+
 #if P_SSL
 
 #include <openssl/sha.h>
@@ -702,39 +1158,125 @@ void PMessageDigest5::Complete(Code & codeResult)
 
 PMessageDigestSHA1::PMessageDigestSHA1()
 {
-  shaContext = NULL;
   Start();
 }
 
 PMessageDigestSHA1::~PMessageDigestSHA1()
 {
-  delete (SHA_CTX *)shaContext;
 }
 
 void PMessageDigestSHA1::Start()
 {
-  delete (SHA_CTX *)shaContext;
-  shaContext = new SHA_CTX;
-
+  // Fails to compile if the space in the class is too small
+  typedef char SHA_CTX_fits[sizeof(SHA_CTX) <= sizeof(shaContext) ? 1 : -1];
+  (void)sizeof(SHA_CTX_fits);
   SHA1_Init((SHA_CTX *)shaContext);
 }
 
 void PMessageDigestSHA1::InternalProcess(const void * data, PINDEX len)
 {
-  if (shaContext == NULL)
-    return;
-
   SHA1_Update((SHA_CTX *)shaContext, data, (unsigned long)len);
 }
 
-void PMessageDigestSHA1::InternalCompleteDigest(Result & result)
+void PMessageDigestSHA1::InternalCompleteDigest(BYTE * digest)
 {
-  if (shaContext == NULL)
-    return;
+  SHA1_Final(digest, (SHA_CTX *)shaContext);
+  Start();
+}
+
+void PMessageDigestSHA1::GetState(DWORD * state, PUInt64 & length) const
+{
+  SHA_CTX ctx;
+  memcpy(&ctx, shaContext, sizeof(ctx));
+  state[0] = ctx.h0;
+  state[1] = ctx.h1;
+  state[2] = ctx.h2;
+  state[3] = ctx.h3;
+  state[4] = ctx.h4;
+  length = ((((PUInt64)ctx.Nh) << 32) | ctx.Nl) >> 3;
+}
+
+#else // P_SSL
+
+PMessageDigestSHA1::PMessageDigestSHA1()
+{
+  Start();
+}
 
-  SHA1_Final(result.value.GetPointer(20), (SHA_CTX *)shaContext);
-  delete ((SHA_CTX *)shaContext);
-  shaContext = NULL;
+PMessageDigestSHA1::~PMessageDigestSHA1()
+{
+}
+
+void PMessageDigestSHA1::Start()
+{
+  memcpy(state, SHA1InitialState, sizeof(state));
+  count = 0;
+}
+
+void PMessageDigestSHA1::Transform(const BYTE * block)
+{
+  DWORD w[16];
+  for (PINDEX i = 0; i < 16; i++)
+    w[i] = ((PUInt32b*)block)[i];
+
+  SHA1Rounds(state, w);
+
+  memset(w, 0, sizeof(w));
+}
+
+void PMessageDigestSHA1::InternalProcess(const void * dataPtr, PINDEX length)
+{
+  const BYTE * data = (const BYTE *)dataPtr;
+
+  PINDEX index = (PINDEX)(count & 0x3F);
+  PINDEX partLen = 64 - index;
+
+  count += length;
+
+  PINDEX i;
+  if (length < partLen)
+    i = 0;
+  else {
+    memcpy(&buffer[index], data, partLen);
+    Transform(buffer);
+    for (i = partLen; i + 63 < length; i += 64)
+      Transform(&data[i]);
+    index = 0;
+  }
+
+  memcpy(&buffer[index], &data[i], length-i);
+}
+
+void PMessageDigestSHA1::InternalCompleteDigest(BYTE * digest)
+{
+  PUInt64b countBytes = count << 3;
+
+  PINDEX index = (PINDEX)(count & 0x3f);
+  PINDEX padLen = (index < 56) ? (56 - index) : (120 - index);
+  static BYTE const padding[64] = { 0x80 };
+  Process(padding, padLen);
+  Process(&countBytes, sizeof(countBytes));
+
+  PUInt32b * valuep = (PUInt32b *)digest;
+  for (PINDEX i = 0; i < PARRAYSIZE(state); i++)
+    valuep[i] = state[i];
+
+  memset(buffer, 0, sizeof(buffer));
+  Start();
+}
+
+void PMessageDigestSHA1::GetState(DWORD * stateCopy, PUInt64 & length) const
+{
+  memcpy(stateCopy, state, sizeof(state));
+  length = count;
+}
+
+#endif // P_SSL
+
+
+void PMessageDigestSHA1::InternalCompleteDigest(Result & result)
+{
+  InternalCompleteDigest(result.value.GetPointer(DigestSize));
 }
 
 
@@ -789,8 +1331,250 @@ void PMessageDigestSHA1::Encode(const void * data, PINDEX len, Result & result)
   stomach.CompleteDigest(result);
 }
 
+
+///////////////////////////////////////////////////////////////////////////////
+// Multi-buffer digests
+
+#if P_DIGEST_LANES
+
+struct PDigestMD5Traits
+{
+  enum { StateWords = 4, BigEndian = false };
+
+  static P_DIGEST_INLINE DWORD Load(const BYTE * p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24); }
+
+  template <typename Word>
+  static P_DIGEST_INLINE void Rounds(Word * state, Word * w) { MD5Rounds(state, w); }
+};
+
+
+struct PDigestSHA1Traits
+{
+  enum { StateWords = 5, BigEndian = true };
+
+  static P_DIGEST_INLINE DWORD Load(const BYTE * p) { return ((DWORD)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+  template <typename Word>
+  static P_DIGEST_INLINE void Rounds(Word * state, Word * w) { SHA1Rounds(state, w); }
+};
+
+
+struct PDigestLane
+{
+  PINDEX       m_index;       // Message in this lane, P_MAX_INDEX if idle
+  const BYTE * m_data;
+  PINDEX       m_fullBlocks;  // Blocks taken straight from the message
+  PINDEX       m_blocks;      // Total blocks including padding
+  PINDEX       m_block;
+  BYTE         m_tail[128];   // Last part of message, padding and length
+};
+
+
+template <class Traits>
+static P_DIGEST_INLINE void StartDigestLane(PDigestLane & lane, PINDEX index, const void * data, PINDEX length, PUInt64 prefixLength)
+{
+  lane.m_index = index;
+  lane.m_data = (const BYTE *)data;
+  lane.m_fullBlocks = length/64;
+  lane.m_block = 0;
+
+  PINDEX remainder = length%64;
+  PINDEX tailBlocks = remainder < 56 ? 1 : 2;
+  lane.m_blocks = lane.m_fullBlocks + tailBlocks;
+
+  memcpy(lane.m_tail, lane.m_data + lane.m_fullBlocks*64, remainder);
+  lane.m_tail[remainder] = 0x80;
+  memset(lane.m_tail+remainder+1, 0, tailBlocks*64-remainder-9);
+
+  PUInt64 bits = (prefixLength + length) << 3;
+  if (Traits::BigEndian)
+    *(PUInt64b *)(lane.m_tail + tailBlocks*64 - 8) = bits;
+  else
+    *(PUInt64l *)(lane.m_tail + tailBlocks*64 - 8) = bits;
+}
+
+
+/* Run one message through each lane of the vector, one block at a time, and
+   as a message finishes start the next one in its lane. Idle lanes at the
+   end hash zeros and the result is discarded. */
+template <class Traits, typename Vector, unsigned Lanes>
+static P_DIGEST_INLINE void DigestLanes(PINDEX count,
+                                        const void * const * data,
+                                        const PINDEX * lengths,
+                                        BYTE * digests,
+                                        const DWORD * initialState,
+                                        PUInt64 prefixLength)
+{
+  static const BYTE zeros[64] = { 0 };
+
+  Vector state[Traits::StateWords];
+  PDigestLane lanes[Lanes];
+  PINDEX next = 0;
+  unsigned active = 0;
+
+  for (unsigned l = 0; l < Lanes; ++l) {
+    lanes[l].m_index = P_MAX_INDEX;
+    for (int k = 0; k < Traits::StateWords; ++k)
+      state[k][l] = initialState[k];
+    if (next < count) {
+      StartDigestLane<Traits>(lanes[l], next, data[next], lengths[next], prefixLength);
+      ++next;
+      ++active;
+    }
+  }
+
+  while (active > 0) {
+    Vector w[16];
+    for (unsigned l = 0; l < Lanes; ++l) {
+      const PDigestLane & lane = lanes[l];
+      const BYTE * block;
+      if (lane.m_index == P_MAX_INDEX)
+        block = zeros;
+      else if (lane.m_block < lane.m_fullBlocks)
+        block = lane.m_data + lane.m_block*64;
+      else
+        block = lane.m_tail + (lane.m_block - lane.m_fullBlocks)*64;
+
+      for (int i = 0; i < 16; ++i)
+        w[i][l] = Traits::Load(block + i*4);
+    }
+
+    Traits::Rounds(state, w);
+
+    for (unsigned l = 0; l < Lanes; ++l) {
+      PDigestLane & lane = lanes[l];
+      if (lane.m_index == P_MAX_INDEX || ++lane.m_block < lane.m_blocks)
+        continue;
+
+      BYTE * digest = digests + lane.m_index*Traits::StateWords*4;
+      for (int k = 0; k < Traits::StateWords; ++k) {
+        if (Traits::BigEndian)
+          ((PUInt32b *)digest)[k] = state[k][l];
+        else
+          ((PUInt32l *)digest)[k] = state[k][l];
+        state[k][l] = initialState[k];
+      }
+
+      if (next < count) {
+        StartDigestLane<Traits>(lane, next, data[next], lengths[next], prefixLength);
+        ++next;
+      }
+      else {
+        lane.m_index = P_MAX_INDEX;
+        --active;
+      }
+    }
+  }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static bool HasDigestAVX2()
+{
+  static bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+__attribute__((target("avx2")))
+static void DigestLanesMD5x8(PINDEX count, const void * const * data, const PINDEX * lengths,
+                             BYTE * digests, const DWORD * initialState, PUInt64 prefixLength)
+{
+  DigestLanes<PDigestMD5Traits, PDigestWords8, 8>(count, data, lengths, digests, initialState, prefixLength);
+}
+
+__attribute__((target("avx2")))
+static void DigestLanesSHA1x8(PINDEX count, const void * const * data, const PINDEX * lengths,
+                              BYTE * digests, const DWORD * initialState, PUInt64 prefixLength)
+{
+  DigestLanes<PDigestSHA1Traits, PDigestWords8, 8>(count, data, lengths, digests, initialState, prefixLength);
+}
+
 #endif
 
+#endif // P_DIGEST_LANES
+
+
+void PMessageDigest5::EncodeMultiple(PINDEX count,
+                                     const void * const * data,
+                                     const PINDEX * lengths,
+                                     BYTE * digests,
+                                     const PMessageDigest5 * prefix)
+{
+#if P_DIGEST_LANES
+  if (count > 1) {
+    DWORD initialState[4];
+    PUInt64 prefixLength = 0;
+    if (prefix == NULL) {
+      PMessageDigest5 start;
+      memcpy(initialState, start.state, sizeof(initialState));
+    }
+    else {
+      PAssert((prefix->count & 0x1ff) == 0, "Prefix of multiple digest must be whole blocks");
+      memcpy(initialState, prefix->state, sizeof(initialState));
+      prefixLength = prefix->count >> 3;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (count > 4 && HasDigestAVX2()) {
+      DigestLanesMD5x8(count, data, lengths, digests, initialState, prefixLength);
+      return;
+    }
+#endif
+
+    DigestLanes<PDigestMD5Traits, PDigestWords4, 4>(count, data, lengths, digests, initialState, prefixLength);
+    return;
+  }
+#endif
+
+  for (PINDEX i = 0; i < count; ++i) {
+    PMessageDigest5 stomach;
+    if (prefix != NULL)
+      stomach = *prefix;
+    stomach.Process(data[i], lengths[i]);
+    stomach.CompleteDigest(digests + i*DigestSize);
+  }
+}
+
+
+void PMessageDigestSHA1::EncodeMultiple(PINDEX count,
+                                        const void * const * data,
+                                        const PINDEX * lengths,
+                                        BYTE * digests,
+                                        const PMessageDigestSHA1 * prefix)
+{
+#if P_DIGEST_LANES
+  if (count > 1) {
+    DWORD initialState[5];
+    PUInt64 prefixLength = 0;
+    if (prefix == NULL)
+      memcpy(initialState, SHA1InitialState, sizeof(initialState));
+    else {
+      prefix->GetState(initialState, prefixLength);
+      PAssert((prefixLength & 0x3f) == 0, "Prefix of multiple digest must be whole blocks");
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (count > 4 && HasDigestAVX2()) {
+      DigestLanesSHA1x8(count, data, lengths, digests, initialState, prefixLength);
+      return;
+    }
+#endif
+
+    DigestLanes<PDigestSHA1Traits, PDigestWords4, 4>(count, data, lengths, digests, initialState, prefixLength);
+    return;
+  }
+#endif
+
+  for (PINDEX i = 0; i < count; ++i) {
+    PMessageDigestSHA1 stomach;
+    if (prefix != NULL)
+      stomach = *prefix;
+    stomach.Process(data[i], lengths[i]);
+    stomach.CompleteDigest(digests + i*DigestSize);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // PCypher
 
@@ -35,10 +35,203 @@
 #include <ptlib.h>
 #include <ptclib/delaychan.h>
 
+#include <time.h>
+#include <errno.h>
+
+
+/////////////////////////////////////////////////////////
+
+// Below this the service thread sleeps uninterruptibly until the deadline
+static const PInt64 PacingFinalSleep = 2000000;
+
+
+PPacingService::PPacingService()
+  : m_nextId(1)
+  , m_running(true)
+{
+  m_thread = new PThreadObj<PPacingService>(*this, &PPacingService::ThreadMain, false, "Pacing", PThread::HighestPriority);
+}
+
+
+PPacingService::~PPacingService()
+{
+  m_mutex.Wait();
+  m_running = false;
+  m_mutex.Signal();
+
+  m_newDeadline.Signal();
+  m_thread->WaitForTermination();
+  delete m_thread;
+
+  // Release anyone still waiting
+  for (DeadlineMap::iterator it = m_deadlines.begin(); it != m_deadlines.end(); ++it) {
+    if (it->second.m_wakeup != NULL)
+      it->second.m_wakeup->Signal();
+  }
+}
+
+
+PPacingService & PPacingService::GetInstance()
+{
+  static PPacingService instance;
+  return instance;
+}
+
+
+void PPacingService::SleepUntilTick(PInt64 deadline)
+{
+#if defined(_POSIX_MONOTONIC_CLOCK) && defined(TIMER_ABSTIME) && !defined(P_MACOSX)
+  // Same clock as PTimer::HighResolutionTick()
+  struct timespec ts;
+  ts.tv_sec = (time_t)(deadline/1000000000);
+  ts.tv_nsec = (long)(deadline%1000000000);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+#else
+  PInt64 delay = deadline - PTimer::HighResolutionTick();
+  if (delay > 0)
+    PThread::Sleep(PTimeInterval((delay+999999)/1000000));
+#endif
+}
+
+
+void PPacingService::SleepUntil(PInt64 deadline)
+{
+  if (deadline <= PTimer::HighResolutionTick())
+    return;
+
+  PSyncPoint wakeup;
+  Entry entry;
+  entry.m_wakeup = &wakeup;
+  entry.m_id = 0;
+  entry.m_period = 0;
+
+  m_mutex.Wait();
+  if (!m_running) {
+    m_mutex.Signal();
+    SleepUntilTick(deadline);
+    return;
+  }
+  bool earliest = m_deadlines.empty() || deadline < m_deadlines.begin()->first;
+  m_deadlines.insert(DeadlineMap::value_type(deadline, entry));
+  m_mutex.Signal();
+
+  if (earliest)
+    m_newDeadline.Signal();
+
+  wakeup.Wait();
+}
+
+
+PINDEX PPacingService::AddPeriodic(const PNotifier & notifier, PInt64 periodMicroSeconds)
+{
+  if (notifier.IsNULL() || periodMicroSeconds <= 0)
+    return 0;
+
+  Entry entry;
+  entry.m_wakeup = NULL;
+  entry.m_notifier = notifier;
+  entry.m_period = periodMicroSeconds*1000;
+
+  PInt64 deadline = PTimer::HighResolutionTick() + entry.m_period;
+
+  m_mutex.Wait();
+  entry.m_id = m_nextId++;
+  bool earliest = m_deadlines.empty() || deadline < m_deadlines.begin()->first;
+  m_deadlines.insert(DeadlineMap::value_type(deadline, entry));
+  m_mutex.Signal();
+
+  if (earliest)
+    m_newDeadline.Signal();
+
+  return entry.m_id;
+}
+
+
+bool PPacingService::RemovePeriodic(PINDEX id)
+{
+  bool found = false;
+
+  m_mutex.Wait();
+  for (DeadlineMap::iterator it = m_deadlines.begin(); it != m_deadlines.end(); ++it) {
+    if (it->second.m_wakeup == NULL && it->second.m_id == id) {
+      m_deadlines.erase(it);
+      found = true;
+      break;
+    }
+  }
+  m_mutex.Signal();
+
+  // Wait for the notifier to finish, if it is executing
+  m_callbackMutex.Wait();
+  m_callbackMutex.Signal();
+
+  return found;
+}
+
+
+void PPacingService::ThreadMain()
+{
+  PTRACE(4, "Pacing\tService thread started");
+
+  for (;;) {
+    m_mutex.Wait();
+
+    if (!m_running) {
+      m_mutex.Signal();
+      break;
+    }
+
+    if (m_deadlines.empty()) {
+      m_mutex.Signal();
+      m_newDeadline.Wait();
+      continue;
+    }
+
+    DeadlineMap::iterator it = m_deadlines.begin();
+    PInt64 deadline = it->first;
+    PInt64 delay = deadline - PTimer::HighResolutionTick();
+    if (delay > 0) {
+      m_mutex.Signal();
+      // Wait may be cut short by an earlier deadline being added
+      if (delay > PacingFinalSleep)
+        m_newDeadline.Wait(PTimeInterval((delay - PacingFinalSleep)/1000000));
+      else
+        SleepUntilTick(deadline);
+      continue;
+    }
+
+    Entry entry = it->second;
+    m_deadlines.erase(it);
+
+    if (entry.m_wakeup != NULL) {
+      m_mutex.Signal();
+      entry.m_wakeup->Signal();
+      continue;
+    }
+
+    // Skip periods missed entirely, rather than calling in a burst
+    PInt64 next = deadline + entry.m_period;
+    PInt64 now = deadline - delay;
+    if (next <= now)
+      next += (now - next)/entry.m_period*entry.m_period + entry.m_period;
+    m_deadlines.insert(DeadlineMap::value_type(next, entry));
+
+    // Lock before releasing list, so RemovePeriodic() waits for the call
+    m_callbackMutex.Wait();
+    m_mutex.Signal();
+    entry.m_notifier(*this, entry.m_id);
+    m_callbackMutex.Signal();
+  }
+
+  PTRACE(4, "Pacing\tService thread ended");
+}
+
+
 /////////////////////////////////////////////////////////
 
 PAdaptiveDelay::PAdaptiveDelay(unsigned _maximumSlip, unsigned _minimumDelay)
-  : jitterLimit(_maximumSlip), minimumDelay(_minimumDelay)
+  : m_targetTick(0), jitterLimit(_maximumSlip), minimumDelay(_minimumDelay), m_pacing(NULL)
 {
   firstTime = PTrue;
 }
@@ -49,43 +242,46 @@ void PAdaptiveDelay::Restart()
 }
 
 PBoolean PAdaptiveDelay::Delay(int frameTime)
+{
+  return DelayMicroSeconds(frameTime*1000LL);
+}
+
+PBoolean PAdaptiveDelay::DelayMicroSeconds(PInt64 frameTime)
 {
   if (firstTime) {
     firstTime = PFalse;
-    targetTime = PTime();   // targetTime is the time we want to delay to
+    m_targetTick = PTimer::HighResolutionTick();   // m_targetTick is the time we want to delay to
     return PTrue;
   }
 
   if (frameTime == 0)
     return true;
 
-  // Set the new target
-  targetTime += frameTime;
+  // Set the new target, all in nanoseconds
+  PInt64 frameTicks = frameTime*1000;
+  m_targetTick += frameTicks;
 
   // Calculate the sleep time so we delay until the target time
-  PTimeInterval delay = targetTime - PTime();
-  int sleep_time = (int)delay.GetMilliSeconds();
+  PInt64 delay = m_targetTick - PTimer::HighResolutionTick();
 
   // Catch up if we are too late and the featue is enabled
-  if (jitterLimit > 0 && sleep_time < -jitterLimit.GetMilliSeconds()) {
-    unsigned i = 0;
-    while (sleep_time < -jitterLimit.GetMilliSeconds()) { 
-      targetTime += frameTime;
-      sleep_time += frameTime;
-      i++;
-    }
-    PTRACE (4, "AdaptiveDelay\tSkipped " << i << " frames");
+  PInt64 slip = jitterLimit.GetMilliSeconds()*1000000;
+  if (slip > 0 && delay < -slip) {
+    PInt64 skipped = (-slip - delay)/frameTicks + 1;
+    m_targetTick += skipped*frameTicks;
+    delay += skipped*frameTicks;
+    PTRACE (4, "AdaptiveDelay\tSkipped " << skipped << " frames");
   }
 
   // Else sleep only if necessary
-  if (sleep_time > minimumDelay.GetMilliSeconds())
-#if defined(P_LINUX) || defined(P_MACOSX)
-    usleep(sleep_time * 1000);
-#else
-    PThread::Sleep(sleep_time);
-#endif
+  if (delay > minimumDelay.GetMilliSeconds()*1000000) {
+    if (m_pacing != NULL)
+      m_pacing->SleepUntil(m_targetTick);
+    else
+      PPacingService::SleepUntilTick(m_targetTick);
+  }
 
-  return sleep_time <= -frameTime;
+  return delay <= -frameTicks;
 }
 
 /////////////////////////////////////////////////////////
@@ -95,6 +291,9 @@ PDelayChannel::PDelayChannel(Mode m,
                              PINDEX size,
                              unsigned max,
                              unsigned min)
+  : nextReadTick(0)
+  , nextWriteTick(0)
+  , m_pacing(NULL)
 {
   mode = m;
   frameDelay = delay;
@@ -112,7 +311,10 @@ PDelayChannel::PDelayChannel(PChannel &channel,
    mode(m), 
    frameDelay(delay),
    frameSize(size),
-   minimumDelay(min)
+   minimumDelay(min),
+   nextReadTick(0),
+   nextWriteTick(0),
+   m_pacing(NULL)
 {
   maximumSlip = -PTimeInterval(max);
   if(Open(channel) == PFalse){
@@ -145,29 +347,36 @@ PBoolean PDelayChannel::Write(const void * buf, PINDEX count)
 }
 
 
-void PDelayChannel::Wait(PINDEX count, PTimeInterval & nextTick)
+void PDelayChannel::Wait(PINDEX count, PInt64 & nextTick)
 {
-  PTimeInterval thisTick = PTimer::Tick();
+  PInt64 thisTick = PTimer::HighResolutionTick();
 
   if (nextTick == 0)
     nextTick = thisTick;
 
-  PTimeInterval delay = nextTick - thisTick;
-  if (delay > maximumSlip)
-    PTRACE(6, "Delay\t" << delay);
+  PInt64 delay = nextTick - thisTick;
+  if (delay > maximumSlip.GetMilliSeconds()*1000000)
+    PTRACE(6, "Delay\t" << delay/1000 << "us");
   else {
-    PTRACE(6, "Delay\t" << delay << " ignored, too large");
+    PTRACE(6, "Delay\t" << delay/1000 << "us ignored, too large");
     nextTick = thisTick;
     delay = 0;
   }
 
+  PInt64 deadline = nextTick;
+
+  // Calculate in nanoseconds so partial frames do not accumulate rounding errors
   if (frameSize > 0)
-    nextTick += count*frameDelay/frameSize;
+    nextTick += (PInt64)count*frameDelay*1000000/frameSize;
   else
-    nextTick += frameDelay;
+    nextTick += frameDelay*1000000LL;
 
-  if (delay > minimumDelay)
-    PThread::Sleep(delay);
+  if (delay > minimumDelay.GetMilliSeconds()*1000000) {
+    if (m_pacing != NULL)
+      m_pacing->SleepUntil(deadline);
+    else
+      PPacingService::SleepUntilTick(deadline);
+  }
 }
 
 
@@ -48,15 +48,13 @@
 
 ///////////////////////////////////////////////////////////////////////////////
 
-PGloballyUniqueID::PGloballyUniqueID()
-  : PBYTEArray(GUID_SIZE)
+/* Time of UTC in 0.1 microseconds since 15 Oct 1582. On Linux the coarse
+   clock is used, as it needs no hardware read; the low bits come from the
+   timestamps reserved below, not the clock. */
+static PInt64 GetGUIDTime()
 {
-  static PMutex mutex;
-  PWaitAndSignal wait(mutex);
-
-  // Want time of UTC in 0.1 microseconds since 15 Oct 1582.
   PInt64 timestamp;
-  static PInt64 deltaTime = PInt64(10000000)*24*60*60*
+  static const PInt64 deltaTime = PInt64(10000000)*24*60*60*
                             (  16            // Days from 15th October
                              + 31            // Days in December 1583
                              + 30            // Days in November 1583
@@ -79,10 +77,14 @@ PGloballyUniqueID::PGloballyUniqueID()
                              + (1970-1583)/4   // Leap days
                              - 3);             // Allow for 1700, 1800, 1900 not leap years
 
-#ifdef P_VXWORKS
+#if defined(P_VXWORKS)
   struct timespec ts;
   clock_gettime(0,&ts);
-  timestamp = (ts.tv_sec*(PInt64)1000000 + ts.tv_nsec*1000)*10;
+  timestamp = (ts.tv_sec*(PInt64)1000000 + ts.tv_nsec/1000)*10;
+#elif defined(CLOCK_REALTIME_COARSE)
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  timestamp = ts.tv_sec*(PInt64)10000000 + ts.tv_nsec/100;
 #else
   struct timeval tv;
   gettimeofday(&tv, NULL);
@@ -90,7 +92,117 @@ PGloballyUniqueID::PGloballyUniqueID()
 #endif // P_VXWORKS
 #endif // _WIN32
 
-  timestamp += deltaTime;
+  return timestamp + deltaTime;
+}
+
+
+static PEthSocket::Address GetGUIDNode()
+{
+  PEthSocket::Address macAddress;
+
+  PIPSocket::InterfaceTable interfaces;
+  if (PIPSocket::GetInterfaceTable(interfaces)) {
+    for (PINDEX i = 0; i < interfaces.GetSize(); i++) {
+      PString macAddrStr = interfaces[i].GetMACAddress();
+      if (!macAddrStr && macAddrStr != "44-45-53-54-00-00") { /* not Win32 PPP device */
+        macAddress = macAddrStr;
+        if (macAddress != NULL)
+          return macAddress;
+      }
+    }
+  }
+
+  PRandom rand;
+  macAddress.ls.l = rand;
+  macAddress.ls.s = (WORD)rand;
+  macAddress.b[0] |= '\x80';
+  return macAddress;
+}
+
+
+/* Every ID gets a distinct timestamp. Each thread reserves a block of them
+   from the shared last timestamp with a compare and swap, and uses it until
+   the block runs out or the clock passes it. The reserved timestamps never
+   go back, so IDs are unique whatever the clock does, but if the clock goes
+   back the clock sequence is still incremented as RFC 4122 requires. */
+enum {
+  GUIDTimestampBlock = 64,
+  GUIDClockBackwards = 10000000  // One second
+};
+
+#if defined(__GNUC__)
+
+static PInt64 volatile GUIDLastTimestamp;
+static PInt64 volatile GUIDLastClock;
+static int    volatile GUIDClockSequence = -1;
+
+static void ReserveGUIDTimestamps(PInt64 now, PInt64 & next, PInt64 & end, WORD & clockSequence)
+{
+  PInt64 last = __atomic_load_n(&GUIDLastTimestamp, __ATOMIC_RELAXED);
+  do {
+    next = last > now ? last : now;
+  } while (!__atomic_compare_exchange_n(&GUIDLastTimestamp, &last, next + GUIDTimestampBlock,
+                                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  end = next + GUIDTimestampBlock;
+
+  int sequence = __atomic_load_n(&GUIDClockSequence, __ATOMIC_RELAXED);
+  if (sequence < 0) {
+    int initial = PRandom::Number() & 0x3fff;
+    if (__atomic_compare_exchange_n(&GUIDClockSequence, &sequence, initial,
+                                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      sequence = initial;
+  }
+
+  if (now + GUIDClockBackwards < __atomic_exchange_n(&GUIDLastClock, now, __ATOMIC_RELAXED))
+    sequence = __atomic_add_fetch(&GUIDClockSequence, 1, __ATOMIC_RELAXED);
+
+  clockSequence = (WORD)sequence;
+}
+
+#else
+
+static void ReserveGUIDTimestamps(PInt64 now, PInt64 & next, PInt64 & end, WORD & clockSequence)
+{
+  static PMutex mutex;
+  PWaitAndSignal wait(mutex);
+
+  static WORD sequence = (WORD)PRandom::Number();
+  static PInt64 lastTimestamp = 0;
+  static PInt64 lastClock = 0;
+
+  if (now + GUIDClockBackwards < lastClock)
+    sequence++;
+  lastClock = now;
+
+  if (lastTimestamp < now)
+    lastTimestamp = now;
+
+  // No thread local storage for the rest of a block, so reserve just one
+  next = lastTimestamp++;
+  end = lastTimestamp;
+  clockSequence = sequence;
+}
+
+#endif
+
+
+PGloballyUniqueID::PGloballyUniqueID()
+  : PBYTEArray(GUID_SIZE)
+{
+#if defined(__GNUC__)
+  static __thread PInt64 nextTimestamp;
+  static __thread PInt64 endTimestamp;
+  static __thread WORD   clockSequence;
+#else
+  PInt64 nextTimestamp = 0;
+  PInt64 endTimestamp = 0;
+  WORD   clockSequence;
+#endif
+
+  PInt64 now = GetGUIDTime();
+  if (nextTimestamp >= endTimestamp || now > nextTimestamp)
+    ReserveGUIDTimestamps(now, nextTimestamp, endTimestamp, clockSequence);
+  PInt64 timestamp = nextTimestamp++;
 
   theArray[0] = (BYTE)(timestamp&0xff);
   theArray[1] = (BYTE)((timestamp>>8)&0xff);
@@ -101,43 +213,10 @@ PGloballyUniqueID::PGloballyUniqueID()
   theArray[6] = (BYTE)((timestamp>>48)&0xff);
   theArray[7] = (BYTE)(((timestamp>>56)&0x0f) + 0x10);  // Version number is 1
 
-  static WORD clockSequence = (WORD)PRandom::Number();
-  static PInt64 lastTimestamp = 0;
-  if (lastTimestamp < timestamp)
-    lastTimestamp = timestamp;
-  else
-    clockSequence++;
-
   theArray[8] = (BYTE)(((clockSequence>>8)&0x1f) | 0x80); // DCE compatible GUID
   theArray[9] = (BYTE)clockSequence;
 
-  static PEthSocket::Address macAddress;
-  static PBoolean needMacAddress = PTrue;
-  if (needMacAddress) {
-    PIPSocket::InterfaceTable interfaces;
-    if (PIPSocket::GetInterfaceTable(interfaces)) {
-      for (PINDEX i = 0; i < interfaces.GetSize(); i++) {
-        PString macAddrStr = interfaces[i].GetMACAddress();
-        if (!macAddrStr && macAddrStr != "44-45-53-54-00-00") { /* not Win32 PPP device */
-          macAddress = macAddrStr;
-          if (macAddress != NULL) {
-            needMacAddress = PFalse;
-            break;
-          }
-        }
-      }
-    }
-
-    if (needMacAddress) {
-      PRandom rand;
-      macAddress.ls.l = rand;
-      macAddress.ls.s = (WORD)rand;
-      macAddress.b[0] |= '\x80';
-
-      needMacAddress = PFalse;
-    }
-  }
-
+  static const PEthSocket::Address macAddress = GetGUIDNode();
   memcpy(theArray+10, macAddress.b, 6);
 }
 
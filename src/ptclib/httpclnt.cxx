@@ -296,48 +296,135 @@ PBoolean PHTTPClient::ReadContentBody(PMIMEInfo & replyMIME, PBYTEArray & body)
 }
 
 
-PBoolean PHTTPClient::InternalReadContentBody(PMIMEInfo & replyMIME, PAbstractArray * body)
+bool PHTTPClient::ReadContentBody(PMIMEInfo & replyMIME, ContentProcessor & processor)
 {
-  PCaselessString encoding = replyMIME(TransferEncodingTag());
+  return InternalReadContentBody(replyMIME, processor);
+}
 
-  if (encoding != ChunkedTag()) {
-    if (replyMIME.Contains(ContentLengthTag())) {
-      PINDEX length = replyMIME.GetInteger(ContentLengthTag());
-      if (body != NULL) {
-        body->SetSize(length);
-        return ReadBlock(body->GetPointer(), length);
-      }
-      while (length-- > 0) {
-        if (ReadChar() < 0)
-          return false;
+
+class PHTTPClient_ArrayProcessor : public PHTTPClient::ContentProcessor
+{
+  public:
+    PHTTPClient_ArrayProcessor(PAbstractArray & body)
+      : m_body(body)
+      , m_length(0)
+    {
+    }
+
+    ~PHTTPClient_ArrayProcessor()
+    {
+      m_body.SetSize(m_length);
+    }
+
+    virtual void * GetBuffer(PINDEX & size)
+    {
+      static const PINDEX MinChunkSize = 2048;
+
+      // Grow geometrically when the length is not known in advance
+      PINDEX available = m_body.GetSize() - m_length;
+      if (available < MinChunkSize || (size != P_MAX_INDEX && available < size)) {
+        PINDEX newSize;
+        if (size != P_MAX_INDEX)
+          newSize = m_length + size;
+        else
+          newSize = PMAX(m_body.GetSize()*2, m_length + MinChunkSize);
+        if (!m_body.SetSize(newSize))
+          return NULL;
+        available = newSize - m_length;
       }
+
+      size = available;
+      return (char *)m_body.GetPointer() + m_length;
+    }
+
+    virtual bool Process(const void *, PINDEX length)
+    {
+      m_length += length;
       return true;
     }
 
+  protected:
+    PAbstractArray & m_body;
+    PINDEX           m_length;
+};
+
+
+class PHTTPClient_WasteProcessor : public PHTTPClient::ContentProcessor
+{
+  public:
+    virtual void * GetBuffer(PINDEX & size)
+    {
+      size = sizeof(m_buffer);
+      return m_buffer;
+    }
+
+    virtual bool Process(const void *, PINDEX)
+    {
+      return true;
+    }
+
+  protected:
+    BYTE m_buffer[4096];
+};
+
+
+PBoolean PHTTPClient::InternalReadContentBody(PMIMEInfo & replyMIME, PAbstractArray * body)
+{
+  if (body == NULL) {
+    PHTTPClient_WasteProcessor processor;
+    return InternalReadContentBody(replyMIME, processor);
+  }
+
+  PHTTPClient_ArrayProcessor processor(*body);
+  return InternalReadContentBody(replyMIME, processor);
+}
+
+
+bool PHTTPClient::InternalReadContentPart(ContentProcessor & processor, PINDEX length)
+{
+  while (length > 0) {
+    PINDEX size = length;
+    void * buffer = processor.GetBuffer(size);
+    if (buffer == NULL || size == 0)
+      return false;
+
+    if (size > length)
+      size = length;
+
+    if (!Read(buffer, size))
+      return length == P_MAX_INDEX && GetErrorCode(LastReadError) == NoError;
+
+    PINDEX count = GetLastReadCount();
+    if (!processor.Process(buffer, count))
+      return false;
+
+    if (length != P_MAX_INDEX)
+      length -= count;
+  }
+
+  return true;
+}
+
+
+bool PHTTPClient::InternalReadContentBody(PMIMEInfo & replyMIME, ContentProcessor & processor)
+{
+  PCaselessString encoding = replyMIME(TransferEncodingTag());
+
+  if (encoding != ChunkedTag()) {
+    if (replyMIME.Contains(ContentLengthTag()))
+      return InternalReadContentPart(processor, replyMIME.GetInteger(ContentLengthTag()));
+
     if (!(encoding.IsEmpty())) {
       lastResponseCode = -1;
       lastResponseInfo = "Unknown Transfer-Encoding extension";
       return PFalse;
     }
 
-    if (body != NULL) {
-      // Must be raw, read to end file variety
-      static const PINDEX ChunkSize = 2048;
-      PINDEX bytesRead = 0;
-      while (ReadBlock((char *)body->GetPointer(bytesRead+ChunkSize)+bytesRead, ChunkSize))
-        bytesRead += GetLastReadCount();
-
-      body->SetSize(bytesRead + GetLastReadCount());
-    }
-    else {
-      while (ReadChar() >= 0)
-        ;
-    }
-    return GetErrorCode(LastReadError) == NoError;
+    // Must be raw, read to end file variety
+    return InternalReadContentPart(processor, P_MAX_INDEX);
   }
 
   // HTTP1.1 chunked format
-  PINDEX bytesRead = 0;
   for (;;) {
     // Read chunk length line
     PString chunkLengthLine;
@@ -349,18 +436,9 @@ PBoolean PHTTPClient::InternalReadContentBody(PMIMEInfo & replyMIME, PAbstractAr
     if (chunkLength == 0)
       break;
 
-    if (body != NULL) {
-      // Read the chunk
-      if (!ReadBlock((char *)body->GetPointer(bytesRead+chunkLength)+bytesRead, chunkLength))
-        return PFalse;
-      bytesRead+= chunkLength;
-    }
-    else {
-      while (chunkLength-- > 0) {
-        if (ReadChar() < 0)
-          return false;
-      }
-    }
+    // Read the chunk
+    if (!InternalReadContentPart(processor, chunkLength))
+      return PFalse;
 
     // Read the trailing CRLF
     if (!ReadLine(chunkLengthLine))
@@ -544,6 +622,231 @@ void PHTTPClient::SetAuthenticationInfo(
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+// PHTTPClientPool
+
+PHTTPClientPool::PHTTPClientPool(PINDEX maxIdlePerHost,
+                                 const PTimeInterval & idleTimeout,
+                                 unsigned maxWorkers,
+                                 const PString & userAgentName)
+  : m_maxIdlePerHost(maxIdlePerHost)
+  , m_idleTimeout(idleTimeout)
+  , m_userAgentName(userAgentName)
+  , m_threadPool(maxWorkers)
+{
+}
+
+
+PHTTPClientPool::~PHTTPClientPool()
+{
+  // Requests in progress release their connections to the idle list
+  m_threadPool.Shutdown();
+  CloseIdle();
+}
+
+
+PString PHTTPClientPool::MakeKey(const PURL & url)
+{
+  PStringStream key;
+  key << url.GetScheme() << "://" << url.GetHostName() << ':' << url.GetPort();
+  return key;
+}
+
+
+PHTTPClient * PHTTPClientPool::Acquire(const PURL & url)
+{
+  PString key = MakeKey(url);
+  PTimeInterval now = PTimer::Tick();
+
+  PWaitAndSignal mutex(m_mutex);
+
+  PHTTPClient * client = NULL;
+
+  IdleMap::iterator it = m_idle.find(key);
+  if (it != m_idle.end()) {
+    IdleList & idle = it->second;
+    while (!idle.empty()) {
+      // Most recently used is at the back, so least likely to have been closed by server
+      IdleConnection connection = idle.back();
+      idle.pop_back();
+      if (connection.m_client->IsOpen() && (now - connection.m_released) < m_idleTimeout) {
+        client = connection.m_client;
+        ++m_connectionsReused;
+        PTRACE(5, "HTTP\tRe-using pooled connection to " << key);
+        break;
+      }
+      delete connection.m_client;
+    }
+    if (idle.empty())
+      m_idle.erase(it);
+  }
+
+  if (client == NULL) {
+    client = new PHTTPClient(m_userAgentName);
+    ++m_connectionsOpened;
+    PTRACE(4, "HTTP\tCreating pooled connection to " << key);
+  }
+
+  m_active[client] = key;
+  return client;
+}
+
+
+void PHTTPClientPool::Release(PHTTPClient * client, bool reuse)
+{
+  if (client == NULL)
+    return;
+
+  PWaitAndSignal mutex(m_mutex);
+
+  ActiveMap::iterator it = m_active.find(client);
+  if (!PAssert(it != m_active.end(), "HTTP client not from this pool"))
+    return;
+
+  PString key = it->second;
+  m_active.erase(it);
+
+  if (reuse && client->IsOpen() && client->GetPersistent()) {
+    IdleList & idle = m_idle[key];
+    if ((PINDEX)idle.size() < m_maxIdlePerHost) {
+      IdleConnection connection;
+      connection.m_client = client;
+      connection.m_released = PTimer::Tick();
+      idle.push_back(connection);
+      return;
+    }
+  }
+
+  delete client;
+}
+
+
+void PHTTPClientPool::CloseIdle()
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  for (IdleMap::iterator it = m_idle.begin(); it != m_idle.end(); ++it) {
+    for (IdleList::iterator conn = it->second.begin(); conn != it->second.end(); ++conn)
+      delete conn->m_client;
+  }
+  m_idle.clear();
+}
+
+
+PINDEX PHTTPClientPool::GetIdleCount() const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  PINDEX count = 0;
+  for (IdleMap::const_iterator it = m_idle.begin(); it != m_idle.end(); ++it)
+    count += it->second.size();
+  return count;
+}
+
+
+int PHTTPClientPool::ExecuteCommand(const PString & cmdName,
+                                    const PURL & url,
+                                    PMIMEInfo & outMIME,
+                                    const PString & dataBody,
+                                    PMIMEInfo & replyMIME,
+                                    PBYTEArray & replyBody)
+{
+  PHTTPClient * client = Acquire(url);
+
+  int code = client->ExecuteCommand(cmdName, url, outMIME, dataBody, replyMIME);
+  bool reuse = code > 0 && client->ReadContentBody(replyMIME, replyBody) &&
+               !(replyMIME(PHTTP::ConnectionTag()) *= "close");
+
+  Release(client, reuse);
+  return code;
+}
+
+
+bool PHTTPClientPool::GetTextDocument(const PURL & url, PString & document, const PString & contentType)
+{
+  PHTTPClient * client = Acquire(url);
+  bool ok = client->GetTextDocument(url, document, contentType);
+  Release(client, ok);
+  return ok;
+}
+
+
+bool PHTTPClientPool::PostData(const PURL & url,
+                               PMIMEInfo & outMIME,
+                               const PString & data,
+                               PMIMEInfo & replyMIME,
+                               PString & replyBody)
+{
+  PHTTPClient * client = Acquire(url);
+  bool ok = client->PostData(url, outMIME, data, replyMIME, replyBody);
+  Release(client, ok && !(replyMIME(PHTTP::ConnectionTag()) *= "close"));
+  return ok;
+}
+
+
+bool PHTTPClientPool::StartRequest(Request * request)
+{
+  if (request == NULL)
+    return false;
+
+  request->m_pool = this;
+  if (m_threadPool.AddWork(request))
+    return true;
+
+  delete request;
+  return false;
+}
+
+
+void PHTTPClientPool::ExecuteRequest(Request & request)
+{
+  PHTTPClient * client = Acquire(request.m_url);
+
+  request.m_responseCode = client->ExecuteCommand(request.m_command,
+                                                  request.m_url,
+                                                  request.m_outMIME,
+                                                  request.m_dataBody,
+                                                  request.m_replyMIME);
+  request.m_responseInfo = client->GetLastResponseInfo();
+
+  bool reuse = false;
+  if (request.m_responseCode > 0) {
+    if (request.m_processor != NULL)
+      reuse = client->ReadContentBody(request.m_replyMIME, *request.m_processor);
+    else
+      reuse = client->ReadContentBody(request.m_replyMIME, request.m_replyBody);
+    if (!reuse && request.IsOK()) {
+      request.m_responseCode = -1;
+      request.m_responseInfo = client->GetErrorText(PChannel::LastReadError);
+    }
+    if (request.m_replyMIME(PHTTP::ConnectionTag()) *= "close")
+      reuse = false;
+  }
+
+  Release(client, reuse);
+
+  if (!request.m_completed.IsNULL())
+    request.m_completed(request, 0);
+}
+
+
+PHTTPClientPool::Request::Request(const PURL & url, const PString & command)
+  : m_url(url)
+  , m_command(command)
+  , m_processor(NULL)
+  , m_responseCode(0)
+  , m_pool(NULL)
+{
+}
+
+
+void PHTTPClientPool::Request::Work()
+{
+  if (PAssertNULL(m_pool) != NULL)
+    m_pool->ExecuteRequest(*this);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////////
 
 PHTTPClientAuthentication::PHTTPClientAuthentication()
@@ -239,6 +239,13 @@ PBoolean PHTTPServer::ProcessCommand()
   // the read timeout appropriately.
   if (transactionCount > 0) 
     SetReadTimeout(nextTimeout);
+  else {
+    // Responses are written as header then body, on a persistent connection
+    // Nagle would hold the body until the client's delayed ACK of the header
+    PIPSocket * socket = GetSocket();
+    if (socket != NULL)
+      socket->SetOption(TCP_NODELAY, 1, IPPROTO_TCP);
+  }
 
   // this will only return false upon timeout or completely invalid command
   if (!ReadCommand(cmd, args))
@@ -542,7 +549,7 @@ PBoolean PHTTPServer::StartResponse(StatusCode code,
       chunked = bodySize == P_MAX_INDEX;
       if (chunked)
         headers.SetAt(TransferEncodingTag(), ChunkedTag());
-      else if (bodySize >= 0 && bodySize < P_MAX_INDEX)
+      else if (bodySize >= 0)
         headers.SetAt(ContentLengthTag(), bodySize);
     }
   }
@@ -1300,6 +1307,86 @@ PString PHTTPString::LoadText(PHTTPRequest &)
 }
 
 
+#if P_PROFILING
+
+//////////////////////////////////////////////////////////////////////////////
+// PHTTPProfilingResource
+
+PHTTPProfilingResource::PHTTPProfilingResource(const PURL & url)
+  : PHTTPString(url, PString::Empty(), "text/plain")
+{
+}
+
+
+PHTTPProfilingResource::PHTTPProfilingResource(const PURL & url,
+                                               const PHTTPAuthority & auth)
+  : PHTTPString(url, PString::Empty(), "text/plain", auth)
+{
+}
+
+
+PBoolean PHTTPProfilingResource::LoadHeaders(PHTTPRequest & request)
+{
+  PStringStream results;
+  PProfiling::Dump(results);
+
+  PWaitAndSignal lock(m_mutex);
+  string = results;
+  return PHTTPString::LoadHeaders(request);
+}
+
+
+PString PHTTPProfilingResource::LoadText(PHTTPRequest &)
+{
+  PWaitAndSignal lock(m_mutex);
+  return string;
+}
+
+#endif // P_PROFILING
+
+
+#if P_HEAP_PROFILER
+
+//////////////////////////////////////////////////////////////////////////////
+// PHTTPHeapProfileResource
+
+PHTTPHeapProfileResource::PHTTPHeapProfileResource(const PURL & url,
+                                                   PHeapProfiler::Formats format)
+  : PHTTPString(url, PString::Empty(), "text/plain")
+  , m_format(format)
+{
+}
+
+
+PHTTPHeapProfileResource::PHTTPHeapProfileResource(const PURL & url,
+                                                   const PHTTPAuthority & auth,
+                                                   PHeapProfiler::Formats format)
+  : PHTTPString(url, PString::Empty(), "text/plain", auth)
+  , m_format(format)
+{
+}
+
+
+PBoolean PHTTPHeapProfileResource::LoadHeaders(PHTTPRequest & request)
+{
+  PStringStream results;
+  PHeapProfiler::Dump(results, m_format);
+
+  PWaitAndSignal lock(m_mutex);
+  string = results;
+  return PHTTPString::LoadHeaders(request);
+}
+
+
+PString PHTTPHeapProfileResource::LoadText(PHTTPRequest &)
+{
+  PWaitAndSignal lock(m_mutex);
+  return string;
+}
+
+#endif // P_HEAP_PROFILER
+
+
 //////////////////////////////////////////////////////////////////////////////
 // PHTTPFile
 
@@ -1383,11 +1470,88 @@ PBoolean PHTTPFile::LoadHeaders(PHTTPRequest & request)
     return PFalse;
   }
 
-  request.contentSize = file.GetLength();
+  off_t length = file.GetLength();
+  request.contentSize = length < P_MAX_INDEX ? (PINDEX)length : P_MAX_INDEX;
   return PTrue;
 }
 
 
+void PHTTPFile::SendData(PHTTPRequest & request)
+{
+  PFile & file = ((PHTTPFileRequest&)request).file;
+  if (!file.IsOpen()) {
+    PHTTPResource::SendData(request);
+    return;
+  }
+
+  PString type = GetContentType();
+  if (type.IsEmpty())
+    type = PMIMEInfo::GetContentType(file.GetFilePath().GetType());
+
+  // Text may be processed by OnLoadedText() so must go via LoadData()
+  if (type(0, 4) *= "text/") {
+    PHTTPResource::SendData(request);
+    return;
+  }
+
+  if (!request.outMIME.Contains(PHTTP::ContentTypeTag()) && !contentType)
+    request.outMIME.SetAt(PHTTP::ContentTypeTag(), contentType);
+
+  /* Read the file already opened by LoadHeaders() in large blocks. It is not
+     memory mapped, as a file truncated by another process while it is being
+     sent would fault on the mapping. */
+  off_t remaining = file.GetLength() - file.GetPosition();
+  long bodySize = (long)remaining;
+  if (bodySize != remaining)
+    bodySize = -1; // Too big for a Content-Length, end at connection close
+
+  PBoolean chunked = request.server.StartResponse(request.code, request.outMIME, bodySize);
+  if (chunked)
+    request.outMIME.RemoveAll();
+
+  static const PINDEX BlockSize = 65536;
+  PBYTEArray buffer(BlockSize);
+  bool ok = true;
+  while (remaining > 0) {
+    PINDEX count = remaining > BlockSize ? BlockSize : (PINDEX)remaining;
+    if (!file.Read(buffer.GetPointer(), count) || file.GetLastReadCount() == 0) {
+      PTRACE(2, "HTTP\tFile " << file.GetFilePath() << " ended " << remaining << " bytes early");
+      ok = false;
+      break;
+    }
+
+    count = file.GetLastReadCount();
+    remaining -= count;
+
+    if (chunked) {
+      request.server << PString(PString::Unsigned, (long)count, 16U) << "\r\n";
+      ok = request.server.Write(buffer, count);
+      request.server << "\r\n";
+    }
+    else
+      ok = request.server.Write(buffer, count);
+
+    if (!ok) {
+      PTRACE(2, "HTTP\tWrite of file " << file.GetFilePath() << " failed: "
+             << request.server.GetErrorText(PChannel::LastWriteError));
+      break;
+    }
+  }
+
+  if (ok) {
+    if (chunked)
+      request.server << "0\r\n" << request.outMIME;
+  }
+  else {
+    // The promised length was not delivered, so the connection must not persist
+    request.outMIME.RemoveAt(PHTTP::ContentLengthTag());
+    request.outMIME.RemoveAt(PHTTP::TransferEncodingTag());
+  }
+
+  file.Close();
+}
+
+
 PBoolean PHTTPFile::LoadData(PHTTPRequest & request, PCharArray & data)
 {
   PFile & file = ((PHTTPFileRequest&)request).file;
@@ -1487,6 +1651,12 @@ PBoolean PHTTPTailFile::LoadHeaders(PHTTPRequest & request)
 }
 
 
+void PHTTPTailFile::SendData(PHTTPRequest & request)
+{
+  PHTTPResource::SendData(request);
+}
+
+
 PBoolean PHTTPTailFile::LoadData(PHTTPRequest & request, PCharArray & data)
 {
   PFile & file = ((PHTTPFileRequest&)request).file;
@@ -39,8 +39,12 @@
 #if P_LUA
 
 #include <ptclib/lua.h>
+#include <ptlib/pdirect.h>
 #include <lua.hpp>
 
+#include <algorithm>
+#include <map>
+
 
 #ifdef _MSC_VER
   #pragma comment(lib, P_LUA_LIBRARY)
@@ -82,6 +86,61 @@ bool PLua::LoadFile(const char * filename)
 }
 
 
+bool PLua::LoadBuffer(const void * data, PINDEX length, const char * name)
+{
+  int err;
+  if ((err = luaL_loadbuffer(m_lua, (const char *)data, length, name)) == 0)
+    return true;
+
+  OnError(err, lua_tostring(m_lua, -1));
+  lua_pop(m_lua, 1);
+  return false;
+}
+
+
+struct PLuaChunkWriter
+{
+  PBYTEArray & m_bytecode;
+  PINDEX       m_length;
+};
+
+static int WriteChunk(lua_State *, const void * data, size_t size, void * user)
+{
+  PLuaChunkWriter & writer = *(PLuaChunkWriter *)user;
+
+  // lua_dump() writes many small pieces, so grow geometrically
+  PINDEX needed = writer.m_length + size;
+  if (needed > writer.m_bytecode.GetSize())
+    writer.m_bytecode.SetSize(std::max(needed, writer.m_bytecode.GetSize()*2));
+  memcpy(writer.m_bytecode.GetPointer() + writer.m_length, data, size);
+  writer.m_length = needed;
+  return 0;
+}
+
+
+bool PLua::Compile(const char * filename, PBYTEArray & bytecode)
+{
+  if (!LoadFile(filename))
+    return false;
+
+  bytecode.SetSize(4096);
+  PLuaChunkWriter writer = { bytecode, 0 };
+#if LUA_VERSION_NUM >= 503
+  int err = lua_dump(m_lua, WriteChunk, &writer, 0);
+#else
+  int err = lua_dump(m_lua, WriteChunk, &writer);
+#endif
+  lua_pop(m_lua, 1);
+
+  bytecode.SetSize(writer.m_length);
+  if (err == 0)
+    return true;
+
+  OnError(err, "Cannot dump bytecode");
+  return false;
+}
+
+
 bool PLua::LoadString(const char * string)
 {
   int err;
@@ -213,21 +272,21 @@ bool PLua::CallLuaFunction(const char * name, const char * sig, ...)
   while (*sig) {
     switch (*sig++) {
       case 'd':
-        if (lua_isnumber(*this, nresults)) {
+        if (!lua_isnumber(*this, nresults)) {
           PTRACE(1, "LUA\tInvalid result from call " << *(sig -1));
           return false;
         }
         *va_arg(args, double *) = lua_tonumber(*this, nresults);
         break;
       case 'i':
-        if (lua_isnumber(*this, nresults)) {
+        if (!lua_isnumber(*this, nresults)) {
           PTRACE(1, "LUA\tInvalid result from call " << *(sig -1));
           return false;
         }
         *va_arg(args, int *) = lua_tointeger(*this, nresults);
         break;
       case 's':
-        if (lua_isstring(*this, nresults)) {
+        if (!lua_isstring(*this, nresults)) {
           PTRACE(1, "LUA\tInvalid result from call " << *(sig -1));
           return false;
         }
@@ -291,6 +350,259 @@ int PLua::TraceFunction(lua_State * L)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+struct PLuaChunk
+{
+  PTime      m_modified;
+  PBYTEArray m_bytecode;
+};
+
+struct PLuaChunkCache
+{
+  PMutex                        m_mutex;
+  std::map<PString, PLuaChunk>  m_chunks;
+};
+
+static PLuaChunkCache & GetChunkCache()
+{
+  static PLuaChunkCache cache;
+  return cache;
+}
+
+
+/* Get the bytecode for the script as it was at the modification time,
+   compiling it only if no pool has done so already. */
+static bool GetChunk(const PFilePath & script, const PTime & modified, PBYTEArray & bytecode)
+{
+  PLuaChunkCache & cache = GetChunkCache();
+  PWaitAndSignal lock(cache.m_mutex);
+
+  std::map<PString, PLuaChunk>::iterator it = cache.m_chunks.find(script);
+  if (it != cache.m_chunks.end() && it->second.m_modified == modified) {
+    bytecode = it->second.m_bytecode;
+    return true;
+  }
+
+  PLua compiler;
+  if (!compiler.Compile(script, bytecode)) {
+    PTRACE(2, "Lua\tCannot compile " << script << ": " << compiler.GetLastErrorText());
+    return false;
+  }
+
+  PLuaChunk & chunk = cache.m_chunks[script];
+  chunk.m_modified = modified;
+  chunk.m_bytecode = bytecode;
+  PTRACE(4, "Lua\tCompiled " << script << " to " << bytecode.GetSize() << " bytes");
+  return true;
+}
+
+
+void PLuaPool::FlushCache()
+{
+  PLuaChunkCache & cache = GetChunkCache();
+  PWaitAndSignal lock(cache.m_mutex);
+  cache.m_chunks.clear();
+}
+
+
+class PLuaPool::State : public PLua
+{
+  public:
+    State(unsigned generation)
+      : m_generation(generation)
+    {
+    }
+
+    unsigned m_generation;
+};
+
+
+PLuaPool::PLuaPool(const PFilePath & script, PINDEX maxStates)
+  : m_script(script)
+  , m_maxStates(maxStates)
+  , m_checkInterval(0, 1)
+  , m_generation(0)
+  , m_stateCount(0)
+  , m_available(maxStates > 0 ? new PSemaphore(maxStates, maxStates) : NULL)
+{
+}
+
+
+PLuaPool::~PLuaPool()
+{
+  PTRACE_IF(2, m_stateCount != (PINDEX)m_idle.size(),
+            "Lua\tPool destroyed with " << m_stateCount - m_idle.size() << " states leased");
+
+  for (size_t i = 0; i < m_idle.size(); ++i)
+    delete m_idle[i];
+  for (size_t i = 0; i < m_binders.size(); ++i)
+    delete m_binders[i];
+  delete m_available;
+}
+
+
+void PLuaPool::AddFunction(const char * name, PLua::CFunction func)
+{
+  PWaitAndSignal lock(m_mutex);
+  m_functions.push_back(std::pair<PString, PLua::CFunction>(name, func));
+}
+
+
+void PLuaPool::AddBinder(Binder * binder)
+{
+  PWaitAndSignal lock(m_mutex);
+  m_binders.push_back(binder);
+}
+
+
+PINDEX PLuaPool::GetStateCount() const
+{
+  PWaitAndSignal lock(m_mutex);
+  return m_stateCount;
+}
+
+
+bool PLuaPool::OnNewState(PLua &)
+{
+  return true;
+}
+
+
+bool PLuaPool::CheckScript()
+{
+  PTimeInterval now = PTimer::Tick();
+  if (m_generation > 0 && now - m_lastCheck < m_checkInterval)
+    return true;
+  m_lastCheck = now;
+
+  // On any failure keep running the script as last compiled
+  PFileInfo info;
+  if (!PFile::GetInfo(m_script, info)) {
+    PTRACE(2, "Lua\tCannot find script " << m_script);
+    return m_generation > 0;
+  }
+
+  if (m_generation > 0 && info.modified == m_modified)
+    return true;
+
+  PBYTEArray bytecode;
+  if (!GetChunk(m_script, info.modified, bytecode))
+    return m_generation > 0;
+
+  m_bytecode = bytecode;
+  m_modified = info.modified;
+  ++m_generation;
+  PTRACE_IF(3, m_generation > 1, "Lua\tReloading changed script " << m_script);
+  return true;
+}
+
+
+PLuaPool::State * PLuaPool::Acquire()
+{
+  if (m_available != NULL)
+    m_available->Wait();
+
+  PBYTEArray bytecode;
+  unsigned generation;
+  std::vector<Binder *> binders;
+  std::vector<std::pair<PString, PLua::CFunction> > functions;
+  {
+    PWaitAndSignal lock(m_mutex);
+
+    if (CheckScript()) {
+      // Most recently used first, it is the most likely to be in the CPU cache
+      while (!m_idle.empty()) {
+        State * state = m_idle.back();
+        m_idle.pop_back();
+        if (state->m_generation == m_generation)
+          return state;
+        delete state;
+        --m_stateCount;
+      }
+
+      bytecode = m_bytecode;
+      generation = m_generation;
+      binders = m_binders;
+      functions = m_functions;
+      ++m_stateCount;
+    }
+    else {
+      if (m_available != NULL)
+        m_available->Signal();
+      return NULL;
+    }
+  }
+
+  // A new state is made outside the lock, other threads keep leasing
+  State * state = new State(generation);
+
+  for (size_t i = 0; i < functions.size(); ++i)
+    state->SetFunction(functions[i].first, functions[i].second);
+  for (size_t i = 0; i < binders.size(); ++i)
+    binders[i]->Bind(*state);
+
+  if (OnNewState(*state) &&
+      state->LoadBuffer(bytecode, bytecode.GetSize(), m_script) &&
+      state->Run()) {
+    PTRACE(4, "Lua\tCreated state " << m_stateCount << " for " << m_script);
+    return state;
+  }
+
+  PTRACE(2, "Lua\tCannot run " << m_script << ": " << state->GetLastErrorText());
+  delete state;
+
+  {
+    PWaitAndSignal lock(m_mutex);
+    --m_stateCount;
+  }
+  if (m_available != NULL)
+    m_available->Signal();
+  return NULL;
+}
+
+
+void PLuaPool::Release(State * state)
+{
+  // Drop anything a call left on the stack
+  lua_settop(*state, 0);
+
+  {
+    PWaitAndSignal lock(m_mutex);
+    if (state->m_generation == m_generation)
+      m_idle.push_back(state);
+    else {
+      delete state;
+      --m_stateCount;
+    }
+  }
+
+  if (m_available != NULL)
+    m_available->Signal();
+}
+
+
+PLuaPool::Lease::Lease(PLuaPool & pool)
+  : m_pool(pool)
+  , m_state(pool.Acquire())
+{
+}
+
+
+PLuaPool::Lease::~Lease()
+{
+  if (m_state != NULL)
+    m_pool.Release(m_state);
+}
+
+
+PLua & PLuaPool::Lease::operator*() const
+{
+  PAssert(m_state != NULL, PNullPointerReference);
+  return *m_state;
+}
+
+
 #else // P_LUA
 
   #ifdef _MSC_VER
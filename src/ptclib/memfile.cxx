@@ -36,6 +36,10 @@
 
 #include <ptclib/memfile.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -169,5 +173,304 @@ off_t PMemoryFile::GetPosition() const
 }
 
 
+
+//////////////////////////////////////////////////////////////////////////////
+
+PMemoryMappedFile::PMemoryMappedFile()
+  : m_address(NULL)
+  , m_mappedSize(0)
+  , m_length(0)
+  , m_position(0)
+  , m_writable(false)
+  , m_unmapped(false)
+#ifdef _WIN32
+  , m_mapping(NULL)
+#endif
+{
+}
+
+
+PMemoryMappedFile::PMemoryMappedFile(const PFilePath & name, OpenMode mode, int opts)
+  : m_address(NULL)
+  , m_mappedSize(0)
+  , m_length(0)
+  , m_position(0)
+  , m_writable(false)
+  , m_unmapped(false)
+#ifdef _WIN32
+  , m_mapping(NULL)
+#endif
+{
+  Open(name, mode, opts);
+}
+
+
+PMemoryMappedFile::~PMemoryMappedFile()
+{
+  Close();
+}
+
+
+PBoolean PMemoryMappedFile::Open(OpenMode mode, int opts)
+{
+  // Mapping requires read access, even for a write only file
+  if (mode == WriteOnly) {
+    mode = ReadWrite;
+    if (opts == ModeDefault)
+      opts = Create|Truncate;
+  }
+
+  if (!PFile::Open(mode, opts))
+    return false;
+
+  m_writable = mode != ReadOnly;
+  m_position = 0;
+  m_length = PFile::GetLength();
+
+  /* Nothing to map for an empty read only file, and things like /proc files
+     and devices report zero length, so use normal file access for those. */
+  if (m_length > 0 ? !MapFile(m_length) : !m_writable) {
+    PTRACE(4, "PTLib\tUsing unmapped access for \"" << GetFilePath() << '"');
+    m_unmapped = true;
+  }
+
+  return true;
+}
+
+
+PBoolean PMemoryMappedFile::Open(const PFilePath & name, OpenMode mode, int opts)
+{
+  return PFile::Open(name, mode, opts);
+}
+
+
+PBoolean PMemoryMappedFile::Close()
+{
+  if (!IsOpen())
+    return SetErrorValues(NotOpen, EBADF);
+
+  PBoolean ok = UnmapFile();
+
+  // Remove any space reserved by growth
+  if (!m_unmapped && m_writable && PFile::GetLength() != m_length)
+    ok = PFile::SetLength(m_length) && ok;
+
+  m_mappedSize = m_length = m_position = 0;
+  m_unmapped = false;
+  return PFile::Close() && ok;
+}
+
+
+PBoolean PMemoryMappedFile::MapFile(off_t size)
+{
+#ifdef _WIN32
+  PUInt64 size64 = size;
+  m_mapping = CreateFileMapping((HANDLE)_get_osfhandle(GetHandle()), NULL,
+                                m_writable ? PAGE_READWRITE : PAGE_READONLY,
+                                (DWORD)(size64 >> 32), (DWORD)size64, NULL);
+  if (m_mapping == NULL)
+    return ConvertOSError(-2);
+
+  m_address = (BYTE *)MapViewOfFile(m_mapping, m_writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+  if (m_address == NULL) {
+    ConvertOSError(-2);
+    CloseHandle(m_mapping);
+    m_mapping = NULL;
+    return false;
+  }
+#else
+  void * address = ::mmap(NULL, (size_t)size, m_writable ? (PROT_READ|PROT_WRITE) : PROT_READ, MAP_SHARED, GetHandle(), 0);
+  if (address == MAP_FAILED)
+    return ConvertOSError(-1);
+  m_address = (BYTE *)address;
+#endif
+
+  m_mappedSize = size;
+  return true;
+}
+
+
+PBoolean PMemoryMappedFile::UnmapFile()
+{
+  if (m_address == NULL)
+    return true;
+
+#ifdef _WIN32
+  PBoolean ok = UnmapViewOfFile(m_address) && CloseHandle(m_mapping);
+  m_mapping = NULL;
+#else
+  PBoolean ok = ::munmap(m_address, (size_t)m_mappedSize) == 0;
+#endif
+
+  m_address = NULL;
+  m_mappedSize = 0;
+  return ok;
+}
+
+
+PBoolean PMemoryMappedFile::Read(void * buf, PINDEX len)
+{
+  if (m_unmapped)
+    return PFile::Read(buf, len);
+
+  flush();
+
+  if (!IsOpen())
+    return SetErrorValues(NotOpen, EBADF, LastReadError);
+
+  if (m_position >= m_length)
+    lastReadCount = 0;
+  else {
+    if (len > m_length - m_position)
+      len = (PINDEX)(m_length - m_position);
+    memcpy(buf, m_address + m_position, len);
+    m_position += len;
+    lastReadCount = len;
+  }
+
+  return SetErrorValues(NoError, 0, LastReadError) && lastReadCount > 0;
+}
+
+
+const BYTE * PMemoryMappedFile::ReadPointer(PINDEX len)
+{
+  if (!IsMapped() || m_position >= m_length) {
+    lastReadCount = 0;
+    return NULL;
+  }
+
+  if (len > m_length - m_position)
+    len = (PINDEX)(m_length - m_position);
+
+  const BYTE * ptr = m_address + m_position;
+  m_position += len;
+  lastReadCount = len;
+  return ptr;
+}
+
+
+PBoolean PMemoryMappedFile::Write(const void * buf, PINDEX len)
+{
+  if (m_unmapped)
+    return PFile::Write(buf, len);
+
+  flush();
+
+  if (!IsOpen())
+    return SetErrorValues(NotOpen, EBADF, LastWriteError);
+
+  if (!m_writable)
+    return SetErrorValues(AccessDenied, EACCES, LastWriteError);
+
+  off_t end = m_position + len;
+  if (end > m_mappedSize) {
+    // Grow geometrically so appending is not a remap per write
+    off_t newSize = PMAX(end, PMAX(m_mappedSize*2, (off_t)65536));
+    if (!UnmapFile() || !PFile::SetLength(newSize) || !MapFile(newSize)) {
+      lastWriteCount = 0;
+      return SetErrorValues(DiskFull, ENOSPC, LastWriteError);
+    }
+  }
+
+  memcpy(m_address + m_position, buf, len);
+  m_position = end;
+  if (m_length < end)
+    m_length = end;
+
+  lastWriteCount = len;
+  return SetErrorValues(NoError, 0, LastWriteError);
+}
+
+
+off_t PMemoryMappedFile::GetLength() const
+{
+  if (m_unmapped)
+    return PFile::GetLength();
+  return IsOpen() ? m_length : -1;
+}
+
+
+PBoolean PMemoryMappedFile::SetLength(off_t len)
+{
+  if (m_unmapped)
+    return PFile::SetLength(len);
+
+  if (!m_writable)
+    return SetErrorValues(AccessDenied, EACCES);
+
+  if (!UnmapFile() || !PFile::SetLength(len))
+    return false;
+
+  m_length = len;
+  return len == 0 || MapFile(len);
+}
+
+
+PBoolean PMemoryMappedFile::SetPosition(off_t pos, FilePositionOrigin origin)
+{
+  if (m_unmapped)
+    return PFile::SetPosition(pos, origin);
+
+  switch (origin) {
+    case Current :
+      pos += m_position;
+      break;
+    case End :
+      pos += m_length;
+      break;
+    default :
+      break;
+  }
+
+  if (pos < 0)
+    return SetErrorValues(BadParameter, EINVAL);
+
+  m_position = pos;
+  return true;
+}
+
+
+off_t PMemoryMappedFile::GetPosition() const
+{
+  if (m_unmapped)
+    return PFile::GetPosition();
+  return m_position;
+}
+
+
+PBoolean PMemoryMappedFile::Advise(Advice advice, off_t offset, off_t length)
+{
+  if (!IsMapped() || offset >= m_mappedSize)
+    return false;
+
+  if (length == 0 || offset + length > m_mappedSize)
+    length = m_mappedSize - offset;
+
+#ifdef _WIN32
+  return true;
+#else
+  static const int Advices[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+
+  // madvise requires a page aligned address
+  static const off_t PageSize = sysconf(_SC_PAGESIZE);
+  off_t aligned = offset - offset % PageSize;
+  return ConvertOSError(::madvise(m_address + aligned, (size_t)(length + offset - aligned), Advices[advice]));
+#endif
+}
+
+
+PBoolean PMemoryMappedFile::Synchronise(bool wait)
+{
+  if (!IsMapped() || !m_writable)
+    return true;
+
+#ifdef _WIN32
+  return ConvertOSError(FlushViewOfFile(m_address, 0) ? 0 : -2);
+#else
+  return ConvertOSError(::msync(m_address, (size_t)m_mappedSize, wait ? MS_SYNC : MS_ASYNC));
+#endif
+}
+
+
 // End of File ///////////////////////////////////////////////////////////////
 
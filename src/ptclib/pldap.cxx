@@ -37,6 +37,8 @@
 #include <ptlib/sockets.h>
 #include <ptclib/pldap.h>
 
+#include <algorithm>
+
 #define new PNEW
 
 
@@ -487,6 +489,11 @@ PLDAPSession::SearchContext::~SearchContext()
 }
 
 
+static const int SearchScopeCode[PLDAPSession::NumSearchScope] = {
+  LDAP_SCOPE_BASE, LDAP_SCOPE_ONELEVEL, LDAP_SCOPE_SUBTREE
+};
+
+
 PBoolean PLDAPSession::Search(SearchContext & context,
                           const PString & filter,
                           const PStringArray & attributes,
@@ -503,15 +510,11 @@ PBoolean PLDAPSession::Search(SearchContext & context,
   if (base.IsEmpty())
     base = defaultBaseDN;
 
-  static const int ScopeCode[NumSearchScope] = {
-    LDAP_SCOPE_BASE, LDAP_SCOPE_ONELEVEL, LDAP_SCOPE_SUBTREE
-  };
-
   P_timeval tval = timeout;
 
   errorNumber = ldap_search_ext(ldapContext,
                                 base,
-                                ScopeCode[scope],
+                                SearchScopeCode[scope],
                                 filter,
                                 attribs,
                                 PFalse,
@@ -535,25 +538,16 @@ PBoolean PLDAPSession::Search(SearchContext & context,
 }
 
 
-PBoolean PLDAPSession::GetSearchResult(SearchContext & context, PStringToString & data)
+static void GetEntryAttributes(LDAP * ldapContext,
+                               LDAPMessage * message,
+                               const PString & multipleValueSeparator,
+                               PStringToString & data)
 {
-  data.RemoveAll();
-
-  if (!IsOpen())
-    return PFalse;
-
-  if (context.result == NULL || context.message == NULL || context.completed)
-    return PFalse;
-
-  // Extract the resulting data
-
-  data.SetAt("dn", GetSearchResultDN(context));
-
   BerElement * ber = NULL;
-  char * attrib = ldap_first_attribute(ldapContext, context.message, &ber);
+  char * attrib = ldap_first_attribute(ldapContext, message, &ber);
   while (attrib != NULL) {
 
-    struct berval ** bvals = ldap_get_values_len(ldapContext, context.message, attrib);
+    struct berval ** bvals = ldap_get_values_len(ldapContext, message, attrib);
     if (bvals != NULL) {
       PString value = data(attrib);
 
@@ -568,12 +562,28 @@ PBoolean PLDAPSession::GetSearchResult(SearchContext & context, PStringToString
     }
 
     ldap_memfree(attrib);
-    attrib = ldap_next_attribute(ldapContext, context.message, ber);
+    attrib = ldap_next_attribute(ldapContext, message, ber);
   }
 
   if (ber != NULL)
     ber_free (ber, 0);
+}
+
+
+PBoolean PLDAPSession::GetSearchResult(SearchContext & context, PStringToString & data)
+{
+  data.RemoveAll();
 
+  if (!IsOpen())
+    return PFalse;
+
+  if (context.result == NULL || context.message == NULL || context.completed)
+    return PFalse;
+
+  // Extract the resulting data
+
+  data.SetAt("dn", GetSearchResultDN(context));
+  GetEntryAttributes(ldapContext, context.message, multipleValueSeparator, data);
   return PTrue;
 }
 
@@ -802,6 +812,568 @@ PString PLDAPSession::GetErrorText() const
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+
+static const PTimeInterval PoolPollInterval(100);
+static const PTimeInterval PoolReconnectInterval(0, 5);
+
+struct PLDAPPendingSearch
+{
+  PNotifier     m_notifier;
+  INT           m_userData;
+  PString       m_cacheKey;
+  PTimeInterval m_start;
+  PTimeInterval m_deadline;
+};
+
+typedef std::list<std::pair<PLDAPPendingSearch *, PLDAPSessionPool::SearchResult *> > PLDAPCompletedSearches;
+
+
+/* Each connection has a thread that waits on the socket, then collects all
+   complete responses with a zero timeout. libldap is only called with the
+   connection mutex held, so it need not be the thread safe library. The
+   notifiers are called without the mutex. */
+class PLDAPSessionPool::Connection : public PThread
+{
+    PCLASSINFO(Connection, PThread);
+  public:
+    Connection(PLDAPSessionPool & pool);
+    ~Connection();
+
+    bool Connect();
+    bool Submit(PLDAPPendingSearch * search,
+                const PString & filter,
+                const PStringArray & attributes,
+                const PString & base,
+                PLDAPSession::SearchScope scope);
+    void Stop();
+    bool IsOpen() const;
+    PINDEX GetOutstanding() const;
+
+    virtual void Main();
+
+  protected:
+    bool WaitForData();
+    void ReadResults(PLDAPCompletedSearches & completed);
+    void CheckTimeouts(PLDAPCompletedSearches & completed);
+    void FailAll(int errorNumber, PLDAPCompletedSearches & completed);
+    void Deliver(PLDAPCompletedSearches & completed);
+
+    typedef std::map<int, PLDAPPendingSearch *> PendingMap;
+
+    PLDAPSessionPool & m_pool;
+    PLDAPSession       m_session;
+    PendingMap         m_pending;
+    mutable PMutex     m_mutex;
+    PSyncPoint         m_work;
+    bool               m_running;
+};
+
+
+PLDAPSessionPool::Connection::Connection(PLDAPSessionPool & pool)
+  : PThread(10000, NoAutoDeleteThread, NormalPriority, "LDAP Pool")
+  , m_pool(pool)
+  , m_running(true)
+{
+}
+
+
+PLDAPSessionPool::Connection::~Connection()
+{
+  Stop();
+}
+
+
+bool PLDAPSessionPool::Connection::Connect()
+{
+  PWaitAndSignal lock(m_mutex);
+
+  if (!m_session.Open(m_pool.server, m_pool.port))
+    return false;
+
+  if (m_session.Bind(m_pool.who, m_pool.passwd, m_pool.authMethod))
+    return true;
+
+  PTRACE(2, "LDAP\tPool could not bind to " << m_pool.server << ": " << m_session.GetErrorText());
+  m_session.Close();
+  return false;
+}
+
+
+bool PLDAPSessionPool::Connection::Submit(PLDAPPendingSearch * search,
+                                          const PString & filter,
+                                          const PStringArray & attributes,
+                                          const PString & base,
+                                          PLDAPSession::SearchScope scope)
+{
+  PCharArray storage;
+  char ** attribs = attributes.ToCharArray(&storage);
+
+  P_timeval tval = m_pool.timeout;
+
+  PWaitAndSignal lock(m_mutex);
+
+  if (!m_session.IsOpen())
+    return false;
+
+  int msgid;
+  int errorNumber = ldap_search_ext(m_session.GetOpenLDAP(),
+                                    base,
+                                    SearchScopeCode[scope],
+                                    filter,
+                                    attribs,
+                                    PFalse,
+                                    NULL,
+                                    NULL,
+                                    tval,
+                                    m_pool.searchLimit,
+                                    &msgid);
+  if (errorNumber != LDAP_SUCCESS) {
+    PTRACE(2, "LDAP\tPool search failed: " << ldap_err2string(errorNumber));
+    if (errorNumber == LDAP_SERVER_DOWN)
+      m_session.Close();
+    return false;
+  }
+
+  // The result cannot be collected until we release the mutex
+  m_pending[msgid] = search;
+  m_work.Signal();
+  return true;
+}
+
+
+void PLDAPSessionPool::Connection::Stop()
+{
+  if (!m_running)
+    return;
+
+  m_running = false;
+  m_work.Signal();
+  WaitForTermination();
+
+  PLDAPCompletedSearches completed;
+  {
+    PWaitAndSignal lock(m_mutex);
+    FailAll(LDAP_USER_CANCELLED, completed);
+    m_session.Close();
+  }
+  Deliver(completed);
+}
+
+
+bool PLDAPSessionPool::Connection::IsOpen() const
+{
+  PWaitAndSignal lock(m_mutex);
+  return m_session.IsOpen();
+}
+
+
+PINDEX PLDAPSessionPool::Connection::GetOutstanding() const
+{
+  PWaitAndSignal lock(m_mutex);
+  return m_pending.size();
+}
+
+
+void PLDAPSessionPool::Connection::Main()
+{
+  while (m_running) {
+    if (!IsOpen() && !Connect()) {
+      m_work.Wait(PoolReconnectInterval);
+      continue;
+    }
+
+    if (GetOutstanding() == 0) {
+      m_work.Wait(PoolPollInterval);
+      continue;
+    }
+
+    bool readable = WaitForData();
+
+    PLDAPCompletedSearches completed;
+    {
+      PWaitAndSignal lock(m_mutex);
+      if (readable)
+        ReadResults(completed);
+      CheckTimeouts(completed);
+    }
+    Deliver(completed);
+  }
+}
+
+
+bool PLDAPSessionPool::Connection::WaitForData()
+{
+  int fd = -1;
+  {
+    PWaitAndSignal lock(m_mutex);
+    if (ldap_get_option(m_session.GetOpenLDAP(), LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS || fd < 0)
+      return true; // Let ldap_result() poll
+  }
+
+  fd_set readfds;
+  FD_ZERO(&readfds);
+  FD_SET(fd, &readfds);
+  P_timeval tval = PoolPollInterval;
+  return ::select(fd+1, &readfds, NULL, NULL, tval) != 0;
+}
+
+
+void PLDAPSessionPool::Connection::ReadResults(PLDAPCompletedSearches & completed)
+{
+  LDAP * ldapContext = m_session.GetOpenLDAP();
+
+  for (;;) {
+    P_timeval zero;
+    LDAPMessage * chain = NULL;
+    int type = ldap_result(ldapContext, LDAP_RES_ANY, LDAP_MSG_ALL, zero, &chain);
+    if (type == 0)
+      return;
+
+    if (type < 0) {
+      int errorNumber = LDAP_SERVER_DOWN;
+      ldap_get_option(ldapContext, LDAP_OPT_RESULT_CODE, &errorNumber);
+      PTRACE(2, "LDAP\tPool connection to " << m_pool.server << " failed: " << ldap_err2string(errorNumber));
+      FailAll(errorNumber, completed);
+      m_session.Close();
+      return;
+    }
+
+    PendingMap::iterator it = m_pending.find(ldap_msgid(chain));
+    if (it == m_pending.end()) {
+      PTRACE(3, "LDAP\tPool ignoring response to unknown message " << ldap_msgid(chain));
+      ldap_msgfree(chain);
+      continue;
+    }
+
+    SearchResult * result = new SearchResult;
+    for (LDAPMessage * message = ldap_first_message(ldapContext, chain);
+         message != NULL;
+         message = ldap_next_message(ldapContext, message)) {
+      switch (ldap_msgtype(message)) {
+        case LDAP_RES_SEARCH_ENTRY : {
+          PStringToString * entry = new PStringToString;
+          char * dn = ldap_get_dn(ldapContext, message);
+          entry->SetAt("dn", dn != NULL ? dn : "");
+          if (dn != NULL)
+            ldap_memfree(dn);
+          GetEntryAttributes(ldapContext, message, '\n', *entry);
+          result->m_entries.Append(entry);
+          break;
+        }
+
+        case LDAP_RES_SEARCH_RESULT :
+          result->m_errorNumber = ldap_result2error(ldapContext, message, PFalse);
+          break;
+      }
+    }
+    ldap_msgfree(chain);
+
+    if (result->m_errorNumber == LDAP_SUCCESS && result->m_entries.IsEmpty())
+      result->m_errorNumber = LDAP_NO_RESULTS_RETURNED;
+
+    completed.push_back(std::make_pair(it->second, result));
+    m_pending.erase(it);
+  }
+}
+
+
+void PLDAPSessionPool::Connection::CheckTimeouts(PLDAPCompletedSearches & completed)
+{
+  PTimeInterval now = PTimer::Tick();
+
+  PendingMap::iterator it = m_pending.begin();
+  while (it != m_pending.end()) {
+    if (it->second->m_deadline > now)
+      ++it;
+    else {
+      ldap_abandon_ext(m_session.GetOpenLDAP(), it->first, NULL, NULL);
+      SearchResult * result = new SearchResult;
+      result->m_errorNumber = LDAP_TIMEOUT;
+      completed.push_back(std::make_pair(it->second, result));
+      m_pending.erase(it++);
+    }
+  }
+}
+
+
+void PLDAPSessionPool::Connection::FailAll(int errorNumber, PLDAPCompletedSearches & completed)
+{
+  for (PendingMap::iterator it = m_pending.begin(); it != m_pending.end(); ++it) {
+    SearchResult * result = new SearchResult;
+    result->m_errorNumber = errorNumber;
+    completed.push_back(std::make_pair(it->second, result));
+  }
+  m_pending.clear();
+}
+
+
+void PLDAPSessionPool::Connection::Deliver(PLDAPCompletedSearches & completed)
+{
+  for (PLDAPCompletedSearches::iterator it = completed.begin(); it != completed.end(); ++it) {
+    it->second->m_latency = PTimer::Tick() - it->first->m_start;
+    m_pool.OnSearchComplete(it->first->m_cacheKey, *it->second, it->first->m_notifier, it->first->m_userData);
+    delete it->second;
+    delete it->first;
+  }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+PLDAPSessionPool::SearchResult::SearchResult()
+  : m_errorNumber(LDAP_SUCCESS)
+  , m_cached(false)
+{
+}
+
+
+PLDAPSessionPool::PLDAPSessionPool(const PString & baseDN, unsigned size)
+  : defaultBaseDN(baseDN),
+    poolSize(size > 0 ? size : 1),
+    timeout(0, 30),
+    searchLimit(0),
+    port(0),
+    authMethod(PLDAPSession::AuthSimple),
+    cacheSize(0)
+{
+}
+
+
+PLDAPSessionPool::~PLDAPSessionPool()
+{
+  Close();
+}
+
+
+PBoolean PLDAPSessionPool::Open(const PString & srv,
+                                WORD prt,
+                                const PString & user,
+                                const PString & password,
+                                PLDAPSession::AuthenticationMethod method)
+{
+  Close();
+
+  server = srv;
+  port = prt;
+  who = user;
+  passwd = password;
+  authMethod = method;
+
+  PWaitAndSignal lock(connectionsMutex);
+
+  // Connections that fail now are retried by their thread
+  bool anyOpen = false;
+  for (unsigned i = 0; i < poolSize; i++) {
+    Connection * connection = new Connection(*this);
+    if (connection->Connect())
+      anyOpen = true;
+    connections.push_back(connection);
+    connection->Resume();
+  }
+
+  PTRACE_IF(2, !anyOpen, "LDAP\tPool could not open any connection to " << server);
+  return anyOpen;
+}
+
+
+void PLDAPSessionPool::Close()
+{
+  std::vector<Connection *> closing;
+  {
+    PWaitAndSignal lock(connectionsMutex);
+    closing.swap(connections);
+  }
+
+  for (size_t i = 0; i < closing.size(); i++)
+    delete closing[i];
+}
+
+
+PBoolean PLDAPSessionPool::IsOpen() const
+{
+  PWaitAndSignal lock(connectionsMutex);
+
+  for (size_t i = 0; i < connections.size(); i++) {
+    if (connections[i]->IsOpen())
+      return PTrue;
+  }
+  return PFalse;
+}
+
+
+PINDEX PLDAPSessionPool::GetOutstanding() const
+{
+  PWaitAndSignal lock(connectionsMutex);
+
+  PINDEX total = 0;
+  for (size_t i = 0; i < connections.size(); i++)
+    total += connections[i]->GetOutstanding();
+  return total;
+}
+
+
+static PList<PStringToString> CopyEntries(const PList<PStringToString> & entries)
+{
+  PList<PStringToString> copy;
+  for (PINDEX i = 0; i < entries.GetSize(); i++)
+    copy.Append(entries[i].Clone());
+  return copy;
+}
+
+
+PBoolean PLDAPSessionPool::Search(const PNotifier & notifier,
+                                  INT userData,
+                                  const PString & filter,
+                                  const PStringArray & attributes,
+                                  const PString & baseDN,
+                                  PLDAPSession::SearchScope scope)
+{
+  PString base = baseDN;
+  if (base.IsEmpty())
+    base = defaultBaseDN;
+
+  PString cacheKey;
+  if (cacheSize > 0) {
+    cacheKey = PString((int)scope) + '\n' + base + '\n' + filter;
+    for (PINDEX i = 0; i < attributes.GetSize(); i++)
+      cacheKey += '\n' + attributes[i];
+
+    SearchResult result;
+    {
+      PWaitAndSignal lock(cacheMutex);
+      CacheMap::iterator it = cache.find(cacheKey);
+      if (it != cache.end()) {
+        if (it->second.m_expiry > PTimer::Tick()) {
+          cacheOrder.splice(cacheOrder.begin(), cacheOrder, it->second.m_order);
+          result.m_errorNumber = it->second.m_errorNumber;
+          result.m_entries = CopyEntries(it->second.m_entries);
+          result.m_cached = true;
+        }
+        else {
+          cacheOrder.erase(it->second.m_order);
+          cache.erase(it);
+        }
+      }
+    }
+
+    if (result.m_cached) {
+      notifier(result, userData);
+      return PTrue;
+    }
+  }
+
+  PWaitAndSignal lock(connectionsMutex);
+
+  // Try the least busy connection first
+  std::vector<std::pair<PINDEX, Connection *> > order;
+  for (size_t i = 0; i < connections.size(); i++)
+    order.push_back(std::make_pair(connections[i]->GetOutstanding(), connections[i]));
+  std::sort(order.begin(), order.end());
+
+  PLDAPPendingSearch * search = new PLDAPPendingSearch;
+  search->m_notifier = notifier;
+  search->m_userData = userData;
+  search->m_cacheKey = cacheKey;
+  search->m_start = PTimer::Tick();
+  search->m_deadline = search->m_start + timeout;
+
+  for (size_t i = 0; i < order.size(); i++) {
+    if (order[i].second->Submit(search, filter, attributes, base, scope))
+      return PTrue;
+  }
+
+  delete search;
+  return PFalse;
+}
+
+
+class PLDAPSyncSearch : public PObject
+{
+    PCLASSINFO(PLDAPSyncSearch, PObject);
+  public:
+    PDECLARE_NOTIFIER(PObject, PLDAPSyncSearch, OnResult);
+
+    PSyncPoint             m_done;
+    PList<PStringToString> m_entries;
+};
+
+
+void PLDAPSyncSearch::OnResult(PObject & obj, INT)
+{
+  m_entries = ((PLDAPSessionPool::SearchResult &)obj).m_entries;
+  m_done.Signal();
+}
+
+
+PList<PStringToString> PLDAPSessionPool::Search(const PString & filter,
+                                                const PStringArray & attributes,
+                                                const PString & base,
+                                                PLDAPSession::SearchScope scope)
+{
+  PLDAPSyncSearch sync;
+  if (Search(PCREATE_NOTIFIER_EXT(&sync, PLDAPSyncSearch, OnResult), 0, filter, attributes, base, scope))
+    sync.m_done.Wait();
+  return sync.m_entries;
+}
+
+
+void PLDAPSessionPool::SetCache(PINDEX maxSearches, const PTimeInterval & timeToLive)
+{
+  PWaitAndSignal lock(cacheMutex);
+
+  cacheSize = maxSearches;
+  cacheTimeToLive = timeToLive;
+
+  while (cache.size() > (size_t)cacheSize) {
+    cache.erase(cacheOrder.back());
+    cacheOrder.pop_back();
+  }
+}
+
+
+void PLDAPSessionPool::FlushCache()
+{
+  PWaitAndSignal lock(cacheMutex);
+  cache.clear();
+  cacheOrder.clear();
+}
+
+
+void PLDAPSessionPool::OnSearchComplete(const PString & cacheKey,
+                                        SearchResult & result,
+                                        const PNotifier & notifier,
+                                        INT userData)
+{
+  // Only successful searches, including those finding nothing, are cached
+  if (!cacheKey.IsEmpty() &&
+      (result.m_errorNumber == LDAP_SUCCESS || result.m_errorNumber == LDAP_NO_RESULTS_RETURNED)) {
+    PWaitAndSignal lock(cacheMutex);
+    if (cacheSize > 0) {
+      CacheMap::iterator it = cache.find(cacheKey);
+      if (it != cache.end())
+        cacheOrder.erase(it->second.m_order);
+      else {
+        if (cache.size() >= (size_t)cacheSize) {
+          cache.erase(cacheOrder.back());
+          cacheOrder.pop_back();
+        }
+        it = cache.insert(CacheMap::value_type(cacheKey, CachedSearch())).first;
+      }
+
+      it->second.m_errorNumber = result.m_errorNumber;
+      it->second.m_entries = CopyEntries(result.m_entries);
+      it->second.m_expiry = PTimer::Tick() + cacheTimeToLive;
+      cacheOrder.push_front(cacheKey);
+      it->second.m_order = cacheOrder.begin();
+    }
+  }
+
+  if (!notifier.IsNULL())
+    notifier(result, userData);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 PLDAPAttributeBase::PLDAPAttributeBase(const char * n, void * ptr, PINDEX sz)
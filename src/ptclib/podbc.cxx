@@ -38,6 +38,9 @@
 
 #include <ptclib/podbc.h>
 
+#include <algorithm>
+#include <map>
+
 #define new PNEW
 
 
@@ -1141,6 +1144,669 @@ void PODBCStmt::GetLastError()
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+/// PODBCPreparedStmt
+
+PODBCPreparedStmt::Parameter::Parameter()
+  : m_cType(SQL_C_CHAR)
+  , m_sqlType(SQL_VARCHAR)
+  , m_integer(0)
+  , m_real(0)
+  , m_indicator(SQL_NULL_DATA)
+{
+}
+
+
+PODBCPreparedStmt::PODBCPreparedStmt(PODBC * odbc)
+  : PODBCStmt(odbc)
+  , m_batchRows(0)
+  , m_rowArraySize(100)
+  , m_rowsFetched(0)
+  , m_cursorOpen(false)
+  , m_columnsBound(false)
+{
+  if (IsValid()) {
+    // A forward only, read only cursor lets every driver fetch blocks of rows
+    SQLSetStmtAttr(m_hStmt, SQL_ATTR_CONCURRENCY, (SQLPOINTER)SQL_CONCUR_READ_ONLY, 0);
+    SQLSetStmtAttr(m_hStmt, SQL_ATTR_CURSOR_TYPE, (SQLPOINTER)SQL_CURSOR_FORWARD_ONLY, 0);
+  }
+}
+
+
+PODBCPreparedStmt::~PODBCPreparedStmt()
+{
+  CloseCursor();
+}
+
+
+PBoolean PODBCPreparedStmt::Prepare(const PString & sql)
+{
+  if (!IsValid())
+    return PFalse;
+
+  CloseCursor();
+  SQLFreeStmt(m_hStmt, SQL_UNBIND);
+  SQLFreeStmt(m_hStmt, SQL_RESET_PARAMS);
+  m_columns.clear();
+  m_columnsBound = false;
+  ClearParameters();
+
+  m_sql = sql;
+  return SQL_OK(SQLPrepare(m_hStmt, (SQLTCHAR *)(const char *)m_sql, SQL_NTS));
+}
+
+
+PODBCPreparedStmt::Parameter & PODBCPreparedStmt::GetParameter(PINDEX index)
+{
+  PAssert(index > 0, PInvalidParameter);
+  if (m_parameters.size() < (size_t)index)
+    m_parameters.resize(index);
+  return m_parameters[index-1];
+}
+
+
+void PODBCPreparedStmt::SetParameter(PINDEX index, const PString & value)
+{
+  Parameter & param = GetParameter(index);
+  param.m_cType = SQL_C_CHAR;
+  param.m_sqlType = SQL_VARCHAR;
+  param.m_string = value;
+  param.m_indicator = value.GetLength();
+}
+
+
+void PODBCPreparedStmt::SetParameter(PINDEX index, const char * value)
+{
+  if (value == NULL)
+    SetNull(index);
+  else
+    SetParameter(index, PString(value));
+}
+
+
+void PODBCPreparedStmt::SetParameter(PINDEX index, int value)
+{
+  // Always bound as a 64 bit C value, the driver converts it to the column
+  Parameter & param = GetParameter(index);
+  param.m_cType = SQL_C_SBIGINT;
+  param.m_sqlType = SQL_INTEGER;
+  param.m_integer = value;
+  param.m_indicator = 0;
+}
+
+
+void PODBCPreparedStmt::SetParameter(PINDEX index, PInt64 value)
+{
+  Parameter & param = GetParameter(index);
+  param.m_cType = SQL_C_SBIGINT;
+  param.m_sqlType = SQL_BIGINT;
+  param.m_integer = value;
+  param.m_indicator = 0;
+}
+
+
+void PODBCPreparedStmt::SetParameter(PINDEX index, double value)
+{
+  Parameter & param = GetParameter(index);
+  param.m_cType = SQL_C_DOUBLE;
+  param.m_sqlType = SQL_DOUBLE;
+  param.m_real = value;
+  param.m_indicator = 0;
+}
+
+
+void PODBCPreparedStmt::SetNull(PINDEX index)
+{
+  GetParameter(index).m_indicator = SQL_NULL_DATA;
+}
+
+
+void PODBCPreparedStmt::ClearParameters()
+{
+  m_parameters.clear();
+  m_batch.clear();
+  m_batchRows = 0;
+}
+
+
+PBoolean PODBCPreparedStmt::BindParameters()
+{
+  // Bound again on every execution as the vector may have moved
+  for (size_t i = 0; i < m_parameters.size(); ++i) {
+    Parameter & param = m_parameters[i];
+    SQLPOINTER value;
+    SQLULEN columnSize = 0;
+    SQLLEN bufferLength = 0;
+    switch (param.m_cType) {
+      case SQL_C_SBIGINT :
+        value = &param.m_integer;
+        break;
+      case SQL_C_DOUBLE :
+        value = &param.m_real;
+        break;
+      default :
+        value = (SQLPOINTER)(const char *)param.m_string;
+        bufferLength = param.m_string.GetLength();
+        columnSize = bufferLength > 0 ? bufferLength : 1;
+    }
+
+    if (!SQL_OK(SQLBindParameter(m_hStmt, (SQLUSMALLINT)(i+1), SQL_PARAM_INPUT,
+                                 param.m_cType, param.m_sqlType, columnSize, 0,
+                                 value, bufferLength, &param.m_indicator)))
+      return PFalse;
+  }
+
+  return PTrue;
+}
+
+
+void PODBCPreparedStmt::CloseCursor()
+{
+  if (m_cursorOpen) {
+    SQLFreeStmt(m_hStmt, SQL_CLOSE);
+    m_cursorOpen = false;
+  }
+  m_rowsFetched = 0;
+}
+
+
+PBoolean PODBCPreparedStmt::Execute()
+{
+  if (!IsValid())
+    return PFalse;
+
+  CloseCursor();
+
+  if (!BindParameters())
+    return PFalse;
+
+  SQLRETURN ret = SQLExecute(m_hStmt);
+  if (ret == SQL_NO_DATA) // Searched UPDATE or DELETE that matched no rows
+    return PTrue;
+
+  if (!SQL_OK(ret))
+    return PFalse;
+
+  m_cursorOpen = true;
+  return PTrue;
+}
+
+
+PBoolean PODBCPreparedStmt::AddBatch()
+{
+  if (m_batchRows > 0 && m_batch.size() != m_parameters.size()*m_batchRows) {
+    PTRACE(2, "ODBC\tBatch row has " << m_parameters.size() << " parameters,"
+              " expected " << m_batch.size()/m_batchRows);
+    return PFalse;
+  }
+
+  m_batch.insert(m_batch.end(), m_parameters.begin(), m_parameters.end());
+  ++m_batchRows;
+  return PTrue;
+}
+
+
+PBoolean PODBCPreparedStmt::ExecuteBatch()
+{
+  if (m_batchRows == 0)
+    return PTrue;
+
+  if (!IsValid())
+    return PFalse;
+
+  CloseCursor();
+
+  // Lay the rows out as one array per parameter, each element m_width bytes
+  PINDEX rows = m_batchRows;
+  size_t count = m_batch.size()/rows;
+  std::vector<BatchColumn> columns(count);
+
+  for (size_t c = 0; c < count; ++c) {
+    BatchColumn & column = columns[c];
+    column.m_cType = SQL_C_CHAR;
+    column.m_sqlType = SQL_VARCHAR;
+    column.m_width = 1;
+    column.m_indicators.resize(rows);
+
+    bool typed = false;
+    for (PINDEX r = 0; r < rows; ++r) {
+      const Parameter & param = m_batch[r*count + c];
+      column.m_indicators[r] = param.m_indicator;
+      if (param.m_indicator == SQL_NULL_DATA)
+        continue;
+      if (!typed) {
+        column.m_cType = param.m_cType;
+        column.m_sqlType = param.m_sqlType;
+        typed = true;
+      }
+      else if (param.m_cType != column.m_cType) {
+        PTRACE(2, "ODBC\tBatch parameter " << c+1 << " changed type in row " << r+1);
+        ClearParameters();
+        return PFalse;
+      }
+      if (param.m_cType == SQL_C_CHAR && column.m_width <= param.m_string.GetLength())
+        column.m_width = param.m_string.GetLength()+1;
+    }
+
+    if (column.m_cType == SQL_C_SBIGINT)
+      column.m_width = sizeof(PInt64);
+    else if (column.m_cType == SQL_C_DOUBLE)
+      column.m_width = sizeof(double);
+
+    BYTE * buffer = column.m_buffer.GetPointer(column.m_width*rows);
+    for (PINDEX r = 0; r < rows; ++r) {
+      const Parameter & param = m_batch[r*count + c];
+      if (param.m_indicator == SQL_NULL_DATA)
+        continue;
+      BYTE * element = buffer + r*column.m_width;
+      switch (column.m_cType) {
+        case SQL_C_SBIGINT :
+          memcpy(element, &param.m_integer, sizeof(PInt64));
+          break;
+        case SQL_C_DOUBLE :
+          memcpy(element, &param.m_real, sizeof(double));
+          break;
+        default :
+          memcpy(element, (const char *)param.m_string, param.m_string.GetLength());
+      }
+    }
+  }
+
+  SQLRETURN ret;
+  if (SQL_SUCCEEDED(SQLSetStmtAttr(m_hStmt, SQL_ATTR_PARAM_BIND_TYPE, (SQLPOINTER)SQL_PARAM_BIND_BY_COLUMN, 0)) &&
+      SQL_SUCCEEDED(SQLSetStmtAttr(m_hStmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)(SQLULEN)rows, 0))) {
+    ret = SQL_SUCCESS;
+    for (size_t c = 0; c < count && SQL_SUCCEEDED(ret); ++c) {
+      BatchColumn & column = columns[c];
+      ret = SQLBindParameter(m_hStmt, (SQLUSMALLINT)(c+1), SQL_PARAM_INPUT,
+                             column.m_cType, column.m_sqlType,
+                             column.m_cType == SQL_C_CHAR ? column.m_width-1 : 0, 0,
+                             column.m_buffer.GetPointer(), column.m_width, &column.m_indicators[0]);
+    }
+    if (SQL_SUCCEEDED(ret))
+      ret = SQLExecute(m_hStmt);
+    SQLFreeStmt(m_hStmt, SQL_CLOSE);
+    SQLSetStmtAttr(m_hStmt, SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER)1, 0);
+  }
+  else {
+    PTRACE(4, "ODBC\tDriver has no parameter arrays, executing " << rows << " rows singly");
+    ret = SQL_SUCCESS;
+    for (PINDEX r = 0; r < rows && (SQL_SUCCEEDED(ret) || ret == SQL_NO_DATA); ++r) {
+      ret = SQL_SUCCESS;
+      for (size_t c = 0; c < count && SQL_SUCCEEDED(ret); ++c) {
+        BatchColumn & column = columns[c];
+        ret = SQLBindParameter(m_hStmt, (SQLUSMALLINT)(c+1), SQL_PARAM_INPUT,
+                               column.m_cType, column.m_sqlType,
+                               column.m_cType == SQL_C_CHAR ? column.m_width-1 : 0, 0,
+                               column.m_buffer.GetPointer() + r*column.m_width, column.m_width,
+                               &column.m_indicators[r]);
+      }
+      if (SQL_SUCCEEDED(ret))
+        ret = SQLExecute(m_hStmt);
+      SQLFreeStmt(m_hStmt, SQL_CLOSE);
+    }
+  }
+
+  // The bindings point into the arrays about to be freed
+  SQLFreeStmt(m_hStmt, SQL_RESET_PARAMS);
+  m_batch.clear();
+  m_batchRows = 0;
+
+  return ret == SQL_NO_DATA || SQL_OK(ret);
+}
+
+
+void PODBCPreparedStmt::SetRowArraySize(PINDEX rows)
+{
+  if (rows < 1)
+    rows = 1;
+  if (rows != m_rowArraySize) {
+    CloseCursor();
+    m_rowArraySize = rows;
+    m_columnsBound = false;
+  }
+}
+
+
+PBoolean PODBCPreparedStmt::BindColumns()
+{
+  SQLSMALLINT count = 0;
+  if (!SQL_OK(SQLNumResultCols(m_hStmt, &count)))
+    return PFalse;
+
+  SQLFreeStmt(m_hStmt, SQL_UNBIND);
+  if (!SQL_OK(SQLSetStmtAttr(m_hStmt, SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER)SQL_BIND_BY_COLUMN, 0)) ||
+      !SQL_OK(SQLSetStmtAttr(m_hStmt, SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER)(SQLULEN)m_rowArraySize, 0)) ||
+      !SQL_OK(SQLSetStmtAttr(m_hStmt, SQL_ATTR_ROWS_FETCHED_PTR, &m_rowsFetched, 0)))
+    return PFalse;
+
+  SQLLEN maxWidth = (PODBCRecord::MaxCharSize > 0 ? PODBCRecord::MaxCharSize : 56)*1024;
+
+  // Sized before binding, the driver keeps pointers into each element
+  m_columns.clear();
+  m_columns.resize(count);
+
+  for (SQLSMALLINT c = 0; c < count; ++c) {
+    Column & column = m_columns[c];
+
+    SQLCHAR name[256];
+    SQLSMALLINT nameLength = 0, dataType = 0, decimals = 0, nullable = 0;
+    SQLULEN size = 0;
+    if (!SQL_OK(SQLDescribeCol(m_hStmt, (SQLUSMALLINT)(c+1), name, sizeof(name), &nameLength,
+                               &dataType, &size, &decimals, &nullable)))
+      return PFalse;
+    column.m_name = PString((const char *)name, std::min(nameLength, (SQLSMALLINT)(sizeof(name)-1)));
+
+    // Room for the text of any value: sign, point, exponent, date separators
+    SQLLEN width = (SQLLEN)size + 8;
+    if (width < 32)
+      width = 32;
+    if (size == 0 || width > maxWidth)
+      width = maxWidth;
+    column.m_width = width + 1;
+
+    column.m_indicators.resize(m_rowArraySize);
+    if (!SQL_OK(SQLBindCol(m_hStmt, (SQLUSMALLINT)(c+1), SQL_C_CHAR,
+                           column.m_buffer.GetPointer(column.m_width*m_rowArraySize),
+                           column.m_width, &column.m_indicators[0])))
+      return PFalse;
+  }
+
+  PTRACE(5, "ODBC\tBound " << count << " columns for blocks of " << m_rowArraySize << " rows");
+  return PTrue;
+}
+
+
+PINDEX PODBCPreparedStmt::FetchRows()
+{
+  if (!m_cursorOpen)
+    return 0;
+
+  if (!m_columnsBound) {
+    if (!BindColumns()) {
+      CloseCursor();
+      return 0;
+    }
+    m_columnsBound = true;
+  }
+
+  m_rowsFetched = 0;
+  SQLRETURN ret = SQLFetch(m_hStmt);
+  if (ret == SQL_NO_DATA || !SQL_OK(ret)) {
+    CloseCursor();
+    return 0;
+  }
+
+  return (PINDEX)m_rowsFetched;
+}
+
+
+PString PODBCPreparedStmt::GetColumnName(PINDEX column) const
+{
+  if (column < 1 || column > (PINDEX)m_columns.size())
+    return PString::Empty();
+  return m_columns[column-1].m_name;
+}
+
+
+PBoolean PODBCPreparedStmt::IsNull(PINDEX row, PINDEX column) const
+{
+  return GetValuePtr(row, column) == NULL;
+}
+
+
+PString PODBCPreparedStmt::GetValue(PINDEX row, PINDEX column) const
+{
+  return GetValuePtr(row, column);
+}
+
+
+const char * PODBCPreparedStmt::GetValuePtr(PINDEX row, PINDEX column) const
+{
+  if (row < 0 || (SQLULEN)row >= m_rowsFetched || column < 1 || column > (PINDEX)m_columns.size())
+    return NULL;
+
+  const Column & col = m_columns[column-1];
+  if (col.m_indicators[row] == SQL_NULL_DATA)
+    return NULL;
+
+  return (const char *)(const BYTE *)col.m_buffer + row*col.m_width;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// PODBCPool
+
+class PODBCPool::Connection : public PDSNConnection
+{
+    PCLASSINFO(Connection, PDSNConnection);
+  public:
+    Connection()
+      : m_connected(false)
+    {
+    }
+
+    ~Connection()
+    {
+      Reset();
+    }
+
+    PBoolean Open(const PODBCPool & pool)
+    {
+      Reset();
+      if (pool.m_source.IsEmpty())
+        m_connected = PODBC::Connect(pool.m_connectString) != PFalse;
+      else
+        m_connected = PDSNConnection::Connect(pool.m_source, pool.m_username, pool.m_password) != PFalse;
+
+      // A failed connect leaves the handles allocated
+      if (!m_connected)
+        Reset();
+
+      return m_connected;
+    }
+
+    void Reset()
+    {
+      for (StatementMap::iterator it = m_statements.begin(); it != m_statements.end(); ++it)
+        delete it->second;
+      m_statements.clear();
+
+      if (m_hDBC != NULL) {
+        if (m_connected)
+          SQLDisconnect(m_hDBC);
+        SQLFreeHandle(SQL_HANDLE_DBC, m_hDBC);
+        m_hDBC = NULL;
+      }
+      if (m_hEnv != NULL) {
+        SQLFreeHandle(SQL_HANDLE_ENV, m_hEnv);
+        m_hEnv = NULL;
+      }
+
+      m_connected = false;
+    }
+
+    bool IsAlive()
+    {
+      if (!m_connected || m_hDBC == NULL)
+        return false;
+
+      // Answered by the driver manager from the last call, no round trip
+      SQLUINTEGER dead = SQL_CD_TRUE;
+      if (!SQL_SUCCEEDED(SQLGetConnectAttr(m_hDBC, SQL_ATTR_CONNECTION_DEAD, &dead, 0, NULL))) {
+        PTRACE(3, "ODBC\tCould not get pooled connection state, assuming dead");
+        return false;
+      }
+
+      return dead == SQL_CD_FALSE;
+    }
+
+    virtual void OnSQLError(PString RetCode, PString RetString)
+    {
+      PTRACE(2, "ODBC\tError " << RetCode << ": " << RetString);
+    }
+
+    typedef std::map<PString, PODBCPreparedStmt *> StatementMap;
+    StatementMap m_statements;
+    bool         m_connected;
+};
+
+
+PODBCPool::PODBCPool(PINDEX size)
+  : m_size(size > 0 ? size : 1)
+  , m_available(0, m_size)
+{
+}
+
+
+PODBCPool::~PODBCPool()
+{
+  Close();
+}
+
+
+PBoolean PODBCPool::Open(const PString & connectString)
+{
+  Close();
+  m_connectString = connectString;
+  m_source.MakeEmpty();
+  return OpenConnections();
+}
+
+
+PBoolean PODBCPool::OpenDSN(const PString & source, const PString & username, const PString & password)
+{
+  Close();
+  m_source = source;
+  m_username = username;
+  m_password = password;
+  return OpenConnections();
+}
+
+
+PBoolean PODBCPool::OpenConnections()
+{
+  PINDEX opened = 0;
+  {
+    PWaitAndSignal lock(m_mutex);
+    for (PINDEX i = 0; i < m_size; ++i) {
+      Connection * connection = new Connection;
+      if (connection->Open(*this))
+        ++opened;
+      m_connections.push_back(connection);
+      m_idle.push_back(connection);
+    }
+  }
+
+  // Failed connections are still leased, and retried when they are
+  for (PINDEX i = 0; i < m_size; ++i)
+    m_available.Signal();
+
+  PTRACE(3, "ODBC\tOpened " << opened << " of " << m_size << " pooled connections");
+  return opened > 0;
+}
+
+
+void PODBCPool::Close()
+{
+  if (m_connections.empty())
+    return;
+
+  // Take every connection, so none is still leased
+  for (PINDEX i = 0; i < m_size; ++i)
+    m_available.Wait();
+
+  PWaitAndSignal lock(m_mutex);
+  for (size_t i = 0; i < m_connections.size(); ++i)
+    delete m_connections[i];
+  m_connections.clear();
+  m_idle.clear();
+}
+
+
+PODBCPool::Connection * PODBCPool::Acquire(const PTimeInterval & timeout)
+{
+  if (!m_available.Wait(timeout)) {
+    PTRACE(2, "ODBC\tTimeout waiting for a pooled connection");
+    return NULL;
+  }
+
+  Connection * connection;
+  {
+    PWaitAndSignal lock(m_mutex);
+    if (m_idle.empty()) {
+      m_available.Signal();
+      return NULL;
+    }
+    connection = m_idle.back();
+    m_idle.pop_back();
+  }
+
+  if (!connection->IsAlive()) {
+    PTRACE(3, "ODBC\tReconnecting pooled connection");
+    if (!connection->Open(*this)) {
+      Release(connection);
+      return NULL;
+    }
+  }
+
+  return connection;
+}
+
+
+void PODBCPool::Release(Connection * connection)
+{
+  {
+    PWaitAndSignal lock(m_mutex);
+    m_idle.push_back(connection);
+  }
+  m_available.Signal();
+}
+
+
+PODBCPool::Lease::Lease(PODBCPool & pool, const PTimeInterval & timeout)
+  : m_pool(pool)
+  , m_connection(pool.Acquire(timeout))
+{
+}
+
+
+PODBCPool::Lease::~Lease()
+{
+  if (m_connection != NULL)
+    m_pool.Release(m_connection);
+}
+
+
+PODBC & PODBCPool::Lease::operator*() const
+{
+  PAssert(m_connection != NULL, PNullPointerReference);
+  return *m_connection;
+}
+
+
+PODBCPreparedStmt * PODBCPool::Lease::Prepare(const PString & sql)
+{
+  if (m_connection == NULL)
+    return NULL;
+
+  Connection::StatementMap::iterator it = m_connection->m_statements.find(sql);
+  if (it != m_connection->m_statements.end()) {
+    it->second->ClearParameters();
+    return it->second;
+  }
+
+  PODBCPreparedStmt * stmt = new PODBCPreparedStmt(m_connection);
+  if (!stmt->Prepare(sql)) {
+    delete stmt;
+    return NULL;
+  }
+
+  m_connection->m_statements[sql] = stmt;
+  return stmt;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 /// PODBCRecord
 
@@ -71,7 +71,11 @@ PBoolean PVideoFile::Open(const PFilePath & name, PFile::OpenMode mode, int opts
   if ((pos = name.FindRegEx(fps)) != P_MAX_INDEX)
     m_fixedFrameRate = PVideoFrameInfo::SetFrameRate(name.Mid(pos+1).AsUnsigned());
 
-  return m_file.Open(name, mode, opts);
+  if (!m_file.Open(name, mode, opts))
+    return false;
+
+  m_file.Advise(PMemoryMappedFile::AdviseSequential);
+  return true;
 }
 
 
@@ -132,6 +132,9 @@ void PWAVFile::Construct()
   header_needs_updating   = PFalse;
   autoConvert             = PFalse;
   autoConverter           = NULL;
+  autoConvertSampleRate   = 0;
+  autoConvertChannels     = 0;
+  autoConvertQuality      = PAudioResampler::MediumQuality;
 
   formatHandler           = NULL;
   wavFmtChunk.hdr.len     = sizeof(wavFmtChunk) - sizeof(wavFmtChunk.hdr);
@@ -270,6 +273,14 @@ void PWAVFile::SetAutoconvert()
   autoConvert = PTrue; 
 }
 
+void PWAVFile::SetAutoconvert(unsigned sampleRate, unsigned channels, PAudioResampler::Quality quality)
+{
+  autoConvert           = PTrue;
+  autoConvertSampleRate = sampleRate;
+  autoConvertChannels   = channels;
+  autoConvertQuality    = quality;
+}
+
 
 // Performs necessary byte-order swapping on for big-endian platforms.
 PBoolean PWAVFile::Read(void * buf, PINDEX len)
@@ -515,6 +526,25 @@ static inline PBoolean NeedsConverter(const PWAV::FMTChunk & fmtChunk)
   return (fmtChunk.format != PWAVFile::fmt_PCM) || (fmtChunk.bitsPerSample != 16);
 }
 
+static inline bool NeedsResampler(const PWAV::FMTChunk & fmtChunk, unsigned sampleRate, unsigned channels)
+{
+  return sampleRate != 0 && channels != 0 &&
+         fmtChunk.format == PWAVFile::fmt_PCM &&
+         (fmtChunk.bitsPerSample == 8 || fmtChunk.bitsPerSample == 16) &&
+         (fmtChunk.sampleRate != sampleRate || fmtChunk.numChannels != channels);
+}
+
+static PWAVFileConverter * CreateResampleConverter(const PWAV::FMTChunk & fmtChunk,
+                                                   unsigned sampleRate,
+                                                   unsigned channels,
+                                                   PAudioResampler::Quality quality);
+
+bool PWAVFile::IsResampling() const
+{
+  return autoConverter != NULL && autoConvert &&
+         NeedsResampler(wavFmtChunk, autoConvertSampleRate, autoConvertChannels);
+}
+
 PBoolean PWAVFile::ProcessHeader() 
 {
   delete autoConverter;
@@ -601,7 +631,9 @@ PBoolean PWAVFile::ProcessHeader()
   lenData    = chunkHeader.len;
 
   // get ptr to data handler if in autoconvert mode
-  if (autoConvert && NeedsConverter(wavFmtChunk)) {
+  if (autoConvert && NeedsResampler(wavFmtChunk, autoConvertSampleRate, autoConvertChannels))
+    autoConverter = CreateResampleConverter(wavFmtChunk, autoConvertSampleRate, autoConvertChannels, autoConvertQuality);
+  else if (autoConvert && NeedsConverter(wavFmtChunk)) {
     autoConverter = PWAVFileConverterFactory::CreateInstance(wavFmtChunk.format);
     PTRACE_IF(1, autoConverter == NULL, "PWAVFile\tNo format converter for type " << (int)wavFmtChunk.format);
   }
@@ -691,7 +723,9 @@ PBoolean PWAVFile::GenerateHeader()
   lenHeader = PFile::GetPosition();
 
   // get pointer to auto converter 
-  if (autoConvert && NeedsConverter(wavFmtChunk)) {
+  if (autoConvert && NeedsResampler(wavFmtChunk, autoConvertSampleRate, autoConvertChannels))
+    autoConverter = CreateResampleConverter(wavFmtChunk, autoConvertSampleRate, autoConvertChannels, autoConvertQuality);
+  else if (autoConvert && NeedsConverter(wavFmtChunk)) {
     autoConverter = PWAVFileConverterFactory::CreateInstance(wavFmtChunk.format);
     if (autoConverter == NULL) {
       PTRACE(1, "PWAVFile\tNo format converter for type " << (int)wavFmtChunk.format);
@@ -1131,3 +1165,196 @@ PBoolean PWAVFileConverterPCM::Write(PWAVFile & file, const void * buf, PINDEX l
 PWAVFileConverterFactory::Worker<PWAVFileConverterPCM> pcmConverter(PWAVFile::fmt_PCM);
 
 //////////////////////////////////////////////////////////////////
+
+// Converts 8 or 16 bit PCM files to and from PCM-16 at another sample rate
+// and number of channels. Positions and lengths are in converted bytes.
+class PWAVFileConverterResample : public PWAVFileConverter
+{
+  public:
+    PWAVFileConverterResample(const PWAV::FMTChunk & fmtChunk,
+                              unsigned sampleRate,
+                              unsigned channels,
+                              PAudioResampler::Quality quality);
+    unsigned GetFormat    (const PWAVFile & file) const;
+    off_t GetPosition     (const PWAVFile & file) const;
+    PBoolean SetPosition      (PWAVFile & file, off_t pos, PFile::FilePositionOrigin origin);
+    unsigned GetSampleSize(const PWAVFile & file) const;
+    off_t GetDataLength   (PWAVFile & file);
+    PBoolean Read             (PWAVFile & file, void * buf, PINDEX len);
+    PBoolean Write            (PWAVFile & file, const void * buf, PINDEX len);
+
+  protected:
+    unsigned        m_fileRate;
+    unsigned        m_fileChannels;
+    unsigned        m_fileBytesPerSample;
+    unsigned        m_sampleRate;
+    unsigned        m_channels;
+    PAudioResampler m_reader;
+    PAudioResampler m_writer;
+    PBYTEArray      m_fileData;
+    PShortArray     m_samples;
+    PShortArray     m_converted;
+    PINDEX          m_convertedPosition;
+    PINDEX          m_convertedFrames;
+    bool            m_atEnd;
+    off_t           m_position;     // in converted frames
+};
+
+static PWAVFileConverter * CreateResampleConverter(const PWAV::FMTChunk & fmtChunk,
+                                                   unsigned sampleRate,
+                                                   unsigned channels,
+                                                   PAudioResampler::Quality quality)
+{
+  PTRACE(4, "PWAVFile\tConverting " << (unsigned)fmtChunk.sampleRate << "Hz x" << (unsigned)fmtChunk.numChannels
+         << " to " << sampleRate << "Hz x" << channels);
+  return new PWAVFileConverterResample(fmtChunk, sampleRate, channels, quality);
+}
+
+PWAVFileConverterResample::PWAVFileConverterResample(const PWAV::FMTChunk & fmtChunk,
+                                                     unsigned sampleRate,
+                                                     unsigned channels,
+                                                     PAudioResampler::Quality quality)
+  : m_fileRate(fmtChunk.sampleRate)
+  , m_fileChannels(fmtChunk.numChannels)
+  , m_fileBytesPerSample(fmtChunk.bitsPerSample/8)
+  , m_sampleRate(sampleRate)
+  , m_channels(channels)
+  , m_reader(m_fileRate, m_fileChannels, sampleRate, channels, quality)
+  , m_writer(sampleRate, channels, m_fileRate, m_fileChannels, quality)
+  , m_convertedPosition(0)
+  , m_convertedFrames(0)
+  , m_atEnd(false)
+  , m_position(0)
+{
+}
+
+unsigned PWAVFileConverterResample::GetFormat(const PWAVFile &) const
+{
+  return PWAVFile::fmt_PCM;
+}
+
+off_t PWAVFileConverterResample::GetPosition(const PWAVFile &) const
+{
+  return m_position * m_channels * 2;
+}
+
+PBoolean PWAVFileConverterResample::SetPosition(PWAVFile & file, off_t pos, PFile::FilePositionOrigin origin)
+{
+  off_t frames = pos / (m_channels * 2);
+  switch (origin) {
+    case PFile::Current :
+      frames += m_position;
+      break;
+    case PFile::End :
+      frames += GetDataLength(file) / (m_channels * 2);
+      break;
+    default :
+      break;
+  }
+  if (frames < 0)
+    frames = 0;
+
+  off_t fileFrames = (off_t)((PInt64)frames * m_fileRate / m_sampleRate);
+  if (!file.RawSetPosition(fileFrames * m_fileChannels * m_fileBytesPerSample, PFile::Start))
+    return PFalse;
+
+  m_reader.Reset();
+  m_writer.Reset();
+  m_convertedPosition = m_convertedFrames = 0;
+  m_atEnd = false;
+  m_position = (off_t)((PInt64)fileFrames * m_sampleRate / m_fileRate);
+  return PTrue;
+}
+
+unsigned PWAVFileConverterResample::GetSampleSize(const PWAVFile &) const
+{
+  return 16;
+}
+
+off_t PWAVFileConverterResample::GetDataLength(PWAVFile & file)
+{
+  PInt64 fileFrames = file.RawGetDataLength() / (m_fileChannels * m_fileBytesPerSample);
+  return (off_t)(fileFrames * m_sampleRate / m_fileRate) * m_channels * 2;
+}
+
+PBoolean PWAVFileConverterResample::Read(PWAVFile & file, void * buf, PINDEX len)
+{
+  PINDEX frameBytes = m_channels * sizeof(short);
+  PINDEX wanted = len / frameBytes;
+  short * output = (short *)buf;
+
+  PINDEX done = 0;
+  while (done < wanted) {
+    if (m_convertedPosition < m_convertedFrames) {
+      PINDEX count = std::min(wanted - done, m_convertedFrames - m_convertedPosition);
+      memcpy(output + done*m_channels, (const short *)m_converted + m_convertedPosition*m_channels, count*frameBytes);
+      done += count;
+      m_convertedPosition += count;
+      continue;
+    }
+
+    if (m_atEnd)
+      break;
+
+    // read about as many frames as the rest of the output needs
+    PINDEX fileFrameBytes = m_fileChannels * m_fileBytesPerSample;
+    PINDEX fileFrames = (PINDEX)((PInt64)(wanted - done) * m_fileRate / m_sampleRate) + 1;
+    if (!file.PWAVFile::RawRead(m_fileData.GetPointer(fileFrames*fileFrameBytes), fileFrames*fileFrameBytes) ||
+        (fileFrames = file.GetLastReadCount()/fileFrameBytes) == 0) {
+      // end of the data, so drain the filter
+      m_atEnd = true;
+      m_convertedFrames = m_reader.Flush(m_converted.GetPointer(m_reader.GetMaxOutputFrames(0)*m_channels));
+    }
+    else {
+      const short * samples = (const short *)(const BYTE *)m_fileData;
+      if (m_fileBytesPerSample == 1) {
+        PINDEX count = fileFrames * m_fileChannels;
+        short * pcmPtr = m_samples.GetPointer(count);
+        for (PINDEX i = 0; i < count; i++)
+          *pcmPtr++ = (unsigned short)((m_fileData[i] << 8) - 0x8000);
+        samples = m_samples;
+      }
+      m_convertedFrames = m_reader.Process(samples, fileFrames,
+                                           m_converted.GetPointer(m_reader.GetMaxOutputFrames(fileFrames)*m_channels));
+    }
+    m_convertedPosition = 0;
+  }
+
+  m_position += done;
+
+  // fake the lastReadCount
+  file.SetLastReadCount(done * frameBytes);
+
+  return done > 0;
+}
+
+PBoolean PWAVFileConverterResample::Write(PWAVFile & file, const void * buf, PINDEX len)
+{
+  PINDEX frames = len / (m_channels * sizeof(short));
+  PINDEX maxFrames = m_writer.GetMaxOutputFrames(frames);
+  short * samples = m_samples.GetPointer(maxFrames*m_fileChannels);
+  PINDEX count = m_writer.Process((const short *)buf, frames, samples) * m_fileChannels;
+
+  if (count > 0) {
+    PBoolean ok;
+    if (m_fileBytesPerSample == 1) {
+      BYTE * pcm8 = m_fileData.GetPointer(count);
+      for (PINDEX i = 0; i < count; i++)
+        pcm8[i] = (BYTE)((samples[i] >> 8) + 0x80);
+      ok = file.PWAVFile::RawWrite(pcm8, count);
+    }
+    else
+      ok = file.PWAVFile::RawWrite(samples, count * sizeof(short));
+    if (!ok)
+      return PFalse;
+  }
+
+  m_position += frames;
+
+  // fake the lastWriteCount
+  file.SetLastWriteCount(frames * m_channels * sizeof(short));
+
+  return PTrue;
+}
+
+//////////////////////////////////////////////////////////////////
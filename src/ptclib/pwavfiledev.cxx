@@ -85,7 +85,6 @@ PSoundChannel_WAVFile::PSoundChannel_WAVFile()
   : m_autoRepeat(false)
   , m_sampleRate(8000)
   , m_bufferSize(2)
-  , m_samplePosition(P_MAX_INDEX)
 {
 }
 
@@ -144,11 +143,23 @@ PBoolean PSoundChannel_WAVFile::Open(const PString & device,
     m_autoRepeat = true;
   }
 
+  // Files at other sample rates are resampled to the requested rate
+  m_WAVFile.SetAutoconvert(sampleRate, numChannels);
+
   if (!m_WAVFile.Open(adjustedDevice, PFile::ReadOnly)) {
     SetErrorValues(m_WAVFile.GetErrorCode(), m_WAVFile.GetErrorNumber());
     return false;
   }
 
+  // Only PCM is resampled, anything else would play at the wrong speed
+  if (m_WAVFile.GetSampleRate() != sampleRate && !m_WAVFile.IsResampling()) {
+    PTRACE(2, "WAVFileDev\tCannot play " << m_WAVFile.GetFormatString() << " file at "
+           << m_WAVFile.GetSampleRate() << "Hz as " << sampleRate << "Hz");
+    Close();
+    SetErrorValues(BadParameter, EINVAL);
+    return false;
+  }
+
   m_sampleRate = sampleRate;
 
   if (m_WAVFile.GetChannels() == numChannels &&
@@ -258,47 +269,12 @@ PBoolean PSoundChannel_WAVFile::Read(void * data, PINDEX size)
 {
   lastReadCount = 0;
 
-  unsigned wavSampleRate = m_WAVFile.GetSampleRate();
   if (m_sampleRate == 0)
     return false;
 
-  if (wavSampleRate < m_sampleRate) {
-    // File has less samples than we want, so we need to interpolate
-    unsigned iDutyCycle = m_sampleRate - wavSampleRate;
-    short iSample = 0;
-    short * pPCM = (short *)data;
-    for (PINDEX count = 0; count < size; count += sizeof(short)) {
-      iDutyCycle += wavSampleRate;
-      if (iDutyCycle >= m_sampleRate) {
-        iDutyCycle -= m_sampleRate;
-        if (!ReadSample(iSample))
-          return false;
-      }
-      *pPCM++ = iSample;
-      lastReadCount += sizeof(short);
-    }
-  }
-  else if (wavSampleRate > m_sampleRate) {
-    // File has more samples than we want, so we need to throw some away
-    unsigned iDutyCycle = 0;
-    short iSample;
-    short * pPCM = (short *)data;
-    for (PINDEX count = 0; count < size; count += sizeof(short)) {
-      do {
-        if (!ReadSample(iSample))
-          return false;
-        iDutyCycle += m_sampleRate;
-      } while (iDutyCycle < wavSampleRate);
-      iDutyCycle -= wavSampleRate;
-      *pPCM++ = iSample;
-      lastReadCount += sizeof(short);
-    }
-  }
-  else {
-    if (!ReadSamples(data, size))
-      return false;
-    lastReadCount = m_WAVFile.GetLastReadCount();
-  }
+  if (!ReadSamples(data, size))
+    return false;
+  lastReadCount = m_WAVFile.GetLastReadCount();
 
   if (m_WAVFile.GetSampleSize() == 0)
     return false;
@@ -308,20 +284,6 @@ PBoolean PSoundChannel_WAVFile::Read(void * data, PINDEX size)
 }
 
 
-bool PSoundChannel_WAVFile::ReadSample(short & sample)
-{
-  if (m_samplePosition >= m_sampleBuffer.GetSize()) {
-    static const PINDEX BufferSize = 10000;
-    if (!ReadSamples(m_sampleBuffer.GetPointer(BufferSize), BufferSize*sizeof(short)))
-      return false;
-    m_sampleBuffer.SetSize(m_WAVFile.GetLastReadCount()/sizeof(short));
-    m_samplePosition = 0;
-  }
-  sample = m_sampleBuffer[m_samplePosition++];
-  return true;
-}
-
-
 bool PSoundChannel_WAVFile::ReadSamples(void * data, PINDEX size)
 {
   if (m_WAVFile.Read(data, size))
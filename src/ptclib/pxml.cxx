@@ -38,6 +38,7 @@
 #endif
 
 #include <ptclib/pxml.h>
+#include <ptclib/memfile.h>
 
 #ifdef P_EXPAT
 
@@ -346,13 +347,22 @@ bool PXML::LoadFile(const PFilePath & fn, PXMLParser::Options options)
   loadFilename = fn;
   loadFromFile = true;
 
-  PFile file;
+  PMemoryMappedFile file;
   if (!file.Open(fn, PFile::ReadOnly)) {
     m_errorString << "File open error " << file.GetErrorText();
     return false;
   }
 
+  // Parse straight out of the mapped file if possible
+  if (file.IsMapped())
+    return InternalLoad((const char *)file.GetPointer(), file.GetLength());
+
   off_t len = file.GetLength();
+  if (len >= P_MAX_INDEX) {
+    m_errorString << "File too large to read";
+    return false;
+  }
+
   PString data;
   if (!file.Read(data.GetPointer(len + 1), len)) {
     m_errorString << "File read error " << file.GetErrorText();
@@ -361,13 +371,20 @@ bool PXML::LoadFile(const PFilePath & fn, PXMLParser::Options options)
 
   data[(PINDEX)len] = '\0';
 
-  return Load(data);
+  return InternalLoad(data, len);
 }
 
 
 bool PXML::Load(const PString & data, PXMLParser::Options options)
 {
   m_options = options;
+  return InternalLoad(data, data.GetLength());
+}
+
+
+bool PXML::InternalLoad(const char * data, off_t len)
+{
+  PXMLParser::Options options = (PXMLParser::Options)m_options;
   m_errorString.MakeEmpty();
   m_errorLine = m_errorColumn = 0;
 
@@ -376,8 +393,15 @@ bool PXML::Load(const PString & data, PXMLParser::Options options)
 
   {
     PXMLParser parser(options);
-    int done = 1;
-    stat = parser.Parse(data, data.GetLength(), done) != 0;
+
+    // The parser takes an int length, so feed very large files in pieces
+    static const off_t MaxParseBlock = 0x40000000;
+    do {
+      int block = (int)(len > MaxParseBlock ? MaxParseBlock : len);
+      len -= block;
+      stat = parser.Parse(data, block, len == 0);
+      data += block;
+    } while (stat && len > 0);
   
     if (!stat)
       parser.GetErrorInfo(m_errorString, m_errorColumn, m_errorLine);
@@ -35,51 +35,165 @@
 #include <ptlib.h>
 #include <ptclib/qchannel.h>
 
+#if defined(__GNUC__)
+  #define P_QUEUE_LOCK_FREE 1
+  #if defined(P_LINUX)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <limits.h>
+    #define P_QUEUE_FUTEX 1
+  #endif
+#endif
+
 
 #define new PNEW
 
 
-/////////////////////////////////////////////////////////
+/* The lock free modes need the GCC atomic builtins; without them the queue
+   always uses the mutex. A thread that has to wait for data or space flags
+   itself as waiting and checks again before sleeping on a sequence number.
+   The other side only bumps the sequence and makes the futex call when the
+   flag is set, so a queue that is neither empty nor full never enters the
+   kernel. */
+
+#if P_QUEUE_LOCK_FREE
 
-PQueueChannel::PQueueChannel(PINDEX size)
+static bool WaitForSequence(unsigned volatile & sequence,
+                            unsigned value,
+                            const PTimeInterval & timeout,
+                            const PTimeInterval & start,
+                            PSyncPoint & syncPoint)
 {
-  if (size > 0) {
-    queueBuffer = new BYTE[size];
-    os_handle = 1;
+  PTimeInterval remaining = timeout;
+  if (timeout != PMaxTimeInterval) {
+    remaining -= PTimer::Tick() - start;
+    if (remaining.GetMilliSeconds() <= 0)
+      return false;
   }
-  else {
-    queueBuffer = NULL;
-    os_handle = -1;
+
+#if P_QUEUE_FUTEX
+  struct timespec delay;
+  struct timespec * delayPtr = NULL;
+  if (remaining != PMaxTimeInterval) {
+    PInt64 milliseconds = remaining.GetMilliSeconds();
+    delay.tv_sec = (time_t)(milliseconds/1000);
+    delay.tv_nsec = (long)(milliseconds%1000)*1000000;
+    delayPtr = &delay;
   }
-  queueSize = size;
-  queueLength = enqueuePos = dequeuePos = 0;
+  syscall(SYS_futex, (unsigned *)&sequence, FUTEX_WAIT_PRIVATE, value, delayPtr, NULL, 0);
+  (void)syncPoint;
+#else
+  // The sync point wakes only one thread, so several waiting writers poll
+  if (__atomic_load_n(&sequence, __ATOMIC_ACQUIRE) == value)
+    syncPoint.Wait(remaining < 100 ? remaining : PTimeInterval(100));
+#endif
+
+  return true;
+}
+
+
+static void WakeSequence(unsigned volatile & waiting,
+                         unsigned volatile & sequence,
+                         PSyncPoint & syncPoint)
+{
+  __atomic_store_n(&waiting, 0U, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&sequence, 1U, __ATOMIC_RELEASE);
+
+#if P_QUEUE_FUTEX
+  syscall(SYS_futex, (unsigned *)&sequence, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  (void)syncPoint;
+#else
+  syncPoint.Signal();
+#endif
+}
+
+#endif // P_QUEUE_LOCK_FREE
+
+
+/////////////////////////////////////////////////////////
+
+PQueueChannel::PQueueChannel(PINDEX size, Mode mode)
+  : queueBuffer(NULL)
+  , queueSize(0)
+  , queueLength(0)
+  , enqueuePos(0)
+  , dequeuePos(0)
+  , mode(LockedMode)
+  , maxSize(0)
+  , ring(NULL)
+  , ringHead(0)
+  , ringReserved(0)
+  , writerTail(0)
+  , ringTail(0)
+  , readerHead(0)
+  , readWaiting(0)
+  , readSequence(0)
+  , writeWaiting(0)
+  , writeSequence(0)
+{
+  os_handle = -1;
+  if (size > 0)
+    Open(size, mode);
 }
 
 
 PQueueChannel::~PQueueChannel()
 {
   Close();
+  DeleteRings();
 }
 
 
 PBoolean PQueueChannel::Open(PINDEX size)
 {
-  if (size == 0)
+  return Open(size, mode, maxSize);
+}
+
+
+PBoolean PQueueChannel::Open(PINDEX size, Mode newMode, PINDEX newMaxSize)
+{
+  if (size == 0) {
     Close();
-  else {
-    mutex.Wait();
-    if (queueBuffer != NULL)
-      delete [] queueBuffer;
-    queueBuffer = new BYTE[size];
-    queueSize = size;
-    queueLength = enqueuePos = dequeuePos = 0;
-    os_handle = 1;
-    mutex.Signal();
+    return PTrue;
+  }
 
-    unempty.Signal();
-    unfull.Signal();
+  mutex.Wait();
+
+  if (queueBuffer != NULL)
+    delete [] queueBuffer;
+  queueBuffer = NULL;
+  DeleteRings();
+
+#if P_QUEUE_LOCK_FREE
+  mode = newMode;
+#else
+  mode = LockedMode;
+#endif
+  maxSize = newMaxSize;
+  queueSize = size;
+  queueLength = enqueuePos = dequeuePos = 0;
+
+  if (mode == LockedMode)
+    queueBuffer = new BYTE[size];
+  else {
+    size_t capacity = 1;
+    while (capacity < (size_t)size)
+      capacity *= 2;
+    ring = new Ring;
+    ring->data = new BYTE[capacity];
+    ring->mask = capacity-1;
+    ringHead = ringReserved = writerTail = ringTail = readerHead = 0;
+    readWaiting = writeWaiting = 0;
   }
 
+  os_handle = 1;
+  mutex.Signal();
+
+  PTRACE(5, "QChan\tOpened " << size << " byte queue, mode " << mode << ", maximum " << maxSize);
+
+  unempty.Signal();
+  unfull.Signal();
+
   return PTrue;
 }
 
@@ -95,13 +209,71 @@ PBoolean PQueueChannel::Close()
   queueBuffer = NULL;
   os_handle = -1;
   mutex.Signal();
+
+#if P_QUEUE_LOCK_FREE
+  // The ring is left for any thread still in Read() or Write(), and freed
+  // by Open() or the destructor.
+  if (mode != LockedMode) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    WakeSequence(readWaiting, readSequence, unempty);
+    WakeSequence(writeWaiting, writeSequence, unfull);
+  }
+#endif
+
   unempty.Signal();
   unfull.Signal();
   return PTrue;
 }
 
 
+void PQueueChannel::DeleteRings()
+{
+  if (ring != NULL) {
+    delete [] ring->data;
+    delete ring;
+    ring = NULL;
+  }
+
+  for (size_t i = 0; i < oldRings.size(); ++i) {
+    delete [] oldRings[i]->data;
+    delete oldRings[i];
+  }
+  oldRings.clear();
+}
+
+
+PINDEX PQueueChannel::GetLength() const
+{
+#if P_QUEUE_LOCK_FREE
+  if (mode != LockedMode) {
+    size_t tail = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+    return (PINDEX)(__atomic_load_n(&ringHead, __ATOMIC_ACQUIRE) - tail);
+  }
+#endif
+
+  return queueLength;
+}
+
+
 PBoolean PQueueChannel::Read(void * buf, PINDEX count)
+{
+  if (mode != LockedMode)
+    return RingRead(buf, count);
+
+  return LockedRead(buf, count);
+}
+
+
+PBoolean PQueueChannel::Write(const void * buf, PINDEX count)
+{
+  if (mode != LockedMode)
+    return RingWrite(buf, count);
+
+  return LockedWrite(buf, count);
+}
+
+
+PBoolean PQueueChannel::LockedRead(void * buf, PINDEX count)
 {
   mutex.Wait();
 
@@ -185,7 +357,7 @@ PBoolean PQueueChannel::Read(void * buf, PINDEX count)
 }
 
 
-PBoolean PQueueChannel::Write(const void * buf, PINDEX count)
+PBoolean PQueueChannel::LockedWrite(const void * buf, PINDEX count)
 {
   mutex.Wait();
 
@@ -199,9 +371,25 @@ PBoolean PQueueChannel::Write(const void * buf, PINDEX count)
   const BYTE * buffer = (BYTE *)buf;
 
   /* If queue is full then we should block for the time specifed in the
-      write timeout.
+      write timeout, unless it may grow.
     */
   while (queueLength == queueSize) {
+    if (queueSize < maxSize) {
+      PINDEX newSize = queueSize*2 < maxSize ? queueSize*2 : maxSize;
+      PTRACE(5, "QChan\tGrowing full queue to " << newSize << " bytes");
+
+      // Unwrap the queued data to the start of the new buffer
+      BYTE * grown = new BYTE[newSize];
+      memcpy(grown, queueBuffer+dequeuePos, queueSize-dequeuePos);
+      memcpy(grown+queueSize-dequeuePos, queueBuffer, dequeuePos);
+      delete [] queueBuffer;
+      queueBuffer = grown;
+      dequeuePos = 0;
+      enqueuePos = queueLength;
+      queueSize = newSize;
+      break;
+    }
+
     mutex.Signal();
 
     PTRACE_IF(6, writeTimeout > 0, "QChan\tBlocking on full queue");
@@ -263,4 +451,315 @@ PBoolean PQueueChannel::Write(const void * buf, PINDEX count)
 }
 
 
+#if P_QUEUE_LOCK_FREE
+
+PBoolean PQueueChannel::RingRead(void * buf, PINDEX count)
+{
+  lastReadCount = 0;
+
+  if (!IsOpen())
+    return PFalse;
+
+  PINDEX available = RingReadable(readTimeout);
+  if (available == 0) {
+    if (!IsOpen())
+      return SetErrorValues(Interrupted, EINTR, LastReadError);
+    PTRACE(6, "QChan\tRead timeout on empty queue");
+    return SetErrorValues(Timeout, EAGAIN, LastReadError);
+  }
+
+  if (count > available)
+    count = available;
+
+  // Copy out in up to two pieces, either side of the end of the ring
+  Ring * current = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+  size_t index = ringTail & current->mask;
+  size_t first = current->mask + 1 - index;
+  if (first > (size_t)count)
+    first = count;
+  memcpy(buf, current->data + index, first);
+  memcpy((BYTE *)buf + first, current->data, count - first);
+
+  lastReadCount = count;
+  ReadCommit(count);
+  return PTrue;
+}
+
+
+PBoolean PQueueChannel::RingWrite(const void * buf, PINDEX count)
+{
+  lastWriteCount = 0;
+
+  if (!IsOpen())
+    return PFalse;
+
+  const BYTE * buffer = (const BYTE *)buf;
+  while (count > 0) {
+    size_t position;
+    PINDEX len = RingReserve(count, position, writeTimeout);
+    if (len == 0) {
+      if (!IsOpen())
+        return SetErrorValues(Interrupted, EINTR, LastWriteError);
+      PTRACE(6, "QChan\tWrite timeout on full queue");
+      return SetErrorValues(Timeout, EAGAIN, LastWriteError);
+    }
+
+    Ring * current = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+    size_t index = position & current->mask;
+    size_t first = current->mask + 1 - index;
+    if (first > (size_t)len)
+      first = len;
+    memcpy(current->data + index, buffer, first);
+    memcpy(current->data, buffer + first, len - first);
+
+    RingCommit(position, len);
+    lastWriteCount += len;
+    buffer += len;
+    count -= len;
+  }
+
+  return PTrue;
+}
+
+
+PINDEX PQueueChannel::RingReadable(const PTimeInterval & timeout)
+{
+  // Only go to the shared head when the last copy of it is used up
+  if (readerHead != ringTail)
+    return (PINDEX)(readerHead - ringTail);
+
+  readerHead = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+  if (readerHead != ringTail)
+    return (PINDEX)(readerHead - ringTail);
+
+  PTRACE_IF(6, timeout > 0, "QChan\tBlocking on empty queue");
+
+  PTimeInterval start = PTimer::Tick();
+  for (;;) {
+    if (!IsOpen())
+      return 0;
+
+    unsigned sequence = __atomic_load_n(&readSequence, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&readWaiting, 1U, __ATOMIC_SEQ_CST);
+
+    readerHead = __atomic_load_n(&ringHead, __ATOMIC_SEQ_CST);
+    if (readerHead != ringTail)
+      return (PINDEX)(readerHead - ringTail);
+
+    if (!IsOpen() || !WaitForSequence(readSequence, sequence, timeout, start, unempty))
+      return 0;
+  }
+}
+
+
+PINDEX PQueueChannel::RingSpace(PINDEX count, size_t & position)
+{
+  if (mode == SingleProducerMode) {
+    // Only go to the shared tail when the last copy of it shows too little
+    PINDEX space = queueSize - (PINDEX)(ringHead - writerTail);
+    if (space < count) {
+      writerTail = __atomic_load_n(&ringTail, __ATOMIC_SEQ_CST);
+      space = queueSize - (PINDEX)(ringHead - writerTail);
+    }
+    position = ringHead;
+    return space < count ? space : count;
+  }
+
+  // Each writer reserves all the space it needs, up to the whole queue, so
+  // the data from one Write() is not split up by other writers.
+  PINDEX needed = count < queueSize ? count : queueSize;
+  for (;;) {
+    // The tail is loaded first so that it is never past the reserved end
+    size_t tail = __atomic_load_n(&ringTail, __ATOMIC_SEQ_CST);
+    size_t reserved = __atomic_load_n(&ringReserved, __ATOMIC_RELAXED);
+    if (queueSize - (PINDEX)(reserved - tail) < needed)
+      return 0;
+    if (__atomic_compare_exchange_n(&ringReserved, &reserved, reserved + needed,
+                                    true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      position = reserved;
+      return needed;
+    }
+  }
+}
+
+
+PINDEX PQueueChannel::RingReserve(PINDEX count, size_t & position, const PTimeInterval & timeout)
+{
+  PINDEX space = RingSpace(count, position);
+  if (space > 0)
+    return space;
+
+  PTRACE_IF(6, timeout > 0, "QChan\tBlocking on full queue");
+
+  PTimeInterval start = PTimer::Tick();
+  for (;;) {
+    if (!IsOpen())
+      return 0;
+
+    if (RingGrow()) {
+      if ((space = RingSpace(count, position)) > 0)
+        return space;
+      continue;
+    }
+
+    unsigned sequence = __atomic_load_n(&writeSequence, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&writeWaiting, 1U, __ATOMIC_SEQ_CST);
+
+    if ((space = RingSpace(count, position)) > 0)
+      return space;
+
+    if (!IsOpen() || !WaitForSequence(writeSequence, sequence, timeout, start, unfull))
+      return 0;
+  }
+}
+
+
+void PQueueChannel::RingCommit(size_t position, PINDEX len)
+{
+  // Writers publish in the order they reserved, so wait for any earlier
+  // reservation still being copied into.
+  if (mode == MultiProducerMode) {
+    unsigned spins = 0;
+    while (__atomic_load_n(&ringHead, __ATOMIC_ACQUIRE) != position) {
+      if (++spins > 100)
+        PThread::Yield();
+    }
+  }
+
+  // Sequentially consistent, so a reader flagging itself as waiting either
+  // sees the new head or is seen to be waiting; cheaper than a fence.
+  __atomic_store_n(&ringHead, position + len, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&readWaiting, __ATOMIC_SEQ_CST) != 0) {
+    PTRACE(6, "QChan\tSignalling queue no longer empty");
+    WakeSequence(readWaiting, readSequence, unempty);
+  }
+}
+
+
+bool PQueueChannel::RingGrow()
+{
+  if (mode != SingleProducerMode || queueSize >= maxSize)
+    return false;
+
+  PINDEX newSize = queueSize*2 < maxSize ? queueSize*2 : maxSize;
+  PTRACE(5, "QChan\tGrowing full queue to " << newSize << " bytes");
+
+  Ring * current = ring;
+  if ((size_t)newSize > current->mask + 1) {
+    size_t capacity = current->mask + 1;
+    while (capacity < (size_t)newSize)
+      capacity *= 2;
+
+    Ring * grown = new Ring;
+    grown->data = new BYTE[capacity];
+    grown->mask = capacity - 1;
+
+    // Copy the queued data to the same positions in the new ring. The
+    // reader may still be reading from the old one, which is kept until the
+    // queue is reopened, but gets the new one with any data written after.
+    size_t tail = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+    for (size_t position = tail; position != ringHead; ++position)
+      grown->data[position & grown->mask] = current->data[position & current->mask];
+
+    oldRings.push_back(current);
+    __atomic_store_n(&ring, grown, __ATOMIC_RELEASE);
+  }
+
+  queueSize = newSize;
+  return true;
+}
+
+
+PINDEX PQueueChannel::ReadPeek(const BYTE * & data, const PTimeInterval & timeout)
+{
+  if (mode == LockedMode || !IsOpen())
+    return 0;
+
+  PINDEX available = RingReadable(timeout);
+  if (available == 0)
+    return 0;
+
+  Ring * current = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+  size_t index = ringTail & current->mask;
+  data = current->data + index;
+  return (size_t)available < current->mask + 1 - index ? available : (PINDEX)(current->mask + 1 - index);
+}
+
+
+void PQueueChannel::ReadCommit(PINDEX len)
+{
+  if (mode == LockedMode || len <= 0)
+    return;
+
+  __atomic_store_n(&ringTail, ringTail + len, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&writeWaiting, __ATOMIC_SEQ_CST) != 0) {
+    PTRACE(6, "QChan\tSignalling queue no longer full");
+    WakeSequence(writeWaiting, writeSequence, unfull);
+  }
+}
+
+
+PINDEX PQueueChannel::WritePeek(BYTE * & data, const PTimeInterval & timeout)
+{
+  if (mode != SingleProducerMode || !IsOpen())
+    return 0;
+
+  size_t position;
+  PINDEX space = RingReserve(P_MAX_INDEX, position, timeout);
+  if (space == 0)
+    return 0;
+
+  Ring * current = ring;
+  size_t index = position & current->mask;
+  data = current->data + index;
+  return (size_t)space < current->mask + 1 - index ? space : (PINDEX)(current->mask + 1 - index);
+}
+
+
+void PQueueChannel::WriteCommit(PINDEX len)
+{
+  if (mode != SingleProducerMode || len <= 0)
+    return;
+
+  RingCommit(ringHead, len);
+}
+
+#else // P_QUEUE_LOCK_FREE
+
+PBoolean PQueueChannel::RingRead(void * buf, PINDEX count)
+{
+  return LockedRead(buf, count);
+}
+
+
+PBoolean PQueueChannel::RingWrite(const void * buf, PINDEX count)
+{
+  return LockedWrite(buf, count);
+}
+
+
+PINDEX PQueueChannel::ReadPeek(const BYTE * &, const PTimeInterval &)
+{
+  return 0;
+}
+
+
+void PQueueChannel::ReadCommit(PINDEX)
+{
+}
+
+
+PINDEX PQueueChannel::WritePeek(BYTE * &, const PTimeInterval &)
+{
+  return 0;
+}
+
+
+void PQueueChannel::WriteCommit(PINDEX)
+{
+}
+
+#endif // P_QUEUE_LOCK_FREE
+
+
 // End of File ///////////////////////////////////////////////////////////////
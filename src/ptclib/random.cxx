@@ -38,6 +38,10 @@
 #include <ptlib.h>
 #include <ptclib/random.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -45,7 +49,7 @@
 
 PRandom::PRandom()
 {
-  SetSeed(PTimer::Tick().GetInterval());
+  SetSeed();
 }
 
 
@@ -68,7 +72,69 @@ PRandom::PRandom(DWORD seed)
 }
 
 
+static bool GetSystemEntropy(void * buffer, size_t length)
+{
+  BYTE * ptr = (BYTE *)buffer;
+
+#if defined(SYS_getrandom)
+  while (length > 0) {
+    long result = syscall(SYS_getrandom, ptr, length, 0);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    ptr += result;
+    length -= result;
+  }
+  if (length == 0)
+    return true;
+#endif
+
+#ifndef _WIN32
+  int fd = ::open("/dev/urandom", O_RDONLY);
+  if (fd >= 0) {
+    while (length > 0) {
+      ssize_t result = ::read(fd, ptr, length);
+      if (result <= 0) {
+        if (result < 0 && errno == EINTR)
+          continue;
+        break;
+      }
+      ptr += result;
+      length -= result;
+    }
+    ::close(fd);
+  }
+#endif
+
+  return length == 0;
+}
+
+
+void PRandom::SetSeed()
+{
+  if (!GetSystemEntropy(randrsl, sizeof(randrsl))) {
+    // Include our address so generators created in the same tick differ
+    DWORD seed = (DWORD)PTimer::Tick().GetInterval() ^ (DWORD)(size_t)this;
+    for (PINDEX i = 0; i < RandSize; i++)
+      randrsl[i] = seed++;
+  }
+
+  Initialise();
+}
+
+
 void PRandom::SetSeed(DWORD seed)
+{
+  for (PINDEX i = 0; i < RandSize; i++)
+    randrsl[i] = seed++;
+
+  Initialise();
+}
+
+
+void PRandom::Initialise()
 {
    int i;
    DWORD a,b,c,d,e,f,g,h;
@@ -77,9 +143,6 @@ void PRandom::SetSeed(DWORD seed)
    m=randmem;
    r=randrsl;
 
-   for (i=0; i<RandSize; i++)
-     r[i] = seed++;
-
    a=b=c=d=e=f=g=h=0x9e3779b9;  /* the golden ratio */
 
    for (i=0; i<4; ++i)          /* scramble it */
@@ -107,9 +170,7 @@ void PRandom::SetSeed(DWORD seed)
      m[i+4]=e; m[i+5]=f; m[i+6]=g; m[i+7]=h;
    }
 
-   randcnt=0;
-   Generate();            /* fill in the first set of results */
-   randcnt=RandSize;  /* prepare to use the first set of results */
+   Isaac();            /* fill in the first set of results */
 }
 
 
@@ -129,38 +190,72 @@ static unsigned redistribute(unsigned value, unsigned minimum, unsigned maximum)
   if (minimum >= maximum)
     return maximum;
   unsigned range = maximum - minimum;
+  if (range == 1)
+    return (value & 1) + minimum; // Loop below never terminates for one
   while (value > range)
     value = (value/range) ^ (value%range);
   return value + minimum;
 }
 
 
+void PRandom::Isaac()
+{
+  DWORD a,b,x,y,*m,*mm,*m2,*r,*mend;
+  mm=randmem; r=randrsl;
+  a = randa; b = randb + (++randc);
+  for (m = mm, mend = m2 = m+(RandSize/2); m<mend; )
+  {
+    rngstep( a<<13, a, b, mm, m, m2, r, x);
+    rngstep( a>>6 , a, b, mm, m, m2, r, x);
+    rngstep( a<<2 , a, b, mm, m, m2, r, x);
+    rngstep( a>>16, a, b, mm, m, m2, r, x);
+  }
+  for (m2 = mm; m2<mend; )
+  {
+    rngstep( a<<13, a, b, mm, m, m2, r, x);
+    rngstep( a>>6 , a, b, mm, m, m2, r, x);
+    rngstep( a<<2 , a, b, mm, m, m2, r, x);
+    rngstep( a>>16, a, b, mm, m, m2, r, x);
+  }
+  randb = b; randa = a;
+
+  randcnt = RandSize;
+}
+
+
 unsigned PRandom::Generate()
 {
-  if (randcnt-- == 0) {
-    DWORD a,b,x,y,*m,*mm,*m2,*r,*mend;
-    mm=randmem; r=randrsl;
-    a = randa; b = randb + (++randc);
-    for (m = mm, mend = m2 = m+(RandSize/2); m<mend; )
-    {
-      rngstep( a<<13, a, b, mm, m, m2, r, x);
-      rngstep( a>>6 , a, b, mm, m, m2, r, x);
-      rngstep( a<<2 , a, b, mm, m, m2, r, x);
-      rngstep( a>>16, a, b, mm, m, m2, r, x);
-    }
-    for (m2 = mm; m2<mend; )
-    {
-      rngstep( a<<13, a, b, mm, m, m2, r, x);
-      rngstep( a>>6 , a, b, mm, m, m2, r, x);
-      rngstep( a<<2 , a, b, mm, m, m2, r, x);
-      rngstep( a>>16, a, b, mm, m, m2, r, x);
-    }
-    randb = b; randa = a;
+  if (randcnt == 0)
+    Isaac();
 
-    randcnt = RandSize-1;
+  return randrsl[--randcnt];
+}
+
+
+void PRandom::GenerateBytes(void * buffer, PINDEX length)
+{
+  BYTE * ptr = (BYTE *)buffer;
+
+  while (length >= (PINDEX)sizeof(DWORD)) {
+    if (randcnt == 0)
+      Isaac();
+
+    PINDEX count = length/sizeof(DWORD);
+    if (count > (PINDEX)randcnt)
+      count = randcnt;
+    length -= count*sizeof(DWORD);
+
+    // Same order as successive Generate() calls
+    while (count-- > 0) {
+      memcpy(ptr, &randrsl[--randcnt], sizeof(DWORD));
+      ptr += sizeof(DWORD);
+    }
   }
 
-  return randrsl[randcnt];
+  if (length > 0) {
+    DWORD last = Generate();
+    memcpy(ptr, &last, length);
+  }
 }
 
 
@@ -176,15 +271,66 @@ unsigned PRandom::Generate(unsigned minimum, unsigned maximum)
 }
 
 
-unsigned PRandom::Number()
+#if defined(P_PTHREADS)
+
+/* Each thread has its own generator, created on first use and freed when
+   the thread exits. It is allocated outside the memory checking heap, as the
+   main thread's generator is never freed. */
+static pthread_key_t ThreadRandomKey;
+static pthread_once_t ThreadRandomOnce = PTHREAD_ONCE_INIT;
+
+static void DestroyThreadRandom(void * ptr)
+{
+  runtime_free(ptr);
+}
+
+
+static void CreateThreadRandomKey()
+{
+  pthread_key_create(&ThreadRandomKey, DestroyThreadRandom);
+}
+
+
+static PRandom & GetThreadRandom()
+{
+  pthread_once(&ThreadRandomOnce, CreateThreadRandomKey);
+
+  PRandom * rand = (PRandom *)pthread_getspecific(ThreadRandomKey);
+  if (rand == NULL) {
+    rand = new (PAssertNULL(runtime_malloc(sizeof(PRandom)))) PRandom;
+    pthread_setspecific(ThreadRandomKey, rand);
+  }
+  return *rand;
+}
+
+#define P_RANDOM_LOCK()
+
+#else
+
+static PMutex & GetRandomMutex()
 {
   static PMutex mutex;
-  PWaitAndSignal wait(mutex);
+  return mutex;
+}
 
+
+static PRandom & GetThreadRandom()
+{
   static PRandom rand;
   return rand;
 }
 
+#define P_RANDOM_LOCK() PWaitAndSignal wait(GetRandomMutex())
+
+#endif
+
+
+unsigned PRandom::Number()
+{
+  P_RANDOM_LOCK();
+  return GetThreadRandom().Generate();
+}
+
 unsigned int PRandom::Number(unsigned maximum)
 {
   return redistribute(Number(), 0, maximum);
@@ -197,4 +343,11 @@ unsigned int PRandom::Number(unsigned minimum, unsigned maximum)
 }
 
 
+void PRandom::Fill(void * buffer, PINDEX length)
+{
+  P_RANDOM_LOCK();
+  GetThreadRandom().GenerateBytes(buffer, length);
+}
+
+
 // End Of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,544 @@
+/*
+ * resample.cxx
+ *
+ * Sample rate and channel conversion of PCM-16 audio.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifdef __GNUC__
+#pragma implementation "resample.h"
+#endif
+
+#include <ptlib.h>
+#include <ptclib/resample.h>
+
+#include <math.h>
+
+
+/* The dot products of the filter are done on GCC vectors, four wide for
+   the baseline instruction set and eight wide, with FMA, for AVX2 which is
+   selected at run time. Other compilers use the scalar loop. */
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+  #define P_RESAMPLE_VECTORS 1
+  #define P_RESAMPLE_INLINE inline __attribute__((always_inline))
+  typedef float PResampleFloats4 __attribute__((vector_size(16)));
+  typedef float PResampleFloats8 __attribute__((vector_size(32)));
+#else
+  #define P_RESAMPLE_VECTORS 0
+  #define P_RESAMPLE_INLINE inline
+#endif
+
+#if P_RESAMPLE_VECTORS && (defined(__x86_64__) || defined(__i386__))
+  #define P_RESAMPLE_AVX2 1
+#else
+  #define P_RESAMPLE_AVX2 0
+#endif
+
+
+// Taps are a multiple of this, so whole vectors are always loaded
+static const unsigned TapAlignment = 16;
+
+// Beyond this many phases the nearest lower phase is used
+static const unsigned MaxPhases = 1024;
+
+/* The window shape sets the stopband attenuation, and with it and the
+   length of the filter, the width of the transition band. */
+static const struct {
+  unsigned m_taps;      // Filter length in input frames at or above unity ratio
+  double   m_beta;      // Kaiser window shape
+} QualityParameters[PAudioResampler::NumQualities] = {
+  {  16,  4.6 },
+  {  48,  7.3 },
+  { 128, 10.0 }
+};
+
+
+static unsigned GreatestCommonDivisor(unsigned a, unsigned b)
+{
+  while (b != 0) {
+    unsigned t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+
+// Zeroth order modified Bessel function of the first kind
+static double BesselI0(double x)
+{
+  double sum = 1, term = 1;
+  for (int k = 1; k < 50 && term > sum*1e-12; ++k) {
+    term *= (x/(2*k))*(x/(2*k));
+    sum += term;
+  }
+  return sum;
+}
+
+
+static P_RESAMPLE_INLINE short SaturateSample(float sample)
+{
+  if (sample >= 32767)
+    return 32767;
+  if (sample <= -32768)
+    return -32768;
+  return (short)(int)(sample < 0 ? sample - 0.5f : sample + 0.5f);
+}
+
+
+#if P_RESAMPLE_VECTORS
+
+static P_RESAMPLE_INLINE float HorizontalSum(PResampleFloats4 v)
+{
+  return (v[0] + v[2]) + (v[1] + v[3]);
+}
+
+
+static P_RESAMPLE_INLINE float HorizontalSum(PResampleFloats8 v)
+{
+  PResampleFloats4 low, high;
+  memcpy(&low, &v, sizeof(low));
+  memcpy(&high, (const char *)&v + sizeof(low), sizeof(high));
+  return HorizontalSum(low + high);
+}
+
+
+template <typename V>
+static P_RESAMPLE_INLINE float DotProduct(const float * x, const float * h, unsigned taps)
+{
+  static const unsigned Width = sizeof(V)/sizeof(float);
+
+  V sum0 = { 0 }, sum1 = { 0 };
+  for (unsigned i = 0; i < taps; i += 2*Width) {
+    V x0, x1, h0, h1;
+    memcpy(&x0, x+i, sizeof(V));
+    memcpy(&x1, x+i+Width, sizeof(V));
+    memcpy(&h0, h+i, sizeof(V));
+    memcpy(&h1, h+i+Width, sizeof(V));
+    sum0 += x0*h0;
+    sum1 += x1*h1;
+  }
+  return HorizontalSum(sum0 + sum1);
+}
+
+#else
+
+template <typename V>
+static P_RESAMPLE_INLINE float DotProduct(const float * x, const float * h, unsigned taps)
+{
+  float sum0 = 0, sum1 = 0;
+  for (unsigned i = 0; i < taps; i += 2) {
+    sum0 += x[i]*h[i];
+    sum1 += x[i+1]*h[i+1];
+  }
+  return sum0 + sum1;
+}
+
+typedef float PResampleFloats4;
+
+#endif // P_RESAMPLE_VECTORS
+
+
+/* Offsets hold the first history frame and the phase of each output frame,
+   one after the other. */
+template <typename V>
+static P_RESAMPLE_INLINE void FilterFrames(const float * history, const float * filter, unsigned taps,
+                                           const unsigned * offsets, PINDEX frames,
+                                           short * output, unsigned stride)
+{
+  for (PINDEX i = 0; i < frames; ++i) {
+    *output = SaturateSample(DotProduct<V>(history + offsets[0], filter + offsets[1]*taps, taps));
+    output += stride;
+    offsets += 2;
+  }
+}
+
+
+static void FilterFramesGeneric(const float * history, const float * filter, unsigned taps,
+                                const unsigned * offsets, PINDEX frames,
+                                short * output, unsigned stride)
+{
+  FilterFrames<PResampleFloats4>(history, filter, taps, offsets, frames, output, stride);
+}
+
+
+#if P_RESAMPLE_AVX2
+
+__attribute__((target("avx2,fma")))
+static void FilterFramesAVX2(const float * history, const float * filter, unsigned taps,
+                             const unsigned * offsets, PINDEX frames,
+                             short * output, unsigned stride)
+{
+  FilterFrames<PResampleFloats8>(history, filter, taps, offsets, frames, output, stride);
+}
+
+#endif
+
+
+typedef void (*FilterFramesFunction)(const float *, const float *, unsigned, const unsigned *, PINDEX, short *, unsigned);
+
+static FilterFramesFunction GetFilterFrames()
+{
+#if P_RESAMPLE_AVX2
+  static FilterFramesFunction function = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+                                                     ? FilterFramesAVX2 : FilterFramesGeneric;
+  return function;
+#else
+  return FilterFramesGeneric;
+#endif
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PAudioResampler
+
+PAudioResampler::PAudioResampler(unsigned inputRate,
+                                 unsigned inputChannels,
+                                 unsigned outputRate,
+                                 unsigned outputChannels,
+                                 Quality quality)
+  : m_inputRate(8000)
+  , m_inputChannels(1)
+  , m_outputRate(8000)
+  , m_outputChannels(1)
+  , m_quality(quality)
+  , m_interpolation(1)
+  , m_decimation(1)
+  , m_phases(1)
+  , m_taps(0)
+  , m_mixedChannels(1)
+  , m_historyFrames(0)
+  , m_position(0)
+  , m_remainder(0)
+  , m_totalInput(0)
+  , m_totalOutput(0)
+{
+  if (!Open(inputRate, inputChannels, outputRate, outputChannels, quality))
+    Open(8000, 1, 8000, 1, quality);
+}
+
+
+bool PAudioResampler::Open(unsigned inputRate,
+                           unsigned inputChannels,
+                           unsigned outputRate,
+                           unsigned outputChannels,
+                           Quality quality)
+{
+  if (inputRate == 0 || inputChannels == 0 || outputRate == 0 || outputChannels == 0) {
+    PTRACE(2, "Resample\tInvalid conversion " << inputRate << "Hz x" << inputChannels
+           << " to " << outputRate << "Hz x" << outputChannels);
+    return false;
+  }
+
+  m_inputRate = inputRate;
+  m_inputChannels = inputChannels;
+  m_outputRate = outputRate;
+  m_outputChannels = outputChannels;
+  m_quality = quality >= FastQuality && quality < NumQualities ? quality : MediumQuality;
+  m_mixedChannels = std::min(inputChannels, outputChannels);
+
+  unsigned divisor = GreatestCommonDivisor(inputRate, outputRate);
+  m_interpolation = outputRate/divisor;
+  m_decimation = inputRate/divisor;
+
+  BuildFilter();
+  Reset();
+
+  PTRACE(4, "Resample\tConverting " << inputRate << "Hz x" << inputChannels
+         << " to " << outputRate << "Hz x" << outputChannels
+         << ", " << m_taps << " taps, " << m_phases << " phases");
+  return true;
+}
+
+
+void PAudioResampler::BuildFilter()
+{
+  m_filter.clear();
+
+  if (IsSameRate()) {
+    m_phases = 1;
+    m_taps = 0;
+    return;
+  }
+
+  // When reducing the rate, the filter cuts off at the output Nyquist
+  // frequency and is lengthened to keep the same transition band.
+  double ratio = std::min(1.0, (double)m_outputRate/m_inputRate);
+  unsigned taps = (unsigned)ceil(QualityParameters[m_quality].m_taps/ratio);
+  m_taps = (taps + TapAlignment - 1)/TapAlignment*TapAlignment;
+  m_phases = std::min(m_interpolation, MaxPhases);
+
+  /* The stopband starts at (2-passband) times the output Nyquist frequency,
+     so anything aliased lands above the passband, and the cutoff is at the
+     Nyquist frequency. Each phase is normalised for unity gain at DC. */
+  double beta = QualityParameters[m_quality].m_beta;
+  double window = BesselI0(beta);
+  double half = m_taps/2;
+
+  m_filter.resize((size_t)m_phases*m_taps);
+  for (unsigned phase = 0; phase < m_phases; ++phase) {
+    float * coefficients = &m_filter[(size_t)phase*m_taps];
+    double fraction = (double)phase/m_phases;
+    double sum = 0;
+    for (unsigned tap = 0; tap < m_taps; ++tap) {
+      double distance = tap - (half - 1) - fraction;
+      double x = M_PI*ratio*distance;
+      double sinc = x == 0 ? 1 : sin(x)/x;
+      double u = distance/half;
+      double value = u*u < 1 ? ratio*sinc*BesselI0(beta*sqrt(1 - u*u))/window : 0;
+      coefficients[tap] = (float)value;
+      sum += value;
+    }
+    for (unsigned tap = 0; tap < m_taps; ++tap)
+      coefficients[tap] = (float)(coefficients[tap]/sum);
+  }
+}
+
+
+void PAudioResampler::Reset()
+{
+  // Output frame 0 is centred on input frame 0, so the history starts with
+  // the silence before it.
+  m_historyFrames = IsSameRate() ? 0 : m_taps/2 - 1;
+  m_history.resize(m_mixedChannels);
+  for (unsigned c = 0; c < m_mixedChannels; ++c)
+    m_history[c].assign(m_historyFrames, 0.0f);
+
+  m_position = 0;
+  m_remainder = 0;
+  m_totalInput = 0;
+  m_totalOutput = 0;
+}
+
+
+PINDEX PAudioResampler::GetMaxOutputFrames(PINDEX inputFrames) const
+{
+  if (IsSameRate())
+    return inputFrames;
+
+  return (PINDEX)(((PInt64)inputFrames + m_taps)*m_interpolation/m_decimation) + 2;
+}
+
+
+PINDEX PAudioResampler::Process(const short * input, PINDEX inputFrames, short * output)
+{
+  if (inputFrames <= 0)
+    return 0;
+
+  if (IsSameRate()) {
+    // Only the channels change, mix straight into the output
+    if (m_inputChannels == m_outputChannels)
+      memcpy(output, input, inputFrames*m_inputChannels*sizeof(short));
+    else if (m_inputChannels > m_outputChannels) {
+      for (PINDEX i = 0; i < inputFrames; ++i) {
+        for (unsigned c = 0; c < m_outputChannels; ++c) {
+          int sum = 0, count = 0;
+          for (unsigned j = c; j < m_inputChannels; j += m_outputChannels, ++count)
+            sum += input[j];
+          *output++ = SaturateSample((float)sum/count);
+        }
+        input += m_inputChannels;
+      }
+    }
+    else {
+      for (PINDEX i = 0; i < inputFrames; ++i) {
+        for (unsigned c = 0; c < m_outputChannels; ++c)
+          *output++ = input[c % m_inputChannels];
+        input += m_inputChannels;
+      }
+    }
+    m_totalInput += inputFrames;
+    m_totalOutput += inputFrames;
+    return inputFrames;
+  }
+
+  MixInput(input, inputFrames);
+  m_totalInput += inputFrames;
+  return Filter(output, P_MAX_INDEX);
+}
+
+
+PINDEX PAudioResampler::Flush(short * output)
+{
+  PINDEX frames = 0;
+
+  if (!IsSameRate()) {
+    // Output frames before the end of the input are still due
+    PInt64 due = (m_totalInput*m_interpolation + m_decimation - 1)/m_decimation - m_totalOutput;
+    if (due > 0) {
+      for (unsigned c = 0; c < m_mixedChannels; ++c)
+        m_history[c].resize(m_historyFrames + m_taps, 0.0f);
+      m_historyFrames += m_taps;
+      frames = Filter(output, (PINDEX)due);
+    }
+  }
+
+  Reset();
+  return frames;
+}
+
+
+void PAudioResampler::MixInput(const short * input, PINDEX frames)
+{
+  for (unsigned c = 0; c < m_mixedChannels; ++c) {
+    m_history[c].resize(m_historyFrames + frames);
+    float * history = &m_history[c][m_historyFrames];
+
+    if (m_inputChannels == m_mixedChannels) {
+      const short * in = input + c;
+      for (PINDEX i = 0; i < frames; ++i, in += m_inputChannels)
+        history[i] = *in;
+    }
+    else {
+      unsigned count = 0;
+      for (unsigned j = c; j < m_inputChannels; j += m_mixedChannels)
+        ++count;
+      float scale = 1.0f/count;
+
+      const short * in = input;
+      for (PINDEX i = 0; i < frames; ++i, in += m_inputChannels) {
+        int sum = 0;
+        for (unsigned j = c; j < m_inputChannels; j += m_mixedChannels)
+          sum += in[j];
+        history[i] = sum*scale;
+      }
+    }
+  }
+
+  m_historyFrames += frames;
+}
+
+
+PINDEX PAudioResampler::Filter(short * output, PINDEX maxFrames)
+{
+  // Work out where each output frame lies in the history, then run the
+  // filter over each channel in turn.
+  m_offsets.clear();
+  PINDEX frames = 0;
+  while (frames < maxFrames && m_position + (PINDEX)m_taps <= m_historyFrames) {
+    unsigned phase = m_phases == m_interpolation
+                        ? m_remainder : (unsigned)((PUInt64)m_remainder*m_phases/m_interpolation);
+    m_offsets.push_back((unsigned)m_position);
+    m_offsets.push_back(phase);
+    ++frames;
+
+    m_remainder += m_decimation;
+    m_position += m_remainder/m_interpolation;
+    m_remainder %= m_interpolation;
+  }
+
+  if (frames > 0) {
+    FilterFramesFunction filterFrames = GetFilterFrames();
+    for (unsigned c = 0; c < m_mixedChannels; ++c)
+      filterFrames(&m_history[c][0], &m_filter[0], m_taps, &m_offsets[0], frames, output + c, m_outputChannels);
+
+    if (m_outputChannels > m_mixedChannels) {
+      short * frame = output;
+      for (PINDEX i = 0; i < frames; ++i, frame += m_outputChannels) {
+        for (unsigned c = m_mixedChannels; c < m_outputChannels; ++c)
+          frame[c] = frame[c % m_mixedChannels];
+      }
+    }
+  }
+
+  // Drop the history no longer under the filter
+  PINDEX consumed = std::min(m_position, m_historyFrames);
+  if (consumed > 0) {
+    for (unsigned c = 0; c < m_mixedChannels; ++c)
+      m_history[c].erase(m_history[c].begin(), m_history[c].begin() + consumed);
+    m_historyFrames -= consumed;
+    m_position -= consumed;
+  }
+
+  m_totalOutput += frames;
+  return frames;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// PAudioResampleChannel
+
+PAudioResampleChannel::PAudioResampleChannel(unsigned channelRate,
+                                             unsigned channelChannels,
+                                             unsigned applicationRate,
+                                             unsigned applicationChannels,
+                                             PAudioResampler::Quality quality)
+  : m_readResampler(channelRate, channelChannels, applicationRate, applicationChannels, quality)
+  , m_writeResampler(applicationRate, applicationChannels, channelRate, channelChannels, quality)
+  , m_readOutputPosition(0)
+  , m_readOutputFrames(0)
+{
+}
+
+
+PBoolean PAudioResampleChannel::Read(void * buf, PINDEX len)
+{
+  unsigned channels = m_readResampler.GetOutputChannels();
+  unsigned inputChannels = m_readResampler.GetInputChannels();
+  PINDEX wanted = len/(channels*sizeof(short));
+  short * output = (short *)buf;
+
+  PINDEX done = 0;
+  while (done < wanted) {
+    if (m_readOutputPosition < m_readOutputFrames) {
+      PINDEX count = std::min(wanted - done, m_readOutputFrames - m_readOutputPosition);
+      memcpy(output + done*channels,
+             (const short *)m_readOutput + m_readOutputPosition*channels,
+             count*channels*sizeof(short));
+      done += count;
+      m_readOutputPosition += count;
+      continue;
+    }
+
+    // Read about as much as is needed for the rest of the output
+    PINDEX inputFrames = (PINDEX)((PInt64)(wanted - done)*m_readResampler.GetInputRate()/m_readResampler.GetOutputRate()) + 1;
+    if (!PIndirectChannel::Read(m_readInput.GetPointer(inputFrames*inputChannels), inputFrames*inputChannels*sizeof(short)))
+      break;
+    inputFrames = lastReadCount/(inputChannels*sizeof(short));
+    if (inputFrames == 0)
+      break;
+
+    PINDEX maxFrames = m_readResampler.GetMaxOutputFrames(inputFrames);
+    m_readOutputFrames = m_readResampler.Process(m_readInput, inputFrames, m_readOutput.GetPointer(maxFrames*channels));
+    m_readOutputPosition = 0;
+  }
+
+  lastReadCount = done*channels*sizeof(short);
+  return lastReadCount > 0;
+}
+
+
+PBoolean PAudioResampleChannel::Write(const void * buf, PINDEX len)
+{
+  unsigned inputChannels = m_writeResampler.GetInputChannels();
+  unsigned channels = m_writeResampler.GetOutputChannels();
+  PINDEX inputFrames = len/(inputChannels*sizeof(short));
+
+  PINDEX maxFrames = m_writeResampler.GetMaxOutputFrames(inputFrames);
+  PINDEX frames = m_writeResampler.Process((const short *)buf, inputFrames, m_writeOutput.GetPointer(maxFrames*channels));
+  if (frames > 0 && !PIndirectChannel::Write(m_writeOutput, frames*channels*sizeof(short)))
+    return false;
+
+  lastWriteCount = inputFrames*inputChannels*sizeof(short);
+  return true;
+}
+
+
+// End Of File ///////////////////////////////////////////////////////////////
@@ -122,6 +122,7 @@ const static PASN_Names Names_PSNMP_PDUs[]={
      ,{"get_response",2}
      ,{"set_request",3}
      ,{"trap",4}
+     ,{"get_bulk_request",5}
 };
 #endif
 //
@@ -129,9 +130,9 @@ const static PASN_Names Names_PSNMP_PDUs[]={
 //
 
 PSNMP_PDUs::PSNMP_PDUs(unsigned tag, PASN_Object::TagClass tagClass)
-  : PASN_Choice(tag, tagClass, 5, PFalse
+  : PASN_Choice(tag, tagClass, 6, PFalse
 #ifndef PASN_NOPRINTON
-    ,(const PASN_Names *)Names_PSNMP_PDUs,5
+    ,(const PASN_Names *)Names_PSNMP_PDUs,6
 #endif
 )
 {
@@ -248,6 +249,28 @@ PSNMP_PDUs::operator const PSNMP_Trap_PDU &() const
 }
 
 
+#if defined(__GNUC__) && __GNUC__ <= 2 && __GNUC_MINOR__ < 9
+PSNMP_PDUs::operator PSNMP_GetBulkRequest_PDU &() const
+#else
+PSNMP_PDUs::operator PSNMP_GetBulkRequest_PDU &()
+{
+#ifndef PASN_LEANANDMEAN
+  PAssert(PIsDescendant(PAssertNULL(choice), PSNMP_GetBulkRequest_PDU), PInvalidCast);
+#endif
+  return *(PSNMP_GetBulkRequest_PDU *)choice;
+}
+
+
+PSNMP_PDUs::operator const PSNMP_GetBulkRequest_PDU &() const
+#endif
+{
+#ifndef PASN_LEANANDMEAN
+  PAssert(PIsDescendant(PAssertNULL(choice), PSNMP_GetBulkRequest_PDU), PInvalidCast);
+#endif
+  return *(PSNMP_GetBulkRequest_PDU *)choice;
+}
+
+
 PBoolean PSNMP_PDUs::CreateObject()
 {
   switch (tag) {
@@ -266,6 +289,9 @@ PBoolean PSNMP_PDUs::CreateObject()
     case e_trap :
       choice = new PSNMP_Trap_PDU();
       return PTrue;
+    case e_get_bulk_request :
+      choice = new PSNMP_GetBulkRequest_PDU();
+      return PTrue;
   }
 
   choice = NULL;
@@ -695,6 +721,25 @@ PObject * PSNMP_SetRequest_PDU::Clone() const
 }
 
 
+//
+// GetBulkRequest-PDU
+//
+
+PSNMP_GetBulkRequest_PDU::PSNMP_GetBulkRequest_PDU(unsigned tag, PASN_Object::TagClass tagClass)
+  : PSNMP_PDU(tag, tagClass)
+{
+}
+
+
+PObject * PSNMP_GetBulkRequest_PDU::Clone() const
+{
+#ifndef PASN_LEANANDMEAN
+  PAssert(IsClass(PSNMP_GetBulkRequest_PDU::Class()), PInvalidCast);
+#endif
+  return new PSNMP_GetBulkRequest_PDU(*this);
+}
+
+
 #endif // if ! H323_DISABLE_PSNMP
 
 
@@ -35,21 +35,264 @@
 
 #include <ptclib/psnmp.h>
 
+#include <algorithm>
+
 #define new PNEW
 
 
+//////////////////////////////////////////////////////////////////////////
+// PSNMPMIBTree
+
+PSNMP::ErrorType PSNMPMIBTree::Variable::SetValue(const PRFC1155_ObjectSyntax &)
+{
+  return PSNMP::ReadOnly;
+}
+
+
+PSNMPMIBTree::PSNMPMIBTree()
+{
+}
+
+
+PSNMPMIBTree::~PSNMPMIBTree()
+{
+  for (VariableMap::iterator it = m_variables.begin(); it != m_variables.end(); ++it)
+    delete it->second;
+}
+
+
+PSNMPMIBTree::Key PSNMPMIBTree::MakeKey(const PASN_ObjectId & oid)
+{
+  const PUnsignedArray & value = oid.GetValue();
+  return Key((const unsigned *)value, (const unsigned *)value + value.GetSize());
+}
+
+
+PSNMPMIBTree::Key PSNMPMIBTree::MakeKey(const PString & oid)
+{
+  Key key;
+  const char * ptr = oid;
+  if (*ptr == '.')
+    ++ptr;
+  while (*ptr != '\0') {
+    char * end;
+    key.push_back(strtoul(ptr, &end, 10));
+    if (*end != '.')
+      break;
+    ptr = end+1;
+  }
+  return key;
+}
+
+
+bool PSNMPMIBTree::Register(const PString & oid, Variable * variable)
+{
+  Key key = MakeKey(oid);
+  if (key.empty() || variable == NULL) {
+    delete variable;
+    return false;
+  }
+
+  PWaitAndSignal mutex(m_mutex);
+
+  VariableMap::iterator it = m_variables.find(key);
+  if (it != m_variables.end()) {
+    delete it->second;
+    it->second = variable;
+  }
+  else
+    m_variables[key] = variable;
+
+  PTRACE(4, "SNMPsrv\tRegistered MIB variable " << oid);
+  return true;
+}
+
+
+bool PSNMPMIBTree::Unregister(const PString & oid)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  VariableMap::iterator it = m_variables.find(MakeKey(oid));
+  if (it == m_variables.end())
+    return false;
+
+  delete it->second;
+  m_variables.erase(it);
+  return true;
+}
+
+
+PINDEX PSNMPMIBTree::UnregisterSubTree(const PString & oid)
+{
+  Key prefix = MakeKey(oid);
+
+  PWaitAndSignal mutex(m_mutex);
+
+  PINDEX count = 0;
+  VariableMap::iterator it = m_variables.lower_bound(prefix);
+  while (it != m_variables.end() &&
+         it->first.size() >= prefix.size() &&
+         std::equal(prefix.begin(), prefix.end(), it->first.begin())) {
+    delete it->second;
+    m_variables.erase(it++);
+    ++count;
+  }
+
+  return count;
+}
+
+
+PINDEX PSNMPMIBTree::GetSize() const
+{
+  PWaitAndSignal mutex(m_mutex);
+  return (PINDEX)m_variables.size();
+}
+
+
+PSNMP::ErrorType PSNMPMIBTree::Get(const PASN_ObjectId & oid, PRFC1155_ObjectSyntax & value) const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  VariableMap::const_iterator it = m_variables.find(MakeKey(oid));
+  if (it == m_variables.end())
+    return PSNMP::NoSuchName;
+
+  it->second->GetValue(value);
+  return PSNMP::NoError;
+}
+
+
+PSNMP::ErrorType PSNMPMIBTree::GetNext(PASN_ObjectId & oid, PRFC1155_ObjectSyntax & value) const
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  VariableMap::const_iterator it = m_variables.upper_bound(MakeKey(oid));
+  if (it == m_variables.end())
+    return PSNMP::NoSuchName;
+
+  oid.SetValue(&it->first[0], (PINDEX)it->first.size());
+  it->second->GetValue(value);
+  return PSNMP::NoError;
+}
+
+
+PSNMP::ErrorType PSNMPMIBTree::Set(const PASN_ObjectId & oid, const PRFC1155_ObjectSyntax & value)
+{
+  PWaitAndSignal mutex(m_mutex);
+
+  VariableMap::iterator it = m_variables.find(MakeKey(oid));
+  if (it == m_variables.end())
+    return PSNMP::NoSuchName;
+
+  return it->second->SetValue(value);
+}
+
+
+static PASN_Object & SetSyntax(PRFC1155_ObjectSyntax & value, unsigned tag, PASN_Object::TagClass tagClass)
+{
+  // Creates the nested Simple/ApplicationSyntax choice and its leaf object
+  value.SetTag(tag, tagClass);
+  return ((PASN_Choice &)value.GetObject()).GetObject();
+}
+
+
+void PSNMPMIBTree::SetInteger(PRFC1155_ObjectSyntax & value, int number)
+{
+  ((PASN_Integer &)SetSyntax(value, PRFC1155_SimpleSyntax::e_number, PASN_Object::UniversalTagClass)).SetValue(number);
+}
+
+
+void PSNMPMIBTree::SetString(PRFC1155_ObjectSyntax & value, const PString & str)
+{
+  ((PASN_OctetString &)SetSyntax(value, PRFC1155_SimpleSyntax::e_string, PASN_Object::UniversalTagClass)).SetValue(str);
+}
+
+
+void PSNMPMIBTree::SetObjectId(PRFC1155_ObjectSyntax & value, const PString & oid)
+{
+  ((PASN_ObjectId &)SetSyntax(value, PRFC1155_SimpleSyntax::e_object, PASN_Object::UniversalTagClass)).SetValue(oid);
+}
+
+
+void PSNMPMIBTree::SetNull(PRFC1155_ObjectSyntax & value)
+{
+  SetSyntax(value, PRFC1155_SimpleSyntax::e_empty, PASN_Object::UniversalTagClass);
+}
+
+
+void PSNMPMIBTree::SetCounter(PRFC1155_ObjectSyntax & value, unsigned count)
+{
+  ((PASN_Integer &)SetSyntax(value, PRFC1155_ApplicationSyntax::e_counter, PASN_Object::ApplicationTagClass)).SetValue(count);
+}
+
+
+void PSNMPMIBTree::SetGauge(PRFC1155_ObjectSyntax & value, unsigned gauge)
+{
+  ((PASN_Integer &)SetSyntax(value, PRFC1155_ApplicationSyntax::e_gauge, PASN_Object::ApplicationTagClass)).SetValue(gauge);
+}
+
+
+void PSNMPMIBTree::SetTimeTicks(PRFC1155_ObjectSyntax & value, unsigned ticks)
+{
+  ((PASN_Integer &)SetSyntax(value, PRFC1155_ApplicationSyntax::e_ticks, PASN_Object::ApplicationTagClass)).SetValue(ticks);
+}
+
+
+class PSNMPMIBTree_ThreadCount : public PSNMPMIBTree::Variable
+{
+  public:
+    virtual void GetValue(PRFC1155_ObjectSyntax & value) const
+    {
+      PSNMPMIBTree::SetGauge(value, PProcess::Current().GetActiveThreadCount());
+    }
+};
+
+
+class PSNMPMIBTree_TimerCount : public PSNMPMIBTree::Variable
+{
+  public:
+    virtual void GetValue(PRFC1155_ObjectSyntax & value) const
+    {
+      PSNMPMIBTree::SetGauge(value, PProcess::Current().GetTimerList()->GetActiveTimerCount());
+    }
+};
+
+
+class PSNMPMIBTree_UpTime : public PSNMPMIBTree::Variable
+{
+  public:
+    virtual void GetValue(PRFC1155_ObjectSyntax & value) const
+    {
+      // TimeTicks are in hundredths of a second
+      PTimeInterval upTime = PTime() - PProcess::Current().GetStartTime();
+      PSNMPMIBTree::SetTimeTicks(value, (unsigned)(upTime.GetMilliSeconds()/10));
+    }
+};
+
+
+void PSNMPMIBTree::RegisterProcessStatistics(const PString & baseOID)
+{
+  Register(baseOID + ".1.0", new PSNMPMIBTree_ThreadCount);
+  Register(baseOID + ".2.0", new PSNMPMIBTree_TimerCount);
+  Register(baseOID + ".3.0", new PSNMPMIBTree_UpTime);
+}
+
+
+bool PSNMPMIBTree::RegisterSafeCollection(const PString & oid, const PSafeCollection & collection)
+{
+  return Register(oid, new MemberGauge<PSafeCollection>(collection, &PSafeCollection::GetSize));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+// PSNMPServer
+
 #define SNMP_VERSION 0
 
 static const char defaultCommunity[] = "public";
 
 PSNMPServer::PSNMPServer(PIPSocket::Address binding, WORD localPort, PINDEX timeout, PINDEX rxSize, PINDEX txSize)
-#ifdef _MSC_VER
-#pragma warning(disable:4355)
-#endif
- : m_thread(*this, &PSNMPServer::Main, true, "SNMP Server")
-#ifdef _MSC_VER
-#pragma warning(default:4355)
-#endif
+ : m_thread(NULL)
  , community(defaultCommunity)
  , version(SNMP_VERSION)
  , lastErrorIndex(0)
@@ -65,7 +308,8 @@ PSNMPServer::PSNMPServer(PIPSocket::Address binding, WORD localPort, PINDEX time
   }
   else {
     Open(baseSocket);
-    m_thread.Resume();
+    // Thread starts immediately, so only create it once the socket is open
+    m_thread = new PThreadObj<PSNMPServer>(*this, &PSNMPServer::Main, false, "SNMP Server");
   }
 }
 
@@ -78,6 +322,11 @@ void PSNMPServer::Main()
 PSNMPServer::~PSNMPServer()
 {
 	Close();
+
+  if (m_thread != NULL) {
+    m_thread->WaitForTermination();
+    delete m_thread;
+  }
 }
 
 PBoolean PSNMPServer::HandleChannel()
@@ -96,6 +345,8 @@ PBoolean PSNMPServer::HandleChannel()
 		readBuffer.SetSize(maxRxSize);
 		for (;;) {
 			if (!Read(readBuffer.GetPointer()+rxSize, maxRxSize - rxSize)) {
+			if (!IsOpen())
+			  return PFalse;
 
 			// if the buffer was too small, then we are receiving datagrams
 			// and the datagram was too big
@@ -160,21 +411,124 @@ PSNMP::ErrorType PSNMPServer::SendGetResponse (PSNMPVarBindingList &)
 }
 
 
-PBoolean PSNMPServer::OnGetRequest (PINDEX , PSNMP::BindingList &, PSNMP::ErrorType &)
+static PRFC1155_ObjectName MakeObjectName(const PString & str)
 {
-	return PFalse;
+  PRFC1155_ObjectName oid;
+  oid.SetValue(str);
+  return oid;
 }
 
 
-PBoolean PSNMPServer::OnGetNextRequest (PINDEX , PSNMP::BindingList &, PSNMP::ErrorType &)
+PBoolean PSNMPServer::OnGetRequest (PINDEX , PSNMP::BindingList & vars, PSNMP::ErrorType & errCode)
 {
-	return PFalse;
+  PSNMP::BindingList result = vars;
+
+  PINDEX index = 1;
+  for (PSNMP::BindingList::iterator it = result.begin(); it != result.end(); ++it, ++index) {
+    errCode = m_mib.Get(MakeObjectName(it->first), it->second);
+    if (errCode != PSNMP::NoError) {
+      lastErrorIndex = index;
+      return PTrue;
+    }
+  }
+
+  vars.swap(result);
+  return PTrue;
 }
 
 
-PBoolean PSNMPServer::OnSetRequest (PINDEX , PSNMP::BindingList &,PSNMP::ErrorType &)
+PBoolean PSNMPServer::OnGetNextRequest (PINDEX , PSNMP::BindingList & vars, PSNMP::ErrorType & errCode)
 {
-	return PFalse;
+  PSNMP::BindingList result = vars;
+
+  PINDEX index = 1;
+  for (PSNMP::BindingList::iterator it = result.begin(); it != result.end(); ++it, ++index) {
+    PRFC1155_ObjectName oid = MakeObjectName(it->first);
+    errCode = m_mib.GetNext(oid, it->second);
+    if (errCode != PSNMP::NoError) {
+      lastErrorIndex = index;
+      return PTrue;
+    }
+    it->first = oid.AsString();
+  }
+
+  vars.swap(result);
+  return PTrue;
+}
+
+
+PBoolean PSNMPServer::OnSetRequest (PINDEX , PSNMP::BindingList & vars, PSNMP::ErrorType & errCode)
+{
+  PINDEX index = 1;
+  for (PSNMP::BindingList::iterator it = vars.begin(); it != vars.end(); ++it, ++index) {
+    errCode = m_mib.Set(MakeObjectName(it->first), it->second);
+    if (errCode != PSNMP::NoError) {
+      lastErrorIndex = index;
+      break;
+    }
+  }
+
+  return PTrue;
+}
+
+
+PBoolean PSNMPServer::OnGetBulkRequest(PINDEX,
+                                       PINDEX nonRepeaters,
+                                       PINDEX maxRepetitions,
+                                       PSNMP::BindingList & vars,
+                                       PSNMP::ErrorType & errCode)
+{
+  // Allow for message header, community and PDU fields
+  PINDEX encodedSize = 50;
+  PINDEX varCount = (PINDEX)vars.size();
+  if (nonRepeaters > varCount)
+    nonRepeaters = varCount;
+
+  PSNMP::BindingList result;
+  PSNMP::BindingList::iterator it = vars.begin();
+
+  // Non-repeaters get a single GetNext each
+  for (PINDEX i = 0; i < nonRepeaters; ++i, ++it) {
+    PRFC1155_ObjectName oid = MakeObjectName(it->first);
+    PRFC1155_ObjectSyntax value;
+    if (m_mib.GetNext(oid, value) != PSNMP::NoError)
+      PSNMPMIBTree::SetNull(value); // SNMPv1 syntax has no endOfMibView
+    encodedSize += oid.GetDataLength() + value.GetDataLength() + 8;
+    result.push_back(PSNMP::BindingList::value_type(oid.AsString(), value));
+  }
+
+  // Remaining variables are walked up to maxRepetitions times, while the response fits
+  std::vector<PRFC1155_ObjectName> repeaters;
+  for (; it != vars.end(); ++it)
+    repeaters.push_back(MakeObjectName(it->first));
+
+  bool endOfMib = repeaters.empty();
+  for (PINDEX repetition = 0; repetition < maxRepetitions && !endOfMib; ++repetition) {
+    for (std::vector<PRFC1155_ObjectName>::iterator oid = repeaters.begin(); oid != repeaters.end(); ++oid) {
+      PRFC1155_ObjectSyntax value;
+      if (m_mib.GetNext(*oid, value) != PSNMP::NoError) {
+        endOfMib = true;
+        break;
+      }
+
+      encodedSize += oid->GetDataLength() + value.GetDataLength() + 8;
+      if (encodedSize > maxTxSize && !result.empty()) {
+        endOfMib = true;
+        break;
+      }
+
+      result.push_back(PSNMP::BindingList::value_type(oid->AsString(), value));
+    }
+  }
+
+  if (result.empty()) {
+    errCode = PSNMP::NoSuchName;
+    lastErrorIndex = 1;
+    return PTrue;
+  }
+
+  vars.swap(result);
+  return PTrue;
 }
 
 
@@ -193,24 +547,23 @@ static void DecodeOID(const PDUType & pdu, PINDEX & reqID, PSNMP::BindingList &
 template <typename PDUType>
 static void EncodeOID(PDUType & pdu, const PINDEX & reqID,
 					  const PSNMP::BindingList & varlist,
-					  const PSNMP::ErrorType & errCode)
+					  const PSNMP::ErrorType & errCode,
+					  PINDEX errIndex)
 {
    pdu.m_request_id = reqID;
    pdu.m_error_status = errCode;
-   pdu.m_error_index = 0;
-
-   if (errCode == PSNMP::NoError) {
-	   // Build the response list
-		PSNMP_VarBindList & vars = pdu.m_variable_bindings;
-		PINDEX i = 0;
-		vars.SetSize((int)varlist.size());
-		PSNMP::BindingList::const_iterator Iter = varlist.begin();
-		while (Iter != varlist.end()) {
-		  vars[i].m_name.SetValue(Iter->first);
-		  vars[i].m_value = Iter->second;
-		  i++;
-		  ++Iter;
-		}
+   pdu.m_error_index = errCode == PSNMP::NoError ? 0 : errIndex;
+
+   // Build the response list, on error this echoes the request bindings
+   PSNMP_VarBindList & vars = pdu.m_variable_bindings;
+   PINDEX i = 0;
+   vars.SetSize((int)varlist.size());
+   PSNMP::BindingList::const_iterator Iter = varlist.begin();
+   while (Iter != varlist.end()) {
+     vars[i].m_name.SetValue(Iter->first);
+     vars[i].m_value = Iter->second;
+     i++;
+     ++Iter;
    }
 }
 
@@ -233,14 +586,16 @@ PBoolean PSNMPServer::MIB_LocalMatch(PSNMP_PDU & pdu)
   return found;
 }
 
-PBoolean PSNMPServer::ConfirmCommunity(PASN_OctetString & /*community*/)
+PBoolean PSNMPServer::ConfirmCommunity(PASN_OctetString & reqCommunity)
 {
-	return PFalse;
+  return reqCommunity.AsString() == community;
 }
 
 PBoolean PSNMPServer::ConfirmVersion(PASN_Integer vers)
 {
-  return version == vers ? PTrue : PFalse;
+  /* Accept SNMPv1 and, when configured for it, SNMPv2c requests. GetBulk
+     requests are further restricted to SNMPv2c messages in ProcessPDU(). */
+  return vers <= version ? PTrue : PFalse;
 }
 
 PBoolean PSNMPServer::ProcessPDU(const PBYTEArray & readBuffer, PBYTEArray & sendBuffer)
@@ -268,65 +623,40 @@ PBoolean PSNMPServer::ProcessPDU(const PBYTEArray & readBuffer, PBYTEArray & sen
   PSNMP::BindingList varlist;
   PINDEX reqID;
 
-  PSNMP_Message resp;
-  PSNMP_PDUs sendpdu;
-
   PBoolean retval = PTrue;
   PSNMP::ErrorType errCode = PSNMP::NoError;
+  lastErrorIndex = 0;
+
   switch (msg.m_pdu.GetTag()) {
     case PSNMP_PDUs::e_get_request:
       DecodeOID<PSNMP_GetRequest_PDU>(msg.m_pdu, reqID, varlist);
       retval = OnGetRequest(reqID, varlist, errCode);
-      if (retval == PTrue){
-        sendpdu.SetTag(PSNMP_PDUs::e_get_response);
-        EncodeOID<PSNMP_GetResponse_PDU>(sendpdu, reqID,varlist,errCode);
-        resp.m_pdu = sendpdu;
-        resp.m_version = msg.m_version;
-        resp.m_community = msg.m_community;
-        PSNMP_GetResponse_PDU & mpdu = (PSNMP_GetResponse_PDU &) resp.m_pdu;
-        if (!MIB_LocalMatch(mpdu)){
-          retval = PFalse;
-          break;
-        }
-        resp.Encode((PASN_Stream &)sendBuffer);
-      }
+      break;
 
-    break;
     case PSNMP_PDUs::e_get_next_request:
       DecodeOID<PSNMP_GetNextRequest_PDU>(msg.m_pdu, reqID, varlist);
       retval = OnGetNextRequest(reqID,varlist,errCode);
-      if (retval == PTrue){
-        sendpdu.SetTag(PSNMP_PDUs::e_get_response);
-        EncodeOID<PSNMP_GetResponse_PDU>(sendpdu, reqID,varlist,errCode);
-        resp.m_pdu = sendpdu;
-        resp.m_version = msg.m_version;
-        resp.m_community = msg.m_community;
-        PSNMP_GetResponse_PDU & mpdu = (PSNMP_GetResponse_PDU &) resp.m_pdu;
-        if (!MIB_LocalMatch(mpdu)){
-          retval = PFalse;
-          break;
-        }
-        resp.Encode((PASN_Stream &)sendBuffer);
-      }
       break;
 
     case PSNMP_PDUs::e_set_request:
       DecodeOID<PSNMP_SetRequest_PDU>(msg.m_pdu, reqID, varlist);
       retval = OnSetRequest(reqID, varlist, errCode);
-      if (retval == PTrue){
-        sendpdu.SetTag(PSNMP_PDUs::e_get_response); // yes, a SET gets a get-response
-        EncodeOID<PSNMP_GetResponse_PDU>(sendpdu, reqID,varlist,errCode);
-        resp.m_pdu = sendpdu;
-        resp.m_version = msg.m_version;
-        resp.m_community = msg.m_community;
-        PSNMP_GetResponse_PDU & mpdu = (PSNMP_GetResponse_PDU &) resp.m_pdu;
-        if (!MIB_LocalMatch(mpdu)){
-          retval = PFalse;
-          break;
-        }
-        resp.Encode((PASN_Stream &)sendBuffer);
+      break;
+
+    case PSNMP_PDUs::e_get_bulk_request:
+    {
+      // There is no GetBulk in SNMPv1, so it is not a valid version 1 message
+      if (msg.m_version < 1) {
+        PTRACE(4, "SNMPsrv\tGetBulk request in SNMPv1 message, ignoring");
+        return PFalse;
       }
+
+      // GetBulk reuses the PDU fields: error-status is non-repeaters, error-index is max-repetitions
+      const PSNMP_GetBulkRequest_PDU & bulk = msg.m_pdu;
+      DecodeOID<PSNMP_GetBulkRequest_PDU>(bulk, reqID, varlist);
+      retval = OnGetBulkRequest(reqID, bulk.m_error_status, bulk.m_error_index, varlist, errCode);
       break;
+    }
 
     case PSNMP_PDUs::e_get_response:
     case PSNMP_PDUs::e_trap:
@@ -336,11 +666,27 @@ PBoolean PSNMPServer::ProcessPDU(const PBYTEArray & readBuffer, PBYTEArray & sen
       retval = PFalse;
   }
 
-  if (retval) {
-    PTRACE(4, "SNMPSrv\tSNMP Response " << resp);
-  }
+  if (!retval)
+    return PFalse;
+
+  PSNMP_Message resp;
+  resp.m_version = msg.m_version;
+  resp.m_community = msg.m_community;
+  resp.m_pdu.SetTag(PSNMP_PDUs::e_get_response); // yes, a SET gets a get-response too
+  PSNMP_GetResponse_PDU & mpdu = resp.m_pdu;
+  EncodeOID<PSNMP_GetResponse_PDU>(mpdu, reqID, varlist, errCode, lastErrorIndex);
+
+  // Legacy dictionary of objects, only used if the MIB tree is not
+  if (m_mib.GetSize() == 0 && objList.GetSize() > 0 && !MIB_LocalMatch(mpdu))
+    return PFalse;
+
+  // The generated encoder writes into the existing storage of the buffer
+  if (sendBuffer.GetSize() < maxTxSize)
+    sendBuffer.SetSize(maxTxSize);
+  resp.Encode((PASN_Stream &)sendBuffer);
 
-  return retval;
+  PTRACE(4, "SNMPSrv\tSNMP Response " << resp);
+  return PTrue;
 }
 
 #endif
@@ -48,15 +48,25 @@ PThreadPoolBase::PThreadPoolBase(unsigned int maxWorkerCount, unsigned int maxWo
 }
 
 PThreadPoolBase::~PThreadPoolBase()
+{
+  Shutdown();
+}
+
+
+void PThreadPoolBase::Shutdown()
 {
   for (;;) {
-    PWaitAndSignal mutex(m_listMutex);
-    if (m_workers.size() == 0)
-      break;
+    WorkerThreadBase * worker;
+    {
+      PWaitAndSignal mutex(m_listMutex);
+      if (m_workers.size() == 0)
+        break;
 
-    WorkerThreadBase * worker = m_workers[0];
-    worker->Shutdown();
-    m_workers.erase(m_workers.begin());
+      worker = m_workers[0];
+      m_workers.erase(m_workers.begin());
+    }
+
+    // Do not hold the list mutex as worker may be finishing off work
     StopWorker(worker);
   }
 }
@@ -117,7 +127,9 @@ bool PThreadPoolBase::CheckWorker(WorkerThreadBase * worker)
       if (*iter == worker)
         break;
     }
-    PAssert(iter != m_workers.end(), "cannot find thread pool worker");
+    // worker may have already been removed by Shutdown()
+    if (iter == m_workers.end())
+      return true;
 
     // if the worker thread has work, leave it alone
     if (worker->GetWorkSize() > 0) 
@@ -281,6 +281,14 @@ bool PVXMLPlayableFile::OnStart()
   if (PAssertNULL(m_vxmlChannel) == NULL)
     return false;
 
+  // try the in memory prompt cache, all sessions share the decoded audio
+  PBYTEArray prompt;
+  if (!m_autoDelete && PVXMLPromptCache::GetInstance().GetPrompt(*m_vxmlChannel, m_filePath, prompt)) {
+    PTRACE(3, "VXML\tPlaying cached file \"" << m_filePath << "\", " << prompt.GetSize() << " bytes");
+    m_subChannel = new PMemoryFile(prompt);
+    return m_vxmlChannel->SetReadChannel(m_subChannel, false);
+  }
+
   PFile * file = NULL;
 
   // check the file extension and open a .wav or a raw (.sw or .g723) file
@@ -741,6 +749,183 @@ PFilePath PVXMLCache::GetRandomFilename(const PString & prefix, const PString &
 }
 
 
+///////////////////////////////////////////////////////////////
+
+PVXMLPromptCache::Statistics::Statistics()
+  : m_hits(0)
+  , m_misses(0)
+  , m_evictions(0)
+  , m_entries(0)
+  , m_bytes(0)
+{
+}
+
+
+PVXMLPromptCache::PVXMLPromptCache(PINDEX maxSize)
+  : m_maxSize(maxSize)
+  , m_maxPromptSize(P_MAX_INDEX)
+  , m_totalSize(0)
+{
+}
+
+
+PVXMLPromptCache & PVXMLPromptCache::GetInstance()
+{
+  static PVXMLPromptCache cache;
+  return cache;
+}
+
+
+bool PVXMLPromptCache::GetPrompt(PVXMLChannel & channel, const PFilePath & fn, PBYTEArray & data)
+{
+  PINDEX maxPromptSize;
+  {
+    PWaitAndSignal mutex(m_mutex);
+    if (m_maxSize == 0)
+      return false;
+    maxPromptSize = PMIN(m_maxSize, m_maxPromptSize);
+  }
+
+  PFileInfo info;
+  if (!PFile::GetInfo(fn, info) || info.size > (PUInt64)maxPromptSize)
+    return false;
+
+  PStringStream key;
+  key << channel.GetMediaFormat() << '\t' << channel.GetSampleFrequency() << '\t' << fn;
+
+  {
+    PWaitAndSignal mutex(m_mutex);
+
+    EntryMap::iterator it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      if (it->second.m_modified == info.modified && it->second.m_fileSize == info.size) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.m_lru);
+        data = it->second.m_data;
+        ++m_statistics.m_hits;
+        return true;
+      }
+
+      PTRACE(3, "VXML\tPrompt file \"" << fn << "\" changed, reloading");
+      RemoveEntry(it);
+    }
+
+    ++m_statistics.m_misses;
+  }
+
+  // Decode outside of the mutex so other sessions are not held up
+  PBYTEArray decoded;
+  if (!LoadPrompt(channel, fn, decoded))
+    return false;
+
+  data = decoded;
+
+  PWaitAndSignal mutex(m_mutex);
+
+  if (decoded.GetSize() > PMIN(m_maxSize, m_maxPromptSize)) {
+    PTRACE(4, "VXML\tPrompt file \"" << fn << "\" too large to cache, " << decoded.GetSize() << " bytes");
+    return true;
+  }
+
+  // Another session may have loaded the same prompt while we were decoding
+  EntryMap::iterator it = m_entries.find(key);
+  if (it != m_entries.end())
+    RemoveEntry(it);
+
+  Evict(decoded.GetSize());
+
+  Entry & entry = m_entries[key];
+  entry.m_data = decoded;
+  entry.m_modified = info.modified;
+  entry.m_fileSize = info.size;
+  entry.m_lru = m_lru.insert(m_lru.begin(), key);
+  m_totalSize += decoded.GetSize();
+
+  PTRACE(4, "VXML\tCached prompt file \"" << fn << "\", " << decoded.GetSize() << " bytes,"
+            " total " << m_totalSize << " bytes in " << m_entries.size() << " prompts");
+  return true;
+}
+
+
+bool PVXMLPromptCache::LoadPrompt(PVXMLChannel & channel, const PFilePath & fn, PBYTEArray & data)
+{
+  PFile * file;
+  if (fn.GetType() == ".wav") {
+    file = channel.CreateWAVFile(fn);
+    if (file == NULL)
+      return false;
+  }
+  else {
+    file = new PFile(fn, PFile::ReadOnly);
+    if (!file->IsOpen()) {
+      PTRACE(2, "VXML\tCould not open audio file \"" << fn << '"');
+      delete file;
+      return false;
+    }
+  }
+
+  // Length is only a hint, format conversion may change it
+  static const PINDEX ChunkSize = 8192;
+  PINDEX total = 0;
+  data.SetSize((PINDEX)file->GetLength() + ChunkSize);
+  for (;;) {
+    if (data.GetSize() < total + ChunkSize)
+      data.SetSize(data.GetSize()*2);
+    if (!file->Read(data.GetPointer() + total, ChunkSize) || file->GetLastReadCount() == 0)
+      break;
+    total += file->GetLastReadCount();
+  }
+
+  delete file;
+
+  data.SetSize(total);
+  return total > 0;
+}
+
+
+void PVXMLPromptCache::SetMaxSize(PINDEX maxSize)
+{
+  PWaitAndSignal mutex(m_mutex);
+  m_maxSize = maxSize;
+  Evict(0);
+}
+
+
+void PVXMLPromptCache::RemoveAll()
+{
+  PWaitAndSignal mutex(m_mutex);
+  m_entries.clear();
+  m_lru.clear();
+  m_totalSize = 0;
+}
+
+
+void PVXMLPromptCache::GetStatistics(Statistics & statistics) const
+{
+  PWaitAndSignal mutex(m_mutex);
+  statistics = m_statistics;
+  statistics.m_entries = m_entries.size();
+  statistics.m_bytes = m_totalSize;
+}
+
+
+void PVXMLPromptCache::RemoveEntry(EntryMap::iterator it)
+{
+  m_totalSize -= it->second.m_data.GetSize();
+  m_lru.erase(it->second.m_lru);
+  m_entries.erase(it);
+}
+
+
+void PVXMLPromptCache::Evict(PINDEX required)
+{
+  while (!m_lru.empty() && m_totalSize + required > m_maxSize) {
+    PTRACE(4, "VXML\tEvicting prompt \"" << m_lru.back() << '"');
+    RemoveEntry(m_entries.find(m_lru.back()));
+    ++m_statistics.m_evictions;
+  }
+}
+
+
 //////////////////////////////////////////////////////////
 
 PVXMLSession::PVXMLSession(PTextToSpeech * tts, PBoolean autoDelete)
@@ -37,10 +37,36 @@
 PDEFINE_POOL_ALLOCATOR(PListElement)
 PDEFINE_POOL_ALLOCATOR(PListInfo)
 PDEFINE_POOL_ALLOCATOR(PSortedListElement)
+PDEFINE_POOL_ALLOCATOR(PSortedListBranch)
 PDEFINE_POOL_ALLOCATOR(PSortedListInfo)
 PDEFINE_POOL_ALLOCATOR(PHashTableElement)
 
 
+// Before the "new" redefinition below, as placement new is used
+PSortedListElement * PSortedListElement::CreateLeaf(PINDEX capacity)
+{
+  if (capacity >= MaxKeys)
+    return new PSortedListElement(true);
+
+  // Smaller than the pool size, so just allocate the part in use
+  void * ptr = malloc(sizeof(PSortedListElement) - (MaxKeys - capacity)*sizeof(PObject *));
+  PAssert(ptr != NULL, POutOfMemory);
+  return ::new (ptr) PSortedListElement(true, capacity);
+}
+
+
+void PSortedListElement::Destroy(PSortedListElement * node)
+{
+  // Must delete via the correct type to use the correct pool
+  if (!node->leaf)
+    delete (PSortedListBranch *)node;
+  else if (node->capacity >= MaxKeys)
+    delete node;
+  else
+    free(node);
+}
+
+
 #define new PNEW
 #undef  __CLASS__
 #define __CLASS__ GetClass()
@@ -324,6 +350,8 @@ PINDEX PAbstractList::Append(PObject * obj)
   if (info->head == NULL)
     info->head = element;
   info->tail = element;
+  if (info->elements != NULL)
+    info->elements->push_back(element);
 
   PINDEX lastIndex = GetSize();
   reference->size++;
@@ -361,6 +389,8 @@ PINDEX PAbstractList::InsertAt(PINDEX index, PObject * obj)
   newElement->prev = lastElement->prev;
   newElement->next = lastElement;
   lastElement->prev = newElement;
+  if (info->elements != NULL)
+    info->elements->insert(info->elements->begin()+index, newElement);
 
   reference->size++;
   return index;
@@ -374,15 +404,15 @@ PBoolean PAbstractList::Remove(const PObject * obj)
     return false;
   }
 
-  Element * elmt = info->head;
-  while (elmt != NULL) {
+  PINDEX index = 0;
+  for (Element * elmt = info->head; elmt != NULL; elmt = elmt->next) {
     if (elmt->data == obj) {
-      RemoveElement(elmt);
+      RemoveElement(elmt, index);
       return true;
     }
-    elmt = elmt->next;
+    index++;
   }
-  
+
   return false;
 }
 
@@ -400,16 +430,20 @@ PObject * PAbstractList::RemoveAt(PINDEX index)
     return NULL;
   }
 
-  return RemoveElement(elmt);
+  return RemoveElement(elmt, index);
 }
 
 
-PObject * PAbstractList::RemoveElement(PListElement * elmt)
+PObject * PAbstractList::RemoveElement(PListElement * elmt, PINDEX index)
 {
   if (elmt == NULL){
     PAssertAlways("elmt is null");
     return NULL;
   }
+
+  // Shifts whichever side of the index is shorter, so the ends are O(1)
+  if (info->elements != NULL)
+    info->elements->erase(info->elements->begin()+index);
   
   if (elmt->prev != NULL)
     elmt->prev->next = elmt->next;
@@ -509,27 +543,49 @@ PBoolean PAbstractList::SetCurrent(PINDEX index, Element * & lastElement) const
   if (index >= GetSize())
     return PFalse;
 
-  PINDEX lastIndex;
-  if (index < GetSize()/2) {
-    lastIndex = 0;
+  if (index == 0)
     lastElement = info->head;
-  }
-  else {
-    lastIndex = GetSize()-1;
+  else if (index == GetSize()-1)
     lastElement = info->tail;
-  }
+  else
+    lastElement = (*GetElementsIndex())[index];
 
-  while (lastIndex < index) {
-    lastElement = lastElement->next;
-    ++lastIndex;
-  }
+  return PTrue;
+}
 
-  while (lastIndex > index) {
-    lastElement = lastElement->prev;
-    --lastIndex;
-  }
 
-  return PTrue;
+/* Building the index is the only change made by a const function, and
+   several threads may read the list, or reference copies sharing the same
+   info, at the same time. So each reader that finds no index builds its own
+   and publishes it with a compare and swap, the losers discard theirs.
+ */
+std::deque<PListElement *> * PAbstractList::GetElementsIndex() const
+{
+  typedef std::deque<Element *> Index;
+
+#ifdef _WIN32
+  Index * elements = (Index *)*(PVOID volatile *)&info->elements;
+  MemoryBarrier();
+#else
+  Index * elements = __atomic_load_n(&info->elements, __ATOMIC_ACQUIRE);
+#endif
+  if (elements != NULL)
+    return elements;
+
+  Index * newElements = new Index;
+  for (Element * element = info->head; element != NULL; element = element->next)
+    newElements->push_back(element);
+
+#ifdef _WIN32
+  elements = (Index *)InterlockedCompareExchangePointer((PVOID volatile *)&info->elements, newElements, NULL);
+#else
+  elements = __sync_val_compare_and_swap(&info->elements, (Index *)NULL, newElements);
+#endif
+  if (elements == NULL)
+    return newElements;
+
+  delete newElements;
+  return elements;
 }
 
 
@@ -549,16 +605,6 @@ PAbstractSortedList::PAbstractSortedList()
 }
 
 
-PSortedListInfo::PSortedListInfo()
-{
-  root = &nil;
-  nil.parent = nil.left = nil.right = &nil;
-  nil.subTreeSize = 0;
-  nil.colour = Element::Black;
-  nil.data = NULL;
-}
-
-
 void PAbstractSortedList::DestroyContents()
 {
   RemoveAll();
@@ -575,20 +621,39 @@ void PAbstractSortedList::CopyContents(const PAbstractSortedList & list)
 
 void PAbstractSortedList::CloneContents(const PAbstractSortedList * list)
 {
+  // Have to do this in this manner as "this" and "list" may be the same
+  // object and we are about to change info in "this".
   PSortedListInfo * otherInfo = list->info;
 
   info = new PSortedListInfo;
   PAssert(info != NULL, POutOfMemory);
-  reference->size = 0;
-
-  // Have to do this in this manner rather than just doing a for() loop
-  // as "this" and "list" may be the same object and we just changed info in
-  // "this" so we need to use the info in "list" saved previously.
-  Element * element = otherInfo->OrderSelect(otherInfo->root, 1);
-  while (element != &otherInfo->nil) {
-    Append(element->data->Clone());
-    element = otherInfo->Successor(element);
+
+  // The shape of the tree does not depend on the values, so just copy it
+  if (otherInfo->root != NULL)
+    info->root = CloneSubTree(otherInfo->root);
+}
+
+
+PSortedListElement * PAbstractSortedList::CloneSubTree(const Element * node)
+{
+  Element * newNode;
+  if (node->leaf)
+    newNode = Element::CreateLeaf(node->capacity);
+  else {
+    const Branch * branch = (const Branch *)node;
+    Branch * newBranch = new Branch;
+    for (PINDEX i = 0; i <= node->count; i++) {
+      newBranch->child[i] = CloneSubTree(branch->child[i]);
+      newBranch->subTreeSize[i] = branch->subTreeSize[i];
+    }
+    newNode = newBranch;
   }
+
+  newNode->count = node->count;
+  for (PINDEX i = 0; i < node->count; i++)
+    newNode->data[i] = node->data[i]->Clone();
+
+  return newNode;
 }
 
 
@@ -601,26 +666,23 @@ PBoolean PAbstractSortedList::SetSize(PINDEX)
 PObject::Comparison PAbstractSortedList::Compare(const PObject & obj) const
 {
   PAssert(PIsDescendant(&obj, PAbstractSortedList), PInvalidCast);
-  Element * elmt1 = info->root;
-  while (elmt1->left != &info->nil)
-    elmt1 = elmt1->left;
-
-  Element * elmt2 = ((const PAbstractSortedList &)obj).info->root;
-  while (elmt2->left != &info->nil)
-    elmt2 = elmt2->left;
-
-  while (elmt1 != &info->nil && elmt2 != &info->nil) {
-    if (elmt1 == &info->nil)
-      return LessThan;
-    if (elmt2 == &info->nil)
-      return GreaterThan;
-    if (*elmt1->data < *elmt2->data)
+  const PAbstractSortedList & other = (const PAbstractSortedList &)obj;
+
+  PINDEX size = GetSize();
+  PINDEX otherSize = other.GetSize();
+  for (PINDEX i = 0; i < size && i < otherSize; i++) {
+    const PObject & data1 = *GetAt(i);
+    const PObject & data2 = *other.GetAt(i);
+    if (data1 < data2)
       return LessThan;
-    if (*elmt1->data > *elmt2->data)
+    if (data1 > data2)
       return GreaterThan;
-    elmt1 = info->Successor(elmt1);
-    elmt2 = info->Successor(elmt2);
   }
+
+  if (size < otherSize)
+    return LessThan;
+  if (size > otherSize)
+    return GreaterThan;
   return EqualTo;
 }
 
@@ -630,114 +692,79 @@ PINDEX PAbstractSortedList::Append(PObject * obj)
   if (PAssertNULL(obj) == NULL)
     return P_MAX_INDEX;
 
-  Element * z = new Element;
-  z->parent = z->left = z->right = &info->nil;
-  z->colour = Element::Black;
-  z->subTreeSize = 1;
-  z->data = obj;
-
-  Element * x = info->root;
-  Element * y = &info->nil;
-  while (x != &info->nil) {
-    x->subTreeSize++;
-    y = x;
-    x = *z->data < *x->data ? x->left : x->right;
-  }
-  z->parent = y;
-  if (y == &info->nil)
-    info->root = z;
-  else if (*z->data < *y->data)
-    y->left = z;
-  else
-    y->right = z;
-
-  PSortedListElement * lastElement = x = z;
-  PINDEX lastIndex;
-
-  x->colour = Element::Red;
-  while (x != info->root && x->parent->colour == Element::Red) {
-    if (x->parent == x->parent->parent->left) {
-      y = x->parent->parent->right;
-      if (y->colour == Element::Red) {
-        x->parent->colour = Element::Black;
-        y->colour = Element::Black;
-        x->parent->parent->colour = Element::Red;
-        x = x->parent->parent;
-      }
-      else {
-        if (x == x->parent->right) {
-          x = x->parent;
-          LeftRotate(x);
-        }
-        x->parent->colour = Element::Black;
-        x->parent->parent->colour = Element::Red;
-        RightRotate(x->parent->parent);
-      }
-    }
-    else {
-      y = x->parent->parent->left;
-      if (y->colour == Element::Red) {
-        x->parent->colour = Element::Black;
-        y->colour = Element::Black;
-        x->parent->parent->colour = Element::Red;
-        x = x->parent->parent;
-      }
-      else {
-        if (x == x->parent->left) {
-          x = x->parent;
-          RightRotate(x);
-        }
-        x->parent->colour = Element::Black;
-        x->parent->parent->colour = Element::Red;
-        LeftRotate(x->parent->parent);
-      }
+  if (info->root == NULL)
+    info->root = Element::CreateLeaf(Element::MinCapacity);
+  else if (info->root->count == info->root->capacity && info->root->capacity < Element::MaxKeys) {
+    // Only a root leaf is ever smaller than a full node
+    Element * root = Element::CreateLeaf(info->root->capacity*2);
+    root->count = info->root->count;
+    memcpy(root->data, info->root->data, root->count*sizeof(PObject *));
+    Element::Destroy(info->root);
+    info->root = root;
+  }
+  else if (info->root->count == Element::MaxKeys) {
+    // Tree only ever grows in height at the root, so stays balanced
+    Branch * root = new Branch;
+    root->child[0] = info->root;
+    root->subTreeSize[0] = GetSize();
+    info->root = root;
+    SplitChild(root, 0);
+  }
+
+  // Split full nodes on the way down, so there is always room in the leaf
+  PINDEX index = 0;
+  Element * node = info->root;
+  PINDEX position = FindInNode(*node, *obj, true);
+  while (!node->leaf) {
+    Branch * branch = (Branch *)node;
+    if (branch->child[position]->count == Element::MaxKeys) {
+      SplitChild(branch, position);
+      position = FindInNode(*branch, *obj, true);
     }
-  }
 
-  info->root->colour = Element::Black;
+    index += position;
+    for (PINDEX i = 0; i < position; i++)
+      index += branch->subTreeSize[i];
 
-  x = lastElement;
-  lastIndex = x->left->subTreeSize;
-  while (x != info->root) {
-    if (x != x->parent->left)
-      lastIndex += x->parent->left->subTreeSize+1;
-    x = x->parent;
+    branch->subTreeSize[position]++;
+    node = branch->child[position];
+    position = FindInNode(*node, *obj, true);
   }
 
+  memmove(&node->data[position+1], &node->data[position], (node->count - position)*sizeof(PObject *));
+  node->data[position] = obj;
+  node->count++;
+
   reference->size++;
-  return lastIndex;
+  return index + position;
 }
 
 
 PBoolean PAbstractSortedList::Remove(const PObject * obj)
 {
-  PSortedListElement * lastElement;
-  if (GetObjectsIndex(obj, lastElement) == P_MAX_INDEX)
+  PINDEX index = GetObjectsIndex(obj);
+  if (index == P_MAX_INDEX)
     return PFalse;
 
-  RemoveElement(lastElement);
+  RemoveElement(index);
   return PTrue;
 }
 
 
 PObject * PAbstractSortedList::RemoveAt(PINDEX index)
 {
-  Element * node = info->OrderSelect(info->root, index+1);
-  if (node == &info->nil)
+  if (index >= GetSize())
     return NULL;
 
-  PObject * data = node->data;
-  RemoveElement(node);
-  return reference->deleteObjects ? (PObject *)NULL : data;
+  return RemoveElement(index);
 }
 
 
 void PAbstractSortedList::RemoveAll()
 {
-  if (info->root != &info->nil) {
+  if (info->root != NULL) {
     DeleteSubTrees(info->root, reference->deleteObjects);
-    delete info->root;
-    info->root = &info->nil;
+    info->root = NULL;
     reference->size = 0;
   }
 }
@@ -766,302 +793,318 @@ PObject * PAbstractSortedList::GetAt(PINDEX index) const
   if (index >= GetSize())
     return NULL;
 
-  PSortedListElement * lastElement = info->OrderSelect(info->root, index+1);
-  return PAssertNULL(lastElement)->data;
+  PINDEX position;
+  const Element * node = info->OrderSelect(index, position);
+  return node->data[position];
 }
 
 
 PINDEX PAbstractSortedList::GetObjectsIndex(const PObject * obj) const
 {
-  PSortedListElement * lastElement;
-  return PAbstractSortedList::GetObjectsIndex(obj, lastElement);
-}
-
-PINDEX PAbstractSortedList::GetObjectsIndex(const PObject * obj, PSortedListElement * & lastElement) const
-{
-  Element * elmt = NULL;
-  PINDEX pos = ValueSelect(info->root, *obj, (const Element **)&elmt);
-  if (pos == P_MAX_INDEX)
+  if (obj == NULL)
     return P_MAX_INDEX;
 
-  if (elmt->data != obj) {
-    PINDEX savePos = pos;
-    Element * saveElmt = elmt;
-    while (elmt->data != obj &&
-            (elmt = info->Predecessor(elmt)) != &info->nil &&
-            *obj == *elmt->data)
-      pos--;
-    if (elmt->data != obj) {
-      pos = savePos;
-      elmt = saveElmt;
-      while (elmt->data != obj &&
-              (elmt = info->Successor(elmt)) != &info->nil &&
-              *obj == *elmt->data)
-        pos++;
-      if (elmt->data != obj)
-        return P_MAX_INDEX;
-    }
+  // Find the run of equal values, then the specific instance within it
+  PINDEX upper = ValueSelect(*obj, true);
+  for (PINDEX index = ValueSelect(*obj, false); index < upper; index++) {
+    if (GetAt(index) == obj)
+      return index;
   }
 
-  lastElement = elmt;
-
-  return pos;
+  return P_MAX_INDEX;
 }
 
 
 PINDEX PAbstractSortedList::GetValuesIndex(const PObject & obj) const
 {
-  PSortedListElement * lastElement;
-  PINDEX lastIndex = ValueSelect(info->root, obj, (const Element **)&lastElement);
-  if (lastIndex == P_MAX_INDEX)
+  PINDEX index = ValueSelect(obj, false);
+  if (index >= GetSize())
     return P_MAX_INDEX;
 
-  Element * prev;
-  while ((prev = info->Predecessor(lastElement)) != &info->nil &&
-                                  prev->data->Compare(obj) == EqualTo) {
-    lastElement = prev;
-    lastIndex--;
-  }
-
-  return lastIndex;
+  /* Everything before the lower bound is less than obj, so the object found
+     is equal to obj only if the upper bound within its node is after it. */
+  PINDEX position;
+  const Element * node = info->OrderSelect(index, position);
+  return FindInNode(*node, obj, true) > position ? index : P_MAX_INDEX;
 }
 
 
-void PAbstractSortedList::RemoveElement(Element * node)
+PINDEX PAbstractSortedList::FindInNode(const Element & node, const PObject & obj, bool upper) const
 {
-  // Don't try an remove one of the special leaf nodes!
-  if (PAssertNULL(node) == &info->nil)
-    return;
+  PINDEX low = 0;
+  PINDEX high = node.count;
+  while (low < high) {
+    PINDEX mid = (low + high)/2;
+    Comparison result = node.data[mid]->Compare(obj);
+    if (result == LessThan || (upper && result == EqualTo))
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
 
-  if (node->data != NULL && reference->deleteObjects)
-    delete node->data;
 
-  Element * y = node->left == &info->nil || node->right == &info->nil ? node : info->Successor(node);
+PINDEX PAbstractSortedList::ValueSelect(const PObject & obj, bool upper) const
+{
+  PINDEX index = 0;
+  const Element * node = info->root;
+  while (node != NULL) {
+    PINDEX position = FindInNode(*node, obj, upper);
+    index += position;
+    if (node->leaf)
+      break;
 
-  Element * t = y;
-  while (t != &info->nil) {
-    t->subTreeSize--;
-    t = t->parent;
+    const Branch * branch = (const Branch *)node;
+    for (PINDEX i = 0; i < position; i++)
+      index += branch->subTreeSize[i];
+    node = branch->child[position];
   }
 
-  Element * x = y->left != &info->nil ? y->left : y->right;
-  x->parent = y->parent;
+  return index;
+}
 
-  if (y->parent == &info->nil)
-    info->root = x;
-  else if (y == y->parent->left)
-    y->parent->left = x;
-  else
-    y->parent->right = x;
-
-  if (y != node)
-    node->data = y->data;
-
-  if (y->colour == Element::Black) {
-    while (x != info->root && x->colour == Element::Black) {
-      if (x == x->parent->left) {
-        Element * w = x->parent->right;
-        if (w->colour == Element::Red) {
-          w->colour = Element::Black;
-          x->parent->colour = Element::Red;
-          LeftRotate(x->parent);
-          w = x->parent->right;
-        }
-        if (w->left->colour == Element::Black && w->right->colour == Element::Black) {
-          w->colour = Element::Red;
-          x = x->parent;
-        }
-        else {
-          if (w->right->colour == Element::Black) {
-            w->left->colour = Element::Black;
-            w->colour = Element::Red;
-            RightRotate(w);
-            w = x->parent->right;
-          }
-          w->colour = x->parent->colour;
-          x->parent->colour = Element::Black;
-          w->right->colour = Element::Black;
-          LeftRotate(x->parent);
-          x = info->root;
-        }
+
+PObject * PAbstractSortedList::RemoveElement(PINDEX index)
+{
+  /* Removal is done top down, making sure every node descended into has an
+     object to spare, so nothing needs to be rebalanced on the way back up. An
+     object in a branch is replaced by its predecessor or successor, which is
+     always in a leaf, so "replace" is the branch slot to put that into. */
+  PObject * obj = NULL;
+  PObject ** replace = NULL;
+
+  Element * node = info->root;
+  for (;;) {
+    if (node->leaf) {
+      PObject * leafObj = node->data[index];
+      node->count--;
+      memmove(&node->data[index], &node->data[index+1], (node->count - index)*sizeof(PObject *));
+      if (replace != NULL)
+        *replace = leafObj;
+      else
+        obj = leafObj;
+      break;
+    }
+
+    Branch * branch = (Branch *)node;
+    PINDEX i = 0;
+    while (index > branch->subTreeSize[i]) {
+      index -= branch->subTreeSize[i] + 1;
+      i++;
+    }
+
+    if (index == branch->subTreeSize[i]) {
+      // The object is in this branch
+      if (branch->child[i]->count >= Element::MinDegree) {
+        obj = branch->data[i];
+        replace = &branch->data[i];
+        index = --branch->subTreeSize[i];
+        node = branch->child[i];
+        continue;
       }
-      else {
-        Element * w = x->parent->left;
-        if (w->colour == Element::Red) {
-          w->colour = Element::Black;
-          x->parent->colour = Element::Red;
-          RightRotate(x->parent);
-          w = x->parent->left;
-        }
-        if (w->right->colour == Element::Black && w->left->colour == Element::Black) {
-          w->colour = Element::Red;
-          x = x->parent;
-        }
-        else {
-          if (w->left->colour == Element::Black) {
-            w->right->colour = Element::Black;
-            w->colour = Element::Red;
-            LeftRotate(w);
-            w = x->parent->left;
-          }
-          w->colour = x->parent->colour;
-          x->parent->colour = Element::Black;
-          w->left->colour = Element::Black;
-          RightRotate(x->parent);
-          x = info->root;
-        }
+
+      if (branch->child[i+1]->count >= Element::MinDegree) {
+        obj = branch->data[i];
+        replace = &branch->data[i];
+        index = 0;
+        branch->subTreeSize[i+1]--;
+        node = branch->child[i+1];
+        continue;
       }
+
+      // Neither side can spare one, merge them with the object in between
+      MergeChildren(branch, i);
+    }
+    else if (branch->child[i]->count < Element::MinDegree) {
+      if (i > 0 && branch->child[i-1]->count >= Element::MinDegree)
+        index += RightRotate(branch, i-1) + 1;
+      else if (i < branch->count && branch->child[i+1]->count >= Element::MinDegree)
+        LeftRotate(branch, i);
+      else if (i > 0) {
+        --i;
+        index += branch->subTreeSize[i] + 1;
+        MergeChildren(branch, i);
+      }
+      else
+        MergeChildren(branch, i);
     }
-    x->colour = Element::Black;
+
+    branch->subTreeSize[i]--;
+    node = branch->child[i];
   }
 
-  delete y;
+  // Tree only ever shrinks in height at the root
+  if (info->root->count == 0) {
+    Element * oldRoot = info->root;
+    info->root = oldRoot->leaf ? NULL : ((Branch *)oldRoot)->child[0];
+    Element::Destroy(oldRoot);
+  }
 
   reference->size--;
+
+  if (obj != NULL && reference->deleteObjects) {
+    delete obj;
+    obj = NULL;
+  }
+  return obj;
 }
 
 
-void PAbstractSortedList::LeftRotate(Element * node)
+void PAbstractSortedList::SplitChild(Branch * node, PINDEX index)
 {
-  Element * pivot = PAssertNULL(node)->right;
-  node->right = pivot->left;
-  if (pivot->left != &info->nil)
-    pivot->left->parent = node;
-  pivot->parent = node->parent;
-  if (node->parent == &info->nil)
-    info->root = pivot;
-  else if (node == node->parent->left)
-    node->parent->left = pivot;
+  Element * left = node->child[index];
+  Element * right;
+  if (left->leaf)
+    right = new Element(true);
   else
-    node->parent->right = pivot;
-  pivot->left = node;
-  node->parent = pivot;
-  pivot->subTreeSize = node->subTreeSize;
-  node->subTreeSize = node->left->subTreeSize + node->right->subTreeSize + 1;
-}
+    right = new Branch;
 
+  right->count = Element::MinDegree-1;
+  memcpy(right->data, &left->data[Element::MinDegree], right->count*sizeof(PObject *));
 
-void PAbstractSortedList::RightRotate(Element * node)
-{
-  Element * pivot = PAssertNULL(node)->left;
-  node->left = pivot->right;
-  if (pivot->right != &info->nil)
-    pivot->right->parent = node;
-  pivot->parent = node->parent;
-  if (node->parent == &info->nil)
-    info->root = pivot;
-  else if (node == node->parent->right)
-    node->parent->right = pivot;
-  else
-    node->parent->left = pivot;
-  pivot->right = node;
-  node->parent = pivot;
-  pivot->subTreeSize = node->subTreeSize;
-  node->subTreeSize = node->left->subTreeSize + node->right->subTreeSize + 1;
+  PINDEX rightSize = right->count;
+  if (!left->leaf) {
+    Branch * leftBranch = (Branch *)left;
+    Branch * rightBranch = (Branch *)right;
+    memcpy(rightBranch->child, &leftBranch->child[Element::MinDegree], Element::MinDegree*sizeof(Element *));
+    memcpy(rightBranch->subTreeSize, &leftBranch->subTreeSize[Element::MinDegree], Element::MinDegree*sizeof(PINDEX));
+    for (PINDEX i = 0; i < Element::MinDegree; i++)
+      rightSize += rightBranch->subTreeSize[i];
+  }
+
+  left->count = Element::MinDegree-1;
+
+  memmove(&node->data[index+1], &node->data[index], (node->count - index)*sizeof(PObject *));
+  memmove(&node->child[index+2], &node->child[index+1], (node->count - index)*sizeof(Element *));
+  memmove(&node->subTreeSize[index+2], &node->subTreeSize[index+1], (node->count - index)*sizeof(PINDEX));
+  node->data[index] = left->data[Element::MinDegree-1];
+  node->child[index+1] = right;
+  node->subTreeSize[index+1] = rightSize;
+  node->subTreeSize[index] -= rightSize + 1;
+  node->count++;
 }
 
 
-PSortedListElement * PSortedListInfo::Successor(const PSortedListElement * node) const
+void PAbstractSortedList::MergeChildren(Branch * node, PINDEX index)
 {
-  Element * next;
-  if (node->right != &nil) {
-    next = node->right;
-    while (next->left != &nil)
-      next = next->left;
-  }
-  else {
-    next = node->parent;
-    while (next != &nil && node == next->right) {
-      node = next;
-      next = node->parent;
-    }
+  Element * left = node->child[index];
+  Element * right = node->child[index+1];
+
+  left->data[left->count] = node->data[index];
+  memcpy(&left->data[left->count+1], right->data, right->count*sizeof(PObject *));
+  if (!left->leaf) {
+    Branch * leftBranch = (Branch *)left;
+    Branch * rightBranch = (Branch *)right;
+    memcpy(&leftBranch->child[left->count+1], rightBranch->child, (right->count+1)*sizeof(Element *));
+    memcpy(&leftBranch->subTreeSize[left->count+1], rightBranch->subTreeSize, (right->count+1)*sizeof(PINDEX));
   }
-  return next;
+  left->count += right->count + 1;
+  node->subTreeSize[index] += node->subTreeSize[index+1] + 1;
+
+  node->count--;
+  memmove(&node->data[index], &node->data[index+1], (node->count - index)*sizeof(PObject *));
+  memmove(&node->child[index+1], &node->child[index+2], (node->count - index)*sizeof(Element *));
+  memmove(&node->subTreeSize[index+1], &node->subTreeSize[index+2], (node->count - index)*sizeof(PINDEX));
+
+  Element::Destroy(right);
 }
 
 
-PSortedListElement * PSortedListInfo::Predecessor(const PSortedListElement * node) const
+PINDEX PAbstractSortedList::LeftRotate(Branch * node, PINDEX index)
 {
-  Element * pred;
-  if (node->left != &nil) {
-    pred = node->left;
-    while (pred->right != &nil)
-      pred = pred->right;
-  }
-  else {
-    pred = node->parent;
-    while (pred != &nil && node == pred->left) {
-      node = pred;
-      pred = node->parent;
-    }
+  // Move the first object of the right child up, and the parent down to the left
+  Element * left = node->child[index];
+  Element * right = node->child[index+1];
+
+  left->data[left->count] = node->data[index];
+  node->data[index] = right->data[0];
+  memmove(&right->data[0], &right->data[1], (right->count-1)*sizeof(PObject *));
+
+  PINDEX moved = 0;
+  if (!left->leaf) {
+    Branch * leftBranch = (Branch *)left;
+    Branch * rightBranch = (Branch *)right;
+    leftBranch->child[left->count+1] = rightBranch->child[0];
+    moved = leftBranch->subTreeSize[left->count+1] = rightBranch->subTreeSize[0];
+    memmove(&rightBranch->child[0], &rightBranch->child[1], right->count*sizeof(Element *));
+    memmove(&rightBranch->subTreeSize[0], &rightBranch->subTreeSize[1], right->count*sizeof(PINDEX));
   }
-  return pred;
+
+  left->count++;
+  right->count--;
+  node->subTreeSize[index] += moved + 1;
+  node->subTreeSize[index+1] -= moved + 1;
+  return moved;
 }
 
 
-PSortedListElement * PSortedListInfo::OrderSelect(PSortedListElement * node, PINDEX index) const
+PINDEX PAbstractSortedList::RightRotate(Branch * node, PINDEX index)
 {
-  PINDEX r = node->left->subTreeSize+1;
-  if (index == r)
-    return node;
+  // Move the last object of the left child up, and the parent down to the right
+  Element * left = node->child[index];
+  Element * right = node->child[index+1];
 
-  if (index < r) {
-    if (node->left != &nil)
-      return OrderSelect(node->left, index);
-  }
-  else {
-    if (node->right != &nil)
-      return OrderSelect(node->right, index - r);
+  memmove(&right->data[1], &right->data[0], right->count*sizeof(PObject *));
+  right->data[0] = node->data[index];
+  node->data[index] = left->data[left->count-1];
+
+  PINDEX moved = 0;
+  if (!left->leaf) {
+    Branch * leftBranch = (Branch *)left;
+    Branch * rightBranch = (Branch *)right;
+    memmove(&rightBranch->child[1], &rightBranch->child[0], (right->count+1)*sizeof(Element *));
+    memmove(&rightBranch->subTreeSize[1], &rightBranch->subTreeSize[0], (right->count+1)*sizeof(PINDEX));
+    rightBranch->child[0] = leftBranch->child[left->count];
+    moved = rightBranch->subTreeSize[0] = leftBranch->subTreeSize[left->count];
   }
 
-  PAssertAlways2("PAbstractSortedList::Element", "Order select failed!");
-  return (Element *)&nil;
+  left->count--;
+  right->count++;
+  node->subTreeSize[index] -= moved + 1;
+  node->subTreeSize[index+1] += moved + 1;
+  return moved;
 }
 
 
-PINDEX PAbstractSortedList::ValueSelect(const Element * node,
-                                        const PObject & obj,
-                                        const Element ** lastElement) const
+const PSortedListElement * PSortedListInfo::OrderSelect(PINDEX index, PINDEX & position) const
 {
-  if (node != &info->nil) {
-    switch (node->data->Compare(obj)) {
-      case PObject::LessThan :
-      {
-        PINDEX index = ValueSelect(node->right, obj, lastElement);
-        if (index != P_MAX_INDEX)
-          return node->left->subTreeSize + index + 1;
-        break;
-      }
-
-      case PObject::GreaterThan :
-        return ValueSelect(node->left, obj, lastElement);
+  const Element * node = root;
+  while (!node->leaf) {
+    const Branch * branch = (const Branch *)node;
+    PINDEX i = 0;
+    while (index > branch->subTreeSize[i]) {
+      index -= branch->subTreeSize[i] + 1;
+      i++;
+    }
 
-      default :
-        *lastElement = node;
-        return node->left->subTreeSize;
+    if (index == branch->subTreeSize[i]) {
+      position = i;
+      return node;
     }
+
+    node = branch->child[i];
   }
 
-  return P_MAX_INDEX;
+  position = index;
+  return node;
 }
 
 
 void PAbstractSortedList::DeleteSubTrees(Element * node, PBoolean deleteObject)
 {
-  if (node->left != &info->nil) {
-    DeleteSubTrees(node->left, deleteObject);
-    delete node->left;
-    node->left = &info->nil;
-  }
-  if (node->right != &info->nil) {
-    DeleteSubTrees(node->right, deleteObject);
-    delete node->right;
-    node->right = &info->nil;
+  if (!node->leaf) {
+    Branch * branch = (Branch *)node;
+    for (PINDEX i = 0; i <= node->count; i++)
+      DeleteSubTrees(branch->child[i], deleteObject);
   }
+
   if (deleteObject) {
-    delete node->data;
-    node->data = NULL;
+    for (PINDEX i = 0; i < node->count; i++)
+      delete node->data[i];
   }
+
+  Element::Destroy(node);
 }
 
 
@@ -47,6 +47,8 @@ extern "C" int vsprintf(char *, const char *, va_list);
 
 #define regexpression()  ((regex_t *)expression)
 
+#include "pregex.h"
+
 #if !P_USE_INLINES
 #include "ptlib/contain.inl"
 #endif
@@ -2407,45 +2409,36 @@ void PSortedStringList::ReadFrom(istream & strm)
 
 PINDEX PSortedStringList::GetNextStringsIndex(const PString & str) const
 {
-  PINDEX len = str.GetLength();
-  Element * lastElement = NULL;
-  PINDEX lastIndex = InternalStringSelect(str, len, info->root, lastElement);
-
-  if (lastIndex != 0) {
-    Element * prev;
-    while ((prev = info->Predecessor(lastElement)) != &info->nil &&
-                    ((PString *)prev->data)->NumCompare(str, len) >= EqualTo) {
-      lastElement = prev;
-      lastIndex--;
-    }
-  }
-
-  return lastIndex;
+  return InternalStringSelect(str, str.GetLength(), info->root);
 }
 
 
 PINDEX PSortedStringList::InternalStringSelect(const char * str,
                                                PINDEX len,
-                                               Element * thisElement,
-                                               Element * & lastElement) const
+                                               const Element * thisElement) const
 {
-  if (thisElement == &info->nil)
+  if (thisElement == NULL)
     return 0;
 
-  switch (((PString *)thisElement->data)->NumCompare(str, len)) {
-    case PObject::LessThan :
-    {
-      PINDEX index = InternalStringSelect(str, len, thisElement->right, lastElement);
-      return thisElement->left->subTreeSize + index + 1;
-    }
+  // Find the first string in the node that is not less than str
+  PINDEX low = 0;
+  PINDEX high = thisElement->count;
+  while (low < high) {
+    PINDEX mid = (low + high)/2;
+    if (((PString *)thisElement->data[mid])->NumCompare(str, len) == PObject::LessThan)
+      low = mid + 1;
+    else
+      high = mid;
+  }
 
-    case PObject::GreaterThan :
-      return InternalStringSelect(str, len, thisElement->left, lastElement);
+  if (thisElement->leaf)
+    return low;
 
-    default :
-      lastElement = thisElement;
-      return thisElement->left->subTreeSize;
-  }
+  const Branch * branch = (const Branch *)thisElement;
+  PINDEX index = low;
+  for (PINDEX i = 0; i < low; i++)
+    index += branch->subTreeSize[i];
+  return index + InternalStringSelect(str, len, branch->child[low]);
 }
 
 
@@ -2690,6 +2683,7 @@ PRegularExpression::PRegularExpression()
 {
   lastError   = NotCompiled;
   expression  = NULL;
+  program     = NULL;
   flagsSaved  = IgnoreCase;
 }
 
@@ -2697,6 +2691,7 @@ PRegularExpression::PRegularExpression()
 PRegularExpression::PRegularExpression(const PString & pattern, int flags)
 {
   expression = NULL;
+  program = NULL;
   bool b = Compile(pattern, flags);
   PAssert(b, PString("regular expression compile failed : " + GetErrorText()));
 }
@@ -2705,6 +2700,7 @@ PRegularExpression::PRegularExpression(const PString & pattern, int flags)
 PRegularExpression::PRegularExpression(const char * pattern, int flags)
 {
   expression = NULL;
+  program = NULL;
   bool b = Compile(pattern, flags);
   PAssert(b, PString("regular expression compile failed : " + GetErrorText()));
 }
@@ -2712,6 +2708,7 @@ PRegularExpression::PRegularExpression(const char * pattern, int flags)
 PRegularExpression::PRegularExpression(const PRegularExpression & from)
 {
   expression   = NULL;
+  program      = NULL;
   bool b = Compile(from.patternSaved, from.flagsSaved);
   PAssert(b, PString("regular expression compile failed : " + GetErrorText()));
 }
@@ -2735,6 +2732,7 @@ PRegularExpression::~PRegularExpression()
     regfree(regexpression());
     delete regexpression();
   }
+  delete program;
 }
 
 
@@ -2774,11 +2772,24 @@ PBoolean PRegularExpression::Compile(const char * pattern, int flags)
     delete regexpression();
     expression = NULL;
   }
+  delete program;
+  program = NULL;
+
   if (pattern == NULL || *pattern == '\0')
     lastError = BadPattern;
   else {
     expression = new regex_t;
     lastError = (ErrorCodes)regcomp(regexpression(), pattern, flags);
+
+    // regcomp() still decides what is valid, and finds subexpressions
+    if (lastError == NoError) {
+      program = new PRegexProgram;
+      if (!program->Add(pattern, flags, 0)) {
+        PTRACE(5, "PTLib\tRegular expression \"" << pattern << "\" executed by regexec()");
+        delete program;
+        program = NULL;
+      }
+    }
   }
   return lastError == NoError;
 }
@@ -2814,6 +2825,19 @@ PBoolean PRegularExpression::Execute(const char * cstr, PINDEX & start, PINDEX &
   if (lastError != NoError && lastError != NoMatch)
     return PFalse;
 
+  if (program != NULL) {
+    switch (program->Find(cstr, start, len, flags)) {
+      case PRegexProgram::Matched :
+        lastError = NoError;
+        return PTrue;
+      case PRegexProgram::NoMatch :
+        lastError = NoMatch;
+        return PFalse;
+      default :
+        break;
+    }
+  }
+
   regmatch_t match;
 
   lastError = (ErrorCodes)regexec(regexpression(), cstr, 1, &match, flags);
@@ -2866,6 +2890,22 @@ PBoolean PRegularExpression::Execute(const char * cstr,
   }
   ends.SetSize(count);
 
+  if (program != NULL) {
+    PINDEX start, len;
+    PRegexProgram::Result result = count > 1 ? program->Match(cstr, flags)
+                                             : program->Find(cstr, start, len, flags);
+    if (result == PRegexProgram::NoMatch) {
+      lastError = NoMatch;
+      return PFalse;
+    }
+    if (result == PRegexProgram::Matched && count == 1) {
+      starts[0] = start;
+      ends[0] = start + len;
+      lastError = NoError;
+      return PTrue;
+    }
+  }
+
   regmatch_t * matches = new regmatch_t[count];
 
   lastError = (ErrorCodes)::regexec(regexpression(), cstr, count, matches, flags);
@@ -2895,6 +2935,21 @@ PBoolean PRegularExpression::Execute(const char * cstr, PStringArray & substring
     count = 1;
   }
 
+  if (program != NULL) {
+    PINDEX start, len;
+    PRegexProgram::Result result = count > 1 ? program->Match(cstr, flags)
+                                             : program->Find(cstr, start, len, flags);
+    if (result == PRegexProgram::NoMatch) {
+      lastError = NoMatch;
+      return PFalse;
+    }
+    if (result == PRegexProgram::Matched && count == 1) {
+      substring[0] = PString(cstr+start, len);
+      lastError = NoError;
+      return PTrue;
+    }
+  }
+
   regmatch_t * matches = new regmatch_t[count];
 
   lastError = (ErrorCodes)::regexec(regexpression(), cstr, count, matches, flags);
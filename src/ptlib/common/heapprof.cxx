@@ -0,0 +1,604 @@
+/*
+ * heapprof.cxx
+ *
+ * Sampling heap profiler for release builds.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#if P_HEAP_PROFILER
+
+#include <ptlib/pprocess.h>
+
+#include <execinfo.h>
+#include <math.h>
+#include <fstream>
+#include <algorithm>
+
+
+/* Sampled allocations that are in use are kept in an open addressed table,
+   each probing a fixed window of slots so removal needs no tombstones. A
+   table of small counters, indexed by a different hash of the address,
+   tells a free that its pointer cannot have been sampled without touching
+   the main table.
+
+   Stacks are kept in an insert only table and hold the totals, so a dump
+   only has to walk the stacks. Everything is allocated on the first
+   Start() and never released, as frees may refer to it at any time.
+ */
+
+static const unsigned HeapSkipFrames     = 2;       // RecordSample() and Allocate()/operator new
+static const unsigned HeapMaxDepth       = 32;
+static const unsigned HeapLiveBits       = 16;
+static const unsigned HeapLiveWindow     = 16;
+static const unsigned HeapStackBits      = 13;
+static const unsigned HeapStackWindow    = 32;
+static const unsigned HeapFilterBits     = 18;
+static const unsigned HeapSummaryStacks  = 50;
+static const unsigned HeapNoStack        = ~0U;
+
+static void * const HeapReservedSlot = (void *)1;
+
+
+struct PHeapProfileSample
+{
+  void   * volatile m_ptr;
+  size_t            m_size;
+  unsigned          m_stack;
+};
+
+
+struct PHeapProfileStack
+{
+  volatile unsigned m_state;            // StackFree, StackBuilding or StackReady
+  unsigned          m_hash;
+  unsigned          m_depth;
+  const char      * m_className;
+  void            * m_frames[HeapMaxDepth];
+  volatile PUInt64  m_allocCount;
+  volatile PUInt64  m_allocBytes;
+  volatile PUInt64  m_liveCount;
+  volatile PUInt64  m_liveBytes;
+};
+
+enum { StackFree, StackBuilding, StackReady };
+
+
+static PHeapProfileSample * volatile HeapLive;
+static PHeapProfileStack  * volatile HeapStacks;
+static unsigned short     * volatile HeapFilter;
+static volatile PUInt64              HeapSampleCount;
+static volatile PUInt64              HeapDroppedCount;
+
+#define HEAP_TLS __thread __attribute__((tls_model("initial-exec")))
+
+static HEAP_TLS long    t_bytesUntilSample;
+static HEAP_TLS bool    t_seeded;
+static HEAP_TLS bool    t_busy;
+static HEAP_TLS PUInt64 t_random;
+
+bool   PHeapProfiler::s_running;
+size_t PHeapProfiler::s_sampleBytes = 512*1024;
+
+
+static inline PUInt64 HashPointer(const void * ptr)
+{
+  return ((PUInt64)(size_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+
+static inline unsigned LiveSlot(PUInt64 hash)
+{
+  return (unsigned)(hash >> (64 - HeapLiveBits));
+}
+
+
+static inline unsigned FilterSlot(PUInt64 hash)
+{
+  return (unsigned)(hash >> 8) & ((1 << HeapFilterBits) - 1);
+}
+
+
+// Exponential interval, so samples are a Poisson process over bytes allocated
+static long NextSampleInterval()
+{
+  if (!t_seeded) {
+    t_random = (PUInt64)(size_t)&t_random ^ (PUInt64)PTimer::HighResolutionTick();
+    t_seeded = true;
+  }
+
+  // xorshift64*
+  t_random ^= t_random >> 12;
+  t_random ^= t_random << 25;
+  t_random ^= t_random >> 27;
+  PUInt64 bits = (t_random * 0x2545F4914F6CDD1DULL) >> 11;
+  double uniform = (bits + 1.0) / (double)(1ULL << 53);
+
+  double interval = -log(uniform) * PHeapProfiler::GetSampleBytes();
+  return interval < 2e9 ? (long)interval + 1 : 2000000000L;
+}
+
+
+static unsigned FindStack(void * const * frames, unsigned depth, const char * className)
+{
+  unsigned hash = (unsigned)(size_t)className * 2654435761U;
+  for (unsigned i = 0; i < depth; ++i)
+    hash = (hash ^ (unsigned)((size_t)frames[i] >> 2)) * 16777619U;
+
+  PHeapProfileStack * stacks = HeapStacks;
+  unsigned mask = (1 << HeapStackBits) - 1;
+  for (unsigned probe = 0; probe < HeapStackWindow; ++probe) {
+    unsigned index = (hash + probe) & mask;
+    PHeapProfileStack & stack = stacks[index];
+
+    if (stack.m_state == StackFree &&
+        __sync_bool_compare_and_swap(&stack.m_state, (unsigned)StackFree, (unsigned)StackBuilding)) {
+      stack.m_hash = hash;
+      stack.m_depth = depth;
+      stack.m_className = className;
+      memcpy(stack.m_frames, frames, depth*sizeof(void *));
+      __sync_synchronize();
+      stack.m_state = StackReady;
+      return index;
+    }
+
+    // A stack still being built by another thread is passed over, at worst
+    // giving the same stack two entries
+    if (stack.m_state == StackReady &&
+        stack.m_hash == hash &&
+        stack.m_depth == depth &&
+        stack.m_className == className &&
+        memcmp(stack.m_frames, frames, depth*sizeof(void *)) == 0)
+      return index;
+  }
+
+  return HeapNoStack;
+}
+
+
+static __attribute__((noinline)) void RecordSample(void * ptr, size_t nSize, const char * className)
+{
+  // A thread's first allocation only starts its count down
+  bool first = !t_seeded;
+  t_bytesUntilSample = NextSampleInterval();
+
+  if (first || t_busy || HeapLive == NULL)
+    return;
+  t_busy = true; // backtrace() may allocate
+
+  void * frames[HeapMaxDepth+HeapSkipFrames];
+  int depth = backtrace(frames, PARRAYSIZE(frames));
+  if (depth < (int)HeapSkipFrames)
+    depth = HeapSkipFrames;
+
+  unsigned stackIndex = FindStack(frames+HeapSkipFrames, depth-HeapSkipFrames, className);
+  if (stackIndex == HeapNoStack) {
+    __sync_fetch_and_add(&HeapDroppedCount, 1);
+    t_busy = false;
+    return;
+  }
+
+  PUInt64 hash = HashPointer(ptr);
+  unsigned mask = (1 << HeapLiveBits) - 1;
+  for (unsigned probe = 0; probe < HeapLiveWindow; ++probe) {
+    PHeapProfileSample & sample = HeapLive[(LiveSlot(hash) + probe) & mask];
+    if (sample.m_ptr == NULL && __sync_bool_compare_and_swap(&sample.m_ptr, (void *)NULL, HeapReservedSlot)) {
+      sample.m_size = nSize;
+      sample.m_stack = stackIndex;
+      __sync_synchronize();
+      sample.m_ptr = ptr;
+
+      __sync_fetch_and_add(&HeapFilter[FilterSlot(hash)], 1);
+
+      PHeapProfileStack & stack = HeapStacks[stackIndex];
+      __sync_fetch_and_add(&stack.m_allocCount, 1);
+      __sync_fetch_and_add(&stack.m_allocBytes, nSize);
+      __sync_fetch_and_add(&stack.m_liveCount, 1);
+      __sync_fetch_and_add(&stack.m_liveBytes, nSize);
+      __sync_fetch_and_add(&HeapSampleCount, 1);
+      t_busy = false;
+      return;
+    }
+  }
+
+  __sync_fetch_and_add(&HeapDroppedCount, 1);
+  t_busy = false;
+}
+
+
+static void RemoveSample(void * ptr, PUInt64 hash)
+{
+  unsigned mask = (1 << HeapLiveBits) - 1;
+  for (unsigned probe = 0; probe < HeapLiveWindow; ++probe) {
+    PHeapProfileSample & sample = HeapLive[(LiveSlot(hash) + probe) & mask];
+    if (sample.m_ptr == ptr) {
+      PHeapProfileStack & stack = HeapStacks[sample.m_stack];
+      __sync_fetch_and_sub(&stack.m_liveCount, 1);
+      __sync_fetch_and_sub(&stack.m_liveBytes, sample.m_size);
+      __sync_fetch_and_sub(&HeapFilter[FilterSlot(hash)], 1);
+      __sync_synchronize();
+      sample.m_ptr = NULL;
+      return;
+    }
+  }
+}
+
+
+static void * HeapMalloc(size_t nSize)
+{
+  for (;;) {
+    void * ptr = malloc(nSize != 0 ? nSize : 1);
+    if (ptr != NULL)
+      return ptr;
+
+#if (__cplusplus >= 201103L) // C++11
+    std::new_handler handler = std::get_new_handler();
+#else
+    std::new_handler handler = std::set_new_handler(NULL);
+    std::set_new_handler(handler);
+#endif
+    if (handler == NULL) {
+#ifdef __EXCEPTIONS
+      throw std::bad_alloc();
+#else
+      PAssertAlways(POutOfMemory);
+      abort();
+#endif
+    }
+    handler();
+  }
+}
+
+
+static inline __attribute__((always_inline)) void * HeapAllocate(size_t nSize, const char * className)
+{
+  void * ptr = HeapMalloc(nSize);
+  if (PHeapProfiler::IsRunning() && (t_bytesUntilSample -= (long)nSize) < 0)
+    RecordSample(ptr, nSize, className);
+  return ptr;
+}
+
+
+static inline __attribute__((always_inline)) void HeapDeallocate(void * ptr)
+{
+  unsigned short * filter = HeapFilter;
+  if (filter != NULL && ptr != NULL) {
+    PUInt64 hash = HashPointer(ptr);
+    if (filter[FilterSlot(hash)] != 0)
+      RemoveSample(ptr, hash);
+  }
+  free(ptr);
+}
+
+
+void * PHeapProfiler::Allocate(size_t nSize, const char * className)
+{
+  return HeapAllocate(nSize, className);
+}
+
+
+void * PHeapProfiler::Allocate(size_t nSize, const char * className, const std::nothrow_t &)
+{
+#ifdef __EXCEPTIONS
+  try {
+    return HeapAllocate(nSize, className);
+  }
+  catch (const std::bad_alloc &) {
+    return NULL;
+  }
+#else
+  return HeapAllocate(nSize, className);
+#endif
+}
+
+
+void PHeapProfiler::Deallocate(void * ptr)
+{
+  HeapDeallocate(ptr);
+}
+
+
+void PHeapProfiler::Start(size_t sampleBytes)
+{
+  static PCriticalSection mutex;
+  PWaitAndSignal lock(mutex);
+
+  if (HeapLive == NULL) {
+    // Load the unwinder now, so the first sample does not
+    void * frames[2];
+    backtrace(frames, PARRAYSIZE(frames));
+
+    HeapStacks = (PHeapProfileStack *)calloc(1 << HeapStackBits, sizeof(PHeapProfileStack));
+    HeapFilter = (unsigned short *)calloc(1 << HeapFilterBits, sizeof(unsigned short));
+    __sync_synchronize();
+    HeapLive = (PHeapProfileSample *)calloc(1 << HeapLiveBits, sizeof(PHeapProfileSample));
+  }
+
+  s_sampleBytes = sampleBytes > 0 ? sampleBytes : 1;
+  s_running = true;
+
+  PTRACE(3, "PTLib\tHeap profiler started, sampling every " << s_sampleBytes << " bytes");
+}
+
+
+void PHeapProfiler::Stop()
+{
+  s_running = false;
+  PTRACE(3, "PTLib\tHeap profiler stopped");
+}
+
+
+// Estimate of what the sampled totals represent, for samples of the mean size
+static double GetScale(PUInt64 count, PUInt64 bytes)
+{
+  if (count == 0)
+    return 1;
+  double size = (double)bytes/count;
+  return 1/(1 - exp(-size/PHeapProfiler::GetSampleBytes()));
+}
+
+
+struct PHeapProfileEntry
+{
+  const PHeapProfileStack * m_stack;
+  PUInt64 m_liveCount;
+  PUInt64 m_liveBytes;
+  PUInt64 m_allocCount;
+  PUInt64 m_allocBytes;
+  double  m_estimatedBytes;
+
+  bool operator<(const PHeapProfileEntry & other) const { return m_estimatedBytes > other.m_estimatedBytes; }
+};
+
+
+static void GetEntries(std::vector<PHeapProfileEntry> & entries)
+{
+  if (HeapStacks == NULL)
+    return;
+
+  for (unsigned i = 0; i < (1U << HeapStackBits); ++i) {
+    const PHeapProfileStack & stack = HeapStacks[i];
+    if (stack.m_state != StackReady)
+      continue;
+
+    PHeapProfileEntry entry;
+    entry.m_stack = &stack;
+    entry.m_liveCount = stack.m_liveCount;
+    entry.m_liveBytes = stack.m_liveBytes;
+    entry.m_allocCount = stack.m_allocCount;
+    entry.m_allocBytes = stack.m_allocBytes;
+    entry.m_estimatedBytes = entry.m_liveBytes*GetScale(entry.m_liveCount, entry.m_liveBytes);
+    entries.push_back(entry);
+  }
+}
+
+
+void PHeapProfiler::GetTotals(Totals & totals)
+{
+  std::vector<PHeapProfileEntry> entries;
+  GetEntries(entries);
+
+  totals.m_samples = HeapSampleCount;
+  totals.m_dropped = HeapDroppedCount;
+  totals.m_liveSamples = 0;
+  double bytes = 0, objects = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    totals.m_liveSamples += entries[i].m_liveCount;
+    double scale = GetScale(entries[i].m_liveCount, entries[i].m_liveBytes);
+    bytes += entries[i].m_liveBytes*scale;
+    objects += entries[i].m_liveCount*scale;
+  }
+  totals.m_liveBytes = (PUInt64)bytes;
+  totals.m_liveObjects = (PUInt64)objects;
+}
+
+
+static void DumpPprof(ostream & strm, const std::vector<PHeapProfileEntry> & entries)
+{
+  PUInt64 liveCount = 0, liveBytes = 0, allocCount = 0, allocBytes = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    liveCount += entries[i].m_liveCount;
+    liveBytes += entries[i].m_liveBytes;
+    allocCount += entries[i].m_allocCount;
+    allocBytes += entries[i].m_allocBytes;
+  }
+
+  strm << "heap profile: " << liveCount << ": " << liveBytes
+       << " [" << allocCount << ": " << allocBytes << "] @ heap_v2/" << PHeapProfiler::GetSampleBytes() << '\n';
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const PHeapProfileEntry & entry = entries[i];
+    strm << setw(6) << entry.m_liveCount << ": " << setw(8) << entry.m_liveBytes
+         << " [" << setw(6) << entry.m_allocCount << ": " << setw(8) << entry.m_allocBytes << "] @";
+    for (unsigned f = 0; f < entry.m_stack->m_depth; ++f)
+      strm << " 0x" << hex << (size_t)entry.m_stack->m_frames[f] << dec;
+    strm << '\n';
+  }
+
+  strm << "\nMAPPED_LIBRARIES:\n";
+  std::ifstream maps("/proc/self/maps");
+  strm << maps.rdbuf();
+}
+
+
+static void DumpSummary(ostream & strm, std::vector<PHeapProfileEntry> & entries)
+{
+  PHeapProfiler::Totals totals;
+  PHeapProfiler::GetTotals(totals);
+
+  strm << "Heap profile: sampling every " << PHeapProfiler::GetSampleBytes() << " bytes, "
+       << totals.m_liveSamples << " of " << totals.m_samples << " samples in use, estimated "
+       << totals.m_liveBytes << " bytes in " << totals.m_liveObjects << " allocations";
+  if (totals.m_dropped > 0)
+    strm << ", " << totals.m_dropped << " samples dropped";
+  strm << '\n';
+
+  std::sort(entries.begin(), entries.end());
+
+  for (size_t i = 0; i < entries.size() && i < HeapSummaryStacks; ++i) {
+    const PHeapProfileEntry & entry = entries[i];
+    if (entry.m_liveCount == 0)
+      break;
+
+    double scale = GetScale(entry.m_liveCount, entry.m_liveBytes);
+    strm << '\n' << (PUInt64)entry.m_estimatedBytes << " bytes in "
+         << (PUInt64)(entry.m_liveCount*scale) << " allocations";
+    if (entry.m_stack->m_className != NULL)
+      strm << " of " << entry.m_stack->m_className;
+    strm << '\n';
+
+    char ** symbols = backtrace_symbols(entry.m_stack->m_frames, entry.m_stack->m_depth);
+    for (unsigned f = 0; f < entry.m_stack->m_depth; ++f) {
+      strm << "    ";
+      if (symbols != NULL)
+        strm << symbols[f];
+      else
+        strm << entry.m_stack->m_frames[f];
+      strm << '\n';
+    }
+    free(symbols);
+  }
+}
+
+
+void PHeapProfiler::Dump(ostream & strm, Formats format)
+{
+  std::vector<PHeapProfileEntry> entries;
+  GetEntries(entries);
+
+  if (format == Summary)
+    DumpSummary(strm, entries);
+  else
+    DumpPprof(strm, entries);
+
+  strm.flush();
+}
+
+
+bool PHeapProfiler::DumpToFile(const char * filename, Formats format)
+{
+  static PAtomicInteger sequence;
+
+  PString name = filename;
+  if (name.IsEmpty())
+    name = psprintf("%s.%u.%u.heap",
+                    (const char *)PProcess::Current().GetName(),
+                    (unsigned)PProcess::GetCurrentProcessID(),
+                    (unsigned)++sequence);
+
+  std::ofstream file((const char *)name);
+  if (!file.is_open()) {
+    PTRACE(2, "PTLib\tCould not create heap profile \"" << name << '"');
+    return false;
+  }
+
+  Dump(file, format);
+  PTRACE(3, "PTLib\tWrote heap profile \"" << name << '"');
+  return file.good();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+#if (__cplusplus >= 201103L) // C++11
+void* operator new(std::size_t nSize) noexcept(false)
+#else
+void * operator new(size_t nSize) throw (std::bad_alloc)
+#endif
+{
+  return HeapAllocate(nSize, NULL);
+}
+
+
+#if (__cplusplus >= 201103L) // C++11
+void* operator new[](std::size_t nSize) noexcept(false)
+#else
+void * operator new[](size_t nSize) throw (std::bad_alloc)
+#endif
+{
+  return HeapAllocate(nSize, NULL);
+}
+
+
+#if (__cplusplus >= 201103L) // C++11
+void operator delete(void * ptr) noexcept
+#else
+void operator delete(void * ptr) throw()
+#endif
+{
+  HeapDeallocate(ptr);
+}
+
+
+#if (__cplusplus >= 201103L) // C++11
+void operator delete[](void * ptr) noexcept
+#else
+void operator delete[](void * ptr) throw()
+#endif
+{
+  HeapDeallocate(ptr);
+}
+
+
+#if (__cplusplus >= 201103L) // C++11
+void * operator new(std::size_t nSize, const std::nothrow_t & nothrow) noexcept
+#else
+void * operator new(size_t nSize, const std::nothrow_t & nothrow) throw()
+#endif
+{
+  return PHeapProfiler::Allocate(nSize, NULL, nothrow);
+}
+
+
+#if (__cplusplus >= 201103L) // C++11
+void * operator new[](std::size_t nSize, const std::nothrow_t & nothrow) noexcept
+#else
+void * operator new[](size_t nSize, const std::nothrow_t & nothrow) throw()
+#endif
+{
+  return PHeapProfiler::Allocate(nSize, NULL, nothrow);
+}
+
+
+#if (__cplusplus >= 201103L) // C++11
+void operator delete(void * ptr, const std::nothrow_t &) noexcept
+#else
+void operator delete(void * ptr, const std::nothrow_t &) throw()
+#endif
+{
+  HeapDeallocate(ptr);
+}
+
+
+#if (__cplusplus >= 201103L) // C++11
+void operator delete[](void * ptr, const std::nothrow_t &) noexcept
+#else
+void operator delete[](void * ptr, const std::nothrow_t &) throw()
+#endif
+{
+  HeapDeallocate(ptr);
+}
+
+
+#endif // P_HEAP_PROFILER
+
+
+// End Of File ///////////////////////////////////////////////////////////////
@@ -70,6 +70,9 @@
  * scaled quantization values.  However, that problem does not arise if
  * we use floating point arithmetic.
  *
+ * Modified for PTLib: added SSE2 and AVX2 versions of the same algorithm,
+ * which give identical output, and tinyjpeg_select_idct() to choose one.
+ *
  *$Log$
  *Revision 1.7  2007/03/04 19:34:22  dsandras
  *Fixed green screen problem with some MJPEG cameras thanks Luc Saillard
@@ -309,3 +312,229 @@ tinyjpeg_idct_float (struct component *compptr, uint8_t *output_buf, int stride)
 #endif  
 }
 
+
+#if TINYJPEG_SIMD
+
+#include <immintrin.h>
+
+#define IDCT_INLINE inline __attribute__((always_inline))
+
+/*
+ * The one dimensional AA&N IDCT of tinyjpeg_idct_float(), on vectors holding
+ * the same coefficient of 4 or 8 columns (or rows). The operations are in
+ * the same order, so the results are the same to the last bit. Columns with
+ * no AC terms need no short cut, as the full calculation gives the DC value.
+ */
+template <typename V>
+static IDCT_INLINE void idct_1d(V *v)
+{
+  V tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+  V tmp10, tmp11, tmp12, tmp13;
+  V z5, z10, z11, z12, z13;
+
+  /* Even part */
+
+  tmp10 = v[0] + v[4];
+  tmp11 = v[0] - v[4];
+
+  tmp13 = v[2] + v[6];
+  tmp12 = (v[2] - v[6]) * ((FAST_FLOAT) 1.414213562) - tmp13;
+
+  tmp0 = tmp10 + tmp13;
+  tmp3 = tmp10 - tmp13;
+  tmp1 = tmp11 + tmp12;
+  tmp2 = tmp11 - tmp12;
+
+  /* Odd part */
+
+  z13 = v[5] + v[3];
+  z10 = v[5] - v[3];
+  z11 = v[1] + v[7];
+  z12 = v[1] - v[7];
+
+  tmp7 = z11 + z13;
+  tmp11 = (z11 - z13) * ((FAST_FLOAT) 1.414213562);
+
+  z5 = (z10 + z12) * ((FAST_FLOAT) 1.847759065);
+  tmp10 = ((FAST_FLOAT) 1.082392200) * z12 - z5;
+  tmp12 = ((FAST_FLOAT) -2.613125930) * z10 + z5;
+
+  tmp6 = tmp12 - tmp7;
+  tmp5 = tmp11 - tmp6;
+  tmp4 = tmp10 + tmp5;
+
+  v[0] = tmp0 + tmp7;
+  v[7] = tmp0 - tmp7;
+  v[1] = tmp1 + tmp6;
+  v[6] = tmp1 - tmp6;
+  v[2] = tmp2 + tmp5;
+  v[5] = tmp2 - tmp5;
+  v[4] = tmp3 + tmp4;
+  v[3] = tmp3 - tmp4;
+}
+
+
+/* As descale_and_clamp(), on the truncated values of one column of 8 rows. */
+static IDCT_INLINE __m128i descale_column(__m128i rows0to3, __m128i rows4to7)
+{
+  const __m128i round = _mm_set1_epi32(1 << 2);
+  const __m128i offset = _mm_set1_epi32(128);
+  rows0to3 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(rows0to3, round), 3), offset);
+  rows4to7 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(rows4to7, round), 3), offset);
+  return _mm_packs_epi32(rows0to3, rows4to7);
+}
+
+
+/* Transpose the 8 columns of 16 bit results to rows, clamp and store them. */
+static IDCT_INLINE void store_columns(__m128i *c, uint8_t *output_buf, int stride)
+{
+  __m128i a0 = _mm_unpacklo_epi16(c[0], c[1]);
+  __m128i a1 = _mm_unpackhi_epi16(c[0], c[1]);
+  __m128i a2 = _mm_unpacklo_epi16(c[2], c[3]);
+  __m128i a3 = _mm_unpackhi_epi16(c[2], c[3]);
+  __m128i a4 = _mm_unpacklo_epi16(c[4], c[5]);
+  __m128i a5 = _mm_unpackhi_epi16(c[4], c[5]);
+  __m128i a6 = _mm_unpacklo_epi16(c[6], c[7]);
+  __m128i a7 = _mm_unpackhi_epi16(c[6], c[7]);
+
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+  /* Rows 0 and 1, 2 and 3, ... each pair packed to bytes in one register */
+  __m128i r01 = _mm_packus_epi16(_mm_unpacklo_epi64(b0, b4), _mm_unpackhi_epi64(b0, b4));
+  __m128i r23 = _mm_packus_epi16(_mm_unpacklo_epi64(b1, b5), _mm_unpackhi_epi64(b1, b5));
+  __m128i r45 = _mm_packus_epi16(_mm_unpacklo_epi64(b2, b6), _mm_unpackhi_epi64(b2, b6));
+  __m128i r67 = _mm_packus_epi16(_mm_unpacklo_epi64(b3, b7), _mm_unpackhi_epi64(b3, b7));
+
+  _mm_storel_epi64((__m128i *)(output_buf + 0*stride), r01);
+  _mm_storel_epi64((__m128i *)(output_buf + 1*stride), _mm_unpackhi_epi64(r01, r01));
+  _mm_storel_epi64((__m128i *)(output_buf + 2*stride), r23);
+  _mm_storel_epi64((__m128i *)(output_buf + 3*stride), _mm_unpackhi_epi64(r23, r23));
+  _mm_storel_epi64((__m128i *)(output_buf + 4*stride), r45);
+  _mm_storel_epi64((__m128i *)(output_buf + 5*stride), _mm_unpackhi_epi64(r45, r45));
+  _mm_storel_epi64((__m128i *)(output_buf + 6*stride), r67);
+  _mm_storel_epi64((__m128i *)(output_buf + 7*stride), _mm_unpackhi_epi64(r67, r67));
+}
+
+
+/*
+ * SSE2: the columns in two halves of 4, a 4x4 block transpose, then the
+ * rows in two halves of 4.
+ */
+static void tinyjpeg_idct_sse2(struct component *compptr, uint8_t *output_buf, int stride)
+{
+  __m128 w[8][2];
+  int h, k;
+
+  for (h = 0; h < 2; h++) {
+    __m128 v[8];
+    for (k = 0; k < 8; k++) {
+      __m128i coef = _mm_loadl_epi64((const __m128i *)(compptr->DCT + k*DCTSIZE + h*4));
+      coef = _mm_srai_epi32(_mm_unpacklo_epi16(coef, coef), 16);
+      v[k] = _mm_mul_ps(_mm_cvtepi32_ps(coef), _mm_loadu_ps(compptr->Q_table + k*DCTSIZE + h*4));
+    }
+    idct_1d(v);
+    for (k = 0; k < 8; k++)
+      w[k][h] = v[k];
+  }
+
+  /* w[row][half] to w[column][half of rows] */
+  _MM_TRANSPOSE4_PS(w[0][0], w[1][0], w[2][0], w[3][0]);
+  _MM_TRANSPOSE4_PS(w[4][1], w[5][1], w[6][1], w[7][1]);
+  _MM_TRANSPOSE4_PS(w[0][1], w[1][1], w[2][1], w[3][1]);
+  _MM_TRANSPOSE4_PS(w[4][0], w[5][0], w[6][0], w[7][0]);
+  for (k = 0; k < 4; k++) {
+    __m128 t = w[k][1];
+    w[k][1] = w[k+4][0];
+    w[k+4][0] = t;
+  }
+
+  __m128 lo[8], hi[8];
+  for (k = 0; k < 8; k++) {
+    lo[k] = w[k][0];
+    hi[k] = w[k][1];
+  }
+  idct_1d(lo);
+  idct_1d(hi);
+
+  __m128i c[8];
+  for (k = 0; k < 8; k++)
+    c[k] = descale_column(_mm_cvttps_epi32(lo[k]), _mm_cvttps_epi32(hi[k]));
+  store_columns(c, output_buf, stride);
+}
+
+
+__attribute__((target("avx2")))
+static IDCT_INLINE void transpose8_ps(__m256 *v)
+{
+  __m256 t0 = _mm256_unpacklo_ps(v[0], v[1]);
+  __m256 t1 = _mm256_unpackhi_ps(v[0], v[1]);
+  __m256 t2 = _mm256_unpacklo_ps(v[2], v[3]);
+  __m256 t3 = _mm256_unpackhi_ps(v[2], v[3]);
+  __m256 t4 = _mm256_unpacklo_ps(v[4], v[5]);
+  __m256 t5 = _mm256_unpackhi_ps(v[4], v[5]);
+  __m256 t6 = _mm256_unpacklo_ps(v[6], v[7]);
+  __m256 t7 = _mm256_unpackhi_ps(v[6], v[7]);
+
+  __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+  __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+  __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+  __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+  __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0));
+  __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+  __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0));
+  __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+
+  v[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+  v[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+  v[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+  v[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+  v[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+  v[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+  v[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+  v[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+
+/* AVX2: all 8 columns, then all 8 rows, at once. */
+__attribute__((target("avx2")))
+static void tinyjpeg_idct_avx2(struct component *compptr, uint8_t *output_buf, int stride)
+{
+  __m256 v[8];
+  int k;
+
+  for (k = 0; k < 8; k++) {
+    __m256i coef = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(compptr->DCT + k*DCTSIZE)));
+    v[k] = _mm256_mul_ps(_mm256_cvtepi32_ps(coef), _mm256_loadu_ps(compptr->Q_table + k*DCTSIZE));
+  }
+  idct_1d(v);
+  transpose8_ps(v);
+  idct_1d(v);
+
+  __m128i c[8];
+  for (k = 0; k < 8; k++) {
+    __m256i x = _mm256_cvttps_epi32(v[k]);
+    c[k] = descale_column(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+  }
+  store_columns(c, output_buf, stride);
+}
+
+#endif // TINYJPEG_SIMD
+
+
+idct_fct tinyjpeg_select_idct(int plain)
+{
+#if TINYJPEG_SIMD
+  if (!plain)
+    return __builtin_cpu_supports("avx2") ? tinyjpeg_idct_avx2 : tinyjpeg_idct_sse2;
+#else
+  (void)plain;
+#endif
+  return tinyjpeg_idct_float;
+}
@@ -0,0 +1,661 @@
+/*
+ * mempool.cxx
+ *
+ * Slab allocator with per-thread magazines for fixed size objects.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+
+static const size_t   SlabSize          = 64*1024;  // Also the alignment of a slab
+static const size_t   SlabHeaderSize    = 64;
+static const size_t   MaxSlabObjectSize = SlabSize/8;
+static const size_t   ObjectAlignment   = 16;
+static const unsigned MagazineSize      = 64;
+static const unsigned MaxDepotMagazines = 16;
+static const unsigned MaxEmptySlabs     = 1;
+static const unsigned MaxPools          = 64;   // Pools with a per-thread cache
+
+
+struct PMemoryPoolMagazine
+{
+  PMemoryPoolMagazine * m_next;
+  unsigned              m_count;
+  void                * m_objects[MagazineSize];
+};
+
+
+struct PMemoryPoolSlab
+{
+  PMemoryPoolSlab * m_prev;
+  PMemoryPoolSlab * m_next;
+  void            * m_freeList;
+  unsigned          m_used;
+  unsigned          m_capacity;
+};
+
+
+struct PMemoryPool::Internal
+{
+  Internal(const char * name, size_t size);
+
+  void * AllocateLocked();
+  void   DeallocateLocked(void * ptr);
+  PMemoryPoolSlab * NewSlab();
+  void   ReleaseSlab(PMemoryPoolSlab * slab);
+  void   Unlink(PMemoryPoolSlab * & list, PMemoryPoolSlab * slab);
+  void   Link(PMemoryPoolSlab * & list, PMemoryPoolSlab * slab);
+  PMemoryPoolMagazine * GetEmptyMagazine();
+  void   EmptyMagazine(PMemoryPoolMagazine * magazine);
+  void   Count(long delta, PUInt64 allocations);
+
+  PCriticalSection      m_mutex;
+  const char          * m_name;
+  size_t                m_size;
+  bool                  m_large;     // Too big for slabs, uses the heap
+
+  PMemoryPoolSlab     * m_partial;   // Slabs with at least one free object
+  PMemoryPoolSlab     * m_full;
+  size_t                m_slabs;
+  size_t                m_emptySlabs;
+
+  PMemoryPoolMagazine * m_depotFull;
+  PMemoryPoolMagazine * m_depotEmpty;
+  unsigned              m_depotCount;
+
+  long                  m_live;
+  long                  m_peak;
+  PUInt64               m_allocations;
+};
+
+
+static PCriticalSection & GetRegistryMutex()
+{
+  static PCriticalSection * mutex = new PCriticalSection;
+  return *mutex;
+}
+
+static PMemoryPool * RegisteredPools = NULL;
+static unsigned      PoolCount = 0;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-thread magazines
+
+#if P_PTHREADS
+
+#define P_MEMORY_POOL_CACHE 1
+
+struct PMemoryPoolThreadCache
+{
+  struct Entry {
+    PMemoryPoolMagazine * m_loaded;
+    PMemoryPoolMagazine * m_previous;
+    long                  m_delta;        // Allocations less frees not yet counted by pool
+    PUInt64               m_allocations;
+  } m_entries[MaxPools];
+
+  PMemoryPoolThreadCache * m_prev;
+  PMemoryPoolThreadCache * m_next;
+};
+
+static PMemoryPool::Internal * PoolsByIndex[MaxPools];
+static PMemoryPoolThreadCache * ThreadCaches = NULL;
+static pthread_key_t ThreadCacheKey;
+static pthread_once_t ThreadCacheOnce = PTHREAD_ONCE_INIT;
+
+
+static void FlushThreadCache(PMemoryPoolThreadCache * cache, unsigned index)
+{
+  PMemoryPool::Internal * pool = PoolsByIndex[index];
+  PMemoryPoolThreadCache::Entry & entry = cache->m_entries[index];
+  if (pool == NULL)
+    return;
+
+  PWaitAndSignal lock(pool->m_mutex);
+  pool->Count(entry.m_delta, entry.m_allocations);
+  entry.m_delta = 0;
+  entry.m_allocations = 0;
+
+  if (entry.m_loaded != NULL) {
+    pool->EmptyMagazine(entry.m_loaded);
+    entry.m_loaded = NULL;
+  }
+  if (entry.m_previous != NULL) {
+    pool->EmptyMagazine(entry.m_previous);
+    entry.m_previous = NULL;
+  }
+}
+
+
+static void DestroyThreadCache(void * ptr)
+{
+  PMemoryPoolThreadCache * cache = (PMemoryPoolThreadCache *)ptr;
+  for (unsigned i = 0; i < MaxPools; i++)
+    FlushThreadCache(cache, i);
+
+  {
+    PWaitAndSignal lock(GetRegistryMutex());
+    if (cache->m_prev != NULL)
+      cache->m_prev->m_next = cache->m_next;
+    else
+      ThreadCaches = cache->m_next;
+    if (cache->m_next != NULL)
+      cache->m_next->m_prev = cache->m_prev;
+  }
+
+  runtime_free(cache);
+}
+
+
+static void CreateThreadCacheKey()
+{
+  pthread_key_create(&ThreadCacheKey, DestroyThreadCache);
+}
+
+
+static PMemoryPoolThreadCache * GetThreadCache()
+{
+  PMemoryPoolThreadCache * cache = (PMemoryPoolThreadCache *)pthread_getspecific(ThreadCacheKey);
+  if (cache != NULL)
+    return cache;
+
+  cache = (PMemoryPoolThreadCache *)runtime_malloc(sizeof(PMemoryPoolThreadCache));
+  if (cache == NULL)
+    return NULL;
+  memset(cache, 0, sizeof(PMemoryPoolThreadCache));
+
+  {
+    PWaitAndSignal lock(GetRegistryMutex());
+    cache->m_next = ThreadCaches;
+    if (ThreadCaches != NULL)
+      ThreadCaches->m_prev = cache;
+    ThreadCaches = cache;
+  }
+
+  pthread_setspecific(ThreadCacheKey, cache);
+  return cache;
+}
+
+#endif // P_PTHREADS
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+PMemoryPool::Internal::Internal(const char * name, size_t size)
+  : m_name(name != NULL ? name : "anonymous")
+  , m_size((size + ObjectAlignment - 1) & ~(ObjectAlignment - 1))
+  , m_large(m_size > MaxSlabObjectSize)
+  , m_partial(NULL)
+  , m_full(NULL)
+  , m_slabs(0)
+  , m_emptySlabs(0)
+  , m_depotFull(NULL)
+  , m_depotEmpty(NULL)
+  , m_depotCount(0)
+  , m_live(0)
+  , m_peak(0)
+  , m_allocations(0)
+{
+}
+
+
+void PMemoryPool::Internal::Link(PMemoryPoolSlab * & list, PMemoryPoolSlab * slab)
+{
+  slab->m_prev = NULL;
+  slab->m_next = list;
+  if (list != NULL)
+    list->m_prev = slab;
+  list = slab;
+}
+
+
+void PMemoryPool::Internal::Unlink(PMemoryPoolSlab * & list, PMemoryPoolSlab * slab)
+{
+  if (slab->m_prev != NULL)
+    slab->m_prev->m_next = slab->m_next;
+  else
+    list = slab->m_next;
+  if (slab->m_next != NULL)
+    slab->m_next->m_prev = slab->m_prev;
+}
+
+
+PMemoryPoolSlab * PMemoryPool::Internal::NewSlab()
+{
+#ifdef _WIN32
+  // Allocation granularity is 64k, so this is always aligned
+  char * base = (char *)VirtualAlloc(NULL, SlabSize, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+  if (base == NULL)
+    return NULL;
+#else
+  // Map twice the size and trim, to get the alignment
+  char * region = (char *)mmap(NULL, SlabSize*2, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (region == (char *)MAP_FAILED)
+    return NULL;
+  char * base = (char *)(((size_t)region + SlabSize - 1) & ~(SlabSize - 1));
+  if (base > region)
+    munmap(region, base - region);
+  if (base + SlabSize < region + SlabSize*2)
+    munmap(base + SlabSize, region + SlabSize*2 - (base + SlabSize));
+#endif
+
+  PMemoryPoolSlab * slab = (PMemoryPoolSlab *)base;
+  slab->m_used = 0;
+  slab->m_capacity = (SlabSize - SlabHeaderSize)/m_size;
+  slab->m_freeList = NULL;
+  for (unsigned i = slab->m_capacity; i-- > 0; ) {
+    void ** object = (void **)(base + SlabHeaderSize + i*m_size);
+    *object = slab->m_freeList;
+    slab->m_freeList = object;
+  }
+
+  m_slabs++;
+  m_emptySlabs++;
+  Link(m_partial, slab);
+  return slab;
+}
+
+
+void PMemoryPool::Internal::ReleaseSlab(PMemoryPoolSlab * slab)
+{
+  Unlink(m_partial, slab);
+  m_slabs--;
+  m_emptySlabs--;
+
+#ifdef _WIN32
+  VirtualFree(slab, 0, MEM_RELEASE);
+#else
+  munmap(slab, SlabSize);
+#endif
+}
+
+
+void * PMemoryPool::Internal::AllocateLocked()
+{
+  if (m_large)
+    return ::operator new(m_size);
+
+  PMemoryPoolSlab * slab = m_partial;
+  if (slab == NULL && (slab = NewSlab()) == NULL)
+    return NULL;
+
+  void ** object = (void **)slab->m_freeList;
+  slab->m_freeList = *object;
+  if (slab->m_used++ == 0)
+    m_emptySlabs--;
+
+  if (slab->m_freeList == NULL) {
+    Unlink(m_partial, slab);
+    Link(m_full, slab);
+  }
+
+  return object;
+}
+
+
+void PMemoryPool::Internal::DeallocateLocked(void * ptr)
+{
+  if (m_large) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  PMemoryPoolSlab * slab = (PMemoryPoolSlab *)((size_t)ptr & ~(SlabSize - 1));
+
+  if (slab->m_freeList == NULL) {
+    Unlink(m_full, slab);
+    Link(m_partial, slab);
+  }
+
+  *(void **)ptr = slab->m_freeList;
+  slab->m_freeList = ptr;
+
+  if (--slab->m_used == 0 && ++m_emptySlabs > MaxEmptySlabs)
+    ReleaseSlab(slab);
+}
+
+
+PMemoryPoolMagazine * PMemoryPool::Internal::GetEmptyMagazine()
+{
+  PMemoryPoolMagazine * magazine = m_depotEmpty;
+  if (magazine != NULL)
+    m_depotEmpty = magazine->m_next;
+  else if ((magazine = (PMemoryPoolMagazine *)runtime_malloc(sizeof(PMemoryPoolMagazine))) == NULL)
+    return NULL;
+
+  magazine->m_next = NULL;
+  magazine->m_count = 0;
+  return magazine;
+}
+
+
+void PMemoryPool::Internal::EmptyMagazine(PMemoryPoolMagazine * magazine)
+{
+  while (magazine->m_count > 0)
+    DeallocateLocked(magazine->m_objects[--magazine->m_count]);
+  magazine->m_next = m_depotEmpty;
+  m_depotEmpty = magazine;
+}
+
+
+void PMemoryPool::Internal::Count(long delta, PUInt64 allocations)
+{
+  m_live += delta;
+  if (m_live > m_peak)
+    m_peak = m_live;
+  m_allocations += allocations;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+PMemoryPool::PMemoryPool(const char * name, size_t objectSize)
+  : m_internal(new Internal(name, objectSize))
+{
+  PWaitAndSignal lock(GetRegistryMutex());
+  m_index = PoolCount++;
+  m_next = RegisteredPools;
+  RegisteredPools = this;
+
+#if P_MEMORY_POOL_CACHE
+  pthread_once(&ThreadCacheOnce, CreateThreadCacheKey);
+  if (m_index < MaxPools)
+    PoolsByIndex[m_index] = m_internal;
+#endif
+}
+
+
+void * PMemoryPool::Allocate()
+{
+#if P_MEMORY_POOL_CACHE
+  PMemoryPoolThreadCache * cache;
+  if (m_index < MaxPools && !m_internal->m_large && (cache = GetThreadCache()) != NULL) {
+    PMemoryPoolThreadCache::Entry & entry = cache->m_entries[m_index];
+
+    PMemoryPoolMagazine * magazine = entry.m_loaded;
+    if (magazine == NULL || magazine->m_count == 0) {
+      if (entry.m_previous != NULL && entry.m_previous->m_count > 0) {
+        entry.m_loaded = entry.m_previous;
+        entry.m_previous = magazine;
+      }
+      else {
+        // Both magazines empty, get a full one from the depot or the slabs
+        PWaitAndSignal lock(m_internal->m_mutex);
+        m_internal->Count(entry.m_delta, entry.m_allocations);
+        entry.m_delta = 0;
+        entry.m_allocations = 0;
+
+        if (magazine == NULL && (magazine = entry.m_loaded = m_internal->GetEmptyMagazine()) == NULL)
+          return NULL;
+
+        if (m_internal->m_depotFull != NULL) {
+          magazine->m_next = m_internal->m_depotEmpty;
+          m_internal->m_depotEmpty = magazine;
+          entry.m_loaded = m_internal->m_depotFull;
+          m_internal->m_depotFull = entry.m_loaded->m_next;
+          m_internal->m_depotCount--;
+        }
+        else {
+          while (magazine->m_count < MagazineSize/2) {
+            void * object = m_internal->AllocateLocked();
+            if (object == NULL)
+              break;
+            magazine->m_objects[magazine->m_count++] = object;
+          }
+          if (magazine->m_count == 0)
+            return NULL;
+        }
+      }
+      magazine = entry.m_loaded;
+    }
+
+    entry.m_delta++;
+    entry.m_allocations++;
+    return magazine->m_objects[--magazine->m_count];
+  }
+#endif
+
+  PWaitAndSignal lock(m_internal->m_mutex);
+  void * object = m_internal->AllocateLocked();
+  if (object != NULL)
+    m_internal->Count(1, 1);
+  return object;
+}
+
+
+void * PMemoryPool::New()
+{
+  void * object = Allocate();
+  if (object != NULL)
+    return object;
+
+#if defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+  throw std::bad_alloc();
+#else
+  PAssertAlways(POutOfMemory);
+  abort();
+#endif
+}
+
+
+void PMemoryPool::Deallocate(void * ptr)
+{
+  if (ptr == NULL)
+    return;
+
+#if P_MEMORY_POOL_CACHE
+  PMemoryPoolThreadCache * cache;
+  if (m_index < MaxPools && !m_internal->m_large && (cache = GetThreadCache()) != NULL) {
+    PMemoryPoolThreadCache::Entry & entry = cache->m_entries[m_index];
+
+    PMemoryPoolMagazine * magazine = entry.m_loaded;
+    if (magazine == NULL || magazine->m_count == MagazineSize) {
+      if (entry.m_previous != NULL && entry.m_previous->m_count == 0) {
+        entry.m_loaded = entry.m_previous;
+        entry.m_previous = magazine;
+      }
+      else {
+        // Both magazines full, hand one to the depot for other threads
+        PWaitAndSignal lock(m_internal->m_mutex);
+        m_internal->Count(entry.m_delta-1, entry.m_allocations);
+        entry.m_delta = 0;
+        entry.m_allocations = 0;
+
+        PMemoryPoolMagazine * empty = m_internal->GetEmptyMagazine();
+        if (empty == NULL) {
+          m_internal->DeallocateLocked(ptr);
+          return;
+        }
+
+        if (entry.m_previous != NULL) {
+          if (m_internal->m_depotCount < MaxDepotMagazines) {
+            entry.m_previous->m_next = m_internal->m_depotFull;
+            m_internal->m_depotFull = entry.m_previous;
+            m_internal->m_depotCount++;
+          }
+          else
+            m_internal->EmptyMagazine(entry.m_previous);
+        }
+
+        entry.m_previous = magazine;
+        entry.m_loaded = empty;
+        empty->m_objects[empty->m_count++] = ptr;
+        return;
+      }
+      magazine = entry.m_loaded;
+    }
+
+    entry.m_delta--;
+    magazine->m_objects[magazine->m_count++] = ptr;
+    return;
+  }
+#endif
+
+  PWaitAndSignal lock(m_internal->m_mutex);
+  m_internal->DeallocateLocked(ptr);
+  m_internal->Count(-1, 0);
+}
+
+
+void PMemoryPool::GetStatistics(Statistics & stats) const
+{
+  PWaitAndSignal registryLock(GetRegistryMutex());
+  PWaitAndSignal lock(m_internal->m_mutex);
+
+  long live = m_internal->m_live;
+  size_t cached = 0;
+
+  for (PMemoryPoolMagazine * magazine = m_internal->m_depotFull; magazine != NULL; magazine = magazine->m_next)
+    cached += magazine->m_count;
+
+  stats.m_allocations = m_internal->m_allocations;
+
+#if P_MEMORY_POOL_CACHE
+  if (m_index < MaxPools) {
+    for (PMemoryPoolThreadCache * cache = ThreadCaches; cache != NULL; cache = cache->m_next) {
+      const PMemoryPoolThreadCache::Entry & entry = cache->m_entries[m_index];
+      live += entry.m_delta;
+      stats.m_allocations += entry.m_allocations;
+      if (entry.m_loaded != NULL)
+        cached += entry.m_loaded->m_count;
+      if (entry.m_previous != NULL)
+        cached += entry.m_previous->m_count;
+    }
+  }
+#endif
+
+  stats.m_name = m_internal->m_name;
+  stats.m_objectSize = m_internal->m_size;
+  stats.m_liveObjects = live > 0 ? live : 0;
+  if (m_internal->m_peak < live)
+    m_internal->m_peak = live;
+  stats.m_peakObjects = m_internal->m_peak;
+  stats.m_cachedObjects = cached;
+  stats.m_slabs = m_internal->m_slabs;
+  stats.m_slabBytes = m_internal->m_slabs*SlabSize;
+}
+
+
+void PMemoryPool::GetAllStatistics(std::vector<Statistics> & stats)
+{
+  std::vector<PMemoryPool *> pools;
+  {
+    PWaitAndSignal lock(GetRegistryMutex());
+    for (PMemoryPool * pool = RegisteredPools; pool != NULL; pool = pool->m_next)
+      pools.push_back(pool);
+  }
+
+  stats.resize(pools.size());
+  for (size_t i = 0; i < pools.size(); i++)
+    pools[i]->GetStatistics(stats[i]);
+}
+
+
+void PMemoryPool::PrintStatistics(ostream & strm)
+{
+  std::vector<Statistics> stats;
+  GetAllStatistics(stats);
+
+  strm << setw(24) << left << "Pool" << right
+       << setw(6) << "Size"
+       << setw(10) << "Live"
+       << setw(10) << "Peak"
+       << setw(10) << "Cached"
+       << setw(8) << "Slabs"
+       << setw(12) << "Allocations" << '\n';
+  for (size_t i = 0; i < stats.size(); i++)
+    strm << setw(24) << left << stats[i].m_name << right
+         << setw(6) << stats[i].m_objectSize
+         << setw(10) << stats[i].m_liveObjects
+         << setw(10) << stats[i].m_peakObjects
+         << setw(10) << stats[i].m_cachedObjects
+         << setw(8) << stats[i].m_slabs
+         << setw(12) << stats[i].m_allocations << '\n';
+  strm << flush;
+}
+
+
+void PMemoryPool::ReleaseMemory()
+{
+#if P_MEMORY_POOL_CACHE
+  if (m_index < MaxPools) {
+    PMemoryPoolThreadCache * cache = (PMemoryPoolThreadCache *)pthread_getspecific(ThreadCacheKey);
+    if (cache != NULL)
+      FlushThreadCache(cache, m_index);
+  }
+#endif
+
+  PWaitAndSignal lock(m_internal->m_mutex);
+
+  while (m_internal->m_depotFull != NULL) {
+    PMemoryPoolMagazine * magazine = m_internal->m_depotFull;
+    m_internal->m_depotFull = magazine->m_next;
+    m_internal->EmptyMagazine(magazine);
+  }
+  m_internal->m_depotCount = 0;
+
+  while (m_internal->m_depotEmpty != NULL) {
+    PMemoryPoolMagazine * magazine = m_internal->m_depotEmpty;
+    m_internal->m_depotEmpty = magazine->m_next;
+    runtime_free(magazine);
+  }
+
+  PMemoryPoolSlab * slab = m_internal->m_partial;
+  while (slab != NULL) {
+    PMemoryPoolSlab * next = slab->m_next;
+    if (slab->m_used == 0)
+      m_internal->ReleaseSlab(slab);
+    slab = next;
+  }
+}
+
+
+void PMemoryPool::ReleaseAllMemory()
+{
+  std::vector<PMemoryPool *> pools;
+  {
+    PWaitAndSignal lock(GetRegistryMutex());
+    for (PMemoryPool * pool = RegisteredPools; pool != NULL; pool = pool->m_next)
+      pools.push_back(pool);
+  }
+
+  for (size_t i = 0; i < pools.size(); i++)
+    pools[i]->ReleaseMemory();
+}
+
+
+void PMemoryHeap::DumpPoolStatistics(ostream & strm)
+{
+  PMemoryPool::PrintStatistics(strm);
+}
+
+
+// End Of File ///////////////////////////////////////////////////////////////
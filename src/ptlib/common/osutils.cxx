@@ -34,6 +34,7 @@
 #include <ptlib.h>
 #include <vector>
 #include <map>
+#include <list>
 #include <fstream>
 #include <algorithm>
 
@@ -646,6 +647,398 @@ void PTrace::Cleanup()
 #endif // PTRACING
 
 
+///////////////////////////////////////////////////////////////////////////////
+// PProfiling
+
+#if P_PROFILING
+
+bool PProfiling::s_enabled = true;
+
+// Maximum number of distinct probes, further probes are not recorded
+static const unsigned ProfileMaxProbes = 1024;
+
+// Log-linear buckets, four per power of two, covering all 64 bit durations
+static const unsigned ProfileSubBuckets = 4;
+static const unsigned ProfileBuckets = 63*ProfileSubBuckets;
+
+
+struct PProfilingHistogram
+{
+  PUInt64 m_count;
+  PUInt64 m_total;
+  PUInt64 m_minimum;
+  PUInt64 m_maximum;
+  PUInt64 m_buckets[ProfileBuckets];
+
+  PProfilingHistogram() { Clear(); }
+
+  void Clear()
+  {
+    m_count = m_total = m_maximum = 0;
+    m_minimum = ~(PUInt64)0;
+    memset(m_buckets, 0, sizeof(m_buckets));
+  }
+
+  static unsigned GetBucket(PUInt64 value)
+  {
+    if (value < ProfileSubBuckets)
+      return (unsigned)value;
+
+#ifdef __GNUC__
+    unsigned msb = 63 - __builtin_clzll(value);
+#else
+    unsigned msb = 0;
+    for (PUInt64 v = value; v > 1; v >>= 1)
+      ++msb;
+#endif
+    return (msb-1)*ProfileSubBuckets + (unsigned)((value >> (msb-2)) & (ProfileSubBuckets-1));
+  }
+
+  static PUInt64 GetBucketMinimum(unsigned bucket)
+  {
+    if (bucket < ProfileSubBuckets)
+      return bucket;
+    return (PUInt64)(ProfileSubBuckets + bucket%ProfileSubBuckets) << (bucket/ProfileSubBuckets - 1);
+  }
+
+  void Add(PUInt64 value)
+  {
+    ++m_count;
+    m_total += value;
+    if (value < m_minimum)
+      m_minimum = value;
+    if (value > m_maximum)
+      m_maximum = value;
+    ++m_buckets[GetBucket(value)];
+  }
+
+  void Merge(const PProfilingHistogram & other)
+  {
+    m_count += other.m_count;
+    m_total += other.m_total;
+    if (other.m_minimum < m_minimum)
+      m_minimum = other.m_minimum;
+    if (other.m_maximum > m_maximum)
+      m_maximum = other.m_maximum;
+    for (unsigned i = 0; i < ProfileBuckets; ++i)
+      m_buckets[i] += other.m_buckets[i];
+  }
+
+  PUInt64 GetPercentile(unsigned percent) const
+  {
+    PUInt64 target = (m_count*percent + 99)/100;
+    PUInt64 cumulative = 0;
+    for (unsigned i = 0; i < ProfileBuckets; ++i) {
+      cumulative += m_buckets[i];
+      if (cumulative >= target) {
+        // Use middle of bucket, but never outside the observed range
+        if (i+1 >= ProfileBuckets)
+          return m_maximum;
+        PUInt64 value = (GetBucketMinimum(i) + GetBucketMinimum(i+1))/2;
+        return std::max(m_minimum, std::min(m_maximum, value));
+      }
+    }
+    return m_maximum;
+  }
+};
+
+
+/* Histograms are only ever written by the owning thread, with m_mutex held
+   so other threads can take a consistent snapshot. As only a dump contends
+   for the lock, it is almost always uncontended. */
+struct PProfilingThreadData
+{
+  PCriticalSection      m_mutex;
+  PProfilingHistogram * m_histograms[ProfileMaxProbes];
+
+  PProfilingThreadData() { memset(m_histograms, 0, sizeof(m_histograms)); }
+  ~PProfilingThreadData()
+  {
+    for (unsigned i = 0; i < ProfileMaxProbes; ++i)
+      delete m_histograms[i];
+  }
+
+  void Merge(const PProfilingThreadData & other)
+  {
+    PWaitAndSignal lock(other.m_mutex);
+    for (unsigned i = 0; i < ProfileMaxProbes; ++i) {
+      if (other.m_histograms[i] != NULL) {
+        if (m_histograms[i] == NULL)
+          m_histograms[i] = new PProfilingHistogram;
+        m_histograms[i]->Merge(*other.m_histograms[i]);
+      }
+    }
+  }
+
+  void Clear()
+  {
+    PWaitAndSignal lock(m_mutex);
+    for (unsigned i = 0; i < ProfileMaxProbes; ++i) {
+      if (m_histograms[i] != NULL)
+        m_histograms[i]->Clear();
+    }
+  }
+};
+
+
+#if defined(P_PTHREADS)
+static void PProfilingThreadEnded(void * data);
+#endif
+
+
+class PProfilingInfo
+{
+  public:
+    static PProfilingInfo & Instance()
+    {
+      static PProfilingInfo info;
+      return info;
+    }
+
+    PProfilingThreadData * GetThreadData()
+    {
+#if defined(P_PTHREADS)
+      PProfilingThreadData * data = (PProfilingThreadData *)pthread_getspecific(m_key);
+#else
+      PProfilingThreadData * data = m_key.Get();
+#endif
+      if (data != NULL)
+        return data;
+
+      data = new PProfilingThreadData;
+      {
+        PWaitAndSignal lock(m_mutex);
+        m_threads.push_back(data);
+      }
+
+#if defined(P_PTHREADS)
+      pthread_setspecific(m_key, data);
+#else
+      m_key.Set(data);
+#endif
+      return data;
+    }
+
+    // Detach the calling thread's results, if it has any
+    PProfilingThreadData * RemoveThreadData()
+    {
+#if defined(P_PTHREADS)
+      PProfilingThreadData * data = (PProfilingThreadData *)pthread_getspecific(m_key);
+      pthread_setspecific(m_key, NULL);
+#else
+      PProfilingThreadData * data = m_key.Get();
+      m_key.Set(NULL);
+#endif
+      return data;
+    }
+
+    // Called when a thread ends, keeping its results
+    void ThreadEnded(PProfilingThreadData * data)
+    {
+      PWaitAndSignal lock(m_mutex);
+      m_threads.remove(data);
+      m_retired.Merge(*data);
+      delete data;
+    }
+
+    double GetNanoSecondsPerTick()
+    {
+#if P_PROFILING_TSC && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+      // Calibrate the time stamp counter against the system clock
+      PInt64 elapsed = PTimer::HighResolutionTick() - m_startNanoSeconds;
+      if (elapsed < 10000000) {
+        PThread::Sleep(10);
+        elapsed = PTimer::HighResolutionTick() - m_startNanoSeconds;
+      }
+      return (double)elapsed/(PProfiling::GetTimestamp() - m_startTimestamp);
+#else
+      return 1.0;
+#endif
+    }
+
+    PMutex m_mutex;
+    std::vector<const PProfiling::Probe *> m_probes;
+    std::list<PProfilingThreadData *> m_threads;
+    PProfilingThreadData m_retired;
+
+  private:
+    PProfilingInfo()
+      : m_startTimestamp(PProfiling::GetTimestamp())
+      , m_startNanoSeconds(PTimer::HighResolutionTick())
+    {
+#if defined(P_PTHREADS)
+      pthread_key_create(&m_key, PProfilingThreadEnded);
+#endif
+    }
+
+#if defined(P_PTHREADS)
+    pthread_key_t m_key;
+#else
+    PThreadLocalStorage<PProfilingThreadData> m_key;
+#endif
+    PProfiling::Timestamp m_startTimestamp;
+    PInt64                m_startNanoSeconds;
+};
+
+
+#if defined(P_PTHREADS)
+static void PProfilingThreadEnded(void * data)
+{
+  PProfilingInfo::Instance().ThreadEnded((PProfilingThreadData *)data);
+}
+#endif
+
+
+PProfiling::Probe::Probe(const char * name, const char * fileName, int lineNum)
+  : m_name(name)
+  , m_fileName(fileName)
+  , m_lineNum(lineNum)
+{
+  PProfilingInfo & info = PProfilingInfo::Instance();
+  PWaitAndSignal lock(info.m_mutex);
+  m_index = (unsigned)info.m_probes.size();
+  info.m_probes.push_back(this);
+}
+
+
+#if !(P_PROFILING_TSC && defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)))
+PProfiling::Timestamp PProfiling::GetTimestamp()
+{
+  return PTimer::HighResolutionTick();
+}
+#endif
+
+
+PUInt64 PProfiling::ToNanoSeconds(Timestamp duration)
+{
+  return (PUInt64)(duration*PProfilingInfo::Instance().GetNanoSecondsPerTick());
+}
+
+
+void PProfiling::Record(const Probe & probe, Timestamp duration)
+{
+  unsigned index = probe.GetIndex();
+  if (index >= ProfileMaxProbes)
+    return;
+
+  PProfilingInfo & info = PProfilingInfo::Instance();
+  PProfilingThreadData * data = info.GetThreadData();
+
+  PWaitAndSignal lock(data->m_mutex);
+
+  PProfilingHistogram * histogram = data->m_histograms[index];
+  if (histogram == NULL)
+    histogram = data->m_histograms[index] = new PProfilingHistogram;
+
+  histogram->Add(duration);
+}
+
+
+void PProfiling::Cleanup()
+{
+  PProfilingInfo & info = PProfilingInfo::Instance();
+  PProfilingThreadData * data = info.RemoveThreadData();
+  if (data != NULL)
+    info.ThreadEnded(data);
+}
+
+
+static void PrintProfile(ostream & strm,
+                         const PProfiling::Probe & probe,
+                         const PProfilingHistogram & histogram,
+                         double nsPerTick)
+{
+  double scale = nsPerTick/1000; // Output in microseconds
+
+  strm << probe.GetName();
+  if (probe.GetFileName() != NULL)
+    strm << " (" << PFilePath(probe.GetFileName()).GetFileName() << ':' << probe.GetLineNumber() << ')';
+
+  std::streamsize oldPrecision = strm.precision(3);
+  ios::fmtflags oldFlags = strm.setf(ios::fixed, ios::floatfield);
+
+  strm << "\tcount=" << histogram.m_count
+       << "\tmean=" << (double)histogram.m_total/histogram.m_count*scale
+       << "\tmin=" << histogram.m_minimum*scale
+       << "\tp50=" << histogram.GetPercentile(50)*scale
+       << "\tp90=" << histogram.GetPercentile(90)*scale
+       << "\tp99=" << histogram.GetPercentile(99)*scale
+       << "\tmax=" << histogram.m_maximum*scale
+       << "\t(us)";
+
+  strm.precision(oldPrecision);
+  strm.flags(oldFlags);
+}
+
+
+// Merge the results of all threads, each live thread is locked while it is read
+static void MergeProfiles(PProfilingInfo & info, PProfilingThreadData & totals)
+{
+  totals.Merge(info.m_retired);
+  for (std::list<PProfilingThreadData *>::iterator it = info.m_threads.begin(); it != info.m_threads.end(); ++it)
+    totals.Merge(**it);
+}
+
+
+void PProfiling::Dump(ostream & strm)
+{
+  PProfilingInfo & info = PProfilingInfo::Instance();
+  double nsPerTick = info.GetNanoSecondsPerTick();
+
+  PWaitAndSignal lock(info.m_mutex);
+
+  PProfilingThreadData totals;
+  MergeProfiles(info, totals);
+
+  for (unsigned i = 0; i < info.m_probes.size() && i < ProfileMaxProbes; ++i) {
+    if (totals.m_histograms[i] != NULL && totals.m_histograms[i]->m_count > 0) {
+      PrintProfile(strm, *info.m_probes[i], *totals.m_histograms[i], nsPerTick);
+      strm << '\n';
+    }
+  }
+  strm.flush();
+}
+
+
+void PProfiling::Trace(unsigned PTRACE_PARAM(level))
+{
+#if PTRACING
+  if (!PTrace::CanTrace(level))
+    return;
+
+  PProfilingInfo & info = PProfilingInfo::Instance();
+  double nsPerTick = info.GetNanoSecondsPerTick();
+
+  PWaitAndSignal lock(info.m_mutex);
+
+  PProfilingThreadData totals;
+  MergeProfiles(info, totals);
+
+  for (unsigned i = 0; i < info.m_probes.size() && i < ProfileMaxProbes; ++i) {
+    if (totals.m_histograms[i] != NULL && totals.m_histograms[i]->m_count > 0) {
+      ostream & strm = PTrace::Begin(level, __FILE__, __LINE__);
+      strm << "Profile\t";
+      PrintProfile(strm, *info.m_probes[i], *totals.m_histograms[i], nsPerTick);
+      strm << PTrace::End;
+    }
+  }
+#endif // PTRACING
+}
+
+
+void PProfiling::Reset()
+{
+  PProfilingInfo & info = PProfilingInfo::Instance();
+  PWaitAndSignal lock(info.m_mutex);
+
+  info.m_retired.Clear();
+  for (std::list<PProfilingThreadData *>::iterator it = info.m_threads.begin(); it != info.m_threads.end(); ++it)
+    (*it)->Clear();
+}
+
+#endif // P_PROFILING
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // PDirectory
 
@@ -926,6 +1319,7 @@ void PTimerList::AddActiveTimer(const RequestType & request)
 {
   ActiveTimerInfoMap::iterator r = m_activeTimers.find(request.m_id);
   if (r == m_activeTimers.end()) {
+    PWaitAndSignal lock(m_activeTimersMutex);
     m_activeTimers.insert(ActiveTimerInfoMap::value_type(request.m_id, ActiveTimerInfo(request.m_timer, request.m_serialNumber)));
   }
   else {
@@ -954,8 +1348,10 @@ void PTimerList::ProcessTimerQueue()
       case PTimerList::RequestType::Stop:
         {
           ActiveTimerInfoMap::iterator r = m_activeTimers.find(request.m_id);
-          if (r != m_activeTimers.end()) 
+          if (r != m_activeTimers.end()) {
+            PWaitAndSignal lock(m_activeTimersMutex);
             m_activeTimers.erase(r);
+          }
         }
         break;
       default:
@@ -971,6 +1367,13 @@ void PTimerList::ProcessTimerQueue()
   m_queueMutex.Signal();
 }
 
+PINDEX PTimerList::GetActiveTimerCount() const
+{
+  PWaitAndSignal lock(m_activeTimersMutex);
+  return (PINDEX)m_activeTimers.size();
+}
+
+
 PTimeInterval PTimerList::Process()
 {
   m_timerThread = PThread::Current();
@@ -993,8 +1396,10 @@ PTimeInterval PTimerList::Process()
         timer.m_timer->Process(now);
         if (timer.m_timer->m_state != PTimer::Stopped)
           m_expiryList.insert(TimerExpiryInfo(expiry.m_timerId, now + timer.m_timer->m_resetTime.GetMilliSeconds(), timer.m_serialNumber));
-        else
+        else {
+          PWaitAndSignal lock(m_activeTimersMutex);
           m_activeTimers.erase(t);
+        }
       }
     }
   }
@@ -1755,6 +2160,13 @@ void PProcess::SetThreadName(const PString & /*name*/)
 {
 }
 
+
+PINDEX PProcess::GetActiveThreadCount()
+{
+  PWaitAndSignal mutex(m_activeThreadMutex);
+  return (PINDEX)m_activeThreads.size();
+}
+
 PTime PProcess::GetStartTime() const
 { 
   return programStartTime; 
@@ -109,8 +109,13 @@ int PChannelStreamBuffer::sync()
       ((PFile *)channel)->SetPosition(-inAvail, PFile::Current);
   }
 
-  if (pptr() > pbase())
-    return overflow();
+  if (pptr() > pbase()) {
+    if (overflow() == EOF)
+      return EOF;
+    // An explicit stream flush pushes file buffered data to the OS as well
+    if (PIsDescendant(channel, PFile) && !((PFile *)channel)->FlushBuffer())
+      return EOF;
+  }
 
   return 0;
 }
@@ -922,7 +927,9 @@ PBoolean PFile::Close()
 #ifdef WOT_NO_FILESYSTEM
   PBoolean ok = PTrue;
 #else
-  PBoolean ok = ConvertOSError(_close(os_handle));
+  PBoolean ok = !m_bufferWrite || FlushBuffer();
+  m_bufferPos = m_bufferLen = 0;
+  ok = ConvertOSError(_close(os_handle)) && ok;
 #endif
 
   os_handle = -1;
@@ -943,6 +950,8 @@ PBoolean PFile::Read(void * buffer, PINDEX amount)
 #ifdef WOT_NO_FILESYSTEM
   lastReadCount = 0;
 #else
+  if (m_bufferSize > 0)
+    return BufferedRead(buffer, amount);
   lastReadCount = _read(GetHandle(), buffer, amount);
 #endif
   return ConvertOSError(lastReadCount, LastReadError) && lastReadCount > 0;
@@ -958,12 +967,123 @@ PBoolean PFile::Write(const void * buffer, PINDEX amount)
 #ifdef WOT_NO_FILESYSTEM
   lastWriteCount = amount;
 #else
+  if (m_bufferSize > 0)
+    return BufferedWrite(buffer, amount);
   lastWriteCount = _write(GetHandle(), buffer, amount);
 #endif
   return ConvertOSError(lastWriteCount, LastWriteError) && lastWriteCount >= amount;
 }
 
 
+PBoolean PFile::BufferedRead(void * buffer, PINDEX amount)
+{
+  if (m_bufferWrite && !FlushBuffer())
+    return PFalse;
+
+  BYTE * ptr = (BYTE *)buffer;
+  PINDEX count = 0;
+  int result = 0;
+  bool shortRead = false;
+
+  while (count < amount) {
+    PINDEX available = m_bufferLen - m_bufferPos;
+    if (available > 0) {
+      PINDEX len = PMIN(available, amount - count);
+      memcpy(ptr + count, (const BYTE *)m_buffer + m_bufferPos, len);
+      m_bufferPos += len;
+      count += len;
+      continue;
+    }
+
+    // Do not block on a device or pipe for more than was there
+    if (shortRead)
+      break;
+
+    m_bufferPos = m_bufferLen = 0;
+
+    // Large reads bypass the buffer
+    PINDEX wanted = amount - count;
+    if (wanted >= m_bufferSize) {
+      if ((result = _read(GetHandle(), ptr + count, wanted)) <= 0)
+        break;
+      count += result;
+      shortRead = result < wanted;
+    }
+    else {
+      if ((result = _read(GetHandle(), m_buffer.GetPointer(m_bufferSize), m_bufferSize)) <= 0)
+        break;
+      m_bufferLen = result;
+      shortRead = result < m_bufferSize;
+    }
+  }
+
+  lastReadCount = count;
+  return ConvertOSError(count > 0 ? count : result, LastReadError) && lastReadCount > 0;
+}
+
+
+PBoolean PFile::BufferedWrite(const void * buffer, PINDEX amount)
+{
+  // Discard any read ahead, or write out pending data if this will not fit
+  if ((!m_bufferWrite || m_bufferPos + amount > m_bufferSize) && !FlushBuffer())
+    return PFalse;
+
+  // Large writes bypass the buffer
+  if (amount >= m_bufferSize) {
+    lastWriteCount = _write(GetHandle(), buffer, amount);
+    return ConvertOSError(lastWriteCount, LastWriteError) && lastWriteCount >= amount;
+  }
+
+  memcpy(m_buffer.GetPointer(m_bufferSize) + m_bufferPos, buffer, amount);
+  m_bufferPos += amount;
+  m_bufferWrite = true;
+  lastWriteCount = amount;
+
+  if (m_lineBuffered && memchr(buffer, '\n', amount) != NULL && !FlushBuffer())
+    return PFalse;
+
+  return ConvertOSError(0, LastWriteError);
+}
+
+
+PBoolean PFile::FlushBuffer()
+{
+  if (!m_bufferWrite) {
+    // Move the OS file position back to the logical position
+    off_t unread = m_bufferLen - m_bufferPos;
+    m_bufferPos = m_bufferLen = 0;
+    return unread == 0 || !IsOpen() || ConvertOSError(_lseek(GetHandle(), -unread, SEEK_CUR) != (off_t)-1 ? 0 : -1);
+  }
+
+  const BYTE * ptr = m_buffer;
+  PINDEX pending = m_bufferPos;
+  m_bufferPos = 0;
+  m_bufferWrite = false;
+
+  while (pending > 0) {
+    int result = _write(GetHandle(), ptr, pending);
+    if (!ConvertOSError(result, LastWriteError) || result == 0)
+      return PFalse;
+    ptr += result;
+    pending -= result;
+  }
+
+  return PTrue;
+}
+
+
+void PFile::SetBufferSize(PINDEX size, bool lineBuffered)
+{
+  m_lineBuffered = lineBuffered;
+  if (size == m_bufferSize)
+    return;
+
+  FlushBuffer();
+  m_bufferSize = size;
+  m_buffer.SetSize(0);
+}
+
+
 PBoolean PFile::Open(const PFilePath & name, OpenMode  mode, int opts)
 {
   Close();
@@ -980,6 +1100,9 @@ off_t PFile::GetLength() const
 #ifdef WOT_NO_FILESYSTEM
   return 0;
 #else
+  if (m_bufferWrite)
+    ((PFile *)this)->FlushBuffer();
+
   off_t pos = _lseek(GetHandle(), 0, SEEK_CUR);
   off_t len = _lseek(GetHandle(), 0, SEEK_END);
   PAssertOS(pos >= 0);
@@ -1008,11 +1131,32 @@ PBoolean PFile::SetPosition(off_t pos, FilePositionOrigin origin)
   if (!IsOpen())
     return SetErrorValues(NotOpen, EBADF);
 
+  if (m_bufferLen > 0 || m_bufferWrite) {
+    // Relative seeks within the read ahead data need no system call
+    if (origin == Current && !m_bufferWrite && pos >= -(off_t)m_bufferPos && pos <= (off_t)(m_bufferLen - m_bufferPos)) {
+      m_bufferPos += (PINDEX)pos;
+      return PTrue;
+    }
+
+    if (!FlushBuffer())
+      return PFalse;
+  }
+
   return _lseek(GetHandle(), pos, origin) != (off_t)-1;
 #endif
 }
 
 
+off_t PFile::GetPosition() const
+{
+  off_t pos = _lseek(GetHandle(), 0, SEEK_CUR);
+  if (pos < 0)
+    return pos;
+
+  return m_bufferWrite ? pos + m_bufferPos : pos - (m_bufferLen - m_bufferPos);
+}
+
+
 PBoolean PFile::Copy(const PFilePath & oldname, const PFilePath & newname, PBoolean force)
 {
   PFile oldfile(oldname, ReadOnly);
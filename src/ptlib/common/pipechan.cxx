@@ -35,6 +35,7 @@
 #include <ptlib/pipechan.h>
 
 #include <ctype.h>
+#include <signal.h>
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -181,4 +182,208 @@ PBoolean PPipeChannel::Open(const PString & subProgram,
 }
 
 
+
+///////////////////////////////////////////////////////////////////////////////
+// PPipeChannelPool
+
+PPipeChannelPool::PPipeChannelPool()
+  : m_searchPath(true)
+  , m_available(0, INT_MAX)
+  , m_startCount(0)
+{
+}
+
+
+PPipeChannelPool::~PPipeChannelPool()
+{
+  Close();
+}
+
+
+bool PPipeChannelPool::Open(const PString & subProgram, PINDEX size, PBoolean searchPath)
+{
+  PString progName;
+  PStringArray arguments;
+  if (!SplitArgs(subProgram, progName, arguments))
+    return false;
+  return Open(progName, arguments, size, searchPath);
+}
+
+
+bool PPipeChannelPool::Open(const PString & subProgram,
+                            const PStringArray & argumentList,
+                            PINDEX size,
+                            PBoolean searchPath)
+{
+  Close();
+
+  m_subProgram = subProgram;
+  m_arguments = argumentList;
+  m_arguments.MakeUnique();
+  m_searchPath = searchPath;
+
+  bool ok = true;
+  while (size-- > 0) {
+    Helper * helper = new Helper;
+    if (!Start(*helper))
+      ok = false;
+
+    m_mutex.Wait();
+    m_helpers.push_back(helper);
+    m_idle.push_back(helper);
+    m_mutex.Signal();
+    m_available.Signal();
+  }
+
+  PTRACE(3, "PipeChannel\tStarted pool of " << m_helpers.size() << " \"" << subProgram << "\" helpers");
+  return ok;
+}
+
+
+void PPipeChannelPool::Close()
+{
+  // Wait for every helper to be returned by Execute()
+  for (size_t i = 0; i < m_helpers.size(); i++)
+    m_available.Wait();
+
+  PWaitAndSignal mutex(m_mutex);
+
+  // Give end of file to every helper to exit gracefully, then SIGTERM to
+  // any still running, and only then let Close() SIGKILL the rest.
+  std::vector<Helper *>::iterator it;
+  for (it = m_helpers.begin(); it != m_helpers.end(); ++it)
+    (*it)->m_channel.Execute();
+
+  if (!WaitForHelpers(HelperExitGrace)) {
+    for (it = m_helpers.begin(); it != m_helpers.end(); ++it) {
+      if ((*it)->m_channel.IsRunning())
+        (*it)->m_channel.Kill(SIGTERM);
+    }
+    WaitForHelpers(HelperExitGrace);
+  }
+
+  for (it = m_helpers.begin(); it != m_helpers.end(); ++it) {
+    (*it)->m_channel.Close();
+    delete *it;
+  }
+
+  m_helpers.clear();
+  m_idle.clear();
+}
+
+
+bool PPipeChannelPool::WaitForHelpers(const PTimeInterval & timeout)
+{
+  PTimeInterval deadline = PTimer::Tick() + timeout;
+  for (;;) {
+    std::vector<Helper *>::iterator it = m_helpers.begin();
+    while (it != m_helpers.end() && !(*it)->m_channel.IsRunning())
+      ++it;
+    if (it == m_helpers.end())
+      return true;
+    if (PTimer::Tick() >= deadline)
+      return false;
+    PThread::Sleep(10);
+  }
+}
+
+
+bool PPipeChannelPool::Start(Helper & helper)
+{
+  helper.m_pending.MakeEmpty();
+  m_startCount++;
+  if (helper.m_channel.Open(m_subProgram, m_arguments, PPipeChannel::ReadWrite, m_searchPath, true))
+    return true;
+
+  PTRACE(2, "PipeChannel\tCould not start helper \"" << m_subProgram << "\": " << helper.m_channel.GetErrorText());
+  return false;
+}
+
+
+bool PPipeChannelPool::Execute(const PString & request, PString & reply, const PTimeInterval & timeout)
+{
+  if (request.Find('\n') != P_MAX_INDEX) {
+    PTRACE(2, "PipeChannel\tHelper request may not contain a line feed");
+    return false;
+  }
+
+  // The wait for a helper and for its reply share the one timeout
+  PTimeInterval deadline = timeout == PMaxTimeInterval ? PMaxTimeInterval : PTimer::Tick() + timeout;
+
+  if (!m_available.Wait(timeout)) {
+    PTRACE(2, "PipeChannel\tNo helper available for \"" << m_subProgram << '"');
+    return false;
+  }
+
+  m_mutex.Wait();
+  Helper * helper = m_idle.front();
+  m_idle.pop_front();
+  m_mutex.Signal();
+
+  bool ok = Transact(*helper, request, reply, deadline);
+
+  PString errors;
+  while (helper->m_channel.IsOpen() && helper->m_channel.ReadStandardError(errors, false)) {
+    PTRACE(2, "PipeChannel\tHelper \"" << m_subProgram << "\" error: " << errors.Trim());
+  }
+
+  if (!ok) {
+    // Helper is in an unknown state so start a fresh one
+    helper->m_channel.Close();
+    Start(*helper);
+  }
+
+  // Most recently used first, so its pages are most likely to be resident
+  m_mutex.Wait();
+  m_idle.push_front(helper);
+  m_mutex.Signal();
+  m_available.Signal();
+
+  return ok;
+}
+
+
+bool PPipeChannelPool::Transact(Helper & helper, const PString & request, PString & reply, const PTimeInterval & deadline)
+{
+  if (!helper.m_channel.IsOpen() || !helper.m_channel.IsRunning())
+    return false;
+
+  PString line = request + '\n';
+  if (!helper.m_channel.Write((const char *)line, line.GetLength()))
+    return false;
+
+  for (;;) {
+    PINDEX lineEnd = helper.m_pending.Find('\n');
+    if (lineEnd != P_MAX_INDEX) {
+      reply = helper.m_pending.Left(lineEnd > 0 && helper.m_pending[lineEnd-1] == '\r' ? lineEnd-1 : lineEnd);
+      helper.m_pending.Delete(0, lineEnd+1);
+      return true;
+    }
+
+    if (deadline != PMaxTimeInterval) {
+      PTimeInterval now = PTimer::Tick();
+      if (now >= deadline) {
+        PTRACE(2, "PipeChannel\tNo reply from helper \"" << m_subProgram << "\" in time");
+        return false;
+      }
+      helper.m_channel.SetReadTimeout(deadline - now);
+    }
+    else
+      helper.m_channel.SetReadTimeout(PMaxTimeInterval);
+
+    char buffer[1024];
+    if (!helper.m_channel.Read(buffer, sizeof(buffer))) {
+      // Helpers are never closed while in use, so an interrupt is spurious
+      if (helper.m_channel.GetErrorCode(PChannel::LastReadError) == PChannel::Interrupted)
+        continue;
+      PTRACE(2, "PipeChannel\tNo reply from helper \"" << m_subProgram << "\": "
+             << helper.m_channel.GetErrorText(PChannel::LastReadError));
+      return false;
+    }
+
+    helper.m_pending += PString(buffer, helper.m_channel.GetLastReadCount());
+  }
+}
+
+
 // End Of File ///////////////////////////////////////////////////////////////
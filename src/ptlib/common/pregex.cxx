@@ -0,0 +1,1143 @@
+/*
+ * pregex.cxx
+ *
+ * Compiled regular expression engine and regular expression sets.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#include <ptlib.h>
+#include "pregex.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdlib.h>
+
+
+// Limits beyond which patterns are left to regexec()
+static const int MaxRepeat = 255;
+static const size_t MaxStatesPerPattern = 10000;
+// Cached DFA states are discarded when they use more memory than this
+static const size_t MaxDfaBytes = 8*1024*1024;
+
+
+static inline BYTE OtherCase(BYTE c)
+{
+  if (c >= 'a' && c <= 'z')
+    return (BYTE)(c - 'a' + 'A');
+  if (c >= 'A' && c <= 'Z')
+    return (BYTE)(c - 'A' + 'a');
+  return c;
+}
+
+
+static inline BYTE LowerCase(BYTE c)
+{
+  return (BYTE)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+struct PRegexNode
+{
+  enum Types { CharSet, Concat, Alternate, Repeat } type;
+  int set;
+  std::vector<int> children;
+  int minimum;
+  int maximum;  // Negative is unbounded
+};
+
+
+/* Recursive descent parser for POSIX basic and extended regular expressions,
+   returns false for anything it cannot be sure regcomp() treats identically.
+ */
+class PRegexParser
+{
+  public:
+    struct Branch {
+      int  node;
+      bool anchorStart;
+      bool anchorEnd;
+    };
+
+    PRegexParser(PRegexProgram & program, const char * pattern, int flags)
+      : m_program(program)
+      , m_ptr(pattern)
+      , m_extended((flags & PRegularExpression::Extended) != 0)
+      , m_caseless((flags & PRegularExpression::IgnoreCase) != 0)
+    {
+    }
+
+    bool Parse();
+
+    /* Get the literal string every match must start with, and the longest
+       literal string every match must contain. Caseless literals are lower
+       case.
+     */
+    void GetLiterals(std::string & prefix, std::string & required) const;
+
+    std::vector<PRegexNode> m_nodes;
+    std::vector<Branch>     m_branches;
+
+  protected:
+    int  NewNode(PRegexNode::Types type);
+    int  NewSet(PRegexProgram::CharSet & set);
+    int  NewLiteral(BYTE c);
+    int  ParseSequence(bool topLevel, bool * anchorEnd);
+    int  ParseGroup();
+    int  ParsePiece(bool first);
+    int  ParseAtom(bool first);
+    int  ParseBracket();
+    bool ParseInterval(int & minimum, int & maximum);
+    bool GetLiteralChar(int node, BYTE & c) const;
+    bool GetExact(int node, std::string & str) const;
+    void GetRequired(int node, std::string & required) const;
+
+    PRegexProgram & m_program;
+    const char    * m_ptr;
+    bool            m_extended;
+    bool            m_caseless;
+};
+
+
+bool PRegexParser::Parse()
+{
+  for (const char * p = m_ptr; *p != '\0'; p++) {
+    if ((*p & 0x80) != 0)
+      return false; // Meaning depends on the locale
+  }
+
+  do {
+    Branch branch;
+    branch.anchorStart = *m_ptr == '^';
+    if (branch.anchorStart)
+      m_ptr++;
+    branch.anchorEnd = false;
+    branch.node = ParseSequence(true, &branch.anchorEnd);
+    if (branch.node < 0)
+      return false;
+    m_branches.push_back(branch);
+  } while (m_extended && *m_ptr == '|' && *++m_ptr != '\0');
+
+  return *m_ptr == '\0';
+}
+
+
+int PRegexParser::NewNode(PRegexNode::Types type)
+{
+  PRegexNode node;
+  node.type = type;
+  node.set = -1;
+  node.minimum = node.maximum = 0;
+  m_nodes.push_back(node);
+  return m_nodes.size()-1;
+}
+
+
+int PRegexParser::NewSet(PRegexProgram::CharSet & set)
+{
+  if (m_caseless) {
+    for (int c = 'A'; c <= 'Z'; c++) {
+      if (set.Has((BYTE)c) || set.Has(OtherCase((BYTE)c))) {
+        set.Add((BYTE)c);
+        set.Add(OtherCase((BYTE)c));
+      }
+    }
+  }
+  set.bits[0] &= 0xfe; // Never match the terminating null
+
+  int node = NewNode(PRegexNode::CharSet);
+  m_nodes[node].set = m_program.AddSet(set);
+  return node;
+}
+
+
+int PRegexParser::NewLiteral(BYTE c)
+{
+  PRegexProgram::CharSet set;
+  memset(set.bits, 0, sizeof(set.bits));
+  set.Add(c);
+  return NewSet(set);
+}
+
+
+int PRegexParser::ParseSequence(bool topLevel, bool * anchorEnd)
+{
+  std::vector<int> children;
+
+  for (;;) {
+    char c = *m_ptr;
+    if (c == '\0')
+      break;
+
+    if (m_extended) {
+      if (c == '|')
+        break;
+      if (c == ')') {
+        if (topLevel)
+          return -1;
+        break;
+      }
+      if (c == '^')
+        return -1;
+      if (c == '$') {
+        if (!topLevel || (m_ptr[1] != '\0' && m_ptr[1] != '|'))
+          return -1;
+        *anchorEnd = true;
+        m_ptr++;
+        break;
+      }
+    }
+    else {
+      if (c == '\\' && m_ptr[1] == ')') {
+        if (topLevel)
+          return -1;
+        break;
+      }
+      if (c == '$') {
+        if (m_ptr[1] == '\0' && topLevel) {
+          *anchorEnd = true;
+          m_ptr++;
+          break;
+        }
+        if (m_ptr[1] == '\\' && m_ptr[2] == ')')
+          return -1;
+      }
+    }
+
+    int piece = ParsePiece(children.empty());
+    if (piece < 0)
+      return -1;
+    children.push_back(piece);
+  }
+
+  // Empty expressions are left to regexec()
+  if (children.empty())
+    return -1;
+
+  int concat = NewNode(PRegexNode::Concat);
+  m_nodes[concat].children = children;
+  return concat;
+}
+
+
+int PRegexParser::ParseGroup()
+{
+  std::vector<int> children;
+
+  for (;;) {
+    int sequence = ParseSequence(false, NULL);
+    if (sequence < 0)
+      return -1;
+    children.push_back(sequence);
+    if (*m_ptr != '|')
+      break;
+    m_ptr++;
+  }
+
+  if (*m_ptr++ != ')')
+    return -1;
+
+  if (children.size() == 1)
+    return children[0];
+
+  int alternate = NewNode(PRegexNode::Alternate);
+  m_nodes[alternate].children = children;
+  return alternate;
+}
+
+
+int PRegexParser::ParsePiece(bool first)
+{
+  int atom = ParseAtom(first);
+
+  while (atom >= 0) {
+    int minimum, maximum;
+    if (*m_ptr == '*') {
+      m_ptr++;
+      minimum = 0;
+      maximum = -1;
+    }
+    else if (m_extended && *m_ptr == '+') {
+      m_ptr++;
+      minimum = 1;
+      maximum = -1;
+    }
+    else if (m_extended && *m_ptr == '?') {
+      m_ptr++;
+      minimum = 0;
+      maximum = 1;
+    }
+    else if (m_extended && *m_ptr == '{') {
+      m_ptr++;
+      if (!ParseInterval(minimum, maximum) || *m_ptr++ != '}')
+        return -1;
+    }
+    else if (!m_extended && m_ptr[0] == '\\' && m_ptr[1] == '{') {
+      m_ptr += 2;
+      if (!ParseInterval(minimum, maximum) || m_ptr[0] != '\\' || m_ptr[1] != '}')
+        return -1;
+      m_ptr += 2;
+    }
+    else
+      break;
+
+    int repeat = NewNode(PRegexNode::Repeat);
+    m_nodes[repeat].children.push_back(atom);
+    m_nodes[repeat].minimum = minimum;
+    m_nodes[repeat].maximum = maximum;
+    atom = repeat;
+  }
+
+  return atom;
+}
+
+
+bool PRegexParser::ParseInterval(int & minimum, int & maximum)
+{
+  if (!isdigit(*m_ptr))
+    return false;
+
+  minimum = 0;
+  while (isdigit(*m_ptr) && minimum <= MaxRepeat)
+    minimum = minimum*10 + *m_ptr++ - '0';
+
+  if (*m_ptr != ',')
+    maximum = minimum;
+  else if (!isdigit(*++m_ptr))
+    maximum = -1;
+  else {
+    maximum = 0;
+    while (isdigit(*m_ptr) && maximum <= MaxRepeat)
+      maximum = maximum*10 + *m_ptr++ - '0';
+    if (maximum < minimum)
+      return false;
+  }
+
+  return minimum <= MaxRepeat && maximum <= MaxRepeat;
+}
+
+
+int PRegexParser::ParseAtom(bool first)
+{
+  char c = *m_ptr;
+
+  if (m_extended) {
+    switch (c) {
+      case '(' :
+        if (*++m_ptr == ')')
+          return -1;
+        return ParseGroup();
+
+      case '*' :
+      case '+' :
+      case '?' :
+      case '{' :
+        return -1; // Nothing to repeat
+    }
+  }
+  else if (c == '\\' && m_ptr[1] == '(') {
+    m_ptr += 2;
+    if (*m_ptr == '^' || *m_ptr == '*')
+      return -1;
+    int sequence = ParseSequence(false, NULL);
+    if (sequence < 0 || m_ptr[0] != '\\' || m_ptr[1] != ')')
+      return -1;
+    m_ptr += 2;
+    return sequence;
+  }
+  else if (c == '*' && !first)
+    return -1;
+
+  switch (c) {
+    case '\0' :
+      return -1;
+
+    case '.' : {
+      PRegexProgram::CharSet set;
+      memset(set.bits, 0xff, sizeof(set.bits));
+      m_ptr++;
+      return NewSet(set);
+    }
+
+    case '[' :
+      return ParseBracket();
+
+    case '\\' :
+      c = m_ptr[1];
+      // Back references and the GNU operators
+      if (c == '\0' || isalnum(c) || strchr("<>`'", c) != NULL)
+        return -1;
+      if (!m_extended && strchr("+?|{}()", c) != NULL)
+        return -1;
+      m_ptr += 2;
+      return NewLiteral(c);
+  }
+
+  m_ptr++;
+  return NewLiteral(c);
+}
+
+
+static bool AddClass(PRegexProgram::CharSet & set, const std::string & name)
+{
+  static const struct {
+    const char * name;
+    int (*test)(int);
+  } classes[] = {
+    { "alpha",  isalpha  },
+    { "digit",  isdigit  },
+    { "alnum",  isalnum  },
+    { "upper",  isupper  },
+    { "lower",  islower  },
+    { "space",  isspace  },
+    { "xdigit", isxdigit },
+    { "punct",  ispunct  },
+    { "print",  isprint  },
+    { "graph",  isgraph  },
+    { "cntrl",  iscntrl  }
+  };
+
+  if (name == "blank") {
+    set.Add(' ');
+    set.Add('\t');
+    return true;
+  }
+
+  for (PINDEX i = 0; i < PARRAYSIZE(classes); i++) {
+    if (name == classes[i].name) {
+      for (int c = 1; c < 128; c++) {
+        if (classes[i].test(c))
+          set.Add((BYTE)c);
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+int PRegexParser::ParseBracket()
+{
+  PRegexProgram::CharSet set;
+  memset(set.bits, 0, sizeof(set.bits));
+
+  bool negate = *++m_ptr == '^';
+  if (negate)
+    m_ptr++;
+
+  bool first = true;
+  for (;;) {
+    BYTE c = *m_ptr;
+    if (c == '\0')
+      return -1;
+    if (c == ']' && !first)
+      break;
+    first = false;
+
+    if (c == '[' && (m_ptr[1] == '=' || m_ptr[1] == '.'))
+      return -1; // Collating elements depend on the locale
+
+    if (c == '[' && m_ptr[1] == ':') {
+      const char * end = strstr(m_ptr+2, ":]");
+      if (end == NULL || !AddClass(set, std::string(m_ptr+2, end)))
+        return -1;
+      m_ptr = end+2;
+      continue;
+    }
+
+    m_ptr++;
+    if (*m_ptr == '-' && m_ptr[1] != ']' && m_ptr[1] != '\0') {
+      BYTE last = m_ptr[1];
+      if (last == '[' || last < c)
+        return -1;
+      for (int r = c; r <= last; r++)
+        set.Add((BYTE)r);
+      m_ptr += 2;
+    }
+    else
+      set.Add(c);
+  }
+  m_ptr++;
+
+  if (negate) {
+    if (m_caseless) {
+      // Fold before inverting, so [^a] excludes both cases
+      for (int c = 'A'; c <= 'Z'; c++) {
+        if (set.Has((BYTE)c) || set.Has(OtherCase((BYTE)c))) {
+          set.Add((BYTE)c);
+          set.Add(OtherCase((BYTE)c));
+        }
+      }
+    }
+    for (PINDEX i = 0; i < (PINDEX)sizeof(set.bits); i++)
+      set.bits[i] = (BYTE)~set.bits[i];
+  }
+
+  return NewSet(set);
+}
+
+
+bool PRegexParser::GetLiteralChar(int node, BYTE & c) const
+{
+  const PRegexProgram::CharSet & set = m_program.m_sets[m_nodes[node].set];
+
+  int count = 0;
+  for (int i = 1; i < 256; i++) {
+    if (set.Has((BYTE)i)) {
+      if (++count > 2)
+        return false;
+      if (count == 1)
+        c = (BYTE)i;
+      else if (!m_caseless || OtherCase(c) != i)
+        return false;
+    }
+  }
+
+  if (m_caseless)
+    c = LowerCase(c);
+  return count == 1 || (count == 2 && m_caseless);
+}
+
+
+bool PRegexParser::GetExact(int node, std::string & str) const
+{
+  const PRegexNode & n = m_nodes[node];
+  switch (n.type) {
+    case PRegexNode::CharSet : {
+      BYTE c;
+      if (!GetLiteralChar(node, c))
+        return false;
+      str += (char)c;
+      return true;
+    }
+
+    case PRegexNode::Concat :
+      for (size_t i = 0; i < n.children.size(); i++) {
+        if (!GetExact(n.children[i], str))
+          return false;
+      }
+      return true;
+
+    case PRegexNode::Repeat :
+      if (n.minimum != n.maximum)
+        return false;
+      for (int i = 0; i < n.minimum; i++) {
+        if (!GetExact(n.children[0], str))
+          return false;
+      }
+      return true;
+
+    default :
+      return false;
+  }
+}
+
+
+void PRegexParser::GetRequired(int node, std::string & required) const
+{
+  const PRegexNode & n = m_nodes[node];
+  switch (n.type) {
+    case PRegexNode::CharSet :
+    case PRegexNode::Alternate :
+      break;
+
+    case PRegexNode::Concat : {
+      std::string run;
+      for (size_t i = 0; i < n.children.size(); i++) {
+        std::string exact;
+        if (GetExact(n.children[i], exact))
+          run += exact;
+        else {
+          if (run.length() > required.length())
+            required = run;
+          run.erase();
+          GetRequired(n.children[i], required);
+        }
+      }
+      if (run.length() > required.length())
+        required = run;
+      break;
+    }
+
+    case PRegexNode::Repeat :
+      if (n.minimum > 0)
+        GetRequired(n.children[0], required);
+      break;
+  }
+}
+
+
+void PRegexParser::GetLiterals(std::string & prefix, std::string & required) const
+{
+  prefix.erase();
+  required.erase();
+
+  if (m_branches.size() != 1)
+    return;
+
+  const PRegexNode & top = m_nodes[m_branches[0].node];
+  for (size_t i = 0; i < top.children.size(); i++) {
+    if (!GetExact(top.children[i], prefix))
+      break;
+  }
+
+  GetRequired(m_branches[0].node, required);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+void PRegexProgram::Dfa::Flush()
+{
+  for (size_t i = 0; i < m_states.size(); i++)
+    delete m_states[i];
+  m_states.clear();
+  m_index.clear();
+  m_start[0] = m_start[1] = -1;
+  m_bytes = 0;
+}
+
+
+PRegexProgram::PRegexProgram()
+  : m_patterns(0)
+  , m_stateLimit(0)
+  , m_anchored(false)
+  , m_caseless(false)
+  , m_prepared(false)
+  , m_multiByte(false)
+  , m_mark(0)
+  , m_visit(0)
+  , m_search(true)
+  , m_anchor(false)
+{
+}
+
+
+PRegexProgram::~PRegexProgram()
+{
+}
+
+
+bool PRegexProgram::Add(const char * pattern, int flags, PINDEX id)
+{
+  if (pattern == NULL || (flags & ~(PRegularExpression::Extended|PRegularExpression::IgnoreCase)) != 0)
+    return false;
+
+  PWaitAndSignal lock(m_mutex);
+
+  PRegexParser parser(*this, pattern, flags);
+  if (!parser.Parse())
+    return false;
+
+  size_t oldStates = m_states.size();
+  m_stateLimit = oldStates + MaxStatesPerPattern;
+  std::vector<int> anchored, floating;
+
+  for (size_t i = 0; i < parser.m_branches.size(); i++) {
+    const PRegexParser::Branch & branch = parser.m_branches[i];
+    int match = NewState(State::Match);
+    m_states[match].id = id;
+    m_states[match].atEnd = branch.anchorEnd;
+
+    int start = Build(parser, branch.node, match);
+    if (start < 0) {
+      m_states.resize(oldStates);
+      return false;
+    }
+
+    (branch.anchorStart ? anchored : floating).push_back(start);
+  }
+
+  m_anchoredSeeds.insert(m_anchoredSeeds.end(), anchored.begin(), anchored.end());
+  m_floatingSeeds.insert(m_floatingSeeds.end(), floating.begin(), floating.end());
+
+  if (m_patterns++ == 0) {
+    parser.GetLiterals(m_prefix, m_required);
+    m_anchored = floating.empty();
+    m_caseless = (flags & PRegularExpression::IgnoreCase) != 0;
+  }
+  else {
+    m_prefix.erase();
+    m_required.erase();
+    m_anchored = false;
+  }
+
+  m_prepared = false;
+  return true;
+}
+
+
+int PRegexProgram::AddSet(const CharSet & set)
+{
+  std::string key((const char *)set.bits, sizeof(set.bits));
+  std::map<std::string, int>::iterator it = m_setIndex.find(key);
+  if (it != m_setIndex.end())
+    return it->second;
+
+  m_sets.push_back(set);
+  return m_setIndex[key] = m_sets.size()-1;
+}
+
+
+int PRegexProgram::NewState(State::Types type, int out, int out1)
+{
+  State state;
+  state.type = type;
+  state.set = -1;
+  state.out = out;
+  state.out1 = out1;
+  state.id = 0;
+  state.atEnd = false;
+  m_states.push_back(state);
+  return m_states.size()-1;
+}
+
+
+/* Builds the states backwards from the continuation, so no patch lists are
+   needed. Bounded repeats make a fresh copy of the sub-expression each time.
+ */
+int PRegexProgram::Build(const PRegexParser & parser, int node, int next)
+{
+  if (next < 0 || m_states.size() > m_stateLimit)
+    return -1;
+
+  const PRegexNode & n = parser.m_nodes[node];
+  switch (n.type) {
+    case PRegexNode::CharSet : {
+      int state = NewState(State::Char, next);
+      m_states[state].set = n.set;
+      return state;
+    }
+
+    case PRegexNode::Concat :
+      for (size_t i = n.children.size(); next >= 0 && i-- > 0; )
+        next = Build(parser, n.children[i], next);
+      return next;
+
+    case PRegexNode::Alternate : {
+      int start = Build(parser, n.children.back(), next);
+      for (size_t i = n.children.size()-1; start >= 0 && i-- > 0; ) {
+        int body = Build(parser, n.children[i], next);
+        start = body < 0 ? -1 : NewState(State::Split, body, start);
+      }
+      return start;
+    }
+
+    case PRegexNode::Repeat : {
+      int child = n.children[0];
+      if (n.maximum < 0) {
+        int loop = NewState(State::Split, -1, next);
+        int body = Build(parser, child, loop);
+        if (body < 0)
+          return -1;
+        m_states[loop].out = body;
+        next = loop;
+      }
+      else {
+        for (int i = n.minimum; next >= 0 && i < n.maximum; i++) {
+          int body = Build(parser, child, next);
+          next = body < 0 ? -1 : NewState(State::Split, body, next);
+        }
+      }
+
+      for (int i = 0; next >= 0 && i < n.minimum; i++)
+        next = Build(parser, child, next);
+      return next;
+    }
+  }
+
+  return -1;
+}
+
+
+void PRegexProgram::Prepare()
+{
+  if (m_prepared)
+    return;
+
+  m_search.Flush();
+  m_anchor.Flush();
+
+  /* Bytes that no pattern can tell apart share a class, so DFA states only
+     need a transition per class. Dial plans have a dozen or so classes. */
+  memset(m_classOf, 0, sizeof(m_classOf));
+  int classes = 1;
+  for (size_t s = 0; s < m_sets.size(); s++) {
+    std::map<int, int> split;
+    for (int c = 0; c < 256; c++) {
+      int key = m_classOf[c]*2 + (m_sets[s].Has((BYTE)c) ? 1 : 0);
+      std::map<int, int>::iterator it = split.find(key);
+      if (it == split.end())
+        it = split.insert(std::pair<int, int>(key, split.size())).first;
+      m_classOf[c] = (BYTE)it->second;
+    }
+    classes = split.size();
+    if (classes == 256)
+      break;
+  }
+
+  m_classByte.assign(classes, 0);
+  for (int c = 255; c >= 0; c--)
+    m_classByte[m_classOf[c]] = (BYTE)c;
+
+  m_marks.assign(m_states.size(), 0);
+  m_mark = 0;
+  m_prepared = true;
+}
+
+
+/* Expand the states through all the splits, leaving a sorted set of the
+   character and match states.
+ */
+void PRegexProgram::Closure(std::vector<int> & states)
+{
+  if (++m_mark == 0) {
+    m_marks.assign(m_states.size(), 0);
+    m_mark = 1;
+  }
+
+  std::vector<int> stack(states.rbegin(), states.rend());
+  states.clear();
+
+  while (!stack.empty()) {
+    int s = stack.back();
+    stack.pop_back();
+    if (m_marks[s] == m_mark)
+      continue;
+    m_marks[s] = m_mark;
+
+    const State & state = m_states[s];
+    if (state.type == State::Split) {
+      stack.push_back(state.out1);
+      stack.push_back(state.out);
+    }
+    else
+      states.push_back(s);
+  }
+
+  std::sort(states.begin(), states.end());
+}
+
+
+int PRegexProgram::GetState(Dfa & dfa, std::vector<int> & nfa)
+{
+  std::map<std::vector<int>, int>::iterator it = dfa.m_index.find(nfa);
+  if (it != dfa.m_index.end())
+    return it->second;
+
+  if (dfa.m_bytes > MaxDfaBytes) {
+    PTRACE(4, "PTLib\tRegular expression DFA cache flushed at " << dfa.m_states.size() << " states");
+    dfa.Flush();
+  }
+
+  DState * state = new DState;
+  state->nfa = nfa;
+  state->next.assign(m_classByte.size(), -1);
+  state->visited = 0;
+
+  for (size_t i = 0; i < nfa.size(); i++) {
+    const State & s = m_states[nfa[i]];
+    if (s.type == State::Match)
+      (s.atEnd ? state->acceptAtEnd : state->accept).push_back(s.id);
+  }
+
+  dfa.m_bytes += sizeof(DState) + 2*sizeof(nfa) + (nfa.size()*2 + state->next.size())*sizeof(int);
+  dfa.m_states.push_back(state);
+  return dfa.m_index[nfa] = dfa.m_states.size()-1;
+}
+
+
+int PRegexProgram::GetStart(Dfa & dfa, bool bol)
+{
+  if (dfa.m_start[bol] < 0) {
+    std::vector<int> nfa = m_floatingSeeds;
+    if (bol)
+      nfa.insert(nfa.end(), m_anchoredSeeds.begin(), m_anchoredSeeds.end());
+    Closure(nfa);
+    dfa.m_start[bol] = GetState(dfa, nfa);
+  }
+  return dfa.m_start[bol];
+}
+
+
+int PRegexProgram::Next(Dfa & dfa, int state, BYTE c)
+{
+  int cls = m_classOf[c];
+  int next = dfa.m_states[state]->next[cls];
+  if (next >= 0)
+    return next;
+
+  BYTE rep = m_classByte[cls];
+  const std::vector<int> & current = dfa.m_states[state]->nfa;
+  std::vector<int> nfa;
+  for (size_t i = 0; i < current.size(); i++) {
+    const State & s = m_states[current[i]];
+    if (s.type == State::Char && m_sets[s.set].Has(rep))
+      nfa.push_back(s.out);
+  }
+
+  if (dfa.m_search)
+    nfa.insert(nfa.end(), m_floatingSeeds.begin(), m_floatingSeeds.end());
+
+  Closure(nfa);
+
+  size_t count = dfa.m_states.size();
+  next = GetState(dfa, nfa);
+  // If the cache was flushed the current state no longer exists
+  if (dfa.m_states.size() >= count)
+    dfa.m_states[state]->next[cls] = next;
+  return next;
+}
+
+
+PRegexProgram::Result PRegexProgram::Search(const char * str, int execFlags, std::vector<PINDEX> * ids)
+{
+  bool eol = (execFlags & PRegularExpression::NotEndofLine) == 0;
+  int s = GetStart(m_search, (execFlags & PRegularExpression::NotBeginningOfLine) == 0);
+
+  for (const BYTE * ptr = (const BYTE *)str; ; ptr++) {
+    DState * state = m_search.m_states[s];
+    if (ids == NULL) {
+      if (!state->accept.empty())
+        return Matched;
+    }
+    else if (state->visited != m_visit) {
+      state->visited = m_visit;
+      ids->insert(ids->end(), state->accept.begin(), state->accept.end());
+    }
+
+    if (*ptr == '\0') {
+      if (eol && !state->acceptAtEnd.empty()) {
+        if (ids == NULL)
+          return Matched;
+        ids->insert(ids->end(), state->acceptAtEnd.begin(), state->acceptAtEnd.end());
+      }
+      break;
+    }
+
+    if (state->nfa.empty())
+      break;
+
+    if (IsUnsupported(*ptr))
+      return Unsupported;
+
+    s = Next(m_search, s, *ptr);
+  }
+
+  if (ids == NULL || ids->empty())
+    return NoMatch;
+
+  std::sort(ids->begin(), ids->end());
+  ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+  return Matched;
+}
+
+
+PINDEX PRegexProgram::FindLiteral(const char * str, PINDEX offset, const std::string & literal) const
+{
+  if (!m_caseless) {
+    const char * found = strstr(str+offset, literal.c_str());
+    return found != NULL ? found - str : P_MAX_INDEX;
+  }
+
+  for (const char * ptr = str+offset; *ptr != '\0'; ptr++) {
+    size_t i = 0;
+    while (i < literal.length() && LowerCase(ptr[i]) == (BYTE)literal[i])
+      i++;
+    if (i == literal.length())
+      return ptr - str;
+  }
+
+  return P_MAX_INDEX;
+}
+
+
+PRegexProgram::Result PRegexProgram::Match(const char * str, int execFlags)
+{
+  if ((execFlags & ~(PRegularExpression::NotBeginningOfLine|PRegularExpression::NotEndofLine)) != 0)
+    return Unsupported;
+
+  // Cheap rejections that do not need the lock
+  if (m_anchored) {
+    if ((execFlags & PRegularExpression::NotBeginningOfLine) != 0)
+      return NoMatch;
+    for (size_t i = 0; i < m_prefix.length(); i++) {
+      if ((m_caseless ? LowerCase(str[i]) : (BYTE)str[i]) != (BYTE)m_prefix[i])
+        return NoMatch;
+    }
+  }
+  if (!m_required.empty() && FindLiteral(str, 0, m_required) == P_MAX_INDEX)
+    return NoMatch;
+
+  PWaitAndSignal lock(m_mutex);
+  m_multiByte = MB_CUR_MAX > 1;
+  Prepare();
+  return Search(str, execFlags, NULL);
+}
+
+
+PRegexProgram::Result PRegexProgram::Find(const char * str, PINDEX & start, PINDEX & len, int execFlags)
+{
+  Result result = Match(str, execFlags);
+  if (result != Matched)
+    return result;
+
+  PWaitAndSignal lock(m_mutex);
+
+  // Leftmost longest, try each start position with the anchored automaton
+  bool bol = (execFlags & PRegularExpression::NotBeginningOfLine) == 0;
+  bool eol = (execFlags & PRegularExpression::NotEndofLine) == 0;
+  for (PINDEX pos = 0; ; pos++) {
+    if (pos > 0) {
+      if (m_floatingSeeds.empty() || str[pos-1] == '\0')
+        break;
+      if (!m_prefix.empty() && (pos = FindLiteral(str, pos, m_prefix)) == P_MAX_INDEX)
+        break;
+    }
+
+    int s = GetStart(m_anchor, pos == 0 && bol);
+    PINDEX last = P_MAX_INDEX;
+    for (const BYTE * ptr = (const BYTE *)str+pos; ; ptr++) {
+      DState * state = m_anchor.m_states[s];
+      if (!state->accept.empty())
+        last = ptr - (const BYTE *)str;
+      if (*ptr == '\0') {
+        if (eol && !state->acceptAtEnd.empty())
+          last = ptr - (const BYTE *)str;
+        break;
+      }
+      if (state->nfa.empty())
+        break;
+      if (IsUnsupported(*ptr))
+        return Unsupported;
+      s = Next(m_anchor, s, *ptr);
+    }
+
+    if (last != P_MAX_INDEX) {
+      start = pos;
+      len = last - pos;
+      return Matched;
+    }
+  }
+
+  // The search automaton said there was a match, so this cannot happen
+  PAssertAlways(PLogicError);
+  return Unsupported;
+}
+
+
+PRegexProgram::Result PRegexProgram::FindAll(const char * str, std::vector<PINDEX> & ids, int execFlags)
+{
+  ids.clear();
+  if ((execFlags & ~(PRegularExpression::NotBeginningOfLine|PRegularExpression::NotEndofLine)) != 0)
+    return Unsupported;
+
+  PWaitAndSignal lock(m_mutex);
+  m_multiByte = MB_CUR_MAX > 1;
+  Prepare();
+  if (++m_visit == 0)
+    ++m_visit;
+  return Search(str, execFlags, &ids);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+PRegexSet::PRegexSet()
+  : m_program(new PRegexProgram)
+{
+}
+
+
+PRegexSet::~PRegexSet()
+{
+  RemoveAll();
+  delete m_program;
+}
+
+
+PINDEX PRegexSet::Add(const PString & pattern, int flags)
+{
+  PRegularExpression * regex = new PRegularExpression;
+  if (!regex->Compile(pattern, flags)) {
+    PTRACE(2, "PTLib\tRegular expression \"" << pattern << "\" not added to set: " << regex->GetErrorText());
+    delete regex;
+    return P_MAX_INDEX;
+  }
+
+  PINDEX index = m_patterns.GetSize();
+  m_patterns.SetAt(index, regex);
+
+  if (!m_program->Add(pattern, flags, index)) {
+    PTRACE(4, "PTLib\tRegular expression \"" << pattern << "\" executed individually in set");
+    m_individual.push_back(index);
+  }
+
+  return index;
+}
+
+
+void PRegexSet::RemoveAll()
+{
+  m_patterns.SetSize(0);
+  m_individual.clear();
+
+  delete m_program;
+  m_program = new PRegexProgram;
+}
+
+
+PBoolean PRegexSet::Execute(const PString & str, PIntArray & matches, int flags) const
+{
+  return Execute((const char *)str, matches, flags);
+}
+
+
+PBoolean PRegexSet::Execute(const char * cstr, PIntArray & matches, int flags) const
+{
+  std::vector<PINDEX> ids;
+  std::vector<PINDEX> individual = m_individual;
+
+  if (m_program->FindAll(cstr, ids, flags) == PRegexProgram::Unsupported) {
+    individual.clear();
+    for (PINDEX i = 0; i < m_patterns.GetSize(); i++)
+      individual.push_back(i);
+  }
+
+  if (!individual.empty()) {
+    PINDEX start, len;
+    for (size_t i = 0; i < individual.size(); i++) {
+      if (m_patterns[individual[i]].Execute(cstr, start, len, flags))
+        ids.push_back(individual[i]);
+    }
+    std::sort(ids.begin(), ids.end());
+  }
+
+  matches.SetSize(ids.size());
+  for (size_t i = 0; i < ids.size(); i++)
+    matches[i] = ids[i];
+
+  return !ids.empty();
+}
+
+
+// End Of File ///////////////////////////////////////////////////////////////
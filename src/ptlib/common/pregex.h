@@ -0,0 +1,146 @@
+/*
+ * pregex.h
+ *
+ * Compiled regular expression engine used by PRegularExpression and PRegexSet.
+ *
+ * Portable Windows Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * $Revision$
+ * $Author$
+ * $Date$
+ */
+
+#ifndef PTLIB_PREGEX_H
+#define PTLIB_PREGEX_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+/* Regular expressions without back references compiled into a Thompson NFA,
+   which is executed as a lazily built DFA. Any number of patterns may be
+   added, each with its own identifier, so a whole set is matched in one pass
+   over the string.
+
+   Only the part of the POSIX grammar that has the same meaning for every
+   regcomp() implementation is accepted, Add() returns false for anything
+   else and the caller must use regexec() for that pattern.
+ */
+class PRegexProgram
+{
+  public:
+    PRegexProgram();
+    ~PRegexProgram();
+
+    enum Result {
+      NoMatch,
+      Matched,
+      Unsupported   // String or flags need regexec()
+    };
+
+    /* Add a pattern with PRegularExpression compile flags. */
+    bool Add(const char * pattern, int flags, PINDEX id);
+
+    /* Determine if any pattern matches anywhere in the string. */
+    Result Match(const char * str, int execFlags);
+
+    /* Find the leftmost longest match, as regexec() would. */
+    Result Find(const char * str, PINDEX & start, PINDEX & len, int execFlags);
+
+    /* Get the sorted identifiers of all patterns matching the string. */
+    Result FindAll(const char * str, std::vector<PINDEX> & ids, int execFlags);
+
+    struct CharSet {
+      BYTE bits[32];
+      bool Has(BYTE c) const { return (bits[c>>3] & (1 << (c&7))) != 0; }
+      void Add(BYTE c) { bits[c>>3] |= (BYTE)(1 << (c&7)); }
+    };
+
+    struct State {
+      enum Types { Char, Split, Match } type;
+      int   set;      // Char: index into m_sets
+      int   out;      // Char and Split: next state
+      int   out1;     // Split: alternate next state
+      PINDEX id;      // Match: pattern identifier
+      bool  atEnd;    // Match: only at end of the string ('$')
+    };
+
+    struct DState {
+      std::vector<int>    nfa;          // Sorted Char and Match states
+      std::vector<PINDEX> accept;       // Patterns matched on entry
+      std::vector<PINDEX> acceptAtEnd;  // Patterns matched if at end of string
+      std::vector<int>    next;         // Per byte class, -1 not yet built
+      unsigned            visited;
+    };
+
+    struct Dfa {
+      Dfa(bool search) : m_search(search) { Flush(); }
+      ~Dfa() { Flush(); }
+      void Flush();
+
+      bool                                m_search; // Restart floating patterns at every byte
+      std::vector<DState *>               m_states;
+      std::map<std::vector<int>, int>     m_index;
+      int                                 m_start[2];
+      size_t                              m_bytes;
+    };
+
+  protected:
+    friend class PRegexParser;
+
+    void Prepare();
+    int  AddSet(const CharSet & set);
+    int  NewState(State::Types type, int out = -1, int out1 = -1);
+    int  Build(const class PRegexParser & parser, int node, int next);
+    void Closure(std::vector<int> & states);
+    int  GetState(Dfa & dfa, std::vector<int> & nfa);
+    int  GetStart(Dfa & dfa, bool bol);
+    int  Next(Dfa & dfa, int state, BYTE c);
+    bool IsUnsupported(BYTE c) const { return (c & 0x80) != 0 && m_multiByte; }
+    Result Search(const char * str, int execFlags, std::vector<PINDEX> * ids);
+    PINDEX FindLiteral(const char * str, PINDEX offset, const std::string & literal) const;
+
+    PMutex                        m_mutex;
+    std::vector<CharSet>          m_sets;
+    std::map<std::string, int>    m_setIndex;
+    std::vector<State>            m_states;
+    std::vector<int>              m_anchoredSeeds;
+    std::vector<int>              m_floatingSeeds;
+    PINDEX                        m_patterns;
+    size_t                        m_stateLimit;
+
+    // Prefilters, only used when there is a single pattern
+    std::string                   m_prefix;
+    std::string                   m_required;
+    bool                          m_anchored;
+    bool                          m_caseless;
+
+    bool                          m_prepared;
+    bool                          m_multiByte;
+    BYTE                          m_classOf[256];
+    std::vector<BYTE>             m_classByte;
+    std::vector<unsigned>         m_marks;
+    unsigned                      m_mark;
+    unsigned                      m_visit;
+    Dfa                           m_search;
+    Dfa                           m_anchor;
+};
+
+
+#endif // PTLIB_PREGEX_H
+
+
+// End Of File ///////////////////////////////////////////////////////////////
@@ -50,18 +50,25 @@ struct jdec_private;
 #define COMPONENTS	   3
 #define JPEG_MAX_WIDTH	   2048
 #define JPEG_MAX_HEIGHT	   2048
+#define TINYJPEG_MAX_THREADS 8
 
 struct huffman_table
 {
   /* Fast look up table, using HUFFMAN_HASH_NBITS bits we can have directly the symbol,
    * if the symbol is <0, then we need to look into the tree table */
   short int lookup[HUFFMAN_HASH_SIZE];
-  /* code size: give the number of bits of a symbol is encoded */
+  /* code size: give the number of bits of the symbol in lookup, per entry as a
+   * damaged table may have the same symbol with codes of different lengths */
   unsigned char code_size[HUFFMAN_HASH_SIZE];
-  /* some place to store value that is not encoded in the lookup table 
-   * FIXME: Calculate if 256 value is enough to store all values
-   */
-  uint16_t slowtable[16-HUFFMAN_HASH_NBITS][256];
+  /* AC coefficients whose code and value bits together fit in HUFFMAN_HASH_NBITS,
+   * as value*65536 + zero run*256 + total bits, or 0 if the code does not fit */
+  int fast_ac[HUFFMAN_HASH_SIZE];
+  /* Codes longer than HUFFMAN_HASH_NBITS are canonical (cf. JPEG standard F.2.2.3):
+   * the largest code of each length, or -1 if none, and the offset from a code
+   * of that length to the index of its symbol in huffval */
+  int maxcode[17];
+  int valoffset[17];
+  unsigned char huffval[256];
 };
 
 struct component 
@@ -85,6 +92,7 @@ struct component
 
 typedef void (*decode_MCU_fct) (struct jdec_private *priv);
 typedef void (*convert_colorspace_fct) (struct jdec_private *priv);
+typedef void (*idct_fct) (struct component *compptr, uint8_t *output_buf, int stride);
 
 struct jdec_private
 {
@@ -120,10 +128,23 @@ struct jdec_private
   /* Internal Pointer use for colorspace conversion, do not modify it !!! */
   uint8_t *plane[COMPONENTS];
 
+  idct_fct idct;				/* IDCT chosen for the CPU */
+  unsigned int threads;				/* Threads to decode restart intervals */
+
 };
 
-#define IDCT tinyjpeg_idct_float
+/* The SSE2/AVX2 IDCT and colour conversion need SSE2 as standard, and GCC intrinsics */
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && !defined(P_MEDIALIB)
+#define TINYJPEG_SIMD 1
+#else
+#define TINYJPEG_SIMD 0
+#endif
+
+#define IDCT priv->idct
 void tinyjpeg_idct_float (struct component *compptr, uint8_t *output_buf, int stride);
 
+/* Get the fastest IDCT for the CPU, or the plain C one */
+idct_fct tinyjpeg_select_idct(int plain);
+
 #endif
 
@@ -37,12 +37,18 @@
 #include <inttypes.h>
 #include <errno.h>
 
+#include <ptlib.h>
+#include <ptclib/threadpool.h>
+
 #include "tinyjpeg.h"
 #include "tinyjpeg-internal.h"
 #include "ptbuildopts.h"
 
+#if TINYJPEG_SIMD
+#include <emmintrin.h>
+#endif
+
 #ifdef INCLUDE_TINYJPEG
-#error("Code has Coverity errors")
 
 enum std_markers {
    DQT  = 0xDB, /* Define Quantization Table */
@@ -151,6 +157,22 @@ static const unsigned char zigzag[64] =
   35, 36, 48, 49, 57, 58, 62, 63
 };
 
+/* The inverse of zigzag, from the position in the stream to the natural
+ * order. A corrupt run can go up to 15 past the end, which goes to 64. */
+static const unsigned char dezigzag[64+16] = 
+{
+   0,  1,  8, 16,  9,  2,  3, 10,
+  17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34,
+  27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36,
+  29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46,
+  53, 60, 61, 54, 47, 55, 62, 63,
+  64, 64, 64, 64, 64, 64, 64, 64,
+  64, 64, 64, 64, 64, 64, 64, 64
+};
+
 /* Set up the standard Huffman tables (cf. JPEG standard section K.3) */
 /* IMPORTANT: these are only valid for 8-bit data precision! */
 static const unsigned char bits_dc_luminance[17] =
@@ -264,7 +286,7 @@ static const unsigned char val_ac_chrominance[] =
         longjmp(priv->jump_state, -EIO); \
       c = *stream++; \
       reservoir <<= 8; \
-      if (c == 0xff && *stream == 0x00) \
+      if (c == 0xff && stream < priv->stream_end && *stream == 0x00) \
         stream++; \
       reservoir |= c; \
       nbits_in_reservoir+=8; \
@@ -310,40 +332,32 @@ static void resync(struct jdec_private *priv);
  * To speedup the procedure, we look HUFFMAN_HASH_NBITS bits and the code is
  * lower than HUFFMAN_HASH_NBITS we have automaticaly the length of the code
  * and the value by using two lookup table.
- * Else if the value is not found, just search (linear) into an array for each
- * bits is the code is present.
+ * Else the code is longer, and as the codes are canonical, its length is the
+ * first one where the bits are no more than the largest code of that length.
  *
- * If the code is not present for any reason, -1 is return.
+ * If the code is not present for any reason, 0 is return.
  */
 static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table *huffman_table)
 {
   int value, hcode;
-  unsigned int extra_nbits, nbits;
-  uint16_t *slowtable;
+  unsigned int nbits;
 
   look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
   value = huffman_table->lookup[hcode];
   if (value >= 0)
   { 
-     unsigned int code_size = huffman_table->code_size[value];
+     unsigned int code_size = huffman_table->code_size[hcode];
      skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, code_size);
      return value;
   }
 
   /* Decode more bits each time ... */
-  for (extra_nbits=0; extra_nbits<16-HUFFMAN_HASH_NBITS; extra_nbits++)
+  for (nbits = HUFFMAN_HASH_NBITS + 1; nbits <= 16; nbits++)
    {
-     nbits = HUFFMAN_HASH_NBITS + 1 + extra_nbits;
-
      look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits, hcode);
-     slowtable = huffman_table->slowtable[extra_nbits];
-     /* Search if the code is in this array */
-     while (slowtable[0]) {
-	if (slowtable[0] == hcode) {
-	   skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits);
-	   return slowtable[1];
-	}
-	slowtable+=2;
+     if (hcode <= huffman_table->maxcode[nbits]) {
+	skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, nbits);
+	return huffman_table->huffval[(hcode + huffman_table->valoffset[nbits]) & 0xff];
      }
    }
   return 0;
@@ -357,21 +371,28 @@ static int get_next_huffman_code(struct jdec_private *priv, struct huffman_table
  * Decode a single block that contains the DCT coefficients.
  * The table coefficients is already dezigzaged at the end of the operation.
  *
+ * Most AC coefficients are short codes with small values, so they are taken
+ * whole from the fast_ac table, without a separate get_nbits() for the value.
+ *
  */
 static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 {
-  unsigned char j;
+  unsigned int j;
   unsigned int huff_code;
   unsigned char size_val, count_0;
+  int hcode, fast;
+  short int value;
 
   struct component *c = &priv->component_infos[component];
-  short int DCT[64];
+  short int DCT[65];	/* natural order, plus a slot for runs past the end */
 
   /* Initialize the DCT coef table */
   memset(DCT, 0, sizeof(DCT));
 
   /* DC coefficient decoding */
   huff_code = get_next_huffman_code(priv, c->DC_table);
+  if (huff_code > 11)
+    longjmp(priv->jump_state, -EIO);	/* DC differences have at most 11 bits */
   if (huff_code) {
      get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, huff_code, DCT[0]);
      DCT[0] += c->previous_DC;
@@ -385,6 +406,17 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
   j = 1;
   while (j<64)
    {
+     look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
+     fast = c->AC_table->fast_ac[hcode];
+     if (fast)
+      {
+	j += (fast >> 8) & 0xff;
+	skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, fast & 0xff);
+	DCT[dezigzag[j]] = fast >> 16;
+	j++;
+	continue;
+      }
+
      huff_code = get_next_huffman_code(priv, c->AC_table);
 
      size_val = huff_code & 0xF;
@@ -400,20 +432,18 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
      else
       {
 	j += count_0;	/* skip count_0 zeroes */
-	get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[j]);
+	get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, value);
+	DCT[dezigzag[j]] = value;
 	j++;
       }
    }
 
-  for (j = 0; j < 64; j++)
 #ifndef P_MEDIALIB
-    c->DCT[j] = DCT[zigzag[j]];
+  memcpy(c->DCT, DCT, sizeof(c->DCT));
 #else
-  {
-    c->DCT[j] = DCT[zigzag[j]] * c->Q_table[j];
-    if (j == 0)
-      c->DCT[j] += 1024;
-  }
+  for (j = 0; j < 64; j++)
+    c->DCT[j] = DCT[j] * c->Q_table[j];
+  c->DCT[0] += 1024;
 #endif    
 }
 
@@ -422,9 +452,10 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
  * 
  * lookup will return the symbol if the code is less or equal than HUFFMAN_HASH_NBITS.
  * code_size will be used to known how many bits this symbol is encoded.
- * slowtable will be used when the first lookup didn't give the result.
+ * fast_ac gives the whole coefficient when its value bits fit in the lookup too.
+ * maxcode, valoffset and huffval will be used when the first lookup didn't give the result.
  */
-static void build_huffman_table(const unsigned char *bits, const unsigned char *vals, struct huffman_table *table)
+static int build_huffman_table(const unsigned char *bits, const unsigned char *vals, struct huffman_table *table)
 {
   unsigned int i, j, code, code_size, val, nbits;
   unsigned char huffsize[257], *hz;
@@ -438,14 +469,12 @@ static void build_huffman_table(const unsigned char *bits, const unsigned char *
   hz = huffsize;
   for (i=1; i<=16; i++)
    {
-     for (j=1; j<=bits[i]; j++)
+     for (j=1; j<=bits[i] && hz < huffsize+256; j++)
        *hz++ = i;
    }
   *hz = 0;
 
   memset(table->lookup, 0xff, sizeof(table->lookup));
-  for (i=0; i<(16-HUFFMAN_HASH_NBITS); i++)
-    table->slowtable[i][0] = 0;
 
   /* Build a temp array
    *   huffcode[X] => code used to write vals[X]
@@ -457,6 +486,9 @@ static void build_huffman_table(const unsigned char *bits, const unsigned char *
   while (*hz)
    {
      while (*hz == nbits) {
+	/* More codes than fit in nbits, the table would overrun lookup */
+	if (code >= (1U<<nbits))
+	  error("Huffman table has too many codes of %u bits\n", nbits);
 	*hc++ = code++;
 	hz++;
      }
@@ -465,7 +497,7 @@ static void build_huffman_table(const unsigned char *bits, const unsigned char *
    }
 
   /*
-   * Build the lookup table, and the slowtable if needed.
+   * Build the lookup table, and the symbols for the longer codes.
    */
   //next_free_entry = -1;
   for (i=0; huffsize[i]; i++)
@@ -476,7 +508,7 @@ static void build_huffman_table(const unsigned char *bits, const unsigned char *
 
      trace("val=%2.2x code=%8.8x codesize=%2.2d\n", i, code, code_size);
 
-     table->code_size[val] = code_size;
+     table->huffval[i] = val;
      if (code_size <= HUFFMAN_HASH_NBITS)
       {
 	/*
@@ -485,24 +517,54 @@ static void build_huffman_table(const unsigned char *bits, const unsigned char *
 	 */
 	int repeat = 1UL<<(HUFFMAN_HASH_NBITS - code_size);
 	code <<= HUFFMAN_HASH_NBITS - code_size;
-	while ( repeat-- )
+	while ( repeat-- ) {
+	  table->code_size[code] = code_size;
 	  table->lookup[code++] = val;
+	}
 
       }
-     else
+   }
+
+  /*
+   * The range of the codes of each length, codes of one length are consecutive.
+   */
+  for (i=0, nbits=1; nbits<=16; nbits++)
+   {
+     table->maxcode[nbits] = -1;
+     if (bits[nbits] && huffsize[i] == nbits)
       {
-	/* Perhaps sorting the array will be an optimization */
-	uint16_t *slowtable = table->slowtable[code_size-HUFFMAN_HASH_NBITS-1];
-	while(slowtable[0])
-	  slowtable+=2;
-	slowtable[0] = code;
-	slowtable[1] = val;
-	slowtable[2] = 0;
-	/* TODO: NEED TO CHECK FOR AN OVERFLOW OF THE TABLE */
+	table->valoffset[nbits] = i - huffcode[i];
+	while (huffsize[i] == nbits)
+	  i++;
+	table->maxcode[nbits] = huffcode[i-1];
       }
+   }
 
+  /*
+   * An AC symbol is zero run*16 + value bits, if both the code and the value
+   * fit in HUFFMAN_HASH_NBITS the lookup bits decode the whole coefficient.
+   */
+  for (code=0; code<HUFFMAN_HASH_SIZE; code++)
+   {
+     int value, run, size;
+
+     table->fast_ac[code] = 0;
+     if (table->lookup[code] < 0)
+       continue;
+     val = table->lookup[code];
+     run = val >> 4;
+     size = val & 0xf;
+     code_size = table->code_size[code];
+     if (size == 0 || code_size + size > HUFFMAN_HASH_NBITS)
+       continue;
+
+     value = (code >> (HUFFMAN_HASH_NBITS - code_size - size)) & ((1 << size) - 1);
+     if (value < (1 << (size - 1)))
+       value += 1 - (1 << size);
+     table->fast_ac[code] = value*65536 + run*256 + code_size + size;
    }
 
+  return 0;
 }
 
 static void build_default_huffman_tables(struct jdec_private *priv)
@@ -1350,6 +1412,145 @@ static void YCrCB_to_Grey_2x2(struct jdec_private *priv)
 }
 
 
+#if TINYJPEG_SIMD
+
+/*******************************************************************************
+ *
+ * SSE2 versions of the YCrCb -> RGB24/BGR24 conversions
+ *
+ * They do the same fixed point sums as the ones above, on 16 pixels at a
+ * time, so the output is identical. The packs do what clamp() does.
+ * 
+ ******************************************************************************/
+
+#define SCALEBITS       10
+#define ONE_HALF        (1UL << (SCALEBITS-1))
+#define FIX(x)          ((int)((x) * (1UL<<SCALEBITS) + 0.5))
+
+/* Two 16 bit factors, to multiply the pairs of 16 bit values with madd */
+#define FACTORS(a, b)	_mm_set1_epi32((int)(((unsigned)(b) << 16) | ((unsigned)(a) & 0xffff)))
+
+/* One colour of 8 pixels: ((y << SCALEBITS) + chroma pairs * factors + add) >> SCALEBITS */
+static inline __m128i ycc_colour_sse2(__m128i y, __m128i pairs_lo, __m128i pairs_hi, __m128i factors, __m128i add)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_add_epi32(_mm_slli_epi32(_mm_unpacklo_epi16(y, zero), SCALEBITS), _mm_madd_epi16(pairs_lo, factors));
+  __m128i hi = _mm_add_epi32(_mm_slli_epi32(_mm_unpackhi_epi16(y, zero), SCALEBITS), _mm_madd_epi16(pairs_hi, factors));
+  lo = _mm_srai_epi32(_mm_add_epi32(lo, add), SCALEBITS);
+  hi = _mm_srai_epi32(_mm_add_epi32(hi, add), SCALEBITS);
+  return _mm_packs_epi32(lo, hi);
+}
+
+/* R, G and B of 8 pixels, from Y and the chroma less 128, all 16 bits */
+static inline void ycc_to_rgb_8_sse2(__m128i y, __m128i cb, __m128i cr, __m128i *r, __m128i *g, __m128i *b)
+{
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i zero = _mm_setzero_si128();
+
+  /* Chroma paired with 1, so the madd includes ONE_HALF */
+  *r = ycc_colour_sse2(y, _mm_unpacklo_epi16(cr, one), _mm_unpackhi_epi16(cr, one),
+		       FACTORS(FIX(1.40200), ONE_HALF), zero);
+  *b = ycc_colour_sse2(y, _mm_unpacklo_epi16(cb, one), _mm_unpackhi_epi16(cb, one),
+		       FACTORS(FIX(1.77200), ONE_HALF), zero);
+  *g = ycc_colour_sse2(y, _mm_unpacklo_epi16(cb, cr), _mm_unpackhi_epi16(cb, cr),
+		       FACTORS(-FIX(0.34414), -FIX(0.71414)), _mm_set1_epi32(ONE_HALF));
+}
+
+/* 16 pixels from 16 Y, Cb and Cr, written as 3 bytes each in the order given */
+static inline void ycc_to_24_sse2(__m128i y, __m128i cb, __m128i cr, unsigned char *first, unsigned char *second, int bgr)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i offset = _mm_set1_epi16(128);
+  __m128i rlo, glo, blo, rhi, ghi, bhi;
+  union { __m128i v; unsigned char b[16]; } r, g, b, *c0, *c2;
+  int i;
+
+  ycc_to_rgb_8_sse2(_mm_unpacklo_epi8(y, zero),
+		    _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), offset),
+		    _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), offset),
+		    &rlo, &glo, &blo);
+  ycc_to_rgb_8_sse2(_mm_unpackhi_epi8(y, zero),
+		    _mm_sub_epi16(_mm_unpackhi_epi8(cb, zero), offset),
+		    _mm_sub_epi16(_mm_unpackhi_epi8(cr, zero), offset),
+		    &rhi, &ghi, &bhi);
+  r.v = _mm_packus_epi16(rlo, rhi);
+  g.v = _mm_packus_epi16(glo, ghi);
+  b.v = _mm_packus_epi16(blo, bhi);
+
+  c0 = bgr ? &b : &r;
+  c2 = bgr ? &r : &b;
+  for (i=0; i<8; i++) {
+     *first++ = c0->b[i];
+     *first++ = g.b[i];
+     *first++ = c2->b[i];
+  }
+  for (; i<16; i++) {
+     *second++ = c0->b[i];
+     *second++ = g.b[i];
+     *second++ = c2->b[i];
+  }
+}
+
+/*
+ * A whole MCU, as 16 pixel units. In every sampling, unit u is the 16 bytes
+ * of Y from 16*u, which is one row of 16 for 2x1 and 2x2, or two rows of 8
+ * for 1x1 and 1x2. The chroma for it are upsampled to match.
+ */
+static inline void YCrCB_to_24_sse2(struct jdec_private *priv, int hfactor, int vfactor, int bgr)
+{
+  unsigned char *p = priv->plane[0];
+  unsigned int stride = priv->width*3;
+  int u, units = 4*hfactor*vfactor;
+
+  for (u=0; u<units; u++) {
+     __m128i y = _mm_loadu_si128((const __m128i *)(priv->Y + 16*u));
+     __m128i cb, cr;
+     unsigned char *first, *second;
+
+     if (hfactor == 1 && vfactor == 1) {
+	cb = _mm_loadu_si128((const __m128i *)(priv->Cb + 16*u));
+	cr = _mm_loadu_si128((const __m128i *)(priv->Cr + 16*u));
+     } else if (hfactor == 1) {
+	cb = _mm_loadl_epi64((const __m128i *)(priv->Cb + 8*u));
+	cr = _mm_loadl_epi64((const __m128i *)(priv->Cr + 8*u));
+	cb = _mm_unpacklo_epi64(cb, cb);
+	cr = _mm_unpacklo_epi64(cr, cr);
+     } else {
+	int row = vfactor == 1 ? u : u/2;
+	cb = _mm_loadl_epi64((const __m128i *)(priv->Cb + 8*row));
+	cr = _mm_loadl_epi64((const __m128i *)(priv->Cr + 8*row));
+	cb = _mm_unpacklo_epi8(cb, cb);
+	cr = _mm_unpacklo_epi8(cr, cr);
+     }
+
+     if (hfactor == 1) {
+	first = p + 2*u*stride;
+	second = first + stride;
+     } else {
+	first = p + u*stride;
+	second = first + 8*3;
+     }
+     ycc_to_24_sse2(y, cb, cr, first, second, bgr);
+  }
+}
+
+#undef FACTORS
+#undef SCALEBITS
+#undef ONE_HALF
+#undef FIX
+
+static void YCrCB_to_RGB24_1x1_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 1, 1, 0); }
+static void YCrCB_to_RGB24_1x2_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 1, 2, 0); }
+static void YCrCB_to_RGB24_2x1_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 2, 1, 0); }
+static void YCrCB_to_RGB24_2x2_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 2, 2, 0); }
+static void YCrCB_to_BGR24_1x1_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 1, 1, 1); }
+static void YCrCB_to_BGR24_1x2_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 1, 2, 1); }
+static void YCrCB_to_BGR24_2x1_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 2, 1, 1); }
+static void YCrCB_to_BGR24_2x2_sse2(struct jdec_private *priv) { YCrCB_to_24_sse2(priv, 2, 2, 1); }
+
+#endif // TINYJPEG_SIMD
+
+
 /*
  * Decode all the 3 components for 1x1 
  */
@@ -1620,13 +1821,15 @@ static int parse_DQT(struct jdec_private *priv, const unsigned char *stream)
 
   while (stream < dqt_block_end)
    {
+     if (stream + 65 > dqt_block_end)
+       error("DQT marker is too short\n");
      qi = *stream++;
 #if SANITY_CHECK
      if (qi>>4)
        error("16 bits quantization table is not supported\n");
-     if (qi>4)
-       error("No more 4 quantization table is supported (got %d)\n", qi);
 #endif
+     if (qi>=COMPONENTS)
+       error("No more %d quantization table is supported (got %d)\n", COMPONENTS, qi);
      table = priv->Q_tables[qi];
      build_quantization_table(table, stream);
      stream += 64;
@@ -1642,6 +1845,9 @@ static int parse_SOF(struct jdec_private *priv, const unsigned char *stream)
   struct component *c;
 
   trace("> SOF marker\n");
+
+  if (be16_to_cpu(stream) < 8 + 3*COMPONENTS)
+    error("SOF marker is too short\n");
   print_SOF(stream);
 
   height = be16_to_cpu(stream+3);
@@ -1650,10 +1856,12 @@ static int parse_SOF(struct jdec_private *priv, const unsigned char *stream)
 #if SANITY_CHECK
   if (stream[2] != 8)
     error("Precision other than 8 is not supported\n");
-  if (width>JPEG_MAX_WIDTH || height>JPEG_MAX_HEIGHT)
+#endif
+  if (width == 0 || height == 0 || width>JPEG_MAX_WIDTH || height>JPEG_MAX_HEIGHT)
     error("Width and Height (%dx%d) seems suspicious\n", width, height);
   if (nr_components != 3)
     error("We only support YUV images\n");
+#if SANITY_CHECK
   if (height%16)
     error("Height need to be a multiple of 16 (current height is %d)\n", height);
   if (width%16)
@@ -1670,6 +1878,10 @@ static int parse_SOF(struct jdec_private *priv, const unsigned char *stream)
 #endif
      c->Vfactor = sampling_factor&0xf;
      c->Hfactor = sampling_factor>>4;
+     if (c->Vfactor < 1 || c->Vfactor > 2 || c->Hfactor < 1 || c->Hfactor > 2)
+       error("Sampling factor %dx%d is not supported\n", c->Hfactor, c->Vfactor);
+     if (Q_table >= COMPONENTS)
+       error("Quantization table %d is not supported\n", Q_table);
      c->Q_table = priv->Q_tables[Q_table];
      trace("Component:%d  factor:%dx%d  Quantization table:%d\n",
 	 cid, c->Hfactor, c->Hfactor, Q_table );
@@ -1690,20 +1902,20 @@ static int parse_SOS(struct jdec_private *priv, const unsigned char *stream)
 
   trace("> SOS marker\n");
 
-#if SANITY_CHECK
   if (nr_components != 3)
     error("We only support YCbCr image\n");
-#endif
+  if ((unsigned int)be16_to_cpu(stream) < 6 + 2*nr_components)
+    error("SOS marker is too short\n");
 
   stream += 3;
   for (i=0;i<nr_components;i++) {
      cid = *stream++;
      table = *stream++;
+     if ((table&0xf)>=HUFFMAN_TABLES)
+	error("We do not support more than %d AC Huffman table\n", HUFFMAN_TABLES);
+     if ((table>>4)>=HUFFMAN_TABLES)
+	error("We do not support more than %d DC Huffman table\n", HUFFMAN_TABLES);
 #if SANITY_CHECK
-     if ((table&0xf)>=4)
-	error("We do not support more than 2 AC Huffman table\n");
-     if ((table>>4)>=4)
-	error("We do not support more than 2 DC Huffman table\n");
      if (cid != priv->component_infos[i].cid)
         error("SOS cid order (%d:%d) isn't compatible with the SOF marker (%d:%d)\n",
 	      i, cid, i, priv->component_infos[i].cid);
@@ -1734,6 +1946,8 @@ static int parse_DHT(struct jdec_private *priv, const unsigned char *stream)
   trace("> DHT marker (length=%d)\n", length);
 
   while (length>0) {
+     if (length < 17)
+       error("DHT marker is too short\n");
      index = *stream++;
 
      /* We need to calculate the number of bytes 'vals' will takes */
@@ -1743,19 +1957,15 @@ static int parse_DHT(struct jdec_private *priv, const unsigned char *stream)
 	huff_bits[i] = *stream++;
 	count += huff_bits[i];
      }
-#if SANITY_CHECK
-     if (count > 1024)
-       error("No more than 1024 bytes is allowed to describe a huffman table");
+     if (count > 256 || (int)count > length - 17)
+       error("Huffman table has %u symbols, the DHT marker is too short or the table is too big\n", count);
      if ( (index &0xf) >= HUFFMAN_TABLES)
        error("No mode than %d Huffman tables is supported\n", HUFFMAN_TABLES);
      trace("Huffman table %s n%d\n", (index&0xf0)?"AC":"DC", index&0xf);
      trace("Length of the table: %d\n", count);
-#endif
 
-     if (index & 0xf0 )
-       build_huffman_table(huff_bits, stream, &priv->HTAC[index&0xf]);
-     else
-       build_huffman_table(huff_bits, stream, &priv->HTDC[index&0xf]);
+     if (build_huffman_table(huff_bits, stream, (index & 0xf0) ? &priv->HTAC[index&0xf] : &priv->HTDC[index&0xf]) < 0)
+       return -1;
 
      length -= 1;
      length -= 16;
@@ -1817,14 +2027,13 @@ static int find_next_rst_marker(struct jdec_private *priv)
   /* Parse marker */
   while (!rst_marker_found)
    {
-     while (*stream++ != 0xff)
-      {
-	if (stream >= priv->stream_end)
-	  error("EOF while search for a RST marker.");
-      }
+     while (stream < priv->stream_end && *stream++ != 0xff)
+       ;
      /* Skip any padding ff byte (this is normal) */
-     while (*stream == 0xff)
+     while (stream < priv->stream_end && *stream == 0xff)
        stream++;
+     if (stream >= priv->stream_end)
+       error("EOF while search for a RST marker.");
 
      marker = *stream++;
      if ((RST+priv->last_rst_marker_seen) == marker)
@@ -1848,31 +2057,40 @@ static int parse_JFIF(struct jdec_private *priv, const unsigned char *stream)
   int marker;
   int sos_marker_found = 0;
   int dht_marker_found = 0;
+  int sof_marker_found = 0;
   const unsigned char *next_chunck;
 
   /* Parse marker */
   while (!sos_marker_found)
    {
-     if (*stream++ != 0xff)
+     if (stream >= priv->stream_end || *stream++ != 0xff)
        goto bogus_jpeg_format;
      /* Skip any padding ff byte (this is normal) */
-     while (*stream == 0xff)
+     while (stream < priv->stream_end && *stream == 0xff)
        stream++;
 
+     /* The marker and its length, then the whole chunk, must be in the buffer */
+     if (priv->stream_end - stream < 3)
+       goto bogus_jpeg_format;
      marker = *stream++;
      chuck_len = be16_to_cpu(stream);
+     if (chuck_len < 2 || chuck_len > priv->stream_end - stream)
+       goto bogus_jpeg_format;
      next_chunck = stream + chuck_len;
      switch (marker)
       {
        case SOF:
 	 if (parse_SOF(priv, stream) < 0)
 	   return -1;
+	 sof_marker_found = 1;
 	 break;
        case DQT:
 	 if (parse_DQT(priv, stream) < 0)
 	   return -1;
 	 break;
        case SOS:
+	 if (!sof_marker_found)
+	   error("SOS marker before the SOF marker\n");
 	 if (parse_SOS(priv, stream) < 0)
 	   return -1;
 	 sos_marker_found = 1;
@@ -1972,7 +2190,7 @@ int tinyjpeg_parse_header(struct jdec_private *priv, const unsigned char *buf, u
   int ret;
 
   /* Identify the file */
-  if ((buf[0] != 0xFF) || (buf[1] != SOI))
+  if (buf == NULL || size < 4 || (buf[0] != 0xFF) || (buf[1] != SOI))
     error("Not a JPG file ?\n");
 
   priv->stream_begin = buf+2;
@@ -2026,6 +2244,215 @@ static const convert_colorspace_fct convert_colorspace_grey[4] = {
    YCrCB_to_Grey_2x2,
 };
 
+#if TINYJPEG_SIMD
+static const convert_colorspace_fct convert_colorspace_rgb24_sse2[4] = {
+   YCrCB_to_RGB24_1x1_sse2,
+   YCrCB_to_RGB24_1x2_sse2,
+   YCrCB_to_RGB24_2x1_sse2,
+   YCrCB_to_RGB24_2x2_sse2,
+};
+
+static const convert_colorspace_fct convert_colorspace_bgr24_sse2[4] = {
+   YCrCB_to_BGR24_1x1_sse2,
+   YCrCB_to_BGR24_1x2_sse2,
+   YCrCB_to_BGR24_2x1_sse2,
+   YCrCB_to_BGR24_2x2_sse2,
+};
+#endif
+
+/*
+ * Where each MCU goes in the output, and how to decode and convert it
+ */
+struct mcu_layout
+{
+  decode_MCU_fct decode_MCU;
+  convert_colorspace_fct convert_to_pixfmt;
+  unsigned int mcus_per_row, mcu_rows;
+  unsigned int bytes_per_blocklines[3], bytes_per_mcu[3];
+};
+
+/*
+ * Decode the MCUs from first up to last, in the order of the stream.
+ * The stream must be at the start of MCU first, after a resync().
+ */
+static int decode_MCU_range(struct jdec_private *priv, const struct mcu_layout *layout, unsigned int first, unsigned int last)
+{
+  unsigned int mcu, x, y;
+  int i;
+
+  x = first % layout->mcus_per_row;
+  y = first / layout->mcus_per_row;
+  for (i=0; i<COMPONENTS; i++)
+    priv->plane[i] = priv->components[i] + y*layout->bytes_per_blocklines[i] + x*layout->bytes_per_mcu[i];
+
+  for (mcu=first; mcu<last; mcu++)
+   {
+     layout->decode_MCU(priv);
+     layout->convert_to_pixfmt(priv);
+     priv->plane[0] += layout->bytes_per_mcu[0];
+     priv->plane[1] += layout->bytes_per_mcu[1];
+     priv->plane[2] += layout->bytes_per_mcu[2];
+     if (priv->restarts_to_go>0)
+      {
+	priv->restarts_to_go--;
+	if (priv->restarts_to_go == 0)
+	 {
+	   priv->stream -= (priv->nbits_in_reservoir/8);
+	   resync(priv);
+	   if (find_next_rst_marker(priv) < 0)
+	     return -1;
+	 }
+      }
+     if (++x == layout->mcus_per_row)
+      {
+	x = 0;
+	y++;
+	for (i=0; i<COMPONENTS; i++)
+	  priv->plane[i] = priv->components[i] + y*layout->bytes_per_blocklines[i];
+      }
+   }
+
+  return 0;
+}
+
+/*
+ * Find where each restart interval starts in the stream, after the RST
+ * marker that ends the one before. Returns how many were found, which is
+ * less than count if the markers are out of sequence or missing.
+ */
+static unsigned int find_restart_intervals(struct jdec_private *priv, const unsigned char **starts, unsigned int count)
+{
+  const unsigned char *stream = priv->stream;
+  unsigned int found = 0;
+
+  starts[found++] = stream;
+  while (found < count)
+   {
+     stream = (const unsigned char *)memchr(stream, 0xff, priv->stream_end - stream);
+     if (stream == NULL)
+       break;
+     /* Skip any padding ff byte */
+     while (++stream < priv->stream_end && *stream == 0xff)
+       ;
+     if (stream >= priv->stream_end)
+       break;
+     if (*stream == 0x00)
+       continue;	/* A stuffed 0xff in the data */
+     if (*stream != RST + ((found-1) & 7))
+       break;
+     starts[found++] = ++stream;
+   }
+
+  return found;
+}
+
+/*
+ * A share of the restart intervals, decoded on its own copy of the decoder
+ */
+class TinyJpegDecodeWork
+{
+  public:
+    TinyJpegDecodeWork(const struct jdec_private *priv, const struct mcu_layout *layout,
+                       const unsigned char *stream, unsigned int interval,
+                       unsigned int first, unsigned int last,
+                       int *result, PSemaphore *done)
+      : m_layout(layout)
+      , m_first(first)
+      , m_last(last)
+      , m_result(result)
+      , m_done(done)
+    {
+      m_priv = (struct jdec_private *)malloc(sizeof(struct jdec_private));
+      memcpy(m_priv, priv, sizeof(struct jdec_private));
+      m_priv->stream = stream;
+      m_priv->last_rst_marker_seen = interval & 7;
+      resync(m_priv);
+    }
+
+    ~TinyJpegDecodeWork()
+    {
+      free(m_priv);
+    }
+
+    void Work()
+    {
+      *m_result = -1;
+      if (setjmp(m_priv->jump_state) == 0)
+        *m_result = decode_MCU_range(m_priv, m_layout, m_first, m_last);
+      m_done->Signal();
+    }
+
+  protected:
+    struct jdec_private * m_priv;
+    const struct mcu_layout * m_layout;
+    unsigned int m_first;
+    unsigned int m_last;
+    int * m_result;
+    PSemaphore * m_done;
+};
+
+/*
+ * The worker threads are shared by all decoders and kept between frames,
+ * starting threads for each frame would cost more than they save. The pool
+ * is never deleted, as its threads cannot be stopped after PProcess is gone.
+ */
+static PQueuedThreadPool<TinyJpegDecodeWork> & get_decode_pool()
+{
+  static PQueuedThreadPool<TinyJpegDecodeWork> * pool = new PQueuedThreadPool<TinyJpegDecodeWork>(TINYJPEG_MAX_THREADS-1);
+  return *pool;
+}
+
+/*
+ * Each restart interval starts with the DC predictions reset, and is
+ * byte aligned after its RST marker, so the intervals can be decoded in
+ * parallel once the markers are found. This thread does the first share.
+ * Returns 1 if the markers are not as the DRI says, to decode in sequence.
+ */
+static int decode_in_parallel(struct jdec_private *priv, const struct mcu_layout *layout)
+{
+  unsigned int mcus = layout->mcus_per_row * layout->mcu_rows;
+  unsigned int intervals = (mcus + priv->restart_interval - 1) / priv->restart_interval;
+  unsigned int threads = priv->threads < intervals ? priv->threads : intervals;
+  const unsigned char **starts;
+  int results[TINYJPEG_MAX_THREADS];
+  PSemaphore done(0, TINYJPEG_MAX_THREADS);
+  unsigned int i, first, last;
+  int ret;
+
+  starts = (const unsigned char **)malloc(intervals * sizeof(*starts));
+  if (starts == NULL || find_restart_intervals(priv, starts, intervals) < intervals) {
+     free(starts);
+     return 1;
+  }
+
+  for (i=1; i<threads; i++) {
+     first = intervals*i/threads;
+     last = intervals*(i+1)/threads;
+     get_decode_pool().AddWork(new TinyJpegDecodeWork(priv, layout, starts[first], first,
+						      first*priv->restart_interval,
+						      last < intervals ? last*priv->restart_interval : mcus,
+						      &results[i], &done));
+  }
+
+  /* The workers have to be waited for, even if this share fails */
+  last = intervals/threads;
+  if (setjmp(priv->jump_state) == 0)
+    ret = decode_MCU_range(priv, layout, 0, last < intervals ? last*priv->restart_interval : mcus);
+  else
+    ret = -1;
+
+  for (i=1; i<threads; i++) {
+     done.Wait();
+  }
+  for (i=1; i<threads; i++) {
+     if (results[i] < 0)
+       ret = -1;
+  }
+
+  free(starts);
+  return ret;
+}
+
 /**
  * Decode and convert the jpeg image into @pixfmt@ image
  *
@@ -2033,21 +2460,20 @@ static const convert_colorspace_fct convert_colorspace_grey[4] = {
  */
 int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 {
-  unsigned int x, y, xstride_by_mcu, ystride_by_mcu;
-  unsigned int bytes_per_blocklines[3], bytes_per_mcu[3];
-  decode_MCU_fct decode_MCU;
+  unsigned int xstride_by_mcu, ystride_by_mcu;
+  struct mcu_layout layout;
   const decode_MCU_fct *decode_mcu_table;
   const convert_colorspace_fct *colorspace_array_conv;
-  convert_colorspace_fct convert_to_pixfmt;
+  int ret;
 
   if (setjmp(priv->jump_state))
     return -1;
 
   /* To keep gcc happy initialize some array */
-  bytes_per_mcu[1] = 0;
-  bytes_per_mcu[2] = 0;
-  bytes_per_blocklines[1] = 0;
-  bytes_per_blocklines[2] = 0;
+  layout.bytes_per_mcu[1] = 0;
+  layout.bytes_per_mcu[2] = 0;
+  layout.bytes_per_blocklines[1] = 0;
+  layout.bytes_per_blocklines[2] = 0;
 
   decode_mcu_table = decode_mcu_3comp_table;
   switch (pixfmt) {
@@ -2059,28 +2485,36 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	 priv->components[1] = (uint8_t *)malloc(priv->width * priv->height/4);
        if (priv->components[2] == NULL)
 	 priv->components[2] = (uint8_t *)malloc(priv->width * priv->height/4);
-       bytes_per_blocklines[0] = priv->width;
-       bytes_per_blocklines[1] = priv->width/4;
-       bytes_per_blocklines[2] = priv->width/4;
-       bytes_per_mcu[0] = 8;
-       bytes_per_mcu[1] = 4;
-       bytes_per_mcu[2] = 4;
+       layout.bytes_per_blocklines[0] = priv->width;
+       layout.bytes_per_blocklines[1] = priv->width/4;
+       layout.bytes_per_blocklines[2] = priv->width/4;
+       layout.bytes_per_mcu[0] = 8;
+       layout.bytes_per_mcu[1] = 4;
+       layout.bytes_per_mcu[2] = 4;
        break;
 
      case TINYJPEG_FMT_RGB24:
        colorspace_array_conv = convert_colorspace_rgb24;
+#if TINYJPEG_SIMD
+       if (!(priv->flags & TINYJPEG_FLAGS_PLAIN_C))
+	 colorspace_array_conv = convert_colorspace_rgb24_sse2;
+#endif
        if (priv->components[0] == NULL)
 	 priv->components[0] = (uint8_t *)malloc(priv->width * priv->height * 3);
-       bytes_per_blocklines[0] = priv->width * 3;
-       bytes_per_mcu[0] = 3*8;
+       layout.bytes_per_blocklines[0] = priv->width * 3;
+       layout.bytes_per_mcu[0] = 3*8;
        break;
 
      case TINYJPEG_FMT_BGR24:
        colorspace_array_conv = convert_colorspace_bgr24;
+#if TINYJPEG_SIMD
+       if (!(priv->flags & TINYJPEG_FLAGS_PLAIN_C))
+	 colorspace_array_conv = convert_colorspace_bgr24_sse2;
+#endif
        if (priv->components[0] == NULL)
 	 priv->components[0] = (uint8_t *)malloc(priv->width * priv->height * 3);
-       bytes_per_blocklines[0] = priv->width * 3;
-       bytes_per_mcu[0] = 3*8;
+       layout.bytes_per_blocklines[0] = priv->width * 3;
+       layout.bytes_per_mcu[0] = 3*8;
        break;
 
      case TINYJPEG_FMT_GREY:
@@ -2088,8 +2522,8 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
        colorspace_array_conv = convert_colorspace_grey;
        if (priv->components[0] == NULL)
 	 priv->components[0] = (uint8_t *)malloc(priv->width * priv->height);
-       bytes_per_blocklines[0] = priv->width;
-       bytes_per_mcu[0] = 8;
+       layout.bytes_per_blocklines[0] = priv->width;
+       layout.bytes_per_mcu[0] = 8;
        break;
 
      default:
@@ -2097,25 +2531,31 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
        return -1;
   }
 
+  if (priv->components[0] == NULL ||
+      (pixfmt == TINYJPEG_FMT_YUV420P && (priv->components[1] == NULL || priv->components[2] == NULL)))
+    error("Can't allocate memory for the image\n");
+
+  priv->idct = tinyjpeg_select_idct(priv->flags & TINYJPEG_FLAGS_PLAIN_C);
+
   xstride_by_mcu = ystride_by_mcu = 8;
   if ((priv->component_infos[cY].Hfactor | priv->component_infos[cY].Vfactor) == 1) {
-     decode_MCU = decode_mcu_table[0];
-     convert_to_pixfmt = colorspace_array_conv[0];
+     layout.decode_MCU = decode_mcu_table[0];
+     layout.convert_to_pixfmt = colorspace_array_conv[0];
      trace("Use decode 1x1 sampling\n");
   } else if (priv->component_infos[cY].Hfactor == 1) {
-     decode_MCU = decode_mcu_table[1];
-     convert_to_pixfmt = colorspace_array_conv[1];
+     layout.decode_MCU = decode_mcu_table[1];
+     layout.convert_to_pixfmt = colorspace_array_conv[1];
      ystride_by_mcu = 16;
      trace("Use decode 1x2 sampling (not supported)\n");
   } else if (priv->component_infos[cY].Vfactor == 2) {
-     decode_MCU = decode_mcu_table[3];
-     convert_to_pixfmt = colorspace_array_conv[3];
+     layout.decode_MCU = decode_mcu_table[3];
+     layout.convert_to_pixfmt = colorspace_array_conv[3];
      xstride_by_mcu = 16;
      ystride_by_mcu = 16;
      trace("Use decode 2x2 sampling\n");
   } else {
-     decode_MCU = decode_mcu_table[2];
-     convert_to_pixfmt = colorspace_array_conv[2];
+     layout.decode_MCU = decode_mcu_table[2];
+     layout.convert_to_pixfmt = colorspace_array_conv[2];
      xstride_by_mcu = 16;
      trace("Use decode 2x1 sampling\n");
   }
@@ -2123,43 +2563,26 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
   resync(priv);
 
   /* Don't forget to that block can be either 8 or 16 lines */
-  bytes_per_blocklines[0] *= ystride_by_mcu;
-  bytes_per_blocklines[1] *= ystride_by_mcu;
-  bytes_per_blocklines[2] *= ystride_by_mcu;
+  layout.bytes_per_blocklines[0] *= ystride_by_mcu;
+  layout.bytes_per_blocklines[1] *= ystride_by_mcu;
+  layout.bytes_per_blocklines[2] *= ystride_by_mcu;
 
-  bytes_per_mcu[0] *= xstride_by_mcu/8;
-  bytes_per_mcu[1] *= xstride_by_mcu/8;
-  bytes_per_mcu[2] *= xstride_by_mcu/8;
+  layout.bytes_per_mcu[0] *= xstride_by_mcu/8;
+  layout.bytes_per_mcu[1] *= xstride_by_mcu/8;
+  layout.bytes_per_mcu[2] *= xstride_by_mcu/8;
 
   /* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
-  for (y=0; y < priv->height/ystride_by_mcu; y++)
-   {
-     //trace("Decoding row %d\n", y);
-     priv->plane[0] = priv->components[0] + (y * bytes_per_blocklines[0]);
-     priv->plane[1] = priv->components[1] + (y * bytes_per_blocklines[1]);
-     priv->plane[2] = priv->components[2] + (y * bytes_per_blocklines[2]);
-     for (x=0; x < priv->width; x+=xstride_by_mcu)
-      {
-	decode_MCU(priv);
-	convert_to_pixfmt(priv);
-	priv->plane[0] += bytes_per_mcu[0];
-	priv->plane[1] += bytes_per_mcu[1];
-	priv->plane[2] += bytes_per_mcu[2];
-	if (priv->restarts_to_go>0)
-	 {
-	   priv->restarts_to_go--;
-	   if (priv->restarts_to_go == 0)
-	    {
-	      priv->stream -= (priv->nbits_in_reservoir/8);
-	      resync(priv);
-	      if (find_next_rst_marker(priv) < 0)
-		return -1;
-	    }
-	 }
-      }
-   }
+  layout.mcus_per_row = (priv->width + xstride_by_mcu - 1) / xstride_by_mcu;
+  layout.mcu_rows = priv->height / ystride_by_mcu;
+
+  if (priv->threads > 1 && priv->restart_interval > 0) {
+     ret = decode_in_parallel(priv, &layout);
+     if (ret <= 0)
+       return ret;
+     trace("Restart markers not as expected, decoding in sequence\n");
+  }
 
-  return 0;
+  return decode_MCU_range(priv, &layout, 0, layout.mcus_per_row * layout.mcu_rows);
 }
 
 const char *tinyjpeg_get_errorstring(struct jdec_private *priv)
@@ -2178,7 +2601,7 @@ void tinyjpeg_get_size(struct jdec_private *priv, unsigned int *width, unsigned
 int tinyjpeg_get_components(struct jdec_private *priv, unsigned char **components)
 {
   int i;
-  for (i=0; priv->components[i] && i<COMPONENTS; i++)
+  for (i=0; i<COMPONENTS && priv->components[i]; i++)
     components[i] = priv->components[i];
   return 0;
 }
@@ -2200,5 +2623,17 @@ int tinyjpeg_set_flags(struct jdec_private *priv, int flags)
   return oldflags;
 }
 
+/**
+ * Set how many threads may decode a frame. Only images with restart
+ * markers (DRI) can be split, others are always decoded in one thread.
+ * At most TINYJPEG_MAX_THREADS are used.
+ */
+int tinyjpeg_set_threads(struct jdec_private *priv, unsigned int threads)
+{
+  int oldthreads = priv->threads;
+  priv->threads = threads < TINYJPEG_MAX_THREADS ? threads : TINYJPEG_MAX_THREADS;
+  return oldthreads;
+}
+
 #endif // INCLUDE_TINYJPEG
 
@@ -35,8 +35,13 @@
 #ifndef __JPEGDEC_H__
 #define __JPEGDEC_H__
 
-// switch to re-enable TinyJPEG (fix Coverity errors first!)
-//#define INCLUDE_TINYJPEG 1
+#include "ptbuildopts.h"
+
+// TinyJPEG, and the MJPEG/JPEG colour converters using it, are only built
+// with configure --enable-tinyjpeg until the decoder has a clean Coverity run
+#if P_TINYJPEG
+#define INCLUDE_TINYJPEG 1
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,6 +51,7 @@ struct jdec_private;
 
 /* Flags that can be set by any applications */
 #define TINYJPEG_FLAGS_MJPEG_TABLE	(1<<1)
+#define TINYJPEG_FLAGS_PLAIN_C		(1<<2)	/* No SSE2/AVX2 IDCT or colour conversion */
 
 /* Format accepted in outout */
 enum tinyjpeg_fmt {
@@ -65,6 +71,7 @@ void tinyjpeg_get_size(struct jdec_private *priv, unsigned int *width, unsigned
 int tinyjpeg_get_components(struct jdec_private *priv, unsigned char **components);
 int tinyjpeg_set_components(struct jdec_private *priv, unsigned char **components, unsigned int ncomponents);
 int tinyjpeg_set_flags(struct jdec_private *priv, int flags);
+int tinyjpeg_set_threads(struct jdec_private *priv, unsigned int threads);
 
 #ifdef __cplusplus
 }
@@ -197,6 +197,9 @@ class PStandardColourConverter : public PColourConverter
       BYTE *rgb,
       int format
     );
+    bool MJPEGSizeMatches(
+      struct jdec_private *jdec
+    ) const;
 #endif
 };
 
@@ -2683,6 +2686,31 @@ PSTANDARD_COLOUR_CONVERTER(UYV444,YUV420P)
 #if  defined (__GNUC__) || defined (__sun)
 #ifndef P_MACOSX
 #ifdef INCLUDE_TINYJPEG
+/*
+ * Frames with restart markers are decoded by up to this many threads.
+ */
+static unsigned int MJPEGDecodeThreads()
+{
+  static const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  return processors > 4 ? 4 : (processors > 1 ? (unsigned int)processors : 1);
+}
+
+/*
+ * The decoder writes the image at the size in its SOF marker, which must be
+ * the frame size the output buffers were allocated for.
+ */
+bool PStandardColourConverter::MJPEGSizeMatches(struct jdec_private *jdec) const
+{
+  unsigned int width, height;
+  tinyjpeg_get_size(jdec, &width, &height);
+  if (width == srcFrameWidth && height == srcFrameHeight)
+    return true;
+
+  PTRACE(2, "PColCnv\tJpeg error: image is " << width << 'x' << height
+         << ", expected " << srcFrameWidth << 'x' << srcFrameHeight);
+  return false;
+}
+
 /*
  * Convert a MJPEG Buffer to one plane pixel format (RGB24, BGR24, GRAY)
  * image need to be same size.
@@ -2702,12 +2730,17 @@ bool PStandardColourConverter::MJPEGtoXXXSameSize(const BYTE *mjpeg, BYTE *rgb,
      return false;
   }
   tinyjpeg_set_flags(jdec, TINYJPEG_FLAGS_MJPEG_TABLE);
+  tinyjpeg_set_threads(jdec, MJPEGDecodeThreads());
   tinyjpeg_set_components(jdec, components, 1);
   if (tinyjpeg_parse_header(jdec, mjpeg, srcFrameBytes) < 0) {
      PTRACE(2, "PColCnv\tJpeg error: " << tinyjpeg_get_errorstring(jdec));
      free(jdec);
      return false;
   }
+  if (!MJPEGSizeMatches(jdec)) {
+     free(jdec);
+     return false;
+  }
   if (tinyjpeg_decode(jdec, format) < 0) {
      PTRACE(2, "PColCnv\tJpeg error: " << tinyjpeg_get_errorstring(jdec));
      free(jdec);
@@ -2798,12 +2831,17 @@ bool PStandardColourConverter::MJPEGtoYUV420PSameSize(const BYTE *mjpeg, BYTE *y
     return false;
   }
   tinyjpeg_set_flags(jdec, TINYJPEG_FLAGS_MJPEG_TABLE);
+  tinyjpeg_set_threads(jdec, MJPEGDecodeThreads());
   tinyjpeg_set_components(jdec, components, 4);
   if (tinyjpeg_parse_header(jdec, mjpeg, srcFrameBytes) < 0) {
      PTRACE(2, "PColCnv\tJpeg error: " << tinyjpeg_get_errorstring(jdec));
      free(jdec);
      return false;
   }
+  if (!MJPEGSizeMatches(jdec)) {
+     free(jdec);
+     return false;
+  }
   if (tinyjpeg_decode(jdec, TINYJPEG_FMT_YUV420P) < 0) {
      PTRACE(2, "PColCnv\tJpeg error: " << tinyjpeg_get_errorstring(jdec));
      free(jdec);
@@ -2837,7 +2875,8 @@ bool PStandardColourConverter::MJPEGtoYUV420P(const BYTE *mjpeg,
      /* Very not efficient */
      unsigned int frameBytes = srcFrameWidth * srcFrameHeight * 3 / 2;
      BYTE *intermed = intermediateFrameStore.GetPointer(frameBytes);
-     MJPEGtoYUV420PSameSize(mjpeg, intermed);
+     if (MJPEGtoYUV420PSameSize(mjpeg, intermed) == false)
+       return false;
      CopyYUV420P(0, 0, srcFrameWidth, srcFrameHeight, srcFrameWidth, srcFrameHeight, intermed,
                  0, 0, dstFrameWidth, dstFrameHeight, dstFrameWidth, dstFrameHeight, yuv420p,
                      resizeMode);
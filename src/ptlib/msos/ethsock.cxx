@@ -1201,6 +1201,31 @@ PBoolean PEthSocket::Write(const void * data, PINDEX length)
 }
 
 
+PBoolean PEthSocket::ReadFrame(const BYTE * & frame, PINDEX & length)
+{
+  static const PINDEX MaxFrameSize = 1514;
+  if (!Read(m_frameBuffer.GetPointer(MaxFrameSize), MaxFrameSize))
+    return PFalse;
+
+  frame = m_frameBuffer;
+  length = lastReadCount;
+  return PTrue;
+}
+
+
+PBoolean PEthSocket::SetRingSize(PINDEX, PINDEX, PINDEX)
+{
+  // No memory mapped capture ring in the packet driver
+  return PFalse;
+}
+
+
+bool PEthSocket::IsRingMapped() const
+{
+  return false;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 
 PWin32PacketBuffer::PWin32PacketBuffer(PINDEX sz)
@@ -866,6 +866,10 @@ PBoolean PFile::Open(OpenMode mode, int opts)
   if ((opts&Temporary) != 0)
     removeOnClose = PTrue;
 
+  // Text mode translation means buffered data does not map to file offsets
+  if (IsTextFile())
+    m_bufferSize = 0;
+
   int sflags = _SH_DENYNO;
   if ((opts&DenySharedRead) == DenySharedRead)
     sflags = _SH_DENYRD;
@@ -884,6 +888,8 @@ PBoolean PFile::Open(OpenMode mode, int opts)
 
 PBoolean PFile::SetLength(off_t len)
 {
+  if (!FlushBuffer())
+    return PFalse;
   return ConvertOSError(_chsize(GetHandle(), len));
 }
 
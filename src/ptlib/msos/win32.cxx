@@ -242,6 +242,19 @@ PTimeInterval PTimer::Tick()
 }
 
 
+PInt64 PTimer::HighResolutionTick()
+{
+  static LARGE_INTEGER frequency;
+  if (frequency.QuadPart == 0 && !QueryPerformanceFrequency(&frequency))
+    return GetTickCount()*1000000i64;
+
+  LARGE_INTEGER count;
+  QueryPerformanceCounter(&count);
+  return count.QuadPart/frequency.QuadPart*1000000000i64 +
+         count.QuadPart%frequency.QuadPart*1000000000i64/frequency.QuadPart;
+}
+
+
 unsigned PTimer::Resolution()
 {
   LARGE_INTEGER frequency;
@@ -779,6 +792,10 @@ UINT __stdcall PThread::MainFunction(void * threadPtr)
   ::CoUninitialize();
 #endif
 
+#if P_PROFILING
+  PProfiling::Cleanup();
+#endif
+
 #if PTRACING
   PTrace::Cleanup();
 #endif
@@ -320,6 +320,20 @@ PTimeInterval PTimer::Tick()
 }
 
 
+PInt64 PTimer::HighResolutionTick()
+{
+#if defined(_POSIX_MONOTONIC_CLOCK) && !defined(P_MACOSX)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000LL + ts.tv_nsec;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec*1000000000LL + tv.tv_usec*1000LL;
+#endif
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // PDirectory
@@ -767,6 +781,8 @@ PBoolean PFile::Open(OpenMode mode, int opt)
 
 PBoolean PFile::SetLength(off_t len)
 {
+  if (!FlushBuffer())
+    return PFalse;
   return ConvertOSError(ftruncate(GetHandle(), len));
 }
 
@@ -969,6 +985,19 @@ PBoolean PTextFile::ReadLine (PString & str)
     *ptr++ = (char)c;
     if (++len >= str.GetSize())
       ptr = str.GetPointer(len + 100) + len;
+
+    // Scan directly through any read ahead data for the end of line
+    PINDEX available = m_bufferLen - m_bufferPos;
+    if (available > 0) {
+      const char * start = (const char *)(const BYTE *)m_buffer + m_bufferPos;
+      const char * eol = (const char *)memchr(start, '\n', available);
+      PINDEX count = eol != NULL ? eol - start : available;
+      ptr = str.GetPointer(len + count + 100) + len;
+      memcpy(ptr, start, count);
+      ptr += count;
+      len += count;
+      m_bufferPos += count;
+    }
   }
   *ptr = '\0';
   PAssert(str.MakeMinimumSize(), POutOfMemory);
@@ -47,6 +47,12 @@
 #include <termio.h>
 #endif
 
+#if defined(_POSIX_SPAWN) && _POSIX_SPAWN > 0 && !defined(P_VXWORKS) && !defined(P_RTEMS)
+#include <spawn.h>
+#include <vector>
+#define P_HAS_POSIX_SPAWN 1
+#endif
+
 #include "../common/pipechan.cxx"
 
 #if defined(P_MACOSX) && !defined(P_IPHONEOS)
@@ -75,6 +81,30 @@ PPipeChannel::PPipeChannel()
 }
 
 
+static bool CreatePipe(int fds[2], const char * name)
+{
+#if P_HAS_POSIX_SPAWN
+  /* The spawn dup's the child ends onto stdio, so every end can be closed on
+     exec and no pipe leaks into children spawned by other threads. */
+#if defined(P_LINUX) && defined(O_CLOEXEC)
+  if (pipe2(fds, O_CLOEXEC) != 0)
+    return false;
+#else
+  if (pipe(fds) != 0)
+    return false;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+#else
+  if (pipe(fds) != 0)
+    return false;
+#endif
+
+  PX_NewHandle(name, PMAX(fds[0], fds[1]));
+  return true;
+}
+
+
 PBoolean PPipeChannel::PlatformOpen(const PString & subProgram,
                                 const PStringArray & argumentList,
                                 OpenMode mode,
@@ -91,35 +121,122 @@ PBoolean PPipeChannel::PlatformOpen(const PString & subProgram,
   // setup the pipe to the child
   if (mode == ReadOnly)
     toChildPipe[0] = toChildPipe[1] = -1;
-  else {
-    PAssert(pipe(toChildPipe) == 0, POperatingSystemError);
-    PX_NewHandle("PPipeChannel toChildPipe", PMAX(toChildPipe[0], toChildPipe[1]));
-  }
+  else
+    PAssert(CreatePipe(toChildPipe, "PPipeChannel toChildPipe"), POperatingSystemError);
  
   // setup the pipe from the child
   if (mode == WriteOnly || mode == ReadWriteStd)
     fromChildPipe[0] = fromChildPipe[1] = -1;
-  else {
-    PAssert(pipe(fromChildPipe) == 0, POperatingSystemError);
-    PX_NewHandle("PPipeChannel fromChildPipe", PMAX(fromChildPipe[0], fromChildPipe[1]));
-  }
+  else
+    PAssert(CreatePipe(fromChildPipe, "PPipeChannel fromChildPipe"), POperatingSystemError);
 
   if (stderrSeparate)
-    PAssert(pipe(stderrChildPipe) == 0, POperatingSystemError);
-  else {
+    PAssert(CreatePipe(stderrChildPipe, "PPipeChannel stderrChildPipe"), POperatingSystemError);
+  else
     stderrChildPipe[0] = stderrChildPipe[1] = -1;
-    PX_NewHandle("PPipeChannel stderrChildPipe", PMAX(stderrChildPipe[0], stderrChildPipe[1]));
+
+#if P_HAS_POSIX_SPAWN
+  /* Spawning avoids duplicating the page tables of a large, many threaded
+     parent, and the strings are referenced in place rather than copied. */
+  char ** exec_environ = environ;
+  PStringArray environmentStrings;
+  std::vector<char *> environmentPointers;
+  if (environment != NULL && !searchPath) {
+    for (PINDEX i = 0; i < environment->GetSize(); i++) {
+      PString key(environment->GetKeyAt(i));
+      if (key != "PATH")
+        environmentStrings.AppendString(key + '=' + environment->GetDataAt(i));
+    }
+    for (PINDEX i = 0; i < environmentStrings.GetSize(); i++)
+      environmentPointers.push_back(environmentStrings[i].GetPointer());
+    environmentPointers.push_back(NULL);
+    exec_environ = &environmentPointers[0];
   }
 
+  PString title = subProgName.GetTitle();
+  std::vector<char *> args;
+  args.push_back(title.GetPointer());
+  for (PINDEX i = 0; i < argumentList.GetSize(); i++)
+    args.push_back((char *)(const char *)argumentList[i]);
+  args.push_back(NULL);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+
+  // if we need to write to the child, make sure the child's stdin
+  // is redirected
+  if (toChildPipe[0] != -1)
+    posix_spawn_file_actions_adddup2(&actions, toChildPipe[0], STDIN_FILENO);
+  else
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+
+  // if we need to read from the child, make sure the child's stdout
+  // and stderr is redirected
+  if (fromChildPipe[1] != -1) {
+    posix_spawn_file_actions_adddup2(&actions, fromChildPipe[1], STDOUT_FILENO);
+    if (!stderrSeparate)
+      posix_spawn_file_actions_adddup2(&actions, fromChildPipe[1], STDERR_FILENO);
+  }
+  else if (mode != ReadWriteStd) {
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    if (!stderrSeparate)
+      posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+  }
+
+  if (stderrSeparate)
+    posix_spawn_file_actions_adddup2(&actions, stderrChildPipe[1], STDERR_FILENO);
+
+  // Put the child in its own process group so we don't get signals from
+  // our parent's terminal, as the fork path does. The child also starts with
+  // no signals blocked, whatever the mask of the calling thread, and with
+  // the default action for every signal but SIGINT and SIGQUIT. Those keep
+  // the parent's disposition, as posix_spawn cannot ignore them, but the
+  // terminal can no longer send them to the child's process group.
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+  posix_spawnattr_setpgroup(&attributes, 0);
+
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+
+  sigfillset(&signals);
+  sigdelset(&signals, SIGINT);
+  sigdelset(&signals, SIGQUIT);
+  sigdelset(&signals, SIGKILL);
+  sigdelset(&signals, SIGSTOP);
+  posix_spawnattr_setsigdefault(&attributes, &signals);
+
+  pid_t pid;
+  int err;
+  if (searchPath)
+    err = posix_spawnp(&pid, subProgram, &actions, &attributes, &args[0], exec_environ);
+  else
+    err = posix_spawn(&pid, subProgram, &actions, &attributes, &args[0], exec_environ);
+
+  posix_spawnattr_destroy(&attributes);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (err != 0) {
+    PTRACE(2, "PipeChannel\tCould not spawn \"" << subProgram << "\", error=" << err);
+    Close();
+    errno = err;
+    return ConvertOSError(-1);
+  }
+
+  childPid = pid;
+#else
   // Set up new environment if one specified.
   char ** exec_environ = environ;
   if (environment != NULL && !searchPath) {
     exec_environ = (char **)calloc(environment->GetSize()+1, sizeof(char*));
+    PINDEX count = 0;
     for (PINDEX i = 0; i < environment->GetSize(); i++) {
       PString key(environment->GetKeyAt(i));
       if (key != "PATH") {
         PString str = key + '=' + environment->GetDataAt(i);
-        exec_environ[i] = strdup(str);
+        exec_environ[count++] = strdup(str);
       }
     }
   }
@@ -136,124 +253,114 @@ PBoolean PPipeChannel::PlatformOpen(const PString & subProgram,
     return PFalse;
   }
 
-  if (childPid > 0) {
-    // setup the pipe to the child
+  if (childPid == 0) {
+    // the following code is in the child process
+
+    // if we need to write to the child, make sure the child's stdin
+    // is redirected
     if (toChildPipe[0] != -1) {
+      ::close(STDIN_FILENO);
+      if (::dup(toChildPipe[0]) == -1)
+        _exit(2);
       ::close(toChildPipe[0]);
-      toChildPipe[0] = -1;
+      ::close(toChildPipe[1]);  
+    } else {
+      int fd = open("/dev/null", O_RDONLY);
+      PAssertOS(fd >= 0);
+      ::close(STDIN_FILENO);
+      if (::dup(fd) == -1)
+        _exit(2);
+      ::close(fd);
     }
 
+    // if we need to read from the child, make sure the child's stdout
+    // and stderr is redirected
     if (fromChildPipe[1] != -1) {
+      ::close(STDOUT_FILENO);
+      if (::dup(fromChildPipe[1]) == -1)
+        _exit(2);
+      ::close(STDERR_FILENO);
+      if (!stderrSeparate)
+        if (::dup(fromChildPipe[1]) == -1)
+          _exit(2);
       ::close(fromChildPipe[1]);
-      fromChildPipe[1] = -1;
+      ::close(fromChildPipe[0]); 
+    } else if (mode != ReadWriteStd) {
+      int fd = ::open("/dev/null", O_WRONLY);
+      PAssertOS(fd >= 0);
+      ::close(STDOUT_FILENO);
+      // coverity[negative_returns] false positive: PAssertOS() has checked the condition
+      if (::dup(fd) == -1)
+        _exit(2);
+      ::close(STDERR_FILENO);
+      if (!stderrSeparate)
+        if (::dup(fd) == -1)
+          _exit(2);
+      ::close(fd);
     }
- 
-    if (stderrChildPipe[1] != -1) {
+
+    if (stderrSeparate) {
+      // coverity[leaked_handle] false positive: dup() doesn't create file handle when it returns -1
+      if (::dup(stderrChildPipe[1]) == -1)
+        _exit(2);
       ::close(stderrChildPipe[1]);
-      stderrChildPipe[1] = -1;
+      ::close(stderrChildPipe[0]); 
     }
 
-    if (exec_environ != environ)
-      free(exec_environ);
- 
-    os_handle = 0;
-    return PTrue;
+    // set the SIGINT and SIGQUIT to ignore so the child process doesn't
+    // inherit them from the parent
+    signal(SIGINT,  SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    // and set ourselves as out own process group so we don't get signals
+    // from our parent's terminal (hopefully!)
+    PSETPGRP();
+
+    // setup the arguments, not as we are about to execl or exit, we don't
+    // care about memory leaks, they are not real!
+    char ** args = (char **)calloc(argumentList.GetSize()+2, sizeof(char *));
+    args[0] = strdup(subProgName.GetTitle());
+    PINDEX i;
+    for (i = 0; i < argumentList.GetSize(); i++) 
+      args[i+1] = strdup(argumentList[i].GetPointer());
+
+    // run the program
+    execve(subProgram, args, exec_environ);
+
+    _exit(2);
   }
 
-  // the following code is in the child process
+  if (exec_environ != environ) {
+    for (char ** env = exec_environ; *env != NULL; env++)
+      free(*env);
+    free(exec_environ);
+  }
+#endif // P_HAS_POSIX_SPAWN
 
-  // if we need to write to the child, make sure the child's stdin
-  // is redirected
+  // close the child's ends of the pipes
   if (toChildPipe[0] != -1) {
-    ::close(STDIN_FILENO);
-    if (::dup(toChildPipe[0]) == -1) {
-      if (exec_environ != environ)
-        free(exec_environ);
-      return false;
-    }
     ::close(toChildPipe[0]);
-    ::close(toChildPipe[1]);  
-  } else {
-    int fd = open("/dev/null", O_RDONLY);
-    PAssertOS(fd >= 0);
-    ::close(STDIN_FILENO);
-    if (::dup(fd) == -1) {
-      if (exec_environ != environ)
-        free(exec_environ);
-      return false;
-    }
-    ::close(fd);
+    toChildPipe[0] = -1;
   }
 
-  // if we need to read from the child, make sure the child's stdout
-  // and stderr is redirected
   if (fromChildPipe[1] != -1) {
-    ::close(STDOUT_FILENO);
-    if (::dup(fromChildPipe[1]) == -1) {
-      if (exec_environ != environ)
-        free(exec_environ);
-      return false;
-    }
-    ::close(STDERR_FILENO);
-    if (!stderrSeparate)
-      if (::dup(fromChildPipe[1]) == -1) {
-        if (exec_environ != environ)
-          free(exec_environ);
-        return false;
-      }
     ::close(fromChildPipe[1]);
-    ::close(fromChildPipe[0]); 
-  } else if (mode != ReadWriteStd) {
-    int fd = ::open("/dev/null", O_WRONLY);
-    PAssertOS(fd >= 0);
-    ::close(STDOUT_FILENO);
-    // coverity[negative_returns] false positive: PAssertOS() has checked the condition
-    if (::dup(fd) == -1) {
-      if (exec_environ != environ)
-        free(exec_environ);
-      // coverity[leaked_handle] false positive: dup() doesn't create file handle when it returns -1
-      return false;
-    }
-    ::close(STDERR_FILENO);
-    if (!stderrSeparate)
-      if (::dup(fd) == -1)
-        return false;
-    ::close(fd);
+    fromChildPipe[1] = -1;
   }
 
-  if (stderrSeparate) {
-    // coverity[leaked_handle] false positive: dup() doesn't create file handle when it returns -1
-    if (::dup(stderrChildPipe[1]) == -1) {
-      if (exec_environ != environ)
-        free(exec_environ);
-      return false;
-    }
+  if (stderrChildPipe[1] != -1) {
     ::close(stderrChildPipe[1]);
-    ::close(stderrChildPipe[0]); 
+    stderrChildPipe[1] = -1;
   }
 
-  // set the SIGINT and SIGQUIT to ignore so the child process doesn't
-  // inherit them from the parent
-  signal(SIGINT,  SIG_IGN);
-  signal(SIGQUIT, SIG_IGN);
-
-  // and set ourselves as out own process group so we don't get signals
-  // from our parent's terminal (hopefully!)
-  PSETPGRP();
-
-  // setup the arguments, not as we are about to execl or exit, we don't
-  // care about memory leaks, they are not real!
-  char ** args = (char **)calloc(argumentList.GetSize()+2, sizeof(char *));
-  args[0] = strdup(subProgName.GetTitle());
-  PINDEX i;
-  for (i = 0; i < argumentList.GetSize(); i++) 
-    args[i+1] = strdup(argumentList[i].GetPointer());
+  // Non-blocking reads so the read timeout is honoured
+  if (fromChildPipe[0] != -1)
+    fcntl(fromChildPipe[0], F_SETFL, fcntl(fromChildPipe[0], F_GETFL) | O_NONBLOCK);
+  if (stderrChildPipe[0] != -1)
+    fcntl(stderrChildPipe[0], F_SETFL, fcntl(stderrChildPipe[0], F_GETFL) | O_NONBLOCK);
 
-  // run the program
-  execve(subProgram, args, exec_environ);
-
-  _exit(2);
-  return PFalse;
+  os_handle = 0;
+  return PTrue;
 #endif // P_VXWORKS || P_RTEMS
 }
 
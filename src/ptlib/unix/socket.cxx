@@ -82,6 +82,15 @@
 #include <ifaddrs.h>
 #endif
 
+#if defined(P_LINUX)
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#if defined(TPACKET3_HDRLEN) && defined(SO_ATTACH_FILTER)
+#define P_HAS_PACKET_RING 1
+#endif
+#endif
+
 #if defined(P_FREEBSD) || defined(P_OPENBSD) || defined(P_NETBSD) || defined(P_MACOSX) || defined(P_MACOS) || defined(P_QNX)
 #include <sys/sysctl.h>
 #endif
@@ -785,12 +794,34 @@ PEthSocket::PEthSocket(PINDEX, PINDEX, PINDEX)
   filterType = TypeAll;
   fakeMacHeader = PFalse;
   ipppInterface = PFalse;
+
+#if defined(P_LINUX)
+  m_interfaceIndex = 0;
+  m_ringBlockCount = 0;
+  m_ringBlockSize = DefaultRingBlockSize;
+  m_ringTxFrames = 0;
+  m_ring = NULL;
+  m_ringSize = 0;
+  m_rxBlock = 0;
+  m_rxFramesLeft = 0;
+  m_rxFrame = NULL;
+  m_rxBlockHeld = false;
+  m_txRing = NULL;
+  m_txFrameSize = 0;
+  m_txBlockSize = 0;
+  m_txFrameCount = 0;
+  m_txFrame = 0;
+#endif
 }
 
 
 PEthSocket::~PEthSocket()
 {
   Close();
+
+#if P_HAS_PACKET_RING
+  CloseRing();
+#endif
 }
 
 
@@ -835,7 +866,41 @@ PBoolean PEthSocket::Connect(const PString & interfaceName)
 
 PBoolean PEthSocket::OpenSocket()
 {
-#ifdef SOCK_PACKET
+#if P_HAS_PACKET_RING
+  CloseRing();
+
+  /* Create with no protocol so nothing is queued until bound to the one
+     interface, then map the ring and attach the filter before binding. */
+  if (!ConvertOSError(os_handle = os_socket(AF_PACKET, SOCK_RAW, 0)))
+    return PFalse;
+
+  ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, channelName, sizeof(ifr.ifr_name)-1);
+  if (!ConvertOSError(ioctl(os_handle, SIOCGIFINDEX, &ifr))) {
+    os_close();
+    os_handle = -1;
+    return PFalse;
+  }
+  m_interfaceIndex = ifr.ifr_ifindex;
+
+  if (m_ringBlockCount > 0 && !fakeMacHeader && !ipppInterface && !OpenRing()) {
+    PTRACE(2, "PWLib\tCould not map packet ring on " << channelName << ", using socket reads");
+  }
+
+  AttachFilter();
+
+  struct sockaddr_ll addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(filterType);
+  addr.sll_ifindex = m_interfaceIndex;
+  if (!ConvertOSError(bind(os_handle, (struct sockaddr *)&addr, sizeof(addr)))) {
+    os_close();
+    os_handle = -1;
+    return PFalse;
+  }
+#elif defined(SOCK_PACKET)
   if (!ConvertOSError(os_handle = os_socket(AF_INET, SOCK_PACKET, htons(filterType))))
     return PFalse;
 
@@ -859,10 +924,217 @@ PBoolean PEthSocket::OpenSocket()
 PBoolean PEthSocket::Close()
 {
   SetFilter(FilterDirected, filterType);  // Turn off promiscuous mode
+
+  /* The ring is not unmapped until the socket is reopened or destroyed, so
+     a reader thread woken by the close never touches unmapped memory. */
   return PSocket::Close();
 }
 
 
+PBoolean PEthSocket::SetRingSize(PINDEX blockCount, PINDEX blockSize, PINDEX txFrames)
+{
+#if P_HAS_PACKET_RING
+  m_ringBlockCount = blockCount;
+  m_ringBlockSize = blockSize;
+  m_ringTxFrames = txFrames;
+  return PTrue;
+#else
+  return PFalse;
+#endif
+}
+
+
+bool PEthSocket::IsRingMapped() const
+{
+#if P_HAS_PACKET_RING
+  return m_ring != NULL && IsOpen();
+#else
+  return false;
+#endif
+}
+
+
+#if P_HAS_PACKET_RING
+
+// Frames handed to the kernel in the transmit ring start after the header
+static const PINDEX TxDataOffset = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+
+// Time a partially filled receive block waits before being handed to us
+static const unsigned RingBlockTimeout = 10;
+
+
+bool PEthSocket::OpenRing()
+{
+  int version = TPACKET_V3;
+  if (setsockopt(os_handle, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    return false;
+
+  PINDEX pageSize = sysconf(_SC_PAGESIZE);
+
+  // Receive blocks must be a power of two multiple of the page size
+  PINDEX blockSize = pageSize;
+  while (blockSize < m_ringBlockSize)
+    blockSize <<= 1;
+
+  struct tpacket_req3 rx;
+  memset(&rx, 0, sizeof(rx));
+  rx.tp_block_size = blockSize;
+  rx.tp_block_nr = m_ringBlockCount;
+  rx.tp_frame_size = 2048; // Nominal only, TPACKET_V3 packs variable sized frames into blocks
+  rx.tp_frame_nr = blockSize/rx.tp_frame_size*m_ringBlockCount;
+  rx.tp_retire_blk_tov = RingBlockTimeout;
+  if (setsockopt(os_handle, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx)) < 0)
+    return false;
+
+  size_t rxSize = (size_t)blockSize*m_ringBlockCount;
+  size_t txSize = 0;
+
+  struct tpacket_req3 tx;
+  memset(&tx, 0, sizeof(tx));
+  if (m_ringTxFrames > 0) {
+    // Every transmit slot must hold a full frame, as all sends go via the ring
+    ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, channelName, sizeof(ifr.ifr_name)-1);
+    int mtu = ioctl(os_handle, SIOCGIFMTU, &ifr) == 0 ? ifr.ifr_mtu : 1500;
+
+    tx.tp_frame_size = TPACKET_ALIGN(TxDataOffset + 18 + mtu); // MAC header and VLAN tag
+    tx.tp_block_size = (tx.tp_frame_size + pageSize - 1)/pageSize*pageSize;
+    PINDEX framesPerBlock = tx.tp_block_size/tx.tp_frame_size;
+    tx.tp_block_nr = (m_ringTxFrames + framesPerBlock - 1)/framesPerBlock;
+    tx.tp_frame_nr = tx.tp_block_nr*framesPerBlock;
+    if (setsockopt(os_handle, SOL_PACKET, PACKET_TX_RING, &tx, sizeof(tx)) == 0)
+      txSize = (size_t)tx.tp_block_size*tx.tp_block_nr;
+    else {
+      PTRACE(2, "PWLib\tCould not create transmit ring on " << channelName << ", errno=" << errno);
+    }
+  }
+
+  void * ring = mmap(NULL, rxSize + txSize, PROT_READ|PROT_WRITE, MAP_SHARED, os_handle, 0);
+  if (ring == MAP_FAILED) {
+    // Release the kernel side of the rings
+    memset(&rx, 0, sizeof(rx));
+    setsockopt(os_handle, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx));
+    if (txSize > 0)
+      setsockopt(os_handle, SOL_PACKET, PACKET_TX_RING, &rx, sizeof(rx));
+    return false;
+  }
+
+  m_ring = (BYTE *)ring;
+  m_ringSize = rxSize + txSize;
+  m_ringBlockSize = blockSize;
+  m_rxBlock = 0;
+  m_rxFramesLeft = 0;
+  m_rxFrame = NULL;
+  m_rxBlockHeld = false;
+
+  if (txSize > 0) {
+    m_txRing = m_ring + rxSize;
+    m_txFrameSize = tx.tp_frame_size;
+    m_txBlockSize = tx.tp_block_size;
+    m_txFrameCount = tx.tp_frame_nr;
+    m_txFrame = 0;
+  }
+
+  PTRACE(4, "PWLib\tMapped packet ring on " << channelName << ": "
+         << m_ringBlockCount << 'x' << blockSize << " receive, "
+         << m_txFrameCount << 'x' << m_txFrameSize << " transmit");
+  return true;
+}
+
+
+void PEthSocket::CloseRing()
+{
+  if (m_ring != NULL)
+    munmap(m_ring, m_ringSize);
+
+  m_ring = NULL;
+  m_ringSize = 0;
+  m_rxFramesLeft = 0;
+  m_rxFrame = NULL;
+  m_rxBlockHeld = false;
+  m_txRing = NULL;
+  m_txFrameCount = 0;
+}
+
+
+void PEthSocket::ReleaseRingBlock()
+{
+  if (!m_rxBlockHeld)
+    return;
+
+  tpacket_block_desc * block = (tpacket_block_desc *)(m_ring + m_rxBlock*m_ringBlockSize);
+  __sync_synchronize();
+  block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+  m_rxBlockHeld = false;
+  if (++m_rxBlock >= m_ringBlockCount)
+    m_rxBlock = 0;
+}
+
+
+bool PEthSocket::AttachFilter()
+{
+  /* Interfaces without a MAC header cannot be filtered on packet type, and
+     promiscuous mode wants everything, so no program is needed. */
+  if ((filterMask&FilterPromiscuous) != 0 || fakeMacHeader || ipppInterface) {
+    setsockopt(os_handle, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+    return true;
+  }
+
+  static const struct {
+    unsigned mask;
+    unsigned packetType;
+  } PacketTypes[] = {
+    { FilterDirected,                      PACKET_HOST      },
+    { FilterMulticast|FilterAllMulticast,  PACKET_MULTICAST },
+    { FilterBroadcast,                     PACKET_BROADCAST }
+  };
+  static const PINDEX NumPacketTypes = PARRAYSIZE(PacketTypes);
+
+  PINDEX tests = 0;
+  PINDEX i;
+  for (i = 0; i < NumPacketTypes; i++) {
+    if ((filterMask&PacketTypes[i].mask) != 0)
+      tests++;
+  }
+
+  /* Some interfaces, e.g. loopback, have no broadcast address so the kernel
+     does not classify ff-ff-ff-ff-ff-ff as broadcast, check for it directly. */
+  bool checkBroadcast = (filterMask&FilterBroadcast) != 0;
+  PINDEX reject = 1 + tests + (checkBroadcast ? 4 : 0);
+  PINDEX accept = reject + 1;
+
+  // Load packet type, compare against each wanted type, then reject or accept
+  struct sock_filter code[NumPacketTypes+6];
+  PINDEX count = 0;
+  code[count++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, (unsigned)(SKF_AD_OFF+SKF_AD_PKTTYPE));
+  for (i = 0; i < NumPacketTypes; i++) {
+    if ((filterMask&PacketTypes[i].mask) != 0) {
+      code[count] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, PacketTypes[i].packetType, (BYTE)(accept-count-1), 0);
+      count++;
+    }
+  }
+  if (checkBroadcast) {
+    code[count++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 0);
+    code[count] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0xffffffff, 0, (BYTE)(reject-count-1));
+    count++;
+    code[count++] = (struct sock_filter)BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 4);
+    code[count] = (struct sock_filter)BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0xffff, (BYTE)(accept-count-1), 0);
+    count++;
+  }
+  code[count++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0);
+  code[count++] = (struct sock_filter)BPF_STMT(BPF_RET|BPF_K, 0xffffffff);
+
+  struct sock_fprog program;
+  program.len = (unsigned short)count;
+  program.filter = code;
+  return ConvertOSError(setsockopt(os_handle, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)));
+}
+
+#endif // P_HAS_PACKET_RING
+
+
 PBoolean PEthSocket::EnumInterfaces(PINDEX idx, PString & name)
 {
   PUDPSocket ifsock;
@@ -961,10 +1233,22 @@ PBoolean PEthSocket::SetFilter(unsigned filter, WORD type)
     return PFalse;
 
   if (filterType != type) {
+#if P_HAS_PACKET_RING
+    // Rebinding changes the protocol while keeping the ring mapped
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(type);
+    addr.sll_ifindex = m_interfaceIndex;
+    if (!ConvertOSError(bind(os_handle, (struct sockaddr *)&addr, sizeof(addr))))
+      return PFalse;
+    filterType = type;
+#else
     os_close();
     filterType = type;
     if (!OpenSocket())
       return PFalse;
+#endif
   }
 
   ifreq ifr;
@@ -984,7 +1268,11 @@ PBoolean PEthSocket::SetFilter(unsigned filter, WORD type)
 
   filterMask = filter;
 
+#if P_HAS_PACKET_RING
+  return AttachFilter();
+#else
   return PTrue;
+#endif
 }
 
 
@@ -1001,10 +1289,67 @@ PBoolean PEthSocket::ResetAdaptor()
 }
 
 
+PBoolean PEthSocket::ReadFrame(const BYTE * & frame, PINDEX & length)
+{
+#if P_HAS_PACKET_RING
+  if (m_ring != NULL) {
+    lastReadCount = 0;
+
+    while (m_rxFramesLeft == 0) {
+      // Hand the block we finished walking back to the kernel
+      ReleaseRingBlock();
+
+      tpacket_block_desc * block = (tpacket_block_desc *)(m_ring + m_rxBlock*m_ringBlockSize);
+      while ((((volatile tpacket_block_desc *)block)->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+        if (!PXSetIOBlock(PXReadBlock, readTimeout))
+          return PFalse;
+      }
+      __sync_synchronize();
+
+      m_rxBlockHeld = true;
+      m_rxFramesLeft = block->hdr.bh1.num_pkts;
+      m_rxFrame = (BYTE *)block + block->hdr.bh1.offset_to_first_pkt;
+    }
+
+    tpacket3_hdr * hdr = (tpacket3_hdr *)m_rxFrame;
+    frame = m_rxFrame + hdr->tp_mac;
+    length = lastReadCount = hdr->tp_snaplen;
+    m_rxFrame += hdr->tp_next_offset;
+    m_rxFramesLeft--;
+    return PTrue;
+  }
+#endif
+
+  // Big enough for a loopback frame
+  static const PINDEX MaxFrameSize = 65536+64;
+  if (!Read(m_frameBuffer.GetPointer(MaxFrameSize), MaxFrameSize))
+    return PFalse;
+
+  frame = m_frameBuffer;
+  length = lastReadCount;
+  return PTrue;
+}
+
+
 PBoolean PEthSocket::Read(void * buf, PINDEX len)
 {
   static const BYTE macHeader[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0, 0, 0, 8, 0 };
 
+#if P_HAS_PACKET_RING
+  if (m_ring != NULL) {
+    const BYTE * frame;
+    PINDEX length;
+    if (!ReadFrame(frame, length))
+      return PFalse;
+
+    if (length > len)
+      length = len;
+    memcpy(buf, frame, length);
+    lastReadCount = length;
+    return PTrue;
+  }
+#endif
+
   BYTE * bufptr = (BYTE *)buf;
 
   if (fakeMacHeader) {
@@ -1020,13 +1365,19 @@ PBoolean PEthSocket::Read(void * buf, PINDEX len)
   }
 
   for (;;) {
+#if P_HAS_PACKET_RING
+    struct sockaddr_ll from;
+#else
     sockaddr from;
+#endif
     PINDEX fromlen = sizeof(from);
-    if (!os_recvfrom(bufptr, len, 0, &from, &fromlen))
+    if (!os_recvfrom(bufptr, len, 0, (sockaddr *)&from, &fromlen))
       return PFalse;
 
+#if !P_HAS_PACKET_RING
     if (channelName != from.sa_data)
       continue;
+#endif
 
     if (ipppInterface) {
       if (lastReadCount <= 10)
@@ -1048,6 +1399,10 @@ PBoolean PEthSocket::Read(void * buf, PINDEX len)
       break;
     }
 
+#if P_HAS_PACKET_RING
+    // Socket is bound to the interface and the kernel has applied the filter
+    break;
+#else
     if ((filterMask&FilterPromiscuous) != 0)
       break;
 
@@ -1057,6 +1412,7 @@ PBoolean PEthSocket::Read(void * buf, PINDEX len)
     static const Address broadcast;
     if ((filterMask&FilterBroadcast) != 0 && broadcast == bufptr)
       break;
+#endif
   }
 
   return lastReadCount > 0;
@@ -1065,11 +1421,54 @@ PBoolean PEthSocket::Read(void * buf, PINDEX len)
 
 PBoolean PEthSocket::Write(const void * buf, PINDEX len)
 {
+#if P_HAS_PACKET_RING
+  if (m_txRing != NULL) {
+    lastWriteCount = 0;
+
+    if (len > (PINDEX)(m_txFrameSize - TxDataOffset))
+      return SetErrorValues(BufferTooSmall, EMSGSIZE, LastWriteError);
+
+    PINDEX framesPerBlock = m_txBlockSize/m_txFrameSize;
+    tpacket3_hdr * hdr = (tpacket3_hdr *)(m_txRing + m_txFrame/framesPerBlock*m_txBlockSize
+                                                   + m_txFrame%framesPerBlock*m_txFrameSize);
+
+    // Wait for the kernel to finish with the slot from last time around
+    while (((volatile tpacket3_hdr *)hdr)->tp_status != TP_STATUS_AVAILABLE) {
+      if ((hdr->tp_status & TP_STATUS_WRONG_FORMAT) != 0) {
+        hdr->tp_status = TP_STATUS_AVAILABLE;
+        return SetErrorValues(Miscellaneous, EINVAL, LastWriteError);
+      }
+      ::send(os_handle, NULL, 0, MSG_DONTWAIT);
+      if (!PXSetIOBlock(PXWriteBlock, writeTimeout))
+        return PFalse;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy((BYTE *)hdr + TxDataOffset, buf, len);
+    hdr->tp_len = len;
+    __sync_synchronize();
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+    if (++m_txFrame >= m_txFrameCount)
+      m_txFrame = 0;
+
+    // Does not wait, the kernel sends every frame queued in the ring so far
+    if (::send(os_handle, NULL, 0, MSG_DONTWAIT) < 0 && errno != EWOULDBLOCK && errno != ENOBUFS)
+      return ConvertOSError(-1, LastWriteError);
+
+    lastWriteCount = len;
+    return PTrue;
+  }
+
+  // Socket is bound to the interface
+  return os_sendto(buf, len, 0, NULL, 0) && lastWriteCount >= len;
+#else
   sockaddr to;
   to.sa_family = AF_INET;
   strncpy((char *)to.sa_data, channelName, sizeof(to.sa_data)-1);
   to.sa_data[sizeof(to.sa_data)-1] = '\0';
   return os_sendto(buf, len, 0, &to, sizeof(to)) && lastWriteCount >= len;
+#endif
 }
 
 
@@ -550,6 +550,11 @@ void PProcess::PXOnAsyncSignal(int sig)
 
 void PProcess::PXOnSignal(int sig)
 {
+#if P_HEAP_PROFILER && defined(SIGPROF)
+  if (sig == SIGPROF && PHeapProfiler::IsRunning())
+    PHeapProfiler::DumpToFile();
+#endif
+
 #ifdef _DEBUG
 #ifdef SIGNALS_DEBUG
   fprintf(stderr,"\nSYNCSIG<%u>\n",sig);
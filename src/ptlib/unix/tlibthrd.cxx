@@ -168,6 +168,7 @@ static pthread_mutex_t MutexInitialiser = PTHREAD_MUTEX_INITIALIZER;
 void PHouseKeepingThread::Main()
 {
   PProcess & process = PProcess::Current();
+  PTimeInterval lastPoolRelease = PTimer::Tick();
 
   while (!closing) {
     PTimeInterval delay = process.timers.Process();
@@ -176,6 +177,12 @@ void PHouseKeepingThread::Main()
 
     process.breakBlock.Wait(delay);
 
+    // Let idle pool allocators return their free slabs to the system
+    if (PTimer::Tick() - lastPoolRelease > 30000) {
+      PMemoryPool::ReleaseAllMemory();
+      lastPoolRelease = PTimer::Tick();
+    }
+
     process.m_activeThreadMutex.Wait();
     PBoolean found;
     do {